@@ -9,6 +9,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "axfr.h"
 #include "dns.h"
 #include "packet.h"
@@ -18,6 +20,262 @@
 /* draft-ietf-dnsop-rfc2845bis-06, section 5.3.1 says to sign every packet */
 #define AXFR_TSIG_SIGN_EVERY_NTH	0	/* tsig sign every N packets. */
 
+/* a packet of a cached AXFR, the bytes after the question, if any */
+struct axfr_cache_packet {
+	uint8_t* data;
+	uint16_t len;
+	uint16_t ancount;
+};
+
+/*
+ * The packets of an AXFR, or of an IXFR over TCP, without TSIG. The
+ * namedb of a server process does not change, a reload starts new server
+ * processes, so that a completed cache stays valid, and it is kept until
+ * the process exits. The packets depend on the size limit and the space
+ * reserved for EDNS and TSIG, and these are part of the key. An IXFR is
+ * also keyed by the serials it goes from and to.
+ */
+struct axfr_cache {
+	struct axfr_cache* next;
+	zone_type* zone;
+	int ixfr;
+	uint32_t from, to;
+	size_t maxlen, reserved_space;
+	struct axfr_cache_packet* packets;
+	size_t count, capacity;
+	/* bytes used, for axfr-cache-size */
+	size_t size;
+	uint32_t capture;
+};
+
+/* the completed AXFRs of this server process */
+static struct axfr_cache* axfr_cache_list = NULL;
+/* the AXFR that is captured, there is one at a time */
+static struct axfr_cache* axfr_cache_capturing = NULL;
+/* bytes in use by the caches */
+static size_t axfr_cache_total = 0;
+/* the number of the last capture */
+static uint32_t axfr_cache_capture_num = 0;
+
+/* the transfers this server process is sending, for the xfr-out limits */
+static struct query* xfr_out_list = NULL;
+
+/* the client addresses are the same, the port is not compared */
+static int
+xfr_out_same_client(struct query* a, struct query* b)
+{
+	int family = ((struct sockaddr*)&a->client_addr)->sa_family;
+	if(family != ((struct sockaddr*)&b->client_addr)->sa_family)
+		return 0;
+	if(family == AF_INET)
+		return memcmp(&((struct sockaddr_in*)&a->client_addr)->sin_addr,
+			&((struct sockaddr_in*)&b->client_addr)->sin_addr,
+			sizeof(struct in_addr)) == 0;
+#ifdef INET6
+	if(family == AF_INET6)
+		return memcmp(&((struct sockaddr_in6*)&a->client_addr)->sin6_addr,
+			&((struct sockaddr_in6*)&b->client_addr)->sin6_addr,
+			sizeof(struct in6_addr)) == 0;
+#endif
+	return 0;
+}
+
+/* see if the transfer fits in the xfr-out limits, that are for the
+ * transfers of this server process */
+static int
+xfr_out_admit(struct nsd* nsd, struct query* q, struct zone_options* zone)
+{
+	struct query* p;
+	int count = 0, zone_count = 0, client_count = 0;
+	if(nsd->options->xfr_out_limit == 0 &&
+		nsd->options->xfr_out_zone_limit == 0 &&
+		nsd->options->xfr_out_client_limit == 0)
+		return 1;
+	for(p = xfr_out_list; p; p = p->xfr_out_next) {
+		count++;
+		if(p->xfr_out_zone == zone)
+			zone_count++;
+		if(xfr_out_same_client(p, q))
+			client_count++;
+	}
+	if((nsd->options->xfr_out_limit != 0 &&
+		count >= nsd->options->xfr_out_limit) ||
+	   (nsd->options->xfr_out_zone_limit != 0 &&
+		zone_count >= nsd->options->xfr_out_zone_limit) ||
+	   (nsd->options->xfr_out_client_limit != 0 &&
+		client_count >= nsd->options->xfr_out_client_limit)) {
+		if (verbosity >= 2) {
+			char a[128];
+			addr2str(&q->client_addr, a, sizeof(a));
+			VERBOSITY(2, (LOG_INFO, "%s for %s from %s refused, "
+				"%d transfers, %d for zone, %d for client",
+				(q->qtype==TYPE_AXFR?"axfr":"ixfr"),
+				dname_to_string(q->qname, NULL), a, count,
+				zone_count, client_count));
+		}
+		STATUP(nsd, xfr_out_limited);
+		return 0;
+	}
+	return 1;
+}
+
+/* the transfer sends more packets, count it for the xfr-out limits */
+static void
+xfr_out_start(struct query* q, struct zone_options* zone)
+{
+	q->xfr_out_zone = zone;
+	q->xfr_out_prev = NULL;
+	q->xfr_out_next = xfr_out_list;
+	if(xfr_out_list)
+		xfr_out_list->xfr_out_prev = q;
+	xfr_out_list = q;
+}
+
+void
+xfr_out_done(struct query* q)
+{
+	if(!q->xfr_out_zone)
+		return;
+	if(q->xfr_out_prev)
+		q->xfr_out_prev->xfr_out_next = q->xfr_out_next;
+	else	xfr_out_list = q->xfr_out_next;
+	if(q->xfr_out_next)
+		q->xfr_out_next->xfr_out_prev = q->xfr_out_prev;
+	q->xfr_out_zone = NULL;
+	q->xfr_out_prev = NULL;
+	q->xfr_out_next = NULL;
+}
+
+/* find the completed cache for the transfer the query starts */
+static struct axfr_cache*
+axfr_cache_find(struct query* query, zone_type* zone, int ixfr,
+	uint32_t from, uint32_t to)
+{
+	struct axfr_cache* c;
+	for(c = axfr_cache_list; c; c = c->next) {
+		if(c->zone == zone && c->ixfr == ixfr &&
+			c->maxlen == query->maxlen &&
+			c->reserved_space == query->reserved_space &&
+			(!ixfr || (c->from == from && c->to == to)))
+			return c;
+	}
+	return NULL;
+}
+
+static void
+axfr_cache_free(struct axfr_cache* c)
+{
+	size_t i;
+	for(i = 0; i < c->count; i++)
+		free(c->packets[i].data);
+	free(c->packets);
+	axfr_cache_total -= c->size;
+	free(c);
+}
+
+/* start to capture the packets of the transfer the query starts; if
+ * another capture was going on, it is dropped */
+static void
+axfr_cache_capture_start(struct nsd* nsd, struct query* query,
+	zone_type* zone, int ixfr, uint32_t from, uint32_t to)
+{
+	struct axfr_cache* c;
+	if(axfr_cache_capturing) {
+		axfr_cache_free(axfr_cache_capturing);
+		axfr_cache_capturing = NULL;
+	}
+	if(axfr_cache_total + sizeof(*c) > nsd->options->axfr_cache_size)
+		return;
+	c = (struct axfr_cache*)xalloc_zero(sizeof(*c));
+	c->zone = zone;
+	c->ixfr = ixfr;
+	c->from = from;
+	c->to = to;
+	c->maxlen = query->maxlen;
+	c->reserved_space = query->reserved_space;
+	c->size = sizeof(*c);
+	if(++axfr_cache_capture_num == 0)
+		axfr_cache_capture_num = 1;
+	c->capture = axfr_cache_capture_num;
+	axfr_cache_total += c->size;
+	axfr_cache_capturing = c;
+	query->axfr_capture = c->capture;
+}
+
+int
+axfr_cache_lookup(struct nsd* nsd, struct query* query, zone_type* zone,
+	int ixfr, uint32_t from, uint32_t to)
+{
+	query->axfr_cache = axfr_cache_find(query, zone, ixfr, from, to);
+	if(query->axfr_cache)
+		return 1;
+	axfr_cache_capture_start(nsd, query, zone, ixfr, from, to);
+	return 0;
+}
+
+void
+axfr_cache_capture(struct nsd* nsd, struct query* query, size_t start,
+	uint16_t ancount, int done)
+{
+	struct axfr_cache* c = axfr_cache_capturing;
+	size_t len = buffer_position(query->packet) - start;
+	struct axfr_cache_packet* p;
+	if(!c || c->capture != query->axfr_capture) {
+		/* another AXFR took over the capture */
+		query->axfr_capture = 0;
+		return;
+	}
+	if(c->count == c->capacity) {
+		size_t newcap = (c->capacity == 0)?64:c->capacity*2;
+		if(axfr_cache_total + (newcap - c->capacity)*sizeof(*p) + len >
+			nsd->options->axfr_cache_size) {
+			goto drop;
+		}
+		c->packets = (struct axfr_cache_packet*)xrealloc(c->packets,
+			newcap*sizeof(*p));
+		axfr_cache_total += (newcap - c->capacity)*sizeof(*p);
+		c->size += (newcap - c->capacity)*sizeof(*p);
+		c->capacity = newcap;
+	}
+	if(axfr_cache_total + len > nsd->options->axfr_cache_size)
+		goto drop;
+	p = &c->packets[c->count++];
+	p->data = (uint8_t*)xalloc(len?len:1);
+	memcpy(p->data, buffer_at(query->packet, start), len);
+	p->len = (uint16_t)len;
+	p->ancount = ancount;
+	axfr_cache_total += len;
+	c->size += len;
+	if(done) {
+		/* complete, it can be used by other transfers */
+		c->next = axfr_cache_list;
+		axfr_cache_list = c;
+		axfr_cache_capturing = NULL;
+		query->axfr_capture = 0;
+	}
+	return;
+drop:
+	VERBOSITY(3, (LOG_INFO, "%s of zone %s does not fit in the "
+		"axfr-cache-size", (c->ixfr?"ixfr":"axfr"),
+		c->zone->opts->name));
+	axfr_cache_free(c);
+	axfr_cache_capturing = NULL;
+	query->axfr_capture = 0;
+}
+
+uint16_t
+axfr_cache_answer(struct query* query, int* done)
+{
+	struct axfr_cache_packet* p =
+		&query->axfr_cache->packets[query->axfr_cache_packet++];
+	buffer_write(query->packet, p->data, p->len);
+	if(query->axfr_cache_packet == query->axfr_cache->count) {
+		query->tsig_sign_it = 1; /* sign last packet */
+		*done = 1;
+	}
+	return p->ancount;
+}
+
 query_state_type
 query_axfr(struct nsd *nsd, struct query *query, int wstats)
 {
@@ -26,6 +284,7 @@ query_axfr(struct nsd *nsd, struct query *query, int wstats)
 	int exact;
 	int added;
 	uint16_t total_added = 0;
+	size_t start;
 
 	if (query->axfr_is_done)
 		return QUERY_PROCESSED;
@@ -77,6 +336,14 @@ query_axfr(struct nsd *nsd, struct query *query, int wstats)
 			query->tsig_sign_it = 1; /* sign first packet in stream */
 		}
 
+		start = buffer_position(query->packet);
+		if(nsd->options->axfr_cache_size != 0 &&
+			axfr_cache_lookup(nsd, query, query->axfr_zone, 0, 0, 0)) {
+			total_added = axfr_cache_answer(query,
+				&query->axfr_is_done);
+			goto return_answer;
+		}
+
 		query_add_compression_domain(query, qdomain, QHEADERSZ);
 
 		assert(query->axfr_zone->soa_rrset->rr_count == 1);
@@ -98,6 +365,12 @@ query_axfr(struct nsd *nsd, struct query *query, int wstats)
 		buffer_set_limit(query->packet, QHEADERSZ);
 		QDCOUNT_SET(query->packet, 0);
 		query_prepare_response(query);
+		start = buffer_position(query->packet);
+		if(query->axfr_cache) {
+			total_added = axfr_cache_answer(query,
+				&query->axfr_is_done);
+			goto return_answer;
+		}
 	}
 
 	/* Add zone RRs until answer is full.  */
@@ -167,6 +440,9 @@ return_answer:
 	ANCOUNT_SET(query->packet, total_added);
 	NSCOUNT_SET(query->packet, 0);
 	ARCOUNT_SET(query->packet, 0);
+	if(query->axfr_capture)
+		axfr_cache_capture(nsd, query, start, total_added,
+			query->axfr_is_done);
 
 	/* check if it needs tsig signatures */
 	if(query->tsig.status == TSIG_OK) {
@@ -255,6 +531,10 @@ static int axfr_ixfr_can_admit_query(struct nsd* nsd, struct query* q)
 		}
 		return 0;
 	}
+	if(q->tcp && !xfr_out_admit(nsd, q, zone_opt)) {
+		RCODE_SET(q->packet, RCODE_REFUSE);
+		return 0;
+	}
 #ifdef HAVE_SSL
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "%s admitted acl %s %s %s",
 		(q->qtype==TYPE_AXFR?"axfr":"ixfr"),
@@ -289,13 +569,18 @@ static int axfr_ixfr_can_admit_query(struct nsd* nsd, struct query* q)
 query_state_type
 answer_axfr_ixfr(struct nsd *nsd, struct query *q)
 {
+	query_state_type state;
 	/* Is it AXFR? */
 	switch (q->qtype) {
 	case TYPE_AXFR:
 		if (q->tcp) {
 			if(!axfr_ixfr_can_admit_query(nsd, q))
 				return QUERY_PROCESSED;
-			return query_axfr(nsd, q, 1);
+			state = query_axfr(nsd, q, 1);
+			if(state == QUERY_IN_AXFR)
+				xfr_out_start(q, zone_options_find(nsd->options,
+					q->qname));
+			return state;
 		}
 		/* AXFR over UDP queries are discarded. */
 		RCODE_SET(q->packet, RCODE_IMPL);
@@ -312,7 +597,11 @@ answer_axfr_ixfr(struct nsd *nsd, struct query *q)
 			}
 			return QUERY_PROCESSED;
 		}
-		return query_ixfr(nsd, q);
+		state = query_ixfr(nsd, q);
+		if(q->tcp && (state == QUERY_IN_AXFR || state == QUERY_IN_IXFR))
+			xfr_out_start(q, zone_options_find(nsd->options,
+				q->qname));
+		return state;
 	default:
 		return QUERY_DISCARDED;
 	}
@@ -22,4 +22,26 @@
 query_state_type answer_axfr_ixfr(struct nsd *nsd, struct query *q);
 query_state_type query_axfr(struct nsd *nsd, struct query *query, int wstats);
 
+/* the transfer the query sends has ended, or the query is reset, and it
+ * is no longer counted for the xfr-out limits */
+void xfr_out_done(struct query* q);
+
+/*
+ * The packet cache of axfr-cache-size, for AXFR and for IXFR over TCP.
+ * Looks up the packets of the transfer the query starts, for the zone, and
+ * for an IXFR the serials it goes from and to. Returns true if they are
+ * cached, and then axfr_cache_answer puts them in the answers. Otherwise
+ * the packets are captured with axfr_cache_capture, if that is possible.
+ */
+int axfr_cache_lookup(struct nsd* nsd, struct query* query, zone_type* zone,
+	int ixfr, uint32_t from, uint32_t to);
+/* put the next packet from the cache in the answer, returns number of
+ * RRs, and sets done after the last packet */
+uint16_t axfr_cache_answer(struct query* query, int* done);
+/* store the packet of the query, that starts at position start, in the
+ * capture, with done set for the last packet; the capture is dropped if
+ * it does not fit */
+void axfr_cache_capture(struct nsd* nsd, struct query* query, size_t start,
+	uint16_t ancount, int done);
+
 #endif /* AXFR_H */
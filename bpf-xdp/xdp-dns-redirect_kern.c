@@ -0,0 +1,207 @@
+/*
+ * xdp-dns-redirect_kern.c -- XDP program that redirects DNS over UDP
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Compile with: clang -O2 -g -target bpf -c xdp-dns-redirect_kern.c
+ *
+ * Plain (non-fragmented, no VLAN tag) IPv4 and IPv6 UDP packets for the
+ * configured DNS port are redirected to the AF_XDP socket that nsd has
+ * bound to the receive queue. Everything else, and packets for queues
+ * without an AF_XDP socket, is passed on to the kernel network stack, so
+ * that TCP, fragments and other traffic are served by the normal sockets.
+ *
+ * Before the redirect, packets for the DNS port that nsd would discard,
+ * too short for a DNS header or with the QR bit set, are dropped. With a
+ * ratelimit configured, packets from a source prefix over the limit per
+ * second are dropped too, before they use a frame and a server process.
+ * The drops are counted per receive queue, in a map that nsd reads.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+/* the fragment offset and more fragments bits of the IPv4 flags field */
+#define IP_FRAG_MASK 0x3fff
+#define DNS_HEADER_LEN 12
+#define DNS_QR_MASK 0x80
+#define NUM_QUEUES 256
+
+/* AF_XDP sockets, indexed by receive queue, filled in by nsd */
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__uint(max_entries, 256);
+	__type(key, __u32);
+	__type(value, __u32);
+} xsks_map SEC(".maps");
+
+/* the UDP port (host byte order) to redirect, set by nsd on startup */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, __u32);
+} dns_port_map SEC(".maps");
+
+/* the ratelimit, set by nsd on startup, must match xdp-server.c */
+struct xdp_limit_config {
+	/* packets per second from a source prefix, 0 is no limit */
+	__u32 ratelimit;
+	/* the masks of the source prefix, in network byte order */
+	__u32 ip4_mask;
+	__u32 ip6_mask[4];
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct xdp_limit_config);
+} limit_map SEC(".maps");
+
+/* the packets of a source prefix in the current second */
+struct xdp_source {
+	__u32 family;
+	__u32 addr[4];
+};
+struct xdp_source_count {
+	__u64 second;
+	__u32 count;
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 65536);
+	__type(key, struct xdp_source);
+	__type(value, struct xdp_source_count);
+} source_map SEC(".maps");
+
+/* the drops per receive queue, read by nsd, must match xdp-server.c */
+struct xdp_counters {
+	__u64 malformed;
+	__u64 ratelimited;
+};
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, NUM_QUEUES);
+	__type(key, __u32);
+	__type(value, struct xdp_counters);
+} stats_map SEC(".maps");
+
+/* returns 1 if the source is over the ratelimit in this second */
+static __always_inline int
+over_ratelimit(struct xdp_source *src, __u32 ratelimit)
+{
+	__u64 now = bpf_ktime_get_ns() / 1000000000;
+	struct xdp_source_count *c = bpf_map_lookup_elem(&source_map, src);
+	if(!c) {
+		struct xdp_source_count n = { now, 1 };
+		bpf_map_update_elem(&source_map, src, &n, BPF_ANY);
+		return 0;
+	}
+	if(c->second != now) {
+		c->second = now;
+		c->count = 1;
+		return 0;
+	}
+	if(c->count >= ratelimit)
+		return 1;
+	__sync_fetch_and_add(&c->count, 1);
+	return 0;
+}
+
+/* count the dropped packet for the receive queue */
+static __always_inline int
+drop(struct xdp_md *ctx, int ratelimited)
+{
+	__u32 queue = ctx->rx_queue_index;
+	struct xdp_counters *c = bpf_map_lookup_elem(&stats_map, &queue);
+	if(c) {
+		if(ratelimited)
+			__sync_fetch_and_add(&c->ratelimited, 1);
+		else	__sync_fetch_and_add(&c->malformed, 1);
+	}
+	return XDP_DROP;
+}
+
+SEC("xdp")
+int xdp_dns_redirect(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct ethhdr *eth = data;
+	struct udphdr *udp;
+	struct xdp_limit_config *limit;
+	struct xdp_source src;
+	__u8 *dns;
+	__u32 key = 0;
+	__u32 *port;
+
+	__builtin_memset(&src, 0, sizeof(src));
+	limit = bpf_map_lookup_elem(&limit_map, &key);
+	if(!limit)
+		return XDP_PASS;
+
+	if((void*)(eth + 1) > data_end)
+		return XDP_PASS;
+
+	if(eth->h_proto == bpf_htons(ETH_P_IP)) {
+		struct iphdr *ip = (void*)(eth + 1);
+		if((void*)(ip + 1) > data_end)
+			return XDP_PASS;
+		if(ip->ihl != 5 || ip->protocol != IPPROTO_UDP)
+			return XDP_PASS;
+		if((ip->frag_off & bpf_htons(IP_FRAG_MASK)) != 0)
+			return XDP_PASS;
+		src.family = 4;
+		src.addr[0] = ip->saddr & limit->ip4_mask;
+		udp = (void*)(ip + 1);
+	} else if(eth->h_proto == bpf_htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6 = (void*)(eth + 1);
+		if((void*)(ip6 + 1) > data_end)
+			return XDP_PASS;
+		/* extension headers, including fragment headers, are passed */
+		if(ip6->nexthdr != IPPROTO_UDP)
+			return XDP_PASS;
+		src.family = 6;
+		src.addr[0] = ip6->saddr.in6_u.u6_addr32[0] &
+			limit->ip6_mask[0];
+		src.addr[1] = ip6->saddr.in6_u.u6_addr32[1] &
+			limit->ip6_mask[1];
+		src.addr[2] = ip6->saddr.in6_u.u6_addr32[2] &
+			limit->ip6_mask[2];
+		src.addr[3] = ip6->saddr.in6_u.u6_addr32[3] &
+			limit->ip6_mask[3];
+		udp = (void*)(ip6 + 1);
+	} else {
+		return XDP_PASS;
+	}
+	if((void*)(udp + 1) > data_end)
+		return XDP_PASS;
+
+	port = bpf_map_lookup_elem(&dns_port_map, &key);
+	if(!port || *port == 0 || udp->dest != bpf_htons((__u16)*port))
+		return XDP_PASS;
+
+	/* nsd discards these, without a DNS header or not a query */
+	dns = (void*)(udp + 1);
+	if((void*)(dns + DNS_HEADER_LEN) > data_end ||
+		bpf_ntohs(udp->len) < sizeof(*udp) + DNS_HEADER_LEN)
+		return drop(ctx, 0);
+	if(dns[2] & DNS_QR_MASK)
+		return drop(ctx, 0);
+	if(limit->ratelimit && over_ratelimit(&src, limit->ratelimit))
+		return drop(ctx, 1);
+
+	/* if there is no socket on this queue, pass it to the kernel */
+	return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "Dual BSD/GPL";
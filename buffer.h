@@ -126,6 +126,31 @@ buffer_skip(buffer_type *buffer, ssize_t count)
 	buffer->_position += count;
 }
 
+/*
+ * Let the buffer begin COUNT bytes further into its data, without
+ * moving the data. The position and limit stay at the same bytes.
+ * The buffer must not be resized until buffer_unskip_begin undoes this.
+ */
+static inline void
+buffer_skip_begin(buffer_type *buffer, size_t count)
+{
+	assert(count <= buffer->_limit);
+	buffer->_data += count;
+	buffer->_capacity -= count;
+	buffer->_limit -= count;
+	buffer->_position = buffer->_position > count ?
+		buffer->_position - count : 0;
+}
+
+static inline void
+buffer_unskip_begin(buffer_type *buffer, size_t count)
+{
+	buffer->_data -= count;
+	buffer->_capacity += count;
+	buffer->_limit += count;
+	buffer->_position += count;
+}
+
 static inline size_t
 buffer_limit(buffer_type *buffer)
 {
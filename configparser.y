@@ -70,10 +70,21 @@ struct component {
 /* server */
 %token VAR_SERVER
 %token VAR_SERVER_COUNT
+%token VAR_SERVER_COUNT_MIN
+%token VAR_SERVER_COUNT_LOAD
 %token VAR_IP_ADDRESS
 %token VAR_IP_TRANSPARENT
 %token VAR_IP_FREEBIND
 %token VAR_REUSEPORT
+%token VAR_REUSEPORT_STEERING
+%token VAR_UDP_GSO
+%token VAR_BUSY_POLL
+%token VAR_BUSY_POLL_IDLE
+%token VAR_UDP_BATCH_LATENCY
+%token VAR_UDP_DRAIN
+%token VAR_UDP_SHED
+%token VAR_UDP_SHED_DROP
+%token VAR_UDP_SHED_ALLOW
 %token VAR_SEND_BUFFER_SIZE
 %token VAR_RECEIVE_BUFFER_SIZE
 %token VAR_DEBUG_MODE
@@ -102,7 +113,11 @@ struct component {
 %token VAR_NSID
 %token VAR_TCP_COUNT
 %token VAR_TCP_REJECT_OVERFLOW
+%token VAR_TCP_EVICT_IDLE
+%token VAR_TCP_SOURCE_LIMIT
 %token VAR_TCP_QUERY_COUNT
+%token VAR_TCP_PIPELINE
+%token VAR_TCP_ZEROCOPY
 %token VAR_TCP_TIMEOUT
 %token VAR_TCP_MSS
 %token VAR_OUTGOING_TCP_MSS
@@ -114,16 +129,42 @@ struct component {
 %token VAR_LOG_TIME_ISO
 %token VAR_ROUND_ROBIN
 %token VAR_MINIMAL_RESPONSES
+%token VAR_RESPONSE_CACHE_SIZE
+%token VAR_AXFR_CACHE_SIZE
+%token VAR_XFR_OUT_LIMIT
+%token VAR_XFR_OUT_ZONE_LIMIT
+%token VAR_XFR_OUT_CLIENT_LIMIT
+%token VAR_XFR_OUT_RATE
+%token VAR_USE_HUGE_PAGES
+%token VAR_NUMA_INTERLEAVE
+%token VAR_LATENCY_STATISTICS
+%token VAR_QUERY_TRACE
+%token VAR_QUERY_TRACE_MIN
+%token VAR_UDP_QUEUE_STATISTICS
+%token VAR_TOP_STATISTICS
+%token VAR_METRICS_ENABLE
+%token VAR_METRICS_INTERFACE
+%token VAR_METRICS_PORT
+%token VAR_RELOAD_PREWARM
+%token VAR_MEMORY_LOCK
+%token VAR_SOCKET_HANDOFF
 %token VAR_CONFINE_TO_ZONE
 %token VAR_REFUSE_ANY
 %token VAR_RELOAD_CONFIG
 %token VAR_ZONEFILES_CHECK
+%token VAR_ZONEFILES_HASH
+%token VAR_RDATA_DEDUP
+%token VAR_RELOAD_COMPACT
 %token VAR_ZONEFILES_WRITE
+%token VAR_ZONEFILES_WRITE_WORKERS
+%token VAR_ZONEFILES_SYNC
+%token VAR_IXFR_MEMORY_BUDGET
 %token VAR_RRL_SIZE
 %token VAR_RRL_RATELIMIT
 %token VAR_RRL_SLIP
 %token VAR_RRL_IPV4_PREFIX_LENGTH
 %token VAR_RRL_IPV6_PREFIX_LENGTH
+%token VAR_RRL_SHARED_BUCKETS
 %token VAR_RRL_WHITELIST_RATELIMIT
 %token VAR_TLS_SERVICE_KEY
 %token VAR_TLS_SERVICE_PEM
@@ -132,13 +173,28 @@ struct component {
 %token VAR_TLS_AUTH_PORT
 %token VAR_TLS_AUTH_XFR_ONLY
 %token VAR_TLS_CERT_BUNDLE
+%token VAR_TLS_SESSION_TICKET_ROTATE
+%token VAR_TLS_KTLS
+%token VAR_TLS_ASYNC
 %token VAR_PROXY_PROTOCOL_PORT
 %token VAR_CPU_AFFINITY
+%token VAR_CPU_AFFINITY_AUTO
 %token VAR_XFRD_CPU_AFFINITY
 %token <llng> VAR_SERVER_CPU_AFFINITY
 %token VAR_DROP_UPDATES
 %token VAR_XFRD_TCP_MAX
+%token VAR_NOTIFY_COALESCE_TIME
 %token VAR_XFRD_TCP_PIPELINE
+%token VAR_XFRD_UDP_SOCKETS
+%token VAR_XFRD_TCP_PER_PRIMARY
+%token VAR_XFRD_TCP_IDLE
+%token VAR_XFRD_STATE_JOURNAL
+%token VAR_XFRD_XFR_SHM
+%token VAR_XFRD_XFR_COMPRESS
+%token VAR_CATALOG_PRODUCER_BATCH
+%token VAR_XDP_INTERFACE
+%token VAR_XDP_PROGRAM_PATH
+%token VAR_XDP_RATELIMIT
 
 /* dnstap */
 %token VAR_DNSTAP
@@ -156,6 +212,8 @@ struct component {
 %token VAR_DNSTAP_VERSION
 %token VAR_DNSTAP_LOG_AUTH_QUERY_MESSAGES
 %token VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES
+%token VAR_DNSTAP_SAMPLE_RATE
+%token VAR_DNSTAP_FILTER
 
 /* remote-control */
 %token VAR_REMOTE_CONTROL
@@ -210,18 +268,26 @@ struct component {
 %token VAR_IXFR_SIZE
 %token VAR_IXFR_NUMBER
 %token VAR_CREATE_IXFR
+%token VAR_IXFR_BINARY
+%token VAR_IXFR_COMPRESS
+%token VAR_IXFR_CONDENSE
+%token VAR_PRECOMPILE_WIRE
+%token VAR_TRANSFER_PRIORITY
 %token VAR_CATALOG
 %token VAR_CATALOG_MEMBER_PATTERN
+%token VAR_CATALOG_MEMBER_SHARD
 %token VAR_CATALOG_PRODUCER_ZONE
 
 /* zone */
 %token VAR_ZONE
 %token VAR_RRL_WHITELIST
+%token VAR_RRL_TYPE_RATELIMIT
 
 /* socket options */
 %token VAR_SERVERS
 %token VAR_BINDTODEVICE
 %token VAR_SETFIB
+%token VAR_IO_URING
 
 /* verify */
 %token VAR_VERIFY
@@ -281,6 +347,16 @@ server_option:
         yyerror("expected a number greater than zero");
       }
     }
+  | VAR_SERVER_COUNT_MIN number
+    { cfg_parser->opt->server_count_min = (int)$2; }
+  | VAR_SERVER_COUNT_LOAD number
+    {
+      if ($2 > 0) {
+        cfg_parser->opt->server_count_load = (int)$2;
+      } else {
+        yyerror("expected a number greater than zero");
+      }
+    }
   | VAR_IP_TRANSPARENT boolean
     { cfg_parser->opt->ip_transparent = $2; }
   | VAR_IP_FREEBIND boolean
@@ -357,8 +433,16 @@ server_option:
     }
   | VAR_TCP_REJECT_OVERFLOW boolean
     { cfg_parser->opt->tcp_reject_overflow = $2; }
+  | VAR_TCP_EVICT_IDLE boolean
+    { cfg_parser->opt->tcp_evict_idle = $2; }
+  | VAR_TCP_SOURCE_LIMIT number
+    { cfg_parser->opt->tcp_source_limit = (int)$2; }
   | VAR_TCP_QUERY_COUNT number
     { cfg_parser->opt->tcp_query_count = (int)$2; }
+  | VAR_TCP_PIPELINE boolean
+    { cfg_parser->opt->tcp_pipeline = $2; }
+  | VAR_TCP_ZEROCOPY number
+    { cfg_parser->opt->tcp_zerocopy = (int)$2; }
   | VAR_TCP_TIMEOUT number
     { cfg_parser->opt->tcp_timeout = (int)$2; }
   | VAR_TCP_MSS number
@@ -380,6 +464,40 @@ server_option:
     }
   | VAR_REUSEPORT boolean
     { cfg_parser->opt->reuseport = $2; }
+  | VAR_REUSEPORT_STEERING STRING
+    {
+      if(strcmp($2, "no") != 0 && strcmp($2, "cpu") != 0 &&
+         strcmp($2, "prefix") != 0)
+        yyerror("expected no, cpu or prefix");
+      else
+        cfg_parser->opt->reuseport_steering = region_strdup(
+          cfg_parser->opt->region, $2);
+    }
+  | VAR_UDP_GSO boolean
+    { cfg_parser->opt->udp_gso = $2; }
+  | VAR_BUSY_POLL number
+    { cfg_parser->opt->busy_poll = (int)$2; }
+  | VAR_BUSY_POLL_IDLE number
+    { cfg_parser->opt->busy_poll_idle = (int)$2; }
+  | VAR_UDP_BATCH_LATENCY number
+    { cfg_parser->opt->udp_batch_latency = (int)$2; }
+  | VAR_UDP_DRAIN boolean
+    { cfg_parser->opt->udp_drain = $2; }
+  | VAR_UDP_SHED boolean
+    { cfg_parser->opt->udp_shed = $2; }
+  | VAR_UDP_SHED_DROP boolean
+    { cfg_parser->opt->udp_shed_drop = $2; }
+  | VAR_UDP_SHED_ALLOW STRING
+    {
+      acl_options_type *acl = parse_acl_info(cfg_parser->opt->region, $2, "NOKEY");
+      append_acl(&cfg_parser->opt->udp_shed_allow, acl);
+    }
+  | VAR_XDP_INTERFACE STRING
+    { cfg_parser->opt->xdp_interface = region_strdup(cfg_parser->opt->region, $2); }
+  | VAR_XDP_PROGRAM_PATH STRING
+    { cfg_parser->opt->xdp_program_path = region_strdup(cfg_parser->opt->region, $2); }
+  | VAR_XDP_RATELIMIT number
+    { cfg_parser->opt->xdp_ratelimit = (int)$2; }
   | VAR_STATISTICS number
     { cfg_parser->opt->statistics = (int)$2; }
   | VAR_CHROOT STRING
@@ -398,6 +516,8 @@ server_option:
     { cfg_parser->opt->xfrdir = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_XFRD_RELOAD_TIMEOUT number
     { cfg_parser->opt->xfrd_reload_timeout = (int)$2; }
+  | VAR_CATALOG_PRODUCER_BATCH number
+    { cfg_parser->opt->catalog_producer_batch = (int)$2; }
   | VAR_VERBOSITY number
     { cfg_parser->opt->verbosity = (int)$2; }
   | VAR_RRL_SIZE number
@@ -440,6 +560,12 @@ server_option:
       } else {
         cfg_parser->opt->rrl_ipv6_prefix_length = (size_t)$2;
       }
+#endif
+    }
+  | VAR_RRL_SHARED_BUCKETS boolean
+    {
+#ifdef RATELIMIT
+      cfg_parser->opt->rrl_shared_buckets = $2;
 #endif
     }
   | VAR_RRL_WHITELIST_RATELIMIT number
@@ -452,8 +578,30 @@ server_option:
     { cfg_parser->opt->reload_config = $2; }
   | VAR_ZONEFILES_CHECK boolean
     { cfg_parser->opt->zonefiles_check = $2; }
+  | VAR_ZONEFILES_HASH boolean
+    { cfg_parser->opt->zonefiles_hash = $2; }
+  | VAR_RDATA_DEDUP boolean
+    { cfg_parser->opt->rdata_dedup = $2; }
+  | VAR_RELOAD_COMPACT number
+    {
+      if($2 > 100)
+        yyerror("reload-compact is a percentage, 0 to 100");
+      else
+        cfg_parser->opt->reload_compact = (int)$2;
+    }
   | VAR_ZONEFILES_WRITE number
     { cfg_parser->opt->zonefiles_write = (int)$2; }
+  | VAR_ZONEFILES_WRITE_WORKERS number
+    {
+      if($2 < 1)
+        yyerror("expected a number greater than zero");
+      else
+        cfg_parser->opt->zonefiles_write_workers = (int)$2;
+    }
+  | VAR_ZONEFILES_SYNC boolean
+    { cfg_parser->opt->zonefiles_sync = $2; }
+  | VAR_IXFR_MEMORY_BUDGET number
+    { cfg_parser->opt->ixfr_memory_budget = (uint64_t)$2; }
   | VAR_LOG_TIME_ASCII boolean
     {
       cfg_parser->opt->log_time_ascii = $2;
@@ -474,6 +622,55 @@ server_option:
       cfg_parser->opt->minimal_responses = $2;
       minimal_responses = cfg_parser->opt->minimal_responses;
     }
+  | VAR_RESPONSE_CACHE_SIZE number
+    { cfg_parser->opt->response_cache_size = (int)$2; }
+  | VAR_AXFR_CACHE_SIZE number
+    { cfg_parser->opt->axfr_cache_size = (size_t)$2; }
+  | VAR_XFR_OUT_LIMIT number
+    { cfg_parser->opt->xfr_out_limit = (int)$2; }
+  | VAR_XFR_OUT_ZONE_LIMIT number
+    { cfg_parser->opt->xfr_out_zone_limit = (int)$2; }
+  | VAR_XFR_OUT_CLIENT_LIMIT number
+    { cfg_parser->opt->xfr_out_client_limit = (int)$2; }
+  | VAR_XFR_OUT_RATE number
+    { cfg_parser->opt->xfr_out_rate = (uint64_t)$2; }
+  | VAR_USE_HUGE_PAGES boolean
+    { cfg_parser->opt->use_huge_pages = $2; }
+  | VAR_NUMA_INTERLEAVE boolean
+    { cfg_parser->opt->numa_interleave = $2; }
+  | VAR_LATENCY_STATISTICS boolean
+    { cfg_parser->opt->latency_statistics = $2; }
+  | VAR_QUERY_TRACE number
+    { cfg_parser->opt->query_trace = (int)$2; }
+  | VAR_QUERY_TRACE_MIN number
+    { cfg_parser->opt->query_trace_min = (int)$2; }
+  | VAR_UDP_QUEUE_STATISTICS boolean
+    { cfg_parser->opt->udp_queue_statistics = $2; }
+  | VAR_TOP_STATISTICS boolean
+    { cfg_parser->opt->top_statistics = $2; }
+  | VAR_METRICS_ENABLE boolean
+    { cfg_parser->opt->metrics_enable = $2; }
+  | VAR_METRICS_INTERFACE STRING
+    { cfg_parser->opt->metrics_interface = region_strdup(cfg_parser->opt->region, $2); }
+  | VAR_METRICS_PORT number
+    {
+      if($2 == 0 || $2 > 65535)
+        yyerror("metrics-port must be between 1 and 65535");
+      cfg_parser->opt->metrics_port = (int)$2;
+    }
+  | VAR_RELOAD_PREWARM boolean
+    { cfg_parser->opt->reload_prewarm = $2; }
+  | VAR_MEMORY_LOCK STRING
+    {
+      if(strcmp($2, "no") != 0 && strcmp($2, "hot") != 0 &&
+         strcmp($2, "all") != 0)
+        yyerror("expected no, hot or all");
+      else
+        cfg_parser->opt->memory_lock = region_strdup(
+          cfg_parser->opt->region, $2);
+    }
+  | VAR_SOCKET_HANDOFF STRING
+    { cfg_parser->opt->socket_handoff = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_CONFINE_TO_ZONE boolean
     { cfg_parser->opt->confine_to_zone = $2; }
   | VAR_REFUSE_ANY boolean
@@ -508,6 +705,12 @@ server_option:
     }
   | VAR_TLS_CERT_BUNDLE STRING
     { cfg_parser->opt->tls_cert_bundle = region_strdup(cfg_parser->opt->region, $2); }
+  | VAR_TLS_SESSION_TICKET_ROTATE number
+    { cfg_parser->opt->tls_session_ticket_rotate = (int)$2; }
+  | VAR_TLS_KTLS boolean
+    { cfg_parser->opt->tls_ktls = $2; }
+  | VAR_TLS_ASYNC boolean
+    { cfg_parser->opt->tls_async = $2; }
   | VAR_PROXY_PROTOCOL_PORT number
     {
       struct proxy_protocol_port_list* elem = region_alloc_zero(
@@ -556,10 +759,26 @@ server_option:
     { cfg_parser->opt->xfrd_tcp_max = (int)$2; }
   | VAR_XFRD_TCP_PIPELINE number
     { cfg_parser->opt->xfrd_tcp_pipeline = (int)$2; }
+  | VAR_XFRD_UDP_SOCKETS number
+    { cfg_parser->opt->xfrd_udp_sockets = (int)$2; }
+  | VAR_XFRD_TCP_PER_PRIMARY number
+    { cfg_parser->opt->xfrd_tcp_per_primary = (int)$2; }
+  | VAR_XFRD_TCP_IDLE number
+    { cfg_parser->opt->xfrd_tcp_idle = (int)$2; }
+  | VAR_NOTIFY_COALESCE_TIME number
+    { cfg_parser->opt->notify_coalesce_time = (int)$2; }
+  | VAR_XFRD_STATE_JOURNAL number
+    { cfg_parser->opt->xfrd_state_journal = (int)$2; }
+  | VAR_XFRD_XFR_SHM boolean
+    { cfg_parser->opt->xfrd_xfr_shm = $2; }
+  | VAR_XFRD_XFR_COMPRESS boolean
+    { cfg_parser->opt->xfrd_xfr_compress = $2; }
   | VAR_CPU_AFFINITY cpus
     {
       cfg_parser->opt->cpu_affinity = $2;
     }
+  | VAR_CPU_AFFINITY_AUTO boolean
+    { cfg_parser->opt->cpu_affinity_auto = $2; }
   | service_cpu_affinity number
     {
       if($2 < 0) {
@@ -625,6 +844,8 @@ socket_option:
     { cfg_parser->ip->dev = $2; }
   | VAR_SETFIB number
     { cfg_parser->ip->fib = $2; }
+  | VAR_IO_URING boolean
+    { cfg_parser->ip->io_uring = $2; }
   ;
 
 cpus:
@@ -710,6 +931,17 @@ dnstap_option:
     { cfg_parser->opt->dnstap_log_auth_query_messages = $2; }
   | VAR_DNSTAP_LOG_AUTH_RESPONSE_MESSAGES boolean
     { cfg_parser->opt->dnstap_log_auth_response_messages = $2; }
+  | VAR_DNSTAP_SAMPLE_RATE number
+    { cfg_parser->opt->dnstap_sample_rate = (int)$2; }
+  | VAR_DNSTAP_FILTER STRING
+    {
+      struct dnstap_filter* f = dnstap_filter_parse(
+        cfg_parser->opt->region, $2);
+      if(!f)
+        yyerror("cannot parse dnstap-filter");
+      else
+        dnstap_filter_append(cfg_parser->opt, f);
+    }
   ;
 
 remote_control:
@@ -880,6 +1112,8 @@ zone:
         cfg_parser->zone->pattern = cfg_parser->pattern =
           pattern_options_create(cfg_parser->opt->region);
         cfg_parser->zone->pattern->implicit = 1;
+        cfg_parser->zone_pattern = NULL;
+        cfg_parser->zone_has_options = 0;
       }
     zone_block
     {
@@ -888,11 +1122,13 @@ zone:
         yyerror("zone has no name");
       } else if(!nsd_options_insert_zone(cfg_parser->opt, cfg_parser->zone)) {
         yyerror("duplicate zone %s", cfg_parser->zone->name);
-      } else if(!nsd_options_insert_pattern(cfg_parser->opt, cfg_parser->zone->pattern)) {
+      } else if(!config_zone_use_pattern() &&
+                !nsd_options_insert_pattern(cfg_parser->opt, cfg_parser->zone->pattern)) {
         yyerror("duplicate pattern %s", cfg_parser->zone->pattern->pname);
       }
       cfg_parser->pattern = NULL;
       cfg_parser->zone = NULL;
+      cfg_parser->zone_pattern = NULL;
     } ;
 
 zone_block:
@@ -912,7 +1148,9 @@ zone_option:
                     "already exists", $2, pname);
       }
     }
-  | pattern_or_zone_option ;
+  | VAR_INCLUDE_PATTERN STRING
+    { config_zone_include_pattern($2); }
+  | { config_zone_option(); } pattern_or_zone_option ;
 
 pattern:
     VAR_PATTERN
@@ -942,6 +1180,8 @@ pattern_option:
       }
       cfg_parser->pattern->pname = region_strdup(cfg_parser->opt->region, $2);
     }
+  | VAR_INCLUDE_PATTERN STRING
+    { config_apply_pattern(cfg_parser->pattern, $2); }
   | pattern_or_zone_option ;
 
 pattern_or_zone_option:
@@ -949,6 +1189,28 @@ pattern_or_zone_option:
     {
 #ifdef RATELIMIT
       cfg_parser->pattern->rrl_whitelist |= rrlstr2type($2);
+#endif
+    }
+  | VAR_RRL_RATELIMIT number
+    {
+#ifdef RATELIMIT
+      cfg_parser->pattern->rrl_ratelimit = (uint32_t)$2;
+      cfg_parser->pattern->rrl_ratelimit_is_default = 0;
+#endif
+    }
+  | VAR_RRL_TYPE_RATELIMIT STRING number
+    {
+#ifdef RATELIMIT
+      uint16_t c = rrlstr2type($2);
+      int i;
+      if(c == 0) {
+        yyerror("unknown rrl type '%s'", $2);
+      }
+      for(i=0; i<RRL_TYPES; i++) {
+        if((c & (1<<i)))
+          cfg_parser->pattern->rrl_type_ratelimit[i] = (uint32_t)$3;
+      }
+      cfg_parser->pattern->rrl_type_limits |= c;
 #endif
     }
   | VAR_ZONEFILE STRING
@@ -965,8 +1227,6 @@ pattern_or_zone_option:
     }
   | VAR_MULTI_PRIMARY_CHECK boolean
     { cfg_parser->pattern->multi_primary_check = (int)$2; }
-  | VAR_INCLUDE_PATTERN STRING
-    { config_apply_pattern(cfg_parser->pattern, $2); }
   | VAR_REQUEST_XFR STRING STRING
     {
       acl_options_type *acl = parse_acl_info(cfg_parser->opt->region, $2, $3);
@@ -1095,6 +1355,31 @@ pattern_or_zone_option:
       cfg_parser->pattern->create_ixfr = $2;
       cfg_parser->pattern->create_ixfr_is_default = 0;
     }
+  | VAR_IXFR_BINARY boolean
+    {
+      cfg_parser->pattern->ixfr_binary = $2;
+      cfg_parser->pattern->ixfr_binary_is_default = 0;
+    }
+  | VAR_IXFR_COMPRESS boolean
+    {
+      cfg_parser->pattern->ixfr_compress = $2;
+      cfg_parser->pattern->ixfr_compress_is_default = 0;
+    }
+  | VAR_IXFR_CONDENSE boolean
+    {
+      cfg_parser->pattern->ixfr_condense = $2;
+      cfg_parser->pattern->ixfr_condense_is_default = 0;
+    }
+  | VAR_PRECOMPILE_WIRE boolean
+    {
+      cfg_parser->pattern->precompile_wire = $2;
+      cfg_parser->pattern->precompile_wire_is_default = 0;
+    }
+  | VAR_TRANSFER_PRIORITY number
+    {
+      cfg_parser->pattern->transfer_priority = $2;
+      cfg_parser->pattern->transfer_priority_is_default = 0;
+    }
   | VAR_VERIFY_ZONE boolean
     { cfg_parser->pattern->verify_zone = $2; }
   | VAR_VERIFIER command
@@ -1114,6 +1399,29 @@ pattern_or_zone_option:
     { 
       cfg_parser->pattern->catalog_member_pattern = region_strdup(cfg_parser->opt->region, $2); 
     }
+  | VAR_CATALOG_MEMBER_SHARD STRING
+    {
+      unsigned long shard, shards;
+      char *end;
+
+      shard = strtoul($2, &end, 10);
+      if(end == $2 || *end != '/') {
+        yyerror("catalog-member-shard expects <shard>/<shards>, like 0/4");
+      } else {
+        char *str = end + 1;
+        shards = strtoul(str, &end, 10);
+        if(end == str || *end != 0 || shards == 0 || shards > 65535) {
+          yyerror("catalog-member-shard: the number of shards must be "
+                  "between 1 and 65535");
+        } else if(shard >= shards) {
+          yyerror("catalog-member-shard: the shard must be below the "
+                  "number of shards, they count from 0");
+        } else {
+          cfg_parser->pattern->catalog_member_shard = (uint32_t)shard;
+          cfg_parser->pattern->catalog_member_shards = (uint32_t)shards;
+        }
+      }
+    }
   | VAR_CATALOG_PRODUCER_ZONE STRING 
     {
       dname_type *dname;
@@ -12,6 +12,7 @@ _nsdcontrol()
         changezone|\
         delzone|\
         force_transfer|\
+        mem_stats|\
         notify|\
         reload|\
         transfer|\
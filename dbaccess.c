@@ -17,6 +17,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
 
 #include "dns.h"
 #include "namedb.h"
@@ -30,6 +33,10 @@
 #include "nsd.h"
 #include "ixfr.h"
 #include "ixfrcreate.h"
+#include "siphash.h"
+
+/* number of zone files that are read ahead of the one that is parsed */
+#define ZONEFILE_READAHEAD 16
 
 void
 namedb_close(struct namedb* db)
@@ -80,7 +87,12 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->logstr = NULL;
 	zone->mtime.tv_sec = 0;
 	zone->mtime.tv_nsec = 0;
+	zone->content_hash = 0;
 	zone->zonestatid = 0;
+	zone->updated_next = NULL;
+#ifdef RATELIMIT
+	memset(zone->rrl_limit, 0, sizeof(zone->rrl_limit));
+#endif
 	zone->is_secure = 0;
 	zone->is_changed = 0;
 	zone->is_updated = 0;
@@ -119,10 +131,42 @@ namedb_zone_free_filenames(namedb_type *db, zone_type* zone)
 	}
 }
 
+void
+namedb_zone_add_updated(namedb_type* db, zone_type* zone)
+{
+	if(zone->is_updated || zone->is_skipped)
+		return; /* already in the list */
+	zone->updated_next = NULL;
+	if(db->updated_last)
+		db->updated_last->updated_next = zone;
+	else	db->updated_first = zone;
+	db->updated_last = zone;
+}
+
+/* remove the zone from the updated list */
+static void
+namedb_zone_remove_updated(namedb_type* db, zone_type* zone)
+{
+	zone_type* z, *prev = NULL;
+	if(!zone->is_updated && !zone->is_skipped)
+		return;
+	for(z = db->updated_first; z; prev = z, z = z->updated_next) {
+		if(z != zone)
+			continue;
+		if(prev)
+			prev->updated_next = z->updated_next;
+		else	db->updated_first = z->updated_next;
+		if(db->updated_last == z)
+			db->updated_last = prev;
+		return;
+	}
+}
+
 void
 namedb_zone_delete(namedb_type* db, zone_type* zone)
 {
 	/* RRs and UDB and NSEC3 and so on must be already deleted */
+	namedb_zone_remove_updated(db, zone);
 	radix_delete(db->zonetree, zone->node);
 
 	/* see if apex can be deleted */
@@ -172,16 +216,29 @@ namedb_open (struct nsd_options* opt)
 #ifdef USE_MMAP_ALLOC
 	db_region = region_create_custom(mmap_alloc, mmap_free, MMAP_ALLOC_CHUNK_SIZE,
 		MMAP_ALLOC_LARGE_OBJECT_SIZE, MMAP_ALLOC_INITIAL_CLEANUP_SIZE, 1);
-#else /* !USE_MMAP_ALLOC */
-	db_region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
-		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
-#endif /* !USE_MMAP_ALLOC */
+#elif defined(USE_SLAB_ALLOC)
+	db_region = region_create_slab(xalloc, free,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE);
+#else /* !USE_MMAP_ALLOC && !USE_SLAB_ALLOC */
+	if(opt && opt->use_huge_pages)
+		db_region = region_create_custom(huge_alloc, huge_free,
+			HUGE_ALLOC_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+			DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	else	db_region = region_create_custom(xalloc, free,
+			DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+			DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+#endif /* !USE_MMAP_ALLOC && !USE_SLAB_ALLOC */
 	db = (namedb_type *) region_alloc(db_region, sizeof(struct namedb));
 	db->region = db_region;
 	db->domains = domain_table_create(db->region);
 	db->zonetree = radix_tree_create(db->region);
+	db->updated_first = NULL;
+	db->updated_last = NULL;
 	db->diff_skip = 0;
 	db->diff_pos = 0;
+	db->rdata_dedup = NULL;
+	if(opt && opt->rdata_dedup)
+		namedb_rdata_dedup_init(db);
 
 	if (gettimeofday(&(db->diff_timestamp), NULL) != 0) {
 		log_msg(LOG_ERR, "unable to load namedb: cannot initialize timestamp");
@@ -192,6 +249,129 @@ namedb_open (struct nsd_options* opt)
 	return db;
 }
 
+/* copy the rdata of the RR into the db, in one block like
+ * rdata_wireformat_to_rdata_atoms makes, with the domains of the db */
+static rdata_atom_type*
+namedb_copy_rdata(namedb_type* db, rr_type* rr)
+{
+	size_t i, pos = sizeof(rdata_atom_type) * rr->rdata_count;
+	uint8_t* block = (uint8_t*)region_alloc(db->region, rdata_atoms_size(
+		rr->type, rr->rdata_count, rr->rdatas));
+	rdata_atom_type* rdatas = (rdata_atom_type*)block;
+	for(i = 0; i < rr->rdata_count; i++) {
+		size_t size;
+		if(rdata_atom_is_domain(rr->type, i)) {
+			rdatas[i].domain = domain_table_insert(db->domains,
+				domain_dname(rr->rdatas[i].domain));
+			rdatas[i].domain->usage++;
+			continue;
+		}
+		size = sizeof(uint16_t) + rdata_atom_size(rr->rdatas[i]);
+		memcpy(block + pos, rr->rdatas[i].data, size);
+		rdatas[i].data = (uint16_t*)(block + pos);
+		pos += RDATA_ATOM_ALIGN(size);
+	}
+	return namedb_rdata_share(db, rr->type, rr->rdata_count, rdatas);
+}
+
+/* copy the strings of the zone, that are in the region of the db */
+static void
+namedb_copy_zone(namedb_type* db, zone_type* zone, zone_type* from)
+{
+	size_t i;
+	if(from->filename)
+		zone->filename = region_strdup(db->region, from->filename);
+	if(from->includes.count) {
+		zone->includes.paths = region_alloc_array(db->region,
+			from->includes.count, sizeof(*zone->includes.paths));
+		for(i = 0; i < from->includes.count; i++)
+			zone->includes.paths[i] = region_strdup(db->region,
+				from->includes.paths[i]);
+		zone->includes.count = from->includes.count;
+	}
+	if(from->logstr)
+		zone->logstr = region_strdup(db->region, from->logstr);
+	/* the IXFR data is not in the region, it moves to the copy */
+	zone->ixfr = from->ixfr;
+	from->ixfr = NULL;
+	zone->mtime = from->mtime;
+	zone->content_hash = from->content_hash;
+	zone->zonestatid = from->zonestatid;
+#ifdef RATELIMIT
+	memcpy(zone->rrl_limit, from->rrl_limit, sizeof(zone->rrl_limit));
+#endif
+	zone->is_secure = from->is_secure;
+	zone->is_ok = from->is_ok;
+	zone->is_changed = from->is_changed;
+	zone->is_checked = from->is_checked;
+	zone->is_bad = from->is_bad;
+}
+
+struct namedb*
+namedb_copy(struct namedb* from, struct nsd_options* opt)
+{
+	namedb_type* db = namedb_open(opt);
+	struct radnode* n;
+	domain_type* walk;
+	zone_type* last_from = NULL, *last = NULL;
+	if(!db)
+		return NULL;
+	db->diff_timestamp = from->diff_timestamp;
+	db->diff_skip = from->diff_skip;
+	db->diff_pos = from->diff_pos;
+
+	for(n = radix_first(from->zonetree); n; n = radix_next(n)) {
+		zone_type* z = (zone_type*)n->elem;
+		namedb_copy_zone(db, namedb_zone_create(db,
+			domain_dname(z->apex), z->opts), z);
+	}
+
+	/* the domains in order, so that the inserts are next to the
+	 * previous one, and the rrsets of a domain keep their order */
+	for(walk = from->domains->root; walk; walk = domain_next(walk)) {
+		domain_type* domain;
+		rrset_type* rrset;
+		if(!walk->rrsets)
+			continue;
+		domain = domain_table_insert(db->domains, domain_dname(walk));
+		for(rrset = walk->rrsets; rrset; rrset = rrset->next) {
+			rrset_type* r;
+			uint16_t i;
+			if(rrset->zone != last_from) {
+				last_from = rrset->zone;
+				last = namedb_find_zone(db,
+					domain_dname(last_from->apex));
+				assert(last);
+			}
+			r = (rrset_type*)region_alloc(db->region, sizeof(*r));
+			r->zone = last;
+			r->rrs = region_alloc_array(db->region,
+				rrset->rr_count, sizeof(rr_type));
+			r->wire = NULL;
+			r->rr_count = rrset->rr_count;
+			r->type = rrset->type;
+			for(i = 0; i < rrset->rr_count; i++) {
+				r->rrs[i] = rrset->rrs[i];
+				r->rrs[i].owner = domain;
+				r->rrs[i].rdatas = namedb_copy_rdata(db,
+					&rrset->rrs[i]);
+			}
+			domain_add_rrset(domain, r);
+			if(domain == last->apex)
+				apex_rrset_checks(db, r, domain);
+		}
+	}
+
+	for(n = radix_first(db->zonetree); n; n = radix_next(n)) {
+		zone_type* z = (zone_type*)n->elem;
+		zone_wire_build(db, z);
+#ifdef NSEC3
+		prehash_zone_complete(db, z);
+#endif
+	}
+	return db;
+}
+
 /** get the file mtime stat (or nonexist or error) */
 int
 file_get_mtime(const char* file, struct timespec* mtime, int* nonexist)
@@ -215,6 +395,164 @@ file_get_mtime(const char* file, struct timespec* mtime, int* nonexist)
 	return 1;
 }
 
+/* hash the content of the file into hash, with the hash of the files
+ * before it as the key. Returns 0 if the file cannot be read. */
+static int
+file_content_hash(const char* fname, uint64_t* hash)
+{
+#ifdef HAVE_MMAP
+	uint8_t key[16], out[8];
+	struct stat st;
+	void* map = NULL;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if(fd == -1)
+		return 0;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return 0;
+	}
+	if(st.st_size > 0) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0);
+		if(map == MAP_FAILED) {
+			close(fd);
+			return 0;
+		}
+	}
+	memset(key, 0, sizeof(key));
+	memcpy(key, hash, sizeof(*hash));
+	(void)siphash(map?(uint8_t*)map:key, (size_t)st.st_size, key,
+		out, sizeof(out));
+	if(map)
+		munmap(map, (size_t)st.st_size);
+	close(fd);
+	memcpy(hash, out, sizeof(*hash));
+	return 1;
+#else
+	(void)fname; (void)hash;
+	return 0;
+#endif /* HAVE_MMAP */
+}
+
+/*
+ * The files that are included by zonefiles, with their mtime and content
+ * hash. When many zones $INCLUDE the same file, it is looked at once per
+ * pass over the zonefiles, instead of once for every zone.
+ */
+struct include_file {
+	rbnode_type node; /* key is the path */
+	int stat_done, stat_ok, nonexist;
+	struct timespec mtime;
+	int hash_done, hash_ok;
+	uint64_t hash;
+};
+static region_type* include_region = NULL;
+static rbtree_type* include_files = NULL;
+
+static int
+include_file_cmp(const void* a, const void* b)
+{
+	return strcmp((const char*)a, (const char*)b);
+}
+
+/* start to remember the included files, for a pass over the zonefiles */
+static void
+include_files_start(void)
+{
+	include_region = region_create(xalloc, free);
+	include_files = rbtree_create(include_region, include_file_cmp);
+}
+
+/* forget the included files, their content may change after the pass */
+static void
+include_files_end(void)
+{
+	region_destroy(include_region);
+	include_region = NULL;
+	include_files = NULL;
+}
+
+/* the remembered info of the included file, NULL outside a pass */
+static struct include_file*
+include_file_find(const char* path)
+{
+	struct include_file* f;
+	if(!include_files)
+		return NULL;
+	f = (struct include_file*)rbtree_search(include_files, path);
+	if(f)
+		return f;
+	f = region_alloc_zero(include_region, sizeof(*f));
+	f->node.key = region_strdup(include_region, path);
+	rbtree_insert(include_files, &f->node);
+	return f;
+}
+
+/* file_get_mtime for an included file */
+static int
+include_get_mtime(const char* path, struct timespec* mtime, int* nonexist)
+{
+	struct include_file* f = include_file_find(path);
+	if(!f)
+		return file_get_mtime(path, mtime, nonexist);
+	if(!f->stat_done) {
+		f->stat_ok = file_get_mtime(path, &f->mtime, &f->nonexist);
+		f->stat_done = 1;
+	}
+	*mtime = f->mtime;
+	*nonexist = f->nonexist;
+	return f->stat_ok;
+}
+
+/* hash the content of an included file into hash. The file is hashed by
+ * itself, so that the result can be used for every zone that includes
+ * it, and that is hashed into the hash of the files before it. */
+static int
+include_content_hash(const char* path, uint64_t* hash)
+{
+	struct include_file* f = include_file_find(path);
+	uint8_t key[16], out[8];
+	uint64_t h = 0;
+	if(!f) {
+		if(!file_content_hash(path, &h))
+			return 0;
+	} else {
+		if(!f->hash_done) {
+			f->hash = 0;
+			f->hash_ok = file_content_hash(path, &f->hash);
+			f->hash_done = 1;
+		}
+		if(!f->hash_ok)
+			return 0;
+		h = f->hash;
+	}
+	memset(key, 0, sizeof(key));
+	memcpy(key, hash, sizeof(*hash));
+	(void)siphash((uint8_t*)&h, sizeof(h), key, out, sizeof(out));
+	memcpy(hash, out, sizeof(*hash));
+	return 1;
+}
+
+/* hash the content of the zonefile and its includes, for zonefiles-hash.
+ * Returns 0 if they cannot be read. */
+static int
+zonefile_content_hash(struct zone* zone, const char* fname, uint64_t* hash)
+{
+	size_t i;
+	*hash = 0;
+	if(!file_content_hash(fname, hash))
+		return 0;
+	for(i = 0; i < zone->includes.count; i++) {
+		if(!include_content_hash(zone->includes.paths[i], hash))
+			return 0;
+	}
+	if(*hash == 0)
+		*hash = 1; /* 0 is for no hash */
+	return 1;
+}
+
 void
 namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 	udb_ptr* last_task)
@@ -225,6 +563,8 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 	const char* fname;
 	struct ixfr_create* ixfrcr = NULL;
 	int ixfr_create_already_done = 0;
+	uint64_t hash;
+	struct timespec t;
 	if(!nsd->db || !zone || !zone->opts || !zone->opts->pattern->zonefile)
 		return;
 	mtime.tv_sec = 0;
@@ -269,7 +609,7 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 			struct timespec include_mtime;
 			/* one of the includes may have been deleted, changed, etc */
 			for (size_t i=0; i < zone->includes.count; i++) {
-				if (!file_get_mtime(zone->includes.paths[i], &include_mtime, &nonexist)) {
+				if (!include_get_mtime(zone->includes.paths[i], &include_mtime, &nonexist)) {
 					changed = 1;
 				} else if (timespec_compare(&zone_mtime, &include_mtime) < 0) {
 					mtime = include_mtime;
@@ -285,6 +625,16 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 		}
 	}
 
+	if(nsd->options->zonefiles_hash && zone->content_hash != 0 &&
+		zone->filename && strcmp(zone->filename, fname) == 0 &&
+		zonefile_content_hash(zone, fname, &hash) &&
+		hash == zone->content_hash) {
+		VERBOSITY(3, (LOG_INFO, "zonefile %s is not modified, the "
+			"content is the same", fname));
+		zone->mtime = mtime;
+		return;
+	}
+
 	if(ixfr_create_from_difference(zone, fname,
 		&ixfr_create_already_done)) {
 		ixfrcr = ixfr_create_start(zone, fname,
@@ -306,7 +656,11 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 	delete_zone_rrs(nsd->db, zone);
 	VERBOSITY(5, (LOG_INFO, "zone %s zonec_read(%s)",
 		zone->opts->name, fname));
+	if(nsd->reload_stats)
+		reload_stats_elapsed(&t);
 	errors = zonec_read(nsd->db, nsd->db->domains, zone->opts->name, fname, zone);
+	if(nsd->reload_stats)
+		nsd->reload_stats->cur.parse += reload_stats_elapsed(&t);
 	if(errors > 0) {
 		log_msg(LOG_ERR, "zone %s file %s read with %u errors",
 			zone->opts->name, fname, errors);
@@ -329,6 +683,10 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 		zone->is_changed = 0;
 		/* store zone into udb */
 		zone->mtime = mtime;
+		if(nsd->options->zonefiles_hash &&
+			zonefile_content_hash(zone, fname, &hash))
+			zone->content_hash = hash;
+		else	zone->content_hash = 0;
 		if(zone->logstr)
 			region_recycle(nsd->db->region, zone->logstr,
 				strlen(zone->logstr)+1);
@@ -350,8 +708,15 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 	}
 	if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
 #ifdef NSEC3
+	if(nsd->reload_stats)
+		reload_stats_elapsed(&t);
 	prehash_zone_complete(nsd->db, zone);
+	if(nsd->reload_stats)
+		nsd->reload_stats->cur.prehash += reload_stats_elapsed(&t);
 #endif
+	if(nsd->reload_stats)
+		reload_stats_zone_done(nsd->reload_stats, zone);
+	if(taskudb) task_new_zone_mem(taskudb, last_task, zone);
 }
 
 void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
@@ -367,13 +732,47 @@ void namedb_check_zonefile(struct nsd* nsd, udb_base* taskudb,
 	namedb_read_zonefile(nsd, zone, taskudb, last_task);
 }
 
+/** have the kernel read the zonefile of a zone that is new to the
+ * database into the page cache, while earlier zones are parsed */
+static void
+namedb_readahead_zonefile(struct nsd* nsd, struct zone_options* zopt)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	const char* fname;
+	int fd;
+	if(!zopt->pattern->zonefile || namedb_find_zone(nsd->db,
+		(const dname_type*)zopt->node.key))
+		return;
+	fname = config_make_zonefile(zopt, nsd);
+	fd = open(fname, O_RDONLY);
+	if(fd == -1)
+		return;
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+#else
+	(void)nsd; (void)zopt;
+#endif
+}
+
 void namedb_check_zonefiles(struct nsd* nsd, struct nsd_options* opt,
 	udb_base* taskudb, udb_ptr* last_task)
 {
 	struct zone_options* zo;
+	rbnode_type* ahead = rbtree_first(opt->zone_options);
+	int num_ahead = 0;
+	include_files_start();
 	/* check all zones in opt, create if not exist in main db */
 	RBTREE_FOR(zo, struct zone_options*, opt->zone_options) {
+		/* keep the file reads ZONEFILE_READAHEAD zones in front */
+		while(ahead != RBTREE_NULL && num_ahead < ZONEFILE_READAHEAD) {
+			namedb_readahead_zonefile(nsd,
+				(struct zone_options*)ahead);
+			ahead = rbtree_next(ahead);
+			num_ahead++;
+		}
+		num_ahead--;
 		namedb_check_zonefile(nsd, taskudb, last_task, zo);
 		if(nsd->signal_hint_shutdown) break;
 	}
+	include_files_end();
 }
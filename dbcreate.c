@@ -16,6 +16,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif /* HAVE_MMAP */
 
 #include "namedb.h"
 #include "udb.h"
@@ -139,6 +147,8 @@ write_to_zonefile(zone_type* zone, const char* filename, const char* logs)
 			zone->opts->name, filename, strerror(errno));
 		return 0;
 	}
+	/* write in large blocks */
+	(void)setvbuf(out, NULL, _IOFBF, 65536);
 	if(!print_header(zone, out, &now, logs)) {
 		fclose(out);
 		log_msg(LOG_ERR, "There was an error printing "
@@ -210,75 +220,358 @@ create_path_components(const char* path, int* notexist)
 	return 1;
 }
 
-void
-namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt)
+/*
+ * See if the zone has to be written to its zonefile, that is if it has
+ * changed or if the file does not exist. Returns the zone, and its
+ * filename in a static buffer, or NULL.
+ */
+static zone_type*
+zonefile_write_needed(struct nsd* nsd, struct zone_options* zopt,
+	const char** zfile)
 {
-	const char* zfile;
 	int notexist = 0;
 	zone_type* zone;
 	/* if no zone exists, it has no contents or it has no zonefile
 	 * configured, then no need to write data to disk */
 	if(!zopt->pattern->zonefile)
-		return;
+		return NULL;
 	zone = namedb_find_zone(nsd->db, (const dname_type*)zopt->node.key);
 	if(!zone || !zone->apex || !zone->soa_rrset)
-		return;
+		return NULL;
 	/* write if file does not exist, or if changed */
 	/* so, determine filename, create directory components, check exist*/
-	zfile = config_make_zonefile(zopt, nsd);
-	if(!create_path_components(zfile, &notexist)) {
+	*zfile = config_make_zonefile(zopt, nsd);
+	if(!create_path_components(*zfile, &notexist)) {
 		log_msg(LOG_ERR, "could not write zone %s to file %s because "
-			"the path could not be created", zopt->name, zfile);
-		return;
+			"the path could not be created", zopt->name, *zfile);
+		return NULL;
 	}
 
 	/* if not changed, do not write. */
-	if(notexist || zone->is_changed) {
-		char logs[4096];
-		char bakfile[4096];
-		struct timespec mtime;
-		/* write to zfile~ first, then rename if that works */
-		snprintf(bakfile, sizeof(bakfile), "%s~", zfile);
-		if(zone->logstr)
-			strlcpy(logs, zone->logstr, sizeof(logs));
-		else
-			logs[0] = 0;
-		VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
-			zone->opts->name, zfile));
-		if(!write_to_zonefile(zone, bakfile, logs)) {
-			(void)unlink(bakfile); /* delete failed file */
-			return; /* error already printed */
+	if(notexist || zone->is_changed)
+		return zone;
+	return NULL;
+}
+
+/* fsync the file or directory at path, returns 0 on error */
+static int
+zonefile_fsync(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "cannot open %s for fsync: %s", path,
+			strerror(errno));
+		return 0;
+	}
+	if(fsync(fd) == -1) {
+		log_msg(LOG_ERR, "fsync %s failed: %s", path, strerror(errno));
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	return 1;
+}
+
+/* fsync the directory of the file at path, returns 0 on error */
+static int
+zonefile_fsync_dir(const char* path)
+{
+	char dir[4096];
+	char* p;
+	strlcpy(dir, path, sizeof(dir));
+	if(!(p = strrchr(dir, PATHSEP)))
+		return zonefile_fsync(".");
+	if(p == dir)
+		p++;
+	*p = 0;
+	return zonefile_fsync(dir);
+}
+
+/* write the zone to zfile~ and rename that to zfile, returns 0 on error.
+ * With sync the file is on disk before the rename, and the rename is on
+ * disk before return. With defer the zone is written to zfile~ and not
+ * renamed, zonefile_rename_file does that. */
+static int
+zonefile_write_file(zone_type* zone, const char* zfile, int sync, int defer)
+{
+	char logs[4096];
+	char bakfile[4096];
+	/* write to zfile~ first, then rename if that works */
+	snprintf(bakfile, sizeof(bakfile), "%s~", zfile);
+	if(zone->logstr)
+		strlcpy(logs, zone->logstr, sizeof(logs));
+	else
+		logs[0] = 0;
+	VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
+		zone->opts->name, zfile));
+	if(!write_to_zonefile(zone, bakfile, logs)) {
+		(void)unlink(bakfile); /* delete failed file */
+		return 0; /* error already printed */
+	}
+	if(defer)
+		return 1;
+	if(sync && !zonefile_fsync(bakfile)) {
+		(void)unlink(bakfile);
+		return 0;
+	}
+	if(rename(bakfile, zfile) == -1) {
+		log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
+			bakfile, zfile, strerror(errno));
+		(void)unlink(bakfile); /* delete failed file */
+		return 0;
+	}
+	if(sync)
+		(void)zonefile_fsync_dir(zfile);
+	return 1;
+}
+
+/* the zone has been written to zfile, update its state */
+static void
+zonefile_write_done(struct nsd* nsd, zone_type* zone, const char* zfile)
+{
+	struct timespec mtime;
+	int notexist = 0;
+	zone->is_changed = 0;
+	/* fetch the mtime of the just created zonefile so we
+	 * do not waste effort reading it back in */
+	if(!file_get_mtime(zfile, &mtime, &notexist)) {
+		get_time(&mtime);
+	}
+	zone->mtime = mtime;
+	if(zone->filename)
+		region_recycle(nsd->db->region, zone->filename,
+			strlen(zone->filename)+1);
+	zone->filename = region_strdup(nsd->db->region, zfile);
+	if(zone->logstr)
+		region_recycle(nsd->db->region, zone->logstr,
+			strlen(zone->logstr)+1);
+	zone->logstr = NULL;
+	if(zone_is_ixfr_enabled(zone) && zone->ixfr)
+		ixfr_write_to_file(zone, zfile);
+}
+
+void
+namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt)
+{
+	const char* zfile = NULL;
+	zone_type* zone = zonefile_write_needed(nsd, zopt, &zfile);
+	if(zone && zonefile_write_file(zone, zfile,
+		nsd->options->zonefiles_sync, 0))
+		zonefile_write_done(nsd, zone, zfile);
+}
+
+#ifdef HAVE_MMAP
+/* a zone to write with the worker processes */
+struct zonefile_write_job {
+	zone_type* zone;
+	char* zfile;
+};
+
+/*
+ * Write the zonefiles of the jobs with worker processes, job i is written
+ * by worker i%workers, that sets done[i] in a shared mapping when it has
+ * written it. The jobs of a worker that could not be started, or that
+ * failed, are written here. written[i] is set for the jobs that are
+ * written, the caller updates the state of the zones and the IXFR files.
+ */
+static void
+zonefile_write_parallel(struct zonefile_write_job* jobs, uint8_t* written,
+	size_t num, size_t workers, int defer)
+{
+	size_t w, i;
+	pid_t* pids;
+	struct sigaction old_sigchld, dfl_sigchld;
+	uint8_t* done = mmap(NULL, num, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(done == MAP_FAILED) {
+		log_msg(LOG_ERR, "zonefiles write: mmap failed: %s",
+			strerror(errno));
+		for(i = 0; i < num; i++)
+			written[i] = (uint8_t)zonefile_write_file(
+				jobs[i].zone, jobs[i].zfile, 0, defer);
+		return;
+	}
+	memset(done, 0, num);
+	/* the reload ignores SIGCHLD, that would reap the workers before
+	 * their exit status is collected */
+	memset(&dfl_sigchld, 0, sizeof(dfl_sigchld));
+	dfl_sigchld.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &dfl_sigchld, &old_sigchld);
+	pids = xmallocarray(workers, sizeof(pid_t));
+	for(w = 0; w < workers; w++) {
+		pids[w] = fork();
+		if(pids[w] == 0) {
+			for(i = w; i < num; i += workers)
+				done[i] = (uint8_t)zonefile_write_file(
+					jobs[i].zone, jobs[i].zfile, 0, defer);
+			_exit(0);
+		} else if(pids[w] == -1) {
+			log_msg(LOG_ERR, "zonefiles write: fork failed: %s",
+				strerror(errno));
 		}
-		if(rename(bakfile, zfile) == -1) {
-			log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
-				bakfile, zfile, strerror(errno));
-			(void)unlink(bakfile); /* delete failed file */
-			return;
+	}
+	for(w = 0; w < workers; w++) {
+		int status = 0;
+		if(pids[w] != -1) {
+			while(waitpid(pids[w], &status, 0) == -1) {
+				if(errno != EINTR) {
+					log_msg(LOG_ERR, "zonefiles write: "
+						"waitpid failed: %s",
+						strerror(errno));
+					status = -1;
+					break;
+				}
+			}
 		}
-		zone->is_changed = 0;
-		/* fetch the mtime of the just created zonefile so we
-		 * do not waste effort reading it back in */
-		if(!file_get_mtime(zfile, &mtime, &notexist)) {
-			get_time(&mtime);
+		if(pids[w] == -1 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0) {
+			for(i = w; i < num; i += workers)
+				if(!done[i])
+					done[i] = (uint8_t)zonefile_write_file(
+						jobs[i].zone, jobs[i].zfile,
+						0, defer);
 		}
-		zone->mtime = mtime;
-		if(zone->filename)
-			region_recycle(nsd->db->region, zone->filename,
-				strlen(zone->filename)+1);
-		zone->filename = region_strdup(nsd->db->region, zfile);
-		if(zone->logstr)
-			region_recycle(nsd->db->region, zone->logstr,
-				strlen(zone->logstr)+1);
-		zone->logstr = NULL;
-		if(zone_is_ixfr_enabled(zone) && zone->ixfr)
-			ixfr_write_to_file(zone, zfile);
 	}
+	free(pids);
+	sigaction(SIGCHLD, &old_sigchld, NULL);
+	memcpy(written, done, num);
+	munmap(done, num);
 }
 
+/*
+ * Group commit of the zonefiles written to zfile~: the file systems that
+ * they are on are synced once, then they are renamed, and the file systems
+ * are synced once more for the renames. That is two syncs per file system
+ * for the batch, instead of two fsyncs for every zone. Without syncfs, it
+ * syncs all file systems.
+ */
+static void
+zonefile_commit_group(struct zonefile_write_job* jobs, uint8_t* written,
+	size_t num)
+{
+	dev_t* devs = xmallocarray(num, sizeof(dev_t));
+	char** paths = xmallocarray(num, sizeof(char*));
+	char bakfile[4096];
+	size_t i, j, ndev = 0;
+	struct stat st;
+	int pass;
+
+	for(i = 0; i < num; i++) {
+		if(!written[i])
+			continue;
+		snprintf(bakfile, sizeof(bakfile), "%s~", jobs[i].zfile);
+		if(stat(bakfile, &st) == -1) {
+			log_msg(LOG_ERR, "cannot stat %s: %s", bakfile,
+				strerror(errno));
+			written[i] = 0;
+			(void)unlink(bakfile);
+			continue;
+		}
+		for(j = 0; j < ndev; j++)
+			if(devs[j] == st.st_dev)
+				break;
+		if(j == ndev) {
+			devs[ndev] = st.st_dev;
+			paths[ndev++] = jobs[i].zfile;
+		}
+	}
+	for(pass = 0; pass < 2; pass++) {
+		if(pass == 1) {
+			for(i = 0; i < num; i++) {
+				if(!written[i])
+					continue;
+				snprintf(bakfile, sizeof(bakfile), "%s~",
+					jobs[i].zfile);
+				if(rename(bakfile, jobs[i].zfile) == -1) {
+					log_msg(LOG_ERR, "rename(%s to %s) "
+						"failed: %s", bakfile,
+						jobs[i].zfile, strerror(errno));
+					(void)unlink(bakfile);
+					written[i] = 0;
+				}
+			}
+		}
+#ifdef HAVE_SYNCFS
+		for(j = 0; j < ndev; j++) {
+			char dir[4096];
+			char* p;
+			int fd;
+			strlcpy(dir, paths[j], sizeof(dir));
+			if((p = strrchr(dir, PATHSEP)) && p != dir)
+				*p = 0;
+			else	strlcpy(dir, p?"/":".", sizeof(dir));
+			if((fd = open(dir, O_RDONLY)) == -1) {
+				log_msg(LOG_ERR, "cannot open %s for syncfs: %s",
+					dir, strerror(errno));
+				continue;
+			}
+			if(syncfs(fd) == -1)
+				log_msg(LOG_ERR, "syncfs %s failed: %s", dir,
+					strerror(errno));
+			close(fd);
+		}
+#else
+		if(ndev > 0)
+			sync();
+#endif
+	}
+	for(i = 0, j = 0; i < num; i++)
+		if(written[i])
+			j++;
+	VERBOSITY(2, (LOG_INFO, "zonefiles write: %d zones synced with %d "
+		"file systems", (int)j, (int)ndev));
+	free(devs);
+	free(paths);
+}
+#endif /* HAVE_MMAP */
+
 void
 namedb_write_zonefiles(struct nsd* nsd, struct nsd_options* options)
 {
 	struct zone_options* zo;
+#ifdef HAVE_MMAP
+	struct zonefile_write_job* jobs = NULL;
+	uint8_t* written;
+	size_t num = 0, max = 0, i;
+
+	if(options->zonefiles_write_workers > 1 || options->zonefiles_sync) {
+		RBTREE_FOR(zo, struct zone_options*, options->zone_options) {
+			const char* zfile = NULL;
+			zone_type* zone = zonefile_write_needed(nsd, zo,
+				&zfile);
+			if(!zone)
+				continue;
+			if(num == max) {
+				max = max ? max*2 : 64;
+				jobs = xrealloc(jobs, max*sizeof(*jobs));
+			}
+			jobs[num].zone = zone;
+			jobs[num++].zfile = xstrdup(zfile);
+		}
+		if(num == 0)
+			return;
+		written = xalloc_zero(num);
+		if(num > 1 && options->zonefiles_write_workers > 1)
+			zonefile_write_parallel(jobs, written, num,
+				((size_t)options->zonefiles_write_workers < num)?
+				(size_t)options->zonefiles_write_workers:num,
+				options->zonefiles_sync);
+		else for(i = 0; i < num; i++)
+			written[i] = (uint8_t)zonefile_write_file(jobs[i].zone,
+				jobs[i].zfile, 0, options->zonefiles_sync);
+		if(options->zonefiles_sync)
+			zonefile_commit_group(jobs, written, num);
+		for(i = 0; i < num; i++) {
+			if(written[i])
+				zonefile_write_done(nsd, jobs[i].zone,
+					jobs[i].zfile);
+			free(jobs[i].zfile);
+		}
+		free(written);
+		free(jobs);
+		return;
+	}
+#endif /* HAVE_MMAP */
 	RBTREE_FOR(zo, struct zone_options*, options->zone_options) {
 		namedb_write_zonefile(nsd, zo);
 	}
@@ -9,6 +9,7 @@
 
 #include "config.h"
 #include <assert.h>
+#include <ctype.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -25,6 +26,7 @@
 #include "ixfr.h"
 #include "zonec.h"
 #include "xfrd-catalog-zones.h"
+#include "fasthash.h"
 
 static int
 write_64(FILE *out, uint64_t val)
@@ -91,6 +93,27 @@ diff_write_packet(const char* zone, const char* pat, uint32_t old_serial,
 		}
 	}
 
+#ifdef USE_LZ4
+	if(nsd->options->xfrd_xfr_compress) {
+		size_t clen = 0;
+		uint8_t* cdata = lz4_compress(data, len, &clen);
+		if(cdata) {
+			if(!write_32(df, DIFF_PART_XZFR) ||
+				!write_32(df, len) ||
+				!write_32(df, clen) ||
+				!write_data(df, cdata, clen) ||
+				!write_32(df, len))
+			{
+				log_msg(LOG_ERR, "could not write transfer %s "
+					"file %lld: %s", zone,
+					(long long)filenumber, strerror(errno));
+			}
+			free(cdata);
+			fclose(df);
+			return;
+		}
+	}
+#endif
 	if(!write_32(df, DIFF_PART_XXFR) ||
 		!write_32(df, len) ||
 		!write_data(df, data, len) ||
@@ -236,17 +259,9 @@ diff_read_str(FILE* in, char* buf, size_t len)
 static void
 add_rdata_to_recyclebin(namedb_type* db, rr_type* rr)
 {
-	/* add rdatas to recycle bin. */
-	size_t i;
-	for(i=0; i<rr->rdata_count; i++)
-	{
-		if(!rdata_atom_is_domain(rr->type, i))
-			region_recycle(db->region, rr->rdatas[i].data,
-				rdata_atom_size(rr->rdatas[i])
-				+ sizeof(uint16_t));
-	}
-	region_recycle(db->region, rr->rdatas,
-		sizeof(rdata_atom_type)*rr->rdata_count);
+	/* add rdatas to recycle bin, the atoms and their data are one
+	 * block, that may be shared with other RRs */
+	namedb_rdata_release(db, rr->type, rr->rdata_count, rr->rdatas);
 }
 
 /* this routine determines if below a domain there exist names with
@@ -294,6 +309,30 @@ rrset_zero_nonexist_check(domain_type* domain, domain_type* ce)
 	return NULL;
 }
 
+/* RRsets with at least this many RRs get an index for the transfer */
+#define RR_INDEX_MIN 64
+/*
+ * Hash index over the RRs of the RRset that the transfer changes, so that
+ * the RRs to delete, and the duplicates of the RRs to add, are found
+ * without a compare with every RR of a large RRset. It is made for one
+ * RRset at a time, kept up to date by add_RR and delete_RR, and freed
+ * when the transfer is applied.
+ */
+struct rr_index_slot {
+	uint32_t hash;
+	/* index of the RR in the rrs array plus one, 0 if the slot is free */
+	uint32_t rr;
+};
+static struct rr_index {
+	/* the rrset, and its rrs array and count when last updated */
+	rrset_type* rrset;
+	rr_type* rrs;
+	uint16_t rr_count;
+	/* open addressing, size is a power of two */
+	struct rr_index_slot* slots;
+	size_t size;
+} rr_index;
+
 /** remove rrset.  Adjusts zone params.  Does not remove domain */
 static void
 rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
@@ -309,6 +348,8 @@ rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 		return;
 	}
 	*pp = rrset->next;
+	if(rr_index.rrset == rrset)
+		rr_index.rrset = NULL;
 
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "delete rrset of %s type %s",
 		domain_to_string(domain),
@@ -334,6 +375,7 @@ rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 		add_rdata_to_recyclebin(db, &rrset->rrs[i]);
 	region_recycle(db->region, rrset->rrs,
 		sizeof(rr_type) * rrset->rr_count);
+	rrset_wire_free(db->region, rrset);
 	rrset->rr_count = 0;
 	region_recycle(db->region, rrset, sizeof(rrset_type));
 }
@@ -459,6 +501,196 @@ find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 	return -1;
 }
 
+/* the hash of the RR, it is the same for the RRs that rdatas_equal
+ * finds equal, the names are hashed in lowercase */
+static uint32_t
+rr_index_hash(uint16_t type, uint16_t klass, rdata_atom_type* rdatas,
+	ssize_t rdata_num)
+{
+	uint8_t buf[MAXDOMAINLEN+2];
+	uint64_t h = ((uint64_t)klass<<16) | (uint64_t)rdata_num;
+	int k, start = 0, end = (int)rdata_num;
+	if(type == TYPE_SOA) {
+		start = 2;
+		end = 3;
+	}
+	for(k = start; k < end && k < rdata_num; k++) {
+		const uint8_t* d;
+		size_t len, i;
+		if(rdata_atom_is_domain(type, k)) {
+			const dname_type* dname = domain_dname(rdatas[k].domain);
+			d = dname_name(dname);
+			len = dname->name_size;
+		} else if(rdata_atom_is_literal_domain(type, k)) {
+			d = rdata_atom_data(rdatas[k]);
+			len = rdata_atom_size(rdatas[k]);
+		} else {
+			h = fasthash64(rdata_atom_data(rdatas[k]),
+				rdata_atom_size(rdatas[k]), h);
+			continue;
+		}
+		if(len > sizeof(buf))
+			len = sizeof(buf);
+		for(i=0; i<len; i++)
+			buf[i] = DNAME_NORMALIZE(d[i]);
+		h = fasthash64(buf, len, h);
+	}
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+static void
+rr_index_clear(void)
+{
+	free(rr_index.slots);
+	memset(&rr_index, 0, sizeof(rr_index));
+}
+
+static void
+rr_index_insert(uint32_t hash, int rrnum)
+{
+	size_t i = hash & (rr_index.size-1);
+	while(rr_index.slots[i].rr)
+		i = (i+1) & (rr_index.size-1);
+	rr_index.slots[i].hash = hash;
+	rr_index.slots[i].rr = (uint32_t)rrnum+1;
+}
+
+/* remove the slot of the RR, with backward shift of the slots after it */
+static void
+rr_index_remove(uint32_t hash, int rrnum)
+{
+	size_t i = hash & (rr_index.size-1), j, want;
+	while(rr_index.slots[i].rr != (uint32_t)rrnum+1) {
+		if(!rr_index.slots[i].rr)
+			return;
+		i = (i+1) & (rr_index.size-1);
+	}
+	j = i;
+	for(;;) {
+		rr_index.slots[i].rr = 0;
+		for(;;) {
+			j = (j+1) & (rr_index.size-1);
+			if(!rr_index.slots[j].rr)
+				return;
+			want = rr_index.slots[j].hash & (rr_index.size-1);
+			/* move it if its wanted slot is not between i and j */
+			if(i <= j ? (i < want && want <= j) :
+				(i < want || want <= j))
+				continue;
+			break;
+		}
+		rr_index.slots[i] = rr_index.slots[j];
+		i = j;
+	}
+}
+
+/* the slot of the RR, to change the RR number it points to */
+static struct rr_index_slot*
+rr_index_slot(uint32_t hash, int rrnum)
+{
+	size_t i = hash & (rr_index.size-1);
+	while(rr_index.slots[i].rr) {
+		if(rr_index.slots[i].rr == (uint32_t)rrnum+1)
+			return &rr_index.slots[i];
+		i = (i+1) & (rr_index.size-1);
+	}
+	return NULL;
+}
+
+/* get the index for the rrset, made if the rrset is large, or NULL */
+static struct rr_index*
+rr_index_get(rrset_type* rrset)
+{
+	int i;
+	if(rr_index.rrset == rrset && rr_index.rrs == rrset->rrs &&
+		rr_index.rr_count == rrset->rr_count)
+		return &rr_index;
+	if(rrset->rr_count < RR_INDEX_MIN)
+		return NULL;
+	free(rr_index.slots);
+	rr_index.size = 128;
+	while(rr_index.size < (size_t)rrset->rr_count*2)
+		rr_index.size *= 2;
+	rr_index.slots = xalloc_array_zero(rr_index.size,
+		sizeof(*rr_index.slots));
+	rr_index.rrset = rrset;
+	rr_index.rrs = rrset->rrs;
+	rr_index.rr_count = rrset->rr_count;
+	for(i=0; i<rrset->rr_count; i++)
+		rr_index_insert(rr_index_hash(rrset->type, rrset->rrs[i].klass,
+			rrset->rrs[i].rdatas, rrset->rrs[i].rdata_count), i);
+	return &rr_index;
+}
+
+/* find the RR in the rrset like find_rr_num, with the index if the rrset
+ * is large. The hash is returned to update the index with. */
+static int
+find_rr_num_index(rrset_type* rrset, uint16_t type, uint16_t klass,
+	rdata_atom_type *rdatas, ssize_t rdata_num, int add, uint32_t* hash)
+{
+	struct rr_index* idx = rr_index_get(rrset);
+	size_t i;
+	int rd;
+	char* reason;
+	if(!idx)
+		return find_rr_num(rrset, type, klass, rdatas, rdata_num, add);
+	*hash = rr_index_hash(type, klass, rdatas, rdata_num);
+	for(i = *hash & (idx->size-1); idx->slots[i].rr;
+		i = (i+1) & (idx->size-1)) {
+		rr_type* rr = &rrset->rrs[idx->slots[i].rr-1];
+		if(idx->slots[i].hash == *hash && rr->type == type &&
+			rr->klass == klass && rr->rdata_count == rdata_num &&
+			rdatas_equal(rdatas, rr->rdatas, rdata_num, type,
+			&rd, &reason))
+			return (int)idx->slots[i].rr-1;
+	}
+	if (!add) {
+		debug_find_rr_num(rrset, type, klass, rdatas, rdata_num);
+	}
+	return -1;
+}
+
+/* the RR was appended to the rrset, put it in the index */
+static void
+rr_index_added(rrset_type* rrset, rr_type* rrs_old, uint32_t hash)
+{
+	if(rr_index.rrset != rrset || rr_index.rrs != rrs_old ||
+		rr_index.rr_count != rrset->rr_count-1)
+		return;
+	if((size_t)rrset->rr_count*2 > rr_index.size) {
+		/* made again, larger, at the next lookup */
+		rr_index.rrset = NULL;
+		return;
+	}
+	rr_index_insert(hash, rrset->rr_count-1);
+	rr_index.rrs = rrset->rrs;
+	rr_index.rr_count = rrset->rr_count;
+}
+
+/* the RR rrnum is deleted from the rrset and the last RR moves to its place,
+ * before the rrset is changed */
+static void
+rr_index_delete(rrset_type* rrset, int rrnum, uint32_t hash)
+{
+	int last = rrset->rr_count-1;
+	if(rr_index.rrset != rrset || rr_index.rrs != rrset->rrs ||
+		rr_index.rr_count != rrset->rr_count)
+		return;
+	rr_index_remove(hash, rrnum);
+	if(rrnum < last) {
+		struct rr_index_slot* slot = rr_index_slot(rr_index_hash(
+			rrset->type, rrset->rrs[last].klass,
+			rrset->rrs[last].rdatas, rrset->rrs[last].rdata_count),
+			last);
+		if(!slot) {
+			rr_index.rrset = NULL;
+			return;
+		}
+		slot->rr = (uint32_t)rrnum+1;
+	}
+	rr_index.rr_count--;
+}
+
 #ifdef NSEC3
 /* see if nsec3 deletion triggers need action */
 static void
@@ -692,6 +924,7 @@ delete_RR(namedb_type* db, const dname_type* dname,
 		rdata_atom_type *rdatas;
 		ssize_t rdata_num;
 		int rrnum;
+		uint32_t hash = 0;
 		temptable = domain_table_create(temp_region);
 		/* This will ensure that the dnames in rdata are
 		 * normalized, conform RFC 4035, section 6.2
@@ -703,7 +936,8 @@ delete_RR(namedb_type* db, const dname_type* dname,
 				dname_to_string(dname,0));
 			return 0;
 		}
-		rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 0);
+		rrnum = find_rr_num_index(rrset, type, klass, rdatas,
+			rdata_num, 0, &hash);
 		if(rrnum == -1 && type == TYPE_SOA && domain == zone->apex
 			&& rrset->rr_count != 0)
 			rrnum = 0; /* replace existing SOA if no match */
@@ -734,6 +968,9 @@ delete_RR(namedb_type* db, const dname_type* dname,
 		} else {
 			/* swap out the bad RR and decrease the count */
 			rr_type* rrs_orig = rrset->rrs;
+			rr_index_delete(rrset, rrnum, hash);
+			/* the wire format is built again after the transfer */
+			rrset_wire_free(db->region, rrset);
 			add_rdata_to_recyclebin(db, &rrset->rrs[rrnum]);
 			if(rrnum < rrset->rr_count-1)
 				rrset->rrs[rrnum] = rrset->rrs[rrset->rr_count-1];
@@ -765,6 +1002,9 @@ delete_RR(namedb_type* db, const dname_type* dname,
 			}
 #endif /* NSEC3 */
 			rrset->rr_count --;
+			if(rr_index.rrset == rrset &&
+				rr_index.rr_count == rrset->rr_count)
+				rr_index.rrs = rrset->rrs;
 #ifdef NSEC3
 			/* for type nsec3, the domain may have become a
 			 * 'normal' domain with its remaining data now */
@@ -789,6 +1029,7 @@ add_RR(namedb_type* db, const dname_type* dname,
 	rr_type *rrs_old;
 	ssize_t rdata_num;
 	int rrnum;
+	uint32_t hash = 0;
 #ifdef NSEC3
 	int rrset_added = 0;
 #endif
@@ -807,7 +1048,9 @@ add_RR(namedb_type* db, const dname_type* dname,
 		}
 		rrset->zone = zone;
 		rrset->rrs = 0;
+		rrset->wire = NULL;
 		rrset->rr_count = 0;
+		rrset->type = type;
 		domain_add_rrset(domain, rrset);
 #ifdef NSEC3
 		rrset_added = 1;
@@ -824,7 +1067,8 @@ add_RR(namedb_type* db, const dname_type* dname,
 			dname_to_string(dname,0));
 		return 0;
 	}
-	rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 1);
+	rrnum = find_rr_num_index(rrset, type, klass, rdatas, rdata_num, 1,
+		&hash);
 	if(rrnum != -1) {
 		DEBUG(DEBUG_XFRD, 2, (LOG_ERR, "diff: RR <%s, %s> already exists",
 			dname_to_string(dname,0), rrtype_to_string(type)));
@@ -838,7 +1082,9 @@ add_RR(namedb_type* db, const dname_type* dname,
 		return 0;
 	}
 
-	/* re-alloc the rrs and add the new */
+	/* re-alloc the rrs and add the new, the wire format is built again
+	 * after the transfer */
+	rrset_wire_free(db->region, rrset);
 	rrs_old = rrset->rrs;
 	rrset->rrs = region_alloc_array(db->region,
 		(rrset->rr_count+1), sizeof(rr_type));
@@ -852,11 +1098,13 @@ add_RR(namedb_type* db, const dname_type* dname,
 	rrset->rr_count ++;
 
 	rrset->rrs[rrset->rr_count - 1].owner = domain;
-	rrset->rrs[rrset->rr_count - 1].rdatas = rdatas;
+	rrset->rrs[rrset->rr_count - 1].rdatas = namedb_rdata_share(db, type,
+		rdata_num, rdatas);
 	rrset->rrs[rrset->rr_count - 1].ttl = ttl;
 	rrset->rrs[rrset->rr_count - 1].type = type;
 	rrset->rrs[rrset->rr_count - 1].klass = klass;
 	rrset->rrs[rrset->rr_count - 1].rdata_count = rdata_num;
+	rr_index_added(rrset, rrs_old, hash);
 
 	/* see if it is a SOA */
 	if(domain == zone->apex) {
@@ -989,13 +1237,134 @@ delete_zone_rrs(namedb_type* db, zone_type* zone)
 	assert(zone->is_secure == 0);
 }
 
+struct diff_changes*
+diff_changes_create(region_type* region)
+{
+	struct diff_changes* changes = (struct diff_changes*)region_alloc(
+		region, sizeof(*changes));
+	changes->region = region_create(xalloc, free);
+	changes->names.region = changes->region;
+	changes->names.root = RBTREE_NULL;
+	changes->names.count = 0;
+	changes->names.cmp = dname_compare;
+	changes->all = 1;
+	return changes;
+}
+
+void
+diff_changes_delete(region_type* region, struct diff_changes* changes)
+{
+	if(!changes)
+		return;
+	region_destroy(changes->region);
+	region_recycle(region, changes, sizeof(*changes));
+}
+
+void
+diff_changes_clear(struct diff_changes* changes)
+{
+	region_free_all(changes->region);
+	changes->names.root = RBTREE_NULL;
+	changes->names.count = 0;
+	changes->all = 0;
+}
+
+/* add the owner name to the changed names */
+static void
+diff_changes_add(struct diff_changes* changes, const dname_type* owner)
+{
+	rbnode_type* node;
+	if(changes->all || rbtree_search(&changes->names, owner))
+		return;
+	if(changes->names.count >= DIFF_CHANGES_MAX) {
+		diff_changes_clear(changes);
+		changes->all = 1;
+		return;
+	}
+	node = (rbnode_type*)region_alloc(changes->region, sizeof(*node));
+	node->key = dname_copy(changes->region, owner);
+	rbtree_insert(&changes->names, node);
+}
+
+/*
+ * The domains of the zone that an AXFR replaces. They are held with a
+ * usage count while the new contents are added, so that the names that
+ * are in the zone before and after are not deleted and inserted again in
+ * the domain table, and the names that are gone are deleted at the end.
+ */
+struct axfr_keep {
+	domain_type** domains;
+	size_t num;
+};
+
+/* delete the rrsets of the zone for an AXFR, and hold its domains */
+static void
+delete_zone_rrs_keep(namedb_type* db, zone_type* zone, struct axfr_keep* keep)
+{
+	rrset_type *rrset;
+	domain_type *domain;
+	size_t i, max = 0;
+	free(keep->domains);
+	keep->domains = NULL;
+	keep->num = 0;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		if(keep->num == max) {
+			max = (max?max*2:1024);
+			keep->domains = xrealloc(keep->domains,
+				max*sizeof(*keep->domains));
+		}
+		keep->domains[keep->num++] = domain;
+		domain->usage++;
+	}
+	for(i=0; i<keep->num; i++) {
+		domain = keep->domains[i];
+		while((rrset = domain_find_any_rrset(domain, zone))) {
+			/* lower usage can delete domains outside the zone */
+			rrset_lower_usage(db, rrset);
+			rrset_delete(db, domain, rrset);
+		}
+	}
+	assert(zone->soa_rrset == 0);
+	assert(zone->ns_rrset == 0);
+	assert(zone->is_secure == 0);
+}
+
+/* release the domains held for the AXFR, the ones that are not used by
+ * the new contents are deleted */
+static void
+axfr_keep_release(namedb_type* db, zone_type* zone, struct axfr_keep* keep)
+{
+	domain_type* domain, *ce = NULL;
+	size_t i;
+	if(!keep->domains)
+		return;
+	for(i=0; i<keep->num; i++)
+		keep->domains[i]->usage--;
+	/* in canonical order, a domain deletes its parents, that are
+	 * earlier in the list, once its parents have no other children */
+	for(i=0; i<keep->num; i++)
+		domain_table_deldomain(db, keep->domains[i]);
+	free(keep->domains);
+	keep->domains = NULL;
+	keep->num = 0;
+	/* the names that lost their data are nonexisting now */
+	domain = zone->apex;
+	while(domain && domain_is_subdomain(domain, zone->apex)) {
+		if(domain->is_existing)
+			ce = rrset_zero_nonexist_check(domain, ce);
+		domain = domain_next(domain);
+	}
+}
+
 /* return value 0: syntaxerror,badIXFR, 1:OK, 2:done_and_skip_it */
 static int
 apply_ixfr(nsd_type* nsd, FILE *in, uint32_t serialno,
 	uint32_t seq_nr, uint32_t seq_total,
 	int* is_axfr, int* delete_mode, int* rr_count,
 	struct zone* zone, int* bytes,
-	int* softfail, struct ixfr_store* ixfr_store)
+	int* softfail, struct ixfr_store* ixfr_store,
+	struct diff_changes* changes, struct axfr_keep* keep)
 {
 	uint32_t msglen, checklen, pkttype;
 	int qcount, ancount;
@@ -1008,7 +1377,8 @@ apply_ixfr(nsd_type* nsd, FILE *in, uint32_t serialno,
 	 * something internal or a bad disk or something. */
 
 	/* read ixfr packet RRs and apply to in memory db */
-	if(!diff_read_32(in, &pkttype) || pkttype != DIFF_PART_XXFR) {
+	if(!diff_read_32(in, &pkttype) || (pkttype != DIFF_PART_XXFR &&
+		pkttype != DIFF_PART_XZFR)) {
 		log_msg(LOG_ERR, "could not read type or wrong type");
 		return 0;
 	}
@@ -1035,7 +1405,16 @@ apply_ixfr(nsd_type* nsd, FILE *in, uint32_t serialno,
 		return 0;
 	}
 	buffer_clear(packet);
-	if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
+	if(pkttype == DIFF_PART_XZFR) {
+		uint32_t clen;
+		if(!diff_read_32(in, &clen) ||
+			!lz4_read_block(in, clen, buffer_begin(packet), msglen)) {
+			log_msg(LOG_ERR, "could not read compressed transfer "
+				"part");
+			region_destroy(region);
+			return 0;
+		}
+	} else if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
 		log_msg(LOG_ERR, "short fread: %s", strerror(errno));
 		region_destroy(region);
 		return 0;
@@ -1203,11 +1582,15 @@ axfr:
 				nsec3_clear_precompile(nsd->db, zone);
 				zone->nsec3_param = NULL;
 #endif
-				delete_zone_rrs(nsd->db, zone);
+				delete_zone_rrs_keep(nsd->db, zone, keep);
 				if(ixfr_store) {
 					ixfr_store_cancel(ixfr_store);
 					ixfr_store_delixfrs(zone);
 				}
+				if(changes) {
+					diff_changes_clear(changes);
+					changes->all = 1;
+				}
 				DEBUG(DEBUG_XFRD,2, (LOG_INFO, "diff: %s sawAXFR count %d, ax %d, delmode %d",
 					domain_to_string(zone->apex), *rr_count, *is_axfr, *delete_mode));
 			}
@@ -1222,6 +1605,8 @@ axfr:
 		DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfr %s RR dname is %s type %s",
 			*delete_mode?"del":"add",
 			dname_to_string(owner, 0), rrtype_to_string(type)));
+		if(changes)
+			diff_changes_add(changes, owner);
 		if(*delete_mode) {
 			assert(!*is_axfr);
 			/* delete this rr */
@@ -1276,7 +1661,8 @@ check_for_bad_serial(namedb_type* db, const char* zone_str, uint32_t old_serial)
 
 int
 apply_ixfr_for_zone(nsd_type* nsd, zone_type* zone, FILE* in,
-	struct nsd_options* ATTR_UNUSED(opt), udb_base* taskudb, uint32_t xfrfilenr)
+	struct nsd_options* ATTR_UNUSED(opt), udb_base* taskudb, uint32_t xfrfilenr,
+	struct diff_changes* changes)
 {
 	char zone_buf[3072];
 	char log_buf[5120];
@@ -1354,6 +1740,8 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zone, FILE* in,
 	{
 		int is_axfr=0, delete_mode=0, rr_count=0, softfail=0;
 		struct ixfr_store* ixfr_store = NULL, ixfr_store_mem;
+		struct axfr_keep keep;
+		memset(&keep, 0, sizeof(keep));
 
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "processing xfr: %s", zone_buf));
 		if(zone_is_ixfr_enabled(zone))
@@ -1365,7 +1753,8 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zone, FILE* in,
 			ret = apply_ixfr(nsd, in, new_serial,
 				i, num_parts, &is_axfr, &delete_mode,
 				&rr_count, zone,
-				&num_bytes, &softfail, ixfr_store);
+				&num_bytes, &softfail, ixfr_store, changes,
+				&keep);
 			if(ret == 0) {
 				log_msg(LOG_ERR, "bad ixfr packet part %d in diff file for %s", (int)i, zone_buf);
 				diff_update_commit(
@@ -1376,6 +1765,7 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zone, FILE* in,
 				break;
 			}
 		}
+		axfr_keep_release(nsd->db, zone, &keep);
 		/* read the final log_str: but do not fail on it */
 		if(!diff_read_str(in, log_buf, sizeof(log_buf))) {
 			log_msg(LOG_ERR, "could not read log for transfer %s",
@@ -1383,9 +1773,20 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zone, FILE* in,
 			snprintf(log_buf, sizeof(log_buf), "error reading log");
 		}
 #ifdef NSEC3
-		prehash_zone(nsd->db, zone);
+		if(nsd->reload_stats) {
+			struct timespec t;
+			reload_stats_elapsed(&t);
+			prehash_zone(nsd->db, zone);
+			nsd->reload_stats->cur.prehash += reload_stats_elapsed(&t);
+		} else {
+			prehash_zone(nsd->db, zone);
+		}
 #endif /* NSEC3 */
+		/* the wire format of the changed rrsets is built by the
+		 * reload, once for the zone after all its transfers */
 		zone->is_changed = 1;
+		zone->content_hash = 0;
+		namedb_zone_add_updated(nsd->db, zone);
 		zone->is_updated = 1;
 		zone->is_checked = (committed == DIFF_VERIFIED);
 		zone->mtime.tv_sec = time_end_0;
@@ -1560,6 +1961,12 @@ void task_remap(struct udb_base* taskudb)
 void task_clear(struct udb_base* taskudb)
 {
 	udb_ptr t, n;
+	if(taskudb->ram_num == 0) {
+		/* drop all tasks at once, the next tasks are appended from
+		 * the start of the file, that does not need to grow again */
+		udb_base_clear(taskudb);
+		return;
+	}
 	udb_ptr_new(&t, taskudb, udb_base_get_userdata(taskudb));
 	udb_base_set_userdata(taskudb, 0);
 	udb_ptr_init(&n, taskudb);
@@ -1573,20 +1980,137 @@ void task_clear(struct udb_base* taskudb)
 	udb_ptr_unlink(&n, taskudb);
 }
 
-void task_new_expire(struct udb_base* udb, udb_ptr* last,
-	const struct dname* z, int expired)
+void task_new_zone_mem(struct udb_base* udb, udb_ptr* last, struct zone* z)
 {
 	udb_ptr e;
-	if(!z) return;
-	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add expire info for zone %s",
-		dname_to_string(z,NULL)));
+	struct zone_mem_usage mem;
+	if(!z || !z->apex || !domain_dname(z->apex))
+		return; /* safety check */
+	zone_mem_usage(z, &mem);
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add zone mem for zone %s",
+		domain_to_string(z->apex)));
 	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
-		dname_total_size(z), z)) {
+		dname_total_size(domain_dname(z->apex)) + sizeof(mem),
+		domain_dname(z->apex))) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add zone mem");
+		return;
+	}
+	TASKLIST(&e)->task_type = task_zone_mem;
+	memmove((uint8_t*)TASKLIST(&e)->zname +
+		dname_total_size(domain_dname(z->apex)), &mem, sizeof(mem));
+	udb_ptr_unlink(&e, udb);
+}
+
+void task_new_reload_stats(struct udb_base* udb, udb_ptr* last,
+	struct reload_stats* rs)
+{
+	udb_ptr e;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add reload stats"));
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
+		sizeof(*rs), NULL)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add reload "
+			"stats");
+		return;
+	}
+	TASKLIST(&e)->task_type = task_reload_stats;
+	memmove(TASKLIST(&e)->zname, rs, sizeof(*rs));
+	udb_ptr_unlink(&e, udb);
+}
+
+/** get the time for the reload stats, monotonic if possible */
+static void
+reload_stats_now(struct timespec* t)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	if(clock_gettime(CLOCK_MONOTONIC, t) == 0)
+		return;
+#endif
+	get_time(t);
+}
+
+void
+reload_stats_start(struct reload_stats* rs)
+{
+	memset(rs, 0, sizeof(*rs));
+	reload_stats_now(&rs->start);
+	rs->stamp = rs->start;
+}
+
+uint64_t
+reload_stats_elapsed(struct timespec* stamp)
+{
+	struct timespec now;
+	uint64_t usec = 0;
+	reload_stats_now(&now);
+	if(timespec_compare(&now, stamp) > 0) {
+		struct timespec d = now;
+		timespec_subtract(&d, stamp);
+		usec = (uint64_t)d.tv_sec*1000000 + (uint64_t)d.tv_nsec/1000;
+	}
+	*stamp = now;
+	return usec;
+}
+
+static uint64_t
+reload_stats_zone_total(struct reload_stats_zone* z)
+{
+	return z->parse + z->apply + z->prehash;
+}
+
+void
+reload_stats_zone_done(struct reload_stats* rs, struct zone* zone)
+{
+	struct reload_stats_zone* cur = &rs->cur;
+	const char* name = zone->opts?zone->opts->name:
+		domain_to_string(zone->apex);
+	uint32_t i;
+	rs->num_zones++;
+	/* a zone with several transfers adds up in its entry */
+	for(i=0; i<rs->num_slow; i++) {
+		if(strcmp(rs->slow[i].name, name) == 0) {
+			cur->parse += rs->slow[i].parse;
+			cur->apply += rs->slow[i].apply;
+			cur->prehash += rs->slow[i].prehash;
+			rs->num_zones--;
+			memmove(&rs->slow[i], &rs->slow[i+1],
+				(rs->num_slow-i-1)*sizeof(rs->slow[0]));
+			rs->num_slow--;
+			break;
+		}
+	}
+	/* insert sorted, the slowest first */
+	for(i=0; i<rs->num_slow; i++) {
+		if(reload_stats_zone_total(cur) >
+			reload_stats_zone_total(&rs->slow[i]))
+			break;
+	}
+	if(i < RELOAD_STATS_ZONES) {
+		if(rs->num_slow == RELOAD_STATS_ZONES)
+			rs->num_slow--;
+		memmove(&rs->slow[i+1], &rs->slow[i],
+			(rs->num_slow-i)*sizeof(rs->slow[0]));
+		rs->slow[i] = *cur;
+		strlcpy(rs->slow[i].name, name, sizeof(rs->slow[i].name));
+		rs->num_slow++;
+	}
+	memset(cur, 0, sizeof(*cur));
+}
+
+void task_new_expire(struct udb_base* udb, udb_ptr* last, uint32_t num,
+	const uint8_t* list, size_t len)
+{
+	udb_ptr e;
+	if(num == 0) return;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add expire info for %u zones",
+		(unsigned)num));
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)+
+		len, NULL)) {
 		log_msg(LOG_ERR, "tasklist: out of space, cannot add expire");
 		return;
 	}
 	TASKLIST(&e)->task_type = task_expire;
-	TASKLIST(&e)->yesno = expired;
+	TASKLIST(&e)->yesno = num;
+	memmove(TASKLIST(&e)->zname, list, len);
 	udb_ptr_unlink(&e, udb);
 }
 
@@ -1709,6 +2233,33 @@ void task_new_del_key(udb_base* udb, udb_ptr* last, const char* name)
 	udb_ptr_unlink(&e, udb);
 }
 
+void task_new_dnstap_filter(udb_base* udb, udb_ptr* last,
+	struct nsd_options* opt)
+{
+	struct dnstap_filter* f;
+	size_t len = 1;
+	char* p;
+	udb_ptr e;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "add task dnstap_filter"));
+	for(f = opt->dnstap_filters; f; f = f->next)
+		len += strlen(f->spec)+1;
+	if(!task_create_new_elem(udb, last, &e, sizeof(struct task_list_d)
+		+len, NULL)) {
+		log_msg(LOG_ERR, "tasklist: out of space, cannot add dnstap");
+		return;
+	}
+	TASKLIST(&e)->task_type = task_dnstap_filter;
+	TASKLIST(&e)->yesno = (uint64_t)opt->dnstap_sample_rate;
+	/* the rules, each ends with a zero, and an empty one at the end */
+	p = (char*)TASKLIST(&e)->zname;
+	for(f = opt->dnstap_filters; f; f = f->next) {
+		memmove(p, f->spec, strlen(f->spec)+1);
+		p += strlen(f->spec)+1;
+	}
+	*p = 0;
+	udb_ptr_unlink(&e, udb);
+}
+
 void task_new_cookies(udb_base* udb, udb_ptr* last, int answer_cookie,
 		size_t cookie_count, void* cookie_secrets) {
 	udb_ptr e;
@@ -1830,26 +2381,39 @@ task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* dname,
 void
 task_process_expire(namedb_type* db, struct task_list_d* task)
 {
-	uint8_t ok;
-	zone_type* z = namedb_find_zone(db, task->zname);
+	uint8_t* p = (uint8_t*)task->zname;
+	uint8_t* end = ((uint8_t*)task) + task->size;
+	uint64_t i;
 	assert(task->task_type == task_expire);
-	if(!z) {
-		DEBUG(DEBUG_IPC, 1, (LOG_WARNING, "zone %s %s but not in zonetree",
-			dname_to_string(task->zname, NULL),
-			task->yesno?"expired":"unexpired"));
-		return;
+	for(i=0; i<task->yesno; i++) {
+		const dname_type* dname;
+		zone_type* z;
+		uint8_t ok;
+		if(p + 1 + sizeof(dname_type) > end)
+			break;
+		ok = !p[0];
+		dname = (const dname_type*)(p+1);
+		if(p + 1 + dname_total_size(dname) > end)
+			break;
+		p += 1 + dname_total_size(dname);
+		z = namedb_find_zone(db, dname);
+		if(!z) {
+			DEBUG(DEBUG_IPC, 1, (LOG_WARNING, "zone %s %s but not "
+				"in zonetree", dname_to_string(dname, NULL),
+				ok?"unexpired":"expired"));
+			continue;
+		}
+		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: expire task zone %s %s",
+			dname_to_string(dname,0), ok?"unexpired":"expired"));
+		/* only update zone->is_ok if needed to minimize copy-on-write
+		 * of memory pages shared after fork() */
+		if(ok && !z->is_ok)
+			z->is_ok = 1;
+		else if(!ok && z->is_ok)
+			z->is_ok = 0;
 	}
-	DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: expire task zone %s %s",
-		dname_to_string(task->zname,0),
-		task->yesno?"expired":"unexpired"));
-	/* find zone, set expire flag */
-	ok = !task->yesno;
-	/* only update zone->is_ok if needed to minimize copy-on-write
-	 * of memory pages shared after fork() */
-	if(ok && !z->is_ok)
-		z->is_ok = 1;
-	else if(!ok && z->is_ok)
-		z->is_ok = 0;
+	if(i != task->yesno)
+		log_msg(LOG_ERR, "tasklist: expire task is malformed");
 }
 
 static void
@@ -1963,6 +2527,23 @@ task_process_del_key(struct nsd* nsd, struct task_list_d* task)
 	key_options_remove(nsd->options, name);
 }
 
+static void
+task_process_dnstap_filter(struct nsd* nsd, struct task_list_d* task)
+{
+	char* p = (char*)task->zname;
+	DEBUG(DEBUG_IPC,1, (LOG_INFO, "dnstap_filter task %d",
+		(int)task->yesno));
+	nsd->options->dnstap_sample_rate = (int)task->yesno;
+	nsd->options->dnstap_filters = NULL;
+	while(*p) {
+		struct dnstap_filter* f = dnstap_filter_parse(
+			nsd->options->region, p);
+		if(f)
+			dnstap_filter_append(nsd->options, f);
+		p += strlen(p)+1;
+	}
+}
+
 static void
 task_process_cookies(struct nsd* nsd, struct task_list_d* task) {
 	DEBUG(DEBUG_IPC, 1, (LOG_INFO, "cookies task answer: %s, count: %d",
@@ -1972,6 +2553,7 @@ task_process_cookies(struct nsd* nsd, struct task_list_d* task) {
 	nsd->cookie_count = (size_t) task->yesno;
 	memmove(nsd->cookie_secrets, task->zname, sizeof(nsd->cookie_secrets));
 	explicit_bzero(task->zname, sizeof(nsd->cookie_secrets));
+	cookie_keys_setup(nsd);
 }
 
 static void
@@ -2029,6 +2611,8 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr* task)
 	 * appends soa_info which may remap and change the pointer. */
 	zone_type* zone;
 	FILE* df;
+	struct timespec t;
+	int rc;
 	DEBUG(DEBUG_IPC,1, (LOG_INFO, "applyxfr task %s", dname_to_string(
 		TASKLIST(task)->zname, NULL)));
 	zone = namedb_find_zone(nsd->db, TASKLIST(task)->zname);
@@ -2046,20 +2630,38 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr* task)
 		/* could not open file to update */
 		/* soainfo_gone will be communicated from server_reload, unless
 		   preceding updates have been applied */
+		namedb_zone_add_updated(nsd->db, zone);
 		zone->is_skipped = 1;
 		udb_ptr_free_space(task, udb, TASKLIST(task)->size);
 		return;
 	}
 	/* read and apply zone transfer */
-	switch(apply_ixfr_for_zone(nsd, zone, df, nsd->options, udb,
-				TASKLIST(task)->yesno)) {
+	if(nsd->reload_stats)
+		reload_stats_elapsed(&t);
+	rc = apply_ixfr_for_zone(nsd, zone, df, nsd->options, udb,
+		TASKLIST(task)->yesno, NULL);
+	/* the RRset index is only for the transfer */
+	rr_index_clear();
+	switch(rc) {
 	case 1: /* Success */
+		if(nsd->reload_stats) {
+			struct reload_stats_zone* cur =
+				&nsd->reload_stats->cur;
+			uint64_t usec = reload_stats_elapsed(&t);
+			cur->apply += (usec > cur->prehash ?
+				usec - cur->prehash : 0);
+			reload_stats_zone_done(nsd->reload_stats, zone);
+		}
 		break;
 
 	case 0: /* Failure */
 		/* soainfo_gone will be communicated from server_reload, unless
 		   preceding updates have been applied  */
+		namedb_zone_add_updated(nsd->db, zone);
 		zone->is_skipped = 1;
+		if(nsd->reload_stats)
+			memset(&nsd->reload_stats->cur, 0,
+				sizeof(nsd->reload_stats->cur));
 		break;
 
 	case -1:/* Fatal */
@@ -2118,6 +2720,9 @@ void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 	case task_cookies:
 		task_process_cookies(nsd, TASKLIST(task));
 		break;
+	case task_dnstap_filter:
+		task_process_dnstap_filter(nsd, TASKLIST(task));
+		break;
 	default:
 		log_msg(LOG_WARNING, "unhandled task in reload type %d",
 			(int)TASKLIST(task)->task_type);
@@ -18,6 +18,9 @@ struct nsdst;
 
 #define DIFF_PART_XXFR ('X'<<24 | 'X'<<16 | 'F'<<8 | 'R')
 #define DIFF_PART_XFRF ('X'<<24 | 'F'<<16 | 'R'<<8 | 'F')
+/* a part with the packet compressed with LZ4, for xfrd-xfr-compress, the
+ * packet length is followed by the compressed length */
+#define DIFF_PART_XZFR ('X'<<24 | 'Z'<<16 | 'F'<<8 | 'R')
 
 #define DIFF_NOT_COMMITTED (0u) /* XFR not (yet) committed to disk */
 #define DIFF_COMMITTED (1u<<0) /* XFR committed to disk */
@@ -66,9 +69,35 @@ int add_RR(namedb_type* db, const dname_type* dname,
 	buffer_type* packet, size_t rdatalen, zone_type *zone,
 	int* softfail);
 
-/* apply the xfr file identified by xfrfilenr to zone */
+/* the number of changed names collected before giving up on them */
+#define DIFF_CHANGES_MAX 4096
+
+/*
+ * The owner names changed by applied transfers, for a zone that is
+ * processed after its transfers, like a catalog consumer zone, so that
+ * only the changed names have to be looked at.
+ */
+struct diff_changes {
+	region_type* region;
+	/* the changed owner names, the keys are dname_type* */
+	rbtree_type names;
+	/* set if the names are not collected, because a transfer replaced
+	 * the contents of the zone, or too many names were changed */
+	int all;
+};
+
+/* create the changed names collection, it starts out with all set */
+struct diff_changes* diff_changes_create(region_type* region);
+/* free the changed names collection */
+void diff_changes_delete(region_type* region, struct diff_changes* changes);
+/* clear the changed names, and all */
+void diff_changes_clear(struct diff_changes* changes);
+
+/* apply the xfr file identified by xfrfilenr to zone, the changed owner
+ * names are added to changes, if not NULL */
 int apply_ixfr_for_zone(struct nsd* nsd, zone_type* zone, FILE* in,
-        struct nsd_options* opt, udb_base* taskudb, uint32_t xfrfilenr);
+        struct nsd_options* opt, udb_base* taskudb, uint32_t xfrfilenr,
+        struct diff_changes* changes);
 
 enum soainfo_hint {
 	soainfo_ok,
@@ -82,7 +111,7 @@ struct task_list_d {
 	udb_rel_ptr next;
 	/** task type */
 	enum {
-		/** expire or un-expire a zone */
+		/** expire or un-expire zones */
 		task_expire,
 		/** apply an ixfr or axfr to a zone */
 		task_apply_xfr,
@@ -112,26 +141,84 @@ struct task_list_d {
 		task_zonestat_inc,
 		/** cookies */
 		task_cookies,
+		/** dnstap sample rate and filter rules */
+		task_dnstap_filter,
+		/** memory used by a zone, for nsd-control mem-stats */
+		task_zone_mem,
+		/** timing of the reload, for nsd-control reload_stats */
+		task_reload_stats,
 	} task_type;
 	uint32_t size; /* size of this struct */
 
 	/** soainfo: zonename dname, soaRR wireform, yesno is soainfo_hint */
-	/** expire: zonename, boolyesno */
+	/** expire: no zonename, yesno is the number of zones, followed by
+	 * that many [uint8 expired][zonename dname] entries */
 	/** apply_xfr: zonename, serials, yesno is filenamecounter */
+	/** zone_mem: zonename, struct zone_mem_usage */
+	/** reload_stats: no zonename, struct reload_stats */
 	uint32_t oldserial, newserial;
 	/** general variable.  for some used to see if zname is present. */
 	uint64_t yesno;
 	struct dname zname[0];
 };
 #define TASKLIST(ptr) ((struct task_list_d*)UDB_PTR(ptr))
+
+/* number of slowest zones kept in the reload statistics */
+#define RELOAD_STATS_ZONES 10
+/* time spent by a zone in the reload, in microseconds */
+struct reload_stats_zone {
+	/* reading the zonefile */
+	uint64_t parse;
+	/* applying transfers, without the prehash */
+	uint64_t apply;
+	/* NSEC3 prehash of the zone */
+	uint64_t prehash;
+	char name[MAXDOMAINLEN*5+1];
+};
+/* time spent in the phases of a reload, in microseconds, and the zones
+ * that took the longest. Made by the reload, passed to xfrd in a task. */
+struct reload_stats {
+	/* wallclock time when the reload was done */
+	uint64_t done;
+	/* the tasks from xfrd before the fork, like reading zonefiles */
+	uint64_t tasks;
+	uint64_t fork;
+	/* applying zone transfers and building the changed wire format */
+	uint64_t xfr;
+	uint64_t verify;
+	/* copying the database into new memory, for reload-compact */
+	uint64_t compact;
+	/* starting the new server processes */
+	uint64_t children;
+	/* waiting for the old main process to quit */
+	uint64_t quit_sync;
+	uint64_t total;
+	/* zones read or transferred, and the entries in slow */
+	uint32_t num_zones, num_slow;
+	/* the slowest zones, the slowest first */
+	struct reload_stats_zone slow[RELOAD_STATS_ZONES];
+	/* the zone that is being timed */
+	struct reload_stats_zone cur;
+	/* start of the reload and of the current phase, monotonic */
+	struct timespec start, stamp;
+};
+/* start timing a reload, clears the stats */
+void reload_stats_start(struct reload_stats* rs);
+/* microseconds since the stamp, and sets the stamp to now */
+uint64_t reload_stats_elapsed(struct timespec* stamp);
+/* the time spent on the zone is done, put it in the slowest zones */
+void reload_stats_zone_done(struct reload_stats* rs, struct zone* zone);
 /** create udb for tasks */
 struct udb_base* task_file_create(const char* file);
 void task_remap(udb_base* udb);
 void task_process_sync(udb_base* udb);
 void task_clear(udb_base* udb);
 void task_new_soainfo(udb_base* udb, udb_ptr* last, struct zone* z, enum soainfo_hint hint);
-void task_new_expire(udb_base* udb, udb_ptr* last,
-	const struct dname* z, int expired);
+void task_new_zone_mem(udb_base* udb, udb_ptr* last, struct zone* z);
+void task_new_reload_stats(udb_base* udb, udb_ptr* last,
+	struct reload_stats* rs);
+void task_new_expire(udb_base* udb, udb_ptr* last, uint32_t num,
+	const uint8_t* list, size_t len);
 void task_new_check_zonefiles(udb_base* udb, udb_ptr* last,
 	const dname_type* zone);
 void task_new_write_zonefiles(udb_base* udb, udb_ptr* last,
@@ -147,6 +234,8 @@ void task_new_add_pattern(udb_base* udb, udb_ptr* last,
 void task_new_del_pattern(udb_base* udb, udb_ptr* last, const char* name);
 void task_new_opt_change(udb_base* udb, udb_ptr* last, struct nsd_options* opt);
 void task_new_zonestat_inc(udb_base* udb, udb_ptr* last, unsigned sz);
+void task_new_dnstap_filter(udb_base* udb, udb_ptr* last,
+	struct nsd_options* opt);
 void task_new_cookies(udb_base* udb, udb_ptr* last, int answer_cookie,
 		size_t cookie_count, void* cookie_secrets);
 int task_new_apply_xfr(udb_base* udb, udb_ptr* last, const dname_type* zone,
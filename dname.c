@@ -22,6 +22,73 @@
 #include "dname.h"
 #include "query.h"
 
+/*
+ * Normalize the case of eight ASCII characters at once.  For every byte
+ * that is a letter of the other case, the 0x20 bit is flipped.  Adding
+ * to the low seven bits of each byte cannot carry into the next byte,
+ * the high bit of each byte is then set if the character is at or above
+ * the start, or above the end, of the letter range.  Bytes with the high
+ * bit set are not letters, like with tolower in the C locale.
+ */
+static inline uint64_t
+dname_normalize_word(uint64_t w)
+{
+	uint64_t heptets = w & 0x7f7f7f7f7f7f7f7fULL;
+	uint64_t letters;
+#if defined(NAMEDB_UPPERCASE) || defined(USE_NAMEDB_UPPERCASE)
+	letters = (heptets + 0x1f1f1f1f1f1f1f1fULL) /* >= 'a' */
+		& ~(heptets + 0x0505050505050505ULL); /* > 'z' */
+#else
+	letters = (heptets + 0x3f3f3f3f3f3f3f3fULL) /* >= 'A' */
+		& ~(heptets + 0x2525252525252525ULL); /* > 'Z' */
+#endif
+	letters &= ~w & 0x8080808080808080ULL;
+	return w ^ (letters >> 2);
+}
+
+/* copy len bytes of label data, normalizing the case */
+static void
+dname_normalize_copy(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	uint64_t w;
+	while (len >= sizeof(w)) {
+		memcpy(&w, src, sizeof(w));
+		w = dname_normalize_word(w);
+		memcpy(dst, &w, sizeof(w));
+		src += sizeof(w);
+		dst += sizeof(w);
+		len -= sizeof(w);
+	}
+	while (len > 0) {
+		*dst++ = DNAME_NORMALIZE((unsigned char)*src++);
+		len--;
+	}
+}
+
+/* compare len bytes of label data, ignoring case */
+static int
+label_data_equal_nocase(const uint8_t *a, const uint8_t *b, size_t len)
+{
+	uint64_t wa, wb;
+	while (len >= sizeof(wa)) {
+		memcpy(&wa, a, sizeof(wa));
+		memcpy(&wb, b, sizeof(wb));
+		if (wa != wb && dname_normalize_word(wa) !=
+			dname_normalize_word(wb))
+			return 0;
+		a += sizeof(wa);
+		b += sizeof(wb);
+		len -= sizeof(wa);
+	}
+	while (len > 0) {
+		if (DNAME_NORMALIZE((unsigned char)*a++) !=
+			DNAME_NORMALIZE((unsigned char)*b++))
+			return 0;
+		len--;
+	}
+	return 1;
+}
+
 const dname_type *
 dname_make(region_type *region, const uint8_t *name, int normalize)
 {
@@ -75,9 +142,9 @@ dname_make(region_type *region, const uint8_t *name, int normalize)
 		while (!label_is_root(src)) {
 			ssize_t len = label_length(src);
 			*dst++ = *src++;
-			for (i = 0; i < len; ++i) {
-				*dst++ = DNAME_NORMALIZE((unsigned char)*src++);
-			}
+			dname_normalize_copy(dst, src, len);
+			dst += len;
+			src += len;
 		}
 		*dst = *src;
 	} else {
@@ -89,6 +156,43 @@ dname_make(region_type *region, const uint8_t *name, int normalize)
 }
 
 
+const dname_type *
+dname_make_from_query(region_type *region, buffer_type *packet)
+{
+	uint8_t label_offsets[MAXDOMAINLEN];
+	uint8_t label_count = 0;
+	const uint8_t *name = buffer_current(packet);
+	size_t avail = buffer_remaining(packet);
+	size_t pos = 0;
+	dname_type *result;
+
+	/* walk the label lengths, the offsets are stored from the end */
+	while (1) {
+		if (pos >= avail || pos >= MAXDOMAINLEN ||
+			label_is_pointer(name + pos) ||
+			!label_is_normal(name + pos))
+			return NULL;
+		label_offsets[MAXDOMAINLEN - 1 - label_count] = (uint8_t)pos;
+		++label_count;
+		if (label_is_root(name + pos))
+			break;
+		pos += label_length(name + pos) + 1;
+	}
+	pos++;
+
+	result = (dname_type *) region_alloc(region,
+		sizeof(dname_type) + label_count + pos);
+	result->name_size = pos;
+	result->label_count = label_count;
+	memcpy((uint8_t *) dname_label_offsets(result),
+	       label_offsets + MAXDOMAINLEN - label_count, label_count);
+	/* the label length bytes are below 64, and not changed by the
+	 * normalization, so the name is copied in one go */
+	dname_normalize_copy((uint8_t *) dname_name(result), name, pos);
+	buffer_skip(packet, pos);
+	return result;
+}
+
 const dname_type *
 dname_make_from_packet(region_type *region, buffer_type *packet,
 		       int allow_pointers, int normalize)
@@ -109,21 +213,23 @@ dname_make_wire_from_packet(uint8_t *buf, buffer_type *packet,
 	const uint8_t *label;
 	ssize_t mark = -1;
 
-	if(sizeof(visited)<(buffer_limit(packet)+7)/8)
-		memset(visited, 0, sizeof(visited));
-	else	memset(visited, 0, (buffer_limit(packet)+7)/8);
-
+	/* The labels before the first pointer are read in order and cannot
+	 * loop, the visited bits are cleared at the first pointer, so that
+	 * names without pointers do not clear them for the whole packet.
+	 * A loop into those labels is found on its next round. */
 	while (!done) {
 		if (!buffer_available(packet, 1)) {
 /* 			error("dname out of bounds"); */
 			return 0;
 		}
 
-		if (get_bit(visited, buffer_position(packet))) {
-/* 			error("dname loops"); */
-			return 0;
+		if (mark != -1) {
+			if (get_bit(visited, buffer_position(packet))) {
+/* 				error("dname loops"); */
+				return 0;
+			}
+			set_bit(visited, buffer_position(packet));
 		}
-		set_bit(visited, buffer_position(packet));
 
 		label = buffer_current(packet);
 		if (label_is_pointer(label)) {
@@ -143,6 +249,10 @@ dname_make_wire_from_packet(uint8_t *buf, buffer_type *packet,
 			buffer_skip(packet, 2);
 			if (mark == -1) {
 				mark = buffer_position(packet);
+				if(sizeof(visited)<(buffer_limit(packet)+7)/8)
+					memset(visited, 0, sizeof(visited));
+				else	memset(visited, 0,
+					(buffer_limit(packet)+7)/8);
 			}
 			buffer_set_position(packet, pointer);
 		} else if (label_is_normal(label)) {
@@ -280,6 +390,43 @@ dname_partial_copy(region_type *region, const dname_type *dname, uint8_t label_c
 	return dname_make(region, dname_label(dname, label_count - 1), 0);
 }
 
+size_t
+dname_partial_size(const dname_type *dname, uint8_t label_count)
+{
+	const uint8_t *start;
+	if (label_count == 0)
+		label_count = 1;
+	assert(label_count <= dname->label_count);
+	start = dname_label(dname, label_count - 1);
+	return sizeof(dname_type) + label_count
+		+ (dname->name_size - (start - dname_name(dname)));
+}
+
+const dname_type *
+dname_partial_copy_into(void *dst, const dname_type *dname,
+	uint8_t label_count)
+{
+	dname_type *result = (dname_type *) dst;
+	uint8_t *offsets;
+	uint8_t start, i;
+
+	if (label_count == 0)
+		label_count = 1;
+	assert(label_count <= dname->label_count);
+
+	/* the offsets are from the root label up, they shift by the
+	 * offset of the first label that is copied */
+	start = dname_label_offsets(dname)[label_count - 1];
+	result->name_size = dname->name_size - start;
+	result->label_count = label_count;
+	offsets = (uint8_t *) dname_label_offsets(result);
+	for (i = 0; i < label_count; i++)
+		offsets[i] = dname_label_offsets(dname)[i] - start;
+	memcpy((uint8_t *) dname_name(result), dname_name(dname) + start,
+	       result->name_size);
+	return result;
+}
+
 
 const dname_type *
 dname_origin(region_type *region, const dname_type *dname)
@@ -569,7 +716,7 @@ char* wiredname2str(const uint8_t* dname)
 
 int dname_equal_nocase(uint8_t* a, uint8_t* b, uint16_t len)
 {
-	uint8_t i, lablen;
+	uint8_t lablen;
 	while(len > 0) {
 		/* check labellen */
 		if(*a != *b)
@@ -581,10 +728,10 @@ int dname_equal_nocase(uint8_t* a, uint8_t* b, uint16_t len)
 		if((lablen & 0xc0) || len < lablen)
 			return (memcmp(a, b, len) == 0);
 		/* check the label, lowercased */
-		for(i=0; i<lablen; i++) {
-			if(DNAME_NORMALIZE((unsigned char)*a++) != DNAME_NORMALIZE((unsigned char)*b++))
-				return 0;
-		}
+		if(!label_data_equal_nocase(a, b, lablen))
+			return 0;
+		a += lablen;
+		b += lablen;
 		len -= lablen;
 	}
 	return 1;
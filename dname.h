@@ -69,6 +69,16 @@ const dname_type *dname_make_from_packet(region_type *region,
 					 int allow_pointers,
 					 int normalize);
 
+/*
+ * Construct the normalized query name from the question at PACKET's
+ * current position, in one pass over the label lengths and one copy.
+ * Compression pointers are not allowed.  The position is moved after
+ * the name.  Returns NULL if the name is malformed, too long or does not
+ * fit in the packet.
+ */
+const dname_type *dname_make_from_query(region_type *region,
+					buffer_type *packet);
+
 /*
  * parse wireformat from packet (following pointers) into the
  * given buffer. Returns length in buffer or 0 on error.
@@ -112,6 +122,20 @@ const dname_type *dname_partial_copy(region_type *region,
 				     const dname_type *dname,
 				     uint8_t label_count);
 
+/*
+ * The size of the copy of the most significant LABEL_COUNT labels from
+ * dname, made by dname_partial_copy_into.
+ */
+size_t dname_partial_size(const dname_type *dname, uint8_t label_count);
+
+/*
+ * Copy the most significant LABEL_COUNT labels from dname into DST, that
+ * has space for dname_partial_size bytes.  So that a name can be stored
+ * together with other data in one allocation.
+ */
+const dname_type *dname_partial_copy_into(void *dst, const dname_type *dname,
+					  uint8_t label_count);
+
 
 /*
  * The origin of DNAME.
@@ -63,7 +63,11 @@
 #endif
 
 #define DNSTAP_CONTENT_TYPE		"protobuf:dnstap.Dnstap"
-#define DNSTAP_INITIAL_BUF_SIZE		256
+/* the queue from the collector to the output thread, and the number of
+ * frames, and the bytes, that the output thread gathers in one write */
+#define DNSTAP_INPUT_QUEUE_SIZE		4096
+#define DNSTAP_OUTPUT_QUEUE_SIZE	512
+#define DNSTAP_BUFFER_HINT		65536
 
 struct dt_msg {
 	void		*buf;
@@ -72,24 +76,18 @@ struct dt_msg {
 	Dnstap__Message	m;
 };
 
+/* Pack the message into a buffer of the exact size, in one allocation.
+ * The buffer is handed to the output thread, that frees it when written. */
 static int
 dt_pack(const Dnstap__Dnstap *d, void **buf, size_t *sz)
 {
-	ProtobufCBufferSimple sbuf;
-
-	memset(&sbuf, 0, sizeof(sbuf));
-	sbuf.base.append = protobuf_c_buffer_simple_append;
-	sbuf.len = 0;
-	sbuf.alloced = DNSTAP_INITIAL_BUF_SIZE;
-	sbuf.data = malloc(sbuf.alloced);
-	if (sbuf.data == NULL)
-		return 0;
-	sbuf.must_free_data = 1;
+	size_t len = dnstap__dnstap__get_packed_size(d);
 
-	*sz = dnstap__dnstap__pack_to_buffer(d, (ProtobufCBuffer *) &sbuf);
-	if (sbuf.data == NULL)
+	*buf = malloc(len);
+	if (*buf == NULL)
 		return 0;
-	*buf = sbuf.data;
+	*sz = dnstap__dnstap__pack(d, (uint8_t *) *buf);
+	assert(*sz == len);
 
 	return 1;
 }
@@ -607,6 +605,17 @@ dt_create(const char *socket_path, char* ip, unsigned num_workers,
 
 	fopt = fstrm_iothr_options_init();
 	fstrm_iothr_options_set_num_input_queues(fopt, num_workers);
+	/* The collector submits the messages of all the server processes,
+	 * room in the queue avoids drops when they come in bursts, and the
+	 * output thread writes many frames at once with vectored I/O. */
+	if (fstrm_iothr_options_set_input_queue_size(fopt,
+		DNSTAP_INPUT_QUEUE_SIZE) != fstrm_res_success ||
+	    fstrm_iothr_options_set_output_queue_size(fopt,
+		DNSTAP_OUTPUT_QUEUE_SIZE) != fstrm_res_success ||
+	    fstrm_iothr_options_set_buffer_hint(fopt,
+		DNSTAP_BUFFER_HINT) != fstrm_res_success)
+		log_msg(LOG_WARNING, "dt_create: cannot set fstrm queue "
+			"sizes, using the defaults");
 	env->iothr = fstrm_iothr_init(fopt, &fw);
 	if (env->iothr == NULL) {
 		log_msg(LOG_ERR, "dt_create: fstrm_iothr_init() failed");
@@ -13,6 +13,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
 #ifndef USE_MINI_EVENT
 #  ifdef HAVE_EVENT_H
 #    include <event.h>
@@ -35,8 +38,83 @@
 #include "remote.h"
 
 #include "udb.h"
+#include "packet.h"
 #include "rrl.h"
 
+/* number of messages received from a worker channel per event */
+#define DT_INPUT_BATCH 64
+
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(HAVE_MMAP) && defined(HAVE_ATOMIC_BUILTINS) && defined(MAP_ANONYMOUS)
+/*
+ * Ring buffer in shared memory, from one worker to the collector. The
+ * worker appends messages at head, the collector removes them at tail,
+ * both count bytes and wrap around. The worker only wakes up the collector,
+ * with a byte on the communication channel, when the ring was empty, the
+ * collector drains the ring until it finds it empty after it has stored
+ * the tail. The stores and loads of head and tail are sequentially
+ * consistent, so either the worker sees the empty ring or the collector
+ * sees the new message.
+ */
+#define USE_DT_RING 1
+/* bytes in the ring, a power of two */
+#define DT_RING_SIZE (1024*1024)
+
+struct dt_ring {
+	/* bytes written by the worker */
+	uint32_t head;
+	/* keep head and tail on different cache lines */
+	uint8_t pad1[60];
+	/* bytes read by the collector */
+	uint32_t tail;
+	uint8_t pad2[60];
+	uint8_t data[DT_RING_SIZE];
+};
+
+/* copy len bytes from the ring at position pos */
+static void
+dt_ring_read(struct dt_ring* ring, uint32_t pos, uint8_t* buf, size_t len)
+{
+	size_t off = pos & (DT_RING_SIZE-1);
+	size_t first = DT_RING_SIZE - off;
+	if(first > len)
+		first = len;
+	memcpy(buf, ring->data + off, first);
+	memcpy(buf + first, ring->data, len - first);
+}
+
+/* copy len bytes into the ring at position pos */
+static void
+dt_ring_write(struct dt_ring* ring, uint32_t pos, uint8_t* buf, size_t len)
+{
+	size_t off = pos & (DT_RING_SIZE-1);
+	size_t first = DT_RING_SIZE - off;
+	if(first > len)
+		first = len;
+	memcpy(ring->data + off, buf, first);
+	memcpy(ring->data, buf + first, len - first);
+}
+
+/* put the message in the ring, returns 0 if it does not fit, 1 if it was
+ * added, and 2 if it was added to an empty ring */
+static int
+dt_ring_put(struct dt_ring* ring, uint8_t* data, size_t len)
+{
+	uint32_t head = ring->head; /* only this worker writes it */
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if(len > DT_RING_SIZE - (uint32_t)(head - tail))
+		return 0; /* full, the message is dropped */
+	dt_ring_write(ring, head, data, len);
+	__atomic_store_n(&ring->head, head + (uint32_t)len, __ATOMIC_SEQ_CST);
+	/* if the collector had read everything, it may be asleep */
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+	return (tail == head) ? 2 : 1;
+}
+#endif /* HAVE_MMAP && HAVE_ATOMIC_BUILTINS && MAP_ANONYMOUS */
+
 struct dt_collector* dt_collector_create(struct nsd* nsd)
 {
 	int i, sv[2];
@@ -54,6 +132,8 @@ struct dt_collector* dt_collector_create(struct nsd* nsd)
 		sizeof(struct sockaddr_in) + sizeof(struct sockaddr_in)
 #endif
 		);
+	dt_col->query_buffer = buffer_create(dt_col->region,
+		buffer_capacity(dt_col->send_buffer));
 
 	/* open communication channels in struct nsd */
 	nsd->dt_collector_fd_send = (int*)xalloc_array_zero(dt_col->count,
@@ -96,6 +176,20 @@ struct dt_collector* dt_collector_create(struct nsd* nsd)
 	}
 	nsd->dt_collector_fd_swap = nsd->dt_collector_fd_send + nsd->child_count;
 
+#ifdef USE_DT_RING
+	/* shared memory for the messages, the pages are only used when
+	 * they are written to */
+	dt_col->rings = (struct dt_ring*)mmap(NULL,
+		sizeof(struct dt_ring)*dt_col->count, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(dt_col->rings == MAP_FAILED) {
+		log_msg(LOG_ERR, "dnstap_collector: mmap of ring buffers failed, "
+			"using the communication channels: %s",
+			strerror(errno));
+		dt_col->rings = NULL;
+	}
+#endif
+
 	/* open socketpair */
 	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
 		error("dnstap_collector: cannot create socketpair: %s",
@@ -124,6 +218,10 @@ void dt_collector_destroy(struct dt_collector* dt_col, struct nsd* nsd)
 		free(nsd->dt_collector_fd_swap);
 	nsd->dt_collector_fd_send = NULL;
 	nsd->dt_collector_fd_swap = NULL;
+#ifdef USE_DT_RING
+	if(dt_col->rings)
+		munmap(dt_col->rings, sizeof(struct dt_ring)*dt_col->count);
+#endif
 	region_destroy(dt_col->region);
 	free(dt_col);
 }
@@ -253,13 +351,81 @@ dt_submit_content(struct dt_env* dt_env, struct buffer* buf)
 	}
 }
 
+#ifdef USE_DT_RING
+/* submit the messages in the ring to dnstap, until it is empty */
+static void
+dt_ring_drain(struct dt_collector_input* dt_input)
+{
+	struct dt_ring* ring = dt_input->ring;
+	struct buffer* buf = dt_input->buffer;
+	uint32_t tail = ring->tail; /* only the collector writes it */
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	while(tail != head) {
+		while(tail != head) {
+			uint8_t lenbuf[4];
+			size_t msglen;
+			dt_ring_read(ring, tail, lenbuf, 4);
+			msglen = read_uint32(lenbuf);
+			if(msglen + 4 > (uint32_t)(head - tail) ||
+				msglen + 4 > buffer_capacity(buf)) {
+				log_msg(LOG_ERR, "dnstap collector: ring out of "
+					"sync (msglen: %u)", (unsigned)msglen);
+				tail = head;
+				break;
+			}
+			buffer_clear(buf);
+			dt_ring_read(ring, tail, buffer_begin(buf), msglen+4);
+			tail += (uint32_t)(msglen + 4);
+			buffer_skip(buf, msglen+4);
+			buffer_flip(buf);
+			if(dt_input->dt_collector->dt_env)
+				dt_submit_content(dt_input->dt_collector->dt_env,
+					buf);
+		}
+		buffer_clear(buf);
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+		/* see if the worker added messages while this was busy */
+		head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* handle wakeup from worker, and the messages in its ring */
+static void
+dt_handle_ring_input(int fd, struct dt_collector_input* dt_input)
+{
+	uint8_t wakeup[16];
+	ssize_t r;
+	/* remove the wakeups, the ring has the messages */
+	while((r = recv(fd, wakeup, sizeof(wakeup), MSG_DONTWAIT)) > 0)
+		;
+	if(r == -1 && errno != EAGAIN && errno != EINTR) {
+		log_msg(LOG_ERR, "dnstap collector: receive failed: %s",
+			strerror(errno));
+		event_base_loopexit(dt_input->dt_collector->event_base, NULL);
+		return;
+	}
+	dt_ring_drain(dt_input);
+}
+#endif /* USE_DT_RING */
+
 /* handle input from worker for dnstap */
 void
 dt_handle_input(int fd, short event, void* arg)
 {
 	struct dt_collector_input* dt_input = (struct dt_collector_input*)arg;
-	if((event&EV_READ) != 0) {
-		/* receive */
+	int i;
+#ifdef USE_DT_RING
+	if((event&EV_READ) != 0 && dt_input->ring) {
+		dt_handle_ring_input(fd, dt_input);
+		return;
+	}
+#endif
+	if((event&EV_READ) == 0)
+		return;
+	/* receive the messages that are waiting, up to a batch, so that the
+	 * channel empties before the worker finds it full and drops logs,
+	 * and the other workers get their turn after the batch */
+	for(i = 0; i < DT_INPUT_BATCH; i++) {
 		int r = recv_into_buffer(fd, dt_input->buffer);
 		if(r == 0)
 			return;
@@ -274,7 +440,7 @@ dt_handle_input(int fd, short event, void* arg)
 			dt_submit_content(dt_input->dt_collector->dt_env,
 				dt_input->buffer);
 		}
-		
+
 		/* clear buffer for next message */
 		buffer_clear(dt_input->buffer);
 	}
@@ -359,6 +525,9 @@ static void dt_attach_events(struct dt_collector* dt_col, struct nsd* nsd)
 		sizeof(*dt_col->inputs));
 	for(i=0; i<dt_col->count; i++) {
 		dt_col->inputs[i].dt_collector = dt_col;
+#ifdef USE_DT_RING
+		dt_col->inputs[i].ring = dt_col->rings?&dt_col->rings[i]:NULL;
+#endif
 		dt_col->inputs[i].event = (struct event*)xalloc_zero(
 			sizeof(struct event));
 		event_set(dt_col->inputs[i].event,
@@ -432,6 +601,11 @@ void dt_collector_start(struct dt_collector* dt_col, struct nsd* nsd)
 #endif
 #ifdef USE_LOG_PROCESS_ROLE
                 log_set_process_role("dnstap_collector");
+#endif
+#ifdef HAVE_CPUSET_T
+		/* the collector runs next to xfrd, off the server cpus */
+		if(nsd->use_cpu_affinity)
+			set_cpu_affinity(nsd->xfrd_cpuset);
 #endif
 		/* Free serve process specific memory pages */
 #ifdef RATELIMIT
@@ -539,6 +713,80 @@ static int attempt_to_send(int s, uint8_t* data, size_t len)
 	return -1;
 }
 
+/* send the message in buf to the collector, through the ring buffer or the
+ * communication channel */
+static void
+dt_collector_send(struct nsd* nsd, struct buffer* buf)
+{
+	int* fd = &nsd->dt_collector_fd_send[nsd->this_child->child_num];
+#ifdef USE_DT_RING
+	if(nsd->dt_collector->rings) {
+		/* the rings are in the same order as the channels, that
+		 * swap halves for the old and new workers on a reload */
+		struct dt_ring* ring = &nsd->dt_collector->rings[
+			(nsd->dt_collector_fd_send < nsd->dt_collector_fd_swap ?
+			0 : nsd->child_count) + nsd->this_child->child_num];
+		uint8_t wakeup = 0;
+		if(dt_ring_put(ring, buffer_begin(buf),
+			buffer_remaining(buf)) != 2)
+			return;
+		if(attempt_to_send(*fd, &wakeup, 1) == 0)
+			return;
+	} else
+#endif
+	/* attempt to send data; do not block */
+	if(attempt_to_send(*fd, buffer_begin(buf),
+			buffer_remaining(buf)) == 0)
+		return;
+	/* Something went wrong sending to the socket. Don't send to
+	 * this socket again. */
+	close(*fd);
+	*fd = -1;
+}
+
+/* if the queries are selected by the sample rate or filter rules */
+static int
+dt_filter_active(struct nsd* nsd)
+{
+	return nsd->options->dnstap_sample_rate != 1 ||
+		nsd->options->dnstap_filters != NULL;
+}
+
+/* see if the query, with the response in packet, is logged. A query that
+ * matches a filter rule is always logged, the others by the sample rate. */
+static int
+dt_filter_select(struct nsd* nsd, int is_tcp, struct buffer* packet,
+	struct zone* zone)
+{
+	struct dt_collector* dt_col = nsd->dt_collector;
+	struct dnstap_filter* f;
+	int qtype = -1;
+
+	if(nsd->options->dnstap_filters && QDCOUNT(packet) == 1) {
+		/* the qtype from the question section of the response */
+		buffer_set_position(packet, QHEADERSZ);
+		if(packet_skip_dname(packet) && buffer_available(packet, 2))
+			qtype = buffer_read_u16(packet);
+		buffer_set_position(packet, 0);
+	}
+	for(f = nsd->options->dnstap_filters; f; f = f->next) {
+		if(f->zone && (!zone || !zone->apex || dname_compare(
+			domain_dname(zone->apex), f->zone) != 0))
+			continue;
+		if(f->rcode != -1 && f->rcode != RCODE(packet))
+			continue;
+		if(f->qtype != -1 && f->qtype != qtype)
+			continue;
+		if(f->transport != -1 && f->transport != (is_tcp?1:0))
+			continue;
+		return 1;
+	}
+	if(nsd->options->dnstap_sample_rate <= 0)
+		return 0;
+	return (++dt_col->sample_count %
+		(uint32_t)nsd->options->dnstap_sample_rate) == 0;
+}
+
 void dt_collector_submit_auth_query(struct nsd* nsd,
 #ifdef INET6
 	struct sockaddr_storage* local_addr,
@@ -552,6 +800,15 @@ void dt_collector_submit_auth_query(struct nsd* nsd,
 	if(!nsd->dt_collector) return;
 	if(!nsd->options->dnstap_log_auth_query_messages) return;
 	if(nsd->dt_collector_fd_send[nsd->this_child->child_num] == -1) return;
+
+	if(dt_filter_active(nsd)) {
+		/* keep the query until the response is known, the rules
+		 * are for the zone and rcode of the response */
+		nsd->dt_collector->query_pending = prep_send_data(
+			nsd->dt_collector->query_buffer, 0, local_addr, addr,
+			addrlen, is_tcp, packet, NULL);
+		return;
+	}
 	VERBOSITY(4, (LOG_INFO, "dnstap submit auth query"));
 
 	/* marshal data into send buffer */
@@ -559,15 +816,7 @@ void dt_collector_submit_auth_query(struct nsd* nsd,
 		is_tcp, packet, NULL))
 		return; /* probably did not fit in buffer */
 
-	/* attempt to send data; do not block */
-	if(attempt_to_send(nsd->dt_collector_fd_send[nsd->this_child->child_num],
-			buffer_begin(nsd->dt_collector->send_buffer),
-			buffer_remaining(nsd->dt_collector->send_buffer))) {
-		/* Something went wrong sending to the socket. Don't send to
-		 * this socket again. */
-		close(nsd->dt_collector_fd_send[nsd->this_child->child_num]);
-		nsd->dt_collector_fd_send[nsd->this_child->child_num] = -1;
-	}
+	dt_collector_send(nsd, nsd->dt_collector->send_buffer);
 }
 
 void dt_collector_submit_auth_response(struct nsd* nsd,
@@ -582,8 +831,22 @@ void dt_collector_submit_auth_response(struct nsd* nsd,
 	struct zone* zone)
 {
 	if(!nsd->dt_collector) return;
-	if(!nsd->options->dnstap_log_auth_response_messages) return;
 	if(nsd->dt_collector_fd_send[nsd->this_child->child_num] == -1) return;
+
+	if(dt_filter_active(nsd)) {
+		int pending = nsd->dt_collector->query_pending;
+		nsd->dt_collector->query_pending = 0;
+		if(!dt_filter_select(nsd, is_tcp, packet, zone))
+			return;
+		if(pending) {
+			VERBOSITY(4, (LOG_INFO, "dnstap submit auth query"));
+			dt_collector_send(nsd, nsd->dt_collector->query_buffer);
+			if(nsd->dt_collector_fd_send[
+				nsd->this_child->child_num] == -1)
+				return;
+		}
+	}
+	if(!nsd->options->dnstap_log_auth_response_messages) return;
 	VERBOSITY(4, (LOG_INFO, "dnstap submit auth response"));
 
 	/* marshal data into send buffer */
@@ -591,13 +854,5 @@ void dt_collector_submit_auth_response(struct nsd* nsd,
 		is_tcp, packet, zone))
 		return; /* probably did not fit in buffer */
 
-	/* attempt to send data; do not block */
-	if(attempt_to_send(nsd->dt_collector_fd_send[nsd->this_child->child_num],
-			buffer_begin(nsd->dt_collector->send_buffer),
-			buffer_remaining(nsd->dt_collector->send_buffer))) {
-		/* Something went wrong sending to the socket. Don't send to
-		 * this socket again. */
-		close(nsd->dt_collector_fd_send[nsd->this_child->child_num]);
-		nsd->dt_collector_fd_send[nsd->this_child->child_num] = -1;
-	}
+	dt_collector_send(nsd, nsd->dt_collector->send_buffer);
 }
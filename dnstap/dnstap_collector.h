@@ -14,6 +14,7 @@ struct nsd;
 struct event_base;
 struct event;
 struct dt_collector_input;
+struct dt_ring;
 struct zone;
 struct buffer;
 struct region;
@@ -43,6 +44,16 @@ struct dt_collector {
 	struct region* region;
 	/* buffer for sending data to the collector */
 	struct buffer* send_buffer;
+	/* with sampling or filter rules, the query waits here until the
+	 * response shows if it is logged, query_pending if it is there */
+	struct buffer* query_buffer;
+	int query_pending;
+	/* number of queries seen for the sample rate */
+	uint32_t sample_count;
+	/* shared memory ring buffer per worker, array size count, or NULL
+	 * if the messages are sent over the communication channels. With
+	 * the rings, the channel only carries wakeups for the collector. */
+	struct dt_ring* rings;
 };
 
 /* information per worker to get input from that worker. */
@@ -53,6 +64,8 @@ struct dt_collector_input {
 	struct event* event;
 	/* buffer to store the datagrams while they are read in */
 	struct buffer* buffer;
+	/* the ring buffer of the worker, or NULL */
+	struct dt_ring* ring;
 };
 
 /* create dt_collector process structure and dt_env */
@@ -20,6 +20,7 @@
 #include "edns.h"
 #include "nsd.h"
 #include "query.h"
+#include "util.h"
 
 #if !defined(HAVE_SSL) || !defined(HAVE_CRYPTO_MEMCMP)
 /* we need fixed time compare, pull it in from tsig.c */
@@ -49,16 +50,42 @@ edns_init_data(edns_data_type *data, uint16_t max_length)
 	data->cookie[1] = (COOKIE_CODE & 0x00ff);
 	data->cookie[2] = (24 & 0xff00) >> 8;
 	data->cookie[3] = (24 & 0x00ff);
+
+	/* the OPT RRs with empty rdata, without and with the DO bit */
+	memcpy(data->ok_empty[0], data->ok, OPT_LEN);
+	memcpy(data->ok_empty[1], data->ok, OPT_LEN);
+	data->ok_empty[1][7] = 0x80;
+	memcpy(data->error_empty[0], data->error, OPT_LEN);
+	memcpy(data->error_empty[1], data->error, OPT_LEN);
+	data->error_empty[1][7] = 0x80;
 }
 
 void
-edns_init_nsid(edns_data_type *data, uint16_t nsid_len)
+edns_init_nsid(edns_data_type *data, const unsigned char* nsid,
+	uint16_t nsid_len)
 {
+	int i;
+	uint8_t* p;
        /* NSID OPT HDR */
        data->nsid[0] = (NSID_CODE & 0xff00) >> 8;
        data->nsid[1] = (NSID_CODE & 0x00ff);
        data->nsid[2] = (nsid_len & 0xff00) >> 8;
        data->nsid[3] = (nsid_len & 0x00ff);
+	if(nsid_len == 0 || nsid_len > 65535 - OPT_HDR)
+		return;
+
+	/* the OPT RRs with only the NSID option, the common answer to a
+	 * query with NSID, written in one piece */
+	data->ok_nsid_len = OPT_LEN + OPT_RDATA + OPT_HDR + nsid_len;
+	for(i=0; i<2; i++) {
+		free(data->ok_nsid[i]);
+		p = data->ok_nsid[i] = xalloc(data->ok_nsid_len);
+		memcpy(p, data->ok_empty[i], OPT_LEN);
+		p[OPT_LEN] = ((OPT_HDR + nsid_len) & 0xff00) >> 8;
+		p[OPT_LEN+1] = (OPT_HDR + nsid_len) & 0x00ff;
+		memcpy(p + OPT_LEN + OPT_RDATA, data->nsid, OPT_HDR);
+		memcpy(p + OPT_LEN + OPT_RDATA + OPT_HDR, nsid, nsid_len);
+	}
 }
 
 void
@@ -75,6 +102,7 @@ edns_init_record(edns_record_type *edns)
 	edns->ede = -1; /* -1 means no Extended DNS Error */
 	edns->ede_text = NULL;
 	edns->ede_text_len = 0;
+	edns->keepalive = 0;
 }
 
 /** handle a single edns option in the query */
@@ -82,7 +110,6 @@ static int
 edns_handle_option(uint16_t optcode, uint16_t optlen, buffer_type* packet,
 	edns_record_type* edns, struct query* query, nsd_type* nsd)
 {
-	(void) query; /* in case edns options need the query structure */
 	/* handle opt code and read the optlen bytes from the packet */
 	switch(optcode) {
 	case NSID_CODE:
@@ -116,6 +143,19 @@ edns_handle_option(uint16_t optcode, uint16_t optlen, buffer_type* packet,
 			buffer_skip(packet, optlen);
 		}
 		break;
+	case KEEPALIVE_CODE:
+		/* RFC 7828, the option is ignored over UDP, and over TCP
+		 * a client does not send a timeout */
+		if(query->tcp) {
+			if(optlen != 0)
+				return 0; /* FORMERR */
+			edns->keepalive = 1;
+			/* in the reply the timeout is 2 bytes */
+			edns->opt_reserved_space += OPT_HDR + 2;
+		} else {
+			buffer_skip(packet, optlen);
+		}
+		break;
 	default:
 		buffer_skip(packet, optlen);
 		break;
@@ -195,9 +235,6 @@ edns_reserved_space(edns_record_type *edns)
 	     : (OPT_LEN + OPT_RDATA + edns->opt_reserved_space);
 }
 
-int siphash(const uint8_t *in, const size_t inlen,
-                const uint8_t *k, uint8_t *out, const size_t outlen);
-
 /** RFC 1982 comparison, uses unsigned integers, and tries to avoid
  * compiler optimization (eg. by avoiding a-b<0 comparisons),
  * this routine matches compare_serial(), for SOA serial number checks */
@@ -283,8 +320,9 @@ void cookie_verify(query_type *q, struct nsd* nsd, uint32_t *now_p) {
 #endif
 
 	q->edns.cookie_status = COOKIE_INVALID;
-	siphash(q->edns.cookie, verify_size,
-		nsd->cookie_secrets[0].cookie_secret, hash, 8);
+	/* the active secret first, most cookies are made with it */
+	siphash_key_hash(&nsd->cookie_keys[0], q->edns.cookie, verify_size,
+		hash);
 	if(CRYPTO_memcmp(hash2verify, hash, 8) == 0 ) {
 		if (subtract_1982(cookie_time, now_uint32) < 1800) {
 			q->edns.cookie_status = COOKIE_VALID_REUSE;
@@ -296,8 +334,8 @@ void cookie_verify(query_type *q, struct nsd* nsd, uint32_t *now_p) {
 	for(i = 1;
 	    i < (int)nsd->cookie_count && i < NSD_COOKIE_HISTORY_SIZE;
 	    i++) {
-		siphash(q->edns.cookie, verify_size,
-		        nsd->cookie_secrets[i].cookie_secret, hash, 8);
+		siphash_key_hash(&nsd->cookie_keys[i], q->edns.cookie,
+			verify_size, hash);
 		if(CRYPTO_memcmp(hash2verify, hash, 8) == 0 ) {
 			q->edns.cookie_status = COOKIE_VALID;
 			return;
@@ -326,15 +364,15 @@ void cookie_create(query_type *q, struct nsd* nsd, uint32_t *now_p)
 	if (q->client_addr.ss_family == AF_INET6) {
 		memcpy( q->edns.cookie + 16
 		      , &((struct sockaddr_in6 *)&q->client_addr)->sin6_addr, 16);
-		siphash(q->edns.cookie, 32, nsd->cookie_secrets[0].cookie_secret, hash, 8);
+		siphash_key_hash(&nsd->cookie_keys[0], q->edns.cookie, 32, hash);
 	} else {
 		memcpy( q->edns.cookie + 16
 		      , &((struct sockaddr_in *)&q->client_addr)->sin_addr, 4);
-		siphash(q->edns.cookie, 20, nsd->cookie_secrets[0].cookie_secret, hash, 8);
+		siphash_key_hash(&nsd->cookie_keys[0], q->edns.cookie, 20, hash);
 	}
 #else
 	memcpy( q->edns.cookie + 16, &q->client_addr.sin_addr, 4);
-	siphash(q->edns.cookie, 20, nsd->cookie_secrets[0].cookie_secret, hash, 8);
+	siphash_key_hash(&nsd->cookie_keys[0], q->edns.cookie, 20, hash);
 #endif
 	memcpy(q->edns.cookie + 16, hash, 8);
 }
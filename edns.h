@@ -19,6 +19,7 @@ struct query;
 #define OPT_HDR 4U                      /* NSID opt header length */
 #define NSID_CODE       3               /* nsid option code */
 #define COOKIE_CODE    10               /* COOKIE option code */
+#define KEEPALIVE_CODE 11               /* edns-tcp-keepalive option code */
 #define EDE_CODE       15               /* Extended DNS Errors option code */
 #define DNSSEC_OK_MASK  0x8000U         /* do bit mask */
 
@@ -26,9 +27,16 @@ struct edns_data
 {
 	char ok[OPT_LEN];
 	char error[OPT_LEN];
-	char rdata_none[OPT_RDATA];
 	char nsid[OPT_HDR];
 	char cookie[OPT_HDR];
+	/* The OPT RRs as they are written in the answer, indexed by the
+	 * DO bit, so that only the options that change are written for a
+	 * query. With an empty rdata, and for BADVERS. */
+	uint8_t ok_empty[2][OPT_LEN + OPT_RDATA];
+	uint8_t error_empty[2][OPT_LEN + OPT_RDATA];
+	/* With the NSID option as the rdata, NULL if there is no NSID */
+	uint8_t* ok_nsid[2];
+	size_t ok_nsid_len;
 };
 typedef struct edns_data edns_data_type;
 
@@ -65,6 +73,7 @@ struct edns_record
 	int                ede; /* RFC 8914 - Extended DNS Errors */
 	char*              ede_text; /* RFC 8914 - Extended DNS Errors text*/
 	uint16_t           ede_text_len;
+	int                keepalive; /* RFC 7828 - edns-tcp-keepalive */
 };
 typedef struct edns_record edns_record_type;
 
@@ -98,7 +107,9 @@ int edns_parse_record(edns_record_type *data, buffer_type *packet,
  */
 size_t edns_reserved_space(edns_record_type *data);
 
-void edns_init_nsid(edns_data_type *data, uint16_t nsid_len);
+/* set the NSID option, nsid is the payload of nsid_len bytes */
+void edns_init_nsid(edns_data_type *data, const unsigned char* nsid,
+	uint16_t nsid_len);
 
 void cookie_verify(struct query *q, struct nsd* nsd, uint32_t *now_p);
 void cookie_create(struct query *q, struct nsd* nsd, uint32_t *now_p);
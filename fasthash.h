@@ -0,0 +1,133 @@
+/*
+ * fasthash.h -- fast non-cryptographic hash for the internal tables
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The hash is wyhash (final version 4, by Wang Yi, released in the public
+ * domain), that reads the key in 4 and 8 byte words and mixes them with a
+ * 64x64 to 128 bit multiply. For the short keys of the internal tables,
+ * the source address and query name for RRL, the response cache and name
+ * lookups, it takes a few multiplies where hashlittle steps through the
+ * key in blocks of 12 bytes.
+ *
+ * It is used for the tables in memory only, the values differ between
+ * little and big endian machines. Keys that are hashed on disk, such as
+ * in the xfrd state file, stay with hashlittle.
+ */
+
+#ifndef FASTHASH_H
+#define FASTHASH_H
+#include <stdint.h>
+#include <string.h>
+
+/* the multiply of wyhash, with the 64 bit halves of the 128 bit result
+ * in a (low) and b (high) */
+static inline void
+fasthash_mum(uint64_t* a, uint64_t* b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t
+fasthash_mix(uint64_t a, uint64_t b)
+{
+	fasthash_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t
+fasthash_r8(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+fasthash_r4(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* 64 bit hash of the key */
+static inline uint64_t
+fasthash64(const void* key, size_t len, uint64_t seed)
+{
+	static const uint64_t s[4] = { 0x2d358dccaa6c78a5ULL,
+		0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+		0x4d5a2da51de1aa47ULL };
+	const uint8_t* p = (const uint8_t*)key;
+	uint64_t a, b;
+
+	seed ^= fasthash_mix(seed ^ s[0], s[1]);
+	if(len <= 16) {
+		if(len >= 4) {
+			a = (fasthash_r4(p) << 32) |
+				fasthash_r4(p + ((len >> 3) << 2));
+			b = (fasthash_r4(p + len - 4) << 32) |
+				fasthash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if(len > 0) {
+			a = ((uint64_t)p[0] << 16) |
+				((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if(i >= 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = fasthash_mix(fasthash_r8(p) ^ s[1],
+					fasthash_r8(p + 8) ^ seed);
+				see1 = fasthash_mix(fasthash_r8(p + 16) ^ s[2],
+					fasthash_r8(p + 24) ^ see1);
+				see2 = fasthash_mix(fasthash_r8(p + 32) ^ s[3],
+					fasthash_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while(i >= 48);
+			seed ^= see1 ^ see2;
+		}
+		while(i > 16) {
+			seed = fasthash_mix(fasthash_r8(p) ^ s[1],
+				fasthash_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = fasthash_r8(p + i - 16);
+		b = fasthash_r8(p + i - 8);
+	}
+	a ^= s[1];
+	b ^= seed;
+	fasthash_mum(&a, &b);
+	return fasthash_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+/* 32 bit hash of the key, for the table indexes */
+static inline uint32_t
+fasthash32(const void* key, size_t len, uint32_t seed)
+{
+	uint64_t h = fasthash64(key, len, seed);
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+#endif /* FASTHASH_H */
@@ -242,9 +242,46 @@ stats_add(struct nsdst* total, struct nsdst* s)
 	total->raxfr += s->raxfr;
 	total->nona += s->nona;
 	total->rixfr += s->rixfr;
+	total->rcache_hit += s->rcache_hit;
+	total->rcache_miss += s->rcache_miss;
+	total->udp_gso += s->udp_gso;
+	total->tls_resumed += s->tls_resumed;
+	total->tls_full += s->tls_full;
+	total->tls_ktls += s->tls_ktls;
+	total->tls_async += s->tls_async;
+	total->tls_handshake_usec += s->tls_handshake_usec;
+	total->tcp_evicted += s->tcp_evicted;
+	total->rrl_evicted += s->rrl_evicted;
+	total->rrl_collision += s->rrl_collision;
+	total->udp_shed += s->udp_shed;
+	total->udp_overload += s->udp_overload;
+	total->tcp_source_limited += s->tcp_source_limited;
+	total->xfr_out_limited += s->xfr_out_limited;
+	total->xdp_malformed += s->xdp_malformed;
+	total->xdp_ratelimited += s->xdp_ratelimited;
+	total->tcp_accepted += s->tcp_accepted;
+	total->tcp_pool_reused += s->tcp_pool_reused;
+	for(i=0; i<LATENCY_TRANSPORTS; i++) {
+		unsigned b;
+		for(b=0; b<LATENCY_BUCKETS; b++)
+			total->latency[i][b] += s->latency[i][b];
+	}
+	total->rxq_dropped += s->rxq_dropped;
+	for(i=0; i<LATENCY_BUCKETS; i++)
+		total->rxq_latency[i] += s->rxq_latency[i];
+	for(i=0; i<UDP_BATCH_BUCKETS; i++)
+		total->udp_batch[i] += s->udp_batch[i];
+	for(i=0; i<TCP_OCCUPANCY_BUCKETS; i++)
+		total->tcp_occupancy[i] += s->tcp_occupancy[i];
+	for(i=0; i<TCP_TIMEOUT_BUCKETS; i++)
+		total->tcp_timeout[i] += s->tcp_timeout[i];
+	total->page_faults_major += s->page_faults_major;
+	total->page_faults_minor += s->page_faults_minor;
 
 	total->db_disk = s->db_disk;
 	total->db_mem = s->db_mem;
+	total->db_reload_faults = s->db_reload_faults;
+	total->db_compact_bytes = s->db_compact_bytes;
 }
 
 /** subtract stats from total */
@@ -276,6 +313,41 @@ stats_subtract(struct nsdst* total, struct nsdst* s)
 	total->raxfr -= s->raxfr;
 	total->nona -= s->nona;
 	total->rixfr -= s->rixfr;
+	total->rcache_hit -= s->rcache_hit;
+	total->rcache_miss -= s->rcache_miss;
+	total->udp_gso -= s->udp_gso;
+	total->tls_resumed -= s->tls_resumed;
+	total->tls_full -= s->tls_full;
+	total->tls_ktls -= s->tls_ktls;
+	total->tls_async -= s->tls_async;
+	total->tls_handshake_usec -= s->tls_handshake_usec;
+	total->tcp_evicted -= s->tcp_evicted;
+	total->rrl_evicted -= s->rrl_evicted;
+	total->rrl_collision -= s->rrl_collision;
+	total->udp_shed -= s->udp_shed;
+	total->udp_overload -= s->udp_overload;
+	total->tcp_source_limited -= s->tcp_source_limited;
+	total->xfr_out_limited -= s->xfr_out_limited;
+	total->xdp_malformed -= s->xdp_malformed;
+	total->xdp_ratelimited -= s->xdp_ratelimited;
+	total->tcp_accepted -= s->tcp_accepted;
+	total->tcp_pool_reused -= s->tcp_pool_reused;
+	for(i=0; i<LATENCY_TRANSPORTS; i++) {
+		unsigned b;
+		for(b=0; b<LATENCY_BUCKETS; b++)
+			total->latency[i][b] -= s->latency[i][b];
+	}
+	total->rxq_dropped -= s->rxq_dropped;
+	for(i=0; i<LATENCY_BUCKETS; i++)
+		total->rxq_latency[i] -= s->rxq_latency[i];
+	for(i=0; i<UDP_BATCH_BUCKETS; i++)
+		total->udp_batch[i] -= s->udp_batch[i];
+	for(i=0; i<TCP_OCCUPANCY_BUCKETS; i++)
+		total->tcp_occupancy[i] -= s->tcp_occupancy[i];
+	for(i=0; i<TCP_TIMEOUT_BUCKETS; i++)
+		total->tcp_timeout[i] -= s->tcp_timeout[i];
+	total->page_faults_major -= s->page_faults_major;
+	total->page_faults_minor -= s->page_faults_minor;
 }
 #endif /* BIND8_STATS */
 
@@ -407,7 +479,9 @@ static void
 xfrd_send_reload_req(xfrd_state_type* xfrd)
 {
 	sig_atomic_t req = NSD_RELOAD;
-	uint64_t p = xfrd->last_task->data;
+	uint64_t p;
+	xfrd_flush_expire_notifications();
+	p = xfrd->last_task->data;
 	udb_ptr_unlink(xfrd->last_task, xfrd->nsd->task[xfrd->nsd->mytask]);
 	task_process_sync(xfrd->nsd->task[xfrd->nsd->mytask]);
 	/* ask server_main for a reload */
@@ -19,6 +19,7 @@
 #  include <sys/stat.h>
 #endif
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "ixfr.h"
 #include "packet.h"
@@ -185,6 +186,8 @@ static void pktcompression_insert_with_labels(struct pktcompression* pcomp,
 	}
 }
 
+static void ixfr_data_free(struct ixfr_data* data);
+
 /* calculate length of dname in uncompressed wireformat in buffer */
 static size_t dname_length(const uint8_t* buf, size_t len)
 {
@@ -739,10 +742,201 @@ static uint16_t ixfr_copy_rrs_into_packet(struct query* query,
 	return total_added;
 }
 
+/* an RR in the net changes of condensed versions */
+struct ixfr_condense_rr {
+	/* node in the tree, the key is the struct itself */
+	rbnode_type node;
+	/* the RR that identifies the entry, and the length of its owner */
+	const uint8_t* rr;
+	size_t owner_len;
+	/* the RR deleted from the old version, or NULL */
+	const uint8_t* del;
+	size_t del_len;
+	/* the RR added in the new version, or NULL */
+	const uint8_t* add;
+	size_t add_len;
+};
+
+/* compare RRs by owner name, type, class and rdata, but not the TTL */
+static int ixfr_condense_cmp(const void* a, const void* b)
+{
+	const struct ixfr_condense_rr* x = (const struct ixfr_condense_rr*)a;
+	const struct ixfr_condense_rr* y = (const struct ixfr_condense_rr*)b;
+	uint16_t xlen, ylen;
+	size_t i;
+	int c;
+	for(i=0; i<x->owner_len && i<y->owner_len; i++) {
+		int xc = tolower((unsigned char)x->rr[i]);
+		int yc = tolower((unsigned char)y->rr[i]);
+		if(xc != yc)
+			return xc<yc?-1:1;
+	}
+	if(x->owner_len != y->owner_len)
+		return x->owner_len<y->owner_len?-1:1;
+	/* type and class */
+	if((c = memcmp(x->rr+x->owner_len, y->rr+y->owner_len, 4)) != 0)
+		return c;
+	xlen = read_uint16(x->rr+x->owner_len+8);
+	ylen = read_uint16(y->rr+y->owner_len+8);
+	if(xlen != ylen)
+		return xlen<ylen?-1:1;
+	return memcmp(x->rr+x->owner_len+10, y->rr+y->owner_len+10, xlen);
+}
+
+/* account a deleted or added RR in the net changes */
+static int ixfr_condense_rr(struct region* region, struct rbtree* tree,
+	const uint8_t* rr, size_t rrlen, int isadd)
+{
+	struct ixfr_condense_rr key, *e;
+	key.node.key = &key;
+	key.rr = rr;
+	key.owner_len = dname_length(rr, rrlen);
+	if(key.owner_len == 0)
+		return 0;
+	e = (struct ixfr_condense_rr*)rbtree_search(tree, &key);
+	if(!e) {
+		e = (struct ixfr_condense_rr*)region_alloc_zero(region,
+			sizeof(*e));
+		e->node.key = e;
+		e->rr = rr;
+		e->owner_len = key.owner_len;
+		rbtree_insert(tree, &e->node);
+	}
+	if(isadd) {
+		if(e->del && !e->add && e->del_len == rrlen &&
+			memcmp(e->del, rr, rrlen) == 0) {
+			/* deleted and added back, it is not changed */
+			e->del = NULL;
+		} else {
+			e->add = rr;
+			e->add_len = rrlen;
+		}
+	} else if(e->add) {
+		/* added in between and deleted again, or the TTL changed
+		 * in between and then deleted, the old RR is deleted */
+		e->add = NULL;
+	} else if(!e->del) {
+		e->del = rr;
+		e->del_len = rrlen;
+	}
+	return 1;
+}
+
+/* account the RRs of a del or add section in the net changes. A del
+ * section of versions collated from a file contains the add sections of
+ * the older versions too, every SOA ends a del or add section. */
+static int ixfr_condense_section(struct region* region, struct rbtree* tree,
+	const uint8_t* data, size_t len, int* isadd)
+{
+	size_t pos = 0;
+	while(pos < len) {
+		size_t rrlen = count_rr_length(data, len, pos);
+		size_t owner_len;
+		if(rrlen == 0)
+			return 0;
+		owner_len = dname_length(data+pos, rrlen);
+		if(owner_len == 0)
+			return 0;
+		if(read_uint16(data+pos+owner_len) == TYPE_SOA)
+			*isadd = !*isadd;
+		else if(!ixfr_condense_rr(region, tree, data+pos, rrlen,
+			*isadd))
+			return 0;
+		pos += rrlen;
+	}
+	return 1;
+}
+
+/* create ixfr data with the net changes from the start of data to the end
+ * of the end data, the versions in between must be connected */
+static struct ixfr_data* ixfr_condense(struct zone_ixfr* ixfr,
+	struct ixfr_data* data, struct ixfr_data* end)
+{
+	struct region* region = region_create(xalloc, free);
+	struct rbtree* tree = rbtree_create(region, ixfr_condense_cmp);
+	struct ixfr_condense_rr* e;
+	struct ixfr_data* p, *c;
+	size_t del_len = end->newsoa_len, add_len = end->newsoa_len;
+	uint8_t* dp, *ap;
+	for(p = data; p; p = (p == end ? NULL : ixfr_data_next(ixfr, p))) {
+		int isadd = 0;
+		if(!ixfr_condense_section(region, tree, p->del, p->del_len,
+			&isadd)) {
+			region_destroy(region);
+			return NULL;
+		}
+		isadd = 1;
+		if(!ixfr_condense_section(region, tree, p->add, p->add_len,
+			&isadd)) {
+			region_destroy(region);
+			return NULL;
+		}
+	}
+	RBTREE_FOR(e, struct ixfr_condense_rr*, tree) {
+		if(e->del)
+			del_len += e->del_len;
+		if(e->add)
+			add_len += e->add_len;
+	}
+	c = xalloc_zero(sizeof(*c));
+	c->oldserial = data->oldserial;
+	c->newserial = end->newserial;
+	c->newsoa = xalloc(end->newsoa_len);
+	memcpy(c->newsoa, end->newsoa, end->newsoa_len);
+	c->newsoa_len = end->newsoa_len;
+	c->oldsoa = xalloc(data->oldsoa_len);
+	memcpy(c->oldsoa, data->oldsoa, data->oldsoa_len);
+	c->oldsoa_len = data->oldsoa_len;
+	c->del = dp = xalloc(del_len);
+	c->del_len = del_len;
+	c->add = ap = xalloc(add_len);
+	c->add_len = add_len;
+	RBTREE_FOR(e, struct ixfr_condense_rr*, tree) {
+		if(e->del) {
+			memcpy(dp, e->del, e->del_len);
+			dp += e->del_len;
+		}
+		if(e->add) {
+			memcpy(ap, e->add, e->add_len);
+			ap += e->add_len;
+		}
+	}
+	/* the sections end with the SOA of the new serial */
+	memcpy(dp, end->newsoa, end->newsoa_len);
+	memcpy(ap, end->newsoa, end->newsoa_len);
+	region_destroy(region);
+	return c;
+}
+
+/* get the condensed ixfr data from data to the end, create it if it is
+ * not there yet. Returns NULL on failure, then the versions are sent. */
+static struct ixfr_data* ixfr_condensed_get(struct zone_ixfr* ixfr,
+	struct ixfr_data* data, struct ixfr_data* end)
+{
+	struct ixfr_data* c;
+	if(!ixfr->condensed)
+		return NULL;
+	c = (struct ixfr_data*)rbtree_search(ixfr->condensed,
+		&data->oldserial);
+	if(c) {
+		if(c->newserial == end->newserial)
+			return c;
+		rbtree_delete(ixfr->condensed, &c->oldserial);
+		ixfr_data_free(c);
+	}
+	c = ixfr_condense(ixfr, data, end);
+	if(!c)
+		return NULL;
+	c->node.key = &c->oldserial;
+	rbtree_insert(ixfr->condensed, &c->node);
+	return c;
+}
+
 query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 {
 	uint16_t total_added = 0;
 	struct pktcompression pcomp;
+	size_t start;
 
 	if (query->ixfr_is_done)
 		return QUERY_PROCESSED;
@@ -846,10 +1040,20 @@ query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 		}
 
 		query->zone = zone;
-		query->ixfr_data = ixfr_data;
 		query->ixfr_is_done = 0;
 		/* set up to copy the last version's SOA as first SOA */
 		query->ixfr_end_data = ixfr_data_last(zone->ixfr);
+		if(zone->opts->pattern->ixfr_condense &&
+			ixfr_data != query->ixfr_end_data) {
+			/* send the net changes as one version */
+			struct ixfr_data* c = ixfr_condensed_get(zone->ixfr,
+				ixfr_data, query->ixfr_end_data);
+			if(c) {
+				ixfr_data = c;
+				query->ixfr_end_data = c;
+			}
+		}
+		query->ixfr_data = ixfr_data;
 		query->ixfr_count_newsoa = 0;
 		query->ixfr_count_oldsoa = 0;
 		query->ixfr_count_del = 0;
@@ -862,6 +1066,16 @@ query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 		if(query->tsig.status == TSIG_OK) {
 			query->tsig_sign_it = 1; /* sign first packet in stream */
 		}
+		/* the answer packets over TCP are the same for every transfer
+		 * between these serials, they can come from the cache */
+		start = buffer_position(query->packet);
+		if(query->tcp && nsd->options->axfr_cache_size != 0 &&
+			axfr_cache_lookup(nsd, query, zone, 1, qserial,
+			current_serial)) {
+			total_added = axfr_cache_answer(query,
+				&query->ixfr_is_done);
+			goto return_answer;
+		}
 	} else {
 		/*
 		 * Query name need not be repeated after the
@@ -870,13 +1084,20 @@ query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 		buffer_set_limit(query->packet, QHEADERSZ);
 		QDCOUNT_SET(query->packet, 0);
 		query_prepare_response(query);
+		start = buffer_position(query->packet);
+		if(query->axfr_cache) {
+			total_added = axfr_cache_answer(query,
+				&query->ixfr_is_done);
+			goto return_answer;
+		}
 	}
 
 	total_added = ixfr_copy_rrs_into_packet(query, &pcomp);
 
 	while(query->ixfr_count_add >= query->ixfr_data->add_len) {
-		struct ixfr_data* next = ixfr_data_next(query->zone->ixfr,
-			query->ixfr_data);
+		struct ixfr_data* next = (query->ixfr_data ==
+			query->ixfr_end_data) ? NULL :
+			ixfr_data_next(query->zone->ixfr, query->ixfr_data);
 		/* finished the ixfr_data */
 		if(next) {
 			/* move to the next IXFR */
@@ -897,11 +1118,15 @@ query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 		}
 	}
 
+return_answer:
 	/* return the answer */
 	AA_SET(query->packet);
 	ANCOUNT_SET(query->packet, total_added);
 	NSCOUNT_SET(query->packet, 0);
 	ARCOUNT_SET(query->packet, 0);
+	if(query->axfr_capture)
+		axfr_cache_capture(nsd, query, start, total_added,
+			query->ixfr_is_done);
 
 	if(!query->tcp && !query->ixfr_is_done) {
 		TC_SET(query->packet);
@@ -929,17 +1154,153 @@ query_state_type query_ixfr(struct nsd *nsd, struct query *query)
 	return QUERY_IN_IXFR;
 }
 
+/* the versions of all zones that are in memory, and not spilled to a
+ * file, oldest first, and the bytes they use */
+static struct ixfr_data* ixfr_mem_first = NULL;
+static struct ixfr_data* ixfr_mem_last = NULL;
+static size_t ixfr_mem_size = 0;
+
+/* add ixfr data to the list of versions in memory, at the end if it is
+ * the newest version, otherwise at the start */
+static void ixfr_mem_link(struct ixfr_data* data, int isnew)
+{
+	if(isnew) {
+		data->mem_prev = ixfr_mem_last;
+		data->mem_next = NULL;
+		if(ixfr_mem_last)
+			ixfr_mem_last->mem_next = data;
+		else	ixfr_mem_first = data;
+		ixfr_mem_last = data;
+	} else {
+		data->mem_prev = NULL;
+		data->mem_next = ixfr_mem_first;
+		if(ixfr_mem_first)
+			ixfr_mem_first->mem_prev = data;
+		else	ixfr_mem_last = data;
+		ixfr_mem_first = data;
+	}
+	ixfr_mem_size += ixfr_data_size(data);
+}
+
+/* remove ixfr data from the list of versions in memory, if it is on it */
+static void ixfr_mem_unlink(struct ixfr_data* data)
+{
+	if(!data->mem_prev && ixfr_mem_first != data)
+		return;
+	if(data->mem_prev)
+		data->mem_prev->mem_next = data->mem_next;
+	else	ixfr_mem_first = data->mem_next;
+	if(data->mem_next)
+		data->mem_next->mem_prev = data->mem_prev;
+	else	ixfr_mem_last = data->mem_prev;
+	data->mem_prev = NULL;
+	data->mem_next = NULL;
+	ixfr_mem_size -= ixfr_data_size(data);
+}
+
 /* free ixfr_data structure */
 static void ixfr_data_free(struct ixfr_data* data)
 {
 	if(!data)
 		return;
+	ixfr_mem_unlink(data);
+	if(data->spill) {
+		munmap(data->spill, data->spill_len);
+	} else {
+		free(data->newsoa);
+		free(data->oldsoa);
+		free(data->del);
+		free(data->add);
+	}
+	free(data->log_str);
+	free(data);
+}
+
+/* write a section of the ixfr data to the spill file */
+static int ixfr_spill_write(int fd, uint8_t* buf, size_t len)
+{
+	while(len > 0) {
+		ssize_t r = write(fd, buf, len);
+		if(r == -1) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return 0;
+		}
+		buf += r;
+		len -= r;
+	}
+	return 1;
+}
+
+/* move the sections of the ixfr data to a file in the xfrdir, that is
+ * mapped read only. The file is unlinked, it is gone with the mapping. */
+static int ixfr_data_spill(struct nsd* nsd, struct ixfr_data* data)
+{
+	char fname[1024];
+	size_t len = data->newsoa_len + data->oldsoa_len + data->del_len +
+		data->add_len;
+	uint8_t* map;
+	int fd;
+	snprintf(fname, sizeof(fname), "%snsd-ixfr-spill.XXXXXX",
+		nsd->options->xfrdir);
+	fd = mkstemp(fname);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "could not create IXFR spill file %s: %s",
+			fname, strerror(errno));
+		return 0;
+	}
+	(void)unlink(fname);
+	if(!ixfr_spill_write(fd, data->newsoa, data->newsoa_len) ||
+		!ixfr_spill_write(fd, data->oldsoa, data->oldsoa_len) ||
+		!ixfr_spill_write(fd, data->del, data->del_len) ||
+		!ixfr_spill_write(fd, data->add, data->add_len)) {
+		log_msg(LOG_ERR, "could not write IXFR spill file %s: %s",
+			fname, strerror(errno));
+		close(fd);
+		return 0;
+	}
+	map = (uint8_t*)mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		log_msg(LOG_ERR, "could not mmap IXFR spill file %s: %s",
+			fname, strerror(errno));
+		return 0;
+	}
 	free(data->newsoa);
 	free(data->oldsoa);
 	free(data->del);
 	free(data->add);
-	free(data->log_str);
-	free(data);
+	data->spill = map;
+	data->spill_len = len;
+	data->newsoa = map;
+	map += data->newsoa_len;
+	data->oldsoa = map;
+	map += data->oldsoa_len;
+	data->del = data->del_len ? map : NULL;
+	map += data->del_len;
+	data->add = data->add_len ? map : NULL;
+	return 1;
+}
+
+/* spill the oldest versions in memory, of all zones, to files, until the
+ * versions in memory fit in the ixfr-memory-budget. The newest version
+ * stays in memory. */
+static void ixfr_mem_budget(struct nsd* nsd)
+{
+	uint64_t budget = nsd->options->ixfr_memory_budget;
+	if(budget == 0)
+		return;
+	while(ixfr_mem_size > budget && ixfr_mem_first != ixfr_mem_last) {
+		struct ixfr_data* data = ixfr_mem_first;
+		ixfr_mem_unlink(data);
+		if(!ixfr_data_spill(nsd, data)) {
+			ixfr_mem_link(data, 0);
+			return;
+		}
+		VERBOSITY(4, (LOG_INFO, "IXFR data from serial %u to %u "
+			"spilled to file, %u bytes", (unsigned)data->oldserial,
+			(unsigned)data->newserial, (unsigned)data->spill_len));
+	}
 }
 
 size_t ixfr_data_size(struct ixfr_data* data)
@@ -1076,6 +1437,7 @@ void ixfr_store_finish(struct ixfr_store* ixfr_store, struct nsd* nsd,
 	}
 	zone_ixfr_add(ixfr_store->zone->ixfr, ixfr_store->data, 1);
 	ixfr_store->data = NULL;
+	ixfr_mem_budget(nsd);
 
 	/* free structure */
 	ixfr_store_free(ixfr_store);
@@ -1511,6 +1873,7 @@ struct zone_ixfr* zone_ixfr_create(struct nsd* nsd)
 {
 	struct zone_ixfr* ixfr = xalloc_zero(sizeof(struct zone_ixfr));
 	ixfr->data = rbtree_create(nsd->region, &ixfrcompare);
+	ixfr->condensed = rbtree_create(nsd->region, &ixfrcompare);
 	return ixfr;
 }
 
@@ -1524,11 +1887,22 @@ static void ixfr_tree_del(struct rbnode* node)
 	ixfr_data_free((struct ixfr_data*)node);
 }
 
+/* clear the condensed ixfr data, the versions have changed */
+static void zone_ixfr_clear_condensed(struct zone_ixfr* ixfr)
+{
+	if(!ixfr->condensed || ixfr->condensed->count == 0)
+		return;
+	ixfr_tree_del(ixfr->condensed->root);
+	ixfr->condensed->root = RBTREE_NULL;
+	ixfr->condensed->count = 0;
+}
+
 /* clear the ixfr data elements */
 static void zone_ixfr_clear(struct zone_ixfr* ixfr)
 {
 	if(!ixfr)
 		return;
+	zone_ixfr_clear_condensed(ixfr);
 	if(ixfr->data) {
 		ixfr_tree_del(ixfr->data->root);
 		ixfr->data->root = RBTREE_NULL;
@@ -1543,6 +1917,7 @@ void zone_ixfr_free(struct zone_ixfr* ixfr)
 {
 	if(!ixfr)
 		return;
+	zone_ixfr_clear_condensed(ixfr);
 	if(ixfr->data) {
 		ixfr_tree_del(ixfr->data->root);
 		ixfr->data = NULL;
@@ -1622,6 +1997,7 @@ void zone_ixfr_make_space(struct zone_ixfr* ixfr, struct zone* zone,
 
 void zone_ixfr_remove(struct zone_ixfr* ixfr, struct ixfr_data* data)
 {
+	zone_ixfr_clear_condensed(ixfr);
 	rbtree_delete(ixfr->data, data->node.key);
 	ixfr->total_size -= ixfr_data_size(data);
 	ixfr_data_free(data);
@@ -1629,6 +2005,7 @@ void zone_ixfr_remove(struct zone_ixfr* ixfr, struct ixfr_data* data)
 
 void zone_ixfr_add(struct zone_ixfr* ixfr, struct ixfr_data* data, int isnew)
 {
+	zone_ixfr_clear_condensed(ixfr);
 	memset(&data->node, 0, sizeof(data->node));
 	if(ixfr->data->count == 0) {
 		ixfr->oldest_serial = data->oldserial;
@@ -1643,6 +2020,8 @@ void zone_ixfr_add(struct zone_ixfr* ixfr, struct ixfr_data* data, int isnew)
 	data->node.key = &data->oldserial;
 	rbtree_insert(ixfr->data, &data->node);
 	ixfr->total_size += ixfr_data_size(data);
+	if(!data->spill)
+		ixfr_mem_link(data, isnew);
 }
 
 struct ixfr_data* zone_ixfr_find_serial(struct zone_ixfr* ixfr,
@@ -1755,6 +2134,80 @@ static int ixfr_unlink_it_temp(const char* zname, const char* zfile,
 	return ixfr_unlink_it_ctmp(zname, zfile, file_num, silent_enoent, 1);
 }
 
+/* the start of an IXFR data file in the binary format. It is followed by
+ * the zone name length (uint16), the zone name, the old and new serial,
+ * and the lengths of the newsoa, oldsoa, del and add sections (uint32,
+ * network order), and then the wireformat of the sections. */
+#define IXFR_BINARY_MAGIC "NSDIXFR\001"
+#define IXFR_BINARY_MAGIC_LEN 8
+#define IXFR_BINARY_SECTIONS 4
+/* the binary format with ixfr-compress, the section lengths are followed
+ * by the stored lengths of the sections, and a section that is stored
+ * shorter than its length is compressed with LZ4 */
+#define IXFR_BINARY_LZ4_MAGIC "NSDIXFR\002"
+#define IXFR_FILE_BINARY 1
+#define IXFR_FILE_BINARY_LZ4 2
+
+/* see if the file starts with the magic of the binary format, the file is
+ * positioned after the magic if so, and at the start otherwise. Returns
+ * IXFR_FILE_BINARY or IXFR_FILE_BINARY_LZ4 for the binary formats. */
+static int ixfr_file_is_binary(FILE* in)
+{
+	char magic[IXFR_BINARY_MAGIC_LEN];
+	if(fread(magic, 1, sizeof(magic), in) == sizeof(magic)) {
+		if(memcmp(magic, IXFR_BINARY_MAGIC, sizeof(magic)) == 0)
+			return IXFR_FILE_BINARY;
+		if(memcmp(magic, IXFR_BINARY_LZ4_MAGIC, sizeof(magic)) == 0)
+			return IXFR_FILE_BINARY_LZ4;
+	}
+	rewind(in);
+	return 0;
+}
+
+/* read the header of a binary format ixfr file, after the magic. The
+ * stored lengths are read into clens for the compressed format, and are
+ * the same as the lengths otherwise. */
+static int ixfr_read_binary_header(FILE* in, const char* zname,
+	const char* ixfrfile, uint32_t* oldserial, uint32_t* newserial,
+	uint32_t* lens, uint32_t* clens, int format)
+{
+	uint8_t buf[4*(2+2*IXFR_BINARY_SECTIONS)];
+	size_t hdrlen = 4*(2+IXFR_BINARY_SECTIONS);
+	char name[MAXDOMAINLEN*5+1];
+	uint16_t namelen;
+	int i;
+	if(fread(buf, 1, 2, in) != 2) {
+		log_msg(LOG_ERR, "could not read %s: short header", ixfrfile);
+		return 0;
+	}
+	namelen = read_uint16(buf);
+	if(namelen >= sizeof(name) || fread(name, 1, namelen, in) != namelen) {
+		log_msg(LOG_ERR, "could not read %s: bad zone name", ixfrfile);
+		return 0;
+	}
+	name[namelen] = 0;
+	if(strcmp(name, zname) != 0) {
+		log_msg(LOG_ERR, "file has wrong zone, expected zone %s, but found %s in file %s",
+			zname, name, ixfrfile);
+		return 0;
+	}
+	if(format == IXFR_FILE_BINARY_LZ4)
+		hdrlen += 4*IXFR_BINARY_SECTIONS;
+	if(fread(buf, 1, hdrlen, in) != hdrlen) {
+		log_msg(LOG_ERR, "could not read %s: short header", ixfrfile);
+		return 0;
+	}
+	*oldserial = read_uint32(buf);
+	*newserial = read_uint32(buf+4);
+	for(i=0; i<IXFR_BINARY_SECTIONS; i++) {
+		lens[i] = read_uint32(buf+8+4*i);
+		if(format == IXFR_FILE_BINARY_LZ4)
+			clens[i] = read_uint32(buf+8+4*IXFR_BINARY_SECTIONS+4*i);
+		else	clens[i] = lens[i];
+	}
+	return 1;
+}
+
 /* read ixfr file header */
 int ixfr_read_file_header(const char* zname, const char* zfile,
 	int file_num, uint32_t* oldserial, uint32_t* newserial,
@@ -1764,6 +2217,7 @@ int ixfr_read_file_header(const char* zname, const char* zfile,
 	char buf[1024];
 	FILE* in;
 	int num_lines = 0, got_old = 0, got_new = 0, got_datasize = 0;
+	int format;
 	make_ixfr_name(ixfrfile, sizeof(ixfrfile), zfile, file_num);
 	in = fopen(ixfrfile, "r");
 	if(!in) {
@@ -1772,6 +2226,21 @@ int ixfr_read_file_header(const char* zname, const char* zfile,
 				strerror(errno));
 		return 0;
 	}
+	if((format = ixfr_file_is_binary(in)) != 0) {
+		uint32_t lens[IXFR_BINARY_SECTIONS];
+		uint32_t clens[IXFR_BINARY_SECTIONS];
+		int i;
+		if(!ixfr_read_binary_header(in, zname, ixfrfile, oldserial,
+			newserial, lens, clens, format)) {
+			fclose(in);
+			return 0;
+		}
+		fclose(in);
+		*data_size = sizeof(struct ixfr_data);
+		for(i=0; i<IXFR_BINARY_SECTIONS; i++)
+			*data_size += lens[i];
+		return 1;
+	}
 	/* read about 10 lines, this is where the header is */
 	while(!(got_old && got_new && got_datasize) && num_lines < 10) {
 		buf[0]=0;
@@ -1979,6 +2448,20 @@ oneline_print_rdata(buffer_type *output, rrtype_descriptor_type *descriptor,
 	size_t i;
 	size_t saved_position = buffer_position(output);
 
+	if (record->type == TYPE_RRSIG && record->rdata_count == 1) {
+		/* print the fields of the packed RRSIG */
+		region_type *region = region_create(xalloc, free);
+		rr_type rr = *record;
+		ssize_t n = rdata_rrsig_unpack(region, record, &rr.rdatas);
+		int r = 0;
+		if (n > 0) {
+			rr.rdata_count = (uint16_t) n;
+			r = oneline_print_rdata(output, descriptor, &rr);
+		}
+		region_destroy(region);
+		return r;
+	}
+
 	for (i = 0; i < record->rdata_count; ++i) {
 		if (i == 0) {
 			buffer_printf(output, "\t");
@@ -2152,6 +2635,97 @@ static int ixfr_write_file_data(struct zone* zone, struct ixfr_data* data,
 	return 1;
 }
 
+/* if the ixfr data is written in the binary format */
+static int ixfr_write_as_binary(struct zone* zone, struct ixfr_data* data)
+{
+	return zone->opts->pattern->ixfr_binary &&
+		strlen(zone->opts->name) <= MAXDOMAINLEN*5 &&
+		data->newsoa_len <= 0xffffffff &&
+		data->oldsoa_len <= 0xffffffff &&
+		data->del_len <= 0xffffffff && data->add_len <= 0xffffffff;
+}
+
+#ifdef USE_LZ4
+/* write the ixfr data in the binary format with the sections compressed,
+ * for ixfr-compress, the sections that do not get smaller are stored as
+ * they are */
+static int ixfr_write_file_binary_lz4(struct zone* zone,
+	struct ixfr_data* data, FILE* out)
+{
+	uint8_t buf[4*(2+2*IXFR_BINARY_SECTIONS)];
+	uint16_t namelen = (uint16_t)strlen(zone->opts->name);
+	uint8_t* sec[IXFR_BINARY_SECTIONS];
+	size_t len[IXFR_BINARY_SECTIONS];
+	uint8_t* csec[IXFR_BINARY_SECTIONS];
+	size_t clen[IXFR_BINARY_SECTIONS];
+	int i, r = 1;
+	sec[0] = data->newsoa; len[0] = data->newsoa_len;
+	sec[1] = data->oldsoa; len[1] = data->oldsoa_len;
+	sec[2] = data->del; len[2] = data->del_len;
+	sec[3] = data->add; len[3] = data->add_len;
+	for(i=0; i<IXFR_BINARY_SECTIONS; i++) {
+		csec[i] = lz4_compress(sec[i], len[i], &clen[i]);
+		if(!csec[i])
+			clen[i] = len[i];
+	}
+	write_uint16(buf, namelen);
+	if(fwrite(IXFR_BINARY_LZ4_MAGIC, 1, IXFR_BINARY_MAGIC_LEN, out) !=
+		IXFR_BINARY_MAGIC_LEN ||
+		fwrite(buf, 1, 2, out) != 2 ||
+		fwrite(zone->opts->name, 1, namelen, out) != namelen)
+		r = 0;
+	write_uint32(buf, data->oldserial);
+	write_uint32(buf+4, data->newserial);
+	for(i=0; i<IXFR_BINARY_SECTIONS; i++) {
+		write_uint32(buf+8+4*i, (uint32_t)len[i]);
+		write_uint32(buf+8+4*IXFR_BINARY_SECTIONS+4*i,
+			(uint32_t)clen[i]);
+	}
+	if(r && fwrite(buf, 1, sizeof(buf), out) != sizeof(buf))
+		r = 0;
+	for(i=0; i<IXFR_BINARY_SECTIONS; i++) {
+		if(r && fwrite((csec[i]?csec[i]:sec[i]), 1, clen[i], out) !=
+			clen[i])
+			r = 0;
+		free(csec[i]);
+	}
+	return r;
+}
+#endif /* USE_LZ4 */
+
+/* write the ixfr data in the binary format */
+static int ixfr_write_file_binary(struct zone* zone, struct ixfr_data* data,
+	FILE* out)
+{
+	uint8_t buf[4*(2+IXFR_BINARY_SECTIONS)];
+	uint16_t namelen = (uint16_t)strlen(zone->opts->name);
+#ifdef USE_LZ4
+	if(zone->opts->pattern->ixfr_compress)
+		return ixfr_write_file_binary_lz4(zone, data, out);
+#endif
+	if(fwrite(IXFR_BINARY_MAGIC, 1, IXFR_BINARY_MAGIC_LEN, out) !=
+		IXFR_BINARY_MAGIC_LEN)
+		return 0;
+	write_uint16(buf, namelen);
+	if(fwrite(buf, 1, 2, out) != 2 ||
+		fwrite(zone->opts->name, 1, namelen, out) != namelen)
+		return 0;
+	write_uint32(buf, data->oldserial);
+	write_uint32(buf+4, data->newserial);
+	write_uint32(buf+8, (uint32_t)data->newsoa_len);
+	write_uint32(buf+12, (uint32_t)data->oldsoa_len);
+	write_uint32(buf+16, (uint32_t)data->del_len);
+	write_uint32(buf+20, (uint32_t)data->add_len);
+	if(fwrite(buf, 1, sizeof(buf), out) != sizeof(buf))
+		return 0;
+	if(fwrite(data->newsoa, 1, data->newsoa_len, out) != data->newsoa_len ||
+		fwrite(data->oldsoa, 1, data->oldsoa_len, out) != data->oldsoa_len ||
+		fwrite(data->del, 1, data->del_len, out) != data->del_len ||
+		fwrite(data->add, 1, data->add_len, out) != data->add_len)
+		return 0;
+	return 1;
+}
+
 int ixfr_write_file(struct zone* zone, struct ixfr_data* data,
 	const char* zfile, int file_num)
 {
@@ -2167,6 +2741,21 @@ int ixfr_write_file(struct zone* zone, struct ixfr_data* data,
 		return 0;
 	}
 
+	if(ixfr_write_as_binary(zone, data)) {
+		if(!ixfr_write_file_binary(zone, data, out)) {
+			log_msg(LOG_ERR, "could not write zone %s IXFR file %s: %s",
+				zone->opts->name, ixfrfile, strerror(errno));
+			fclose(out);
+			return 0;
+		}
+		if(fclose(out) != 0) {
+			log_msg(LOG_ERR, "could not write zone %s IXFR file %s: %s",
+				zone->opts->name, ixfrfile, strerror(errno));
+			return 0;
+		}
+		data->file_num = file_num;
+		return 1;
+	}
 	if(!ixfr_write_file_header(zone, data, out)) {
 		log_msg(LOG_ERR, "could not write file header for zone %s IXFR file %s: %s",
 			zone->opts->name, ixfrfile, strerror(errno));
@@ -2243,11 +2832,16 @@ void ixfr_write_to_file(struct zone* zone, const char* zfile)
 static void domain_table_delete(struct domain_table* table,
 	struct domain* domain)
 {
+	if(table->last_insert == domain)
+		table->last_insert = NULL;
 #ifdef USE_RADIX_TREE
 	radix_delete(table->nametree, domain->rnode);
 #else
 	rbtree_delete(table->names_to_domains, domain->node.key);
 #endif
+#ifdef USE_NAME_HASH
+	domain_table_namehash_del(table, domain);
+#endif
 }
 
 /* can we delete temp domain */
@@ -2598,11 +3192,90 @@ static void ixfr_data_log(
 	log_msg(priority, "%s", message);
 }
 
+/* add ixfr data that is read from file to the zone, if it fits */
+static int ixfr_data_read_add(struct nsd* nsd, struct zone* zone,
+	const char* ixfrfile, struct ixfr_data* data)
+{
+	if(!zone->ixfr)
+		zone->ixfr = zone_ixfr_create(nsd);
+	if(zone->opts->pattern->ixfr_size != 0 &&
+		zone->ixfr->total_size + ixfr_data_size(data) >
+		zone->opts->pattern->ixfr_size) {
+		VERBOSITY(3, (LOG_INFO, "zone %s skip %s IXFR data because only ixfr-size: %u configured, and it is %u size",
+			zone->opts->name, ixfrfile, (unsigned)zone->opts->pattern->ixfr_size, (unsigned)ixfr_data_size(data)));
+		ixfr_data_free(data);
+		return 0;
+	}
+	zone_ixfr_add(zone->ixfr, data, 0);
+	VERBOSITY(3, (LOG_INFO, "zone %s read %s IXFR data of %u bytes",
+		zone->opts->name, ixfrfile, (unsigned)ixfr_data_size(data)));
+	ixfr_mem_budget(nsd);
+	return 1;
+}
+
+/* read a section of binary ixfr data, of len bytes stored in clen */
+static int ixfr_read_binary_section(FILE* in, uint32_t len, uint32_t clen,
+	uint8_t** dest, size_t* dest_len)
+{
+	*dest_len = len;
+	if(len == 0)
+		return clen == 0;
+	*dest = malloc(len);
+	if(!*dest)
+		return 0;
+	if(clen < len)
+		return lz4_read_block(in, clen, *dest, len);
+	return clen == len && fread(*dest, 1, len, in) == len;
+}
+
+/* read ixfr data from a file in the binary format, positioned after the
+ * magic. The sections are the stored wireformat, and need no parsing. */
+static int ixfr_data_read_binary(struct nsd* nsd, struct zone* zone,
+	FILE* in, const char* ixfrfile, uint32_t* dest_serial, int file_num,
+	int format)
+{
+	uint32_t lens[IXFR_BINARY_SECTIONS];
+	uint32_t clens[IXFR_BINARY_SECTIONS];
+	struct ixfr_data* data;
+	data = xalloc_zero(sizeof(*data));
+	data->file_num = file_num;
+	if(!ixfr_read_binary_header(in, zone->opts->name, ixfrfile,
+		&data->oldserial, &data->newserial, lens, clens, format)) {
+		ixfr_data_free(data);
+		return 0;
+	}
+	if(data->newserial != *dest_serial) {
+		log_msg(LOG_ERR, "zone %s ixfr data: IXFR data contains the wrong version, serial %u but want destination serial %u",
+			zone->opts->name, data->newserial, *dest_serial);
+		ixfr_data_free(data);
+		return 0;
+	}
+	if(lens[0] == 0 || lens[1] == 0 ||
+		!ixfr_read_binary_section(in, lens[0], clens[0],
+			&data->newsoa, &data->newsoa_len) ||
+		!ixfr_read_binary_section(in, lens[1], clens[1],
+			&data->oldsoa, &data->oldsoa_len) ||
+		!ixfr_read_binary_section(in, lens[2], clens[2],
+			&data->del, &data->del_len) ||
+		!ixfr_read_binary_section(in, lens[3], clens[3],
+			&data->add, &data->add_len) ||
+		fgetc(in) != EOF) {
+		log_msg(LOG_ERR, "zone %s ixfr data: could not read %s, "
+			"wrong length", zone->opts->name, ixfrfile);
+		ixfr_data_free(data);
+		return 0;
+	}
+	*dest_serial = data->oldserial;
+	return ixfr_data_read_add(nsd, zone, ixfrfile, data);
+}
+
 /* read ixfr data from file */
 static int ixfr_data_read(struct nsd* nsd, struct zone* zone,
 	const char* ixfrfile, uint32_t* dest_serial, int file_num)
 {
 	struct ixfr_data_state state = { 0 };
+	FILE* in;
+	int format;
 
 	if(!zone->apex) {
 		return 0;
@@ -2613,6 +3286,18 @@ static int ixfr_data_read(struct nsd* nsd, struct zone* zone,
 			zone->opts->name, ixfrfile, (int)zone->opts->pattern->ixfr_number));
 		return 0;
 	}
+	if((in = fopen(ixfrfile, "r")) == NULL) {
+		log_msg(LOG_ERR, "could not open %s: %s", ixfrfile,
+			strerror(errno));
+		return 0;
+	}
+	if((format = ixfr_file_is_binary(in)) != 0) {
+		int r = ixfr_data_read_binary(nsd, zone, in, ixfrfile,
+			dest_serial, file_num, format);
+		fclose(in);
+		return r;
+	}
+	fclose(in);
 
 	/* the file has header comments, new soa, old soa, delsection,
 	 * addsection. The delsection and addsection end in a SOA of oldver
@@ -2672,20 +3357,7 @@ static int ixfr_data_read(struct nsd* nsd, struct zone* zone,
 	region_destroy(state.tempregion);
 	region_destroy(state.stayregion);
 
-	if(!zone->ixfr)
-		zone->ixfr = zone_ixfr_create(nsd);
-	if(zone->opts->pattern->ixfr_size != 0 &&
-		zone->ixfr->total_size + ixfr_data_size(state.data) >
-		zone->opts->pattern->ixfr_size) {
-		VERBOSITY(3, (LOG_INFO, "zone %s skip %s IXFR data because only ixfr-size: %u configured, and it is %u size",
-			zone->opts->name, ixfrfile, (unsigned)zone->opts->pattern->ixfr_size, (unsigned)ixfr_data_size(state.data)));
-		ixfr_data_free(state.data);
-		return 0;
-	}
-	zone_ixfr_add(zone->ixfr, state.data, 0);
-	VERBOSITY(3, (LOG_INFO, "zone %s read %s IXFR data of %u bytes",
-		zone->opts->name, ixfrfile, (unsigned)ixfr_data_size(state.data)));
-	return 1;
+	return ixfr_data_read_add(nsd, zone, ixfrfile, state.data);
 }
 
 /* try to read the next ixfr file. returns false if it fails or if it
@@ -38,6 +38,10 @@ struct zone_ixfr {
 	 * tree, so it is the old_serial of the newest data entry, that
 	 * has an even newer new_serial of that entry */
 	uint32_t newest_serial;
+	/* Tree of ixfr data, the key is old_serial, for ixfr-condense.
+	 * The entries go from old_serial to the newest serial with the net
+	 * changes of the versions in between. Cleared when versions change. */
+	struct rbtree* condensed;
 };
 
 /* Data structure that stores one IXFR.
@@ -87,6 +91,14 @@ struct ixfr_data {
 	/* the number of the ixfr.<num> file on disk. If 0, there is no
 	 * file. If 1, it is file ixfr<nothingafterit>. */
 	int file_num;
+	/* if not NULL, the version is spilled, the newsoa, oldsoa, del and
+	 * add sections point into this read only file mapping of spill_len
+	 * bytes, that is unmapped when the data is freed. */
+	uint8_t* spill;
+	size_t spill_len;
+	/* list of the versions of all zones that are in memory, by age,
+	 * for the ixfr-memory-budget */
+	struct ixfr_data* mem_prev, *mem_next;
 };
 
 /* process queries in IXFR state */
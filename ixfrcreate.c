@@ -157,12 +157,36 @@ static int spool_domains(FILE* out, struct zone* zone)
 	return 1;
 }
 
+/* open the spool for writing, in memory if possible, so that it does not
+ * have to be written to disk and read back, otherwise to the file */
+static FILE* spool_open_write(struct ixfr_create* ixfrcr)
+{
+#if defined(HAVE_OPEN_MEMSTREAM) && defined(HAVE_FMEMOPEN)
+	FILE* out = open_memstream(&ixfrcr->spool_buf, &ixfrcr->spool_len);
+	if(out)
+		return out;
+	ixfrcr->spool_buf = NULL;
+#endif
+	return fopen(ixfrcr->file_name, "w");
+}
+
+/* open the spool for reading, from memory or from the file */
+static FILE* spool_open_read(struct ixfr_create* ixfrcr)
+{
+#if defined(HAVE_OPEN_MEMSTREAM) && defined(HAVE_FMEMOPEN)
+	if(ixfrcr->spool_buf)
+		return fmemopen(ixfrcr->spool_buf, ixfrcr->spool_len, "r");
+#endif
+	return fopen(ixfrcr->file_name, "r");
+}
+
 /* spool the namedb zone to the file. print error on failure. */
-static int spool_zone_to_file(struct zone* zone, char* file_name,
+static int spool_zone_to_file(struct zone* zone, struct ixfr_create* ixfrcr,
 	uint32_t serial)
 {
+	char* file_name = ixfrcr->file_name;
 	FILE* out;
-	out = fopen(file_name, "w");
+	out = spool_open_write(ixfrcr);
 	if(!out) {
 		log_msg(LOG_ERR, "could not open %s for writing: %s",
 			file_name, strerror(errno));
@@ -229,7 +253,7 @@ struct ixfr_create* ixfr_create_start(struct zone* zone, const char* zfile,
 		return NULL;
 	}
 	ixfrcr->old_serial = zone_get_current_serial(zone);
-	if(!spool_zone_to_file(zone, ixfrcr->file_name, ixfrcr->old_serial)) {
+	if(!spool_zone_to_file(zone, ixfrcr, ixfrcr->old_serial)) {
 		ixfr_create_free(ixfrcr);
 		return NULL;
 	}
@@ -246,6 +270,7 @@ void ixfr_create_free(struct ixfr_create* ixfrcr)
 	if(!ixfrcr)
 		return;
 	free(ixfrcr->file_name);
+	free(ixfrcr->spool_buf);
 	free(ixfrcr->zone_name);
 	free(ixfrcr);
 }
@@ -366,12 +391,15 @@ static int rdata_match(struct rr* rr, uint8_t* rdata, uint16_t rdlen)
 	return 1;
 }
 
-/* find an rdata in an rrset, true if found and sets index found */
+/* find an rdata in an rrset, true if found and sets index found. The
+ * search begins at start, where the RR is if the order is the same. */
 static int rrset_find_rdata(struct rrset* rrset, uint32_t ttl, uint8_t* rdata,
-	uint16_t rdlen, uint16_t* index)
+	uint16_t rdlen, uint16_t start, uint16_t* index)
 {
-	int i;
-	for(i=0; i<rrset->rr_count; i++) {
+	int n, i = start;
+	for(n=0; n<rrset->rr_count; n++, i++) {
+		if(i >= rrset->rr_count)
+			i = 0;
 		if(rrset->rrs[i].ttl != ttl)
 			continue;
 		if(rdata_match(&rrset->rrs[i], rdata, rdlen)) {
@@ -401,9 +429,11 @@ static int process_diff_rrset(FILE* spool, struct ixfr_create* ixfrcr,
 {
 	/* read RRs from file and see if they are added, deleted or in both */
 	uint8_t buf[MAX_RDLENGTH];
-	uint16_t marked[65536];
-	size_t marked_num = 0, atmarked;
+	/* bitmap of the RRs of the rrset that are also in the spool */
+	uint8_t marked[65536/8];
+	uint16_t next = 0;
 	int i;
+	memset(marked, 0, ((size_t)rrset->rr_count+7)/8);
 	for(i=0; i<rrcount; i++) {
 		uint16_t rdlen, index;
 		uint32_t ttl;
@@ -431,9 +461,10 @@ static int process_diff_rrset(FILE* spool, struct ixfr_create* ixfrcr,
 				return 0;
 		}
 		/* see if the rr is in the RRset */
-		if(rrset_find_rdata(rrset, ttl, buf, rdlen, &index)) {
+		if(rrset_find_rdata(rrset, ttl, buf, rdlen, next, &index)) {
 			/* it is in both, mark it */
-			marked[marked_num++] = index;
+			marked[index/8] |= (1<<(index&7));
+			next = index+1;
 		} else {
 			/* not in new rrset, but only on spool, it is
 			 * a deleted RR */
@@ -448,12 +479,9 @@ static int process_diff_rrset(FILE* spool, struct ixfr_create* ixfrcr,
 	}
 	/* now that we are done, see if RRs in the rrset are not marked,
 	 * and thus are new rrs that are added */
-	qsort(marked, marked_num, sizeof(marked[0]), &sort_uint16);
-	atmarked = 0;
 	for(i=0; i<rrset->rr_count; i++) {
-		if(atmarked < marked_num && marked[atmarked] == i) {
+		if((marked[i/8] & (1<<(i&7)))) {
 			/* the item is in the marked list, skip it */
-			atmarked++;
 			continue;
 		}
 		/* not in the marked list, the RR is added */
@@ -934,7 +962,7 @@ static int ixfr_create_store_newsoa(struct ixfr_store* store,
 static int ixfr_perform_init(struct ixfr_create* ixfrcr, struct zone* zone,
 	struct ixfr_store* store_mem, struct ixfr_store** store, FILE** spool)
 {
-	*spool = fopen(ixfrcr->file_name, "r");
+	*spool = spool_open_read(ixfrcr);
 	if(!*spool) {
 		log_msg(LOG_ERR, "could not open %s for reading: %s",
 			ixfrcr->file_name, strerror(errno));
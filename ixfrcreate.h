@@ -20,6 +20,10 @@ struct ixfr_create {
 	uint32_t old_serial, new_serial;
 	/* the file with the spooled old zone data */
 	char* file_name;
+	/* the spooled old zone data if it is kept in memory, instead of
+	 * in the file, and its length */
+	char* spool_buf;
+	size_t spool_len;
 	/* zone name in uncompressed wireformat */
 	uint8_t* zone_name;
 	/* length of zone name */
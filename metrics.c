@@ -0,0 +1,574 @@
+/*
+ * metrics.c -- serve the statistics in the Prometheus text format
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The metrics process is forked from the main process at start, after
+ * the statistics are mapped in shared memory. For a scrape it copies the
+ * statistics blocks of the server processes, adds them up and formats
+ * them. The servers and xfrd are not involved, so the cost of a scrape
+ * does not depend on the number of servers or on the work of xfrd.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include "metrics.h"
+#include "nsd.h"
+#include "ipc.h"
+#include "options.h"
+#include "buffer.h"
+#include "util.h"
+#include "dns.h"
+
+#ifdef BIND8_STATS
+/* a counter in struct nsdst that is printed as nsd_<name>_total */
+struct metrics_counter {
+	const char* name;
+	size_t offset;
+	const char* help;
+};
+
+#define METRICS_COUNTER(name, field, help) \
+	{ name, offsetof(struct nsdst, field), help }
+
+static const struct metrics_counter metrics_counters[] = {
+	METRICS_COUNTER("dropped", dropped, "Queries that were dropped."),
+	METRICS_COUNTER("truncated", truncated, "Answers with the TC flag."),
+	METRICS_COUNTER("wrongzone", wrongzone,
+		"Queries for zones that are not served."),
+	METRICS_COUNTER("rxerr", rxerr, "Receive errors."),
+	METRICS_COUNTER("txerr", txerr, "Send errors."),
+	METRICS_COUNTER("edns", edns, "Queries with EDNS."),
+	METRICS_COUNTER("ednserr", ednserr, "Queries with a bad EDNS record."),
+	METRICS_COUNTER("answer_wo_aa", nona, "Answers without the AA flag."),
+	METRICS_COUNTER("raxfr", raxfr, "AXFR requests."),
+	METRICS_COUNTER("rixfr", rixfr, "IXFR requests."),
+	METRICS_COUNTER("rcache_hit", rcache_hit,
+		"Answers from the response cache."),
+	METRICS_COUNTER("rcache_miss", rcache_miss,
+		"Response cache lookups that missed."),
+	METRICS_COUNTER("udp_gso", udp_gso, "UDP answers sent with GSO."),
+	METRICS_COUNTER("tls_resumed", tls_resumed,
+		"TLS handshakes that resumed a session."),
+	METRICS_COUNTER("tls_full", tls_full, "Full TLS handshakes."),
+	METRICS_COUNTER("tls_ktls", tls_ktls,
+		"TLS connections that send with kernel TLS."),
+	METRICS_COUNTER("tls_async", tls_async,
+		"TLS handshakes that waited for an async job."),
+	METRICS_COUNTER("tls_handshake_usec", tls_handshake_usec,
+		"Microseconds the server spent in TLS handshakes."),
+	METRICS_COUNTER("tcp_accepted", tcp_accepted,
+		"TCP connections accepted."),
+	METRICS_COUNTER("tcp_evicted", tcp_evicted,
+		"Idle TCP connections closed for new ones."),
+	METRICS_COUNTER("tcp_source_limited", tcp_source_limited,
+		"TCP connections closed for tcp-source-limit."),
+	METRICS_COUNTER("tcp_pool_reused", tcp_pool_reused,
+		"TCP connections with a handler from the pool."),
+	METRICS_COUNTER("xfr_out_limited", xfr_out_limited,
+		"Transfers refused for the xfr-out limits."),
+	METRICS_COUNTER("xdp_malformed", xdp_malformed,
+		"Malformed packets dropped by the XDP program."),
+	METRICS_COUNTER("xdp_ratelimited", xdp_ratelimited,
+		"Packets dropped by the XDP program for xdp-ratelimit."),
+	METRICS_COUNTER("rrl_evicted", rrl_evicted,
+		"Ratelimit buckets that were replaced."),
+	METRICS_COUNTER("rrl_collision", rrl_collision,
+		"Replaced ratelimit buckets that were in use."),
+	METRICS_COUNTER("udp_shed", udp_shed,
+		"UDP queries shed in overload for udp-shed."),
+	METRICS_COUNTER("udp_overload", udp_overload,
+		"Times that a server went into overload."),
+	METRICS_COUNTER("rxq_dropped", rxq_dropped,
+		"UDP queries dropped by the kernel for a full socket buffer."),
+	{ NULL, 0, NULL }
+};
+
+static const char* metrics_rcodes[] = {"NOERROR", "FORMERR", "SERVFAIL",
+	"NXDOMAIN", "NOTIMP", "REFUSED", "YXDOMAIN", "YXRRSET", "NXRRSET",
+	"NOTAUTH", "NOTZONE", "RCODE11", "RCODE12", "RCODE13", "RCODE14",
+	"RCODE15", "BADVERS"};
+static const char* metrics_opcodes[] = {"QUERY", "IQUERY", "STATUS",
+	"OTHER", "NOTIFY", "UPDATE"};
+static const char* metrics_transports[] = {"udp", "tcp", "tls"};
+
+#define METRICS_VALUE(st, c) (*(const stc_type*)((const char*)(st) + \
+	(c)->offset))
+
+/* print the HELP and TYPE lines of a metric */
+static void
+metrics_head(buffer_type* out, const char* name, const char* type,
+	const char* help)
+{
+	buffer_printf(out, "# HELP nsd_%s %s\n# TYPE nsd_%s %s\n", name, help,
+		name, type);
+}
+
+/* print a label value, with the escapes of the text format */
+static void
+metrics_label(buffer_type* out, const char* str)
+{
+	for(; *str; str++) {
+		if(*str == '\\' || *str == '"')
+			buffer_printf(out, "\\%c", *str);
+		else if(*str == '\n')
+			buffer_printf(out, "\\n");
+		else	buffer_printf(out, "%c", *str);
+	}
+}
+
+/* print the counters of a statistics block, with an extra label */
+static void
+metrics_block(buffer_type* out, struct nsdst* st)
+{
+	const struct metrics_counter* c;
+	size_t i, b;
+	stc_type sum;
+
+	metrics_head(out, "queries_total", "counter",
+		"Queries received, per transport.");
+	buffer_printf(out, "nsd_queries_total{transport=\"udp\"} %lu\n"
+		"nsd_queries_total{transport=\"udp6\"} %lu\n"
+		"nsd_queries_total{transport=\"tcp\"} %lu\n"
+		"nsd_queries_total{transport=\"tcp6\"} %lu\n"
+		"nsd_queries_total{transport=\"tls\"} %lu\n"
+		"nsd_queries_total{transport=\"tls6\"} %lu\n",
+		(unsigned long)st->qudp, (unsigned long)st->qudp6,
+		(unsigned long)st->ctcp, (unsigned long)st->ctcp6,
+		(unsigned long)st->ctls, (unsigned long)st->ctls6);
+
+	metrics_head(out, "query_type_total", "counter",
+		"Queries per query type.");
+	for(i=0; i<=255; i++) {
+		if(st->qtype[i] == 0)
+			continue;
+		buffer_printf(out, "nsd_query_type_total{type=\"%s\"} %lu\n",
+			rrtype_to_string(i), (unsigned long)st->qtype[i]);
+	}
+	metrics_head(out, "query_class_total", "counter",
+		"Queries per query class.");
+	for(i=0; i<4; i++) {
+		if(st->qclass[i] == 0 && i != CLASS_IN)
+			continue;
+		buffer_printf(out, "nsd_query_class_total{class=\"%s\"} %lu\n",
+			rrclass_to_string(i), (unsigned long)st->qclass[i]);
+	}
+	metrics_head(out, "query_opcode_total", "counter",
+		"Queries per opcode.");
+	for(i=0; i<6; i++) {
+		if(st->opcode[i] == 0 && i != OPCODE_QUERY)
+			continue;
+		buffer_printf(out, "nsd_query_opcode_total{opcode=\"%s\"} %lu\n",
+			metrics_opcodes[i], (unsigned long)st->opcode[i]);
+	}
+	metrics_head(out, "answer_rcode_total", "counter",
+		"Answers per rcode.");
+	for(i=0; i<17; i++) {
+		if(st->rcode[i] == 0 && i > RCODE_YXDOMAIN)
+			continue;
+		buffer_printf(out, "nsd_answer_rcode_total{rcode=\"%s\"} %lu\n",
+			metrics_rcodes[i], (unsigned long)st->rcode[i]);
+	}
+
+	for(c = metrics_counters; c->name; c++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s_total", c->name);
+		metrics_head(out, name, "counter", c->help);
+		buffer_printf(out, "nsd_%s %lu\n", name,
+			(unsigned long)METRICS_VALUE(st, c));
+	}
+
+	/* bucket b has the answers that took less than 2^b usec */
+	metrics_head(out, "query_latency_seconds", "histogram",
+		"Time from the receipt of a query to the send of the answer.");
+	for(i=0; i<LATENCY_TRANSPORTS; i++) {
+		sum = 0;
+		for(b=0; b<LATENCY_BUCKETS; b++) {
+			sum += st->latency[i][b];
+			if(b == LATENCY_BUCKETS-1)
+				break;
+			buffer_printf(out, "nsd_query_latency_seconds_bucket"
+				"{transport=\"%s\",le=\"%.6f\"} %lu\n",
+				metrics_transports[i],
+				(double)((uint64_t)1<<b)/1000000.0,
+				(unsigned long)sum);
+		}
+		buffer_printf(out, "nsd_query_latency_seconds_bucket"
+			"{transport=\"%s\",le=\"+Inf\"} %lu\n"
+			"nsd_query_latency_seconds_count{transport=\"%s\"} %lu\n",
+			metrics_transports[i], (unsigned long)sum,
+			metrics_transports[i], (unsigned long)sum);
+	}
+
+	metrics_head(out, "udp_queue_seconds", "histogram",
+		"Time UDP queries waited in the socket receive buffer.");
+	sum = 0;
+	for(b=0; b<LATENCY_BUCKETS; b++) {
+		sum += st->rxq_latency[b];
+		if(b == LATENCY_BUCKETS-1)
+			break;
+		buffer_printf(out, "nsd_udp_queue_seconds_bucket{le=\"%.6f\"} "
+			"%lu\n", (double)((uint64_t)1<<b)/1000000.0,
+			(unsigned long)sum);
+	}
+	buffer_printf(out, "nsd_udp_queue_seconds_bucket{le=\"+Inf\"} %lu\n"
+		"nsd_udp_queue_seconds_count %lu\n", (unsigned long)sum,
+		(unsigned long)sum);
+
+	/* bucket b has the reads of less than 2^b queries */
+	metrics_head(out, "udp_batch_queries", "histogram",
+		"Number of UDP queries read and answered at once.");
+	sum = 0;
+	for(b=0; b<UDP_BATCH_BUCKETS; b++) {
+		sum += st->udp_batch[b];
+		if(b == UDP_BATCH_BUCKETS-1)
+			break;
+		buffer_printf(out, "nsd_udp_batch_queries_bucket{le=\"%lu\"} "
+			"%lu\n", (unsigned long)(((uint64_t)1<<b)-1),
+			(unsigned long)sum);
+	}
+	buffer_printf(out, "nsd_udp_batch_queries_bucket{le=\"+Inf\"} %lu\n"
+		"nsd_udp_batch_queries_count %lu\n", (unsigned long)sum,
+		(unsigned long)sum);
+
+	/* bucket b has the accepts with less than (b+1) tenths in use */
+	metrics_head(out, "tcp_occupancy_ratio", "histogram",
+		"Fraction of tcp-count in use when a TCP connection is accepted.");
+	sum = 0;
+	for(b=0; b<TCP_OCCUPANCY_BUCKETS; b++) {
+		sum += st->tcp_occupancy[b];
+		if(b == TCP_OCCUPANCY_BUCKETS-1)
+			break;
+		buffer_printf(out, "nsd_tcp_occupancy_ratio_bucket{le=\"%.1f\"} "
+			"%lu\n", (double)(b+1)/TCP_OCCUPANCY_BUCKETS,
+			(unsigned long)sum);
+	}
+	buffer_printf(out, "nsd_tcp_occupancy_ratio_bucket{le=\"+Inf\"} %lu\n"
+		"nsd_tcp_occupancy_ratio_count %lu\n", (unsigned long)sum,
+		(unsigned long)sum);
+
+	/* bucket b has the timeouts of up to 100*2^b msec */
+	metrics_head(out, "tcp_idle_timeout_seconds", "histogram",
+		"Idle timeout given to TCP connections that wait for a query.");
+	sum = 0;
+	for(b=0; b<TCP_TIMEOUT_BUCKETS; b++) {
+		sum += st->tcp_timeout[b];
+		if(b == TCP_TIMEOUT_BUCKETS-1)
+			break;
+		buffer_printf(out, "nsd_tcp_idle_timeout_seconds_bucket"
+			"{le=\"%.1f\"} %lu\n", (double)(100<<b)/1000.,
+			(unsigned long)sum);
+	}
+	buffer_printf(out, "nsd_tcp_idle_timeout_seconds_bucket{le=\"+Inf\"} "
+		"%lu\nnsd_tcp_idle_timeout_seconds_count %lu\n",
+		(unsigned long)sum, (unsigned long)sum);
+}
+
+#ifdef USE_ZONE_STATS
+/* map the zone statistics file read only, returns the number of
+ * entries for the zones, or 0 */
+static size_t
+metrics_map_zonestat(struct nsd* nsd, int fd, struct nsdst** map,
+	size_t* len)
+{
+	struct stat s;
+	*map = NULL;
+	*len = 0;
+	if(fd == -1 || fstat(fd, &s) == -1 || s.st_size <= 0)
+		return 0;
+	*len = (size_t)s.st_size;
+	*map = (struct nsdst*)mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+	if(*map == MAP_FAILED) {
+		*map = NULL;
+		return 0;
+	}
+	return *len / (sizeof(struct nsdst)*nsd->child_count);
+}
+
+/* print the per zone statistics, from the two zone statistics blocks */
+static void
+metrics_zonestats(buffer_type* out, struct nsd* nsd)
+{
+	struct nsdst* map[2], st;
+	size_t len[2], num[2], i, cc = nsd->child_count;
+	struct zonestatname* n;
+	int k;
+
+	if(!nsd->options->zonestatnames ||
+		nsd->options->zonestatnames->count == 0)
+		return;
+	num[0] = metrics_map_zonestat(nsd, nsd->zonestatfd[0], &map[0],
+		&len[0]);
+	num[1] = metrics_map_zonestat(nsd, nsd->zonestatfd[1], &map[1],
+		&len[1]);
+
+	metrics_head(out, "zone_queries_total", "counter",
+		"Queries per zone statistics name.");
+	RBTREE_FOR(n, struct zonestatname*, nsd->options->zonestatnames) {
+		const char* name = (const char*)n->node.key;
+		if(name == NULL || name[0] == 0)
+			continue;
+		memset(&st, 0, sizeof(st));
+		for(k=0; k<2; k++) {
+			if(n->id >= num[k])
+				continue;
+			for(i=0; i<cc; i++)
+				stats_add(&st, &map[k][n->id*cc+i]);
+		}
+		buffer_printf(out, "nsd_zone_queries_total{zone=\"");
+		metrics_label(out, name);
+		buffer_printf(out, "\"} %lu\n", (unsigned long)(st.qudp +
+			st.qudp6 + st.ctcp + st.ctcp6 + st.ctls + st.ctls6));
+		for(i=0; i<17; i++) {
+			if(st.rcode[i] == 0)
+				continue;
+			buffer_printf(out, "nsd_zone_answer_rcode_total{zone=\"");
+			metrics_label(out, name);
+			buffer_printf(out, "\",rcode=\"%s\"} %lu\n",
+				metrics_rcodes[i], (unsigned long)st.rcode[i]);
+		}
+	}
+	for(k=0; k<2; k++) {
+		if(map[k])
+			munmap(map[k], len[k]);
+	}
+}
+#endif /* USE_ZONE_STATS */
+
+/* format the statistics into the buffer */
+static void
+metrics_render(buffer_type* out, struct nsd* nsd, struct nsdst* stats)
+{
+	struct nsdst total;
+	size_t i, cc = nsd->child_count;
+
+	/* a snapshot, the old and new servers of a reload have a block
+	 * each and together they are the count of the server */
+	memcpy(stats, nsd->stat_map, cc*2*sizeof(struct nsdst));
+	memset(&total, 0, sizeof(total));
+	metrics_head(out, "server_queries_total", "counter",
+		"Queries received per server process.");
+	for(i=0; i<cc; i++) {
+		stats_add(&stats[i], &stats[cc+i]);
+		buffer_printf(out, "nsd_server_queries_total{server=\"%d\"} "
+			"%lu\n", (int)i+1, (unsigned long)(stats[i].qudp +
+			stats[i].qudp6 + stats[i].ctcp + stats[i].ctcp6 +
+			stats[i].ctls + stats[i].ctls6));
+		stats_add(&total, &stats[i]);
+	}
+	metrics_head(out, "server_page_faults_total", "counter",
+		"Page faults per server process, major ones read from disk.");
+	for(i=0; i<cc; i++) {
+		buffer_printf(out, "nsd_server_page_faults_total{server=\"%d\","
+			"kind=\"major\"} %lu\n", (int)i+1,
+			(unsigned long)stats[i].page_faults_major);
+		buffer_printf(out, "nsd_server_page_faults_total{server=\"%d\","
+			"kind=\"minor\"} %lu\n", (int)i+1,
+			(unsigned long)stats[i].page_faults_minor);
+	}
+	metrics_block(out, &total);
+
+	metrics_head(out, "start_time_seconds", "gauge",
+		"Start time of the server since the epoch.");
+	buffer_printf(out, "nsd_start_time_seconds %lld\n",
+		(long long)stats[0].boot);
+	metrics_head(out, "database_bytes", "gauge",
+		"Size of the zone data.");
+	buffer_printf(out, "nsd_database_bytes{kind=\"memory\"} %llu\n"
+		"nsd_database_bytes{kind=\"disk\"} %llu\n",
+		(unsigned long long)stats[0].db_mem,
+		(unsigned long long)stats[0].db_disk);
+	metrics_head(out, "database_compact_bytes_total", "counter",
+		"Memory given back by reloads that copied the zone data.");
+	buffer_printf(out, "nsd_database_compact_bytes_total %llu\n",
+		(unsigned long long)stats[0].db_compact_bytes);
+#ifdef USE_ZONE_STATS
+	metrics_zonestats(out, nsd);
+#endif
+}
+
+/* write all of the data, the socket is blocking */
+static int
+metrics_write(int fd, const void* data, size_t len)
+{
+	const char* p = (const char*)data;
+	while(len > 0) {
+		ssize_t w = write(fd, p, len);
+		if(w == -1) {
+			if(errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += w;
+		len -= (size_t)w;
+	}
+	return 1;
+}
+
+/* answer one HTTP request on the connection */
+static void
+metrics_handle(int fd, struct nsd* nsd, region_type* region,
+	struct nsdst* stats)
+{
+	char req[METRICS_REQUEST_MAX+1], head[256];
+	size_t len = 0;
+	struct timeval tv;
+	buffer_type* out;
+
+	tv.tv_sec = METRICS_TIMEOUT;
+	tv.tv_usec = 0;
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	/* read the request head, the body of a GET is empty */
+	while(len < METRICS_REQUEST_MAX) {
+		ssize_t r = read(fd, req+len, METRICS_REQUEST_MAX-len);
+		if(r == -1 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return;
+		len += (size_t)r;
+		req[len] = 0;
+		if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = 0;
+
+	if(strncmp(req, "GET /metrics ", 13) != 0 &&
+		strncmp(req, "GET / ", 6) != 0) {
+		const char* nf = "HTTP/1.0 404 Not Found\r\n"
+			"Content-Length: 0\r\nConnection: close\r\n\r\n";
+		(void)metrics_write(fd, nf, strlen(nf));
+		return;
+	}
+	out = buffer_create(region, 65536);
+	metrics_render(out, nsd, stats);
+	snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: %lu\r\nConnection: close\r\n\r\n",
+		(unsigned long)buffer_position(out));
+	if(metrics_write(fd, head, strlen(head)))
+		(void)metrics_write(fd, buffer_begin(out),
+			buffer_position(out));
+}
+
+/* open the listening socket for the metrics */
+static int
+metrics_listen(struct nsd* nsd)
+{
+	struct addrinfo hints, *res = NULL;
+	const char* addr = nsd->options->metrics_interface;
+	char port[16];
+	int fd, r, on = 1;
+
+	if(!addr || !addr[0])
+		addr = "127.0.0.1";
+	snprintf(port, sizeof(port), "%d", nsd->options->metrics_port);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_NUMERICHOST | AI_PASSIVE;
+	hints.ai_socktype = SOCK_STREAM;
+	if((r = getaddrinfo(addr, port, &hints, &res)) != 0 || !res) {
+		log_msg(LOG_ERR, "metrics: cannot parse %s: %s", addr,
+			gai_strerror(r));
+		return -1;
+	}
+	if((fd = socket(res->ai_family, SOCK_STREAM, 0)) == -1) {
+		log_msg(LOG_ERR, "metrics: socket: %s", strerror(errno));
+		freeaddrinfo(res);
+		return -1;
+	}
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if(bind(fd, res->ai_addr, res->ai_addrlen) == -1 ||
+		listen(fd, 16) == -1) {
+		log_msg(LOG_ERR, "metrics: cannot listen on %s port %s: %s",
+			addr, port, strerror(errno));
+		close(fd);
+		freeaddrinfo(res);
+		return -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+/* the metrics process, serves scrapes until it is terminated */
+static void
+metrics_run(struct nsd* nsd, int fd)
+{
+	struct nsdst* stats = xalloc_array_zero(nsd->child_count*2,
+		sizeof(struct nsdst));
+	region_type* region = region_create(xalloc, free);
+	while(1) {
+		int s = accept(fd, NULL, NULL);
+		if(s == -1) {
+			if(errno != EINTR && errno != ECONNABORTED)
+				log_msg(LOG_ERR, "metrics: accept: %s",
+					strerror(errno));
+			continue;
+		}
+		metrics_handle(s, nsd, region, stats);
+		close(s);
+		region_free_all(region);
+	}
+}
+#endif /* BIND8_STATS */
+
+pid_t
+metrics_start(struct nsd* nsd)
+{
+#ifdef BIND8_STATS
+	pid_t pid;
+	int fd = metrics_listen(nsd);
+	if(fd == -1)
+		return -1;
+	pid = fork();
+	if(pid == -1) {
+		log_msg(LOG_ERR, "metrics: fork failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if(pid != 0) {
+		close(fd);
+		return pid;
+	}
+	/* the metrics process is this */
+#ifdef HAVE_SETPROCTITLE
+	setproctitle("metrics");
+#endif
+	log_set_process_role("metrics");
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGALRM, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+#ifdef HAVE_CPUSET_T
+	/* off the server cpus, with xfrd */
+	if(nsd->use_cpu_affinity)
+		set_cpu_affinity(nsd->xfrd_cpuset);
+#endif
+	VERBOSITY(1, (LOG_INFO, "metrics: serving on port %d",
+		nsd->options->metrics_port));
+	metrics_run(nsd, fd);
+	/* NOTREACH */
+	exit(0);
+#else
+	log_msg(LOG_ERR, "metrics: NSD was compiled without statistics, "
+		"use --enable-bind8-stats");
+	(void)nsd;
+	return -1;
+#endif /* BIND8_STATS */
+}
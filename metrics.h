@@ -0,0 +1,27 @@
+/*
+ * metrics.h -- serve the statistics in the Prometheus text format
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+struct nsd;
+
+/* the longest HTTP request head that is read */
+#define METRICS_REQUEST_MAX 4096
+/* seconds to wait for the request of a scrape */
+#define METRICS_TIMEOUT 5
+
+/*
+ * Fork the metrics process, that answers HTTP requests on the
+ * metrics-interface and metrics-port with the statistics from the shared
+ * memory. The server processes and xfrd are not involved in a scrape.
+ * Returns the pid of the process, or -1 on failure.
+ */
+pid_t metrics_start(struct nsd* nsd);
+
+#endif /* METRICS_H */
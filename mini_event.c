@@ -36,8 +36,8 @@
 
 /**
  * \file
- * fake libevent implementation. Less broad in functionality, and only
- * supports select(2).
+ * fake libevent implementation. Less broad in functionality, and
+ * supports epoll(7), kqueue(2) and select(2).
  */
 
 #include "config.h"
@@ -58,8 +58,21 @@
 #include <signal.h>
 #include "mini_event.h"
 #include "util.h"
+#ifdef USE_MINI_EVENT_EPOLL
+#include <sys/epoll.h>
+#endif
+#ifdef USE_MINI_EVENT_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+#include <unistd.h>
+#include <fcntl.h>
+/** number of ready fds to get per poll call */
+#define MINI_EV_POLL_SIZE 128
+#endif
 
-/** compare events in tree, based on timevalue, ptr for uniqueness */
+/** compare events by timevalue, ptr for uniqueness */
 int
 mini_ev_cmp(const void* a, const void* b)
 {
@@ -102,26 +115,28 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 	if(!base)
 		return NULL;
 	memset(base, 0, sizeof(*base));
-	base->region = region_create(xalloc, free);
-	if(!base->region) {
-		free(base);
-		return NULL;
-	}
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	base->pollfd = -1;
+#endif
 	base->time_secs = time_secs;
 	base->time_tv = time_tv;
 	if(settime(base) < 0) {
 		event_base_free(base);
 		return NULL;
 	}
-	base->times = rbtree_create(base->region, mini_ev_cmp);
+	base->cap_times = 64;
+	base->times = (struct event**)calloc((size_t)base->cap_times,
+		sizeof(struct event*));
 	if(!base->times) {
 		event_base_free(base);
 		return NULL;
 	}
 	base->capfd = MAX_FDS;
+#if !defined(USE_MINI_EVENT_EPOLL) && !defined(USE_MINI_EVENT_KQUEUE)
 #ifdef FD_SETSIZE
 	if((int)FD_SETSIZE < base->capfd)
 		base->capfd = (int)FD_SETSIZE;
+#endif
 #endif
 	base->fds = (struct event**)calloc((size_t)base->capfd, 
 		sizeof(struct event*));
@@ -134,9 +149,24 @@ event_init(time_t* time_secs, struct timeval* time_tv)
 		event_base_free(base);
 		return NULL;
 	}
+#ifdef USE_MINI_EVENT_EPOLL
+	base->pollfd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(USE_MINI_EVENT_KQUEUE)
+	if((base->pollfd = kqueue()) != -1)
+		(void)fcntl(base->pollfd, F_SETFD, FD_CLOEXEC);
+#endif
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	if(base->pollfd == -1) {
+		log_msg(LOG_ERR, "mini-event: could not create %s fd: %s",
+			event_get_method(), strerror(errno));
+		event_base_free(base);
+		return NULL;
+	}
+#else
 #ifndef S_SPLINT_S
 	FD_ZERO(&base->reads);
 	FD_ZERO(&base->writes);
+#endif
 #endif
 	return base;
 }
@@ -148,11 +178,91 @@ event_get_version(void)
 	return "mini-event-"PACKAGE_VERSION;
 }
 
-/** get polling method, select */
+/** get polling method, epoll, kqueue or select */
 const char *
 event_get_method(void)
 {
+#ifdef USE_MINI_EVENT_EPOLL
+	return "epoll";
+#elif defined(USE_MINI_EVENT_KQUEUE)
+	return "kqueue";
+#else
 	return "select";
+#endif
+}
+
+/** put the event at index i in the heap, and note the index */
+static void
+heap_set(struct event_base* base, int i, struct event* ev)
+{
+	base->times[i] = ev;
+	ev->heap_idx = i;
+}
+
+/** move the event at index i up in the heap to its place */
+static void
+heap_up(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	while(i > 1 && mini_ev_cmp(ev, base->times[i/2]) < 0) {
+		heap_set(base, i, base->times[i/2]);
+		i /= 2;
+	}
+	heap_set(base, i, ev);
+}
+
+/** move the event at index i down in the heap to its place */
+static void
+heap_down(struct event_base* base, int i)
+{
+	struct event* ev = base->times[i];
+	int c;
+	while((c = i*2) <= base->num_times) {
+		if(c < base->num_times &&
+			mini_ev_cmp(base->times[c+1], base->times[c]) < 0)
+			c++;
+		if(mini_ev_cmp(base->times[c], ev) >= 0)
+			break;
+		heap_set(base, i, base->times[c]);
+		i = c;
+	}
+	heap_set(base, i, ev);
+}
+
+/** insert event in the timeout heap */
+static int
+heap_insert(struct event_base* base, struct event* ev)
+{
+	if(base->num_times+1 >= base->cap_times) {
+		struct event** t = (struct event**)realloc(base->times,
+			sizeof(struct event*)*(size_t)base->cap_times*2);
+		if(!t)
+			return -1;
+		base->times = t;
+		base->cap_times *= 2;
+	}
+	base->num_times++;
+	base->times[base->num_times] = ev;
+	heap_up(base, base->num_times);
+	return 0;
+}
+
+/** remove event from the timeout heap, if it is in it */
+static void
+heap_remove(struct event_base* base, struct event* ev)
+{
+	int i = ev->heap_idx;
+	struct event* last;
+	if(i < 1 || i > base->num_times || base->times[i] != ev)
+		return;
+	ev->heap_idx = 0;
+	last = base->times[base->num_times--];
+	if(last == ev)
+		return;
+	base->times[i] = last;
+	if(i > 1 && mini_ev_cmp(last, base->times[i/2]) < 0)
+		heap_up(base, i);
+	else	heap_down(base, i);
 }
 
 /** call timeouts handlers, and return how long to wait for next one or -1 */
@@ -166,8 +276,8 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 	wait->tv_sec = (time_t)-1;
 #endif
 
-	while((rbnode_type*)(p = (struct event*)rbtree_first(base->times))
-		!=RBTREE_NULL) {
+	while(base->num_times > 0) {
+		p = base->times[1];
 #ifndef S_SPLINT_S
 		if(p->ev_timeout.tv_sec > now->tv_sec ||
 			(p->ev_timeout.tv_sec==now->tv_sec && 
@@ -187,13 +297,153 @@ handle_timeouts(struct event_base* base, struct timeval* now,
 #endif
 		/* event times out, remove it */
 		tofired = 1;
-		(void)rbtree_delete(base->times, p);
+		heap_remove(base, p);
 		p->ev_flags &= ~EV_TIMEOUT;
 		(*p->ev_callback)(p->ev_fd, EV_TIMEOUT, p->ev_arg);
 	}
 	return tofired;
 }
 
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+/** call the handler of fd for the ready bits */
+static void
+handle_ready(struct event_base* base, int fd, short bits)
+{
+	struct event* ev;
+	if(fd < 0 || fd >= base->capfd || !(ev = base->fds[fd]))
+		return;
+	/* the event was added after the poll, by one of the handlers,
+	 * perhaps for a new fd with the same number */
+	if(ev->round == base->round)
+		return;
+	bits &= ev->ev_flags;
+	if(bits)
+		(*ev->ev_callback)(ev->ev_fd, bits, ev->ev_arg);
+}
+
+/** wait for ready fds and call the handlers for them */
+static int
+handle_poll(struct event_base* base, struct timeval* wait)
+{
+#ifdef USE_MINI_EVENT_EPOLL
+	struct epoll_event evs[MINI_EV_POLL_SIZE];
+	int timeout = -1;
+#else
+	struct kevent evs[MINI_EV_POLL_SIZE];
+	struct timespec ts, *timeout = NULL;
+#endif
+	int ret, i;
+
+#ifndef S_SPLINT_S
+	if(wait->tv_sec != (time_t)-1) {
+#ifdef USE_MINI_EVENT_EPOLL
+		/* round up, to not wake up just before the timeout */
+		timeout = (int)wait->tv_sec*1000 +
+			(int)(wait->tv_usec+999)/1000;
+#else
+		ts.tv_sec = wait->tv_sec;
+		ts.tv_nsec = (long)wait->tv_usec*1000;
+		timeout = &ts;
+#endif
+	}
+#endif
+#ifdef USE_MINI_EVENT_EPOLL
+	ret = epoll_wait(base->pollfd, evs, MINI_EV_POLL_SIZE, timeout);
+#else
+	ret = kevent(base->pollfd, NULL, 0, evs, MINI_EV_POLL_SIZE, timeout);
+#endif
+	if(ret == -1) {
+		ret = errno;
+		if(settime(base) < 0)
+			return -1;
+		errno = ret;
+		if(ret == EAGAIN || ret == EINTR)
+			return 0;
+		return -1;
+	}
+	if(settime(base) < 0)
+		return -1;
+
+	base->round++;
+	for(i=0; i<ret; i++) {
+#ifdef USE_MINI_EVENT_EPOLL
+		short bits = 0;
+		if((evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)))
+			bits |= EV_READ;
+		if((evs[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR)))
+			bits |= EV_WRITE;
+		handle_ready(base, evs[i].data.fd, bits);
+#else
+		if((evs[i].flags & EV_ERROR))
+			continue;
+		handle_ready(base, (int)evs[i].ident,
+			evs[i].filter == EVFILT_WRITE?EV_WRITE:EV_READ);
+#endif
+	}
+	return 0;
+}
+
+/** make the poll fd watch the fd of the event, or stop watching it */
+static int
+poll_change(struct event* ev, int add)
+{
+	struct event_base* base = ev->ev_base;
+#ifdef USE_MINI_EVENT_EPOLL
+	struct epoll_event e;
+	if(!add) {
+		/* the fd may have been closed already */
+		(void)epoll_ctl(base->pollfd, EPOLL_CTL_DEL, ev->ev_fd, NULL);
+		return 0;
+	}
+	memset(&e, 0, sizeof(e));
+	if((ev->ev_flags&EV_READ))
+		e.events |= EPOLLIN;
+	if((ev->ev_flags&EV_WRITE))
+		e.events |= EPOLLOUT;
+	e.data.fd = ev->ev_fd;
+	if(epoll_ctl(base->pollfd, EPOLL_CTL_ADD, ev->ev_fd, &e) == -1) {
+		/* a closed fd that was not deleted, with the same number */
+		if(errno != EEXIST || epoll_ctl(base->pollfd, EPOLL_CTL_MOD,
+			ev->ev_fd, &e) == -1)
+			return -1;
+	}
+#else
+	struct kevent e;
+	if((ev->ev_flags&EV_READ)) {
+		EV_SET(&e, ev->ev_fd, EVFILT_READ, add?EV_ADD:EV_DELETE,
+			0, 0, NULL);
+		if(kevent(base->pollfd, &e, 1, NULL, 0, NULL) == -1 && add)
+			return -1;
+	}
+	if((ev->ev_flags&EV_WRITE)) {
+		EV_SET(&e, ev->ev_fd, EVFILT_WRITE, add?EV_ADD:EV_DELETE,
+			0, 0, NULL);
+		if(kevent(base->pollfd, &e, 1, NULL, 0, NULL) == -1 && add)
+			return -1;
+	}
+#endif
+	return 0;
+}
+
+/** grow the fds array to fit fd */
+static int
+grow_fds(struct event_base* base, int fd)
+{
+	int cap = base->capfd;
+	struct event** fds;
+	while(cap <= fd)
+		cap *= 2;
+	fds = (struct event**)realloc(base->fds, sizeof(struct event*)*
+		(size_t)cap);
+	if(!fds)
+		return -1;
+	memset(fds+base->capfd, 0, sizeof(struct event*)*
+		(size_t)(cap-base->capfd));
+	base->fds = fds;
+	base->capfd = cap;
+	return 0;
+}
+#else /* select */
 /** call select and callbacks for that */
 static int
 handle_select(struct event_base* base, struct timeval* wait)
@@ -244,21 +494,27 @@ handle_select(struct event_base* base, struct timeval* wait)
 	}
 	return 0;
 }
+#define handle_poll handle_select
+#endif /* USE_MINI_EVENT_EPOLL || USE_MINI_EVENT_KQUEUE */
 
 /** run select once */
 int
 event_base_loop(struct event_base* base, int flags)
 {
 	struct timeval wait;
-	if(!(flags & EVLOOP_ONCE))
+	if(!(flags & (EVLOOP_ONCE|EVLOOP_NONBLOCK)))
 		return event_base_dispatch(base);
 	/* see if timeouts need handling */
 	if(handle_timeouts(base, base->time_tv, &wait))
 		return 0; /* there were timeouts, end of loop */
+	if((flags & EVLOOP_NONBLOCK)) {
+		wait.tv_sec = 0;
+		wait.tv_usec = 0;
+	}
 	if(base->need_to_exit)
 		return 0;
 	/* do select */
-	if(handle_select(base, &wait) < 0) {
+	if(handle_poll(base, &wait) < 0) {
 		if(base->need_to_exit)
 			return 0;
 		return -1;
@@ -280,7 +536,7 @@ event_base_dispatch(struct event_base* base)
 		if(base->need_to_exit)
 			return 0;
 		/* do select */
-		if(handle_select(base, &wait) < 0) {
+		if(handle_poll(base, &wait) < 0) {
 			if(base->need_to_exit)
 				return 0;
 			return -1;
@@ -309,12 +565,16 @@ event_base_free(struct event_base* base)
 {
 	if(!base)
 		return;
-	/* base->times is allocated in region and is freed with the region */
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	if(base->pollfd != -1)
+		close(base->pollfd);
+#endif
+	if(base->times)
+		free(base->times);
 	if(base->fds)
 		free(base->fds);
 	if(base->signals)
 		free(base->signals);
-	region_destroy(base->region);
 	free(base);
 }
 
@@ -323,7 +583,7 @@ void
 event_set(struct event* ev, int fd, short bits, 
 	void (*cb)(int, short, void *), void* arg)
 {
-	ev->node.key = ev;
+	ev->heap_idx = 0;
 	ev->ev_fd = fd;
 	ev->ev_flags = bits;
 	ev->ev_callback = cb;
@@ -346,9 +606,21 @@ event_add(struct event* ev, struct timeval* tv)
 {
 	if(ev->added)
 		event_del(ev);
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		(ev->ev_flags&(EV_READ|EV_WRITE)) &&
+		grow_fds(ev->ev_base, ev->ev_fd) == -1)
+		return -1;
+#endif
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
 	if( (ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+		if(poll_change(ev, 1) == -1)
+			return -1;
+		ev->round = ev->ev_base->round;
+		ev->ev_base->fds[ev->ev_fd] = ev;
+#else
 		ev->ev_base->fds[ev->ev_fd] = ev;
 		if(ev->ev_flags&EV_READ) {
 			FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
@@ -358,6 +630,7 @@ event_add(struct event* ev, struct timeval* tv)
 		}
 		FD_SET(FD_SET_T ev->ev_fd, &ev->ev_base->content);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
+#endif
 		if(ev->ev_fd > ev->ev_base->maxfd)
 			ev->ev_base->maxfd = ev->ev_fd;
 	}
@@ -371,7 +644,14 @@ event_add(struct event* ev, struct timeval* tv)
 			ev->ev_timeout.tv_sec++;
 		}
 #endif
-		(void)rbtree_insert(ev->ev_base->times, &ev->node);
+		if(heap_insert(ev->ev_base, ev) == -1) {
+			if( (ev->ev_flags&(EV_READ|EV_WRITE)) &&
+				ev->ev_fd != -1) {
+				ev->added = 1;
+				event_del(ev);
+			}
+			return -1;
+		}
 	}
 	ev->added = 1;
 	return 0;
@@ -381,16 +661,30 @@ event_add(struct event* ev, struct timeval* tv)
 int
 event_del(struct event* ev)
 {
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd &&
+		(ev->ev_flags&(EV_READ|EV_WRITE)))
+		return -1;
+#else
 	if(ev->ev_fd != -1 && ev->ev_fd >= ev->ev_base->capfd)
 		return -1;
-	if((ev->ev_flags&EV_TIMEOUT))
-		(void)rbtree_delete(ev->ev_base->times, &ev->node);
+#endif
+	if(ev->heap_idx)
+		heap_remove(ev->ev_base, ev);
 	if((ev->ev_flags&(EV_READ|EV_WRITE)) && ev->ev_fd != -1) {
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+		/* only if it is the one registered for the fd */
+		if(ev->ev_base->fds[ev->ev_fd] == ev) {
+			ev->ev_base->fds[ev->ev_fd] = NULL;
+			(void)poll_change(ev, 0);
+		}
+#else
 		ev->ev_base->fds[ev->ev_fd] = NULL;
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->reads);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->writes);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->ready);
 		FD_CLR(FD_SET_T ev->ev_fd, &ev->ev_base->content);
+#endif
 	}
 	ev->added = 0;
 	return 0;
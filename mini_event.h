@@ -1,5 +1,6 @@
 /*
- * mini-event.h - micro implementation of libevent api, using select() only.
+ * mini-event.h - micro implementation of libevent api, using epoll, kqueue
+ * or select.
  *
  * Copyright (c) 2007, NLnet Labs. All rights reserved.
  * 
@@ -36,17 +37,16 @@
 /**
  * \file
  * This file implements part of the event(3) libevent api.
- * The back end is only select. Max number of fds is limited.
+ * The back end is epoll on Linux, kqueue on the BSDs, and select
+ * elsewhere, where the max number of fds is limited.
  * Max number of signals is limited, one handler per signal only.
  * And one handler per fd.
  *
- * Although limited to select() and a max (1024) open fds, it
- * is efficient:
- * o dispatch call caches fd_sets to use. 
- * o handler calling takes time ~ to the number of fds.
- * o timeouts are stored in a redblack tree, sorted, so take log(n).
- * Timeouts are only accurate to the second (no subsecond accuracy).
- * To avoid cpu hogging, fractional timeouts are rounded up to a whole second.
+ * It is efficient:
+ * o with epoll and kqueue, handler calling takes time ~ to the number of
+ *   ready fds. With select, the dispatch call caches fd_sets to use,
+ *   and handler calling takes time ~ to the number of fds.
+ * o timeouts are stored in a binary heap, so take log(n).
  */
 
 #ifndef MINI_EVENT_H
@@ -75,10 +75,15 @@ struct region;
 /** event must persist */
 #define EV_PERSIST	0x10
 
-/* needs our redblack tree */
-#include "rbtree.h"
+/** the fd polling back end */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+#define USE_MINI_EVENT_EPOLL 1
+#elif defined(HAVE_SYS_EVENT_H) && defined(HAVE_KQUEUE)
+#define USE_MINI_EVENT_KQUEUE 1
+#endif
 
-/** max number of file descriptors to support */
+/** max number of file descriptors to support with select, and the
+ * initial size of the fds array for epoll and kqueue */
 #define MAX_FDS 1024
 /** max number of signals to support */
 #define MAX_SIG 32
@@ -86,14 +91,25 @@ struct region;
 /** event base */
 struct event_base
 {
-	/** sorted by timeout (absolute), ptr */
-	rbtree_type* times;
+	/** binary heap sorted by timeout (absolute), from index 1 */
+	struct event** times;
+	/** number of events in the heap */
+	int num_times;
+	/** capacity of the heap array */
+	int cap_times;
 	/** array of 0 - maxfd of ptr to event for it */
 	struct event** fds;
 	/** max fd in use */
 	int maxfd;
 	/** capacity - size of the fds array */
 	int capfd;
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	/** the epoll or kqueue fd */
+	int pollfd;
+	/** number of the current round of callbacks, events added in it
+	 * do not get the readiness of the fd polled before the round */
+	unsigned int round;
+#else
 	/* fdset for read write, for fds ready, and added */
 	fd_set 
 		/** fds for reading */
@@ -104,6 +120,7 @@ struct event_base
 		ready, 
 		/** ready plus newly added events. */
 		content;
+#endif
 	/** array of 0 - maxsig of ptr to event for it */
 	struct event** signals;
 	/** if we need to exit */
@@ -112,18 +129,20 @@ struct event_base
 	time_t* time_secs;
 	/** where to store time in microseconds */
 	struct timeval* time_tv;
-	/** region for allocation */
-	struct region* region;
 };
 
 /**
  * Event structure. Has some of the event elements.
  */
 struct event {
-	/** node in timeout rbtree */
-	rbnode_type node;
+	/** index in the timeout heap, 0 if not in it */
+	int heap_idx;
 	/** is event already added */
 	int added;
+#if defined(USE_MINI_EVENT_EPOLL) || defined(USE_MINI_EVENT_KQUEUE)
+	/** round of callbacks in which the event was added */
+	unsigned int round;
+#endif
 
 	/** event base it belongs to */
 	struct event_base *ev_base;
@@ -145,7 +164,7 @@ struct event {
 void *event_init(time_t* time_secs, struct timeval* time_tv);
 /** get version */
 const char *event_get_version(void);
-/** get polling method, select */
+/** get polling method, epoll, kqueue or select */
 const char *event_get_method(void);
 /** run select in a loop */
 int event_base_dispatch(struct event_base *);
@@ -155,6 +174,8 @@ int event_base_loopexit(struct event_base *, struct timeval *);
 int event_base_loopbreak(struct event_base *);
 /** run select once */
 #define EVLOOP_ONCE 1
+/** run select once, without waiting */
+#define EVLOOP_NONBLOCK 2
 int event_base_loop(struct event_base* base, int flags);
 /** free event base. Free events yourself */
 void event_base_free(struct event_base *);
@@ -184,7 +205,7 @@ int signal_del(struct event *);
 
 #endif /* USE_MINI_EVENT and not USE_WINSOCK */
 
-/** compare events in tree, based on timevalue, ptr for uniqueness */
+/** compare events by timevalue, ptr for uniqueness */
 int mini_ev_cmp(const void* a, const void* b);
 
 #endif /* MINI_EVENT_H */
@@ -19,6 +19,9 @@
 
 #include "namedb.h"
 #include "nsec3.h"
+#include "fasthash.h"
+#include "ixfr.h"
+#include "rdata.h"
 
 static domain_type *
 allocate_domain_info(domain_table_type* table,
@@ -26,20 +29,23 @@ allocate_domain_info(domain_table_type* table,
 		     domain_type* parent)
 {
 	domain_type *result;
+	uint8_t label_count;
 
 	assert(table);
 	assert(dname);
 	assert(parent);
 
+	/* the name is stored right after the domain, in the same block,
+	 * that is recycled together in do_deldomain */
+	label_count = domain_dname(parent)->label_count + 1;
 	result = (domain_type *) region_alloc(table->region,
-					      sizeof(domain_type));
+		sizeof(domain_type) + dname_partial_size(dname, label_count));
 #ifdef USE_RADIX_TREE
 	result->dname 
 #else
 	result->node.key
 #endif
-		= dname_partial_copy(
-		table->region, dname, domain_dname(parent)->label_count + 1);
+		= dname_partial_copy_into(result + 1, dname, label_count);
 	result->parent = parent;
 	result->wildcard_child_closest_match = result;
 	result->rrsets = NULL;
@@ -211,6 +217,102 @@ prehash_del(domain_table_type* table, domain_type* domain)
 }
 #endif /* NSEC3 */
 
+#ifdef USE_NAME_HASH
+/* initial number of slots in the hash table of names */
+#define NAMEHASH_INITIAL_SIZE 1024
+
+static uint32_t
+namehash_hash(const dname_type* dname)
+{
+	return fasthash32(dname_name(dname), dname->name_size, 0);
+}
+
+/* put the domain in a free slot, the table is not full */
+static void
+namehash_put(struct namehash_entry* table, size_t mask, uint32_t h,
+	domain_type* domain)
+{
+	size_t i = h & mask;
+	while(table[i].domain)
+		i = (i+1) & mask;
+	table[i].hash = h;
+	table[i].domain = domain;
+}
+
+/* add the domain to the hash table of names, grows it when it is at
+ * three quarters */
+static void
+namehash_add(domain_table_type* table, domain_type* domain)
+{
+	if((table->namehash_count+1)*4 > table->namehash_size*3) {
+		size_t size = table->namehash_size ?
+			table->namehash_size*2 : NAMEHASH_INITIAL_SIZE;
+		struct namehash_entry* n = region_alloc_array_zero(
+			table->region, size, sizeof(*n));
+		size_t i;
+		for(i = 0; i < table->namehash_size; i++)
+			if(table->namehash[i].domain)
+				namehash_put(n, size-1, table->namehash[i].hash,
+					table->namehash[i].domain);
+		region_recycle(table->region, table->namehash,
+			table->namehash_size*sizeof(*n));
+		table->namehash = n;
+		table->namehash_size = size;
+	}
+	namehash_put(table->namehash, table->namehash_size-1,
+		namehash_hash(domain_dname(domain)), domain);
+	table->namehash_count++;
+}
+
+/* find the domain with the name in the hash table of names */
+static domain_type*
+namehash_find(domain_table_type* table, const dname_type* dname)
+{
+	size_t mask = table->namehash_size-1, i;
+	uint32_t h;
+	if(!table->namehash)
+		return NULL;
+	h = namehash_hash(dname);
+	for(i = h & mask; table->namehash[i].domain; i = (i+1) & mask) {
+		const dname_type* d;
+		if(table->namehash[i].hash != h)
+			continue;
+		d = domain_dname(table->namehash[i].domain);
+		if(d->name_size == dname->name_size &&
+			memcmp(dname_name(d), dname_name(dname),
+			d->name_size) == 0)
+			return table->namehash[i].domain;
+	}
+	return NULL;
+}
+
+void
+domain_table_namehash_del(domain_table_type* table, domain_type* domain)
+{
+	size_t mask = table->namehash_size-1, i, j, k;
+	if(!table->namehash)
+		return;
+	i = namehash_hash(domain_dname(domain)) & mask;
+	while(table->namehash[i].domain != domain) {
+		if(!table->namehash[i].domain)
+			return;
+		i = (i+1) & mask;
+	}
+	/* move the entries after it back, that would not be found
+	 * otherwise, until the next empty slot */
+	for(j = (i+1) & mask; table->namehash[j].domain; j = (j+1) & mask) {
+		k = table->namehash[j].hash & mask;
+		if((j > i && (k <= i || k > j)) ||
+			(j < i && k <= i && k > j)) {
+			table->namehash[i] = table->namehash[j];
+			i = j;
+		}
+	}
+	table->namehash[i].domain = NULL;
+	table->namehash_count--;
+}
+#endif /* USE_NAME_HASH */
+
 /** perform domain name deletion */
 static void
 do_deldomain(namedb_type* db, domain_type* domain)
@@ -265,14 +367,18 @@ do_deldomain(namedb_type* db, domain_type* domain)
 			domain_previous_existing_child(domain);
 
 	/* actual removal */
+	if(db->domains->last_insert == domain)
+		db->domains->last_insert = NULL;
 #ifdef USE_RADIX_TREE
 	radix_delete(db->domains->nametree, domain->rnode);
 #else
 	rbtree_delete(db->domains->names_to_domains, domain->node.key);
 #endif
-	region_recycle(db->domains->region, domain_dname(domain),
+#ifdef USE_NAME_HASH
+	domain_table_namehash_del(db->domains, domain);
+#endif
+	region_recycle(db->domains->region, domain, sizeof(domain_type) +
 		dname_total_size(domain_dname(domain)));
-	region_recycle(db->domains->region, domain, sizeof(domain_type));
 }
 
 void
@@ -355,9 +461,16 @@ domain_table_create(region_type* region)
 
 	result->root = root;
 	result->numlist_last = root;
+	result->last_insert = NULL;
 #ifdef NSEC3
 	result->prehash_list = NULL;
 #endif
+#ifdef USE_NAME_HASH
+	result->namehash = NULL;
+	result->namehash_size = 0;
+	result->namehash_count = 0;
+	namehash_add(result, root);
+#endif
 
 	return result;
 }
@@ -376,9 +489,17 @@ domain_table_search(domain_table_type *table,
 	assert(closest_match);
 	assert(closest_encloser);
 
+#ifdef USE_NAME_HASH
+	/* most lookups are for names that exist */
+	if((*closest_match = namehash_find(table, dname)) != NULL) {
+		*closest_encloser = *closest_match;
+		return 1;
+	}
+#endif
 #ifdef USE_RADIX_TREE
-	exact = radname_find_less_equal(table->nametree, dname_name(dname),
-		dname->name_size, (struct radnode**)closest_match);
+	exact = radname_find_less_equal_labels(table->nametree,
+		dname_name(dname), dname_label_offsets(dname),
+		dname->label_count, (struct radnode**)closest_match);
 	*closest_match = (domain_type*)((*(struct radnode**)closest_match)->elem);
 #else
 	exact = rbtree_find_less_equal(table->names_to_domains, dname, (rbnode_type **) closest_match);
@@ -415,6 +536,50 @@ domain_table_find(domain_table_type* table,
 }
 
 
+/*
+ * Search for the name next to the last inserted domain, for names that
+ * are inserted in canonical order. Returns 0 if the name is not at or
+ * just after the last insert, and the tree has to be searched.
+ */
+static int
+domain_table_search_next(domain_table_type* table, const dname_type* dname,
+	domain_type** closest_match, domain_type** closest_encloser,
+	int* exact)
+{
+	domain_type* last = table->last_insert, *next;
+	uint8_t label_match_count;
+	int c;
+
+	if (!last)
+		return 0;
+	c = dname_compare(dname, domain_dname(last));
+	if (c < 0)
+		return 0;
+	if (c == 0) {
+		*closest_match = *closest_encloser = last;
+		*exact = 1;
+		return 1;
+	}
+	next = domain_next(last);
+	if (next) {
+		c = dname_compare(dname, domain_dname(next));
+		if (c > 0)
+			return 0;
+		if (c == 0) {
+			*closest_match = *closest_encloser = next;
+			*exact = 1;
+			return 1;
+		}
+	}
+	/* between the last insert and the next domain */
+	*closest_match = *closest_encloser = last;
+	*exact = 0;
+	label_match_count = dname_label_match_count(domain_dname(last), dname);
+	while (label_match_count < domain_dname(*closest_encloser)->label_count)
+		*closest_encloser = (*closest_encloser)->parent;
+	return 1;
+}
+
 domain_type *
 domain_table_insert(domain_table_type* table,
 		    const dname_type* dname)
@@ -427,8 +592,10 @@ domain_table_insert(domain_table_type* table,
 	assert(table);
 	assert(dname);
 
-	exact = domain_table_search(
-		table, dname, &closest_match, &closest_encloser);
+	if (!domain_table_search_next(
+		table, dname, &closest_match, &closest_encloser, &exact))
+		exact = domain_table_search(
+			table, dname, &closest_match, &closest_encloser);
 	if (exact) {
 		result = closest_encloser;
 	} else {
@@ -446,6 +613,9 @@ domain_table_insert(domain_table_type* table,
 #else
 			rbtree_insert(table->names_to_domains, (rbnode_type *) result);
 #endif
+#ifdef USE_NAME_HASH
+			namehash_add(table, result);
+#endif
 
 			/*
 			 * If the newly added domain name is larger
@@ -467,6 +637,7 @@ domain_table_insert(domain_table_type* table,
 		} while (domain_dname(closest_encloser)->label_count < dname->label_count);
 	}
 
+	table->last_insert = result;
 	return result;
 }
 
@@ -519,7 +690,7 @@ domain_find_rrset(domain_type* domain, zone_type* zone, uint16_t type)
 	rrset_type* result = domain->rrsets;
 
 	while (result) {
-		if (result->zone == zone && rrset_rrtype(result) == type) {
+		if (result->type == type && result->zone == zone) {
 			return result;
 		}
 		result = result->next;
@@ -541,6 +712,171 @@ domain_find_any_rrset(domain_type* domain, zone_type* zone)
 	return NULL;
 }
 
+/* size of the rdata of the RR in wire format, sets compressed if it has
+ * compressible domain names */
+static size_t
+rr_wire_rdlength(rr_type* rr, int* compressed)
+{
+	size_t rdlength = 0;
+	uint16_t j;
+	for(j = 0; j < rr->rdata_count; j++) {
+		if(rdata_atom_is_domain(rr->type, j)) {
+			if(rdata_atom_wireformat_type(rr->type, j) ==
+				RDATA_WF_COMPRESSED_DNAME) {
+				*compressed = 1;
+				return 0;
+			}
+			rdlength += domain_dname(rdata_atom_domain(
+				rr->rdatas[j]))->name_size;
+		} else {
+			rdlength += rdata_atom_size(rr->rdatas[j]);
+		}
+	}
+	return rdlength;
+}
+
+void
+rrset_wire_build(region_type* region, rrset_type* rrset)
+{
+	size_t size, rdlength;
+	uint32_t* offsets;
+	uint8_t* p;
+	uint16_t i, j;
+	int compressed = 0;
+
+	rrset_wire_free(region, rrset);
+	if(rrset->rr_count == 0)
+		return;
+	size = sizeof(uint32_t) * ((size_t)rrset->rr_count + 1);
+	for(i = 0; i < rrset->rr_count; i++) {
+		rdlength = rr_wire_rdlength(&rrset->rrs[i], &compressed);
+		/* the offsets are 32 bit */
+		if(compressed || rdlength > MAX_RDLENGTH ||
+			size + 10 + rdlength > 0x7fffffff)
+			return;
+		size += 10 + rdlength;
+	}
+
+	rrset->wire = region_alloc(region, size);
+	offsets = (uint32_t*)rrset->wire;
+	p = rrset->wire + sizeof(uint32_t) * ((size_t)rrset->rr_count + 1);
+	for(i = 0; i < rrset->rr_count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		offsets[i] = (uint32_t)(p - rrset->wire);
+		write_uint16(p, rr->type);
+		write_uint16(p + 2, rr->klass);
+		write_uint32(p + 4, rr->ttl);
+		write_uint16(p + 8, (uint16_t)rr_wire_rdlength(rr,
+			&compressed));
+		p += 10;
+		for(j = 0; j < rr->rdata_count; j++) {
+			if(rdata_atom_is_domain(rr->type, j)) {
+				const dname_type* dname = domain_dname(
+					rdata_atom_domain(rr->rdatas[j]));
+				memcpy(p, dname_name(dname), dname->name_size);
+				p += dname->name_size;
+			} else {
+				memcpy(p, rdata_atom_data(rr->rdatas[j]),
+					rdata_atom_size(rr->rdatas[j]));
+				p += rdata_atom_size(rr->rdatas[j]);
+			}
+		}
+	}
+	offsets[rrset->rr_count] = (uint32_t)(p - rrset->wire);
+	assert((size_t)(p - rrset->wire) == size);
+}
+
+void
+rrset_wire_free(region_type* region, rrset_type* rrset)
+{
+	const uint32_t* offsets = (const uint32_t*)rrset->wire;
+	if(!rrset->wire)
+		return;
+	/* the first RR starts after the offsets, that gives the count of
+	 * RRs the blob was made for, and the last offset its size */
+	region_recycle(region, rrset->wire,
+		offsets[offsets[0]/sizeof(uint32_t) - 1]);
+	rrset->wire = NULL;
+}
+
+void
+zone_wire_build(namedb_type* db, zone_type* zone)
+{
+	domain_type* domain;
+	rrset_type* rrset;
+	/* with precompile-wire: no, the answers use the rdata */
+	if(zone->opts && !zone->opts->pattern->precompile_wire)
+		return;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone == zone && !rrset->wire)
+				rrset_wire_build(db->region, rrset);
+		}
+	}
+}
+
+/* memory used by the rrset, its RRs, rdata and precompiled wire format */
+static uint64_t
+rrset_mem_usage(rrset_type* rrset)
+{
+	uint64_t sz = sizeof(rrset_type) + rrset->rr_count*sizeof(rr_type);
+	unsigned i, j;
+	for(i = 0; i < rrset->rr_count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		sz += rr->rdata_count*sizeof(rdata_atom_type);
+		for(j = 0; j < rr->rdata_count; j++) {
+			if(!rdata_atom_is_domain(rr->type, j))
+				sz += sizeof(uint16_t) +
+					rdata_atom_size(rr->rdatas[j]);
+		}
+	}
+	if(rrset->wire)
+		sz += ((const uint32_t*)rrset->wire)[rrset->rr_count];
+	return sz;
+}
+
+void
+zone_mem_usage(zone_type* zone, struct zone_mem_usage* mem)
+{
+	domain_type* domain;
+	domain_type* subzone = NULL;
+	rrset_type* rrset;
+	memset(mem, 0, sizeof(*mem));
+	if(!zone->apex)
+		return;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone == zone) {
+				mem->rrsets += rrset_mem_usage(rrset);
+				mem->num_rrsets++;
+			}
+		}
+		if(subzone && domain_is_subdomain(domain, subzone))
+			continue;
+		if(domain != zone->apex && domain->is_apex) {
+			/* the domains below belong to the other zone */
+			subzone = domain;
+			continue;
+		}
+		mem->domains += sizeof(domain_type) +
+			dname_total_size(domain_dname(domain));
+		mem->num_domains++;
+#ifdef NSEC3
+		if(domain->nsec3) {
+			mem->nsec3 += sizeof(struct nsec3_domain_data);
+			if(domain->nsec3->hash_wc)
+				mem->nsec3 += sizeof(nsec3_hash_wc_node_type);
+			if(domain->nsec3->ds_parent_hash)
+				mem->nsec3 += sizeof(nsec3_hash_node_type);
+		}
+#endif
+	}
+	if(zone->ixfr)
+		mem->ixfr = zone->ixfr->total_size;
+}
+
 zone_type *
 domain_find_zone(namedb_type* db, domain_type* domain)
 {
@@ -651,7 +987,8 @@ rr_rrsig_type_covered(rr_type* rr)
 {
 	assert(rr->type == TYPE_RRSIG);
 	assert(rr->rdata_count > 0);
-	assert(rdata_atom_size(rr->rdatas[0]) == sizeof(uint16_t));
+	/* the rdata is packed in one atom, see rdata_rrsig_unpack */
+	assert(rdata_atom_size(rr->rdatas[0]) >= sizeof(uint16_t));
 
 	return ntohs(* (uint16_t *) rdata_atom_data(rr->rdatas[0]));
 }
@@ -659,8 +996,9 @@ rr_rrsig_type_covered(rr_type* rr)
 zone_type *
 namedb_find_zone(namedb_type* db, const dname_type* dname)
 {
-	struct radnode* n = radname_search(db->zonetree, dname_name(dname),
-		dname->name_size);
+	struct radnode* n = radname_search_labels(db->zonetree,
+		dname_name(dname), dname_label_offsets(dname),
+		dname->label_count);
 	if(n) return (zone_type*)n->elem;
 	return NULL;
 }
@@ -758,3 +1096,160 @@ rr_type *zone_rr_iter_next(struct zone_rr_iter *iter)
 
 	return NULL;
 }
+
+/* an rdata block that is shared by the RRs with the same content */
+struct rdata_shared {
+	rdata_atom_type* rdatas;
+	uint32_t hash;
+	uint32_t refs; /* 0 for an empty slot */
+	uint16_t type;
+	uint16_t rdata_count;
+};
+
+/* the table of shared rdata, open addressing with linear probing */
+struct rdata_dedup {
+	struct rdata_shared* slots;
+	size_t size; /* power of 2 */
+	size_t count;
+};
+
+/* the hash of the rdata content, the pointers of the domain atoms and the
+ * bytes of the other atoms */
+static uint32_t
+rdata_content_hash(uint16_t type, size_t rdata_count, rdata_atom_type* rdatas)
+{
+	uint32_t h = fasthash32(&type, sizeof(type), (uint32_t)rdata_count);
+	size_t i;
+	for(i = 0; i < rdata_count; i++) {
+		if(rdata_atom_is_domain(type, i)) {
+			domain_type* d = rdata_atom_domain(rdatas[i]);
+			h = fasthash32(&d, sizeof(d), h);
+		} else {
+			h = fasthash32(rdatas[i].data,
+				sizeof(uint16_t) + rdata_atom_size(rdatas[i]), h);
+		}
+	}
+	return h;
+}
+
+static int
+rdata_content_equal(uint16_t type, size_t rdata_count,
+	rdata_atom_type* a, rdata_atom_type* b)
+{
+	size_t i;
+	for(i = 0; i < rdata_count; i++) {
+		if(rdata_atom_is_domain(type, i)) {
+			if(rdata_atom_domain(a[i]) != rdata_atom_domain(b[i]))
+				return 0;
+		} else if(rdata_atom_size(a[i]) != rdata_atom_size(b[i]) ||
+			memcmp(rdata_atom_data(a[i]), rdata_atom_data(b[i]),
+			rdata_atom_size(a[i])) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void
+namedb_rdata_dedup_init(namedb_type* db)
+{
+	db->rdata_dedup = region_alloc_zero(db->region,
+		sizeof(*db->rdata_dedup));
+	db->rdata_dedup->size = 1024;
+	db->rdata_dedup->slots = region_alloc_array_zero(db->region,
+		db->rdata_dedup->size, sizeof(struct rdata_shared));
+}
+
+static void
+rdata_dedup_grow(namedb_type* db)
+{
+	struct rdata_dedup* t = db->rdata_dedup;
+	struct rdata_shared* old = t->slots;
+	size_t oldsize = t->size, i, j;
+	t->size *= 2;
+	t->slots = region_alloc_array_zero(db->region, t->size,
+		sizeof(struct rdata_shared));
+	for(i = 0; i < oldsize; i++) {
+		if(!old[i].refs)
+			continue;
+		j = old[i].hash & (t->size-1);
+		while(t->slots[j].refs)
+			j = (j+1) & (t->size-1);
+		t->slots[j] = old[i];
+	}
+	region_recycle(db->region, old, oldsize*sizeof(struct rdata_shared));
+}
+
+rdata_atom_type*
+namedb_rdata_share(namedb_type* db, uint16_t type, size_t rdata_count,
+	rdata_atom_type* rdatas)
+{
+	struct rdata_dedup* t = db->rdata_dedup;
+	uint32_t h;
+	size_t i;
+	if(!t || rdata_count > 0xffff)
+		return rdatas;
+	h = rdata_content_hash(type, rdata_count, rdatas);
+	for(i = h & (t->size-1); t->slots[i].refs; i = (i+1) & (t->size-1)) {
+		struct rdata_shared* s = &t->slots[i];
+		if(s->hash == h && s->type == type &&
+			s->rdata_count == rdata_count &&
+			s->refs < 0xffffffff &&
+			rdata_content_equal(type, rdata_count, s->rdatas,
+			rdatas)) {
+			/* the domains of the rdata have their usage counted
+			 * per RR, only the block itself is shared */
+			region_recycle(db->region, rdatas, rdata_atoms_size(
+				type, rdata_count, rdatas));
+			s->refs++;
+			return s->rdatas;
+		}
+	}
+	t->slots[i].rdatas = rdatas;
+	t->slots[i].hash = h;
+	t->slots[i].refs = 1;
+	t->slots[i].type = type;
+	t->slots[i].rdata_count = (uint16_t)rdata_count;
+	if(++t->count > t->size/4*3)
+		rdata_dedup_grow(db);
+	return rdatas;
+}
+
+void
+namedb_rdata_release(namedb_type* db, uint16_t type, size_t rdata_count,
+	rdata_atom_type* rdatas)
+{
+	struct rdata_dedup* t = db->rdata_dedup;
+	size_t i, j;
+	if(t) {
+		/* the domain atoms may have been deleted already, the hash
+		 * is of their pointers only */
+		uint32_t h = rdata_content_hash(type, rdata_count, rdatas);
+		for(i = h & (t->size-1); t->slots[i].refs;
+			i = (i+1) & (t->size-1)) {
+			if(t->slots[i].rdatas == rdatas)
+				break;
+		}
+		if(t->slots[i].refs) {
+			if(--t->slots[i].refs != 0)
+				return;
+			/* remove the slot, and move the entries after it
+			 * that would not be found across the empty slot */
+			t->slots[i].rdatas = NULL;
+			t->count--;
+			for(j = (i+1) & (t->size-1); t->slots[j].refs;
+				j = (j+1) & (t->size-1)) {
+				size_t k = t->slots[j].hash & (t->size-1);
+				if((j > i && (k <= i || k > j)) ||
+					(j < i && (k <= i && k > j))) {
+					t->slots[i] = t->slots[j];
+					t->slots[j].refs = 0;
+					t->slots[j].rdatas = NULL;
+					i = j;
+				}
+			}
+		}
+	}
+	region_recycle(db->region, rdatas, rdata_atoms_size(type,
+		rdata_count, rdatas));
+}
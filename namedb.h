@@ -16,6 +16,7 @@
 #include "dns.h"
 #include "radtree.h"
 #include "rbtree.h"
+#include "options.h"
 struct zone_options;
 struct nsd_options;
 struct udb_base;
@@ -35,6 +36,14 @@ typedef struct domain domain_type;
 typedef struct zone zone_type;
 typedef struct namedb namedb_type;
 
+#ifdef USE_NAME_HASH
+/* entry in the hash table of domain names, domain is NULL if empty */
+struct namehash_entry {
+	uint32_t hash;
+	domain_type* domain;
+};
+#endif /* USE_NAME_HASH */
+
 struct domain_table
 {
 	region_type* region;
@@ -42,11 +51,21 @@ struct domain_table
 	struct radtree *nametree;
 #else
 	rbtree_type      *names_to_domains;
+#endif
+#ifdef USE_NAME_HASH
+	/* the domains in the tree by name, with linear probing, for exact
+	 * matches; the size is a power of two */
+	struct namehash_entry* namehash;
+	size_t namehash_size, namehash_count;
 #endif
 	domain_type* root;
 	/* ptr to biggest domain.number and last in list.
 	 * the root is the lowest and first in the list. */
 	domain_type *numlist_last;
+	/* the domain of the last insert, names that are inserted in order,
+	 * like the RRs of a transfer or a zonefile, are found next to it
+	 * without a search of the tree. NULL if it is deleted */
+	domain_type *last_insert;
 #ifdef NSEC3
 	/* the prehash list, start of the list */
 	domain_type* prehash_list;
@@ -93,6 +112,12 @@ struct nsec3_domain_data {
 } ATTR_PACKED;
 #endif /* NSEC3 */
 
+/*
+ * The fields used to answer queries come first, the pointers and then
+ * the 32bit fields, so that they are aligned without padding, and are
+ * together in the first cache line. The fields only used when the
+ * database is changed come last.
+ */
 struct domain
 {
 #ifdef USE_RADIX_TREE
@@ -102,23 +127,24 @@ struct domain
 	rbnode_type     node;
 #endif
 	domain_type* parent;
-	domain_type* wildcard_child_closest_match;
 	rrset_type* rrsets;
+	domain_type* wildcard_child_closest_match;
 #ifdef NSEC3
 	struct nsec3_domain_data* nsec3;
 #endif
-	/* double-linked list sorted by domain.number */
-	domain_type* numlist_prev, *numlist_next;
 	uint32_t     number; /* Unique domain name number.  */
-	uint32_t     usage; /* number of ptrs to this from RRs(in rdata) and
-			     from zone-apex pointers, also the root has one
-			     more to make sure it cannot be deleted. */
 
 	/*
 	 * This domain name exists (see wildcard clarification draft).
 	 */
 	unsigned     is_existing : 1;
 	unsigned     is_apex : 1;
+
+	/* double-linked list sorted by domain.number */
+	domain_type* numlist_prev, *numlist_next;
+	uint32_t     usage; /* number of ptrs to this from RRs(in rdata) and
+			     from zone-apex pointers, also the root has one
+			     more to make sure it cannot be deleted. */
 } ATTR_PACKED;
 
 struct zone
@@ -147,7 +173,16 @@ struct zone
 	} includes;
 	char*        logstr; /* set for zone xfer, the log string */
 	struct timespec mtime; /* time of last modification */
+	/* hash of the content of the zonefile and includes that the zone
+	 * was read from, for zonefiles-hash, or 0 */
+	uint64_t     content_hash;
 	unsigned     zonestatid; /* array index for zone stats */
+	/* next in the list of zones updated by this reload */
+	struct zone* updated_next;
+#ifdef RATELIMIT
+	/* ratelimit per rrl type, in 2x qps, from the zone options */
+	uint32_t     rrl_limit[RRL_TYPES];
+#endif
 	unsigned     is_secure : 1; /* zone uses DNSSEC */
 	unsigned     is_ok : 1; /* zone has not expired */
 	unsigned     is_changed : 1; /* zone changes must be written to disk */
@@ -176,7 +211,12 @@ struct rrset
 	rrset_type* next;
 	zone_type*  zone;
 	rr_type*    rrs;
+	/* precompiled wire format of the RRs, or NULL, see rrset_wire_build */
+	uint8_t*    wire;
 	uint16_t    rr_count;
+	/* the type of the RRs, next to the list pointer, so a search
+	 * through the rrsets of a domain does not touch the RRs */
+	uint16_t    type;
 } ATTR_PACKED;
 
 /*
@@ -257,6 +297,39 @@ void domain_add_rrset(domain_type* domain, rrset_type* rrset);
 rrset_type* domain_find_rrset(domain_type* domain, zone_type* zone, uint16_t type);
 rrset_type* domain_find_any_rrset(domain_type* domain, zone_type* zone);
 
+/*
+ * Build the wire format of the RRs of the rrset, if the rdata has no
+ * compressible domain names, so that the RRs can be copied into answers
+ * after the owner name.  It starts with rr_count+1 offsets (uint32_t, from
+ * the start of the blob), of the RRs and of the end, followed per RR by the
+ * type, class, ttl, rdlength and rdata.  Must be called again (or the blob
+ * freed) when the RRs of the rrset change.
+ */
+void rrset_wire_build(region_type* region, rrset_type* rrset);
+/* free the precompiled wire format of the rrset, if any */
+void rrset_wire_free(region_type* region, rrset_type* rrset);
+/* build the wire format for the rrsets of the zone that do not have it,
+ * unless precompile-wire is off for the zone */
+void zone_wire_build(namedb_type* db, zone_type* zone);
+
+/* memory used by a zone, in bytes, and the number of domains and rrsets */
+struct zone_mem_usage {
+	/* domain nodes and their names */
+	uint64_t domains;
+	/* rrsets, their RRs and rdata, and the precompiled wire format */
+	uint64_t rrsets;
+	/* NSEC3 data and precompiled hashes of the domains */
+	uint64_t nsec3;
+	/* IXFR history kept for the zone */
+	uint64_t ixfr;
+	uint64_t num_domains;
+	uint64_t num_rrsets;
+};
+/* count the memory used by the zone. Domains below the apex of another
+ * zone are not counted, the rrsets of the zone there (glue, the NS of the
+ * delegation) are. */
+void zone_mem_usage(zone_type* zone, struct zone_mem_usage* mem);
+
 zone_type* domain_find_zone(namedb_type* db, domain_type* domain);
 zone_type* domain_find_parent_zone(namedb_type* db, zone_type* zone);
 
@@ -338,11 +411,17 @@ struct namedb
 	region_type*       region;
 	domain_table_type* domains;
 	struct radtree*    zonetree;
+	/* the zones that were updated or skipped by the transfers of
+	 * this reload, in the order of the transfers, so that the reload
+	 * does not walk every zone to find them */
+	struct zone*       updated_first, *updated_last;
 	/* the timestamp on the ixfr.db file */
 	struct timeval	  diff_timestamp;
 	/* if diff_skip=1, diff_pos contains the nsd.diff place to continue */
 	uint8_t		  diff_skip;
 	off_t		  diff_pos;
+	/* the rdata that is shared between RRs, with rdata-dedup, or NULL */
+	struct rdata_dedup* rdata_dedup;
 };
 
 static inline int rdata_atom_is_domain(uint16_t type, size_t index);
@@ -376,6 +455,11 @@ zone_type *namedb_find_zone(namedb_type *db, const dname_type *dname);
  * wcard_child closest match.
  */
 void domain_table_deldomain(namedb_type* db, domain_type* domain);
+#ifdef USE_NAME_HASH
+/* remove the domain from the hash table of names, when it is removed
+ * from the tree of names */
+void domain_table_namehash_del(domain_table_type* table, domain_type* domain);
+#endif
 
 /** dbcreate.c */
 int print_rrs(FILE* out, struct zone* zone);
@@ -388,6 +472,20 @@ int namedb_lookup (struct namedb* db,
 		   domain_type     **closest_encloser);
 /* pass number of children (to alloc in dirty array */
 struct namedb *namedb_open(struct nsd_options* opt);
+/* copy the zones of the database into a new one, in memory that is
+ * allocated in order, without the holes of the changes. The IXFR data
+ * of the zones moves to the copy. */
+struct namedb *namedb_copy(struct namedb* from, struct nsd_options* opt);
+/* start to share the rdata of RRs with the same content, for rdata-dedup */
+void namedb_rdata_dedup_init(namedb_type* db);
+/* the rdata to store for a new RR. With rdata-dedup, if another RR has
+ * the same rdata, the new block is recycled and the shared one is
+ * returned. The domains in the rdata keep their usage per RR. */
+rdata_atom_type* namedb_rdata_share(namedb_type* db, uint16_t type,
+	size_t rdata_count, rdata_atom_type* rdatas);
+/* recycle the rdata of a deleted RR, when no other RR shares it */
+void namedb_rdata_release(namedb_type* db, uint16_t type,
+	size_t rdata_count, rdata_atom_type* rdatas);
 void namedb_close(struct namedb* db);
 /* free ixfr data stored for zones */
 void namedb_free_ixfr(struct namedb* db);
@@ -407,6 +505,8 @@ namedb_find_or_create_zone(namedb_type *db, const dname_type *dname,
   return zone ? zone : namedb_zone_create(db, dname, zopt); }
 void namedb_zone_free_filenames(namedb_type* db, zone_type* zone);
 void namedb_zone_delete(namedb_type* db, zone_type* zone);
+/* add the zone to the updated list, before it is marked updated or skipped */
+void namedb_zone_add_updated(namedb_type* db, zone_type* zone);
 void namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt);
 void namedb_write_zonefiles(struct nsd* nsd, struct nsd_options* options);
 int create_dirs(const char* path);
@@ -446,7 +546,34 @@ rrset_rrtype(rrset_type* rrset)
 {
 	assert(rrset);
 	assert(rrset->rr_count > 0);
-	return rrset->rrs[0].type;
+	assert(rrset->type == rrset->rrs[0].type);
+	return rrset->type;
+}
+
+/* the precompiled wire format of RR i of the rrset, and its length */
+static inline const uint8_t*
+rrset_wire_rr(rrset_type* rrset, uint16_t i, size_t* len)
+{
+	const uint32_t* offsets = (const uint32_t*)rrset->wire;
+	assert(rrset->wire && i < rrset->rr_count);
+	*len = offsets[i+1] - offsets[i];
+	return rrset->wire + offsets[i];
+}
+
+/*
+ * The least size of the RRs of the rrset in an answer, when every owner
+ * name is compressed, from the precompiled wire format. The rrset must
+ * have the wire format.
+ */
+static inline size_t
+rrset_wire_min_size(rrset_type* rrset, domain_type* owner)
+{
+	const uint32_t* offsets = (const uint32_t*)rrset->wire;
+	/* a compression pointer, or the root label */
+	size_t ownerlen = (domain_dname(owner)->name_size < 2 ? 1 : 2);
+	assert(rrset->wire);
+	return offsets[rrset->rr_count] - offsets[0] +
+		ownerlen * rrset->rr_count;
 }
 
 static inline uint16_t
@@ -353,12 +353,18 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		ZONE_GET_INT(size_limit_xfr, o, zone->pattern);
 #ifdef RATELIMIT
 		ZONE_GET_RRL(rrl_whitelist, o, zone->pattern);
+		ZONE_GET_INT(rrl_ratelimit, o, zone->pattern);
 #endif
 		ZONE_GET_BIN(multi_primary_check, o, zone->pattern);
 		ZONE_GET_BIN(store_ixfr, o, zone->pattern);
 		ZONE_GET_INT(ixfr_size, o, zone->pattern);
 		ZONE_GET_INT(ixfr_number, o, zone->pattern);
 		ZONE_GET_BIN(create_ixfr, o, zone->pattern);
+		ZONE_GET_BIN(ixfr_binary, o, zone->pattern);
+		ZONE_GET_BIN(ixfr_compress, o, zone->pattern);
+		ZONE_GET_BIN(ixfr_condense, o, zone->pattern);
+		ZONE_GET_BIN(precompile_wire, o, zone->pattern);
+		ZONE_GET_INT(transfer_priority, o, zone->pattern);
 		printf("Zone option not handled: %s %s\n", z, o);
 		exit(1);
 	} else if(pat) {
@@ -390,12 +396,18 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		ZONE_GET_INT(size_limit_xfr, o, p);
 #ifdef RATELIMIT
 		ZONE_GET_RRL(rrl_whitelist, o, p);
+		ZONE_GET_INT(rrl_ratelimit, o, p);
 #endif
 		ZONE_GET_BIN(multi_primary_check, o, p);
 		ZONE_GET_BIN(store_ixfr, o, p);
 		ZONE_GET_INT(ixfr_size, o, p);
 		ZONE_GET_INT(ixfr_number, o, p);
 		ZONE_GET_BIN(create_ixfr, o, p);
+		ZONE_GET_BIN(ixfr_binary, o, p);
+		ZONE_GET_BIN(ixfr_compress, o, p);
+		ZONE_GET_BIN(ixfr_condense, o, p);
+		ZONE_GET_BIN(precompile_wire, o, p);
+		ZONE_GET_INT(transfer_priority, o, p);
 		printf("Pattern option not handled: %s %s\n", pat, o);
 		exit(1);
 	} else {
@@ -408,18 +420,42 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_BIN(do_ip4, o);
 		SERV_GET_BIN(do_ip6, o);
 		SERV_GET_BIN(reuseport, o);
+		SERV_GET_STR(reuseport_steering, o);
+		SERV_GET_BIN(udp_gso, o);
+		SERV_GET_INT(busy_poll, o);
+		SERV_GET_INT(busy_poll_idle, o);
+		SERV_GET_INT(udp_batch_latency, o);
+		SERV_GET_BIN(udp_drain, o);
+		SERV_GET_BIN(udp_shed, o);
+		SERV_GET_BIN(udp_shed_drop, o);
 		SERV_GET_BIN(hide_version, o);
 		SERV_GET_BIN(hide_identity, o);
 		SERV_GET_BIN(drop_updates, o);
 		SERV_GET_BIN(reload_config, o);
 		SERV_GET_BIN(zonefiles_check, o);
+		SERV_GET_BIN(zonefiles_hash, o);
+		SERV_GET_BIN(rdata_dedup, o);
+		SERV_GET_INT(reload_compact, o);
 		SERV_GET_BIN(log_time_ascii, o);
 		SERV_GET_BIN(log_time_iso, o);
 		SERV_GET_BIN(round_robin, o);
 		SERV_GET_BIN(minimal_responses, o);
 		SERV_GET_BIN(confine_to_zone, o);
 		SERV_GET_BIN(refuse_any, o);
+		SERV_GET_BIN(latency_statistics, o);
+		SERV_GET_INT(query_trace, o);
+		SERV_GET_INT(query_trace_min, o);
+		SERV_GET_BIN(udp_queue_statistics, o);
+		SERV_GET_BIN(top_statistics, o);
+		SERV_GET_BIN(metrics_enable, o);
+		SERV_GET_STR(metrics_interface, o);
+		SERV_GET_INT(metrics_port, o);
+		SERV_GET_BIN(reload_prewarm, o);
+		SERV_GET_STR(memory_lock, o);
+		SERV_GET_STR(socket_handoff, o);
 		SERV_GET_BIN(tcp_reject_overflow, o);
+		SERV_GET_BIN(tcp_evict_idle, o);
+		SERV_GET_INT(tcp_source_limit, o);
 		SERV_GET_BIN(log_only_syslog, o);
 		/* str */
 		SERV_GET_STR(identity, o);
@@ -428,6 +464,9 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_PATH(final, logfile, o);
 		SERV_GET_PATH(final, pidfile, o);
 		SERV_GET_STR(chroot, o);
+		SERV_GET_STR(xdp_interface, o);
+		SERV_GET_STR(xdp_program_path, o);
+		SERV_GET_INT(xdp_ratelimit, o);
 		SERV_GET_STR(username, o);
 		SERV_GET_PATH(final, zonesdir, o);
 		SERV_GET_PATH(final, xfrdfile, o);
@@ -439,23 +478,47 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_STR(tls_service_pem, o);
 		SERV_GET_STR(tls_port, o);
 		SERV_GET_STR(tls_cert_bundle, o);
+		SERV_GET_INT(tls_session_ticket_rotate, o);
+		SERV_GET_BIN(tls_ktls, o);
+		SERV_GET_BIN(tls_async, o);
 		SERV_GET_STR(cookie_secret, o);
 		SERV_GET_STR(cookie_staging_secret, o);
 		SERV_GET_STR(cookie_secret_file, o);
 		SERV_GET_BIN(answer_cookie, o);
 		/* int */
 		SERV_GET_INT(server_count, o);
+		SERV_GET_INT(server_count_min, o);
+		SERV_GET_INT(server_count_load, o);
+		SERV_GET_BIN(cpu_affinity_auto, o);
+		SERV_GET_INT(response_cache_size, o);
+		SERV_GET_INT(axfr_cache_size, o);
+		SERV_GET_INT(xfr_out_limit, o);
+		SERV_GET_INT(xfr_out_zone_limit, o);
+		SERV_GET_INT(xfr_out_client_limit, o);
+		SERV_GET_INT(xfr_out_rate, o);
+		SERV_GET_BIN(use_huge_pages, o);
+		SERV_GET_BIN(numa_interleave, o);
 		SERV_GET_INT(tcp_count, o);
 		SERV_GET_INT(tcp_query_count, o);
+		SERV_GET_BIN(tcp_pipeline, o);
+		SERV_GET_INT(tcp_zerocopy, o);
 		SERV_GET_INT(tcp_timeout, o);
 		SERV_GET_INT(tcp_mss, o);
 		SERV_GET_INT(outgoing_tcp_mss, o);
 		SERV_GET_INT(xfrd_tcp_max, o);
 		SERV_GET_INT(xfrd_tcp_pipeline, o);
+		SERV_GET_INT(xfrd_udp_sockets, o);
+		SERV_GET_INT(xfrd_tcp_per_primary, o);
+		SERV_GET_INT(xfrd_tcp_idle, o);
+		SERV_GET_INT(notify_coalesce_time, o);
+		SERV_GET_INT(xfrd_state_journal, o);
+		SERV_GET_BIN(xfrd_xfr_shm, o);
+		SERV_GET_BIN(xfrd_xfr_compress, o);
 		SERV_GET_INT(ipv4_edns_size, o);
 		SERV_GET_INT(ipv6_edns_size, o);
 		SERV_GET_INT(statistics, o);
 		SERV_GET_INT(xfrd_reload_timeout, o);
+		SERV_GET_INT(catalog_producer_batch, o);
 		SERV_GET_INT(verbosity, o);
 		SERV_GET_INT(send_buffer_size, o);
 		SERV_GET_INT(receive_buffer_size, o);
@@ -465,6 +528,7 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(rrl_slip, o);
 		SERV_GET_INT(rrl_ipv4_prefix_length, o);
 		SERV_GET_INT(rrl_ipv6_prefix_length, o);
+		SERV_GET_BIN(rrl_shared_buckets, o);
 		SERV_GET_INT(rrl_whitelist_ratelimit, o);
 #endif
 #ifdef USE_DNSTAP
@@ -482,8 +546,12 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_STR(dnstap_version, o);
 		SERV_GET_BIN(dnstap_log_auth_query_messages, o);
 		SERV_GET_BIN(dnstap_log_auth_response_messages, o);
+		SERV_GET_INT(dnstap_sample_rate, o);
 #endif
 		SERV_GET_INT(zonefiles_write, o);
+		SERV_GET_INT(zonefiles_write_workers, o);
+		SERV_GET_BIN(zonefiles_sync, o);
+		SERV_GET_INT(ixfr_memory_budget, o);
 		/* remote control */
 		SERV_GET_BIN(control_enable, o);
 		SERV_GET_IP(control_interface, control_interface, o);
@@ -519,10 +587,20 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 /* print zone content items */
 static void print_zone_content_elems(pattern_options_type* pat)
 {
+#ifdef RATELIMIT
+	int i;
+#endif
 	if(pat->zonefile)
 		print_string_var("zonefile:", pat->zonefile);
 #ifdef RATELIMIT
 	zone_print_rrl_whitelist("\trrl-whitelist: ", pat->rrl_whitelist);
+	if(!pat->rrl_ratelimit_is_default)
+		printf("\trrl-ratelimit: %d\n", (int)pat->rrl_ratelimit);
+	for(i=0; i<RRL_TYPES; i++) {
+		if((pat->rrl_type_limits & (1<<i)))
+			printf("\trrl-type-ratelimit: %s %d\n",
+				rrltype2str(1<<i), (int)pat->rrl_type_ratelimit[i]);
+	}
 #endif
 	print_acl("allow_query:", pat->allow_query);
 	print_acl("allow-notify:", pat->allow_notify);
@@ -562,6 +640,16 @@ static void print_zone_content_elems(pattern_options_type* pat)
 		printf("\tixfr-size: %u\n", (unsigned)pat->ixfr_size);
 	if(!pat->create_ixfr_is_default)
 		printf("\tcreate-ixfr: %s\n", pat->create_ixfr?"yes":"no");
+	if(!pat->ixfr_binary_is_default)
+		printf("\tixfr-binary: %s\n", pat->ixfr_binary?"yes":"no");
+	if(!pat->ixfr_compress_is_default)
+		printf("\tixfr-compress: %s\n", pat->ixfr_compress?"yes":"no");
+	if(!pat->ixfr_condense_is_default)
+		printf("\tixfr-condense: %s\n", pat->ixfr_condense?"yes":"no");
+	if(!pat->precompile_wire_is_default)
+		printf("\tprecompile-wire: %s\n", pat->precompile_wire?"yes":"no");
+	if(!pat->transfer_priority_is_default)
+		printf("\ttransfer-priority: %u\n", (unsigned)pat->transfer_priority);
 	if(pat->verify_zone != VERIFY_ZONE_INHERIT) {
 		printf("\tverify-zone: ");
 		if(pat->verify_zone) {
@@ -600,6 +688,10 @@ static void print_zone_content_elems(pattern_options_type* pat)
 
 	if(pat->catalog_member_pattern)
 		print_string_var("catalog-member-pattern:", pat->catalog_member_pattern);
+	if(pat->catalog_member_shards)
+		printf("\tcatalog-member-shard: %u/%u\n",
+			(unsigned)pat->catalog_member_shard,
+			(unsigned)pat->catalog_member_shards);
 	if(pat->catalog_producer_zone)
 		print_string_var("catalog-producer-zone:", pat->catalog_producer_zone);
 }
@@ -612,6 +704,9 @@ config_test_print_server(nsd_options_type* opt)
 	tls_auth_options_type* tlsauth;
 	zone_options_type* zone;
 	pattern_options_type* pat;
+#ifdef USE_DNSTAP
+	struct dnstap_filter* dtf;
+#endif
 
 	printf("# Config settings.\n");
 	printf("server:\n");
@@ -619,6 +714,16 @@ config_test_print_server(nsd_options_type* opt)
 	printf("\tip-transparent: %s\n", opt->ip_transparent?"yes":"no");
 	printf("\tip-freebind: %s\n", opt->ip_freebind?"yes":"no");
 	printf("\treuseport: %s\n", opt->reuseport?"yes":"no");
+	print_string_var("reuseport-steering:", opt->reuseport_steering);
+	printf("\tudp-gso: %s\n", opt->udp_gso?"yes":"no");
+	printf("\tbusy-poll: %d\n", opt->busy_poll);
+	printf("\tbusy-poll-idle: %d\n", opt->busy_poll_idle);
+	printf("\tudp-batch-latency: %d\n", opt->udp_batch_latency);
+	printf("\tudp-drain: %s\n", opt->udp_drain?"yes":"no");
+	printf("\tudp-shed: %s\n", opt->udp_shed?"yes":"no");
+	printf("\tudp-shed-drop: %s\n", opt->udp_shed_drop?"yes":"no");
+	print_acl_ips("udp-shed-allow:", opt->udp_shed_allow);
+	printf("\txdp-ratelimit: %d\n", opt->xdp_ratelimit);
 	printf("\tdo-ip4: %s\n", opt->do_ip4?"yes":"no");
 	printf("\tdo-ip6: %s\n", opt->do_ip6?"yes":"no");
 	printf("\tsend-buffer-size: %d\n", opt->send_buffer_size);
@@ -628,12 +733,16 @@ config_test_print_server(nsd_options_type* opt)
 	printf("\tdrop-updates: %s\n", opt->drop_updates?"yes":"no");
 	printf("\ttcp-reject-overflow: %s\n",
 		opt->tcp_reject_overflow ? "yes" : "no");
+	printf("\ttcp-evict-idle: %s\n", opt->tcp_evict_idle?"yes":"no");
+	printf("\ttcp-source-limit: %d\n", opt->tcp_source_limit);
 	print_string_var("identity:", opt->identity);
 	print_string_var("version:", opt->version);
 	print_string_var("nsid:", opt->nsid);
 	print_string_var("logfile:", opt->logfile);
 	printf("\tlog-only-syslog: %s\n", opt->log_only_syslog?"yes":"no");
 	printf("\tserver-count: %d\n", opt->server_count);
+	printf("\tserver-count-min: %d\n", opt->server_count_min);
+	printf("\tserver-count-load: %d\n", opt->server_count_load);
 	if(opt->cpu_affinity) {
 		cpu_option_type *n;
 		printf("\tcpu-affinity:");
@@ -654,13 +763,23 @@ config_test_print_server(nsd_options_type* opt)
 			}
 		}
 	}
+	printf("\tcpu-affinity-auto: %s\n", opt->cpu_affinity_auto?"yes":"no");
 	printf("\ttcp-count: %d\n", opt->tcp_count);
 	printf("\ttcp-query-count: %d\n", opt->tcp_query_count);
+	printf("\ttcp-pipeline: %s\n", opt->tcp_pipeline?"yes":"no");
+	printf("\ttcp-zerocopy: %d\n", opt->tcp_zerocopy);
 	printf("\ttcp-timeout: %d\n", opt->tcp_timeout);
 	printf("\ttcp-mss: %d\n", opt->tcp_mss);
 	printf("\toutgoing-tcp-mss: %d\n", opt->outgoing_tcp_mss);
 	printf("\txfrd-tcp-max: %d\n", opt->xfrd_tcp_max);
 	printf("\txfrd-tcp-pipeline: %d\n", opt->xfrd_tcp_pipeline);
+	printf("\txfrd-udp-sockets: %d\n", opt->xfrd_udp_sockets);
+	printf("\txfrd-tcp-per-primary: %d\n", opt->xfrd_tcp_per_primary);
+	printf("\txfrd-tcp-idle: %d\n", opt->xfrd_tcp_idle);
+	printf("\tnotify-coalesce-time: %d\n", opt->notify_coalesce_time);
+	printf("\txfrd-state-journal: %d\n", opt->xfrd_state_journal);
+	printf("\txfrd-xfr-shm: %s\n", opt->xfrd_xfr_shm?"yes":"no");
+	printf("\txfrd-xfr-compress: %s\n", opt->xfrd_xfr_compress?"yes":"no");
 	printf("\tipv4-edns-size: %d\n", (int) opt->ipv4_edns_size);
 	printf("\tipv6-edns-size: %d\n", (int) opt->ipv6_edns_size);
 	print_string_var("pidfile:", opt->pidfile);
@@ -673,10 +792,32 @@ config_test_print_server(nsd_options_type* opt)
 	print_string_var("zonelistfile:", opt->zonelistfile);
 	print_string_var("xfrdir:", opt->xfrdir);
 	printf("\txfrd-reload-timeout: %d\n", opt->xfrd_reload_timeout);
+	printf("\tcatalog-producer-batch: %d\n", opt->catalog_producer_batch);
 	printf("\tlog-time-ascii: %s\n", opt->log_time_ascii?"yes":"no");
 	printf("\tlog-time-iso: %s\n", opt->log_time_iso?"yes":"no");
 	printf("\tround-robin: %s\n", opt->round_robin?"yes":"no");
 	printf("\tminimal-responses: %s\n", opt->minimal_responses?"yes":"no");
+	printf("\tresponse-cache-size: %d\n", opt->response_cache_size);
+	printf("\taxfr-cache-size: %d\n", (int)opt->axfr_cache_size);
+	printf("\txfr-out-limit: %d\n", opt->xfr_out_limit);
+	printf("\txfr-out-zone-limit: %d\n", opt->xfr_out_zone_limit);
+	printf("\txfr-out-client-limit: %d\n", opt->xfr_out_client_limit);
+	printf("\txfr-out-rate: %llu\n", (unsigned long long)opt->xfr_out_rate);
+	printf("\tuse-huge-pages: %s\n", opt->use_huge_pages?"yes":"no");
+	printf("\tnuma-interleave: %s\n", opt->numa_interleave?"yes":"no");
+	printf("\tlatency-statistics: %s\n",
+		opt->latency_statistics?"yes":"no");
+	printf("\tquery-trace: %d\n", opt->query_trace);
+	printf("\tquery-trace-min: %d\n", opt->query_trace_min);
+	printf("\tudp-queue-statistics: %s\n",
+		opt->udp_queue_statistics?"yes":"no");
+	printf("\ttop-statistics: %s\n", opt->top_statistics?"yes":"no");
+	printf("\tmetrics-enable: %s\n", opt->metrics_enable?"yes":"no");
+	print_string_var("metrics-interface:", opt->metrics_interface);
+	printf("\tmetrics-port: %d\n", opt->metrics_port);
+	printf("\treload-prewarm: %s\n", opt->reload_prewarm?"yes":"no");
+	print_string_var("memory-lock:", opt->memory_lock);
+	print_string_var("socket-handoff:", opt->socket_handoff);
 	printf("\tconfine-to-zone: %s\n",
 		opt->confine_to_zone ? "yes" : "no");
 	printf("\trefuse-any: %s\n", opt->refuse_any?"yes":"no");
@@ -700,6 +841,9 @@ config_test_print_server(nsd_options_type* opt)
 		if(ip->fib != -1) {
 			printf(" setfib=%d", ip->fib);
 		}
+		if(ip->io_uring) {
+			printf(" io-uring=yes");
+		}
 		printf("\n");
 	}
 #ifdef RATELIMIT
@@ -708,16 +852,27 @@ config_test_print_server(nsd_options_type* opt)
 	printf("\trrl-slip: %d\n", (int)opt->rrl_slip);
 	printf("\trrl-ipv4-prefix-length: %d\n", (int)opt->rrl_ipv4_prefix_length);
 	printf("\trrl-ipv6-prefix-length: %d\n", (int)opt->rrl_ipv6_prefix_length);
+	printf("\trrl-shared-buckets: %s\n", opt->rrl_shared_buckets?"yes":"no");
 	printf("\trrl-whitelist-ratelimit: %d\n", (int)opt->rrl_whitelist_ratelimit);
 #endif
 	printf("\treload-config: %s\n", opt->reload_config?"yes":"no");
 	printf("\tzonefiles-check: %s\n", opt->zonefiles_check?"yes":"no");
+	printf("\tzonefiles-hash: %s\n", opt->zonefiles_hash?"yes":"no");
+	printf("\trdata-dedup: %s\n", opt->rdata_dedup?"yes":"no");
+	printf("\treload-compact: %d\n", opt->reload_compact);
 	printf("\tzonefiles-write: %d\n", opt->zonefiles_write);
+	printf("\tzonefiles-write-workers: %d\n", opt->zonefiles_write_workers);
+	printf("\tzonefiles-sync: %s\n", opt->zonefiles_sync?"yes":"no");
+	printf("\tixfr-memory-budget: %llu\n",
+		(unsigned long long)opt->ixfr_memory_budget);
 	print_string_var("tls-service-key:", opt->tls_service_key);
 	print_string_var("tls-service-pem:", opt->tls_service_pem);
 	print_string_var("tls-service-ocsp:", opt->tls_service_ocsp);
 	print_string_var("tls-port:", opt->tls_port);
 	print_string_var("tls-cert-bundle:", opt->tls_cert_bundle);
+	printf("\ttls-session-ticket-rotate: %d\n", opt->tls_session_ticket_rotate);
+	printf("\ttls-ktls: %s\n", opt->tls_ktls?"yes":"no");
+	printf("\ttls-async: %s\n", opt->tls_async?"yes":"no");
 	printf("\tanswer-cookie: %s\n", opt->answer_cookie?"yes":"no");
 	print_string_var("cookie-secret:", opt->cookie_secret);
 	print_string_var("cookie-staging-secret:", opt->cookie_staging_secret);
@@ -750,6 +905,9 @@ config_test_print_server(nsd_options_type* opt)
 	print_string_var("dnstap-version:", opt->dnstap_version);
 	printf("\tdnstap-log-auth-query-messages: %s\n", opt->dnstap_log_auth_query_messages?"yes":"no");
 	printf("\tdnstap-log-auth-response-messages: %s\n", opt->dnstap_log_auth_response_messages?"yes":"no");
+	printf("\tdnstap-sample-rate: %d\n", opt->dnstap_sample_rate);
+	for(dtf = opt->dnstap_filters; dtf; dtf = dtf->next)
+		print_string_var("dnstap-filter:", dtf->spec);
 #endif
 
 	printf("\nremote-control:\n");
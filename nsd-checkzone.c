@@ -16,6 +16,16 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif /* HAVE_MMAP */
 
 #include "nsd.h"
 #include "options.h"
@@ -27,6 +37,15 @@
 
 struct nsd nsd;
 
+/* the result of the check of a zone, in shared memory with the workers */
+struct check_result {
+	/* set when the zone has been checked */
+	int done;
+	int ok;
+	uint64_t records;
+	double seconds;
+};
+
 /*
  * Print the help text.
  *
@@ -34,8 +53,11 @@ struct nsd nsd;
 static void
 usage (void)
 {
-	fprintf(stderr, "Usage: nsd-checkzone [-p] <zone name> <zone file>\n");
+	fprintf(stderr, "Usage: nsd-checkzone [-p] <zone name> <zone file> "
+		"[<zone name> <zone file> ...]\n");
 	fprintf(stderr, "\t-p\tprint the zone if the zone is ok\n");
+	fprintf(stderr, "\t-j <num>\tcheck the zones with num processes in parallel.\n");
+	fprintf(stderr, "\t-b\tprint the time, MB/s and records/s of reading the zones.\n");
 	fprintf(stderr, "\t-i <old zone file>\tcreate an IXFR from the differences between the\n\t\told zone file and the new zone file. Writes to \n\t\t<zonefile>.ixfr and renames other <zonefile>.ixfr files to\n\t\t<zonefile>.ixfr.num+1.\n");
 	fprintf(stderr, "\t-n <ixfr number>\tnumber of IXFR versions to store, at most.\n\t\tdefault %d.\n", (int)IXFR_NUMBER_DEFAULT);
 	fprintf(stderr, "\t-s <ixfr size>\tsize of IXFR to store, at most. default %d.\n", (int)IXFR_SIZE_DEFAULT);
@@ -43,15 +65,67 @@ usage (void)
 		PACKAGE_VERSION, PACKAGE_BUGREPORT);
 }
 
+/* the number of records of the zone */
+static uint64_t
+count_records(zone_type* zone)
+{
+	domain_type* domain = zone->apex;
+	rrset_type* rrset;
+	uint64_t num = 0;
+	while(domain && domain_is_subdomain(domain, zone->apex)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone == zone)
+				num += rrset->rr_count;
+		}
+		domain = domain_next(domain);
+	}
+	return num;
+}
+
+static double
+time_now(void)
+{
+	struct timeval tv;
+	if(gettimeofday(&tv, NULL) == -1)
+		return 0;
+	return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/* the size of the zone file, without the included files */
+static uint64_t
+file_size(const char* fname)
+{
+	struct stat st;
+	if(strcmp(fname, "-") == 0 || stat(fname, &st) == -1)
+		return 0;
+	return (uint64_t)st.st_size;
+}
+
 static void
+print_bench(const char* name, uint64_t bytes, uint64_t records,
+	double seconds)
+{
+	if(seconds <= 0)
+		seconds = 0.000001;
+	printf("zone %s read %llu bytes, %llu records in %.3f seconds, "
+		"%.1f MB/s, %.0f records/s\n", name,
+		(unsigned long long)bytes, (unsigned long long)records,
+		seconds, (double)bytes/seconds/1000000.0,
+		(double)records/seconds);
+}
+
+/* check the zone, returns true if it is ok */
+static int
 check_zone(struct nsd* nsd, const char* name, const char* fname, FILE *out,
-	const char* oldzone, uint32_t ixfr_number, uint64_t ixfr_size)
+	const char* oldzone, uint32_t ixfr_number, uint64_t ixfr_size,
+	struct check_result* result)
 {
 	const dname_type* dname;
 	zone_options_type* zo;
 	zone_type* zone;
 	unsigned errors;
 	struct ixfr_create* ixfrcr = NULL;
+	double start;
 
 	/* init*/
 	nsd->db = namedb_open(nsd->options);
@@ -80,16 +154,17 @@ check_zone(struct nsd* nsd, const char* name, const char* fname, FILE *out,
 	}
 
 	/* read the zone */
+	start = time_now();
 	errors = zonec_read(nsd->db, nsd->db->domains, name, fname, zone);
+	result->seconds = time_now() - start;
 	if(errors > 0) {
 		printf("zone %s file %s has %u errors\n", name, fname, errors);
 		ixfr_create_cancel(ixfrcr);
-#ifdef MEMCLEAN /* otherwise, the OS collects memory pages */
 		namedb_close(nsd->db);
-		region_destroy(nsd->options->region);
-#endif
-		exit(1);
+		result->done = 1;
+		return 0;
 	}
+	result->records = count_records(zone);
 	if(ixfrcr) {
 		if(!ixfr_create_perform(ixfrcr, zone, 0, nsd, fname,
 			ixfr_number)) {
@@ -109,6 +184,64 @@ check_zone(struct nsd* nsd, const char* name, const char* fname, FILE *out,
 	}
 	printf("zone %s is ok\n", name);
 	namedb_close(nsd->db);
+	result->ok = 1;
+	result->done = 1;
+	return 1;
+}
+
+/* check the zones, in argv as name and file pairs, num is the
+ * number of zones. Zone i is checked by worker i%workers, in a
+ * forked process, returns the number of zones that are not ok. */
+static size_t
+check_zones_parallel(struct nsd* nsd, char* argv[], size_t num,
+	FILE* out, struct check_result* results, size_t workers)
+{
+	size_t i, w, failed = 0;
+	pid_t* pids = xalloc_array_zero(workers, sizeof(pid_t));
+
+	/* whole lines of output from the workers */
+	fflush(stdout);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	for(w = 0; w < workers; w++) {
+		pids[w] = fork();
+		if(pids[w] == -1) {
+			log_msg(LOG_ERR, "fork failed: %s", strerror(errno));
+			continue;
+		}
+		if(pids[w] == 0) {
+			int ok = 1;
+			for(i = w; i < num; i += workers) {
+				if(!check_zone(nsd, argv[i*2], argv[i*2+1],
+					out, NULL, 0, 0, &results[i]))
+					ok = 0;
+			}
+			fflush(stdout);
+			_exit(ok?0:1);
+		}
+	}
+	for(w = 0; w < workers; w++) {
+		int status;
+		if(pids[w] == -1)
+			continue;
+		while(waitpid(pids[w], &status, 0) == -1) {
+			if(errno != EINTR) {
+				log_msg(LOG_ERR, "waitpid failed: %s",
+					strerror(errno));
+				break;
+			}
+		}
+	}
+	free(pids);
+	/* check the zones of a worker that could not run, or has failed
+	 * before it was done with them */
+	for(i = 0; i < num; i++) {
+		if(!results[i].done)
+			(void)check_zone(nsd, argv[i*2], argv[i*2+1], out,
+				NULL, 0, 0, &results[i]);
+		if(!results[i].ok)
+			failed++;
+	}
+	return failed;
 }
 
 /* dummy functions to link */
@@ -136,6 +269,11 @@ main(int argc, char *argv[])
 	/* Scratch variables... */
 	int c;
 	int print_zone = 0;
+	int bench = 0;
+	size_t workers = 1, num, i, failed = 0;
+	struct check_result* results;
+	uint64_t bytes = 0, records = 0;
+	double start;
 	uint32_t ixfr_number = IXFR_NUMBER_DEFAULT;
 	uint64_t ixfr_size = IXFR_SIZE_DEFAULT;
 	char* oldzone = NULL;
@@ -145,11 +283,22 @@ main(int argc, char *argv[])
 	log_init("nsd-checkzone");
 
 	/* Parse the command line... */
-	while ((c = getopt(argc, argv, "hi:n:ps:")) != -1) {
+	while ((c = getopt(argc, argv, "bhi:j:n:ps:")) != -1) {
 		switch (c) {
+		case 'b':
+			bench = 1;
+			break;
 		case 'h':
 			usage();
 			exit(0);
+		case 'j':
+			if(atoi(optarg) < 1) {
+				fprintf(stderr, "-j needs a number greater "
+					"than zero.\n");
+				exit(1);
+			}
+			workers = (size_t)atoi(optarg);
+			break;
 		case 'i':
 			oldzone = optarg;
 			break;
@@ -172,11 +321,18 @@ main(int argc, char *argv[])
 	argv += optind;
 
 	/* Commandline parse error */
-	if (argc != 2) {
+	if (argc < 2 || argc%2 != 0) {
 		fprintf(stderr, "wrong number of arguments.\n");
 		usage();
 		exit(1);
 	}
+	num = (size_t)argc/2;
+	if(oldzone && num > 1) {
+		fprintf(stderr, "-i can be used with one zone only.\n");
+		exit(1);
+	}
+	if(workers > num)
+		workers = num;
 
 	nsd.options = nsd_options_create(region_create_custom(xalloc, free,
 		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
@@ -184,10 +340,54 @@ main(int argc, char *argv[])
 	if (verbosity == 0)
 		verbosity = nsd.options->verbosity;
 
-	check_zone(&nsd, argv[0], argv[1], print_zone ? stdout : NULL,
-		oldzone, ixfr_number, ixfr_size);
+	results = NULL;
+#ifdef HAVE_MMAP
+	if(workers > 1) {
+		results = mmap(NULL, num*sizeof(*results),
+			PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if(results == MAP_FAILED) {
+			log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
+			results = NULL;
+		} else {
+			memset(results, 0, num*sizeof(*results));
+		}
+	}
+#endif
+	start = time_now();
+	if(results) {
+		failed = check_zones_parallel(&nsd, argv, num,
+			print_zone ? stdout : NULL, results, workers);
+	} else {
+		workers = 1;
+		results = xalloc_array_zero(num, sizeof(*results));
+		for(i = 0; i < num; i++) {
+			if(!check_zone(&nsd, argv[i*2], argv[i*2+1],
+				print_zone ? stdout : NULL, oldzone,
+				ixfr_number, ixfr_size, &results[i]))
+				failed++;
+		}
+	}
+	if(bench) {
+		for(i = 0; i < num; i++) {
+			uint64_t b = file_size(argv[i*2+1]);
+			if(results[i].ok)
+				print_bench(argv[i*2], b, results[i].records,
+					results[i].seconds);
+			bytes += b;
+			records += results[i].records;
+		}
+		if(num > 1)
+			print_bench("total", bytes, records,
+				time_now() - start);
+	}
+#ifdef HAVE_MMAP
+	if(workers > 1)
+		munmap(results, num*sizeof(*results));
+	else
+#endif
+		free(results);
 	region_destroy(nsd.options->region);
 	/* yylex_destroy(); but, not available in all versions of flex */
 
-	exit(0);
+	exit(failed?1:0);
 }
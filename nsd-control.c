@@ -118,18 +118,28 @@ usage()
 	printf("  status			display status of server\n");
 	printf("  stats				print statistics\n");
 	printf("  stats_noreset			peek at statistics\n");
+	printf("  top [number]			print names, sources, zones with most queries\n");
 	printf("  addzone <name> <pattern>	add a new zone\n");
 	printf("  delzone <name>		remove a zone\n");
 	printf("  changezone <name> <pattern>	change zone to use pattern\n");
 	printf("  addzones			add zone list on stdin {name space pattern newline}\n");
 	printf("  delzones			remove zone list on stdin {name newline}\n");
+	printf("  session			commands on stdin {command newline}, one connection\n");
 	printf("  write [<zone>]		write changed zonefiles to disk\n");
+	printf("  snapshot		write the zonefiles, xfrd state and zone list\n");
+	printf("  			for the start of a new secondary\n");
 	printf("  notify [<zone>]		send NOTIFY messages to secondary servers\n");
 	printf("  transfer [<zone>]		try to update secondary zones to newer serial\n");
 	printf("  force_transfer [<zone>]	update secondary zones with AXFR, no serial check\n");
 	printf("  zonestatus [<zone>]		print state, serial, activity\n");
+	printf("  zonestatus state=expired pattern=<p> below=<name> count=<n> start=<zone>\n");
+	printf("				print the zones that match, a page at a time\n");
+	printf("  mem_stats [<zone>]		print memory used by the zones\n");
+	printf("  reload_stats			print time of the last reload, slowest zones\n");
 	printf("  serverpid			get pid of server process\n");
 	printf("  verbosity <number>		change logging detail\n");
+	printf("  dnstap_sample [<number>]	log one in number queries with dnstap\n");
+	printf("  dnstap_filter [<rule>|clear]	add or clear dnstap filter rules\n");
 	printf("  print_tsig [<key_name>]	print tsig with <name> the secret and algo\n");
 	printf("  update_tsig <name> <secret>	change existing tsig with <name> to a new <secret>\n");
 	printf("  add_tsig <name> <secret> [algo] add new key with the given parameters\n");
@@ -235,7 +245,8 @@ checkconnecterr(int err, const char* svr, int port, int statuscmd)
 
 /** contact the server with TCP connect */
 static int
-contact_server(const char* svr, struct nsd_options* cfg, int statuscmd)
+contact_server(const char* svr, struct nsd_options* cfg, int statuscmd,
+	int* local)
 {
 #ifdef INET6
 	struct sockaddr_storage addr;
@@ -246,6 +257,7 @@ contact_server(const char* svr, struct nsd_options* cfg, int statuscmd)
 	int fd;
 	int port = cfg->control_port;
 	int addrfamily = 0;
+	*local = 0;
 	/* use svr or a config entry */
 	if(!svr) {
 		if(cfg->control_interface) {
@@ -284,6 +296,7 @@ contact_server(const char* svr, struct nsd_options* cfg, int statuscmd)
 		addrlen = (socklen_t)sizeof(struct sockaddr_un);
 		addrfamily = AF_LOCAL;
 		port = 0;
+		*local = 1;
 #endif
 #ifdef INET6
 	} else if(strchr(svr, ':')) {
@@ -510,12 +523,98 @@ go_cmd(SSL* ssl, int fd, int argc, char* argv[])
 	return was_error;
 }
 
+/** read ahead of the replies in a session */
+static char session_in[4096];
+static size_t session_pos = 0, session_len = 0;
+
+/** read a line of reply in a session, including the newline, 0 on EOF */
+static int
+session_read_line(SSL* ssl, int fd, char* line, size_t max)
+{
+	size_t len = 0;
+	while(len+1 < max) {
+		if(session_pos >= session_len) {
+			if(remote_read(ssl, fd, session_in,
+				sizeof(session_in)) == 0)
+				break; /* EOF */
+			session_pos = 0;
+			session_len = strlen(session_in);
+			continue;
+		}
+		line[len] = session_in[session_pos++];
+		if(line[len++] == '\n')
+			break;
+	}
+	line[len] = 0;
+	return len != 0;
+}
+
+/** display the reply to a command in a session, up to the end line.
+ * returns 1 for an error reply, 0 for success and -1 if the connection
+ * is closed. The ok for the start of the session is not displayed. */
+static int
+session_reply(SSL* ssl, int fd, int start)
+{
+	char buf[1024];
+	int was_error = 0, first_line = 1;
+	while(session_read_line(ssl, fd, buf, sizeof(buf))) {
+		if(strcmp(buf, "\004\n") == 0)
+			return was_error;
+		if(first_line && strncmp(buf, "error", 5) == 0)
+			was_error = 1;
+		if(!(start && first_line && strcmp(buf, "ok\n") == 0))
+			printf("%s", buf);
+		first_line = 0;
+	}
+	return -1;
+}
+
+/** send the commands on stdin, one per line, over one connection and
+ * display the results */
+static int
+go_session(SSL* ssl, int fd)
+{
+	char pre[10];
+	char buf[1024];
+	const char* cmd = "session\n";
+	int was_error = 0, r;
+	snprintf(pre, sizeof(pre), "NSDCT%d ", NSD_CONTROL_VERSION);
+	remote_write(ssl, fd, pre, strlen(pre));
+	remote_write(ssl, fd, cmd, strlen(cmd));
+	if(session_reply(ssl, fd, 1) != 0)
+		return 1; /* the server does not do sessions */
+
+	while(fgets(buf, (int)sizeof(buf), stdin)) {
+		size_t len = strlen(buf);
+		if(buf[len-1] != '\n') {
+			if(len+1 >= sizeof(buf)) {
+				fprintf(stderr, "error: command too long: %s\n",
+					buf);
+				return 1;
+			}
+			buf[len++] = '\n';
+			buf[len] = 0;
+		}
+		if(buf[0] == '\n')
+			continue;
+		remote_write(ssl, fd, buf, len);
+		if((r = session_reply(ssl, fd, 0)) == -1) {
+			fprintf(stderr, "error: connection closed\n");
+			return 1;
+		}
+		if(r)
+			was_error = 1;
+		fflush(stdout);
+	}
+	return was_error;
+}
+
 /** go ahead and read config, contact server and perform command and display */
 static int
 go(const char* cfgfile, char* svr, int argc, char* argv[])
 {
 	struct nsd_options* opt;
-	int fd, ret;
+	int fd, ret, local;
 #ifdef HAVE_SSL
 	SSL_CTX* ctx = NULL;
 #endif
@@ -534,23 +633,27 @@ go(const char* cfgfile, char* svr, int argc, char* argv[])
 	if(!opt->control_enable)
 		fprintf(stderr, "warning: control-enable is 'no' in the config file.\n");
 	resolve_interface_names(opt);
+
+	/* contact server */
+	fd = contact_server(svr, opt, argc>0&&strcmp(argv[0],"status")==0,
+		&local);
+	/* a local socket is used without TLS */
 #ifdef HAVE_SSL
-	ctx = setup_ctx(opt);
+	if(!local) {
+		ctx = setup_ctx(opt);
+		ssl = setup_ssl(ctx, fd);
+	}
 #else
-	if(options_remote_is_address(opt)) {
+	if(!local && options_remote_is_address(opt)) {
 		fprintf(stderr, "error: NSD was compiled without SSL.\n");
 		exit(1);
 	}
 #endif /* HAVE_SSL */
 
-	/* contact server */
-	fd = contact_server(svr, opt, argc>0&&strcmp(argv[0],"status")==0);
-#ifdef HAVE_SSL
-	ssl = setup_ssl(ctx, fd);
-#endif
-
 	/* send command */
-	ret = go_cmd(ssl, fd, argc, argv);
+	if(argc == 1 && strcmp(argv[0], "session") == 0)
+		ret = go_session(ssl, fd);
+	else	ret = go_cmd(ssl, fd, argc, argv);
 
 #ifdef HAVE_SSL
 	if(ssl) SSL_free(ssl);
@@ -58,6 +58,8 @@ struct tot_mem {
 
 	/* count of number of domains */
 	size_t domaincount;
+	/* zone data per domain, of all the zones */
+	size_t domain_data;
 
 	/* options data */
 	size_t opt_data;
@@ -110,6 +112,8 @@ account_total(struct nsd_options* opt, struct tot_mem* t)
 {
 	t->opt_data = region_get_mem(opt->region);
 	t->opt_unused = region_get_mem_unused(opt->region);
+	if(t->domaincount != 0)
+		t->domain_data = (t->data + t->data_unused) / t->domaincount;
 	t->compresstable = sizeof(uint16_t) *
 		(t->domaincount + 1 + EXTRA_DOMAIN_NUMBERS);
 	t->compresstable *= opt->server_count;
@@ -133,6 +137,9 @@ print_tot_mem(struct tot_mem* t)
 	printf("\ntotal\n");
 	pretty_mem(t->data, "data");
 	pretty_mem(t->data_unused, "unused space (due to alignment)");
+	pretty_mem(t->domaincount, "domains");
+	pretty_mem(sizeof(domain_type), "bytes per domain entry");
+	pretty_mem(t->domain_data, "bytes of zone data per domain");
 	pretty_mem(t->opt_data, "options");
 	pretty_mem(t->opt_unused, "options unused space (due to alignment)");
 	pretty_mem(t->compresstable, "name table (depends on servercount)");
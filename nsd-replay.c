@@ -0,0 +1,800 @@
+/*
+ * nsd-replay.c -- replay queries to a server and measure it
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Sends the queries from a list of names, or the UDP DNS queries in a pcap
+ * file, to the server over UDP, TCP or TLS, at a rate, or as fast as the
+ * number of outstanding queries allows. It prints the queries per second,
+ * the latency percentiles and the CPU time it used, as name=value lines.
+ * The result can be compared with that of a baseline run, to find
+ * throughput regressions.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#ifdef HAVE_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+#include "util.h"
+#include "dname.h"
+#include "dns.h"
+#include "region-allocator.h"
+#include "packet.h"
+
+/** the latency histogram has buckets of one usec, up to this */
+#define HIST_USEC 100000
+/** the largest number of streams */
+#define MAX_STREAMS 256
+
+/** a query to send, with the ID set at send time */
+struct replay_query {
+	uint8_t* wire;
+	uint16_t len;
+};
+
+/** a UDP socket or TCP or TLS connection to the server */
+struct replay_stream {
+	int fd;
+#ifdef HAVE_SSL
+	SSL* ssl;
+#endif
+	/* the send times of the outstanding queries by ID, 0 is none */
+	double sent[65536];
+	uint16_t next_id;
+	size_t outstanding;
+	/* received stream data that is not a whole message yet */
+	uint8_t in[65535+2];
+	size_t inlen;
+};
+
+/** the settings of the replay */
+static const char* server = "127.0.0.1";
+static const char* port = "53";
+static int transport = SOCK_DGRAM;
+static int use_tls = 0;
+static double rate = 0;
+static double duration = 10;
+static double timeout = 2;
+static size_t window = 100;
+static size_t num_streams = 1;
+static int edns = 0, dnssec_ok = 0;
+
+/** the queries */
+static struct replay_query* queries = NULL;
+static size_t num_queries = 0, max_queries = 0;
+
+/** the results */
+static uint64_t num_sent = 0, num_received = 0, num_lost = 0;
+static uint64_t num_noerror = 0, num_nxdomain = 0, num_otherrcode = 0;
+static uint64_t num_truncated = 0, num_reconnect = 0;
+static uint64_t hist[HIST_USEC+1];
+static double lat_sum = 0, lat_min = -1, lat_max = 0;
+
+#ifdef HAVE_SSL
+static SSL_CTX* tls_ctx = NULL;
+#endif
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	nsd-replay [options] -f file | -P pcapfile\n");
+	printf(" -f file	names to query, one per line, with an optional type\n");
+	printf(" -P file	replay the UDP DNS queries in the pcap file\n");
+	printf(" -s server	address of the server, default 127.0.0.1\n");
+	printf(" -p port	port of the server, default 53\n");
+	printf(" -T transport	udp, tcp or tls, default udp\n");
+	printf(" -r qps		queries per second, default as fast as possible\n");
+	printf(" -d seconds	duration of the replay, default 10\n");
+	printf(" -t seconds	timeout of a query, default 2\n");
+	printf(" -w num		outstanding queries per stream, default 100\n");
+	printf(" -c num		number of sockets or connections, default 1\n");
+	printf(" -e		add EDNS with a buffer size of 1232\n");
+	printf(" -D		set the DO flag, implies -e\n");
+	printf(" -b file	compare the qps with that of a baseline result\n");
+	printf(" -m percent	the qps may be this much lower than the baseline,\n"
+	       "		default 10, else the exit code is 2\n");
+	printf(" -h		this help\n");
+}
+
+static double
+now_time(void)
+{
+	struct timeval tv;
+	if(gettimeofday(&tv, NULL) == -1)
+		return 0;
+	return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+/** add a query, the wire format is copied */
+static void
+add_query(const uint8_t* wire, size_t len)
+{
+	if(len < QHEADERSZ || len > 65535)
+		return;
+	if(num_queries == max_queries) {
+		max_queries = max_queries ? max_queries*2 : 1024;
+		queries = xrealloc(queries, max_queries*sizeof(*queries));
+	}
+	queries[num_queries].wire = xalloc(len);
+	memcpy(queries[num_queries].wire, wire, len);
+	queries[num_queries].len = (uint16_t)len;
+	num_queries++;
+}
+
+/** read the file with a name and optional type on every line */
+static void
+read_names(const char* fname)
+{
+	region_type* region = region_create(xalloc, free);
+	FILE* in = fopen(fname, "r");
+	char line[1024], name[1024], type[64];
+	uint8_t wire[QHEADERSZ+MAXDOMAINLEN+4+11];
+	size_t lineno = 0;
+
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	while(fgets(line, (int)sizeof(line), in)) {
+		const dname_type* dname;
+		uint16_t qtype = TYPE_A;
+		size_t pos;
+		int n;
+		lineno++;
+		type[0] = 0;
+		n = sscanf(line, "%1023s %63s", name, type);
+		if(n < 1 || name[0] == ';' || name[0] == '#')
+			continue;
+		if(n == 2 && (qtype = rrtype_from_string(type)) == 0) {
+			log_msg(LOG_ERR, "%s:%d: unknown type %s", fname,
+				(int)lineno, type);
+			continue;
+		}
+		if(!(dname = dname_parse(region, name))) {
+			log_msg(LOG_ERR, "%s:%d: cannot parse name %s", fname,
+				(int)lineno, name);
+			continue;
+		}
+		memset(wire, 0, QHEADERSZ);
+		write_uint16(wire+4, 1); /* qdcount */
+		pos = QHEADERSZ;
+		memcpy(wire+pos, dname_name(dname), dname->name_size);
+		pos += dname->name_size;
+		write_uint16(wire+pos, qtype);
+		write_uint16(wire+pos+2, CLASS_IN);
+		pos += 4;
+		if(edns) {
+			write_uint16(wire+10, 1); /* arcount */
+			wire[pos] = 0;
+			write_uint16(wire+pos+1, TYPE_OPT);
+			write_uint16(wire+pos+3, 1232);
+			write_uint32(wire+pos+5, dnssec_ok ? 0x8000 : 0);
+			write_uint16(wire+pos+9, 0);
+			pos += 11;
+		}
+		add_query(wire, pos);
+		region_free_all(region);
+	}
+	fclose(in);
+	region_destroy(region);
+}
+
+/** read a 32 bit value from the pcap file, in its byte order */
+static uint32_t
+pcap_u32(const uint8_t* p, int swap)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	if(swap)
+		v = ((v&0xff)<<24) | ((v&0xff00)<<8) | ((v>>8)&0xff00) |
+			(v>>24);
+	return v;
+}
+
+/** add the packet from the pcap file if it is a UDP DNS query */
+static void
+pcap_packet(const uint8_t* p, size_t len, uint32_t linktype)
+{
+	uint16_t proto;
+	size_t udplen;
+
+	switch(linktype) {
+	case 0: /* DLT_NULL, the address family in host byte order */
+		if(len < 4)
+			return;
+		proto = (p[0] == 2 || p[3] == 2) ? 0x0800 : 0x86dd;
+		p += 4; len -= 4;
+		break;
+	case 1: /* DLT_EN10MB */
+		if(len < 14)
+			return;
+		proto = read_uint16(p+12);
+		p += 14; len -= 14;
+		if(proto == 0x8100 && len >= 4) {
+			proto = read_uint16(p+2);
+			p += 4; len -= 4;
+		}
+		break;
+	case 12: /* DLT_RAW, on some systems */
+	case 101: /* LINKTYPE_RAW */
+		if(len < 1)
+			return;
+		proto = ((p[0]>>4) == 6) ? 0x86dd : 0x0800;
+		break;
+	case 113: /* DLT_LINUX_SLL */
+		if(len < 16)
+			return;
+		proto = read_uint16(p+14);
+		p += 16; len -= 16;
+		break;
+	default:
+		return;
+	}
+	if(proto == 0x0800) {
+		size_t hl;
+		if(len < 20 || (p[0]>>4) != 4 || p[9] != 17)
+			return;
+		/* skip fragments */
+		if((read_uint16(p+6) & 0x3fff) != 0)
+			return;
+		hl = (size_t)(p[0]&0x0f)*4;
+		if(hl < 20 || len < hl)
+			return;
+		p += hl; len -= hl;
+	} else if(proto == 0x86dd) {
+		if(len < 40 || (p[0]>>4) != 6 || p[6] != 17)
+			return;
+		p += 40; len -= 40;
+	} else {
+		return;
+	}
+	if(len < 8 || read_uint16(p+2) != 53)
+		return;
+	udplen = read_uint16(p+4);
+	if(udplen < 8 || udplen > len)
+		return;
+	p += 8;
+	udplen -= 8;
+	/* only queries */
+	if(udplen < QHEADERSZ || (p[2]&0x80))
+		return;
+	add_query(p, udplen);
+}
+
+/** read the UDP DNS queries from the pcap file */
+static void
+read_pcap(const char* fname)
+{
+	FILE* in = fopen(fname, "rb");
+	uint8_t hdr[24], rec[16];
+	uint8_t* pkt = xalloc(65536);
+	uint32_t magic, linktype, caplen;
+	int swap;
+
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	if(fread(hdr, sizeof(hdr), 1, in) != 1)
+		error("%s: cannot read the pcap header", fname);
+	memcpy(&magic, hdr, sizeof(magic));
+	if(magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+		swap = 0;
+	else if(magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		swap = 1;
+	else	error("%s: not a pcap file", fname);
+	linktype = pcap_u32(hdr+20, swap) & 0xffff;
+	while(fread(rec, sizeof(rec), 1, in) == 1) {
+		caplen = pcap_u32(rec+8, swap);
+		if(caplen > 65536)
+			error("%s: bad packet length %u", fname,
+				(unsigned)caplen);
+		if(fread(pkt, caplen, 1, in) != 1)
+			break;
+		pcap_packet(pkt, caplen, linktype);
+	}
+	free(pkt);
+	fclose(in);
+}
+
+/** the outstanding queries of the stream are lost */
+static void
+stream_clear(struct replay_stream* s)
+{
+	size_t i;
+	if(s->outstanding == 0)
+		return;
+	for(i = 0; i < 65536; i++) {
+		if(s->sent[i] != 0) {
+			s->sent[i] = 0;
+			num_lost++;
+		}
+	}
+	s->outstanding = 0;
+}
+
+static void
+stream_close(struct replay_stream* s)
+{
+#ifdef HAVE_SSL
+	if(s->ssl) {
+		SSL_shutdown(s->ssl);
+		SSL_free(s->ssl);
+		s->ssl = NULL;
+	}
+#endif
+	if(s->fd != -1)
+		close(s->fd);
+	s->fd = -1;
+	s->inlen = 0;
+	stream_clear(s);
+}
+
+/** connect the stream to the server */
+static int
+stream_open(struct replay_stream* s, struct addrinfo* addr)
+{
+	if((s->fd = socket(addr->ai_family, transport, 0)) == -1) {
+		log_msg(LOG_ERR, "socket: %s", strerror(errno));
+		return 0;
+	}
+	if(connect(s->fd, addr->ai_addr, addr->ai_addrlen) == -1) {
+		log_msg(LOG_ERR, "connect to %s port %s: %s", server, port,
+			strerror(errno));
+		close(s->fd);
+		s->fd = -1;
+		return 0;
+	}
+	if(transport == SOCK_STREAM) {
+		int on = 1;
+		(void)setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &on,
+			sizeof(on));
+	}
+#ifdef HAVE_SSL
+	if(use_tls) {
+		if(!(s->ssl = SSL_new(tls_ctx)) ||
+			!SSL_set_fd(s->ssl, s->fd) ||
+			SSL_connect(s->ssl) != 1) {
+			log_msg(LOG_ERR, "TLS connect to %s port %s failed",
+				server, port);
+			ERR_print_errors_fp(stderr);
+			stream_close(s);
+			return 0;
+		}
+	}
+#endif
+	return 1;
+}
+
+/** write all of the data to the stream */
+static int
+stream_write(struct replay_stream* s, const uint8_t* data, size_t len)
+{
+#ifdef HAVE_SSL
+	if(s->ssl)
+		return SSL_write(s->ssl, data, (int)len) == (int)len;
+#endif
+	while(len > 0) {
+		ssize_t r = write(s->fd, data, len);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			return 0;
+		}
+		data += r;
+		len -= (size_t)r;
+	}
+	return 1;
+}
+
+/** send the query on the stream */
+static int
+stream_send(struct replay_stream* s, struct replay_query* q, double now)
+{
+	uint8_t buf[65535+2];
+	uint8_t* msg = (transport == SOCK_STREAM) ? buf+2 : buf;
+	uint16_t id;
+
+	/* find an ID that is not in use */
+	while(s->sent[s->next_id] != 0)
+		s->next_id++;
+	id = s->next_id++;
+	memcpy(msg, q->wire, q->len);
+	write_uint16(msg, id);
+	if(transport == SOCK_STREAM) {
+		write_uint16(buf, q->len);
+		if(!stream_write(s, buf, (size_t)q->len+2))
+			return 0;
+	} else if(send(s->fd, msg, q->len, 0) == -1) {
+		if(errno != EAGAIN && errno != EINTR && errno != ENOBUFS &&
+			errno != ECONNREFUSED)
+			log_msg(LOG_ERR, "send: %s", strerror(errno));
+		num_sent++;
+		num_lost++;
+		return 1;
+	}
+	s->sent[id] = now;
+	s->outstanding++;
+	num_sent++;
+	return 1;
+}
+
+/** the answer is received */
+static void
+stream_answer(struct replay_stream* s, const uint8_t* msg, size_t len,
+	double now)
+{
+	double lat;
+	uint16_t id;
+	if(len < QHEADERSZ)
+		return;
+	id = read_uint16(msg);
+	if(s->sent[id] == 0)
+		return; /* too late, or not ours */
+	lat = now - s->sent[id];
+	s->sent[id] = 0;
+	s->outstanding--;
+	num_received++;
+	if((msg[3]&0x0f) == RCODE_OK)
+		num_noerror++;
+	else if((msg[3]&0x0f) == RCODE_NXDOMAIN)
+		num_nxdomain++;
+	else	num_otherrcode++;
+	if((msg[2]&0x02))
+		num_truncated++;
+	if(lat < 0)
+		lat = 0;
+	lat_sum += lat;
+	if(lat_min < 0 || lat < lat_min)
+		lat_min = lat;
+	if(lat > lat_max)
+		lat_max = lat;
+	if(lat*1000000.0 >= HIST_USEC)
+		hist[HIST_USEC]++;
+	else	hist[(size_t)(lat*1000000.0)]++;
+}
+
+/** read from the stream, returns false if it is closed */
+static int
+stream_read(struct replay_stream* s, double now)
+{
+	uint8_t buf[65536];
+	ssize_t r;
+	size_t pos = 0;
+
+	if(transport == SOCK_DGRAM) {
+		if((r = recv(s->fd, buf, sizeof(buf), 0)) == -1)
+			return (errno == EAGAIN || errno == EINTR ||
+				errno == ECONNREFUSED);
+		stream_answer(s, buf, (size_t)r, now);
+		return 1;
+	}
+#ifdef HAVE_SSL
+	if(s->ssl)
+		r = SSL_read(s->ssl, s->in+s->inlen, sizeof(s->in)-s->inlen);
+	else
+#endif
+		r = read(s->fd, s->in+s->inlen, sizeof(s->in)-s->inlen);
+	if(r == -1 && errno == EINTR)
+		return 1;
+	if(r <= 0)
+		return 0;
+	s->inlen += (size_t)r;
+	while(s->inlen - pos >= 2 &&
+		s->inlen - pos >= 2 + (size_t)read_uint16(s->in+pos)) {
+		size_t len = read_uint16(s->in+pos);
+		stream_answer(s, s->in+pos+2, len, now);
+		pos += 2 + len;
+	}
+	memmove(s->in, s->in+pos, s->inlen-pos);
+	s->inlen -= pos;
+	return 1;
+}
+
+/** the queries that did not get an answer in time are lost */
+static void
+stream_expire(struct replay_stream* s, double now)
+{
+	size_t i;
+	if(s->outstanding == 0)
+		return;
+	for(i = 0; i < 65536; i++) {
+		if(s->sent[i] != 0 && now - s->sent[i] > timeout) {
+			s->sent[i] = 0;
+			s->outstanding--;
+			num_lost++;
+		}
+	}
+}
+
+/** the latency in msec below which the fraction of the answers is */
+static double
+percentile(double frac)
+{
+	uint64_t want = (uint64_t)(frac*(double)num_received), n = 0;
+	size_t i;
+	for(i = 0; i < HIST_USEC; i++) {
+		n += hist[i];
+		if(n > want)
+			return (double)(i+1)/1000.0;
+	}
+	return lat_max*1000.0;
+}
+
+/** replay the queries to the server */
+static void
+replay(struct addrinfo* addr, double* elapsed)
+{
+	struct replay_stream* streams = xalloc_array_zero(num_streams,
+		sizeof(*streams));
+	struct pollfd* fds = xalloc_array_zero(num_streams, sizeof(*fds));
+	double start, end, now, next_send, last_expire;
+	size_t i, cur = 0, qi = 0;
+	int done = 0;
+
+	for(i = 0; i < num_streams; i++) {
+		streams[i].fd = -1;
+		if(!stream_open(&streams[i], addr))
+			exit(1);
+	}
+	start = now = now_time();
+	end = start + duration;
+	next_send = last_expire = start;
+	while(!done) {
+		size_t outstanding = 0, burst = 0;
+		int wait = 1;
+
+		/* send as much as the rate and the windows allow */
+		while(now < end && burst < 1000 &&
+			(rate == 0 || next_send <= now)) {
+			size_t tries;
+			for(tries = 0; tries < num_streams; tries++) {
+				if(streams[cur].fd != -1 &&
+					streams[cur].outstanding < window)
+					break;
+				cur = (cur+1)%num_streams;
+			}
+			if(tries == num_streams)
+				break;
+			if(!stream_send(&streams[cur],
+				&queries[qi++ % num_queries], now)) {
+				stream_close(&streams[cur]);
+				num_reconnect++;
+				(void)stream_open(&streams[cur], addr);
+			}
+			cur = (cur+1)%num_streams;
+			burst++;
+			if(rate != 0) {
+				next_send += 1.0/rate;
+				/* do not burst to catch up on a long stall */
+				if(next_send < now - 0.1)
+					next_send = now - 0.1;
+			}
+		}
+
+		for(i = 0; i < num_streams; i++) {
+			fds[i].fd = streams[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+			outstanding += streams[i].outstanding;
+		}
+		if(rate != 0 && now < end && next_send > now)
+			wait = (int)((next_send - now)*1000.0);
+		if(wait < 1)
+			wait = (burst == 1000) ? 0 : 1;
+		if(poll(fds, (nfds_t)num_streams, wait) == -1 &&
+			errno != EINTR)
+			error("poll: %s", strerror(errno));
+		now = now_time();
+		for(i = 0; i < num_streams; i++) {
+			if(!(fds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+				continue;
+			if(!stream_read(&streams[i], now)) {
+				/* the server closed the connection */
+				stream_close(&streams[i]);
+				if(now < end) {
+					num_reconnect++;
+					(void)stream_open(&streams[i], addr);
+				}
+			}
+		}
+		if(now - last_expire > 0.1) {
+			for(i = 0; i < num_streams; i++)
+				stream_expire(&streams[i], now);
+			last_expire = now;
+		}
+		if(now >= end && (outstanding == 0 || now > end + timeout))
+			done = 1;
+	}
+	*elapsed = now_time() - start;
+	for(i = 0; i < num_streams; i++)
+		stream_close(&streams[i]);
+	free(fds);
+	free(streams);
+}
+
+/** read the qps from a baseline result */
+static double
+baseline_qps(const char* fname)
+{
+	FILE* in = fopen(fname, "r");
+	char line[256];
+	double qps = 0;
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	while(fgets(line, (int)sizeof(line), in)) {
+		if(strncmp(line, "qps=", 4) == 0)
+			qps = atof(line+4);
+	}
+	fclose(in);
+	return qps;
+}
+
+extern char *optarg;
+extern int optind;
+
+int
+main(int argc, char* argv[])
+{
+	const char* names = NULL, *pcap = NULL, *baseline = NULL;
+	double margin = 10, elapsed = 0, tm;
+	struct addrinfo hints, *addr = NULL;
+	struct rusage ru;
+	int c, r, ret = 0;
+
+	log_init("nsd-replay");
+	while((c = getopt(argc, argv, "b:c:d:Def:hm:p:P:r:s:t:T:w:")) != -1) {
+		switch(c) {
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'c':
+			num_streams = (size_t)atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'D':
+			dnssec_ok = 1;
+			edns = 1;
+			break;
+		case 'e':
+			edns = 1;
+			break;
+		case 'f':
+			names = optarg;
+			break;
+		case 'm':
+			margin = atof(optarg);
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'P':
+			pcap = optarg;
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 't':
+			timeout = atof(optarg);
+			break;
+		case 'T':
+			if(strcmp(optarg, "udp") == 0)
+				transport = SOCK_DGRAM;
+			else if(strcmp(optarg, "tcp") == 0)
+				transport = SOCK_STREAM;
+			else if(strcmp(optarg, "tls") == 0) {
+				transport = SOCK_STREAM;
+				use_tls = 1;
+			} else {
+				fprintf(stderr, "unknown transport %s\n",
+					optarg);
+				exit(1);
+			}
+			break;
+		case 'w':
+			window = (size_t)atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		case '?':
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if((!names && !pcap) || num_streams < 1 ||
+		num_streams > MAX_STREAMS || window < 1 || window > 65535 ||
+		duration <= 0 || timeout <= 0 || rate < 0) {
+		usage();
+		exit(1);
+	}
+	if(names)
+		read_names(names);
+	if(pcap)
+		read_pcap(pcap);
+	if(num_queries == 0)
+		error("there are no queries to send");
+#ifdef HAVE_SSL
+	if(use_tls) {
+		if(!(tls_ctx = SSL_CTX_new(SSLv23_client_method())))
+			error("could not create the TLS context");
+		SSL_CTX_set_verify(tls_ctx, SSL_VERIFY_NONE, NULL);
+	}
+#else
+	if(use_tls)
+		error("nsd-replay is compiled without TLS");
+#endif
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = transport;
+	if((r = getaddrinfo(server, port, &hints, &addr)) != 0 || !addr)
+		error("cannot resolve %s port %s: %s", server, port,
+			gai_strerror(r));
+
+	replay(addr, &elapsed);
+	freeaddrinfo(addr);
+
+	printf("queries.sent=%llu\n", (unsigned long long)num_sent);
+	printf("queries.received=%llu\n", (unsigned long long)num_received);
+	printf("queries.lost=%llu\n", (unsigned long long)num_lost);
+	printf("rcode.NOERROR=%llu\n", (unsigned long long)num_noerror);
+	printf("rcode.NXDOMAIN=%llu\n", (unsigned long long)num_nxdomain);
+	printf("rcode.other=%llu\n", (unsigned long long)num_otherrcode);
+	printf("truncated=%llu\n", (unsigned long long)num_truncated);
+	printf("reconnects=%llu\n", (unsigned long long)num_reconnect);
+	printf("time=%.3f\n", elapsed);
+	printf("qps=%.1f\n", elapsed > 0 ? (double)num_received/elapsed : 0);
+	if(num_received > 0) {
+		printf("latency.min=%.3fms\n", lat_min*1000.0);
+		printf("latency.avg=%.3fms\n",
+			lat_sum/(double)num_received*1000.0);
+		printf("latency.max=%.3fms\n", lat_max*1000.0);
+		printf("latency.p50=%.3fms\n", percentile(0.50));
+		printf("latency.p90=%.3fms\n", percentile(0.90));
+		printf("latency.p99=%.3fms\n", percentile(0.99));
+		printf("latency.p999=%.3fms\n", percentile(0.999));
+	}
+	if(getrusage(RUSAGE_SELF, &ru) == 0) {
+		printf("cpu.user=%.3f\n", (double)ru.ru_utime.tv_sec +
+			(double)ru.ru_utime.tv_usec/1000000.0);
+		printf("cpu.sys=%.3f\n", (double)ru.ru_stime.tv_sec +
+			(double)ru.ru_stime.tv_usec/1000000.0);
+	}
+	if(baseline) {
+		double base = baseline_qps(baseline);
+		double qps = elapsed > 0 ? (double)num_received/elapsed : 0;
+		tm = base > 0 ? (qps - base)/base*100.0 : 0;
+		printf("baseline.qps=%.1f\n", base);
+		printf("baseline.change=%.1f%%\n", tm);
+		if(base > 0 && tm < -margin) {
+			printf("qps is more than %.1f%% below the baseline\n",
+				margin);
+			ret = 2;
+		}
+	}
+#ifdef HAVE_SSL
+	if(tls_ctx)
+		SSL_CTX_free(tls_ctx);
+#endif
+	return ret;
+}
@@ -49,15 +49,18 @@
 #endif
 
 #include "nsd.h"
+#include "nsec3.h"
 #include "options.h"
 #include "tsig.h"
 #include "remote.h"
 #include "xfrd-disk.h"
 #include "ipc.h"
+#include "metrics.h"
 #ifdef USE_DNSTAP
 #include "dnstap/dnstap_collector.h"
 #endif
 #include "util/proxy_protocol.h"
+#include "xdp-server.h"
 
 /* The server handler... */
 struct nsd nsd;
@@ -498,6 +501,15 @@ figure_sockets(
 			(*udp)[i].fib = ip->fib;
 			(*tcp)[i].fib = ip->fib;
 		}
+		if(ip->io_uring) {
+#ifdef USE_IO_URING
+			(*udp)[i].flags |= NSD_USE_IO_URING;
+#else
+			log_msg(LOG_WARNING, "io-uring=yes for ip-address %s, "
+				"but NSD is compiled without --enable-io-uring",
+				ip->address);
+#endif
+		}
 #ifdef HAVE_GETIFADDRS
 		if(ip->dev != 0) {
 			(*udp)[i].flags |= NSD_BIND_DEVICE;
@@ -639,6 +651,94 @@ static void free_cpuset(void *ptr)
 	cpuset_t *set = (cpuset_t *)ptr;
 	cpuset_destroy(set);
 }
+
+/* the configured cpu for the service, -1 for xfrd, or -1 if none */
+static int
+service_cpu(struct nsd_options* opt, int service)
+{
+	struct cpu_map_option* m;
+	for(m = opt->service_cpu_affinity; m; m = m->next) {
+		if(m->service == service)
+			return m->cpu;
+	}
+	return -1;
+}
+
+static void
+add_service_cpu(struct nsd_options* opt, int service, int cpu)
+{
+	struct cpu_map_option* m = region_alloc_zero(opt->region, sizeof(*m));
+	m->service = service;
+	m->cpu = cpu;
+	m->next = opt->service_cpu_affinity;
+	opt->service_cpu_affinity = m;
+}
+
+/*
+ * Fill in cpu-affinity, and the server-N-cpu-affinity and
+ * xfrd-cpu-affinity that are not configured, from the cpu topology.
+ */
+static void
+cpu_affinity_auto(struct nsd* nsd)
+{
+	struct nsd_options* opt = nsd->options;
+	struct cpu_place* list;
+	int ncpus, n, i, cpu, xfrd = -1;
+
+	if((ncpus = number_of_cpus()) <= 0)
+		ncpus = 1;
+	list = xalloc_array_zero(ncpus, sizeof(*list));
+	if((n = cpu_placement(list, ncpus)) <= 0) {
+		log_msg(LOG_WARNING, "cpu-affinity-auto: the cpu topology "
+			"is not available, no cpu affinity is set");
+		free(list);
+		return;
+	}
+	for(i = n-1; i >= 0; i--) {
+		struct cpu_option* c = region_alloc_zero(opt->region,
+			sizeof(*c));
+		c->cpu = list[i].cpu;
+		c->next = opt->cpu_affinity;
+		opt->cpu_affinity = c;
+	}
+	for(i = 0; i < (int)nsd->child_count; i++) {
+		struct cpu_place* p = &list[i%n];
+		if((cpu = service_cpu(opt, i+1)) != -1) {
+			log_msg(LOG_INFO, "cpu-affinity-auto: server %d on "
+				"cpu %d, configured", i+1, cpu);
+			continue;
+		}
+		add_service_cpu(opt, i+1, p->cpu);
+		log_msg(LOG_INFO, "cpu-affinity-auto: server %d on cpu %d, "
+			"node %d%s%s", i+1, p->cpu, p->node,
+			(p->smt?", smt sibling":""),
+			(p->irq?", nic interrupts":""));
+	}
+	if((cpu = service_cpu(opt, -1)) != -1) {
+		log_msg(LOG_INFO, "cpu-affinity-auto: xfrd on cpu %d, "
+			"configured", cpu);
+	} else {
+		/* a cpu that no server has, best one without interrupts */
+		for(i = n-1; i >= (int)nsd->child_count; i--) {
+			if(!list[i].irq) {
+				xfrd = i;
+				break;
+			}
+		}
+		if(xfrd == -1)
+			xfrd = n-1;
+		add_service_cpu(opt, -1, list[xfrd].cpu);
+		log_msg(LOG_INFO, "cpu-affinity-auto: xfrd%s on cpu %d, "
+			"node %d",
+#ifdef USE_DNSTAP
+			(opt->dnstap_enable?" and dnstap collector":""),
+#else
+			"",
+#endif
+			list[xfrd].cpu, list[xfrd].node);
+	}
+	free(list);
+}
 #endif
 
 /*
@@ -931,6 +1031,9 @@ main(int argc, char *argv[])
 
 	/* Initialize the server handler... */
 	memset(&nsd, 0, sizeof(struct nsd));
+#ifdef BIND8_STATS
+	nsd.metrics_pid = -1;
+#endif
 	nsd.region      = region_create(xalloc, free);
 	nsd.pidfile	= 0;
 	nsd.server_kind = NSD_SERVER_MAIN;
@@ -1120,6 +1223,7 @@ main(int argc, char *argv[])
 		error("could not read zonelist file %s\n",
 			nsd.options->zonelistfile);
 	}
+	nsd_options_compile_acls(nsd.options);
 	if(nsd.options->do_ip4 && !nsd.options->do_ip6) {
 		hints.ai_family = AF_INET;
 	}
@@ -1156,12 +1260,34 @@ main(int argc, char *argv[])
 	if(nsd.child_count == 0) {
 		nsd.child_count = nsd.options->server_count;
 	}
+#ifdef NSEC3
+	nsec3_prehash_workers(nsd.child_count);
+#endif
 
 #ifdef SO_REUSEPORT
 	if(nsd.options->reuseport && nsd.child_count > 1) {
 		nsd.reuseport = nsd.child_count;
 	}
 #endif /* SO_REUSEPORT */
+	/* start with all servers, server-count-min retires them by load */
+	nsd.active_children = nsd.child_count;
+	if(nsd.options->server_count_min > 0) {
+#ifndef BIND8_STATS
+		log_msg(LOG_WARNING, "server-count-min needs the statistics, "
+			"enabled with --enable-bind8-stats, all servers run");
+		nsd.options->server_count_min = 0;
+#else
+#  if !defined(SO_ATTACH_REUSEPORT_CBPF) || !defined(HAVE_LINUX_FILTER_H)
+		if(nsd.reuseport) {
+			log_msg(LOG_WARNING, "server-count-min with reuseport "
+				"needs socket filters, all servers run");
+			nsd.options->server_count_min = 0;
+		}
+#  endif
+		if((size_t)nsd.options->server_count_min >= nsd.child_count)
+			nsd.options->server_count_min = 0;
+#endif /* BIND8_STATS */
+	}
 	if(nsd.maximum_tcp_count == 0) {
 		nsd.maximum_tcp_count = nsd.options->tcp_count;
 	}
@@ -1174,6 +1300,7 @@ main(int argc, char *argv[])
 #ifdef HAVE_SSL
 	nsd.tls_ctx = NULL;
 	nsd.tls_auth_ctx = NULL;
+	nsd.tls_ticket_keys = NULL;
 #endif
 
 	if(udp_port == 0)
@@ -1230,6 +1357,7 @@ main(int argc, char *argv[])
 #endif /* defined(INET6) */
 
 	reconfig_cookies(&nsd, nsd.options);
+	cookie_keys_setup(&nsd);
 
 	if (nsd.nsid_len == 0 && nsd.options->nsid) {
 		if (strlen(nsd.options->nsid) % 2 != 0) {
@@ -1241,12 +1369,14 @@ main(int argc, char *argv[])
 			error("hex string cannot be parsed '%s' in NSID.", nsd.options->nsid);
 		}
 	}
-	edns_init_nsid(&nsd.edns_ipv4, nsd.nsid_len);
+	edns_init_nsid(&nsd.edns_ipv4, nsd.nsid, nsd.nsid_len);
 #if defined(INET6)
-	edns_init_nsid(&nsd.edns_ipv6, nsd.nsid_len);
+	edns_init_nsid(&nsd.edns_ipv6, nsd.nsid, nsd.nsid_len);
 #endif /* defined(INET6) */
 
 #ifdef HAVE_CPUSET_T
+	if(nsd.options->cpu_affinity_auto && !nsd.options->cpu_affinity)
+		cpu_affinity_auto(&nsd);
 	nsd.use_cpu_affinity = (nsd.options->cpu_affinity != NULL);
 	if(nsd.use_cpu_affinity) {
 		int ncpus;
@@ -1505,6 +1635,25 @@ main(int argc, char *argv[])
 		error("server initialization failed, %s could "
 			"not be started", argv0);
 	}
+#ifdef USE_XDP
+	/* attach the XDP program and create the sockets, while root */
+	if(nsd.options->xdp_interface && xdp_server_init(&nsd) != 0) {
+		error("could not set up AF_XDP on %s",
+			nsd.options->xdp_interface);
+	}
+#else
+	if(nsd.options->xdp_interface) {
+		log_msg(LOG_WARNING, "xdp-interface: %s ignored, NSD is "
+			"compiled without --enable-xdp",
+			nsd.options->xdp_interface);
+	}
+#endif
+#ifndef USE_LZ4
+	if(nsd.options->xfrd_xfr_compress) {
+		log_msg(LOG_WARNING, "xfrd-xfr-compress: yes ignored, NSD is "
+			"compiled without --enable-lz4");
+	}
+#endif
 #if defined(HAVE_SSL)
 	if(nsd.options->control_enable || (nsd.options->tls_service_key && nsd.options->tls_service_key[0])) {
 		perform_openssl_init();
@@ -1531,6 +1680,10 @@ main(int argc, char *argv[])
 		}
 	}
 #endif /* HAVE_SSL */
+	/* the sockets of an old nsd are taken, open it for the next one */
+	if(server_handoff_listen(&nsd) != 0)
+		error("could not open socket-handoff %s",
+			nsd.options->socket_handoff);
 
 	/* Unless we're debugging, fork... */
 	if (!nsd.debug) {
@@ -1700,6 +1853,10 @@ main(int argc, char *argv[])
 			dt_collector_start(nsd.dt_collector, &nsd);
 		}
 #endif /* USE_DNSTAP */
+#ifdef BIND8_STATS
+		if(nsd.options->metrics_enable)
+			nsd.metrics_pid = metrics_start(&nsd);
+#endif /* BIND8_STATS */
 	}
 	if (server_prepare(&nsd) != 0) {
 		unlinkpid(nsd.pidfile, nsd.username);
@@ -26,10 +26,12 @@
 #include "dns.h"
 #include "edns.h"
 #include "bitset.h"
+#include "siphash.h"
 struct netio_handler;
 struct nsd_options;
 struct udb_base;
 struct daemon_remote;
+struct respcache_handover;
 #ifdef USE_DNSTAP
 struct dt_collector;
 #endif
@@ -99,14 +101,18 @@ typedef	unsigned long stc_type;
 #endif /* BIND8_STATS */
 
 #ifdef USE_ZONE_STATS
+/* the zone statistic of this server process, every zone has an entry per
+ * server so that the servers do not write to the same counters */
+#define ZONESTATNOW(nsd, zone) \
+	nsd->zonestatnow[zone->zonestatid*nsd->child_count+nsd->zonestat_child]
 /* increment zone statistic, checks if zone-nonNULL and zone array bounds */
 #define ZTATUP(nsd, zone, stc) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		nsd->zonestatnow[zone->zonestatid].stc++ \
+		ZONESTATNOW(nsd, zone).stc++ \
 		: 0)
 #define	ZTATUP2(nsd, zone, stc, i) ( \
 	(zone && zone->zonestatid < nsd->zonestatsizenow) ? \
-		(nsd->zonestatnow[zone->zonestatid].stc[(i) <= (LASTELEM(nsd->zonestatnow[zone->zonestatid].stc) - 1) ? i : LASTELEM(nsd->zonestatnow[zone->zonestatid].stc)]++ ) \
+		(ZONESTATNOW(nsd, zone).stc[(i) <= (LASTELEM(ZONESTATNOW(nsd, zone).stc) - 1) ? i : LASTELEM(ZONESTATNOW(nsd, zone).stc)]++ ) \
 		: 0)
 #else /* USE_ZONE_STATS */
 #define	ZTATUP(nsd, zone, stc) /* Nothing */
@@ -114,6 +120,24 @@ typedef	unsigned long stc_type;
 #endif /* USE_ZONE_STATS */
 
 #ifdef	BIND8_STATS
+/* latency histogram buckets, bucket i counts the answers that took less
+ * than 2^i microseconds, the last bucket counts the ones that took longer */
+#define LATENCY_BUCKETS 24
+/* transports for the latency statistics */
+#define LATENCY_UDP 0
+#define LATENCY_TCP 1
+#define LATENCY_TLS 2
+#define LATENCY_TRANSPORTS 3
+/* UDP batch size buckets, bucket i counts the reads of less than 2^i
+ * queries, the last bucket counts the larger ones */
+#define UDP_BATCH_BUCKETS 8
+/* TCP occupancy buckets, bucket i counts the connections accepted when
+ * i tenths of tcp-count were in use */
+#define TCP_OCCUPANCY_BUCKETS 10
+/* TCP idle timeout buckets, bucket i counts the timeouts of up to 100*2^i
+ * msec, the last bucket counts the longer ones */
+#define TCP_TIMEOUT_BUCKETS 12
+
 /* Data structure to keep track of statistics */
 struct nsdst {
 	time_t	boot;
@@ -126,12 +150,60 @@ struct nsdst {
 	/* Dropped, truncated, queries for nonconfigured zone, tx errors */
 	stc_type dropped, truncated, wrongzone, txerr, rxerr;
 	stc_type edns, ednserr, raxfr, nona, rixfr;
+	/* Answers from the response cache, and cache lookups that missed */
+	stc_type rcache_hit, rcache_miss;
+	/* UDP answers that were sent together with others, with GSO */
+	stc_type udp_gso;
+	/* TLS handshakes that resumed a session, and full handshakes */
+	stc_type tls_resumed, tls_full;
+	/* TLS connections that send with kernel TLS */
+	stc_type tls_ktls;
+	/* TLS handshakes that waited for an async job, and the time the
+	 * server spent in the handshakes, in microseconds */
+	stc_type tls_async, tls_handshake_usec;
+	/* TCP connections closed for tcp-evict-idle and tcp-source-limit */
+	stc_type tcp_evicted, tcp_source_limited;
+	/* transfers refused for the xfr-out limits */
+	stc_type xfr_out_limited;
+	/* packets dropped by the XDP program, malformed and over the
+	 * xdp-ratelimit */
+	stc_type xdp_malformed, xdp_ratelimited;
+	/* TCP connections accepted, also those closed right away */
+	stc_type tcp_accepted;
+	/* TCP connections that got a handler from the pool */
+	stc_type tcp_pool_reused;
+	/* ratelimit buckets of other sources that were replaced, and of
+	 * those, the ones that had queries in the last second */
+	stc_type rrl_evicted, rrl_collision;
+	/* UDP queries that were shed in overload for udp-shed, and the
+	 * times that the server went into overload */
+	stc_type udp_shed, udp_overload;
+	/* time from receipt of the query to the send of the answer */
+	stc_type latency[LATENCY_TRANSPORTS][LATENCY_BUCKETS];
+	/* UDP queries the kernel dropped for a full socket buffer, and the
+	 * time from the kernel receive to the read by the server */
+	stc_type rxq_dropped;
+	stc_type rxq_latency[LATENCY_BUCKETS];
+	/* the number of queries of the UDP reads */
+	stc_type udp_batch[UDP_BATCH_BUCKETS];
+	/* the connections in use at TCP accept, and the idle timeouts that
+	 * connections got, that shrink when the connections are many */
+	stc_type tcp_occupancy[TCP_OCCUPANCY_BUCKETS];
+	stc_type tcp_timeout[TCP_TIMEOUT_BUCKETS];
+	/* page faults of the server process, the major ones waited for a
+	 * read from disk or swap */
+	stc_type page_faults_major, page_faults_minor;
 	uint64_t db_disk, db_mem;
+	/* page faults of the last reload, copy-on-write of the database */
+	uint64_t db_reload_faults;
+	/* memory given back by reloads that copied the database */
+	uint64_t db_compact_bytes;
 };
 #endif /* BIND8_STATS */
 
 #define NSD_SOCKET_IS_OPTIONAL (1<<0)
 #define NSD_BIND_DEVICE (1<<1)
+#define NSD_USE_IO_URING (1<<2)
 
 struct nsd_addrinfo
 {
@@ -193,6 +265,7 @@ struct nsd_child
 
 #ifdef	BIND8_STATS
 	stc_type query_count;
+	stc_type page_faults_major, page_faults_minor;
 #endif
 };
 
@@ -240,6 +313,9 @@ struct	nsd
 
 	size_t            child_count;
 	struct nsd_child *children;
+	/* the children up to active_children run, the ones after it are
+	 * retired by server-count-min until the load goes up */
+	size_t            active_children;
 	int	restart_children;
 	int	reload_failed;
 
@@ -255,6 +331,10 @@ struct	nsd
 	region_type* server_region;
 	struct netio_handler* xfrd_listener;
 	struct daemon_remote* rc;
+	/* listening unix socket of the socket-handoff, or -1 */
+	int handoff_fd;
+	/* a new nsd has taken the sockets on the socket-handoff */
+	int handoff_done;
 
 	/* Configuration */
 	const char		*pidfile;
@@ -316,18 +396,21 @@ struct	nsd
 	struct nsdst* st;
 	/* Produce statistics dump every st_period seconds */
 	int st_period;
-	/* per zone stats, each an array per zone-stat-idx, stats per zone is
-	 * add of [0][zoneidx] and [1][zoneidx]. */
+	/* per zone stats, each an array per zone-stat-idx, with child_count
+	 * entries per zone, one for every server. Stats per zone is the add
+	 * of [0][zoneidx*child_count+i] and [1][zoneidx*child_count+i]. */
 	struct nsdst* zonestat[2];
 	/* fd for zonestat mapping (otherwise mmaps cannot be shared between
 	 * processes and resized) */
 	int zonestatfd[2];
 	/* filenames */
 	char* zonestatfname[2];
-	/* size of the mmapped zone stat array (number of array entries) */
+	/* size of the mmapped zone stat array (number of zones) */
 	size_t zonestatsize[2], zonestatdesired, zonestatsizenow;
 	/* current zonestat array to use */
 	struct nsdst* zonestatnow;
+	/* the entry of this server in the zonestats of a zone */
+	size_t zonestat_child;
 	/* filenames for stat file mappings */
 	char* statfname;
 	/* fd for stat mapping (otherwise mmaps cannot be shared between
@@ -342,6 +425,19 @@ struct	nsd
 	int stat_current;
 	/* start value for per process statistics printout, to clear it */
 	struct nsdst stat_proc;
+	/* heavy hitters, child_count*2 after the stat_map, or NULL if
+	 * top-statistics is off */
+	struct topstat* topstat_map;
+	/* the queries of the cached responses of the servers, child_count*2
+	 * after the topstat_map, for reload-prewarm, or NULL */
+	struct respcache_handover* respcache_handover_map;
+	/* the number of running servers, for nsd-control status, after the
+	 * respcache_handover_map in the stat file */
+	uint32_t* stat_active_children;
+	/* heavy hitters of this server process, NULL in other processes */
+	struct topstat* topstat;
+	/* the metrics process, or -1 */
+	pid_t metrics_pid;
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
 	/* the dnstap collector process info */
@@ -356,6 +452,8 @@ struct	nsd
 	 * simultaneous with new serve childs. */
 	int *dt_collector_fd_swap;
 #endif /* USE_DNSTAP */
+	/* timing of the reload in progress, NULL outside of the reload */
+	struct reload_stats* reload_stats;
 	/* the pipes from the serve processes to xfrd, for passing through
 	 * NOTIFY messages, arrays of size child_count * 2.
 	 * Kept open for (re-)forks. */
@@ -372,6 +470,9 @@ struct	nsd
 
 	/* do answer with server cookie when request contained cookie option */
 	int do_answer_cookie;
+	/* the server reads full UDP batches, for udp-shed, the queries
+	 * without a valid cookie are shed */
+	int udp_overloaded;
 
 	/* how many cookies are there in the cookies array */
 	size_t cookie_count;
@@ -379,6 +480,8 @@ struct	nsd
 	/* keep track of the last `NSD_COOKIE_HISTORY_SIZE`
 	 * cookies as per rfc requirement .*/
 	cookie_secrets_type cookie_secrets;
+	/* the SipHash keys of the cookie secrets, see cookie_keys_setup */
+	struct siphash_key cookie_keys[NSD_COOKIE_HISTORY_SIZE];
 
 	/* From where came the configured cookies */
 	cookie_secrets_source_type cookie_secrets_source;
@@ -393,9 +496,31 @@ struct	nsd
 	/* TLS specific configuration */
 	SSL_CTX *tls_ctx;
 	SSL_CTX *tls_auth_ctx;
+	/* session ticket keys shared by the server processes, or NULL */
+	struct tls_ticket_keys* tls_ticket_keys;
 #endif
 };
 
+#ifdef HAVE_SSL
+/* the number of session ticket keys, the current one, the previous one
+ * whose tickets are still accepted, and the one that is made next */
+#define TLS_TICKET_KEYS 3
+/*
+ * The session ticket keys, in shared memory so that every server process
+ * can resume the sessions of the others. xfrd writes a new key in the slot
+ * after current and then moves current, the server processes only use the
+ * current and the previous key.
+ */
+struct tls_ticket_keys {
+	volatile uint32_t current;
+	struct tls_ticket_key {
+		uint8_t name[16];
+		uint8_t aes[32];
+		uint8_t hmac[32];
+	} key[TLS_TICKET_KEYS];
+};
+#endif
+
 extern struct nsd nsd;
 
 /* nsd.c */
@@ -412,6 +537,13 @@ void server_main(struct nsd *nsd);
 void server_child(struct nsd *nsd);
 void server_shutdown(struct nsd *nsd) ATTR_NORETURN;
 void server_close_all_sockets(struct nsd_socket sockets[], size_t n);
+/* the socket passed by the old nsd on the socket-handoff, that is bound to
+ * the address, of the socktype, or -1 if there is none */
+int server_handoff_take(struct sockaddr* addr, int socktype);
+/* close the unused sockets of the old nsd, and open the socket-handoff */
+int server_handoff_listen(struct nsd *nsd);
+/* pass the socket over the socket-handoff, returns 1 if done */
+int server_handoff_send_fd(int s, int fd);
 const char* nsd_event_vs(void);
 const char* nsd_event_method(void);
 struct event_base* nsd_child_event_base(void);
@@ -419,6 +551,10 @@ void service_remaining_tcp(struct nsd* nsd);
 /* extra domain numbers for temporary domains */
 #define EXTRA_DOMAIN_NUMBERS 1024
 #define SLOW_ACCEPT_TIMEOUT 2 /* in seconds */
+/* max number of connections accepted per event of a TCP socket */
+#define TCP_ACCEPT_BATCH 16
+/* max number of closed TCP handlers that are kept for new connections */
+#define TCP_HANDLER_POOL_SIZE 32
 /* ratelimit for error responses */
 #define ERROR_RATELIMIT 100 /* qps */
 /* allocate zonestat structures */
@@ -439,6 +575,8 @@ void server_send_soa_xfrd(struct nsd *nsd, int shortsoa);
 #ifdef HAVE_SSL
 SSL_CTX* server_tls_ctx_setup(char* key, char* pem, char* verifypem);
 SSL_CTX* server_tls_ctx_create(struct nsd *nsd, char* verifypem, char* ocspfile);
+/* make a new session ticket key, and make it the current one */
+void server_tls_ticket_keys_rotate(struct nsd* nsd);
 void perform_openssl_init(void);
 #endif
 ssize_t block_read(struct nsd* nsd, int s, void* p, ssize_t sz, int timeout);
@@ -10,6 +10,18 @@
 #ifdef NSEC3
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+#endif /* HAVE_MMAP */
 
 #include "nsec3.h"
 #include "iterated_hash.h"
@@ -17,8 +29,14 @@
 #include "nsd.h"
 #include "answer.h"
 #include "options.h"
+#include "fasthash.h"
 
 #define NSEC3_RDATA_BITMAP 5
+/* minimum number of names in a zone before hashing is done by workers */
+#define NSEC3_PREHASH_PARALLEL_MIN 10000
+
+/* number of worker processes that compute the hashes for a new chain */
+static int nsec3_prehash_worker_count = 1;
 
 /* compare nsec3 hashes in nsec3 tree */
 static int
@@ -612,6 +630,170 @@ nsec3_precompile_nsec3rr(namedb_type* db, struct domain* domain,
 	}
 }
 
+void
+nsec3_prehash_workers(int num)
+{
+	nsec3_prehash_worker_count = (num < 1)?1:num;
+}
+
+#ifdef HAVE_MMAP
+/* a hash to compute before the zone is precompiled */
+struct nsec3_prehash_job {
+	const dname_type* dname;
+	/* hash the wildcard below the name */
+	int wc;
+	uint8_t* store;
+};
+
+/* compute the hashes of a range of jobs into the result array */
+static void
+nsec3_prehash_range(zone_type* zone, struct nsec3_prehash_job* jobs,
+	size_t start, size_t end, uint8_t* result)
+{
+	const unsigned char* nsec3_salt = NULL;
+	int nsec3_saltlength = 0;
+	int nsec3_iterations = 0;
+	uint8_t wcard[MAXDOMAINLEN+2];
+	size_t i;
+
+	detect_nsec3_params(zone->nsec3_param, &nsec3_salt,
+		&nsec3_saltlength, &nsec3_iterations);
+	wcard[0] = 1;
+	wcard[1] = '*';
+	for(i = start; i < end; i++) {
+		const dname_type* dname = jobs[i].dname;
+		if(jobs[i].wc) {
+			memcpy(wcard+2, dname_name(dname), dname->name_size);
+			iterated_hash(result+i*NSEC3_HASH_LEN, nsec3_salt,
+				nsec3_saltlength, wcard, dname->name_size+2,
+				nsec3_iterations);
+		} else {
+			iterated_hash(result+i*NSEC3_HASH_LEN, nsec3_salt,
+				nsec3_saltlength, dname_name(dname),
+				dname->name_size, nsec3_iterations);
+		}
+	}
+}
+
+/*
+ * Compute the hashes of the jobs with worker processes, that write into
+ * a shared mapping. A range that a worker could not do is hashed here.
+ */
+static void
+nsec3_prehash_parallel(zone_type* zone, struct nsec3_prehash_job* jobs,
+	size_t num)
+{
+	size_t workers = (size_t)nsec3_prehash_worker_count, w, i;
+	pid_t* pids;
+	struct sigaction old_sigchld, dfl_sigchld;
+	uint8_t* result = mmap(NULL, num*NSEC3_HASH_LEN,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(result == MAP_FAILED) {
+		log_msg(LOG_ERR, "nsec3 prehash: mmap failed: %s",
+			strerror(errno));
+		result = xmallocarray(num, NSEC3_HASH_LEN);
+		nsec3_prehash_range(zone, jobs, 0, num, result);
+		for(i = 0; i < num; i++)
+			memcpy(jobs[i].store, result+i*NSEC3_HASH_LEN,
+				NSEC3_HASH_LEN);
+		free(result);
+		return;
+	}
+	/* the reload ignores SIGCHLD, that would reap the workers before
+	 * their exit status is collected */
+	memset(&dfl_sigchld, 0, sizeof(dfl_sigchld));
+	dfl_sigchld.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &dfl_sigchld, &old_sigchld);
+	pids = xmallocarray(workers, sizeof(pid_t));
+	for(w = 0; w < workers; w++) {
+		pids[w] = fork();
+		if(pids[w] == 0) {
+			nsec3_prehash_range(zone, jobs, w*num/workers,
+				(w+1)*num/workers, result);
+			_exit(0);
+		} else if(pids[w] == -1) {
+			log_msg(LOG_ERR, "nsec3 prehash: fork failed: %s",
+				strerror(errno));
+		}
+	}
+	for(w = 0; w < workers; w++) {
+		int status = 0;
+		if(pids[w] != -1) {
+			while(waitpid(pids[w], &status, 0) == -1) {
+				if(errno != EINTR) {
+					log_msg(LOG_ERR, "nsec3 prehash: "
+						"waitpid failed: %s",
+						strerror(errno));
+					status = -1;
+					break;
+				}
+			}
+		}
+		if(pids[w] == -1 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0) {
+			nsec3_prehash_range(zone, jobs, w*num/workers,
+				(w+1)*num/workers, result);
+		}
+	}
+	free(pids);
+	sigaction(SIGCHLD, &old_sigchld, NULL);
+	for(i = 0; i < num; i++)
+		memcpy(jobs[i].store, result+i*NSEC3_HASH_LEN, NSEC3_HASH_LEN);
+	munmap(result, num*NSEC3_HASH_LEN);
+}
+
+/*
+ * Allocate the hash nodes of the domains that the precompile of the zone
+ * is going to hash, and compute the hashes with worker processes, so that
+ * the precompile only inserts them into the trees.
+ */
+static void
+nsec3_prehash_zone(namedb_type* db, zone_type* zone, unsigned long n)
+{
+	struct nsec3_prehash_job* jobs;
+	size_t num = 0;
+	domain_type* walk;
+
+	/* at most the name, the wildcard and the ds hash, per name */
+	jobs = xmallocarray((size_t)n*3, sizeof(*jobs));
+	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
+		walk = domain_next(walk)) {
+		if(nsec3_condition_hash(walk, zone)) {
+			allocate_domain_nsec3(db->domains, walk);
+			if(!walk->nsec3->hash_wc) {
+				nsec3_hash_wc_node_type* hash_wc =
+					(nsec3_hash_wc_node_type *)region_alloc(
+					db->region, sizeof(*hash_wc));
+				hash_wc->hash.node.key = NULL;
+				hash_wc->wc.node.key = NULL;
+				walk->nsec3->hash_wc = hash_wc;
+				jobs[num].dname = domain_dname(walk);
+				jobs[num].wc = 0;
+				jobs[num++].store = hash_wc->hash.hash;
+				jobs[num].dname = domain_dname(walk);
+				jobs[num].wc = 1;
+				jobs[num++].store = hash_wc->wc.hash;
+			}
+		}
+		if(nsec3_condition_dshash(walk, zone)) {
+			allocate_domain_nsec3(db->domains, walk);
+			if(!walk->nsec3->ds_parent_hash) {
+				nsec3_hash_node_type* ds = (nsec3_hash_node_type *)
+					region_alloc(db->region, sizeof(*ds));
+				ds->node.key = NULL;
+				walk->nsec3->ds_parent_hash = ds;
+				jobs[num].dname = domain_dname(walk);
+				jobs[num].wc = 0;
+				jobs[num++].store = ds->hash;
+			}
+		}
+	}
+	if(num != 0)
+		nsec3_prehash_parallel(zone, jobs, num);
+	free(jobs);
+}
+#endif /* HAVE_MMAP */
+
 void
 nsec3_precompile_newparam(namedb_type* db, zone_type* zone)
 {
@@ -628,6 +810,12 @@ nsec3_precompile_newparam(namedb_type* db, zone_type* zone)
 			nsec3_precompile_nsec3rr(db, walk, zone);
 		}
 	}
+#ifdef HAVE_MMAP
+	/* large zones are hashed by workers, the precompile below then
+	 * finds the hashes present and only adds them to the trees */
+	if(nsec3_prehash_worker_count > 1 && n >= NSEC3_PREHASH_PARALLEL_MIN)
+		nsec3_prehash_zone(db, zone, n);
+#endif
 	/* hash and precompile zone */
 	for(walk=zone->apex; walk && domain_is_subdomain(walk, zone->apex);
 		walk = domain_next(walk)) {
@@ -881,7 +1069,180 @@ nsec3_add_rrset(struct query* query, struct answer* answer,
 	}
 }
 
-/* this routine does hashing at query-time. slow. */
+/*
+ * The next closer names that were hashed at query time, with their cover.
+ * A direct mapped table per process that answers queries; the zone data
+ * does not change while it answers, so the zone, NSEC3PARAM and cover
+ * pointers stay valid, and it is cleared when a server process starts
+ * and when the reload process answers the verifiers.
+ */
+#define NSEC3_NEXT_CLOSER_CACHE_SIZE 1024
+struct nsec3_next_closer {
+	zone_type* zone;
+	rr_type* nsec3_param;
+	domain_type* cover;
+	uint8_t exact;
+	uint8_t hash[NSEC3_HASH_LEN];
+	uint16_t name_size;
+	uint8_t name[MAXDOMAINLEN];
+};
+static struct nsec3_next_closer* nsec3_next_closer_cache = NULL;
+
+/*
+ * The NSEC3 chain of a zone as a sorted array of the base32 hash labels
+ * and their domains, for a binary search over contiguous memory instead
+ * of a walk down the nsec3tree. It is made per process that answers
+ * queries, for the zones that need a cover at query time, and emptied
+ * with the next closer cache.
+ */
+#define NSEC3_COVER_INDEX_SIZE 64
+#define NSEC3_B32_LEN 32
+struct nsec3_cover_index {
+	zone_type* zone;
+	/* the nsec3tree the index is made from */
+	rbtree_type* tree;
+	size_t count;
+	/* the first label of the NSEC3 owner names, in tree order */
+	uint8_t* labels;
+	domain_type** domains;
+};
+static struct nsec3_cover_index* nsec3_cover_index = NULL;
+
+void
+nsec3_next_closer_cache_clear(void)
+{
+	size_t i;
+	free(nsec3_next_closer_cache);
+	nsec3_next_closer_cache = NULL;
+	if(!nsec3_cover_index)
+		return;
+	for(i = 0; i < NSEC3_COVER_INDEX_SIZE; i++) {
+		free(nsec3_cover_index[i].labels);
+		free(nsec3_cover_index[i].domains);
+	}
+	free(nsec3_cover_index);
+	nsec3_cover_index = NULL;
+}
+
+/* get the cover index of the zone, it is made if it does not exist */
+static struct nsec3_cover_index*
+nsec3_cover_index_get(zone_type* zone)
+{
+	struct nsec3_cover_index* e;
+	rbnode_type* n;
+	size_t i = 0;
+
+	if(!nsec3_cover_index)
+		nsec3_cover_index = xalloc_array_zero(NSEC3_COVER_INDEX_SIZE,
+			sizeof(*nsec3_cover_index));
+	e = &nsec3_cover_index[(((size_t)zone)>>4) % NSEC3_COVER_INDEX_SIZE];
+	if(e->zone == zone && e->tree == zone->nsec3tree)
+		return e;
+	free(e->labels);
+	free(e->domains);
+	e->zone = zone;
+	e->tree = zone->nsec3tree;
+	e->count = zone->nsec3tree->count;
+	e->labels = xalloc_array_zero(e->count ? e->count : 1,
+		NSEC3_B32_LEN);
+	e->domains = xalloc_array_zero(e->count ? e->count : 1,
+		sizeof(*e->domains));
+	RBTREE_FOR(n, rbnode_type*, zone->nsec3tree) {
+		domain_type* d = (domain_type*)n->key;
+		assert(dname_name(domain_dname(d))[0] == NSEC3_B32_LEN);
+		memcpy(e->labels + i*NSEC3_B32_LEN,
+			dname_name(domain_dname(d))+1, NSEC3_B32_LEN);
+		e->domains[i] = d;
+		i++;
+	}
+	assert(i == e->count);
+	return e;
+}
+
+/* nsec3_find_cover, with a binary search in the cover index */
+static int
+nsec3_find_cover_indexed(zone_type* zone, uint8_t* hash,
+	domain_type** result)
+{
+	struct nsec3_cover_index* e;
+	char b32[NSEC3_B32_LEN+1];
+	size_t lo = 0, hi, mid;
+
+	assert(zone->nsec3_param && zone->nsec3tree);
+	e = nsec3_cover_index_get(zone);
+	b32_ntop(hash, NSEC3_HASH_LEN, b32, sizeof(b32));
+	/* find the first label that is larger than the hash */
+	hi = e->count;
+	while(lo < hi) {
+		mid = lo + (hi-lo)/2;
+		if(memcmp(e->labels + mid*NSEC3_B32_LEN, b32,
+			NSEC3_B32_LEN) <= 0)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	if(lo == 0) {
+		*result = zone->nsec3_last;
+		return 0;
+	}
+	*result = e->domains[lo-1];
+	return memcmp(e->labels + (lo-1)*NSEC3_B32_LEN, b32,
+		NSEC3_B32_LEN) == 0;
+}
+
+/* hash the next closer name and find its cover, return 1 on an exact
+ * match, that is a hash collision */
+static int
+nsec3_hash_next_closer(zone_type* zone, const dname_type* to_prove,
+	uint8_t* hash, domain_type** cover)
+{
+	struct nsec3_next_closer* e;
+	uint32_t h;
+
+	if(!nsec3_next_closer_cache)
+		nsec3_next_closer_cache = xalloc_array_zero(
+			NSEC3_NEXT_CLOSER_CACHE_SIZE,
+			sizeof(*nsec3_next_closer_cache));
+	h = fasthash32(dname_name(to_prove), to_prove->name_size,
+		fasthash32(&zone, sizeof(zone), 0));
+	e = &nsec3_next_closer_cache[h % NSEC3_NEXT_CLOSER_CACHE_SIZE];
+	if(e->zone == zone && e->nsec3_param == zone->nsec3_param &&
+		e->name_size == to_prove->name_size &&
+		memcmp(e->name, dname_name(to_prove), e->name_size) == 0) {
+		memcpy(hash, e->hash, NSEC3_HASH_LEN);
+		*cover = e->cover;
+		return e->exact;
+	}
+	nsec3_hash_and_store(zone, to_prove, hash);
+	e->exact = (uint8_t)nsec3_find_cover_indexed(zone, hash, cover);
+	e->zone = zone;
+	e->nsec3_param = zone->nsec3_param;
+	e->cover = *cover;
+	memcpy(e->hash, hash, NSEC3_HASH_LEN);
+	e->name_size = (uint16_t)to_prove->name_size;
+	memcpy(e->name, dname_name(to_prove), e->name_size);
+	return e->exact;
+}
+
+domain_type*
+nsec3_next_closer_cover(zone_type* zone, const dname_type* qname,
+	domain_type* closest_encloser)
+{
+	/* the next closer name, with its label offsets */
+	uint8_t buf[sizeof(dname_type) + MAXDOMAINLEN*2];
+	uint8_t hash[NSEC3_HASH_LEN];
+	domain_type* cover = NULL;
+	const dname_type* to_prove;
+	if(!zone->nsec3_param)
+		return NULL;
+	to_prove = dname_partial_copy_into(buf, qname,
+		dname_label_match_count(qname, domain_dname(closest_encloser))+1);
+	if(nsec3_hash_next_closer(zone, to_prove, hash, &cover))
+		return NULL;
+	return cover;
+}
+
+/* this routine does hashing at query-time, unless the next closer name
+ * was hashed recently. */
 static void
 nsec3_add_nonexist_proof(struct query* query, struct answer* answer,
         struct domain* encloser, const dname_type* qname)
@@ -895,8 +1256,7 @@ nsec3_add_nonexist_proof(struct query* query, struct answer* answer,
 	to_prove = dname_partial_copy(query->region, qname,
 		dname_label_match_count(qname, domain_dname(encloser))+1);
 	/* generate proof that one label below closest encloser does not exist */
-	nsec3_hash_and_store(query->zone, to_prove, hash);
-	if(nsec3_find_cover(query->zone, hash, sizeof(hash), &cover))
+	if(nsec3_hash_next_closer(query->zone, to_prove, hash, &cover))
 	{
 		/* exact match, hash collision */
 		domain_type* walk;
@@ -938,6 +1298,12 @@ nsec3_add_nonexist_proof(struct query* query, struct answer* answer,
 	{
 		/* cover proves the qname does not exist */
 		nsec3_add_rrset(query, answer, AUTHORITY_SECTION, cover);
+		/* the response cache keys the answer on this cover, that
+		 * is the same for all names below the encloser that hash
+		 * into it */
+		if(query->rcache_nsec3_cover && query->rcache_nsec3_cover != cover)
+			query->rcache_closest_match = NULL;
+		query->rcache_nsec3_cover = cover;
 	}
 }
 
@@ -1107,9 +1473,9 @@ domain_has_only_NSEC3(struct domain* domain, struct zone* zone)
 	{
 		if(!zone || rrset->zone == zone)
 		{
-			if(rrset->rrs[0].type == TYPE_NSEC3)
+			if(rrset->type == TYPE_NSEC3)
 				nsec3_seen = 1;
-			else if(rrset->rrs[0].type != TYPE_RRSIG)
+			else if(rrset->type != TYPE_RRSIG)
 				return 0;
 		}
 		rrset = rrset->next;
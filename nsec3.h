@@ -99,6 +99,17 @@ void nsec3_precompile_domain(struct namedb* db, struct domain* domain,
 /* hash ds_parent_cover, and lookup nsec3 and precompile */
 void nsec3_precompile_domain_ds(struct namedb* db, struct domain* domain,
 	struct zone* zone);
+/* set the number of worker processes that hash large zones, default 1 */
+void nsec3_prehash_workers(int num);
+/* the NSEC3 that covers the hash of the next closer name of qname below
+ * the closest encloser, or NULL if the zone has no NSEC3 or on a hash
+ * collision. Used as key for answers that depend on that proof. */
+struct domain* nsec3_next_closer_cover(struct zone* zone,
+	const struct dname* qname, struct domain* closest_encloser);
+/* empty the cache of next closer hashes, and the sorted arrays of the
+ * NSEC3 chains, when the process starts to answer queries from a
+ * database that may have changed */
+void nsec3_next_closer_cache_clear(void);
 /* put nsec3 into nsec3tree and adjust zonelast */
 void nsec3_precompile_nsec3rr(struct namedb* db, struct domain* domain,
 	struct zone* zone);
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <ctype.h>
 #ifdef HAVE_IFADDRS_H
 #include <ifaddrs.h>
 #endif
@@ -58,6 +59,7 @@ nsd_options_create(region_type* region)
 	opt->zone_options = rbtree_create(region,
 		(int (*)(const void *, const void *)) dname_compare);
 	opt->configfile = NULL;
+	opt->zonelist_batch = 0;
 	opt->zonestatnames = rbtree_create(opt->region, rbtree_strcmp);
 	opt->patterns = rbtree_create(region, rbtree_strcmp);
 	opt->keys = rbtree_create(region, rbtree_strcmp);
@@ -83,14 +85,40 @@ nsd_options_create(region_type* region)
 	opt->log_time_iso = 0;
 	opt->round_robin = 0; /* also packet.h::round_robin */
 	opt->minimal_responses = 0; /* also packet.h::minimal_responses */
+	opt->response_cache_size = 0;
+	opt->axfr_cache_size = 0;
+	opt->xfr_out_limit = 0;
+	opt->xfr_out_zone_limit = 0;
+	opt->xfr_out_client_limit = 0;
+	opt->xfr_out_rate = 0;
+	opt->use_huge_pages = 0;
+	opt->numa_interleave = 0;
+	opt->latency_statistics = 0;
+	opt->query_trace = 0;
+	opt->query_trace_min = 0;
+	opt->udp_queue_statistics = 0;
+	opt->top_statistics = 0;
+	opt->metrics_enable = 0;
+	opt->metrics_interface = NULL;
+	opt->metrics_port = 9154;
+	opt->reload_prewarm = 0;
+	opt->memory_lock = "no";
+	opt->socket_handoff = NULL;
 	opt->confine_to_zone = 0;
 	opt->refuse_any = 0;
 	opt->server_count = 1;
+	opt->server_count_min = 0;
+	opt->server_count_load = 10000;
 	opt->cpu_affinity = NULL;
 	opt->service_cpu_affinity = NULL;
+	opt->cpu_affinity_auto = 0;
 	opt->tcp_count = 100;
 	opt->tcp_reject_overflow = 0;
+	opt->tcp_evict_idle = 0;
+	opt->tcp_source_limit = 0;
 	opt->tcp_query_count = 0;
+	opt->tcp_pipeline = 0;
+	opt->tcp_zerocopy = 0;
 	opt->tcp_timeout = TCP_TIMEOUT;
 	opt->tcp_mss = 0;
 	opt->outgoing_tcp_mss = 0;
@@ -100,8 +128,31 @@ nsd_options_create(region_type* region)
 	opt->port = UDP_PORT;
 /* deprecated?	opt->port = TCP_PORT; */
 	opt->reuseport = 0;
+	opt->reuseport_steering = "no";
+	opt->udp_gso = 0;
+	opt->busy_poll = 0;
+	opt->busy_poll_idle = 100;
+	opt->udp_batch_latency = 0;
+	opt->udp_drain = 0;
+	opt->udp_shed = 0;
+	opt->udp_shed_drop = 0;
+	opt->udp_shed_allow = NULL;
+	opt->xdp_interface = NULL;
+	opt->xdp_ratelimit = 0;
+#ifdef XDP_PROGRAM_PATH
+	opt->xdp_program_path = XDP_PROGRAM_PATH;
+#else
+	opt->xdp_program_path = NULL;
+#endif
 	opt->xfrd_tcp_max = 128;
 	opt->xfrd_tcp_pipeline = 128;
+	opt->xfrd_udp_sockets = 0;
+	opt->xfrd_tcp_per_primary = 0;
+	opt->xfrd_tcp_idle = 0;
+	opt->notify_coalesce_time = 0;
+	opt->xfrd_state_journal = 0;
+	opt->xfrd_xfr_shm = 0;
+	opt->xfrd_xfr_compress = 0;
 	opt->statistics = 0;
 	opt->chroot = 0;
 	opt->username = USER;
@@ -114,6 +165,7 @@ nsd_options_create(region_type* region)
 	opt->rrl_slip = RRL_SLIP;
 	opt->rrl_ipv4_prefix_length = RRL_IPV4_PREFIX_LENGTH;
 	opt->rrl_ipv6_prefix_length = RRL_IPV6_PREFIX_LENGTH;
+	opt->rrl_shared_buckets = 0;
 #  ifdef RATELIMIT_DEFAULT_OFF
 	opt->rrl_ratelimit = 0;
 	opt->rrl_whitelist_ratelimit = 0;
@@ -137,11 +189,20 @@ nsd_options_create(region_type* region)
 	opt->dnstap_version = NULL;
 	opt->dnstap_log_auth_query_messages = 0;
 	opt->dnstap_log_auth_response_messages = 0;
+	opt->dnstap_sample_rate = 1;
+	opt->dnstap_filters = NULL;
 #endif
 	opt->reload_config = 0;
 	opt->zonefiles_check = 1;
+	opt->zonefiles_hash = 0;
+	opt->rdata_dedup = 0;
+	opt->reload_compact = 0;
 	opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
+	opt->zonefiles_write_workers = 1;
+	opt->zonefiles_sync = 0;
+	opt->ixfr_memory_budget = 0;
 	opt->xfrd_reload_timeout = 1;
+	opt->catalog_producer_batch = 0;
 	opt->tls_service_key = NULL;
 	opt->tls_service_ocsp = NULL;
 	opt->tls_service_pem = NULL;
@@ -149,6 +210,9 @@ nsd_options_create(region_type* region)
 	opt->tls_auth_port = NULL;
 	opt->tls_cert_bundle = NULL;
 	opt->tls_auth_xfr_only = 0;
+	opt->tls_session_ticket_rotate = 3600;
+	opt->tls_ktls = 0;
+	opt->tls_async = 0;
 	opt->proxy_protocol_port = NULL;
 	opt->answer_cookie = 0;
 	opt->cookie_secret = NULL;
@@ -236,6 +300,8 @@ parse_options_file(struct nsd_options* opt, const char* file,
 	cfg_parser->opt = opt;
 	cfg_parser->pattern = NULL;
 	cfg_parser->zone = NULL;
+	cfg_parser->zone_pattern = NULL;
+	cfg_parser->zone_has_options = 0;
 	cfg_parser->key = NULL;
 	cfg_parser->tls_auth = NULL;
 
@@ -523,6 +589,9 @@ parse_zone_list_file(struct nsd_options* opt)
 	*/
 	char hdr[64];
 	char buf[1024];
+	/* offset of the line in buf, kept here instead of with an ftello
+	 * for every line, that is a lot of calls for large zonelists */
+	off_t off, lineoff;
 	
 	/* create empty data structures */
 	opt->zonefree = rbtree_create(opt->region, comp_zonebucket);
@@ -550,9 +619,12 @@ parse_zone_list_file(struct nsd_options* opt)
 		return 0;
 	}
 	buf[sizeof(buf)-1]=0;
+	off = (off_t)strlen(ZONELIST_HEADER);
 
 	/* read entries in file */
 	while(fgets(buf, sizeof(buf), opt->zonelist)) {
+		lineoff = off;
+		off += (off_t)strlen(buf);
 		/* skip comments and empty lines */
 		if(buf[0] == 0 || buf[0] == '\n' || buf[0] == '#')
 			continue;
@@ -578,7 +650,7 @@ parse_zone_list_file(struct nsd_options* opt)
 			/* store offset and line size for zone entry */
 			/* and create zone entry in zonetree */
 			(void)zone_list_member_zone_insert(opt, nm, patnm,
-				linesize, ftello(opt->zonelist)-linesize,
+				linesize, lineoff,
 				NULL, NULL);
 
 		} else if(strncmp(buf, "cat ", 4) == 0) {
@@ -610,21 +682,20 @@ parse_zone_list_file(struct nsd_options* opt)
 			/* store offset and line size for zone entry */
 			/* and create zone entry in zonetree */
 			(void)zone_list_member_zone_insert(opt, nm, patnm,
-				linesize, ftello(opt->zonelist)-linesize,
+				linesize, lineoff,
 				mem_idnm, NULL);
 
 		} else if(strncmp(buf, "del ", 4) == 0) {
 			/* store offset and line size for deleted entry */
 			int linesize = strlen(buf);
-			zone_list_free_insert(opt, linesize,
-				ftello(opt->zonelist)-linesize);
+			zone_list_free_insert(opt, linesize, lineoff);
 		} else {
 			log_msg(LOG_WARNING, "bad data in %s, '%s'", opt->zonelistfile,
 				buf);
 		}
 	}
 	/* store EOF offset */
-	opt->zonelist_off = ftello(opt->zonelist);
+	opt->zonelist_off = off;
 	return 1;
 }
 
@@ -658,6 +729,17 @@ zone_options_delete(struct nsd_options* opt, struct zone_options* zone)
 }
 
 
+/* flush the zonelist file, unless the changes are batched */
+static void
+zone_list_flush(struct nsd_options* opt)
+{
+	if(opt->zonelist_batch)
+		return;
+	if(fflush(opt->zonelist) != 0) {
+		log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
+	}
+}
+
 /* add a new zone to the zonelist */
 struct zone_options*
 zone_list_add_or_cat(struct nsd_options* opt, const char* zname,
@@ -727,17 +809,17 @@ zone_list_add_or_cat(struct nsd_options* opt, const char* zname,
 		opt->zonelist_off = ftello(opt->zonelist);
 		if(opt->zonelist_off == -1)
 			log_msg(LOG_ERR, "ftello(%s): %s", opt->zonelistfile, strerror(errno));
-		if(fflush(opt->zonelist) != 0) {
-			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
-		}
+		zone_list_flush(opt);
 		return zone;
 	}
 	b = (struct zonelist_bucket*)rbtree_search(opt->zonefree,
 		&zone->linesize);
 	if(!b || b->list == NULL) {
-		/* no empty place, append to file */
+		/* no empty place, append to file, the seek is skipped when
+		 * the file is already there, it would flush a batch */
 		zone->off = opt->zonelist_off;
-		if(fseeko(opt->zonelist, zone->off, SEEK_SET) == -1) {
+		if(ftello(opt->zonelist) != zone->off &&
+			fseeko(opt->zonelist, zone->off, SEEK_SET) == -1) {
 			log_msg(LOG_ERR, "fseeko(%s): %s", opt->zonelistfile, strerror(errno));
 			log_msg(LOG_ERR, "zone %s could not be added", zname);
 			zone_options_delete(opt, zone);
@@ -755,9 +837,7 @@ zone_list_add_or_cat(struct nsd_options* opt, const char* zname,
 			return NULL;
 		}
 		opt->zonelist_off += zone->linesize;
-		if(fflush(opt->zonelist) != 0) {
-			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
-		}
+		zone_list_flush(opt);
 		return zone;
 	}
 	/* reuse empty spot */
@@ -780,9 +860,7 @@ zone_list_add_or_cat(struct nsd_options* opt, const char* zname,
 		zone_options_delete(opt, zone);
 		return NULL;
 	}
-	if(fflush(opt->zonelist) != 0) {
-		log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
-	}
+	zone_list_flush(opt);
 
 	/* snip off and recycle element */
 	b->list = e->next;
@@ -816,12 +894,30 @@ zone_list_del(struct nsd_options* opt, struct zone_options* zone)
 	zone_options_delete(opt, zone);
 
 	/* see if we need to compact: it is going to halve the zonelist */
+	if(opt->zonefree_number > opt->zone_options->count &&
+		!opt->zonelist_batch) {
+		zone_list_compact(opt);
+	} else {
+		zone_list_flush(opt);
+	}
+}
+
+void
+zone_list_batch_start(struct nsd_options* opt)
+{
+	opt->zonelist_batch = 1;
+}
+
+void
+zone_list_batch_end(struct nsd_options* opt)
+{
+	opt->zonelist_batch = 0;
+	if(!opt->zonelist)
+		return;
 	if(opt->zonefree_number > opt->zone_options->count) {
 		zone_list_compact(opt);
 	} else {
-		if(fflush(opt->zonelist) != 0) {
-			log_msg(LOG_ERR, "fflush %s: %s", opt->zonelistfile, strerror(errno));
-		}
+		zone_list_flush(opt);
 	}
 }
 /* postorder delete of zonelist free space tree */
@@ -1110,6 +1206,10 @@ pattern_options_create(region_type* region)
 	p->min_expire_time_expr = EXPIRE_TIME_IS_DEFAULT;
 #ifdef RATELIMIT
 	p->rrl_whitelist = 0;
+	p->rrl_ratelimit = 0;
+	p->rrl_ratelimit_is_default = 1;
+	p->rrl_type_limits = 0;
+	memset(p->rrl_type_ratelimit, 0, sizeof(p->rrl_type_ratelimit));
 #endif
 	p->multi_primary_check = 0;
 	p->store_ixfr = 0;
@@ -1120,6 +1220,16 @@ pattern_options_create(region_type* region)
 	p->ixfr_number_is_default = 1;
 	p->create_ixfr = 0;
 	p->create_ixfr_is_default = 1;
+	p->ixfr_binary = 0;
+	p->ixfr_binary_is_default = 1;
+	p->ixfr_compress = 0;
+	p->ixfr_compress_is_default = 1;
+	p->ixfr_condense = 0;
+	p->ixfr_condense_is_default = 1;
+	p->precompile_wire = 1;
+	p->precompile_wire_is_default = 1;
+	p->transfer_priority = 0;
+	p->transfer_priority_is_default = 1;
 	p->verify_zone = VERIFY_ZONE_INHERIT;
 	p->verify_zone_is_default = 1;
 	p->verifier = NULL;
@@ -1130,10 +1240,171 @@ pattern_options_create(region_type* region)
 	p->catalog_role = CATALOG_ROLE_INHERIT;
 	p->catalog_role_is_default = 1;
 	p->catalog_member_pattern = NULL;
+	p->catalog_member_shard = 0;
+	p->catalog_member_shards = 0;
 	p->catalog_producer_zone = NULL;
 	return p;
 }
 
+/* acl lists with at least this many elements get a prefix trie */
+#define ACL_TRIE_MIN 16
+
+/* node in the acl prefix trie, indexes are 0 for none */
+struct acl_trie_node {
+	/* the next node for a 0 bit and a 1 bit */
+	uint32_t child[2];
+	/* first element whose prefix ends at this node */
+	uint32_t ent;
+};
+
+/* acl element in the trie, chained in list order */
+struct acl_trie_ent {
+	struct acl_options* acl;
+	/* the position of the element in the acl list */
+	int number;
+	uint32_t next;
+};
+
+/*
+ * Compiled form of a long acl list. Single addresses and subnets are
+ * stored by their address bits, so that a lookup visits at most 32 or
+ * 128 nodes. Mask and min-max ranges are kept on the rest chain.
+ */
+struct acl_trie {
+	struct acl_trie_node* nodes;
+	uint32_t num_nodes;
+	/* element 0 is unused */
+	struct acl_trie_ent* ents;
+	uint32_t num_ents;
+	/* chain of elements that are checked one by one */
+	uint32_t rest;
+};
+
+/* root nodes of the acl trie, these are never a child */
+#define ACL_TRIE_ROOT4 0
+#define ACL_TRIE_ROOT6 1
+
+static void
+acl_trie_delete(region_type* region, struct acl_trie* t)
+{
+	region_recycle(region, t->nodes, t->num_nodes*sizeof(*t->nodes));
+	region_recycle(region, t->ents, t->num_ents*sizeof(*t->ents));
+	region_recycle(region, t, sizeof(*t));
+}
+
+/* number of prefix bits of the acl element, or -1 if not a prefix */
+static int
+acl_prefix_bits(struct acl_options* acl)
+{
+	size_t i, len = acl->is_ipv6?16:4;
+	uint8_t* mask = (uint8_t*)&acl->range_mask;
+	int bits = 0;
+	if(acl->rangetype == acl_range_single)
+		return (int)len*8;
+	if(acl->rangetype != acl_range_subnet)
+		return -1;
+	for(i=0; i<len && mask[i] == 0xff; i++)
+		bits += 8;
+	if(i<len) {
+		uint8_t m = mask[i];
+		while(m & 0x80) {
+			bits++;
+			m <<= 1;
+		}
+	}
+	return bits;
+}
+
+static void
+acl_trie_append(struct acl_trie* t, uint32_t* chain, uint32_t e)
+{
+	while(*chain)
+		chain = &t->ents[*chain].next;
+	*chain = e;
+}
+
+static void
+acl_list_compile(region_type* region, struct acl_options* list)
+{
+	struct acl_options* acl;
+	struct acl_trie_node* nodes;
+	struct acl_trie t;
+	uint32_t cap = 64, n, e;
+	int number = 0, bits, i;
+
+	if(!list || list->trie)
+		return;
+	for(acl = list; acl; acl = acl->next) {
+		/* tls-auth checks have to see every element */
+		if(acl->tls_auth_name)
+			return;
+		number++;
+	}
+	if(number < ACL_TRIE_MIN)
+		return;
+
+	memset(&t, 0, sizeof(t));
+	t.num_ents = (uint32_t)number+1;
+	t.ents = (struct acl_trie_ent*)xalloc_array_zero(t.num_ents,
+		sizeof(*t.ents));
+	nodes = (struct acl_trie_node*)xalloc_array_zero(cap,
+		sizeof(*nodes));
+	t.num_nodes = 2; /* the roots */
+	for(acl = list, e = 1; acl; acl = acl->next, e++) {
+		uint8_t* a = (uint8_t*)&acl->addr;
+		t.ents[e].acl = acl;
+		t.ents[e].number = (int)e-1;
+		if((bits = acl_prefix_bits(acl)) == -1) {
+			acl_trie_append(&t, &t.rest, e);
+			continue;
+		}
+		n = acl->is_ipv6?ACL_TRIE_ROOT6:ACL_TRIE_ROOT4;
+		for(i=0; i<bits; i++) {
+			int bit = (a[i/8] >> (7-(i%8))) & 1;
+			if(!nodes[n].child[bit]) {
+				if(t.num_nodes == cap) {
+					nodes = (struct acl_trie_node*)
+						xrealloc(nodes, cap*2*
+						sizeof(*nodes));
+					memset(nodes+cap, 0,
+						cap*sizeof(*nodes));
+					cap *= 2;
+				}
+				nodes[n].child[bit] = t.num_nodes++;
+			}
+			n = nodes[n].child[bit];
+		}
+		acl_trie_append(&t, &nodes[n].ent, e);
+	}
+
+	list->trie = (struct acl_trie*)region_alloc(region,
+		sizeof(*list->trie));
+	*list->trie = t;
+	list->trie->nodes = (struct acl_trie_node*)region_alloc_array_init(
+		region, nodes, t.num_nodes, sizeof(*nodes));
+	list->trie->ents = (struct acl_trie_ent*)region_alloc_array_init(
+		region, t.ents, t.num_ents, sizeof(*t.ents));
+	free(nodes);
+	free(t.ents);
+}
+
+void
+pattern_options_compile_acls(region_type* region, struct pattern_options* p)
+{
+	acl_list_compile(region, p->allow_notify);
+	acl_list_compile(region, p->provide_xfr);
+	acl_list_compile(region, p->allow_query);
+}
+
+void
+nsd_options_compile_acls(struct nsd_options* opt)
+{
+	struct pattern_options* p;
+	RBTREE_FOR(p, struct pattern_options*, opt->patterns) {
+		pattern_options_compile_acls(opt->region, p);
+	}
+}
+
 static void
 acl_delete(region_type* region, struct acl_options* acl)
 {
@@ -1154,6 +1425,8 @@ static void
 acl_list_delete(region_type* region, struct acl_options* list)
 {
 	struct acl_options* n;
+	if(list && list->trie)
+		acl_trie_delete(region, list->trie);
 	while(list) {
 		n = list->next;
 		acl_delete(region, list);
@@ -1218,6 +1491,7 @@ copy_acl(region_type* region, struct acl_options* a)
 	b->next = NULL;
 	b->key_options = NULL;
 	b->tls_auth_options = NULL;
+	b->trie = NULL;
 	return b;
 }
 
@@ -1316,6 +1590,11 @@ copy_pat_fixed(region_type* region, struct pattern_options* orig,
 	orig->min_expire_time_expr = p->min_expire_time_expr;
 #ifdef RATELIMIT
 	orig->rrl_whitelist = p->rrl_whitelist;
+	orig->rrl_ratelimit = p->rrl_ratelimit;
+	orig->rrl_ratelimit_is_default = p->rrl_ratelimit_is_default;
+	orig->rrl_type_limits = p->rrl_type_limits;
+	memmove(orig->rrl_type_ratelimit, p->rrl_type_ratelimit,
+		sizeof(orig->rrl_type_ratelimit));
 #endif
 	orig->multi_primary_check = p->multi_primary_check;
 	orig->store_ixfr = p->store_ixfr;
@@ -1326,6 +1605,16 @@ copy_pat_fixed(region_type* region, struct pattern_options* orig,
 	orig->ixfr_number_is_default = p->ixfr_number_is_default;
 	orig->create_ixfr = p->create_ixfr;
 	orig->create_ixfr_is_default = p->create_ixfr_is_default;
+	orig->ixfr_binary = p->ixfr_binary;
+	orig->ixfr_binary_is_default = p->ixfr_binary_is_default;
+	orig->ixfr_compress = p->ixfr_compress;
+	orig->ixfr_compress_is_default = p->ixfr_compress_is_default;
+	orig->ixfr_condense = p->ixfr_condense;
+	orig->ixfr_condense_is_default = p->ixfr_condense_is_default;
+	orig->precompile_wire = p->precompile_wire;
+	orig->precompile_wire_is_default = p->precompile_wire_is_default;
+	orig->transfer_priority = p->transfer_priority;
+	orig->transfer_priority_is_default = p->transfer_priority_is_default;
 	orig->verify_zone = p->verify_zone;
 	orig->verify_zone_is_default = p->verify_zone_is_default;
 	orig->verifier_timeout = p->verifier_timeout;
@@ -1338,6 +1627,8 @@ copy_pat_fixed(region_type* region, struct pattern_options* orig,
 		orig->catalog_member_pattern =
 			region_strdup(region, p->catalog_member_pattern);
 	else orig->catalog_member_pattern = NULL;
+	orig->catalog_member_shard = p->catalog_member_shard;
+	orig->catalog_member_shards = p->catalog_member_shards;
 	if(p->catalog_producer_zone)
 		orig->catalog_producer_zone =
 			region_strdup(region, p->catalog_producer_zone);
@@ -1381,6 +1672,7 @@ pattern_options_add_modify(struct nsd_options* opt, struct pattern_options* p)
 			p->outgoing_interface);
 		copy_changed_verifier(opt, &orig->verifier, p->verifier);
 	}
+	pattern_options_compile_acls(opt->region, orig);
 }
 
 struct pattern_options*
@@ -1454,6 +1746,12 @@ pattern_options_equal(struct pattern_options* p, struct pattern_options* q)
 		q->min_expire_time_expr)) return 0;
 #ifdef RATELIMIT
 	if(p->rrl_whitelist != q->rrl_whitelist) return 0;
+	if(p->rrl_ratelimit != q->rrl_ratelimit) return 0;
+	if(!booleq(p->rrl_ratelimit_is_default,
+		q->rrl_ratelimit_is_default)) return 0;
+	if(p->rrl_type_limits != q->rrl_type_limits) return 0;
+	if(memcmp(p->rrl_type_ratelimit, q->rrl_type_ratelimit,
+		sizeof(p->rrl_type_ratelimit)) != 0) return 0;
 #endif
 	if(!booleq(p->multi_primary_check,q->multi_primary_check)) return 0;
 	if(p->size_limit_xfr != q->size_limit_xfr) return 0;
@@ -1465,6 +1763,17 @@ pattern_options_equal(struct pattern_options* p, struct pattern_options* q)
 	if(!booleq(p->ixfr_number_is_default,q->ixfr_number_is_default)) return 0;
 	if(!booleq(p->create_ixfr,q->create_ixfr)) return 0;
 	if(!booleq(p->create_ixfr_is_default,q->create_ixfr_is_default)) return 0;
+	if(!booleq(p->ixfr_binary,q->ixfr_binary)) return 0;
+	if(!booleq(p->ixfr_binary_is_default,q->ixfr_binary_is_default)) return 0;
+	if(!booleq(p->ixfr_compress,q->ixfr_compress)) return 0;
+	if(!booleq(p->ixfr_compress_is_default,q->ixfr_compress_is_default)) return 0;
+	if(!booleq(p->ixfr_condense,q->ixfr_condense)) return 0;
+	if(!booleq(p->ixfr_condense_is_default,q->ixfr_condense_is_default)) return 0;
+	if(!booleq(p->precompile_wire,q->precompile_wire)) return 0;
+	if(!booleq(p->precompile_wire_is_default,q->precompile_wire_is_default)) return 0;
+	if(p->transfer_priority != q->transfer_priority) return 0;
+	if(!booleq(p->transfer_priority_is_default,
+		q->transfer_priority_is_default)) return 0;
 	if(p->verify_zone != q->verify_zone) return 0;
 	if(!booleq(p->verify_zone_is_default,
 		q->verify_zone_is_default)) return 0;
@@ -1484,6 +1793,8 @@ pattern_options_equal(struct pattern_options* p, struct pattern_options* q)
 	else if(p->catalog_member_pattern && q->catalog_member_pattern) {
 		if(strcmp(p->catalog_member_pattern, q->catalog_member_pattern) != 0) return 0;
 	}
+	if(p->catalog_member_shard != q->catalog_member_shard) return 0;
+	if(p->catalog_member_shards != q->catalog_member_shards) return 0;
 	if(!p->catalog_producer_zone && q->catalog_producer_zone) return 0;
 	else if(p->catalog_producer_zone && !q->catalog_producer_zone) return 0;
 	else if(p->catalog_producer_zone && q->catalog_producer_zone) {
@@ -1591,6 +1902,7 @@ unmarshal_acl(region_type* r, struct buffer* b)
 	acl->next = NULL;
 	acl->key_options = NULL;
 	acl->tls_auth_options = NULL;
+	acl->trie = NULL;
 	acl->ip_address_spec = unmarshal_str(r, b);
 	acl->key_name = unmarshal_str(r, b);
 	acl->tls_auth_name = unmarshal_str(r, b);
@@ -1669,11 +1981,19 @@ unmarshal_strv(region_type* r, struct buffer* b)
 void
 pattern_options_marshal(struct buffer* b, struct pattern_options* p)
 {
+#ifdef RATELIMIT
+	int i;
+#endif
 	marshal_str(b, p->pname);
 	marshal_str(b, p->zonefile);
 	marshal_str(b, p->zonestats);
 #ifdef RATELIMIT
 	marshal_u16(b, p->rrl_whitelist);
+	marshal_u32(b, p->rrl_ratelimit);
+	marshal_u8(b, p->rrl_ratelimit_is_default);
+	marshal_u16(b, p->rrl_type_limits);
+	for(i=0; i<RRL_TYPES; i++)
+		marshal_u32(b, p->rrl_type_ratelimit[i]);
 #endif
 	marshal_u8(b, p->allow_axfr_fallback);
 	marshal_u8(b, p->allow_axfr_fallback_is_default);
@@ -1706,6 +2026,16 @@ pattern_options_marshal(struct buffer* b, struct pattern_options* p)
 	marshal_u8(b, p->ixfr_number_is_default);
 	marshal_u8(b, p->create_ixfr);
 	marshal_u8(b, p->create_ixfr_is_default);
+	marshal_u8(b, p->ixfr_binary);
+	marshal_u8(b, p->ixfr_binary_is_default);
+	marshal_u8(b, p->ixfr_compress);
+	marshal_u8(b, p->ixfr_compress_is_default);
+	marshal_u8(b, p->ixfr_condense);
+	marshal_u8(b, p->ixfr_condense_is_default);
+	marshal_u8(b, p->precompile_wire);
+	marshal_u8(b, p->precompile_wire_is_default);
+	marshal_u32(b, p->transfer_priority);
+	marshal_u8(b, p->transfer_priority_is_default);
 	marshal_u8(b, p->verify_zone);
 	marshal_u8(b, p->verify_zone_is_default);
 	marshal_strv(b, p->verifier);
@@ -1716,6 +2046,8 @@ pattern_options_marshal(struct buffer* b, struct pattern_options* p)
 	marshal_u8(b, p->catalog_role);
 	marshal_u8(b, p->catalog_role_is_default);
 	marshal_str(b, p->catalog_member_pattern);
+	marshal_u32(b, p->catalog_member_shard);
+	marshal_u32(b, p->catalog_member_shards);
 	marshal_str(b, p->catalog_producer_zone);
 }
 
@@ -1723,11 +2055,19 @@ struct pattern_options*
 pattern_options_unmarshal(region_type* r, struct buffer* b)
 {
 	struct pattern_options* p = pattern_options_create(r);
+#ifdef RATELIMIT
+	int i;
+#endif
 	p->pname = unmarshal_str(r, b);
 	p->zonefile = unmarshal_str(r, b);
 	p->zonestats = unmarshal_str(r, b);
 #ifdef RATELIMIT
 	p->rrl_whitelist = unmarshal_u16(b);
+	p->rrl_ratelimit = unmarshal_u32(b);
+	p->rrl_ratelimit_is_default = unmarshal_u8(b);
+	p->rrl_type_limits = unmarshal_u16(b);
+	for(i=0; i<RRL_TYPES; i++)
+		p->rrl_type_ratelimit[i] = unmarshal_u32(b);
 #endif
 	p->allow_axfr_fallback = unmarshal_u8(b);
 	p->allow_axfr_fallback_is_default = unmarshal_u8(b);
@@ -1760,6 +2100,16 @@ pattern_options_unmarshal(region_type* r, struct buffer* b)
 	p->ixfr_number_is_default = unmarshal_u8(b);
 	p->create_ixfr = unmarshal_u8(b);
 	p->create_ixfr_is_default = unmarshal_u8(b);
+	p->ixfr_binary = unmarshal_u8(b);
+	p->ixfr_binary_is_default = unmarshal_u8(b);
+	p->ixfr_compress = unmarshal_u8(b);
+	p->ixfr_compress_is_default = unmarshal_u8(b);
+	p->ixfr_condense = unmarshal_u8(b);
+	p->ixfr_condense_is_default = unmarshal_u8(b);
+	p->precompile_wire = unmarshal_u8(b);
+	p->precompile_wire_is_default = unmarshal_u8(b);
+	p->transfer_priority = unmarshal_u32(b);
+	p->transfer_priority_is_default = unmarshal_u8(b);
 	p->verify_zone = unmarshal_u8(b);
 	p->verify_zone_is_default = unmarshal_u8(b);
 	p->verifier = unmarshal_strv(r, b);
@@ -1770,6 +2120,8 @@ pattern_options_unmarshal(region_type* r, struct buffer* b)
 	p->catalog_role = unmarshal_u8(b);
 	p->catalog_role_is_default = unmarshal_u8(b);
 	p->catalog_member_pattern = unmarshal_str(r, b);
+	p->catalog_member_shard = unmarshal_u32(b);
+	p->catalog_member_shards = unmarshal_u32(b);
 	p->catalog_producer_zone = unmarshal_str(r, b);
 	return p;
 }
@@ -1953,6 +2305,70 @@ acl_check_incoming_block_proxy(struct acl_options* acl, struct query* q,
 	return 0;
 }
 
+static void
+acl_trie_check_chain(struct acl_trie* t, uint32_t e, struct query* q,
+	struct acl_trie_ent** match, struct acl_trie_ent** block)
+{
+	for(; e; e = t->ents[e].next) {
+		struct acl_trie_ent* ent = &t->ents[e];
+		/* also checks the port */
+		if(!acl_addr_matches(ent->acl, q) ||
+			!acl_key_matches(ent->acl, q))
+			continue;
+		if(!*match || ent->number < (*match)->number)
+			*match = ent;
+		if(ent->acl->blocked &&
+			(!*block || ent->number < (*block)->number))
+			*block = ent;
+	}
+}
+
+/* same result as the list walk in acl_check_incoming */
+static int
+acl_trie_check(struct acl_trie* t, struct query* q,
+	struct acl_options** reason)
+{
+	struct acl_trie_ent* match = NULL, *block = NULL;
+	uint8_t* a = NULL;
+	uint32_t n = 0;
+	int i, bits = 0;
+#ifdef INET6
+	if(q->client_addr.ss_family == AF_INET6) {
+		a = (uint8_t*)&((struct sockaddr_in6*)&q->client_addr)->
+			sin6_addr;
+		n = ACL_TRIE_ROOT6;
+		bits = 128;
+	} else if(q->client_addr.ss_family == AF_INET) {
+#else
+	if(q->client_addr.sin_family == AF_INET) {
+#endif
+		a = (uint8_t*)&((struct sockaddr_in*)&q->client_addr)->
+			sin_addr;
+		n = ACL_TRIE_ROOT4;
+		bits = 32;
+	}
+	if(a) {
+		for(i=0; ; i++) {
+			acl_trie_check_chain(t, t->nodes[n].ent, q, &match,
+				&block);
+			if(i == bits)
+				break;
+			n = t->nodes[n].child[(a[i/8] >> (7-(i%8))) & 1];
+			if(!n)
+				break;
+		}
+	}
+	acl_trie_check_chain(t, t->rest, q, &match, &block);
+	if(block) {
+		if(reason)
+			*reason = block->acl;
+		return -1;
+	}
+	if(reason)
+		*reason = match?match->acl:NULL;
+	return match?match->number:-1;
+}
+
 int
 acl_check_incoming(struct acl_options* acl, struct query* q,
 	struct acl_options** reason)
@@ -1965,6 +2381,8 @@ acl_check_incoming(struct acl_options* acl, struct query* q,
 	int number = 0;
 	struct acl_options* match = 0;
 
+	if(acl && acl->trie)
+		return acl_trie_check(acl->trie, q, reason);
 	if(reason)
 		*reason = NULL;
 
@@ -2675,6 +3093,7 @@ parse_acl_info(region_type* region, char* ip, const char* key)
 	acl->key_options = 0;
 	acl->tls_auth_options = 0;
 	acl->tls_auth_name = 0;
+	acl->trie = 0;
 	acl->is_ipv6 = 0;
 	acl->port = 0;
 	memset(&acl->addr, 0, sizeof(union acl_addr_storage));
@@ -2769,6 +3188,9 @@ config_apply_pattern(struct pattern_options *dest, const char* name)
 	/* find the pattern */
 	struct pattern_options* pat = pattern_options_find(cfg_parser->opt,
 		name);
+#ifdef RATELIMIT
+	int i;
+#endif
 	if(!pat) {
 		c_error("could not find pattern %s", name);
 		return;
@@ -2837,9 +3259,38 @@ config_apply_pattern(struct pattern_options *dest, const char* name)
 		dest->create_ixfr = pat->create_ixfr;
 		dest->create_ixfr_is_default = 0;
 	}
+	if(!pat->ixfr_binary_is_default) {
+		dest->ixfr_binary = pat->ixfr_binary;
+		dest->ixfr_binary_is_default = 0;
+	}
+	if(!pat->ixfr_compress_is_default) {
+		dest->ixfr_compress = pat->ixfr_compress;
+		dest->ixfr_compress_is_default = 0;
+	}
+	if(!pat->ixfr_condense_is_default) {
+		dest->ixfr_condense = pat->ixfr_condense;
+		dest->ixfr_condense_is_default = 0;
+	}
+	if(!pat->precompile_wire_is_default) {
+		dest->precompile_wire = pat->precompile_wire;
+		dest->precompile_wire_is_default = 0;
+	}
+	if(!pat->transfer_priority_is_default) {
+		dest->transfer_priority = pat->transfer_priority;
+		dest->transfer_priority_is_default = 0;
+	}
 	dest->size_limit_xfr = pat->size_limit_xfr;
 #ifdef RATELIMIT
 	dest->rrl_whitelist |= pat->rrl_whitelist;
+	if(!pat->rrl_ratelimit_is_default) {
+		dest->rrl_ratelimit = pat->rrl_ratelimit;
+		dest->rrl_ratelimit_is_default = 0;
+	}
+	for(i=0; i<RRL_TYPES; i++) {
+		if((pat->rrl_type_limits & (1<<i)))
+			dest->rrl_type_ratelimit[i] = pat->rrl_type_ratelimit[i];
+	}
+	dest->rrl_type_limits |= pat->rrl_type_limits;
 #endif
 	/* append acl items */
 	copy_and_append_acls(&dest->allow_notify, pat->allow_notify);
@@ -2893,11 +3344,64 @@ config_apply_pattern(struct pattern_options *dest, const char* name)
 	if(pat->catalog_member_pattern)
 		dest->catalog_member_pattern = region_strdup(
 			cfg_parser->opt->region, pat->catalog_member_pattern);
+	if(pat->catalog_member_shards) {
+		dest->catalog_member_shard = pat->catalog_member_shard;
+		dest->catalog_member_shards = pat->catalog_member_shards;
+	}
 	if(pat->catalog_producer_zone)
 		dest->catalog_producer_zone = region_strdup(
 			cfg_parser->opt->region, pat->catalog_producer_zone);
 }
 
+void
+config_zone_include_pattern(const char* name)
+{
+	struct pattern_options* pat;
+	if(!cfg_parser->zone_has_options && !cfg_parser->zone_pattern) {
+		/* keep it back, if there are no other options the zone
+		 * uses the pattern itself. Catalog producer patterns are
+		 * applied, so that config_apply_pattern gives the error */
+		pat = pattern_options_find(cfg_parser->opt, name);
+		if(pat && !pat->catalog_producer_zone) {
+			cfg_parser->zone_pattern = pat;
+			return;
+		}
+	}
+	config_zone_option();
+	config_apply_pattern(cfg_parser->pattern, name);
+}
+
+void
+config_zone_option(void)
+{
+	if(cfg_parser->zone_pattern) {
+		config_apply_pattern(cfg_parser->pattern,
+			cfg_parser->zone_pattern->pname);
+		cfg_parser->zone_pattern = NULL;
+	}
+	cfg_parser->zone_has_options = 1;
+}
+
+int
+config_zone_use_pattern(void)
+{
+	struct pattern_options* implicit = cfg_parser->pattern;
+	if(!cfg_parser->zone_pattern || cfg_parser->zone_has_options)
+		return 0;
+	/* the zone is the apex and a reference to the pattern, the
+	 * implicit pattern is not needed, and its memory is reused for
+	 * the next zone */
+	if(implicit->pname)
+		region_recycle(cfg_parser->opt->region, (void*)implicit->pname,
+			strlen(implicit->pname)+1);
+	region_recycle(cfg_parser->opt->region, implicit,
+		sizeof(struct pattern_options));
+	cfg_parser->zone->pattern = cfg_parser->zone_pattern;
+	cfg_parser->pattern = NULL;
+	cfg_parser->zone_pattern = NULL;
+	return 1;
+}
+
 void
 nsd_options_destroy(struct nsd_options* opt)
 {
@@ -3121,3 +3625,82 @@ sockaddr_uses_proxy_protocol_port(struct nsd_options* options,
 	}
 	return 0;
 }
+
+/* rcodes by name for the dnstap filter rules */
+static lookup_table_type dnstap_filter_rcodes[] = {
+	{ RCODE_OK, "NOERROR" },
+	{ RCODE_FORMAT, "FORMERR" },
+	{ RCODE_SERVFAIL, "SERVFAIL" },
+	{ RCODE_NXDOMAIN, "NXDOMAIN" },
+	{ RCODE_IMPL, "NOTIMP" },
+	{ RCODE_REFUSE, "REFUSED" },
+	{ RCODE_YXDOMAIN, "YXDOMAIN" },
+	{ RCODE_YXRRSET, "YXRRSET" },
+	{ RCODE_NXRRSET, "NXRRSET" },
+	{ RCODE_NOTAUTH, "NOTAUTH" },
+	{ RCODE_NOTZONE, "NOTZONE" },
+	{ 0, NULL }
+};
+
+struct dnstap_filter*
+dnstap_filter_parse(region_type* region, const char* spec)
+{
+	struct dnstap_filter* f;
+	char buf[1024], *item, *val, *p = buf;
+	if(strlcpy(buf, spec, sizeof(buf)) >= sizeof(buf))
+		return NULL;
+	f = (struct dnstap_filter*)region_alloc_zero(region, sizeof(*f));
+	f->rcode = -1;
+	f->qtype = -1;
+	f->transport = -1;
+	while(*p) {
+		/* the items are separated by whitespace */
+		if(isspace((unsigned char)*p)) {
+			p++;
+			continue;
+		}
+		item = p;
+		while(*p && !isspace((unsigned char)*p))
+			p++;
+		if(*p)
+			*p++ = 0;
+		if(!(val = strchr(item, '=')))
+			return NULL;
+		*val++ = 0;
+		if(strcmp(item, "zone") == 0) {
+			if(!(f->zone = dname_parse(region, val)))
+				return NULL;
+		} else if(strcmp(item, "rcode") == 0) {
+			lookup_table_type* rc = lookup_by_name(
+				dnstap_filter_rcodes, val);
+			if(rc)
+				f->rcode = rc->id;
+			else if(isdigit((unsigned char)*val) && atoi(val) < 16)
+				f->rcode = atoi(val);
+			else	return NULL;
+		} else if(strcmp(item, "qtype") == 0) {
+			if((f->qtype = rrtype_from_string(val)) == 0)
+				return NULL;
+		} else if(strcmp(item, "transport") == 0) {
+			if(strcasecmp(val, "udp") == 0)
+				f->transport = 0;
+			else if(strcasecmp(val, "tcp") == 0)
+				f->transport = 1;
+			else	return NULL;
+		} else {
+			return NULL;
+		}
+	}
+	f->spec = region_strdup(region, spec);
+	return f;
+}
+
+void
+dnstap_filter_append(struct nsd_options* opt, struct dnstap_filter* f)
+{
+	struct dnstap_filter** p = &opt->dnstap_filters;
+	while(*p)
+		p = &(*p)->next;
+	f->next = NULL;
+	*p = f;
+}
@@ -22,8 +22,12 @@ struct tsig_key;
 struct buffer;
 struct nsd;
 struct proxy_protocol_port_list;
+struct acl_trie;
 
 
+/* number of rrl types, the bits of enum rrl_type in rrl.h */
+#define RRL_TYPES 9
+
 typedef struct nsd_options nsd_options_type;
 typedef struct pattern_options pattern_options_type;
 typedef struct zone_options zone_options_type;
@@ -62,6 +66,9 @@ struct nsd_options {
 	FILE* zonelist;
 	/* last offset in file (or 0 if none) */
 	off_t zonelist_off;
+	/* set while zonelist changes are batched, the file is flushed, and
+	 * compacted if needed, at the end of the batch */
+	int zonelist_batch;
 
 	/* tree of zonestat names and their id values, entries are struct
 	 * zonestatname with malloced key=stringname. The number of items
@@ -94,12 +101,28 @@ struct nsd_options {
 	const char* logfile;
 	int log_only_syslog;
 	int server_count;
+	/* run between this many and server_count servers, by the load,
+	 * 0 runs all of them */
+	int server_count_min;
+	/* queries per second per server above which a server is added */
+	int server_count_load;
 	struct cpu_option* cpu_affinity;
 	struct cpu_map_option* service_cpu_affinity;
+	/* place the servers and xfrd on cpus from the topology */
+	int cpu_affinity_auto;
 	int tcp_count;
 	int tcp_reject_overflow;
+	/* close the least recently used idle tcp connection when full */
+	int tcp_evict_idle;
+	/* maximum tcp connections from a source address, 0 is no limit */
+	int tcp_source_limit;
 	int confine_to_zone;
 	int tcp_query_count;
+	/* answer the queries that are read ahead on a tcp connection together */
+	int tcp_pipeline;
+	/* tcp answers of this size and larger are sent with MSG_ZEROCOPY,
+	 * or 0 when off */
+	int tcp_zerocopy;
 	int tcp_timeout;
 	int tcp_mss;
 	int outgoing_tcp_mss;
@@ -116,19 +139,115 @@ struct nsd_options {
 	const char* zonelistfile;
 	const char* nsid;
 	int xfrd_reload_timeout;
+	/* seconds to collect catalog producer member changes in one
+	 * transfer, or 0 */
+	int catalog_producer_batch;
 	int reload_config;
 	int zonefiles_check;
+	/* skip the read of zonefiles with a new mtime and the same content */
+	int zonefiles_hash;
+	/* share the rdata of RRs with the same content between zones */
+	int rdata_dedup;
+	/* percent of the database memory that is unused after changes,
+	 * above which a reload copies the database, 0 is off */
+	int reload_compact;
 	int zonefiles_write;
+	/* number of processes that write the changed zonefiles at once */
+	int zonefiles_write_workers;
+	/* sync the written zonefiles to disk, as a group */
+	int zonefiles_sync;
+	/* bytes of IXFR data kept in memory for all zones, 0 is no limit,
+	 * the older versions above it are spilled to files */
+	uint64_t ixfr_memory_budget;
 	int log_time_ascii;
 	int log_time_iso;
 	int round_robin;
 	int minimal_responses;
+	/* number of responses in the response cache of a server */
+	int response_cache_size;
+	/* bytes of AXFR packets a server keeps to answer AXFRs with */
+	size_t axfr_cache_size;
+	/* max number of AXFRs and IXFRs over TCP a server sends at the same
+	 * time, in total, for one zone and to one client, or 0 */
+	int xfr_out_limit;
+	int xfr_out_zone_limit;
+	int xfr_out_client_limit;
+	/* bytes per second a server sends in transfers, or 0 */
+	uint64_t xfr_out_rate;
+	/* keep the zone data on huge pages */
+	int use_huge_pages;
+	/* interleave the zone data over the NUMA nodes */
+	int numa_interleave;
+	/* keep histograms of the time it takes to answer queries */
+	int latency_statistics;
+	/* log the time of the stages of one in this many queries, 0 is off,
+	 * if they took at least query_trace_min usec */
+	int query_trace;
+	int query_trace_min;
+	/* count the kernel drops and time the queue of the UDP sockets */
+	int udp_queue_statistics;
+	/* keep the heavy hitter query names, sources and zones */
+	int top_statistics;
+	/* serve the statistics over HTTP for Prometheus */
+	int metrics_enable;
+	/* address for the metrics, NULL is 127.0.0.1 */
+	char* metrics_interface;
+	int metrics_port;
+	/* new server processes answer the heavy hitters of the old ones */
+	int reload_prewarm;
+	/* lock the database in memory, "no", "hot" or "all" */
+	char* memory_lock;
+	/* unix socket to pass the listening sockets to a new nsd, or NULL */
+	const char* socket_handoff;
 	int refuse_any;
 	int reuseport;
+	/* steer the queries to the reuseport sockets, "no", "cpu" or
+	 * "prefix" */
+	char* reuseport_steering;
+	/* send the answers to the same client together with UDP_SEGMENT */
+	int udp_gso;
+	/* usec for SO_BUSY_POLL, and spin on the UDP sockets, 0 is off */
+	int busy_poll;
+	/* msec without queries after which the busy poll sleeps */
+	int busy_poll_idle;
+	/* usec target for the answer of the first query of a UDP batch,
+	 * the batch size adapts to it, 0 is the fixed batch */
+	int udp_batch_latency;
+	/* read the other UDP sockets of the server that have queries after
+	 * the one that woke it up */
+	int udp_drain;
+	/* shed the UDP queries without a valid cookie in overload */
+	int udp_shed;
+	/* drop the shed queries, instead of the truncated answer */
+	int udp_shed_drop;
+	/* the sources that are not shed */
+	struct acl_options* udp_shed_allow;
+	/* interface to serve UDP queries on with AF_XDP, or NULL */
+	char* xdp_interface;
+	/* XDP program object that redirects DNS packets to AF_XDP */
+	char* xdp_program_path;
+	/* packets per second per source prefix that the XDP program lets
+	 * through, 0 is no limit */
+	int xdp_ratelimit;
 	/* max number of xfrd tcp sockets */
 	int xfrd_tcp_max;
 	/* max number of simultaneous requests on xfrd tcp socket */
 	int xfrd_tcp_pipeline;
+	/* number of shared xfrd udp sockets for SOA and IXFR queries, or 0 */
+	int xfrd_udp_sockets;
+	/* max number of xfrd tcp sockets to one primary, or 0 */
+	int xfrd_tcp_per_primary;
+	/* seconds an xfrd tcp socket without transfers is kept open, or 0 */
+	int xfrd_tcp_idle;
+	/* seconds a server does not pass the same NOTIFY to xfrd again */
+	int notify_coalesce_time;
+	/* seconds between appends of zone state changes to the journal of
+	 * the xfrdfile, or 0 */
+	int xfrd_state_journal;
+	/* keep the received zone transfers in shared memory, not xfrdir */
+	int xfrd_xfr_shm;
+	/* compress the packets of the received zone transfers with LZ4 */
+	int xfrd_xfr_compress;
 
 	/* private key file for TLS */
 	char* tls_service_key;
@@ -144,6 +263,13 @@ struct nsd_options {
 	const char* tls_cert_bundle;
 	/* Answer XFR only from tls_auth_port and after authentication */
 	int tls_auth_xfr_only;
+	/* seconds between rotations of the shared session ticket keys,
+	 * 0 leaves the ticket keys to the TLS library */
+	int tls_session_ticket_rotate;
+	/* hand the TLS record crypto to the kernel after the handshake */
+	int tls_ktls;
+	/* run the TLS handshakes as async jobs, for an async crypto engine */
+	int tls_async;
 
 	/* proxy protocol port list */
 	struct proxy_protocol_port_list* proxy_protocol_port;
@@ -173,6 +299,8 @@ struct nsd_options {
 	/** ip prefix length */
 	size_t rrl_ipv4_prefix_length;
 	size_t rrl_ipv6_prefix_length;
+	/** one rrl hashtable shared by all servers */
+	int rrl_shared_buckets;
 	/** max qps for whitelisted queries, 0 is nolimit */
 	size_t rrl_whitelist_ratelimit;
 #endif
@@ -204,6 +332,10 @@ struct nsd_options {
 	int dnstap_log_auth_query_messages;
 	/** true to log dnstap AUTH_RESPONSE message events */
 	int dnstap_log_auth_response_messages;
+	/** log one in this number of queries with dnstap, 0 for none */
+	int dnstap_sample_rate;
+	/** queries that match one of these are always logged with dnstap */
+	struct dnstap_filter* dnstap_filters;
 
 	/** do answer with server cookie when request contained cookie option */
 	int answer_cookie;
@@ -247,6 +379,8 @@ struct ip_address_option {
 	struct range_option* servers;
 	int dev;
 	int fib;
+	/* serve the udp socket with io_uring */
+	int io_uring;
 };
 
 struct cpu_option {
@@ -287,6 +421,10 @@ struct pattern_options {
 	const char* zonestats;
 #ifdef RATELIMIT
 	uint16_t rrl_whitelist; /* bitmap with rrl types */
+	uint32_t rrl_ratelimit; /* qps for the zone, 0 is nolimit */
+	uint8_t rrl_ratelimit_is_default;
+	uint16_t rrl_type_limits; /* bitmap with rrl types that have a qps */
+	uint32_t rrl_type_ratelimit[RRL_TYPES]; /* qps per rrl type */
 #endif
 	uint8_t allow_axfr_fallback;
 	uint8_t allow_axfr_fallback_is_default;
@@ -318,6 +456,16 @@ struct pattern_options {
 	uint8_t ixfr_number_is_default;
 	uint8_t create_ixfr;
 	uint8_t create_ixfr_is_default;
+	uint8_t ixfr_binary;
+	uint8_t ixfr_binary_is_default;
+	uint8_t ixfr_compress;
+	uint8_t ixfr_compress_is_default;
+	uint8_t ixfr_condense;
+	uint8_t ixfr_condense_is_default;
+	uint8_t precompile_wire;
+	uint8_t precompile_wire_is_default;
+	uint32_t transfer_priority;
+	uint8_t transfer_priority_is_default;
 	uint8_t verify_zone;
 	uint8_t verify_zone_is_default;
 	char **verifier;
@@ -328,6 +476,10 @@ struct pattern_options {
 	uint8_t catalog_role;
 	uint8_t catalog_role_is_default;
 	const char* catalog_member_pattern;
+	/* only the member zones with a hash in this shard of the shards are
+	 * served, or all of them if shards is 0 */
+	uint32_t catalog_member_shard;
+	uint32_t catalog_member_shards;
 	const char* catalog_producer_zone;
 } ATTR_PACKED;
 
@@ -346,7 +498,8 @@ struct zone_options {
 	off_t off;
 	int linesize;
 	/* pattern for the zone options, if zone is part_of_config, this is
-	 * a anonymous pattern created in-place */
+	 * a anonymous pattern created in-place, unless the zone only has an
+	 * include-pattern, then it is that pattern */
 	struct pattern_options* pattern;
 	/* zone is fixed into the main config, not in zonelist, cannot delete */
 	unsigned part_of_config        : 1;
@@ -413,6 +566,9 @@ struct acl_options {
 	/* tls_auth for XoT */
 	const char* tls_auth_name;
 	struct tls_auth_options* tls_auth_options;
+
+	/* compiled lookup of the list that starts here, or NULL */
+	struct acl_trie* trie;
 } ATTR_PACKED;
 
 /*
@@ -444,6 +600,17 @@ struct proxy_protocol_port_list {
 	int port;
 };
 
+/* dnstap filter rule, the items that are given must all match */
+struct dnstap_filter {
+	struct dnstap_filter* next;
+	/* the rule as it was given */
+	char* spec;
+	/* zone apex, or NULL for any zone */
+	const struct dname* zone;
+	/* rcode, qtype and transport (0 udp, 1 tcp), -1 for any */
+	int rcode, qtype, transport;
+};
+
 /** zone list free space */
 struct zonelist_free {
 	struct zonelist_free* next;
@@ -475,6 +642,11 @@ struct config_parser_state {
 	struct nsd_options* opt;
 	struct pattern_options *pattern;
 	struct zone_options *zone;
+	/* the include-pattern of the zone, if it is the only option of the
+	 * zone so far; then the zone uses that pattern and no implicit one */
+	struct pattern_options *zone_pattern;
+	/* if the zone has other options than name and that include-pattern */
+	int zone_has_options;
 	struct key_options *key;
 	struct tls_auth_options *tls_auth;
 	struct ip_address_option *ip;
@@ -512,6 +684,11 @@ struct pattern_options* pattern_options_create(region_type* region);
 struct pattern_options* pattern_options_find(struct nsd_options* opt, const char* name);
 int pattern_options_equal(struct pattern_options* p, struct pattern_options* q);
 void pattern_options_remove(struct nsd_options* opt, const char* name);
+/* compile the long allow-notify, provide-xfr and allow-query lists into
+ * prefix tries, for faster acl_check_incoming */
+void pattern_options_compile_acls(region_type* region,
+	struct pattern_options* p);
+void nsd_options_compile_acls(struct nsd_options* opt);
 void pattern_options_add_modify(struct nsd_options* opt,
 	struct pattern_options* p);
 void pattern_options_marshal(struct buffer* buffer, struct pattern_options* p);
@@ -529,6 +706,12 @@ void key_options_desetup(region_type* region, struct key_options* key);
 struct tls_auth_options* tls_auth_options_create(region_type* region);
 void tls_auth_options_insert(struct nsd_options* opt, struct tls_auth_options* auth);
 struct tls_auth_options* tls_auth_options_find(struct nsd_options* opt, const char* name);
+/* parse a dnstap filter rule, like "zone=example.com rcode=NXDOMAIN
+ * qtype=A transport=udp", returns NULL on a syntax error */
+struct dnstap_filter* dnstap_filter_parse(region_type* region,
+	const char* spec);
+/* add the dnstap filter rule at the end of the list */
+void dnstap_filter_append(struct nsd_options* opt, struct dnstap_filter* f);
 /* read in zone list file. Returns false on failure */
 int parse_zone_list_file(struct nsd_options* opt);
 /* create (potential) catalog producer member entry and add to the zonelist */
@@ -543,6 +726,9 @@ struct zone_options* zone_list_zone_insert(struct nsd_options* opt,
 	const char* nm, const char* patnm);
 void zone_list_del(struct nsd_options* opt, struct zone_options* zone);
 void zone_list_compact(struct nsd_options* opt);
+/* batch the zonelist changes until zone_list_batch_end, for bulk changes */
+void zone_list_batch_start(struct nsd_options* opt);
+void zone_list_batch_end(struct nsd_options* opt);
 void zone_list_close(struct nsd_options* opt);
 
 /* create zonestat name tree , for initially created zones */
@@ -631,6 +817,14 @@ void nsd_options_destroy(struct nsd_options* opt);
 void replace_str(char* buf, size_t len, const char* one, const char* two);
 /* apply pattern to the existing pattern in the parser */
 void config_apply_pattern(struct pattern_options *dest, const char* name);
+/* include-pattern in a zone clause, the first one is kept back until the
+ * zone has other options, so zones with only an include-pattern use it */
+void config_zone_include_pattern(const char* name);
+/* an option in a zone clause, applies the kept back include-pattern */
+void config_zone_option(void);
+/* end of a zone clause, makes the zone use the kept back include-pattern
+ * instead of its implicit pattern, returns 1 if it did */
+int config_zone_use_pattern(void);
 /* if the file is a directory, print a warning, because flex just exit()s
  * when a fileread fails because it is a directory, helps the user figure
  * out what just happened */
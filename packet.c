@@ -14,6 +14,7 @@
 #include "packet.h"
 #include "query.h"
 #include "rdata.h"
+#include "probes.h"
 
 int round_robin = 0;
 int minimal_responses = 0;
@@ -46,6 +47,29 @@ encode_dname(query_type *q, domain_type *domain)
 	}
 }
 
+/*
+ * The encoders write an RR and roll it back when it passes the maxlen of
+ * the query, that is room for one RR after the maxlen. Buffers smaller
+ * than that, for UDP, are checked for the worst case size of the RR
+ * first, an RR that does not fit in the buffer is also over the maxlen.
+ */
+static int
+packet_rr_fits(query_type *q, rr_type *rr)
+{
+	size_t size = MAXDOMAINLEN + 10;
+	uint16_t j;
+
+	if (buffer_remaining(q->packet) >= MAX_RR_SIZE)
+		return 1;
+	for (j = 0; j < rr->rdata_count; ++j) {
+		if (rdata_atom_is_domain(rr->type, j))
+			size += domain_dname(rdata_atom_domain(
+				rr->rdatas[j]))->name_size;
+		else	size += rdata_atom_size(rr->rdatas[j]);
+	}
+	return buffer_remaining(q->packet) >= size;
+}
+
 int
 packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 {
@@ -58,6 +82,9 @@ packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 	assert(owner);
 	assert(rr);
 
+	if (!packet_rr_fits(q, rr))
+		return 0;
+
 	/*
 	 * If the record does not in fit in the packet the packet size
 	 * will be restored to the mark.
@@ -107,6 +134,41 @@ packet_encode_rr(query_type *q, domain_type *owner, rr_type *rr, uint32_t ttl)
 	}
 }
 
+/*
+ * Encode RR i of the rrset, with the precompiled wire format of the rrset
+ * when it has one.
+ */
+static int
+packet_encode_rrset_rr(query_type *q, domain_type *owner, rrset_type *rrset,
+	uint16_t i, uint32_t ttl)
+{
+	size_t truncation_mark;
+	const uint8_t* wire;
+	size_t len;
+
+	if (!rrset->wire)
+		return packet_encode_rr(q, owner, &rrset->rrs[i], ttl);
+
+	wire = rrset_wire_rr(rrset, i, &len);
+	if (!buffer_available(q->packet, MAXDOMAINLEN + len))
+		return 0;
+	truncation_mark = buffer_position(q->packet);
+	encode_dname(q, owner);
+	buffer_write(q->packet, wire, len);
+	/* the type and class precede the ttl */
+	buffer_write_u32_at(q->packet, buffer_position(q->packet) - len + 4,
+		ttl);
+
+	if (!query_overflow(q)) {
+		return 1;
+	} else {
+		buffer_set_position(q->packet, truncation_mark);
+		query_clear_dname_offsets(q, truncation_mark);
+		assert(!query_overflow(q));
+		return 0;
+	}
+}
+
 int
 packet_encode_rrset(query_type *query,
 		    domain_type *owner,
@@ -143,11 +205,19 @@ packet_encode_rrset(query_type *query,
 
 	truncation_mark = buffer_position(query->packet);
 
+	/* An RRset that does not fit in the space that is left, not even
+	 * with all the owner names compressed, is truncated without the
+	 * encode, for large answers to clients with a small EDNS size. */
+	if (truncate_rrset && rrset->wire && truncation_mark +
+		rrset_wire_min_size(rrset, owner) >
+		query->maxlen - query->reserved_space)
+		all_added = 0;
+
 	if(do_robin && rrset->rr_count)
 		start = (uint16_t)(round_robin_off++ % rrset->rr_count);
 	else	start = 0;
-	for (i = start; i < rrset->rr_count; ++i) {
-		if (packet_encode_rr(query, owner, &rrset->rrs[i],
+	for (i = start; all_added && i < rrset->rr_count; ++i) {
+		if (packet_encode_rrset_rr(query, owner, rrset, i,
 			rrset->rrs[i].ttl)) {
 			++added;
 		} else {
@@ -156,8 +226,8 @@ packet_encode_rrset(query_type *query,
 			break;
 		}
 	}
-	for (i = 0; i < start; ++i) {
-		if (packet_encode_rr(query, owner, &rrset->rrs[i],
+	for (i = 0; all_added && i < start; ++i) {
+		if (packet_encode_rrset_rr(query, owner, rrset, i,
 			rrset->rrs[i].ttl)) {
 			++added;
 		} else {
@@ -176,8 +246,8 @@ packet_encode_rrset(query_type *query,
 			if (rr_rrsig_type_covered(&rrsig->rrs[i])
 			    == rrset_rrtype(rrset))
 			{
-				if (packet_encode_rr(query, owner,
-					&rrsig->rrs[i],
+				if (packet_encode_rrset_rr(query, owner,
+					rrsig, i,
 					rrset_rrtype(rrset)==TYPE_SOA?rrset->rrs[0].ttl:rrsig->rrs[i].ttl))
 				{
 					++added;
@@ -205,6 +275,8 @@ packet_encode_rrset(query_type *query,
 		buffer_set_position(query->packet, truncation_mark);
 		query_clear_dname_offsets(query, truncation_mark);
 		TC_SET(query->packet);
+		NSD_PROBE3(truncation, PROBE_QNAME(query), query->qtype,
+			PROBE_ZONE(query->zone));
 		added = 0;
 	}
 
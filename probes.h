@@ -0,0 +1,47 @@
+/*
+ * probes.h -- USDT static probes for dtrace, systemtap and bpftrace
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * With --enable-usdt the probes are compiled in with sys/sdt.h, as nops in
+ * the code and notes in the binary that the tracer uses to find them, eg.
+ *	bpftrace -e 'usdt:/usr/sbin/nsd:nsd:query__receive { @[arg1] = count(); }'
+ * Without it the macros expand to nothing.
+ *
+ * The probes in the provider 'nsd', and their arguments:
+ * query__receive(qname, qtype, qclass, tcp)	query parsed
+ * zone__found(qname, qtype, zone)		zone for the query found
+ * answer__encoded(qname, qtype, zone, rcode, len)	answer ready to send
+ * rrl__decision(qname, qtype, zone, limited)	rate limit checked
+ * truncation(qname, qtype, zone)		answer truncated, TC set
+ * reload__phase(phase)			reload passed a phase
+ * Names are pointers to the wire format of the name, or NULL, the phase
+ * is a string: start, tasks, verified, children, done.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+#define NSD_PROBE1(name, a) DTRACE_PROBE1(nsd, name, a)
+#define NSD_PROBE3(name, a, b, c) DTRACE_PROBE3(nsd, name, a, b, c)
+#define NSD_PROBE4(name, a, b, c, d) DTRACE_PROBE4(nsd, name, a, b, c, d)
+#define NSD_PROBE5(name, a, b, c, d, e) \
+	DTRACE_PROBE5(nsd, name, a, b, c, d, e)
+#else
+#define NSD_PROBE1(name, a) /* Nothing */
+#define NSD_PROBE3(name, a, b, c) /* Nothing */
+#define NSD_PROBE4(name, a, b, c, d) /* Nothing */
+#define NSD_PROBE5(name, a, b, c, d, e) /* Nothing */
+#endif /* USE_USDT */
+
+/* the probe arguments for the query name and the zone apex name */
+#define PROBE_QNAME(q) \
+	((q)->qname ? (const void*)dname_name((q)->qname) : NULL)
+#define PROBE_ZONE(z) ((z) && (z)->apex ? \
+	(const void*)dname_name(domain_dname((z)->apex)) : NULL)
+
+#endif /* PROBES_H */
@@ -36,6 +36,9 @@
 #include "options.h"
 #include "nsec3.h"
 #include "tsig.h"
+#include "respcache.h"
+#include "fasthash.h"
+#include "probes.h"
 
 /* [Bug #253] Adding unnecessary NS RRset may lead to undesired truncation.
  * This function determines if the final response packet needs the NS RRset
@@ -60,15 +63,21 @@ static void answer_authoritative(struct nsd	  *nsd,
 				 domain_type      *closest_encloser,
 				 const dname_type *qname);
 
+static zone_type* query_find_zone(struct nsd *nsd, domain_type* domain);
+
 static void answer_lookup_zone(struct nsd *nsd, struct query *q,
-			       answer_type *answer, size_t domain_number,
-			       int exact, domain_type *closest_match,
+			       answer_type *answer, zone_type *zone,
+			       size_t domain_number, int exact,
+			       domain_type *closest_match,
 			       domain_type *closest_encloser,
 			       const dname_type *qname);
 
 void
 query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 {
+	struct compression_entry *entries;
+	uint32_t i;
+
 	assert(q);
 	assert(domain);
 	assert(domain->number > 0);
@@ -78,19 +87,30 @@ query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 	if (q->compressed_dname_count >= MAX_COMPRESSED_DNAMES)
 		return;
 
-	q->compressed_dname_offsets[domain->number] = offset;
-	q->compressed_dnames[q->compressed_dname_count] = domain;
+	entries = q->compression->entries;
+	for (i = compression_hash(domain->number); entries[i].offset != 0;
+		i = (i + 1) & (COMPRESSION_TABLE_SIZE - 1)) {
+		/* keep the first offset, it stays valid the longest */
+		if (entries[i].number == domain->number)
+			return;
+	}
+	entries[i].number = domain->number;
+	entries[i].offset = offset;
+	q->compression->used[q->compressed_dname_count] = (uint16_t)i;
 	++q->compressed_dname_count;
 }
 
 void
 query_clear_dname_offsets(struct query *q, size_t max_offset)
 {
+	struct compression_entry *entries = q->compression->entries;
+	uint16_t *used = q->compression->used;
+
 	while (q->compressed_dname_count > 0
-	       && (q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number]
-		   >= max_offset))
+	       && entries[used[q->compressed_dname_count - 1]].offset
+		   >= max_offset)
 	{
-		q->compressed_dname_offsets[q->compressed_dnames[q->compressed_dname_count - 1]->number] = 0;
+		entries[used[q->compressed_dname_count - 1]].offset = 0;
 		--q->compressed_dname_count;
 	}
 }
@@ -98,12 +118,12 @@ query_clear_dname_offsets(struct query *q, size_t max_offset)
 void
 query_clear_compression_tables(struct query *q)
 {
+	struct compression_entry *entries = q->compression->entries;
+	uint16_t *used = q->compression->used;
 	uint16_t i;
 
-	for (i = 0; i < q->compressed_dname_count; ++i) {
-		assert(q->compressed_dnames);
-		q->compressed_dname_offsets[q->compressed_dnames[i]->number] = 0;
-	}
+	for (i = 0; i < q->compressed_dname_count; ++i)
+		entries[used[i]].offset = 0;
 	q->compressed_dname_count = 0;
 }
 
@@ -179,21 +199,34 @@ static void
 query_cleanup(void *data)
 {
 	query_type *query = (query_type *) data;
+	xfr_out_done(query);
+	/* before the buffer cleanup frees the data */
+	if(query->pp2_skip)
+		buffer_unskip_begin(query->packet, query->pp2_skip);
 	region_destroy(query->region);
 }
 
 query_type *
-query_create(region_type *region, uint16_t *compressed_dname_offsets,
-	size_t compressed_dname_size, domain_type **compressed_dnames)
+query_create(region_type *region, struct compression_table *compression,
+	size_t compressed_dname_size)
+{
+	return query_create_with_buffer(region, compression,
+		compressed_dname_size, QIOBUFSZ);
+}
+
+query_type *
+query_create_with_buffer(region_type *region,
+	struct compression_table *compression, size_t compressed_dname_size,
+	size_t bufsize)
 {
 	query_type *query
 		= (query_type *) region_alloc_zero(region, sizeof(query_type));
 	/* create region with large block size, because the initial chunk
-	   saves many mallocs in the server */
-	query->region = region_create_custom(xalloc, free, 16384, 16384/8, 32, 0);
-	query->compressed_dname_offsets = compressed_dname_offsets;
-	query->compressed_dnames = compressed_dnames;
-	query->packet = buffer_create(region, QIOBUFSZ);
+	   saves many mallocs in the server, and keep the chunks after it
+	   for the next queries */
+	query->region = region_create_arena(xalloc, free, 16384, 16384/8, 32);
+	query->compression = compression;
+	query->packet = buffer_create(region, bufsize);
 	region_add_cleanup(region, query_cleanup, query);
 	query->compressed_dname_offsets_size = compressed_dname_size;
 	tsig_create_record(&query->tsig, region);
@@ -207,9 +240,10 @@ void
 query_reset(query_type *q, size_t maxlen, int is_tcp)
 {
 	/*
-	 * As long as less than 4Kb (region block size) has been used,
-	 * this call to free_all is free, the block is saved for re-use,
-	 * so no malloc() or free() calls are done.
+	 * The region is an arena, its chunks are saved for re-use, so
+	 * unless large objects (2Kb and more) have been used, this call to
+	 * free_all only resets the region, no malloc() or free() calls are
+	 * done.
 	 * at present use of the region is for:
 	 *   o query qname dname_type (255 max).
 	 *   o wildcard expansion domain_type (7*ptr+u32+2bytes)+(5*ptr nsec3)
@@ -218,9 +252,15 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	 *     one proof per wildcard and for nx domain).
 	 */
 	region_free_all(q->region);
+	xfr_out_done(q);
 	q->remote_addrlen = (socklen_t)sizeof(q->remote_addr);
 	q->client_addrlen = (socklen_t)sizeof(q->client_addr);
 	q->is_proxied = 0;
+	q->traced = 0;
+	if(q->pp2_skip) {
+		buffer_unskip_begin(q->packet, q->pp2_skip);
+		q->pp2_skip = 0;
+	}
 	q->maxlen = maxlen;
 	q->reserved_space = 0;
 	buffer_clear(q->packet);
@@ -230,6 +270,7 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->tsig_update_it = 1;
 	q->tsig_sign_it = 1;
 	q->tcp = is_tcp;
+	q->tcp_keepalive = 0;
 	q->qname = NULL;
 	q->qtype = 0;
 	q->qclass = 0;
@@ -240,12 +281,21 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->delegation_rrset = NULL;
 	q->compressed_dname_count = 0;
 	q->number_temporary_domains = 0;
+	q->client_specific = 0;
+	q->rcache_closest_match = NULL;
+	q->rcache_closest_encloser = NULL;
+	q->rcache_wildcard = 0;
+	q->rcache_nsec3_cover = NULL;
+	q->rcache_referral = 0;
 
 	q->axfr_is_done = 0;
 	q->axfr_zone = NULL;
 	q->axfr_current_domain = NULL;
 	q->axfr_current_rrset = NULL;
 	q->axfr_current_rr = 0;
+	q->axfr_cache = NULL;
+	q->axfr_cache_packet = 0;
+	q->axfr_capture = 0;
 
 	q->ixfr_is_done = 0;
 	q->ixfr_data = NULL;
@@ -311,14 +361,14 @@ query_addtxt(struct query  *q,
 static int
 process_query_section(query_type *query)
 {
-	uint8_t qnamebuf[MAXDOMAINLEN];
-
 	buffer_set_position(query->packet, QHEADERSZ);
 	/* Lets parse the query name and convert it to lower case.  */
-	if(!packet_read_query_section(query->packet, qnamebuf,
-		&query->qtype, &query->qclass))
+	query->qname = dname_make_from_query(query->region, query->packet);
+	if(!query->qname || !buffer_available(query->packet,
+		2*sizeof(uint16_t)))
 		return 0;
-	query->qname = dname_make(query->region, qnamebuf, 1);
+	query->qtype = buffer_read_u16(query->packet);
+	query->qclass = buffer_read_u16(query->packet);
 	return 1;
 }
 
@@ -414,6 +464,54 @@ process_tsig(struct query* q)
 	return NSD_RC_OK;
 }
 
+/* the NOTIFYs that this server process passed to xfrd, per zone, for
+ * notify-coalesce-time */
+#define NOTIFY_COALESCE_SIZE 256
+struct notify_coalesce {
+	struct zone_options* zone;
+	time_t time;
+	uint32_t serial;
+	int acl_num, acl_xfr;
+};
+static struct notify_coalesce notify_coalesce[NOTIFY_COALESCE_SIZE];
+
+/* see if the same NOTIFY was passed to xfrd within notify-coalesce-time,
+ * if not, it is noted as passed. Returns true if it need not be passed.
+ * A NOTIFY without a serial is always passed, it asks for a refresh that
+ * may not be the same as the one that was passed before. */
+static int
+notify_coalesced(struct nsd* nsd, struct zone_options* zone, int has_serial,
+	uint32_t serial, int acl_num, int acl_xfr)
+{
+	struct notify_coalesce* e;
+	time_t now;
+	if(nsd->options->notify_coalesce_time <= 0 || !has_serial)
+		return 0;
+	now = time(NULL);
+	e = &notify_coalesce[fasthash32(&zone, sizeof(zone), 0) %
+		NOTIFY_COALESCE_SIZE];
+	if(e->zone == zone && e->acl_num == acl_num &&
+		e->acl_xfr == acl_xfr && e->serial == serial && now >= e->time &&
+		now - e->time < (time_t)nsd->options->notify_coalesce_time)
+		return 1;
+	e->zone = zone;
+	e->time = now;
+	e->serial = serial;
+	e->acl_num = acl_num;
+	e->acl_xfr = acl_xfr;
+	return 0;
+}
+
+/* the NOTIFY for the zone could not be passed to xfrd after all */
+static void
+notify_coalesce_forget(struct zone_options* zone)
+{
+	struct notify_coalesce* e = &notify_coalesce[fasthash32(&zone,
+		sizeof(zone), 0) % NOTIFY_COALESCE_SIZE];
+	if(e->zone == zone)
+		e->zone = NULL;
+}
+
 /*
  * Check notify acl and forward to xfrd (or return an error).
  */
@@ -470,6 +568,8 @@ answer_notify(struct nsd* nsd, struct query *query)
 		uint16_t sz;
 		uint32_t acl_send = htonl(acl_num);
 		uint32_t acl_xfr;
+		uint32_t serial = 0;
+		int has_serial;
 		size_t pos;
 
 		/* Find priority candidate for request XFR. -1 if no match */
@@ -486,25 +586,33 @@ answer_notify(struct nsd* nsd, struct query *query)
 			(why->blocked?"BLOCKED":why->key_name)));
 		if(buffer_limit(query->packet) > MAX_PACKET_SIZE)
 			return query_error(query, NSD_RC_SERVFAIL);
-		/* forward to xfrd for processing
-		   Note. Blocking IPC I/O, but acl is OK. */
-		sz = buffer_limit(query->packet)
-		   + sizeof(acl_send) + sizeof(acl_xfr);
-		sz = htons(sz);
-		if(!write_socket(s, &sz, sizeof(sz)) ||
-			!write_socket(s, buffer_begin(query->packet),
-				buffer_limit(query->packet)) ||
-			!write_socket(s, &acl_send, sizeof(acl_send)) ||
-			!write_socket(s, &acl_xfr, sizeof(acl_xfr))) {
-			log_msg(LOG_ERR, "error in IPC notify server2main, %s",
-				strerror(errno));
-			return query_error(query, NSD_RC_SERVFAIL);
+		has_serial = packet_find_notify_serial(query->packet, &serial);
+		if(notify_coalesced(nsd, zone_opt, has_serial, serial,
+			acl_num, acl_num_xfr)) {
+			/* xfrd has this one already, only answer it */
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "notify %s coalesced",
+				dname_to_string(query->qname, NULL)));
+		} else {
+			/* forward to xfrd for processing
+			   Note. Blocking IPC I/O, but acl is OK. */
+			sz = buffer_limit(query->packet)
+			   + sizeof(acl_send) + sizeof(acl_xfr);
+			sz = htons(sz);
+			if(!write_socket(s, &sz, sizeof(sz)) ||
+				!write_socket(s, buffer_begin(query->packet),
+					buffer_limit(query->packet)) ||
+				!write_socket(s, &acl_send, sizeof(acl_send)) ||
+				!write_socket(s, &acl_xfr, sizeof(acl_xfr))) {
+				log_msg(LOG_ERR, "error in IPC notify "
+					"server2main, %s", strerror(errno));
+				notify_coalesce_forget(zone_opt);
+				return query_error(query, NSD_RC_SERVFAIL);
+			}
 		}
 		if(verbosity >= 1) {
-			uint32_t serial = 0;
 			char address[128];
 			addr2str(&query->client_addr, address, sizeof(address));
-			if(packet_find_notify_serial(query->packet, &serial))
+			if(has_serial)
 			  VERBOSITY(1, (LOG_INFO, "notify for %s from %s serial %u",
 				dname_to_string(query->qname, NULL), address,
 				(unsigned)serial));
@@ -614,6 +722,29 @@ answer_chaos(struct nsd *nsd, query_type *q)
 }
 
 
+/*
+ * The covering NSEC of a domain, found once by the walk backwards over
+ * the empty non-terminals and the names below delegations, and kept in
+ * a direct mapped table. Below a delegation with a lot of glue, the walk
+ * is long, and the same denials are given over and over.
+ */
+#define NSEC_CACHE_SIZE 4096
+struct nsec_cache {
+	domain_type* domain;
+	zone_type* zone;
+	/* the owner of the covering NSEC, NULL if there is none */
+	domain_type* nsec;
+	rrset_type* rrset;
+};
+static struct nsec_cache* nsec_cache = NULL;
+
+void
+query_nsec_cache_clear(void)
+{
+	free(nsec_cache);
+	nsec_cache = NULL;
+}
+
 /*
  * Find the covering NSEC for a non-existent domain name.  Normally
  * the NSEC will be located at CLOSEST_MATCH, except when it is an
@@ -625,6 +756,7 @@ find_covering_nsec(domain_type *closest_match,
 		   zone_type   *zone,
 		   rrset_type **nsec_rrset)
 {
+	struct nsec_cache* e;
 	assert(closest_match);
 	assert(nsec_rrset);
 
@@ -635,9 +767,23 @@ find_covering_nsec(domain_type *closest_match,
 	while (closest_match->node.parent == NULL)
 #endif
 		closest_match = closest_match->parent;
+	if(!nsec_cache)
+		nsec_cache = xalloc_array_zero(NSEC_CACHE_SIZE,
+			sizeof(*nsec_cache));
+	e = &nsec_cache[(((size_t)closest_match)>>4) % NSEC_CACHE_SIZE];
+	if(e->domain == closest_match && e->zone == zone) {
+		*nsec_rrset = e->rrset;
+		return e->nsec;
+	}
+	e->domain = closest_match;
+	e->zone = zone;
+	e->nsec = NULL;
+	e->rrset = NULL;
 	while (closest_match) {
 		*nsec_rrset = domain_find_rrset(closest_match, zone, TYPE_NSEC);
 		if (*nsec_rrset) {
+			e->nsec = closest_match;
+			e->rrset = *nsec_rrset;
 			return closest_match;
 		}
 		if (closest_match == zone->apex) {
@@ -676,18 +822,123 @@ struct additional_rr_types rt_additional_rr_types[] = {
 	{ 0, (rr_section_type) 0 }
 };
 
+/*
+ * The additional rrsets for the targets of the RRs of an rrset, found once
+ * and kept in a direct mapped table. The database does not change while a
+ * process answers queries from it, and the table is cleared when it
+ * starts to, so the lists stay correct across reloads and IXFRs.
+ */
+#define ADDITIONAL_CACHE_SIZE 16384
+#define ADDITIONAL_CACHE_TYPES 4
+struct additional_target {
+	domain_type* domain;
+	/* the rrsets of the domain, for the types of the entry, or NULL */
+	rrset_type* rrsets[ADDITIONAL_CACHE_TYPES];
+};
+struct additional_cache {
+	rrset_type* rrset;
+	zone_type* zone;
+	struct additional_rr_types* types;
+	/* the targets, that have no glue if that is not allowed */
+	struct additional_target* targets;
+	size_t count;
+	/* a target is made from a wildcard, it is done per query */
+	int wildcard;
+};
+static struct additional_cache* additional_cache = NULL;
+
+void
+query_additional_cache_clear(void)
+{
+	size_t i;
+	if(!additional_cache)
+		return;
+	for(i = 0; i < ADDITIONAL_CACHE_SIZE; i++)
+		free(additional_cache[i].targets);
+	free(additional_cache);
+	additional_cache = NULL;
+}
+
+/* find the additional rrsets of the rrset, from the table, or fill the
+ * entry for it */
+static struct additional_cache*
+additional_cache_lookup(struct query *query, rrset_type *master_rrset,
+	size_t rdata_index, int allow_glue, struct additional_rr_types types[])
+{
+	struct additional_cache* e;
+	size_t i;
+	int j;
+	if(!additional_cache)
+		additional_cache = xalloc_array_zero(ADDITIONAL_CACHE_SIZE,
+			sizeof(*additional_cache));
+	e = &additional_cache[(((size_t)master_rrset)>>4) %
+		ADDITIONAL_CACHE_SIZE];
+	if(e->rrset == master_rrset && e->zone == query->zone &&
+		e->types == types)
+		return e;
+	free(e->targets);
+	e->rrset = master_rrset;
+	e->zone = query->zone;
+	e->types = types;
+	e->targets = xalloc_array_zero(master_rrset->rr_count,
+		sizeof(*e->targets));
+	e->count = 0;
+	e->wildcard = 0;
+	for (i = 0; i < master_rrset->rr_count; ++i) {
+		domain_type *additional = rdata_atom_domain(master_rrset->rrs[i].rdatas[rdata_index]);
+		domain_type *match = additional;
+		struct additional_target* t;
+
+		if (!allow_glue && domain_is_glue(match, query->zone))
+			continue;
+		while (!match->is_existing) {
+			match = match->parent;
+		}
+		if (additional != match && domain_wildcard_child(match)) {
+			e->wildcard = 1;
+			return e;
+		}
+		t = &e->targets[e->count++];
+		t->domain = additional;
+		for (j = 0; types[j].rr_type != 0; ++j) {
+			assert(j < ADDITIONAL_CACHE_TYPES);
+			t->rrsets[j] = domain_find_rrset(additional,
+				query->zone, types[j].rr_type);
+		}
+	}
+	return e;
+}
+
 static void
 add_additional_rrsets(struct query *query, answer_type *answer,
 		      rrset_type *master_rrset, size_t rdata_index,
 		      int allow_glue, struct additional_rr_types types[])
 {
 	size_t i;
+	struct additional_cache* e;
 
 	assert(query);
 	assert(answer);
 	assert(master_rrset);
 	assert(rdata_atom_is_domain(rrset_rrtype(master_rrset), rdata_index));
 
+	e = additional_cache_lookup(query, master_rrset, rdata_index,
+		allow_glue, types);
+	if (!e->wildcard) {
+		for (i = 0; i < e->count; ++i) {
+			int j;
+			for (j = 0; types[j].rr_type != 0; ++j) {
+				if (e->targets[i].rrsets[j]) {
+					answer_add_rrset(answer,
+						types[j].rr_section,
+						e->targets[i].domain,
+						e->targets[i].rrsets[j]);
+				}
+			}
+		}
+		return;
+	}
+
 	for (i = 0; i < master_rrset->rr_count; ++i) {
 		int j;
 		domain_type *additional = rdata_atom_domain(master_rrset->rrs[i].rdatas[rdata_index]);
@@ -802,14 +1053,130 @@ add_rrset(struct query   *query,
 }
 
 
+/*
+ * The result of a DNAME substitution, the new name and its lookup, with
+ * the names of the temporary domains of the synthesized CNAME, in a
+ * direct mapped table by the DNAME owner and the name that is substituted.
+ * The database does not change while a process answers queries from it,
+ * and the table is cleared when it starts to, with the zone cache.
+ */
+#define DNAME_CACHE_SIZE 1024
+struct dname_cache {
+	/* the owner of the DNAME and the name that is substituted */
+	domain_type* src;
+	uint16_t name_size;
+	uint8_t name[MAXDOMAINLEN];
+	/* the answer that uses the entry, it is not replaced during it,
+	 * because the answer points to its names */
+	uint32_t use;
+	/* the new name and the result of its lookup */
+	const dname_type* newname;
+	domain_type* closest_match;
+	domain_type* closest_encloser;
+	/* the names of the temporary domains, the ones below the owner and
+	 * then the ones below the closest encloser of the new name */
+	const dname_type** names;
+	/* the allocation that holds the names */
+	void* data;
+};
+static struct dname_cache* dname_cache = NULL;
+static uint32_t dname_cache_use = 0;
+
+void
+query_dname_cache_clear(void)
+{
+	size_t i;
+	if(!dname_cache)
+		return;
+	for(i = 0; i < DNAME_CACHE_SIZE; i++)
+		free(dname_cache[i].data);
+	free(dname_cache);
+	dname_cache = NULL;
+}
+
+static struct dname_cache*
+dname_cache_entry(domain_type* src, const dname_type* name)
+{
+	if(!dname_cache)
+		dname_cache = xalloc_array_zero(DNAME_CACHE_SIZE,
+			sizeof(*dname_cache));
+	return &dname_cache[fasthash32(dname_name(name), name->name_size,
+		fasthash32(&src, sizeof(src), 0)) % DNAME_CACHE_SIZE];
+}
+
+/* find the substitution of the name by the DNAME at src, or NULL */
+static struct dname_cache*
+dname_cache_lookup(domain_type* src, const dname_type* name)
+{
+	struct dname_cache* e = dname_cache_entry(src, name);
+	if(e->src != src || e->name_size != name->name_size ||
+		memcmp(e->name, dname_name(name), name->name_size) != 0)
+		return NULL;
+	e->use = dname_cache_use;
+	return e;
+}
+
+/* store the substitution of the name by the DNAME at src, returns the
+ * entry, or NULL if it is not stored */
+static struct dname_cache*
+dname_cache_store(domain_type* src, const dname_type* name,
+	const dname_type* newname, domain_type* closest_match,
+	domain_type* closest_encloser)
+{
+	struct dname_cache* e = dname_cache_entry(src, name);
+	uint8_t src_labels = domain_dname(src)->label_count;
+	uint8_t ce_labels = domain_dname(closest_encloser)->label_count;
+	size_t src_count = name->label_count - src_labels;
+	size_t dest_count = newname->label_count - ce_labels;
+	size_t size, i;
+	uint8_t* p;
+
+	if(e->use == dname_cache_use)
+		return NULL;
+	size = (src_count + dest_count) * sizeof(*e->names) +
+		dname_total_size(newname);
+	for(i = 0; i < src_count; i++)
+		size += dname_partial_size(name, src_labels + i + 1);
+	for(i = 0; i < dest_count; i++)
+		size += dname_partial_size(newname, ce_labels + i + 1);
+	p = (uint8_t*)malloc(size);
+	if(!p)
+		return NULL;
+	free(e->data);
+	e->data = p;
+	e->names = (const dname_type**)p;
+	p += (src_count + dest_count) * sizeof(*e->names);
+	for(i = 0; i < src_count; i++) {
+		e->names[i] = dname_partial_copy_into(p, name,
+			src_labels + i + 1);
+		p += dname_partial_size(name, src_labels + i + 1);
+	}
+	for(i = 0; i < dest_count; i++) {
+		e->names[src_count + i] = dname_partial_copy_into(p, newname,
+			ce_labels + i + 1);
+		p += dname_partial_size(newname, ce_labels + i + 1);
+	}
+	memcpy(p, newname, dname_total_size(newname));
+	e->newname = (const dname_type*)p;
+	e->src = src;
+	e->name_size = name->name_size;
+	memcpy(e->name, dname_name(name), name->name_size);
+	e->closest_match = closest_match;
+	e->closest_encloser = closest_encloser;
+	e->use = dname_cache_use;
+	return e;
+}
+
 /* returns 0 on error, or the domain number for to_name.
    from_name is changes to to_name by the DNAME rr.
    DNAME rr is from src to dest.
-   closest encloser encloses the to_name. */
+   closest encloser encloses the to_name.
+   names are the names of the temporary domains from the dname cache,
+   or NULL to copy them from from_name and to_name. */
 static size_t
 query_synthesize_cname(struct query* q, struct answer* answer, const dname_type* from_name,
 	const dname_type* to_name, domain_type* src, domain_type* to_closest_encloser,
-	domain_type** to_closest_match, uint32_t ttl)
+	domain_type** to_closest_match, uint32_t ttl, const dname_type** names)
 {
 	/* add temporary domains for from_name and to_name and all
 	   their (not allocated yet) parents */
@@ -850,7 +1217,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 #else
 		newdom->node.key
 #endif
-			= dname_partial_copy(q->region,
+			= names ? names[i] : dname_partial_copy(q->region,
 			from_name, domain_dname(src)->label_count + i + 1);
 		if(dname_compare(domain_dname(newdom), q->qname) == 0) {
 			/* 0 good for query name, otherwise new number */
@@ -877,8 +1244,10 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 #else
 		newdom->node.key
 #endif
-			= dname_partial_copy(q->region,
-			to_name, domain_dname(to_closest_encloser)->label_count + i + 1);
+			= names ? names[from_name->label_count -
+			domain_dname(src)->label_count + i] :
+			dname_partial_copy(q->region, to_name,
+			domain_dname(to_closest_encloser)->label_count + i + 1);
 		DEBUG(DEBUG_QUERY,2, (LOG_INFO, "created temp domain dest %d. %s nr %d", i,
 			domain_to_string(newdom), (int)newdom->number));
 		lastparent = newdom;
@@ -891,6 +1260,7 @@ query_synthesize_cname(struct query* q, struct answer* answer, const dname_type*
 	memset(rrset, 0, sizeof(rrset_type));
 	rrset->zone = q->zone;
 	rrset->rr_count = 1;
+	rrset->type = TYPE_CNAME;
 	rrset->rrs = (rr_type*) region_alloc(q->region, sizeof(rr_type));
 	memset(rrset->rrs, 0, sizeof(rr_type));
 	rrset->rrs->owner = cname_domain;
@@ -926,6 +1296,7 @@ answer_delegation(query_type *query, answer_type *answer)
 
 	if (query->cname_count == 0) {
 		AA_CLR(query->packet);
+		query->rcache_referral = 1;
 	} else {
 		AA_SET(query->packet);
 	}
@@ -1005,6 +1376,95 @@ answer_nxdomain(query_type *query, answer_type *answer)
 }
 
 
+/*
+ * The rrset of the minimal answer to ANY of a domain, found once and kept
+ * in a direct mapped table, so that a flood of ANY queries does not walk
+ * the rrsets of the domain for every query. It is cleared at the same
+ * times as the additional cache.
+ */
+#define ANY_CACHE_SIZE 4096
+struct any_cache {
+	domain_type* domain;
+	zone_type* zone;
+	/* if the RRSIG rrset is left out, for DNSSEC */
+	int skip_rrsig;
+	/* the rrset of the answer, NULL if there is none */
+	rrset_type* rrset;
+};
+static struct any_cache* any_cache = NULL;
+
+void
+query_any_cache_clear(void)
+{
+	free(any_cache);
+	any_cache = NULL;
+}
+
+/*
+ * Minimize response size for ANY, with one RRset
+ * according to RFC 8482(4.1).
+ * Prefers popular and not large rtypes (A,AAAA,...)
+ * lowering large ones (DNSKEY,RRSIG,...).
+ */
+static rrset_type*
+any_rrset_select(domain_type* domain, zone_type* zone, int skip_rrsig)
+{
+	rrset_type *rrset;
+	rrset_type *normal_rrset = NULL;
+	rrset_type *non_preferred_rrset = NULL;
+
+	for (rrset = domain_find_any_rrset(domain, zone); rrset; rrset = rrset->next) {
+		if (rrset->zone == zone
+#ifdef NSEC3
+			&& rrset_rrtype(rrset) != TYPE_NSEC3
+#endif
+		    /*
+		     * Don't include the RRSIG RRset when
+		     * DNSSEC is used, because it is added
+		     * automatically on an per-RRset basis.
+		     */
+		    && !(skip_rrsig && rrset_rrtype(rrset) == TYPE_RRSIG))
+		{
+			switch(rrset_rrtype(rrset)) {
+				case TYPE_A:
+				case TYPE_AAAA:
+				case TYPE_SOA:
+				case TYPE_MX:
+				case TYPE_PTR:
+					return rrset;
+				case TYPE_DNSKEY:
+				case TYPE_RRSIG:
+				case TYPE_NSEC:
+					non_preferred_rrset = rrset;
+					break;
+				default:
+					normal_rrset = rrset;
+			}
+		}
+	}
+	return normal_rrset ? normal_rrset : non_preferred_rrset;
+}
+
+/* the rrset of the answer to ANY, from the table, or fill the entry */
+static rrset_type*
+any_cache_lookup(struct query *q, domain_type* domain)
+{
+	struct any_cache* e;
+	int skip_rrsig = (q->edns.dnssec_ok && zone_is_secure(q->zone));
+	if(!any_cache)
+		any_cache = xalloc_array_zero(ANY_CACHE_SIZE,
+			sizeof(*any_cache));
+	e = &any_cache[(((size_t)domain)>>4) % ANY_CACHE_SIZE];
+	if(e->domain != domain || e->zone != q->zone ||
+		e->skip_rrsig != skip_rrsig) {
+		e->domain = domain;
+		e->zone = q->zone;
+		e->skip_rrsig = skip_rrsig;
+		e->rrset = any_rrset_select(domain, q->zone, skip_rrsig);
+	}
+	return e->rrset;
+}
+
 /*
  * Answer domain information (or SOA if we do not have an RRset for
  * the type specified by the query).
@@ -1016,55 +1476,8 @@ answer_domain(struct nsd* nsd, struct query *q, answer_type *answer,
 	rrset_type *rrset;
 
 	if (q->qtype == TYPE_ANY) {
-		rrset_type *preferred_rrset = NULL;
-		rrset_type *normal_rrset = NULL;
-		rrset_type *non_preferred_rrset = NULL;
-
-		/*
-		 * Minimize response size for ANY, with one RRset
-		 * according to RFC 8482(4.1).
-		 * Prefers popular and not large rtypes (A,AAAA,...)
-		 * lowering large ones (DNSKEY,RRSIG,...).
-		 */
-		for (rrset = domain_find_any_rrset(domain, q->zone); rrset; rrset = rrset->next) {
-			if (rrset->zone == q->zone
-#ifdef NSEC3
-				&& rrset_rrtype(rrset) != TYPE_NSEC3
-#endif
-			    /*
-			     * Don't include the RRSIG RRset when
-			     * DNSSEC is used, because it is added
-			     * automatically on an per-RRset basis.
-			     */
-			    && !(q->edns.dnssec_ok
-				 && zone_is_secure(q->zone)
-				 && rrset_rrtype(rrset) == TYPE_RRSIG))
-			{
-				switch(rrset_rrtype(rrset)) {
-					case TYPE_A:
-					case TYPE_AAAA:
-					case TYPE_SOA:
-					case TYPE_MX:
-					case TYPE_PTR:
-						preferred_rrset = rrset;
-						break;
-					case TYPE_DNSKEY:
-					case TYPE_RRSIG:
-					case TYPE_NSEC:
-						non_preferred_rrset = rrset;
-						break;
-					default:
-						normal_rrset = rrset;
-				}
-				if (preferred_rrset) break;
-			}
-		}
-		if (preferred_rrset) {
-			add_rrset(q, answer, ANSWER_SECTION, domain, preferred_rrset);
-		} else if (normal_rrset) {
-			add_rrset(q, answer, ANSWER_SECTION, domain, normal_rrset);
-		} else if (non_preferred_rrset) {
-			add_rrset(q, answer, ANSWER_SECTION, domain, non_preferred_rrset);
+		if ((rrset = any_cache_lookup(q, domain))) {
+			add_rrset(q, answer, ANSWER_SECTION, domain, rrset);
 		} else {
 			answer_nodata(q, answer, original);
 			return;
@@ -1093,7 +1506,9 @@ answer_domain(struct nsd* nsd, struct query *q, answer_type *answer,
 			zone_type* origzone = q->zone;
 			++q->cname_count;
 
-			answer_lookup_zone(nsd, q, answer, closest_match->number,
+			answer_lookup_zone(nsd, q, answer,
+					     query_find_zone(nsd, closest_encloser),
+					     closest_match->number,
 					     closest_match == closest_encloser,
 					     closest_match, closest_encloser,
 					     domain_dname(closest_match));
@@ -1161,6 +1576,7 @@ answer_authoritative(struct nsd   *nsd,
 		const dname_type* newname;
 		size_t newnum = 0;
 		zone_type* origzone = q->zone;
+		struct dname_cache* dc;
 		assert(rrset->rr_count > 0);
 		if(domain_number != 0) /* we followed CNAMEs or DNAMEs */
 			name = domain_dname(closest_match);
@@ -1175,23 +1591,33 @@ answer_authoritative(struct nsd   *nsd,
 				return;
 			}
 		}
-		newname = dname_replace(q->region, name,
-			domain_dname(src), domain_dname(dest));
 		++q->cname_count;
-		if(!newname) { /* newname too long */
-			RCODE_SET(q->packet, RCODE_YXDOMAIN);
-			/* RFC 8914 - Extended DNS Errors
-			 * 4.21. Extended DNS Error Code 0 - Other */
-			ASSIGN_EDE_CODE_AND_STRING_LITERAL(q->edns.ede,
-				EDE_OTHER, "DNAME expansion became too large");
-			return;
+		if((dc = dname_cache_lookup(src, name)) != NULL) {
+			newname = dc->newname;
+			closest_match = dc->closest_match;
+			closest_encloser = dc->closest_encloser;
+		} else {
+			newname = dname_replace(q->region, name,
+				domain_dname(src), domain_dname(dest));
+			if(!newname) { /* newname too long */
+				RCODE_SET(q->packet, RCODE_YXDOMAIN);
+				/* RFC 8914 - Extended DNS Errors
+				 * 4.21. Extended DNS Error Code 0 - Other */
+				ASSIGN_EDE_CODE_AND_STRING_LITERAL(q->edns.ede,
+					EDE_OTHER, "DNAME expansion became too large");
+				return;
+			}
+			/* follow the DNAME */
+			(void)namedb_lookup(nsd->db, newname, &closest_match,
+				&closest_encloser);
+			dc = dname_cache_store(src, name, newname,
+				closest_match, closest_encloser);
 		}
 		DEBUG(DEBUG_QUERY,2, (LOG_INFO, "->result is %s", dname_to_string(newname, NULL)));
-		/* follow the DNAME */
-		(void)namedb_lookup(nsd->db, newname, &closest_match, &closest_encloser);
 		/* synthesize CNAME record */
 		newnum = query_synthesize_cname(q, answer, name, newname,
-			src, closest_encloser, &closest_match, rrset->rrs[0].ttl);
+			src, closest_encloser, &closest_match, rrset->rrs[0].ttl,
+			dc ? dc->names : NULL);
 		if(!newnum) {
 			/* could not synthesize the CNAME. */
 			/* return previous CNAMEs to make resolver recurse for us */
@@ -1204,7 +1630,8 @@ answer_authoritative(struct nsd   *nsd,
 			return;
 		}
 
-		answer_lookup_zone(nsd, q, answer, newnum,
+		answer_lookup_zone(nsd, q, answer,
+			query_find_zone(nsd, closest_encloser), newnum,
 			closest_match == closest_encloser,
 			closest_match, closest_encloser, newname);
 		q->zone = origzone;
@@ -1212,6 +1639,7 @@ answer_authoritative(struct nsd   *nsd,
 	} else if ((wildcard_child=domain_wildcard_child(closest_encloser))!=NULL &&
 		wildcard_child->is_existing) {
 		/* Generate the domain from the wildcard.  */
+		q->rcache_wildcard = 1;
 #ifdef RATELIMIT
 		q->wildcard_domain = wildcard_child;
 #endif
@@ -1310,13 +1738,117 @@ answer_authoritative(struct nsd   *nsd,
 /*
  * qname may be different after CNAMEs have been followed from query->qname.
  */
+/*
+ * The zone of a closest encloser, found by walking up to the apex, in a
+ * direct mapped table. The database does not change while a process
+ * answers queries from it, and the table is cleared when it starts to.
+ */
+#define QUERY_ZONE_CACHE_SIZE 4096
+struct query_zone_cache {
+	domain_type* domain;
+	zone_type* zone;
+};
+static struct query_zone_cache* query_zone_cache = NULL;
+
+/*
+ * A bloom filter of the zone apex names, with two bits per name. A query
+ * name that has no suffix in the filter is not in any of the zones, and
+ * is refused without a lookup in the domain table. It is made when the
+ * process answers its first query and cleared with the zone cache.
+ */
+static uint32_t* query_zone_filter = NULL;
+static uint32_t query_zone_filter_mask = 0;
+
+void
+query_zone_cache_clear(void)
+{
+	free(query_zone_cache);
+	query_zone_cache = NULL;
+	free(query_zone_filter);
+	query_zone_filter = NULL;
+	query_zone_filter_mask = 0;
+}
+
+/* the two bits of a (normalized) name in the zone filter */
+static void
+query_zone_filter_bits(const uint8_t* name, size_t len, uint32_t* b1,
+	uint32_t* b2)
+{
+	uint32_t h = fasthash32(name, len, 0);
+	*b1 = h & query_zone_filter_mask;
+	*b2 = ((h >> 16) | (h << 16)) & query_zone_filter_mask;
+}
+
+static void
+query_zone_filter_create(struct nsd* nsd)
+{
+	struct radnode* n;
+	size_t bits = 1024, i;
+	while(bits < nsd->db->zonetree->count * 16 && bits < 0x80000000)
+		bits <<= 1;
+	query_zone_filter = xalloc_array_zero(bits/32, sizeof(uint32_t));
+	query_zone_filter_mask = (uint32_t)(bits - 1);
+	for(n = radix_first(nsd->db->zonetree); n; n = radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		const dname_type* apex = domain_dname(zone->apex);
+		uint8_t name[MAXDOMAINLEN];
+		uint32_t b1, b2;
+		for(i = 0; i < apex->name_size; i++)
+			name[i] = DNAME_NORMALIZE((unsigned char)
+				dname_name(apex)[i]);
+		query_zone_filter_bits(name, apex->name_size, &b1, &b2);
+		query_zone_filter[b1/32] |= (1U << (b1%32));
+		query_zone_filter[b2/32] |= (1U << (b2%32));
+	}
+}
+
+/* returns 0 if the query name is certainly not in one of the zones */
+static int
+query_zone_filter_match(struct nsd* nsd, const dname_type* qname)
+{
+	const uint8_t* name = dname_name(qname);
+	int i;
+	if(!query_zone_filter)
+		query_zone_filter_create(nsd);
+	for(i = (int)qname->label_count - 1; i >= 0; i--) {
+		size_t start = dname_label_offsets(qname)[i];
+		uint32_t b1, b2;
+		query_zone_filter_bits(name + start, qname->name_size - start,
+			&b1, &b2);
+		if((query_zone_filter[b1/32] & (1U << (b1%32))) &&
+		   (query_zone_filter[b2/32] & (1U << (b2%32))))
+			return 1;
+	}
+	return 0;
+}
+
+static zone_type*
+query_find_zone(struct nsd *nsd, domain_type* domain)
+{
+	struct query_zone_cache* e;
+	if(!domain)
+		return NULL;
+	if(!query_zone_cache)
+		query_zone_cache = xalloc_array_zero(QUERY_ZONE_CACHE_SIZE,
+			sizeof(*query_zone_cache));
+	e = &query_zone_cache[(((size_t)domain)>>4) % QUERY_ZONE_CACHE_SIZE];
+	if(e->domain != domain) {
+		e->domain = domain;
+		e->zone = domain_find_zone(nsd->db, domain);
+	}
+	return e->zone;
+}
+
+/* answer from the zone of the closest encloser, that is looked up with
+ * query_find_zone by the caller */
 static void
 answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
-	size_t domain_number, int exact, domain_type *closest_match,
-	domain_type *closest_encloser, const dname_type *qname)
+	zone_type *zone, size_t domain_number, int exact,
+	domain_type *closest_match, domain_type *closest_encloser,
+	const dname_type *qname)
 {
 	zone_type* origzone = q->zone;
-	q->zone = domain_find_zone(nsd->db, closest_encloser);
+	q->zone = zone;
 	if (!q->zone) {
 		/* no zone for this */
 		if(q->cname_count == 0) {
@@ -1328,9 +1860,11 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		return;
 	}
 	assert(closest_encloser); /* otherwise, no q->zone would be found */
+	NSD_PROBE3(zone__found, PROBE_QNAME(q), q->qtype, PROBE_ZONE(q->zone));
 	if(q->zone->opts && q->zone->opts->pattern
 	&& q->zone->opts->pattern->allow_query) {
 		struct acl_options *why = NULL;
+		q->client_specific = 1;
 
 		/* check if it passes acl */
 		if(q->is_proxied && acl_check_incoming_block_proxy(
@@ -1511,20 +2045,35 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 	}
 }
 
-static void
+/* returns 1 if the answer came from the response cache */
+static int
 answer_query(struct nsd *nsd, struct query *q)
 {
 	domain_type *closest_match;
 	domain_type *closest_encloser;
+	zone_type *zone;
 	int exact;
 	uint16_t offset;
 	answer_type answer;
 
 	answer_init(&answer);
+	/* the dname cache entries that this answer uses are kept */
+	dname_cache_use++;
 
 	exact = namedb_lookup(nsd->db, q->qname, &closest_match, &closest_encloser);
-
-	answer_lookup_zone(nsd, q, &answer, 0, exact, closest_match,
+	QUERY_TRACE(q, QUERY_TRACE_LOOKUP);
+	if(respcache_lookup_referral(q, nsd, closest_encloser))
+		return 1;
+	/* the zone is looked up once, for the cache and the answer */
+	zone = query_find_zone(nsd, closest_encloser);
+	if(!exact && respcache_lookup_nxdomain(q, nsd, zone, closest_match,
+		closest_encloser))
+		return 1;
+	if(!exact)
+		q->rcache_closest_match = closest_match;
+	q->rcache_closest_encloser = closest_encloser;
+
+	answer_lookup_zone(nsd, q, &answer, zone, 0, exact, closest_match,
 		closest_encloser, q->qname);
 	ZTATUP2(nsd, q->zone, opcode, q->opcode);
 	ZTATUP2(nsd, q->zone, qtype, q->qtype);
@@ -1534,6 +2083,7 @@ answer_query(struct nsd *nsd, struct query *q)
 	query_add_compression_domain(q, closest_encloser, offset);
 	encode_answer(q, &answer);
 	query_clear_compression_tables(q);
+	return 0;
 }
 
 void
@@ -1561,6 +2111,26 @@ query_prepare_response(query_type *q)
 	FLAGS_SET(q->packet, flags);
 }
 
+/*
+ * In overload, for udp-shed, the UDP queries of sources that are not
+ * known to be real, with a valid cookie or from udp-shed-allow, are shed
+ * before the lookup. The truncated answer makes the resolver retry with
+ * the cookie, or over TCP, and a spoofed flood gets no more than that.
+ */
+static int
+query_udp_shed(nsd_type *nsd, struct query *q)
+{
+	struct acl_options* acl;
+	if(q->edns.cookie_status == COOKIE_VALID ||
+		q->edns.cookie_status == COOKIE_VALID_REUSE)
+		return 0;
+	for(acl = nsd->options->udp_shed_allow; acl; acl = acl->next) {
+		if(acl_addr_matches(acl, q))
+			return 0;
+	}
+	return 1;
+}
+
 /*
  * Processes the query.
  *
@@ -1603,6 +2173,8 @@ query_process(query_type *q, nsd_type *nsd, uint32_t *now_p)
 	STATUP2(nsd, opcode, q->opcode);
 	STATUP2(nsd, qtype, q->qtype);
 	STATUP2(nsd, qclass, q->qclass);
+	NSD_PROBE4(query__receive, PROBE_QNAME(q), q->qtype, q->qclass,
+		q->tcp);
 
 	if (q->opcode != OPCODE_QUERY) {
 		if (q->opcode == OPCODE_NOTIFY) {
@@ -1725,9 +2297,19 @@ query_process(query_type *q, nsd_type *nsd, uint32_t *now_p)
 
 	if (q->edns.cookie_status == COOKIE_UNVERIFIED)
 		cookie_verify(q, nsd, now_p);
+	QUERY_TRACE(q, QUERY_TRACE_PARSE);
 
 	query_prepare_response(q);
 
+	if(nsd->udp_overloaded && !q->tcp && query_udp_shed(nsd, q)) {
+		STATUP(nsd, udp_shed);
+		if(nsd->options->udp_shed_drop)
+			return QUERY_DISCARDED;
+		/* the truncated answer has the server cookie, for the retry */
+		TC_SET(q->packet);
+		return query_error(q, NSD_RC_OK);
+	}
+
 	if (q->qclass != CLASS_IN && q->qclass != CLASS_ANY) {
 		if (q->qclass == CLASS_CH) {
 			return answer_chaos(nsd, q);
@@ -1748,7 +2330,21 @@ query_process(query_type *q, nsd_type *nsd, uint32_t *now_p)
 		return query_error(q, NSD_RC_OK);
 	}
 
-	answer_query(nsd, q);
+	if(!query_zone_filter_match(nsd, q->qname)) {
+		/* no zone for this */
+		RCODE_SET(q->packet, RCODE_REFUSE);
+		/* RFC 8914 - Extended DNS Errors
+		 * 4.21. Extended DNS Error Code 20 - Not Authoritative */
+		q->edns.ede = EDE_NOT_AUTHORITATIVE;
+		return QUERY_PROCESSED;
+	}
+	if(respcache_lookup(q, nsd)) {
+		QUERY_TRACE(q, QUERY_TRACE_ANSWER);
+		return QUERY_PROCESSED;
+	}
+	if(!answer_query(nsd, q))
+		respcache_store(q, nsd);
+	QUERY_TRACE(q, QUERY_TRACE_ANSWER);
 
 	return QUERY_PROCESSED;
 }
@@ -1757,6 +2353,7 @@ void
 query_add_optional(query_type *q, nsd_type *nsd, uint32_t *now_p)
 {
 	struct edns_data *edns = &nsd->edns_ipv4;
+	int do_bit = (q->edns.dnssec_ok != 0);
 #if defined(INET6)
 	if (q->client_addr.ss_family == AF_INET6) {
 		edns = &nsd->edns_ipv6;
@@ -1769,10 +2366,6 @@ query_add_optional(query_type *q, nsd_type *nsd, uint32_t *now_p)
 	case EDNS_NOT_PRESENT:
 		break;
 	case EDNS_OK:
-		if (q->edns.dnssec_ok)	edns->ok[7] = 0x80;
-		else			edns->ok[7] = 0x00;
-		buffer_write(q->packet, edns->ok, OPT_LEN);
-
 		/* Add Extended DNS Error (RFC8914)
 		 * to verify that we stay in bounds */
 		if (q->edns.ede >= 0)
@@ -1780,11 +2373,22 @@ query_add_optional(query_type *q, nsd_type *nsd, uint32_t *now_p)
 				6 + ( q->edns.ede_text_len
 			            ? q->edns.ede_text_len : 0);
 
+		/* the OPT RR header is not written yet, it is in the
+		 * check, as are the rdata length and the options */
 		if(q->edns.opt_reserved_space == 0 || !buffer_available(
-			q->packet, 2+q->edns.opt_reserved_space)) {
-			/* fill with NULLs */
-			buffer_write(q->packet, edns->rdata_none, OPT_RDATA);
+			q->packet, OPT_LEN+2+q->edns.opt_reserved_space)) {
+			/* the OPT RR with empty rdata */
+			buffer_write(q->packet, edns->ok_empty[do_bit],
+				OPT_LEN + OPT_RDATA);
+		} else if(q->edns.nsid && edns->ok_nsid[do_bit] &&
+			q->edns.cookie_status == COOKIE_NOT_PRESENT &&
+			q->edns.ede < 0 && !q->edns.keepalive) {
+			/* the OPT RR with only the NSID option */
+			buffer_write(q->packet, edns->ok_nsid[do_bit],
+				edns->ok_nsid_len);
 		} else {
+			buffer_write(q->packet, edns->ok_empty[do_bit],
+				OPT_LEN);
 			/* rdata length */
 			buffer_write_u16(q->packet, q->edns.opt_reserved_space);
 			/* edns options */
@@ -1801,6 +2405,13 @@ query_add_optional(query_type *q, nsd_type *nsd, uint32_t *now_p)
 				cookie_create(q, nsd, now_p);
 				buffer_write(q->packet, q->edns.cookie, 24);
 			}
+			if(q->edns.keepalive) {
+				/* edns-tcp-keepalive (RFC7828), the idle
+				 * timeout of the connection */
+				buffer_write_u16(q->packet, KEEPALIVE_CODE);
+				buffer_write_u16(q->packet, 2);
+				buffer_write_u16(q->packet, q->tcp_keepalive);
+			}
 			/* Append Extended DNS Error (RFC8914) option if needed */
 			if (q->edns.ede >= 0) { /* < 0 means no EDE */
 				/* OPTION-CODE */
@@ -1823,10 +2434,8 @@ query_add_optional(query_type *q, nsd_type *nsd, uint32_t *now_p)
 		ZTATUP(nsd, q->zone, edns);
 		break;
 	case EDNS_ERROR:
-		if (q->edns.dnssec_ok)	edns->error[7] = 0x80;
-		else			edns->error[7] = 0x00;
-		buffer_write(q->packet, edns->error, OPT_LEN);
-		buffer_write(q->packet, edns->rdata_none, OPT_RDATA);
+		buffer_write(q->packet, edns->error_empty[do_bit],
+			OPT_LEN + OPT_RDATA);
 		ARCOUNT_SET(q->packet, ARCOUNT(q->packet) + 1);
 		STATUP(nsd, ednserr);
 		ZTATUP(nsd, q->zone, ednserr);
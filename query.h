@@ -19,6 +19,41 @@
 #include "tsig.h"
 struct ixfr_data;
 
+/*
+ * The dname compression table is a hash table of the domain numbers that
+ * are in the answer, so that its size follows the number of names in a
+ * packet and not the number of names in the database.  Entries are removed
+ * in the reverse order they were added, so the linear probing needs no
+ * deleted markers. The size is a power of two, at least twice
+ * MAX_COMPRESSED_DNAMES.
+ */
+#define COMPRESSION_TABLE_BITS 15
+#define COMPRESSION_TABLE_SIZE (1U << COMPRESSION_TABLE_BITS)
+
+struct compression_entry {
+	uint32_t number; /* domain->number */
+	uint16_t offset; /* 0 if the entry is not used */
+};
+
+struct compression_table {
+	struct compression_entry entries[COMPRESSION_TABLE_SIZE];
+	/* the used entries, in the order they were added */
+	uint16_t used[MAX_COMPRESSED_DNAMES];
+};
+
+/* the stages of a query that are timed by query-trace */
+enum query_trace_stage {
+	QUERY_TRACE_RECV = 0,	/* received from the socket */
+	QUERY_TRACE_START,	/* processing of it starts */
+	QUERY_TRACE_PARSE,	/* question, EDNS and TSIG are parsed */
+	QUERY_TRACE_LOOKUP,	/* the name is looked up in the database */
+	QUERY_TRACE_ANSWER,	/* the answer is encoded */
+	QUERY_TRACE_RRL,	/* the rate limit is checked */
+	QUERY_TRACE_FINAL,	/* EDNS and TSIG are added to the answer */
+	QUERY_TRACE_SEND,	/* the answer is sent */
+	QUERY_TRACE_STAGES
+};
+
 enum query_state {
 	QUERY_PROCESSED,
 	QUERY_DISCARDED,
@@ -47,6 +82,8 @@ struct query {
 
 	/* if set, the request came through a proxy */
 	int is_proxied;
+	/* size of the PROXYv2 header that the UDP packet buffer skips */
+	size_t pp2_skip;
 	/* the client address
 	 * the same as remote_addr if not proxied */
 #ifdef INET6
@@ -76,6 +113,9 @@ struct query {
 
 	int tcp;
 	uint16_t tcplen;
+	/* the idle timeout of the TCP connection, in units of 100 msec,
+	 * for the edns-tcp-keepalive option */
+	uint16_t tcp_keepalive;
 
 	buffer_type *packet;
 
@@ -118,18 +158,34 @@ struct query {
 
 	/* Used for dname compression.  */
 	uint16_t     compressed_dname_count;
-	domain_type **compressed_dnames;
+	struct compression_table *compression;
 
-	 /*
-	  * Indexed by domain->number, index 0 is reserved for the
-	  * query name when generated from a wildcard record.
-	  */
-	uint16_t    *compressed_dname_offsets;
+	/*
+	 * Number of domain numbers in use by the database, temporary
+	 * domains are numbered after it.  Number 0 is reserved for the
+	 * query name when generated from a wildcard record.
+	 */
 	size_t compressed_dname_offsets_size;
 
 	/* number of temporary domains used for the query */
 	size_t number_temporary_domains;
 
+	/* set if the answer depends on the client, such as with an
+	 * allow-query acl, it is not stored in the response cache */
+	int client_specific;
+	/* the lookup result for the qname, an NXDOMAIN or wildcard answer
+	 * is stored in the response cache for these, instead of for the
+	 * qname */
+	domain_type *rcache_closest_match;
+	domain_type *rcache_closest_encloser;
+	/* set if the answer is expanded from a wildcard */
+	int rcache_wildcard;
+	/* the NSEC3 that covers the next closer name in the answer */
+	domain_type *rcache_nsec3_cover;
+	/* set if the answer is a referral, it is stored in the response
+	 * cache for the closest encloser, instead of for the qname */
+	int rcache_referral;
+
 	/*
 	 * Used for AXFR processing.
 	 */
@@ -138,6 +194,15 @@ struct query {
 	domain_type *axfr_current_domain;
 	rrset_type  *axfr_current_rrset;
 	uint16_t     axfr_current_rr;
+	/* the cached AXFR that is sent, and the next packet of it */
+	struct axfr_cache *axfr_cache;
+	size_t       axfr_cache_packet;
+	/* capture of the AXFR packets into the cache, 0 if not */
+	uint32_t     axfr_capture;
+	/* the zone of the AXFR or IXFR over TCP that is sent, and the list
+	 * of these transfers, for the xfr-out limits, NULL if not sent */
+	struct zone_options *xfr_out_zone;
+	struct query *xfr_out_prev, *xfr_out_next;
 
 	/* Used for IXFR processing,
 	 * indicates if the zone transfer is done, connection can close. */
@@ -161,8 +226,29 @@ struct query {
 	/* if we encountered a wildcard, its domain */
 	domain_type *wildcard_domain;
 #endif
+
+	/* set if the query is sampled by query-trace, with the time in
+	 * nsec that it passed the stages, or 0 for stages it skipped */
+	int traced;
+	uint64_t trace[QUERY_TRACE_STAGES];
 };
 
+#ifdef HAVE_CLOCK_GETTIME
+/* the monotonic time in nsec, for query-trace */
+static inline uint64_t
+query_trace_now(void)
+{
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+#define QUERY_TRACE(q, stage) do { if((q)->traced) \
+		(q)->trace[(stage)] = query_trace_now(); } while(0)
+#else
+#define QUERY_TRACE(q, stage) /* nothing */
+#endif
+
 
 /* Check if the last write resulted in an overflow.  */
 static inline int query_overflow(struct query *q);
@@ -179,10 +265,26 @@ void query_put_dname_offset(struct query *query,
  * table.  Offset 0 is used to indicate the domain is not yet in the
  * compression table.
  */
+static inline uint32_t
+compression_hash(uint32_t number)
+{
+	return (number * 2654435761U) >> (32 - COMPRESSION_TABLE_BITS);
+}
+
 static inline
 uint16_t query_get_dname_offset(struct query *query, domain_type *domain)
 {
-	return query->compressed_dname_offsets[domain->number];
+	struct compression_entry *entries = query->compression->entries;
+	uint32_t i;
+
+	if (domain->number == 0)
+		return QHEADERSZ; /* The original query name */
+	for (i = compression_hash(domain->number); entries[i].offset != 0;
+		i = (i + 1) & (COMPRESSION_TABLE_SIZE - 1)) {
+		if (entries[i].number == domain->number)
+			return entries[i].offset;
+	}
+	return 0;
 }
 
 /*
@@ -211,9 +313,17 @@ void query_add_compression_domain(struct query *query,
  * Create a new query structure.
  */
 query_type *query_create(region_type *region,
-			 uint16_t *compressed_dname_offsets,
-			 size_t compressed_dname_size,
-			 domain_type **compressed_dnames);
+			 struct compression_table *compression,
+			 size_t compressed_dname_size);
+
+/*
+ * Create a new query structure, with a packet buffer of bufsize bytes
+ * instead of the QIOBUFSZ for TCP. For UDP queries, the buffer has to
+ * hold the largest UDP answer.
+ */
+query_type *query_create_with_buffer(region_type *region,
+	struct compression_table *compression, size_t compressed_dname_size,
+	size_t bufsize);
 
 /*
  * Reset a query structure so it is ready for receiving and processing
@@ -226,6 +336,38 @@ void query_reset(query_type *query, size_t maxlen, int is_tcp);
  */
 query_state_type query_process(query_type *q, nsd_type *nsd, uint32_t *now_p);
 
+/*
+ * Empty the cache of the zones of the closest enclosers, and the filter
+ * of zone names, when the process starts to answer queries from a
+ * database that may have changed.
+ */
+void query_zone_cache_clear(void);
+
+/*
+ * Empty the cache of the additional rrsets of NS, MX, SRV and similar
+ * rrsets, at the same times as query_zone_cache_clear.
+ */
+void query_additional_cache_clear(void);
+
+/*
+ * Empty the cache of DNAME substitutions, and the names of the CNAMEs
+ * that are synthesized for them, at the same times as
+ * query_zone_cache_clear.
+ */
+void query_dname_cache_clear(void);
+
+/*
+ * Empty the cache of the rrsets of the minimal answers to ANY queries,
+ * at the same times as query_zone_cache_clear.
+ */
+void query_any_cache_clear(void);
+
+/*
+ * Empty the cache of the covering NSEC of names in NSEC signed zones,
+ * at the same times as query_zone_cache_clear.
+ */
+void query_nsec_cache_clear(void);
+
 /*
  * Prepare the query structure for writing the response. The packet
  * data up-to the current packet limit is preserved. This usually
@@ -31,6 +31,14 @@ void radix_tree_init(struct radtree* rt)
 	rt->count = 0;
 }
 
+/** free the lookup array of a node, unless it is the one in the node */
+static void radnode_array_free(struct region* region, struct radnode* n)
+{
+	if(n->array != &n->single)
+		region_recycle(region, n->array,
+			n->capacity*sizeof(struct radsel));
+}
+
 /** delete radnodes in postorder recursion */
 static void radnode_del_postorder(struct region* region, struct radnode* n)
 {
@@ -40,7 +48,7 @@ static void radnode_del_postorder(struct region* region, struct radnode* n)
 		radnode_del_postorder(region, n->array[i].node);
 		region_recycle(region, n->array[i].str, n->array[i].len);
 	}
-	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	radnode_array_free(region, n);
 	region_recycle(region, n, sizeof(*n));
 }
 
@@ -196,7 +204,7 @@ radnode_array_grow(struct region* region, struct radnode* n, unsigned want)
 	assert(n->len <= n->capacity);
 	assert(n->capacity < ns);
 	memcpy(&a[0], &n->array[0], n->len*sizeof(struct radsel));
-	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	radnode_array_free(region, n);
 	n->array = a;
 	n->capacity = ns;
 	return 1;
@@ -208,9 +216,8 @@ radnode_array_space(struct region* region, struct radnode* n, uint8_t byte)
 {
 	/* is there an array? */
 	if(!n->array || n->capacity == 0) {
-		n->array = (struct radsel*)region_alloc(region,
-			sizeof(struct radsel));
-		if(!n->array) return 0;
+		/* the first entry goes in the node itself */
+		n->array = &n->single;
 		memset(&n->array[0], 0, sizeof(struct radsel));
 		n->len = 1;
 		n->capacity = 1;
@@ -462,7 +469,7 @@ radsel_split(struct region* region, struct radsel* r, uint8_t* k,
 		/* make space in the common node array */
 		if(!radnode_array_space(region, com, r->str[common_len]) ||
 			!radnode_array_space(region, com, addstr[common_len])) {
-			region_recycle(region, com->array, com->capacity*sizeof(struct radsel));
+			radnode_array_free(region, com);
 			region_recycle(region, com, sizeof(*com));
 			region_recycle(region, common_str, common_len);
 			region_recycle(region, s1_str, s1_len);
@@ -517,8 +524,7 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k,
 				return NULL;
 			}
 			if(!radnode_array_space(rt->region, n, k[0])) {
-				region_recycle(rt->region, n->array,
-					n->capacity*sizeof(struct radsel));
+				radnode_array_free(rt->region, n);
 				region_recycle(rt->region, n, sizeof(*n));
 				region_recycle(rt->region, add, sizeof(*add));
 				return NULL;
@@ -529,8 +535,7 @@ struct radnode* radix_insert(struct radtree* rt, uint8_t* k,
 			if(len > 1) {
 				if(!radsel_prefix_remainder(rt->region, 1, k, len,
 					&n->array[0].str, &n->array[0].len)) {
-					region_recycle(rt->region, n->array,
-						n->capacity*sizeof(struct radsel));
+					radnode_array_free(rt->region, n);
 					region_recycle(rt->region, n, sizeof(*n));
 					region_recycle(rt->region, add, sizeof(*add));
 					return NULL;
@@ -618,7 +623,7 @@ static void radnode_delete(struct region* region, struct radnode* n)
 		/* safe to free NULL str */
 		region_recycle(region, n->array[i].str, n->array[i].len);
 	}
-	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	radnode_array_free(region, n);
 	region_recycle(region, n, sizeof(*n));
 }
 
@@ -670,7 +675,7 @@ radnode_array_clean_all(struct region* region, struct radnode* n)
 	n->offset = 0;
 	n->len = 0;
 	/* shrink capacity */
-	region_recycle(region, n->array, n->capacity*sizeof(struct radsel));
+	radnode_array_free(region, n);
 	n->array = NULL;
 	n->capacity = 0;
 }
@@ -679,12 +684,18 @@ radnode_array_clean_all(struct region* region, struct radnode* n)
 static void
 radnode_array_reduce_if_needed(struct region* region, struct radnode* n)
 {
-	if(n->len <= n->capacity/2 && n->len != n->capacity) {
+	if(n->len == 1 && n->array != &n->single) {
+		/* move the entry into the node itself */
+		memcpy(&n->single, n->array, sizeof(n->single));
+		radnode_array_free(region, n);
+		n->array = &n->single;
+		n->capacity = 1;
+	} else if(n->len <= n->capacity/2 && n->len != n->capacity) {
 		struct radsel* a = (struct radsel*)region_alloc_array(region,
 			sizeof(*a), n->len);
 		if(!a) return;
 		memcpy(a, n->array, sizeof(*a)*n->len);
-		region_recycle(region, n->array, n->capacity*sizeof(*a));
+		radnode_array_free(region, n);
 		n->array = a;
 		n->capacity = n->len;
 	}
@@ -1189,57 +1200,88 @@ radname_delete(struct radtree* rt, const uint8_t* d, size_t max)
 	if(n) radix_delete(rt, n);
 }
 
+/*
+ * Find the label offsets of the domain name, like the label offsets of a
+ * dname_type, offs[0] is the root label and offs[labs-1] the first label.
+ * Returns false on a compression pointer, or if the name is out of bounds.
+ */
+static int
+radname_labels(const uint8_t* d, size_t max, uint8_t* offs,
+	unsigned int* labs)
+{
+	unsigned int lab = 0, i;
+	size_t dpos = 0;
+	uint8_t tmp;
+
+	if(max < 1)
+		return 0;
+	while(1) {
+		if((d[dpos] & 0xc0))
+			return 0; /* compression ptrs not allowed error */
+		if(dpos > 255 || lab >= 128)
+			return 0; /* too long for a domain name */
+		offs[lab++] = (uint8_t)dpos;
+		if(d[dpos] == 0)
+			break;
+		if(dpos + d[dpos] + 1 >= max)
+			return 0; /* format error: outside of bounds */
+		/* skip the label contents */
+		dpos += d[dpos];
+		dpos ++;
+	}
+	/* reverse, so that the root label is first */
+	for(i = 0; i < lab/2; i++) {
+		tmp = offs[i];
+		offs[i] = offs[lab-1-i];
+		offs[lab-1-i] = tmp;
+	}
+	*labs = lab;
+	return 1;
+}
+
 /* search for exact match of domain name, converted to radname in tree */
 struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 	size_t max)
 {
-	/* stack of labels in the domain name */
-	const uint8_t* labstart[130];
-	unsigned int lab, dpos, lpos;
+	uint8_t offs[128];
+	unsigned int labs;
+	if(!radname_labels(d, max, offs, &labs))
+		return NULL;
+	return radname_search_labels(rt, d, offs, labs);
+}
+
+struct radnode* radname_search_labels(struct radtree* rt, const uint8_t* d,
+	const uint8_t* offs, unsigned int labs)
+{
+	/* the current label, its index in offs and position in it */
+	const uint8_t* lbl;
+	unsigned int lab, lpos;
 	struct radnode* n = rt->root;
 	uint8_t byte;
 	radstrlen_type i;
 	uint8_t b;
 
 	/* search for root? it is '' */
-	if(max < 1)
-		return NULL;
-	if(d[0] == 0) {
+	if(labs <= 1) {
 		if(!n) return NULL;
 		return n->elem?n:NULL;
 	}
 
-	/* find labels stack in domain name */
-	lab = 0;
-	dpos = 0;
-	/* must have one label, since root is specialcased */
-	do {
-		if((d[dpos] & 0xc0))
-			return NULL; /* compression ptrs not allowed error */
-		labstart[lab++] = &d[dpos];
-		if(dpos + d[dpos] + 1 >= max)
-			return NULL; /* format error: outside of bounds */
-		/* skip the label contents */
-		dpos += d[dpos];
-		dpos ++;
-	} while(d[dpos] != 0);
-	/* exit condition makes that root label is not in the labstarts */
-	/* now: dpos+1 is length of domain name. lab is number of labels-1 */
-
 	/* start processing at the last label */
-	lab-=1;
+	lab = 1;
+	lbl = d + offs[lab];
 	lpos = 0;
 	while(n) {
 		/* fetch next byte this label */
-		if(lpos < *labstart[lab])
+		if(lpos < *lbl)
 			/* lpos+1 to skip labelstart, lpos++ to move forward */
-			byte = char_d2r(labstart[lab][++lpos]);
+			byte = char_d2r(lbl[++lpos]);
 		else {
-			if(lab == 0) /* last label - we're done */
+			if(lab == labs-1) /* last label - we're done */
 				return n->elem?n:NULL;
 			/* next label, search for byte 00 */
 			lpos = 0;
-			lab--;
+			lbl = d + offs[++lab];
 			byte = 0;
 		}
 		/* find that byte in the array */
@@ -1253,16 +1295,16 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 			/* see how many bytes we need and start matching them*/
 			for(i=0; i<n->array[byte].len; i++) {
 				/* next byte to match */
-				if(lpos < *labstart[lab])
-					b = char_d2r(labstart[lab][++lpos]);
+				if(lpos < *lbl)
+					b = char_d2r(lbl[++lpos]);
 				else {
 					/* if last label, no match since
 					 * we are in the additional string */
-					if(lab == 0)
+					if(lab == labs-1)
 						return NULL; 
 					/* next label, search for byte 00 */
 					lpos = 0;
-					lab--;
+					lbl = d + offs[++lab];
 					b = 0;
 				}
 				if(n->array[byte].str[i] != b)
@@ -1278,9 +1320,27 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
         struct radnode** result)
 {
-	/* stack of labels in the domain name */
-	const uint8_t* labstart[130];
-	unsigned int lab, dpos, lpos;
+	uint8_t offs[128];
+	unsigned int labs;
+
+	/* empty tree */
+	if(!rt->root) {
+		*result = NULL;
+		return 0;
+	}
+	if(!radname_labels(d, max, offs, &labs)) {
+		*result = NULL;
+		return 0; /* parse error */
+	}
+	return radname_find_less_equal_labels(rt, d, offs, labs, result);
+}
+
+int radname_find_less_equal_labels(struct radtree* rt, const uint8_t* d,
+	const uint8_t* offs, unsigned int labs, struct radnode** result)
+{
+	/* the current label, its index in offs and position in it */
+	const uint8_t* lbl;
+	unsigned int lab, lpos;
 	struct radnode* n = rt->root;
 	uint8_t byte;
 	radstrlen_type i;
@@ -1293,11 +1353,7 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 	}
 
 	/* search for root? it is '' */
-	if(max < 1) {
-		*result = NULL;
-		return 0; /* parse error, out of bounds */
-	}
-	if(d[0] == 0) {
+	if(labs <= 1) {
 		if(n->elem) {
 			*result = n;
 			return 1;
@@ -1307,37 +1363,17 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 		return 0;
 	}
 
-	/* find labels stack in domain name */
-	lab = 0;
-	dpos = 0;
-	/* must have one label, since root is specialcased */
-	do {
-		if((d[dpos] & 0xc0)) {
-			*result = NULL;
-			return 0; /* compression ptrs not allowed error */
-		}
-		labstart[lab++] = &d[dpos];
-		if(dpos + d[dpos] + 1 >= max) {
-			*result = NULL; /* format error: outside of bounds */
-			return 0;
-		}
-		/* skip the label contents */
-		dpos += d[dpos];
-		dpos ++;
-	} while(d[dpos] != 0);
-	/* exit condition makes that root label is not in the labstarts */
-	/* now: dpos+1 is length of domain name. lab is number of labels-1 */
-
 	/* start processing at the last label */
-	lab-=1;
+	lab = 1;
+	lbl = d + offs[lab];
 	lpos = 0;
 	while(1) {
 		/* fetch next byte this label */
-		if(lpos < *labstart[lab])
+		if(lpos < *lbl)
 			/* lpos+1 to skip labelstart, lpos++ to move forward */
-			byte = char_d2r(labstart[lab][++lpos]);
+			byte = char_d2r(lbl[++lpos]);
 		else {
-			if(lab == 0) {
+			if(lab == labs-1) {
 				/* last label - we're done */
 				/* exact match */
 				if(n->elem) {
@@ -1351,7 +1387,7 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 			}
 			/* next label, search for byte 0 the label separator */
 			lpos = 0;
-			lab--;
+			lbl = d + offs[++lab];
 			byte = 0;
 		}
 		/* find that byte in the array */
@@ -1382,12 +1418,12 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 			/* see how many bytes we need and start matching them*/
 			for(i=0; i<n->array[byte].len; i++) {
 				/* next byte to match */
-				if(lpos < *labstart[lab])
-					b = char_d2r(labstart[lab][++lpos]);
+				if(lpos < *lbl)
+					b = char_d2r(lbl[++lpos]);
 				else {
 					/* if last label, no match since
 					 * we are in the additional string */
-					if(lab == 0) {
+					if(lab == labs-1) {
 						/* dname ended, thus before
 						 * this array element */
 						*result =radix_prev(
@@ -1396,7 +1432,7 @@ int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 					}
 					/* next label, search for byte 00 */
 					lpos = 0;
-					lab--;
+					lbl = d + offs[++lab];
 					b = 0;
 				}
 				if(b < n->array[byte].str[i]) {
@@ -12,6 +12,18 @@ struct region;
 /** length of the binary string */
 typedef uint16_t radstrlen_type;
 
+/**
+ * radix select edge in array
+ */
+struct radsel {
+	/** additional string after the selection-byte for this edge. */
+	uint8_t* str;
+	/** length of the additional string for this edge */
+	radstrlen_type len;
+	/** node that deals with byte+str */
+	struct radnode* node;
+} ATTR_PACKED;
+
 /**
  * The radix tree
  *
@@ -32,7 +44,10 @@ struct radtree {
 
 /**
  * A radix tree lookup node.
- * The array is malloced separately from the radnode.
+ * The array is malloced separately from the radnode, except for nodes
+ * with a lookup array of one entry, the most common kind of inner node,
+ * that use the entry in the node, so that the lookup does not need to
+ * fetch another cache line.
  */
 struct radnode {
 	/** data element associated with the binary string up to this node */
@@ -49,18 +64,8 @@ struct radnode {
 	uint16_t capacity;
 	/** the lookup array by [byte-offset] */
 	struct radsel* array; 
-} ATTR_PACKED;
-
-/**
- * radix select edge in array
- */
-struct radsel {
-	/** additional string after the selection-byte for this edge. */
-	uint8_t* str;
-	/** length of the additional string for this edge */
-	radstrlen_type len;
-	/** node that deals with byte+str */
-	struct radnode* node;
+	/** the lookup array when it has a capacity of one */
+	struct radsel single;
 } ATTR_PACKED;
 
 /**
@@ -213,6 +218,34 @@ struct radnode* radname_search(struct radtree* rt, const uint8_t* d,
 int radname_find_less_equal(struct radtree* rt, const uint8_t* d, size_t max,
 	struct radnode** result);
 
+/**
+ * Search the radix tree using a domain name and its label offsets, like
+ * radname_search, but without the pass over the name that finds the
+ * labels. The offsets are ordered like in a dname_type.
+ * @param rt: tree
+ * @param d: domain name, checked already.
+ * @param offs: label offsets in d, offs[0] is the root label and
+ * 	offs[labs-1] the first label of the name.
+ * @param labs: number of labels, including the root label.
+ * @return NULL if not found.
+ */
+struct radnode* radname_search_labels(struct radtree* rt, const uint8_t* d,
+	const uint8_t* offs, unsigned int labs);
+
+/**
+ * Find radix element by domain name and its label offsets, or the closest
+ * smaller or equal element, like radname_find_less_equal.
+ * @param rt: the radix tree.
+ * @param d: domain name, checked already.
+ * @param offs: label offsets in d, like for radname_search_labels.
+ * @param labs: number of labels, including the root label.
+ * @param result: returns the radix node or closest match (NULL if key is
+ * 	smaller than the smallest key in the tree).
+ * @return true if exact match, false if no match.
+ */
+int radname_find_less_equal_labels(struct radtree* rt, const uint8_t* d,
+	const uint8_t* offs, unsigned int labs, struct radnode** result);
+
 /**
  * Insert radix element by domain name.
  * @param rt: the radix tree
@@ -626,13 +626,23 @@ rdata_nsec_to_string(buffer_type *output, rdata_atom_type rdata,
 			return 0;
 		}
 
-		for (i = 0; i < bitmap_size * 8; ++i) {
-			if (get_bit(bitmap, i)) {
-				buffer_printf(output,
-					      "%s%s",
-					      insert_space ? " " : "",
-					      rrtype_to_string(
-						      window * 256 + i));
+		/* a byte at a time, most of the bitmap is zero */
+		for (i = 0; i < bitmap_size; ++i) {
+			uint8_t bits = bitmap[i];
+			while (bits) {
+				int bit = 7;
+				const char* str;
+				size_t len;
+				while (!(bits & (1 << bit)))
+					bit--;
+				bits &= ~(1 << bit);
+				str = rrtype_to_string(
+					window * 256 + i * 8 + (7 - bit));
+				len = strlen(str);
+				buffer_reserve(output, len + 1);
+				if (insert_space)
+					buffer_write_u8(output, ' ');
+				buffer_write(output, str, len);
 				insert_space = 1;
 			}
 		}
@@ -926,16 +936,49 @@ rdata_atom_to_string(buffer_type *output, rdata_zoneformat_type type,
 	return rdata_to_string_table[type](output, rdata, record);
 }
 
-ssize_t
-rdata_wireformat_to_rdata_atoms(region_type *region,
-				domain_table_type *owners,
-				uint16_t rrtype,
-				uint16_t data_size,
-				buffer_type *packet,
-				rdata_atom_type **rdatas)
+/* pack the atoms of an RRSIG into one atom with the rdata in wireformat,
+ * with the signer name in lowercase, that is the same in the canonical
+ * form that is signed */
+static ssize_t
+rdata_rrsig_pack(region_type *region, rdata_atom_type *temp_rdatas,
+	size_t count, rdata_atom_type **rdatas)
+{
+	size_t size = 0, pos = 0, j, k;
+	uint8_t *block, *data;
+	for (j = 0; j < count; ++j)
+		size += rdata_atom_size(temp_rdatas[j]);
+	block = (uint8_t *) region_alloc(region, sizeof(rdata_atom_type) +
+		RDATA_ATOM_ALIGN(sizeof(uint16_t) + size));
+	((rdata_atom_type *) block)->data = (uint16_t *) (block +
+		sizeof(rdata_atom_type));
+	((rdata_atom_type *) block)->data[0] = (uint16_t) size;
+	data = block + sizeof(rdata_atom_type) + sizeof(uint16_t);
+	for (j = 0; j < count; ++j) {
+		size_t len = rdata_atom_size(temp_rdatas[j]);
+		memcpy(data + pos, rdata_atom_data(temp_rdatas[j]), len);
+		if (rdata_atom_is_literal_domain(TYPE_RRSIG, j)) {
+			/* the label lengths are not letters */
+			for (k = 0; k < len; ++k)
+				data[pos + k] = tolower(data[pos + k]);
+		}
+		pos += len;
+	}
+	*rdatas = (rdata_atom_type *) block;
+	return 1;
+}
+
+static ssize_t
+rdata_wireformat_to_atoms(region_type *region,
+			  domain_table_type *owners,
+			  uint16_t rrtype,
+			  uint16_t data_size,
+			  buffer_type *packet,
+			  rdata_atom_type **rdatas,
+			  int pack)
 {
 	size_t end = buffer_position(packet) + data_size;
-	size_t i;
+	size_t i, j, pos;
+	uint8_t *block;
 	rdata_atom_type temp_rdatas[MAXRDATALEN];
 	rrtype_descriptor_type *descriptor = rrtype_descriptor_by_type(rrtype);
 	region_type *temp_region;
@@ -1060,7 +1103,7 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 			}
 			if(is_wirestore) {
 				temp_rdatas[i].data = (uint16_t *) region_alloc(
-                                	region, sizeof(uint16_t) + ((size_t)dname->name_size));
+					temp_region, sizeof(uint16_t) + ((size_t)dname->name_size));
 				temp_rdatas[i].data[0] = dname->name_size;
 				memcpy(temp_rdatas[i].data+1, dname_name(dname),
 					dname->name_size);
@@ -1084,7 +1127,7 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 			}
 
 			temp_rdatas[i].data = (uint16_t *) region_alloc(
-				region, sizeof(uint16_t) + length);
+				temp_region, sizeof(uint16_t) + length);
 			temp_rdatas[i].data[0] = length;
 			buffer_read(packet, temp_rdatas[i].data + 1, length);
 		}
@@ -1096,12 +1139,198 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 		return -1;
 	}
 
-	*rdatas = (rdata_atom_type *) region_alloc_array_init(
-		region, temp_rdatas, i, sizeof(rdata_atom_type));
+	if (pack && rrtype == TYPE_RRSIG) {
+		ssize_t n = rdata_rrsig_pack(region, temp_rdatas, i, rdatas);
+		region_destroy(temp_region);
+		return n;
+	}
+
+	/* one block, with the atoms followed by the data of the atoms
+	 * that are not domains */
+	block = (uint8_t *) region_alloc(region,
+		rdata_atoms_size(rrtype, i, temp_rdatas));
+	pos = sizeof(rdata_atom_type) * i;
+	for (j = 0; j < i; ++j) {
+		size_t size;
+		if (rdata_atom_is_domain(rrtype, j))
+			continue;
+		size = sizeof(uint16_t) + rdata_atom_size(temp_rdatas[j]);
+		memcpy(block + pos, temp_rdatas[j].data, size);
+		temp_rdatas[j].data = (uint16_t *) (block + pos);
+		pos += RDATA_ATOM_ALIGN(size);
+	}
+	memcpy(block, temp_rdatas, sizeof(rdata_atom_type) * i);
+	*rdatas = (rdata_atom_type *) block;
 	region_destroy(temp_region);
 	return (ssize_t)i;
 }
 
+ssize_t
+rdata_wireformat_to_rdata_atoms(region_type *region,
+				domain_table_type *owners,
+				uint16_t rrtype,
+				uint16_t data_size,
+				buffer_type *packet,
+				rdata_atom_type **rdatas)
+{
+	return rdata_wireformat_to_atoms(region, owners, rrtype, data_size,
+		packet, rdatas, 1);
+}
+
+ssize_t
+rdata_rrsig_unpack(region_type *region, rr_type *rr, rdata_atom_type **rdatas)
+{
+	buffer_type packet;
+	assert(rr->type == TYPE_RRSIG && rr->rdata_count == 1);
+	buffer_create_from(&packet, rdata_atom_data(rr->rdatas[0]),
+		rdata_atom_size(rr->rdatas[0]));
+	return rdata_wireformat_to_atoms(region, NULL, TYPE_RRSIG,
+		rdata_atom_size(rr->rdatas[0]), &packet, rdatas, 0);
+}
+
+int
+rdata_wireformat_check(uint16_t rrtype, uint16_t data_size,
+	buffer_type *packet)
+{
+	size_t end = buffer_position(packet) + data_size;
+	size_t i;
+	uint8_t gateway_type = IPSECKEY_NOGATEWAY;
+	uint8_t buf[MAXDOMAINLEN + 1];
+	rrtype_descriptor_type *descriptor = rrtype_descriptor_by_type(rrtype);
+
+	if (!buffer_available(packet, data_size)) {
+		return 0;
+	}
+
+	for (i = 0; i < descriptor->maximum; ++i) {
+		int is_domain = 0;
+		size_t length = 0;
+		int required = i < descriptor->minimum;
+
+		switch (rdata_atom_wireformat_type(rrtype, i)) {
+		case RDATA_WF_COMPRESSED_DNAME:
+		case RDATA_WF_UNCOMPRESSED_DNAME:
+		case RDATA_WF_LITERAL_DNAME:
+			is_domain = 1;
+			break;
+		case RDATA_WF_BYTE:
+			length = sizeof(uint8_t);
+			break;
+		case RDATA_WF_SHORT:
+			length = sizeof(uint16_t);
+			break;
+		case RDATA_WF_LONG:
+			length = sizeof(uint32_t);
+			break;
+		case RDATA_WF_TEXTS:
+		case RDATA_WF_LONG_TEXT:
+		case RDATA_WF_BINARY:
+			length = end - buffer_position(packet);
+			break;
+		case RDATA_WF_TEXT:
+		case RDATA_WF_BINARYWITHLENGTH:
+			length = 1;
+			if (buffer_position(packet) + length <= end) {
+				length += buffer_current(packet)[length - 1];
+			}
+			break;
+		case RDATA_WF_A:
+			length = sizeof(in_addr_t);
+			break;
+		case RDATA_WF_AAAA:
+			length = IP6ADDRLEN;
+			break;
+		case RDATA_WF_ILNP64:
+			length = IP6ADDRLEN/2;
+			break;
+		case RDATA_WF_EUI48:
+			length = EUI48ADDRLEN;
+			break;
+		case RDATA_WF_EUI64:
+			length = EUI64ADDRLEN;
+			break;
+		case RDATA_WF_APL:
+			length = (sizeof(uint16_t)    /* address family */
+				  + sizeof(uint8_t)   /* prefix */
+				  + sizeof(uint8_t)); /* length */
+			if (buffer_position(packet) + length <= end) {
+				/* Mask out negation bit.  */
+				length += (buffer_current(packet)[length - 1]
+					   & APL_LENGTH_MASK);
+			}
+			break;
+		case RDATA_WF_IPSECGATEWAY:
+			switch(gateway_type) {
+			default:
+			case IPSECKEY_NOGATEWAY:
+				length = 0;
+				break;
+			case IPSECKEY_IP4:
+				length = IP4ADDRLEN;
+				break;
+			case IPSECKEY_IP6:
+				length = IP6ADDRLEN;
+				break;
+			case IPSECKEY_DNAME:
+				is_domain = 1;
+				break;
+			}
+			break;
+		case RDATA_WF_SVCPARAM:
+			length = 4;
+			if (buffer_position(packet) + 4 <= end) {
+				length +=
+				    read_uint16(buffer_current(packet) + 2);
+			}
+			break;
+		}
+
+		if (is_domain) {
+			if (!required && buffer_position(packet) == end) {
+				break;
+			}
+			if (!dname_make_wire_from_packet(buf, packet, 1) ||
+				buffer_position(packet) > end) {
+				/* Error in domain name.  */
+				return 0;
+			}
+		} else {
+			if (buffer_position(packet) + length > end) {
+				if (required) {
+					/* Truncated RDATA.  */
+					return 0;
+				} else {
+					break;
+				}
+			}
+			if (!required && buffer_position(packet) == end) {
+				break;
+			}
+			/* the gateway type of IPSECKEY */
+			if (i == 1 && length > 0)
+				gateway_type = buffer_current(packet)[0];
+			buffer_skip(packet, length);
+		}
+	}
+
+	/* no trailing garbage */
+	return buffer_position(packet) == end;
+}
+
+size_t
+rdata_atoms_size(uint16_t rrtype, size_t rdata_count,
+	rdata_atom_type *rdatas)
+{
+	size_t result = sizeof(rdata_atom_type) * rdata_count;
+	size_t i;
+	for (i = 0; i < rdata_count; ++i) {
+		if (!rdata_atom_is_domain(rrtype, i))
+			result += RDATA_ATOM_ALIGN(sizeof(uint16_t)
+				+ rdata_atom_size(rdatas[i]));
+	}
+	return result;
+}
+
 size_t
 rdata_maximum_wireformat_size(rrtype_descriptor_type *descriptor,
 			      size_t rdata_count,
@@ -1150,6 +1379,20 @@ print_rdata(buffer_type *output, rrtype_descriptor_type *descriptor,
 	size_t i;
 	size_t saved_position = buffer_position(output);
 
+	if (record->type == TYPE_RRSIG && record->rdata_count == 1) {
+		/* print the fields of the packed RRSIG */
+		region_type *region = region_create(xalloc, free);
+		rr_type rr = *record;
+		ssize_t n = rdata_rrsig_unpack(region, record, &rr.rdatas);
+		int r = 0;
+		if (n > 0) {
+			rr.rdata_count = (uint16_t) n;
+			r = print_rdata(output, descriptor, &rr);
+		}
+		region_destroy(region);
+		return r;
+	}
+
 	for (i = 0; i < record->rdata_count; ++i) {
 		if (i == 0) {
 			buffer_printf(output, "\t");
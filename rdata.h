@@ -39,6 +39,37 @@ ssize_t rdata_wireformat_to_rdata_atoms(region_type *region,
 					buffer_type *packet,
 					rdata_atom_type **rdatas);
 
+/*
+ * The rdata of an RRSIG is stored in one atom, in wireformat, with the
+ * signer name in lowercase, so that the RRSIGs that are most of a signed
+ * zone do not have an atom and length per field. This splits it into the
+ * atoms of the fields, in REGION, for printing. Returns the number of
+ * atoms, or -1 on failure.
+ */
+ssize_t rdata_rrsig_unpack(region_type *region, rr_type *rr,
+	rdata_atom_type **rdatas);
+
+/*
+ * Check that the RDATA_SIZE bytes of rdata in PACKET are valid for the
+ * rrtype, like rdata_wireformat_to_rdata_atoms does, but without making
+ * the atoms. The packet position is after the rdata.
+ *
+ * Returns 0 on failure.
+ */
+int rdata_wireformat_check(uint16_t rrtype, uint16_t rdata_size,
+	buffer_type *packet);
+
+/* the data of an atom in the block is aligned for its uint16_t length */
+#define RDATA_ATOM_ALIGN(x) (((x) + 1) & ~((size_t)1))
+
+/*
+ * The size of the block with the rdata atoms, as allocated by
+ * rdata_wireformat_to_rdata_atoms: the atoms, followed by the length and
+ * data of the atoms that are not domains. It is used to recycle it.
+ */
+size_t rdata_atoms_size(uint16_t rrtype, size_t rdata_count,
+	rdata_atom_type *rdatas);
+
 /*
  * Calculate the maximum size of the rdata assuming domain names are
  * not compressed.
@@ -17,6 +17,17 @@
 #include "region-allocator.h"
 #include "util.h"
 
+#if defined(USE_SLAB_ALLOC) && (!defined(HAVE_MMAP) || !defined(HAVE_MUNMAP))
+#undef USE_SLAB_ALLOC
+#endif
+#ifdef USE_SLAB_ALLOC
+#include <errno.h>
+#include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define	MAP_ANONYMOUS	MAP_ANON
+#endif
+#endif /* USE_SLAB_ALLOC */
+
 /** This value is enough so that x*y does not overflow if both < than this */
 #define REGION_NO_OVERFLOW ((size_t)1 << (sizeof(size_t) * 4))
 
@@ -52,6 +63,24 @@ struct large_elem {
 	struct large_elem* prev;
 };
 
+/* header at the start of a slab page, the page has blocks of one size */
+struct slab_page {
+	/* list of all the slab pages of the region */
+	struct slab_page* next;
+	struct slab_page* prev;
+	/* list of the pages of this size that have space for a block */
+	struct slab_page* pnext;
+	struct slab_page* pprev;
+	/* recycled blocks in this page */
+	struct recycle_elem* free;
+	/* size of the blocks */
+	size_t size;
+	/* number of blocks in use */
+	size_t used;
+	/* offset of the part of the page that has not been used yet */
+	size_t fresh;
+};
+
 struct region
 {
 	size_t        total_allocated;
@@ -82,8 +111,32 @@ struct region
 	struct recycle_elem** recycle_bin;
 	/* amount of memory in recycle storage */
 	size_t		recycle_size;
+
+	/* if not NULL the small objects are kept in slab pages.
+	 * Array [i] points to the pages, for elements of size i, that have
+	 * space for another element. */
+	struct slab_page** slab_class;
+	/* list of all the slab pages */
+	struct slab_page* slab_pages;
+	size_t		slab_page_count;
+	/* number of empty slab pages given back */
+	size_t		slab_pages_freed;
+
+	/* if true, the chunks are kept for reuse by region_free_all.
+	 * The chunks after the first are in a list, linked at their start,
+	 * of chunks in use and of chunks kept for later. */
+	int		arena;
+	struct recycle_elem* arena_used;
+	struct recycle_elem* arena_kept;
 };
 
+#ifdef USE_SLAB_ALLOC
+/* The slab pages are aligned on their size, so that the page of a block
+ * can be found from its address. */
+#define REGION_SLAB_SIZE	65536
+#define REGION_SLAB_HEADER	REGION_ALIGN_UP(sizeof(struct slab_page), ALIGNMENT)
+#endif /* USE_SLAB_ALLOC */
+
 
 static region_type *
 alloc_region_base(void *(*allocator)(size_t size),
@@ -101,6 +154,13 @@ alloc_region_base(void *(*allocator)(size_t size),
 	result->recycle_bin = NULL;
 	result->recycle_size = 0;
 	result->large_list = NULL;
+	result->slab_class = NULL;
+	result->slab_pages = NULL;
+	result->slab_page_count = 0;
+	result->slab_pages_freed = 0;
+	result->arena = 0;
+	result->arena_used = NULL;
+	result->arena_kept = NULL;
 
 	result->allocated = 0;
 	result->data = NULL;
@@ -180,6 +240,196 @@ region_type *region_create_custom(void *(*allocator)(size_t),
 	return result;
 }
 
+region_type *region_create_arena(void *(*allocator)(size_t),
+				 void (*deallocator)(void *),
+				 size_t chunk_size,
+				 size_t large_object_size,
+				 size_t initial_cleanup_size)
+{
+	region_type* result = region_create_custom(allocator, deallocator,
+		chunk_size, large_object_size, initial_cleanup_size, 0);
+	if(!result)
+		return NULL;
+	/* the later chunks start with the link */
+	assert(chunk_size >= large_object_size + sizeof(struct recycle_elem));
+	result->arena = 1;
+	return result;
+}
+
+region_type *region_create_slab(void *(*allocator)(size_t),
+				void (*deallocator)(void *),
+				size_t large_object_size,
+				size_t initial_cleanup_size)
+{
+#ifdef USE_SLAB_ALLOC
+	region_type* result = alloc_region_base(allocator, deallocator,
+		initial_cleanup_size);
+	if(!result)
+		return NULL;
+	/* a page holds at least a couple of blocks of the largest size */
+	assert(large_object_size <= REGION_SLAB_SIZE / 8);
+	result->chunk_size = 0;
+	result->chunk_count = 0;
+	result->large_object_size = large_object_size;
+	result->slab_class = allocator(sizeof(struct slab_page*)
+		* result->large_object_size);
+	if(!result->slab_class) {
+		region_destroy(result);
+		return NULL;
+	}
+	memset(result->slab_class, 0, sizeof(struct slab_page*)
+		* result->large_object_size);
+	return result;
+#else
+	return region_create_custom(allocator, deallocator,
+		large_object_size * 8, large_object_size,
+		initial_cleanup_size, 1);
+#endif /* USE_SLAB_ALLOC */
+}
+
+#ifdef USE_SLAB_ALLOC
+/* true if the slab page has no space for another block */
+static int
+slab_page_full(struct slab_page* page)
+{
+	return !page->free && page->fresh + page->size > REGION_SLAB_SIZE;
+}
+
+static void
+slab_class_insert(region_type* region, struct slab_page* page)
+{
+	page->pprev = NULL;
+	page->pnext = region->slab_class[page->size];
+	if(page->pnext)
+		page->pnext->pprev = page;
+	region->slab_class[page->size] = page;
+}
+
+static void
+slab_class_remove(region_type* region, struct slab_page* page)
+{
+	if(page->pprev)
+		page->pprev->pnext = page->pnext;
+	else	region->slab_class[page->size] = page->pnext;
+	if(page->pnext)
+		page->pnext->pprev = page->pprev;
+	page->pnext = NULL;
+	page->pprev = NULL;
+}
+
+/* get a new slab page for blocks of size from the OS */
+static struct slab_page*
+slab_page_create(region_type* region, size_t size)
+{
+	char *base, *start;
+	struct slab_page* page;
+
+	/* map twice the size, and unmap the parts around the aligned page */
+	base = mmap(NULL, 2*REGION_SLAB_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED) {
+		log_msg(LOG_ERR, "region slab mmap failed: %s",
+			strerror(errno));
+		return NULL;
+	}
+	start = (char*)(((uintptr_t)base + REGION_SLAB_SIZE - 1) &
+		~((uintptr_t)REGION_SLAB_SIZE - 1));
+	if(start > base)
+		(void)munmap(base, start - base);
+	if(start + REGION_SLAB_SIZE < base + 2*REGION_SLAB_SIZE)
+		(void)munmap(start + REGION_SLAB_SIZE,
+			(base + 2*REGION_SLAB_SIZE) - (start + REGION_SLAB_SIZE));
+
+	page = (struct slab_page*)start;
+	page->free = NULL;
+	page->size = size;
+	page->used = 0;
+	page->fresh = REGION_SLAB_HEADER;
+	page->prev = NULL;
+	page->next = region->slab_pages;
+	if(page->next)
+		page->next->prev = page;
+	region->slab_pages = page;
+	slab_class_insert(region, page);
+	region->slab_page_count++;
+	return page;
+}
+
+/* give the slab page back to the OS, it is not in a class list */
+static void
+slab_page_delete(region_type* region, struct slab_page* page)
+{
+	if(page->prev)
+		page->prev->next = page->next;
+	else	region->slab_pages = page->next;
+	if(page->next)
+		page->next->prev = page->prev;
+	region->slab_page_count--;
+	if(munmap(page, REGION_SLAB_SIZE) == -1)
+		log_msg(LOG_ERR, "region slab munmap failed: %s",
+			strerror(errno));
+}
+
+static void *
+slab_alloc(region_type *region, size_t aligned_size, size_t size)
+{
+	struct slab_page* page = region->slab_class[aligned_size];
+	void *result;
+
+	if(!page) {
+		page = slab_page_create(region, aligned_size);
+		if(!page)
+			return NULL;
+	}
+	if(page->free) {
+		result = (void*)page->free;
+		page->free = page->free->next;
+		region->recycle_size -= aligned_size;
+	} else {
+		result = (char*)page + page->fresh;
+		page->fresh += aligned_size;
+	}
+	page->used++;
+	if(slab_page_full(page))
+		slab_class_remove(region, page);
+
+	region->total_allocated += aligned_size;
+	region->unused_space += aligned_size - size;
+	++region->small_objects;
+	return result;
+}
+
+static void
+slab_recycle(region_type *region, void *block, size_t size)
+{
+	struct slab_page* page = (struct slab_page*)((uintptr_t)block &
+		~((uintptr_t)REGION_SLAB_SIZE - 1));
+	struct recycle_elem* elem = (struct recycle_elem*)block;
+	int full = slab_page_full(page);
+
+	assert(page->used > 0 && size <= page->size);
+	elem->next = page->free;
+	page->free = elem;
+	page->used--;
+	region->total_allocated -= page->size;
+	region->unused_space -= page->size - size;
+	region->recycle_size += page->size;
+	--region->small_objects;
+
+	if(full) {
+		slab_class_insert(region, page);
+	} else if(page->used == 0 && (page->pprev || page->pnext)) {
+		/* The page is empty. It is given back unless it is the only
+		 * one of its size with space, so that a size that is alloced
+		 * and recycled in turn does not need a new page every time. */
+		slab_class_remove(region, page);
+		region->recycle_size -= page->fresh - REGION_SLAB_HEADER;
+		slab_page_delete(region, page);
+		region->slab_pages_freed++;
+	}
+}
+#endif /* USE_SLAB_ALLOC */
+
 
 void
 region_destroy(region_type *region)
@@ -195,6 +445,13 @@ region_destroy(region_type *region)
 	deallocator(region->initial_data);
 	if(region->recycle_bin)
 		deallocator(region->recycle_bin);
+	if(region->slab_class)
+		deallocator(region->slab_class);
+	while(region->arena_kept) {
+		struct recycle_elem* c = region->arena_kept;
+		region->arena_kept = c->next;
+		deallocator(c);
+	}
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
 		while(p) {
@@ -275,6 +532,11 @@ region_alloc(region_type *region, size_t size)
 		return (char *)result + sizeof(struct large_elem);
 	}
 
+#ifdef USE_SLAB_ALLOC
+	if (region->slab_class)
+		return slab_alloc(region, aligned_size, size);
+#endif
+
 	if (region->recycle_bin && region->recycle_bin[aligned_size]) {
 		result = (void*)region->recycle_bin[aligned_size];
 		region->recycle_bin[aligned_size] = region->recycle_bin[aligned_size]->next;
@@ -284,10 +546,16 @@ region_alloc(region_type *region, size_t size)
 	}
 
 	if (region->allocated + aligned_size > region->chunk_size) {
-		void *chunk = region->allocator(region->chunk_size);
+		void *chunk;
 		size_t wasted;
-		if (!chunk)
-			return NULL;
+		if (region->arena_kept) {
+			chunk = region->arena_kept;
+			region->arena_kept = region->arena_kept->next;
+		} else {
+			chunk = region->allocator(region->chunk_size);
+			if (!chunk)
+				return NULL;
+		}
 
 		wasted = (region->chunk_size - region->allocated) & (~(ALIGNMENT-1));
 		if(
@@ -306,15 +574,24 @@ region_alloc(region_type *region, size_t size)
 		++region->chunk_count;
 		region->unused_space += region->chunk_size - region->allocated;
 
-		if(!region_add_cleanup(region, region->deallocator, chunk)) {
-			region->deallocator(chunk);
-			region->chunk_count--;
-			region->unused_space -=
-                                region->chunk_size - region->allocated;
-			return NULL;
+		if(region->arena) {
+			((struct recycle_elem*)chunk)->next = region->arena_used;
+			region->arena_used = (struct recycle_elem*)chunk;
+			region->allocated = REGION_ALIGN_UP(
+				sizeof(struct recycle_elem), ALIGNMENT);
+			region->data = (char *) chunk;
+		} else {
+			if(!region_add_cleanup(region, region->deallocator,
+				chunk)) {
+				region->deallocator(chunk);
+				region->chunk_count--;
+				region->unused_space -=
+					region->chunk_size - region->allocated;
+				return NULL;
+			}
+			region->allocated = 0;
+			region->data = (char *) chunk;
 		}
-		region->allocated = 0;
-		region->data = (char *) chunk;
 	}
 
 	result = region->data + region->allocated;
@@ -399,6 +676,16 @@ region_free_all(region_type *region)
 		region->recycle_size = 0;
 	}
 
+#ifdef USE_SLAB_ALLOC
+	if(region->slab_class) {
+		while(region->slab_pages)
+			slab_page_delete(region, region->slab_pages);
+		memset(region->slab_class, 0, sizeof(struct slab_page*)
+			* region->large_object_size);
+		region->recycle_size = 0;
+	}
+#endif
+
 	if(region->large_list) {
 		struct large_elem* p = region->large_list, *np;
 		void (*deallocator)(void *) = region->deallocator;
@@ -410,6 +697,14 @@ region_free_all(region_type *region)
 		region->large_list = NULL;
 	}
 
+	/* keep the chunks of an arena for the next use */
+	while(region->arena_used) {
+		struct recycle_elem* c = region->arena_used;
+		region->arena_used = c->next;
+		c->next = region->arena_kept;
+		region->arena_kept = c;
+	}
+
 	region->data = region->initial_data;
 	region->cleanup_count = 0;
 	region->allocated = 0;
@@ -417,7 +712,7 @@ region_free_all(region_type *region)
 	region->total_allocated = 0;
 	region->small_objects = 0;
 	region->large_objects = 0;
-	region->chunk_count = 1;
+	region->chunk_count = region->slab_class ? 0 : 1;
 	region->unused_space = 0;
 }
 
@@ -452,7 +747,7 @@ region_recycle(region_type *region, void *block, size_t size)
 {
 	size_t aligned_size;
 
-	if(!block || !region->recycle_bin)
+	if(!block || (!region->recycle_bin && !region->slab_class))
 		return;
 
 	if (size == 0) {
@@ -464,6 +759,12 @@ region_recycle(region_type *region, void *block, size_t size)
 		struct recycle_elem* elem = (struct recycle_elem*)block;
 		/* we rely on the fact that ALIGNMENT is void* so the next will fit */
 		assert(aligned_size >= sizeof(struct recycle_elem));
+#ifdef USE_SLAB_ALLOC
+		if(region->slab_class) {
+			slab_recycle(region, block, size);
+			return;
+		}
+#endif
 
 #ifdef CHECK_DOUBLE_FREE
 		if(CHECK_DOUBLE_FREE) {
@@ -498,9 +799,64 @@ region_recycle(region_type *region, void *block, size_t size)
 	}
 }
 
+/* number of recycled blocks of the size, in the recycle bin or slabs */
+static size_t
+region_recycle_count(region_type *region, size_t size)
+{
+	size_t count = 0;
+	if(region->recycle_bin) {
+		struct recycle_elem* el = region->recycle_bin[size];
+		while(el) {
+			count++;
+			el = el->next;
+		}
+	}
+#ifdef USE_SLAB_ALLOC
+	if(region->slab_class) {
+		/* only the pages in the class list have recycled blocks */
+		struct slab_page* page = region->slab_class[size];
+		while(page) {
+			count += (page->fresh - REGION_SLAB_HEADER) / size
+				- page->used;
+			page = page->pnext;
+		}
+	}
+#endif
+	return count;
+}
+
+/* Print the fragmentation, the recycled part of the memory held for small
+ * objects, and for slabs the number of pages, to the string. */
+static void
+region_frag_str(region_type *region, char *buf, size_t len)
+{
+	size_t held = 0;
+	buf[0] = 0;
+#ifdef USE_SLAB_ALLOC
+	if(region->slab_class) {
+		held = region->slab_page_count * REGION_SLAB_SIZE;
+		snprintf(buf, len, ", %lu%% fragmented, %lu slab pages "
+			"(%lu given back)",
+			(unsigned long)(held ? region->recycle_size * 100 / held
+			: 0),
+			(unsigned long) region->slab_page_count,
+			(unsigned long) region->slab_pages_freed);
+		return;
+	}
+#endif
+	if(region->recycle_bin) {
+		held = region->chunk_count * region->chunk_size;
+		snprintf(buf, len, ", %lu%% fragmented",
+			(unsigned long)(held ? region->recycle_size * 100 / held
+			: 0));
+	}
+}
+
 void
 region_dump_stats(region_type *region, FILE *out)
 {
+	char frag[128];
+	region_frag_str(region, frag, sizeof(frag));
 	fprintf(out, "%lu objects (%lu small/%lu large), %lu bytes allocated (%lu wasted) in %lu chunks, %lu cleanups, %lu in recyclebin",
 		(unsigned long) (region->small_objects + region->large_objects),
 		(unsigned long) region->small_objects,
@@ -510,18 +866,14 @@ region_dump_stats(region_type *region, FILE *out)
 		(unsigned long) region->chunk_count,
 		(unsigned long) region->cleanup_count,
 		(unsigned long) region->recycle_size);
-	if(region->recycle_bin) {
+	fputs(frag, out);
+	if(region->recycle_bin || region->slab_class) {
 		/* print details of the recycle bin */
 		size_t i;
 		for(i=0; i<region->large_object_size; i++) {
-			size_t count = 0;
-			struct recycle_elem* el = region->recycle_bin[i];
-			while(el) {
-				count++;
-				el = el->next;
-			}
 			if(i%ALIGNMENT == 0 && i!=0)
-				fprintf(out, " %lu", (unsigned long)count);
+				fprintf(out, " %lu", (unsigned long)
+					region_recycle_count(region, i));
 		}
 	}
 }
@@ -560,18 +912,17 @@ region_log_stats(region_type *region)
 	len = strlen(str);
 	str+=len;
 	strl-=len;
-	if(region->recycle_bin) {
+	region_frag_str(region, str, strl);
+	len = strlen(str);
+	str+=len;
+	strl-=len;
+	if(region->recycle_bin || region->slab_class) {
 		/* print details of the recycle bin */
 		size_t i;
 		for(i=0; i<region->large_object_size; i++) {
-			size_t count = 0;
-			struct recycle_elem* el = region->recycle_bin[i];
-			while(el) {
-				count++;
-				el = el->next;
-			}
 			if(i%ALIGNMENT == 0 && i!=0) {
-				snprintf(str, strl, " %lu", (unsigned long)count);
+				snprintf(str, strl, " %lu", (unsigned long)
+					region_recycle_count(region, i));
 				len = strlen(str);
 				str+=len;
 				strl-=len;
@@ -58,6 +58,34 @@ region_type *region_create_custom(void *(*allocator)(size_t),
 				  size_t initial_cleanup_size,
 				  int recycle);
 
+/*
+ * Create a new region for short lived data, that is freed all the time,
+ * like the data for one query. The chunks are kept when the region is
+ * freed, and used again, so that region_free_all only resets the region
+ * to the start of the first chunk, and only the large objects are alloced
+ * and freed for every use. The region keeps as many chunks as the largest
+ * use has needed, until it is destroyed.
+ */
+region_type *region_create_arena(void *(*allocator)(size_t),
+				 void (*deallocator)(void *),
+				 size_t chunk_size,
+				 size_t large_object_size,
+				 size_t initial_cleanup_size);
+
+/*
+ * Create a new region for long lived data that is recycled a lot.
+ * The blocks smaller than large_object_size are kept in pages with blocks
+ * of one size class, and a page is returned to the OS when all its blocks
+ * are recycled, so that the memory of one size can be used for another.
+ * Larger objects are individually alloced with the allocator.
+ * Without slab support (--enable-slab-alloc), this returns a region with
+ * recycling enabled.
+ */
+region_type *region_create_slab(void *(*allocator)(size_t),
+				void (*deallocator)(void *),
+				size_t large_object_size,
+				size_t initial_cleanup_size);
+
 
 /*
  * Destroy REGION.  All memory associated with REGION is freed as if
@@ -74,6 +74,7 @@
 #include "util.h"
 #include "xfrd.h"
 #include "xfrd-catalog-zones.h"
+#include "xfrd-disk.h"
 #include "xfrd-notify.h"
 #include "xfrd-tcp.h"
 #include "nsd.h"
@@ -81,6 +82,7 @@
 #include "difffile.h"
 #include "ipc.h"
 #include "remote.h"
+#include "topstat.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -100,12 +102,21 @@
 
 /** number of seconds timeout on incoming remote control handshake */
 #define REMOTE_CONTROL_TCP_TIMEOUT 120
+/** the number of zones that zonestatus with a count skips at most */
+#define ZONESTATUS_SCAN_MAX 10000
+/** the line after the output of every command in a session */
+#define SESSION_END "\004\n"
 
 /** repattern to master or slave */
 #define REPAT_SLAVE                   1
 #define REPAT_MASTER                  2
 #define REPAT_CATALOG_CONSUMER        4
 #define REPAT_CATALOG_CONSUMER_DEINIT 8
+/* set on an old pattern when it is compared, for the interrupt of zones */
+#define REPAT_COMPARED               16
+#define REPAT_INTERRUPT_XFR          32
+#define REPAT_INTERRUPT_NOTIFY       64
+#define REPAT_INTERRUPT_MASK (REPAT_COMPARED|REPAT_INTERRUPT_XFR|REPAT_INTERRUPT_NOTIFY)
 
 /** if you want zero to be inhibited in stats output.
  * it omits zeroes for types that have no acronym and unused-rcodes */
@@ -132,6 +143,10 @@ struct rc_state {
 #endif
 	/** file descriptor */
 	int fd;
+	/** a local socket, served without TLS */
+	int plain;
+	/** for a session, the stream with its read ahead, malloced */
+	struct remote_stream* session;
 	/** the rc this is part of */
 	struct daemon_remote* rc;
 	/** stats list next item */
@@ -183,6 +198,12 @@ struct remote_stream {
 #endif
 	/** file descriptor for plain transfer */
 	int fd;
+	/** read ahead of the input, and the position and end of it */
+	char in[4096];
+	size_t in_pos, in_len;
+	/** if not NULL, the output is collected here until it is sent with
+	 * ssl_out_flush, so that bulk commands do not write every line */
+	buffer_type* out;
 };
 typedef struct remote_stream RES;
 
@@ -379,6 +400,9 @@ create_tcp_accept_sock(struct addrinfo* addr, int* noproto)
 #endif
 	int s;
 	*noproto = 0;
+	/* passed by the old nsd on the socket-handoff */
+	if ((s = server_handoff_take(addr->ai_addr, addr->ai_socktype)) != -1)
+		return s;
 	if ((s = socket(addr->ai_family, addr->ai_socktype, 0)) == -1) {
 #if defined(INET6)
 		if (addr->ai_family == AF_INET6 &&
@@ -549,6 +573,18 @@ daemon_remote_open_ports(struct daemon_remote* rc, struct nsd_options* cfg)
 	return 1;
 }
 
+size_t
+daemon_remote_handoff(struct daemon_remote* rc, int s)
+{
+	struct acceptlist* p;
+	size_t num = 0;
+	for(p = rc->accept_list; p; p = p->next) {
+		if(p->c.ev_fd != -1)
+			num += server_handoff_send_fd(s, p->c.ev_fd);
+	}
+	return num;
+}
+
 void
 daemon_remote_attach(struct daemon_remote* rc, struct xfrd_state* xfrd)
 {
@@ -662,8 +698,10 @@ remote_accept_callback(int fd, short event, void* arg)
 		}
 	}
 
+	/* access to a local socket is controlled by its file permissions */
+	n->plain = (hl->ident && hl->ident[0] == '/');
 #ifdef HAVE_SSL
-	if(rc->ctx) {
+	if(rc->ctx && !n->plain) {
 		n->shake_state = rc_hs_read;
 		n->ssl = SSL_new(rc->ctx);
 		if(!n->ssl) {
@@ -725,19 +763,19 @@ clean_point(struct daemon_remote* rc, struct rc_state* s)
 	}
 #endif /* HAVE_SSL */
 	close(s->c.ev_fd);
+	free(s->session);
 	free(s);
 }
 
+/** write the data over the ssl connection in blocking mode */
 static int
-ssl_print_text(RES* res, const char* text)
+ssl_write_data(RES* res, const void* data, size_t len)
 {
-	if(!res) 
-		return 0;
 #ifdef HAVE_SSL
 	if(res->ssl) {
 		int r;
 		ERR_clear_error();
-		if((r=SSL_write(res->ssl, text, (int)strlen(text))) <= 0) {
+		if((r=SSL_write(res->ssl, data, (int)len)) <= 0) {
 			if(SSL_get_error(res->ssl, r) == SSL_ERROR_ZERO_RETURN) {
 				VERBOSITY(2, (LOG_WARNING, "in SSL_write, peer "
 					"closed connection"));
@@ -748,7 +786,7 @@ ssl_print_text(RES* res, const char* text)
 		}
 	} else {
 #endif /* HAVE_SSL */
-		if(write_socket(res->fd, text, strlen(text)) <= 0) {
+		if(write_socket(res->fd, data, len) <= 0) {
 			log_msg(LOG_ERR, "could not write: %s",
 				strerror(errno));
 			return 0;
@@ -759,6 +797,39 @@ ssl_print_text(RES* res, const char* text)
 	return 1;
 }
 
+static int
+ssl_print_text(RES* res, const char* text)
+{
+	size_t len;
+	if(!res) 
+		return 0;
+	len = strlen(text);
+	if(res->out) {
+		buffer_reserve(res->out, len);
+		buffer_write(res->out, text, len);
+		return 1;
+	}
+	return ssl_write_data(res, text, len);
+}
+
+/** start collecting the output in a buffer, allocated in region */
+static void
+ssl_out_start(RES* res, region_type* region)
+{
+	res->out = buffer_create(region, 4096);
+}
+
+/** send the collected output, and stop collecting it */
+static int
+ssl_out_flush(RES* res)
+{
+	buffer_type* out = res->out;
+	res->out = NULL;
+	if(!out || buffer_position(out) == 0)
+		return 1;
+	return ssl_write_data(res, buffer_begin(out), buffer_position(out));
+}
+
 /** print text over the ssl connection */
 static int
 ssl_print_vmsg(RES* ssl, const char* format, va_list args)
@@ -780,47 +851,63 @@ ssl_printf(RES* ssl, const char* format, ...)
 	return ret;
 }
 
+/** read the next byte of input, returns 1, 0 on EOF or -1 on failure */
+static int
+ssl_read_byte(RES* res, char* c)
+{
+	if(res->in_pos < res->in_len) {
+		*c = res->in[res->in_pos++];
+		return 1;
+	}
+	res->in_pos = res->in_len = 0;
+#ifdef HAVE_SSL
+	if(res->ssl) {
+		int r;
+		ERR_clear_error();
+		if((r=SSL_read(res->ssl, res->in, (int)sizeof(res->in))) <= 0) {
+			if(SSL_get_error(res->ssl, r) == SSL_ERROR_ZERO_RETURN)
+				return 0;
+			log_crypto_err("could not SSL_read");
+			return -1;
+		}
+		res->in_len = (size_t)r;
+	} else {
+#endif /* HAVE_SSL */
+		while(1) {
+			ssize_t rr = read(res->fd, res->in, sizeof(res->in));
+			if(rr <= 0) {
+				if(rr == 0)
+					return 0;
+				if(errno == EINTR || errno == EAGAIN)
+					continue;
+				log_msg(LOG_ERR, "could not read: %s",
+					strerror(errno));
+				return -1;
+			}
+			res->in_len = (size_t)rr;
+			break;
+		}
+#ifdef HAVE_SSL
+	}
+#endif /* HAVE_SSL */
+	*c = res->in[res->in_pos++];
+	return 1;
+}
+
 static int
 ssl_read_line(RES* res, char* buf, size_t max)
 {
 	size_t len = 0;
+	int r;
 	if(!res)
 		return 0;
 	while(len < max) {
 		buf[len] = 0; /* terminate for safety and please checkers */
 		/* this byte is written if we read a byte from the input */
-#ifdef HAVE_SSL
-		if(res->ssl) {
-			int r;
-			ERR_clear_error();
-			if((r=SSL_read(res->ssl, buf+len, 1)) <= 0) {
-				if(SSL_get_error(res->ssl, r) == SSL_ERROR_ZERO_RETURN) {
-					buf[len] = 0;
-					return 1;
-				}
-				log_crypto_err("could not SSL_read");
-				return 0;
-			}
-		} else {
-#endif /* HAVE_SSL */
-			while(1) {
-				ssize_t rr = read(res->fd, buf+len, 1);
-				if(rr <= 0) {
-					if(rr == 0) {
-						buf[len] = 0;
-						return 1;
-					}
-					if(errno == EINTR || errno == EAGAIN)
-						continue;
-					log_msg(LOG_ERR, "could not read: %s",
-						strerror(errno));
-					return 0;
-				}
-				break;
-			}
-#ifdef HAVE_SSL
+		if((r = ssl_read_byte(res, buf+len)) <= 0) {
+			buf[len] = 0;
+			return r == 0;
 		}
-#endif /* HAVE_SSL */
 		if(buf[len] == '\n') {
 			/* return string without \n */
 			buf[len] = 0;
@@ -923,6 +1010,40 @@ do_write(RES* ssl, xfrd_state_type* xfrd, char* arg)
 	send_ok(ssl);
 }
 
+/** do the snapshot command, that writes the files from which a new
+ * secondary can start, instead of a transfer of every zone */
+static void
+do_snapshot(RES* ssl, xfrd_state_type* xfrd)
+{
+	struct nsd_options* opt = xfrd->nsd->options;
+	struct zone_options* zo;
+	size_t zones = 0, nofile = 0;
+
+	RBTREE_FOR(zo, struct zone_options*, opt->zone_options) {
+		zones++;
+		if(!zo->pattern->zonefile || !zo->pattern->zonefile[0])
+			nofile++;
+	}
+	/* the changed zones are written by the reload, the others are on
+	 * disk already */
+	task_new_write_zonefiles(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, NULL);
+	xfrd_set_reload_now(xfrd);
+	/* the serials and timers of the secondary zones, in one file
+	 * without a journal */
+	xfrd_write_state(xfrd);
+	if(opt->zonelistfile && opt->zonelistfile[0])
+		zone_list_compact(opt);
+	(void)ssl_printf(ssl, "zones: %u\n", (unsigned)zones);
+	(void)ssl_printf(ssl, "zones-without-zonefile: %u\n",
+		(unsigned)nofile);
+	(void)ssl_printf(ssl, "xfrdfile: %s\n", opt->xfrdfile);
+	if(opt->zonelistfile && opt->zonelistfile[0])
+		(void)ssl_printf(ssl, "zonelistfile: %s\n", opt->zonelistfile);
+	if(opt->zonesdir && opt->zonesdir[0])
+		(void)ssl_printf(ssl, "zonesdir: %s\n", opt->zonesdir);
+}
+
 /** do the notify command */
 static void
 do_notify(RES* ssl, xfrd_state_type* xfrd, char* arg)
@@ -980,7 +1101,7 @@ force_transfer_zone(xfrd_zone_type* zone)
 	/* if in TCP transaction, stop it immediately. */
 	if(zone->tcp_conn != -1)
 		xfrd_tcp_release(xfrd->tcp_set, zone);
-	else if(zone->zone_handler.ev_fd != -1)
+	else if(XFRD_ZONE_IN_UDP(zone))
 		xfrd_udp_release(zone);
 	/* pretend we not longer have it and force any
 	 * zone to be downloaded (even same serial, w AXFR) */
@@ -1146,7 +1267,7 @@ print_zonestatus(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo)
 	if(xz->udp_waiting) {
 		if(!ssl_printf(ssl, "	transfer: \"waiting-for-UDP-fd\"\n"))
 			return 0;
-	} else if(xz->zone_handler.ev_fd != -1 && xz->tcp_conn == -1) {
+	} else if(XFRD_ZONE_IN_UDP(xz) && xz->tcp_conn == -1) {
 		if(!ssl_printf(ssl, "	transfer: \"sent UDP to %s\"\n",
 			xz->master->ip_address_spec))
 			return 0;
@@ -1165,11 +1286,168 @@ print_zonestatus(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo)
 	return 1;
 }
 
+/** the filters and the page for the zonestatus of a list of zones */
+struct zonestatus_filter {
+	/* the state to print, or NULL for all */
+	const char* state;
+	/* the pattern to print, or NULL for all */
+	const char* pattern;
+	/* print this name and the zones below it, or NULL for all */
+	const dname_type* below;
+	/* start after this zone, or NULL to start at the first */
+	const dname_type* start;
+	/* the number of zones to print, 0 for all */
+	size_t count;
+};
+
+/** the state of the zone, as printed by zonestatus */
+static const char*
+zonestatus_state(xfrd_state_type* xfrd, struct zone_options* zo)
+{
+	xfrd_zone_type* xz = (xfrd_zone_type*)rbtree_search(xfrd->zones,
+		(const dname_type*)zo->node.key);
+	if(!xz)
+		return "primary";
+	return (xz->state == xfrd_zone_ok)?"ok":(
+		(xz->state == xfrd_zone_expired)?"expired":"refreshing");
+}
+
+/** parse the name in a zonestatus filter, or print an error */
+static const dname_type*
+zonestatus_dname(RES* ssl, region_type* region, const char* str)
+{
+	const dname_type* dname = dname_parse(region, str);
+	if(!dname)
+		(void)ssl_printf(ssl, "error cannot parse zone name '%s'\n",
+			str);
+	return dname;
+}
+
+/** parse the zonestatus filters, like state=expired count=100 */
+static int
+zonestatus_parse_filter(RES* ssl, region_type* region, char* arg,
+	struct zonestatus_filter* f)
+{
+	char* tok, *ptr, *val;
+	memset(f, 0, sizeof(*f));
+	for(tok = strtok_r(arg, " \t", &ptr); tok;
+		tok = strtok_r(NULL, " \t", &ptr)) {
+		if(!(val = strchr(tok, '='))) {
+			(void)ssl_printf(ssl, "error expected filter=value: "
+				"'%s'\n", tok);
+			return 0;
+		}
+		*val++ = 0;
+		if(strcmp(tok, "state") == 0) {
+			if(strcmp(val, "ok") != 0 &&
+				strcmp(val, "expired") != 0 &&
+				strcmp(val, "refreshing") != 0 &&
+				strcmp(val, "primary") != 0) {
+				(void)ssl_printf(ssl, "error unknown state "
+					"'%s'\n", val);
+				return 0;
+			}
+			f->state = val;
+		} else if(strcmp(tok, "pattern") == 0) {
+			f->pattern = val;
+		} else if(strcmp(tok, "below") == 0) {
+			if(!(f->below = zonestatus_dname(ssl, region, val)))
+				return 0;
+		} else if(strcmp(tok, "start") == 0) {
+			if(!(f->start = zonestatus_dname(ssl, region, val)))
+				return 0;
+		} else if(strcmp(tok, "count") == 0) {
+			int c = atoi(val);
+			if(c <= 0) {
+				(void)ssl_printf(ssl, "error expected a number: "
+					"'%s'\n", val);
+				return 0;
+			}
+			f->count = (size_t)c;
+		} else {
+			(void)ssl_printf(ssl, "error unknown filter '%s'\n", tok);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/** the first zone in the tree that is larger than or equal to the name,
+ * or after it if after is true */
+static rbnode_type*
+zonestatus_first(rbtree_type* tree, const dname_type* name, int after)
+{
+	rbnode_type* node;
+	if(rbtree_find_less_equal(tree, name, &node)) {
+		return after?rbtree_next(node):node;
+	}
+	return node?rbtree_next(node):rbtree_first(tree);
+}
+
+/**
+ * Print the zonestatus of the zones that match the filter. The walk
+ * starts at the start or below name in the sorted zone tree, and the
+ * zones below a name are next to each other in it, so that it costs the
+ * zones it prints. With a count, it stops after that many zones, or
+ * after ZONESTATUS_SCAN_MAX zones that do not match, and prints the
+ * zone to start the next page after.
+ */
+static void
+zonestatus_list(RES* ssl, xfrd_state_type* xfrd, struct zonestatus_filter* f)
+{
+	rbtree_type* tree = xfrd->nsd->options->zone_options;
+	rbnode_type* node;
+	struct zone_options* zo, *last = NULL;
+	size_t printed = 0, scanned = 0;
+
+	if(f->start) {
+		node = zonestatus_first(tree, f->start, 1);
+		if(f->below && node != RBTREE_NULL && dname_compare(
+			(const dname_type*)node->key, f->below) < 0)
+			node = zonestatus_first(tree, f->below, 0);
+	} else if(f->below) {
+		node = zonestatus_first(tree, f->below, 0);
+	} else {
+		node = rbtree_first(tree);
+	}
+	for(; node != RBTREE_NULL; node = rbtree_next(node)) {
+		zo = (struct zone_options*)node;
+		if(f->below && !dname_is_subdomain(
+			(const dname_type*)zo->node.key, f->below))
+			return; /* past the zones below the name */
+		if(f->count && (printed >= f->count ||
+			scanned >= ZONESTATUS_SCAN_MAX)) {
+			if(last)
+				(void)ssl_printf(ssl, "next:	%s\n", last->name);
+			return;
+		}
+		last = zo;
+		if((f->pattern && strcmp(zo->pattern->pname, f->pattern) != 0)
+			|| (f->state && strcmp(zonestatus_state(xfrd, zo),
+			f->state) != 0)) {
+			scanned++;
+			continue;
+		}
+		if(!print_zonestatus(ssl, xfrd, zo))
+			return;
+		printed++;
+	}
+}
+
 /** do the zonestatus command */
 static void
 do_zonestatus(RES* ssl, xfrd_state_type* xfrd, char* arg)
 {
 	struct zone_options* zo;
+	struct zonestatus_filter f;
+	region_type* region;
+	if(strchr(arg, '=')) {
+		region = region_create(xalloc, free);
+		if(zonestatus_parse_filter(ssl, region, arg, &f))
+			zonestatus_list(ssl, xfrd, &f);
+		region_destroy(region);
+		return;
+	}
 	if(!get_zone_arg(ssl, xfrd, arg, &zo))
 		return;
 	if(zo) (void)print_zonestatus(ssl, xfrd, zo);
@@ -1182,6 +1460,99 @@ do_zonestatus(RES* ssl, xfrd_state_type* xfrd, char* arg)
 	}
 }
 
+/** print the memory use of one zone, sum it in total */
+static int
+print_zone_mem(RES* ssl, xfrd_state_type* xfrd, struct zone_options* zo,
+	unsigned long long* total)
+{
+	struct notify_zone* nz = (struct notify_zone*)rbtree_search(
+		xfrd->notify_zones, (const dname_type*)zo->node.key);
+	struct zone_mem_usage* m;
+	unsigned long long sz;
+	if(!nz || !nz->mem)
+		return 1; /* not loaded (yet) */
+	m = nz->mem;
+	sz = (unsigned long long)(m->domains + m->rrsets + m->nsec3 + m->ixfr);
+	*total += sz;
+	return ssl_printf(ssl, "mem.%s.domains=%llu\n", zo->name,
+		(unsigned long long)m->domains)
+	    && ssl_printf(ssl, "mem.%s.rrsets=%llu\n", zo->name,
+		(unsigned long long)m->rrsets)
+	    && ssl_printf(ssl, "mem.%s.nsec3=%llu\n", zo->name,
+		(unsigned long long)m->nsec3)
+	    && ssl_printf(ssl, "mem.%s.ixfr=%llu\n", zo->name,
+		(unsigned long long)m->ixfr)
+	    && ssl_printf(ssl, "mem.%s.total=%llu\n", zo->name, sz)
+	    && ssl_printf(ssl, "mem.%s.num_domains=%llu\n", zo->name,
+		(unsigned long long)m->num_domains)
+	    && ssl_printf(ssl, "mem.%s.num_rrsets=%llu\n", zo->name,
+		(unsigned long long)m->num_rrsets);
+}
+
+/** do the mem_stats command */
+static void
+do_mem_stats(RES* ssl, xfrd_state_type* xfrd, char* arg)
+{
+	struct zone_options* zo;
+	unsigned long long total = 0;
+	if(!get_zone_arg(ssl, xfrd, arg, &zo))
+		return;
+	if(zo) {
+		(void)print_zone_mem(ssl, xfrd, zo, &total);
+		return;
+	}
+	RBTREE_FOR(zo, struct zone_options*,
+		xfrd->nsd->options->zone_options) {
+		if(!print_zone_mem(ssl, xfrd, zo, &total))
+			return;
+	}
+	(void)ssl_printf(ssl, "mem.total=%llu\n", total);
+}
+
+/** do the reload_stats command */
+static void
+do_reload_stats(RES* ssl, xfrd_state_type* xfrd)
+{
+	struct reload_stats* rs = xfrd->reload_stats;
+	uint32_t i;
+	if(!rs) {
+		(void)ssl_printf(ssl, "error no reload done yet\n");
+		return;
+	}
+	if(!ssl_printf(ssl, "reload.time=%llu\n",
+		(unsigned long long)rs->done)
+	    || !ssl_printf(ssl, "reload.tasks_usec=%llu\n",
+		(unsigned long long)rs->tasks)
+	    || !ssl_printf(ssl, "reload.fork_usec=%llu\n",
+		(unsigned long long)rs->fork)
+	    || !ssl_printf(ssl, "reload.xfr_usec=%llu\n",
+		(unsigned long long)rs->xfr)
+	    || !ssl_printf(ssl, "reload.verify_usec=%llu\n",
+		(unsigned long long)rs->verify)
+	    || !ssl_printf(ssl, "reload.compact_usec=%llu\n",
+		(unsigned long long)rs->compact)
+	    || !ssl_printf(ssl, "reload.children_usec=%llu\n",
+		(unsigned long long)rs->children)
+	    || !ssl_printf(ssl, "reload.quit_sync_usec=%llu\n",
+		(unsigned long long)rs->quit_sync)
+	    || !ssl_printf(ssl, "reload.total_usec=%llu\n",
+		(unsigned long long)rs->total)
+	    || !ssl_printf(ssl, "reload.num_zones=%u\n",
+		(unsigned)rs->num_zones))
+		return;
+	for(i=0; i<rs->num_slow && i<RELOAD_STATS_ZONES; i++) {
+		struct reload_stats_zone* z = &rs->slow[i];
+		z->name[sizeof(z->name)-1] = 0;
+		if(!ssl_printf(ssl, "reload.zone.%s.parse_usec=%llu\n",
+			z->name, (unsigned long long)z->parse)
+		    || !ssl_printf(ssl, "reload.zone.%s.apply_usec=%llu\n",
+			z->name, (unsigned long long)z->apply)
+		    || !ssl_printf(ssl, "reload.zone.%s.prehash_usec=%llu\n",
+			z->name, (unsigned long long)z->prehash))
+			return;
+	}
+}
+
 /** do the verbosity command */
 static void
 do_verbosity(RES* ssl, char* str)
@@ -1202,6 +1573,56 @@ do_verbosity(RES* ssl, char* str)
 	send_ok(ssl);
 }
 
+/** do the dnstap_sample command */
+static void
+do_dnstap_sample(RES* ssl, xfrd_state_type* xfrd, char* str)
+{
+	int val = atoi(str);
+	if(strcmp(str, "") == 0) {
+		(void)ssl_printf(ssl, "dnstap_sample %d\n",
+			xfrd->nsd->options->dnstap_sample_rate);
+		return;
+	}
+	if(val < 0 || (val == 0 && strcmp(str, "0") != 0)) {
+		(void)ssl_printf(ssl, "error in dnstap_sample number syntax: "
+			"%s\n", str);
+		return;
+	}
+	xfrd->nsd->options->dnstap_sample_rate = val;
+	task_new_dnstap_filter(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, xfrd->nsd->options);
+	xfrd_set_reload_now(xfrd);
+	send_ok(ssl);
+}
+
+/** do the dnstap_filter command */
+static void
+do_dnstap_filter(RES* ssl, xfrd_state_type* xfrd, char* str)
+{
+	struct nsd_options* opt = xfrd->nsd->options;
+	struct dnstap_filter* f;
+	if(strcmp(str, "") == 0) {
+		for(f = opt->dnstap_filters; f; f = f->next)
+			if(!ssl_printf(ssl, "%s\n", f->spec))
+				return;
+		return;
+	}
+	if(strcmp(str, "clear") == 0) {
+		opt->dnstap_filters = NULL;
+	} else {
+		if(!(f = dnstap_filter_parse(opt->region, str))) {
+			(void)ssl_printf(ssl, "error cannot parse dnstap "
+				"filter: %s\n", str);
+			return;
+		}
+		dnstap_filter_append(opt, f);
+	}
+	task_new_dnstap_filter(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, opt);
+	xfrd_set_reload_now(xfrd);
+	send_ok(ssl);
+}
+
 /** find second argument, modifies string */
 static int
 find_arg2(RES* ssl, char* arg, char** arg2)
@@ -1259,6 +1680,15 @@ do_status(RES* ssl, xfrd_state_type* xfrd)
 #else
 	(void)xfrd;
 #endif
+#ifdef BIND8_STATS
+	if(xfrd->nsd->options->server_count_min > 0 &&
+		xfrd->nsd->stat_active_children) {
+		if(!ssl_printf(ssl, "server-count: %u of %u\n",
+			(unsigned)*xfrd->nsd->stat_active_children,
+			(unsigned)xfrd->nsd->child_count))
+			return;
+	}
+#endif
 }
 
 /** do the stats command */
@@ -1273,6 +1703,55 @@ do_stats(RES* ssl, xfrd_state_type* xfrd, int peek)
 #endif /* BIND8_STATS */
 }
 
+/** do the top command, print the heavy hitters since the previous one */
+static void
+do_top(RES* ssl, xfrd_state_type* xfrd, char* arg)
+{
+#ifdef BIND8_STATS
+	const char* kindstr[] = {"qname", "source", "zone"};
+	size_t num = xfrd->nsd->child_count*2, max = 10, n, i;
+	struct topstat* snapshot;
+	struct topstat_entry* top;
+	char buf[MAXDOMAINLEN*5];
+	int kind;
+	if(!xfrd->nsd->topstat_map) {
+		(void)ssl_printf(ssl, "error top-statistics is not enabled\n");
+		return;
+	}
+	if(*arg) {
+		int v = atoi(arg);
+		if(v <= 0) {
+			(void)ssl_printf(ssl, "error expected a number: %s\n",
+				arg);
+			return;
+		}
+		max = (v > TOPSTAT_SIZE) ? TOPSTAT_SIZE : (size_t)v;
+	}
+	snapshot = xmallocarray(num, sizeof(*snapshot));
+	memcpy(snapshot, xfrd->nsd->topstat_map, num*sizeof(*snapshot));
+	topstat_reset(xfrd->nsd->topstat_map, snapshot, num);
+	top = xmallocarray(max, sizeof(*top));
+	for(kind = 0; kind < TOPSTAT_KINDS; kind++) {
+		n = topstat_merge(snapshot, num, kind, top, max);
+		for(i = 0; i < n; i++) {
+			topstat_key2str(kind, &top[i], buf, sizeof(buf));
+			if(!ssl_printf(ssl, "top.%s.%d=%s %llu\n",
+				kindstr[kind], (int)i+1, buf,
+				(unsigned long long)top[i].count)) {
+				free(top);
+				free(snapshot);
+				return;
+			}
+		}
+	}
+	free(top);
+	free(snapshot);
+#else
+	(void)xfrd; (void)arg;
+	(void)ssl_printf(ssl, "error no stats enabled at compile time\n");
+#endif /* BIND8_STATS */
+}
+
 /** see if we have more zonestatistics entries and it has to be incremented */
 static void
 zonestat_inc_ifneeded(xfrd_state_type* xfrd)
@@ -1560,20 +2039,26 @@ do_addzones(RES* ssl, xfrd_state_type* xfrd)
 {
 	char buf[2048];
 	int num = 0;
+	region_type* region = region_create(xalloc, free);
+	/* the output is sent after all of the input is read, and the
+	 * zonelist is written once, at the end */
+	ssl_out_start(ssl, region);
+	zone_list_batch_start(xfrd->nsd->options);
 	while(ssl_read_line(ssl, buf, sizeof(buf))) {
 		if(buf[0] == 0x04 && buf[1] == 0)
 			break; /* end of transmission */
 		if(!perform_addzone(ssl, xfrd, buf)) {
-			if(!ssl_printf(ssl, "error for input line '%s'\n", 
-				buf))
-				return;
+			(void)ssl_printf(ssl, "error for input line '%s'\n",
+				buf);
 		} else {
-			if(!ssl_printf(ssl, "added: %s\n", buf))
-				return;
+			(void)ssl_printf(ssl, "added: %s\n", buf);
 			num++;
 		}
 	}
+	zone_list_batch_end(xfrd->nsd->options);
 	(void)ssl_printf(ssl, "added %d zones\n", num);
+	(void)ssl_out_flush(ssl);
+	region_destroy(region);
 }
 
 /** do the delzones command */
@@ -1582,20 +2067,26 @@ do_delzones(RES* ssl, xfrd_state_type* xfrd)
 {
 	char buf[2048];
 	int num = 0;
+	region_type* region = region_create(xalloc, free);
+	/* the output is sent after all of the input is read, and the
+	 * zonelist is written once, at the end */
+	ssl_out_start(ssl, region);
+	zone_list_batch_start(xfrd->nsd->options);
 	while(ssl_read_line(ssl, buf, sizeof(buf))) {
 		if(buf[0] == 0x04 && buf[1] == 0)
 			break; /* end of transmission */
 		if(!perform_delzone(ssl, xfrd, buf)) {
-			if(!ssl_printf(ssl, "error for input line '%s'\n", 
-				buf))
-				return;
+			(void)ssl_printf(ssl, "error for input line '%s'\n",
+				buf);
 		} else {
-			if(!ssl_printf(ssl, "removed: %s\n", buf))
-				return;
+			(void)ssl_printf(ssl, "removed: %s\n", buf);
 			num++;
 		}
 	}
+	zone_list_batch_end(xfrd->nsd->options);
 	(void)ssl_printf(ssl, "deleted %d zones\n", num);
+	(void)ssl_out_flush(ssl);
+	region_destroy(region);
 }
 
 
@@ -1654,27 +2145,11 @@ parse_implicit_name(xfrd_state_type* xfrd,const char* pname)
 		strlen(PATTERN_IMPLICIT_MARKER));
 }
 
-/** remove cfgzone and add task so that reload does too */
+/** remove the cfgzone and add task so that reload does too */
 static void
-remove_cfgzone(xfrd_state_type* xfrd, const char* pname)
+remove_cfgzone_opt(xfrd_state_type* xfrd, struct zone_options* zopt,
+	const dname_type* dname)
 {
-	/* dname and find the zone for the implicit pattern */
-	struct zone_options* zopt = NULL;
-	const dname_type* dname = parse_implicit_name(xfrd, pname);
-	if(!dname) {
-		/* should have a parseable name, but it did not */
-		return;
-	}
-
-	/* find the zone entry for the implicit pattern */
-	zopt = zone_options_find(xfrd->nsd->options, dname);
-	if(!zopt) {
-		/* this should not happen; implicit pattern has zone entry */
-		region_recycle(xfrd->region, (void*)dname,
-			dname_total_size(dname));
-		return;
-	}
-
 	/* create deletion task */
 	task_new_del_zone(xfrd->nsd->task[xfrd->nsd->mytask],
 		xfrd->last_task, dname);
@@ -1691,14 +2166,34 @@ remove_cfgzone(xfrd_state_type* xfrd, const char* pname)
 
 	/* delete from zoneoptions */
 	zone_options_delete(xfrd->nsd->options, zopt);
+}
+
+/** remove cfgzone of the implicit pattern */
+static void
+remove_cfgzone(xfrd_state_type* xfrd, const char* pname)
+{
+	/* dname and find the zone for the implicit pattern */
+	struct zone_options* zopt = NULL;
+	const dname_type* dname = parse_implicit_name(xfrd, pname);
+	if(!dname) {
+		/* should have a parseable name, but it did not */
+		return;
+	}
+
+	/* find the zone entry for the implicit pattern */
+	zopt = zone_options_find(xfrd->nsd->options, dname);
+	if(zopt) {
+		remove_cfgzone_opt(xfrd, zopt, dname);
+	}
+	/* else this should not happen; implicit pattern has zone entry */
 
 	/* recycle parsed dname */
 	region_recycle(xfrd->region, (void*)dname, dname_total_size(dname));
 }
 
-/** add cfgzone and add task so that reload does too */
+/** add cfgzone with the pattern, and add task so that reload does too */
 static void
-add_cfgzone(xfrd_state_type* xfrd, const char* pname)
+add_cfgzone_name(xfrd_state_type* xfrd, const char* zname, const char* pname)
 {
 	/* add to our zonelist */
 	struct zone_options* zopt = zone_options_create(
@@ -1706,8 +2201,7 @@ add_cfgzone(xfrd_state_type* xfrd, const char* pname)
 	if(!zopt)
 		return;
 	zopt->part_of_config = 1;
-	zopt->name = region_strdup(xfrd->nsd->options->region, 
-		pname + strlen(PATTERN_IMPLICIT_MARKER));
+	zopt->name = region_strdup(xfrd->nsd->options->region, zname);
 	zopt->pattern = pattern_options_find(xfrd->nsd->options, pname);
 	if(!zopt->name || !zopt->pattern)
 		return;
@@ -1734,6 +2228,64 @@ add_cfgzone(xfrd_state_type* xfrd, const char* pname)
 	}
 }
 
+/** add cfgzone of the implicit pattern */
+static void
+add_cfgzone(xfrd_state_type* xfrd, const char* pname)
+{
+	add_cfgzone_name(xfrd, pname + strlen(PATTERN_IMPLICIT_MARKER), pname);
+}
+
+/** if the zone is in the config with only an include-pattern */
+static int
+cfgzone_uses_pattern(struct zone_options* zopt)
+{
+	return zopt->part_of_config && !zopt->pattern->implicit;
+}
+
+/** remove the cfgzones, that have no implicit pattern, that are removed
+ * from the config or use another pattern now */
+static void
+repat_cfgzones_remove(xfrd_state_type* xfrd, struct nsd_options* newopt)
+{
+	struct zone_options* zopt, *next, *newz;
+	zopt = (struct zone_options*)rbtree_first(xfrd->nsd->options->
+		zone_options);
+	while((rbnode_type*)zopt != RBTREE_NULL) {
+		next = (struct zone_options*)rbtree_next((rbnode_type*)zopt);
+		if(cfgzone_uses_pattern(zopt)) {
+			newz = zone_options_find(newopt,
+				(const dname_type*)zopt->node.key);
+			if(!newz || !cfgzone_uses_pattern(newz) ||
+				strcmp(newz->pattern->pname,
+				zopt->pattern->pname) != 0) {
+				VERBOSITY(1, (LOG_INFO, "zone removed from "
+					"config: %s", zopt->name));
+				remove_cfgzone_opt(xfrd, zopt,
+					(const dname_type*)zopt->node.key);
+			}
+		}
+		zopt = next;
+	}
+}
+
+/** add the cfgzones, that have no implicit pattern, that are new in the
+ * config, or have been removed because they use another pattern now */
+static void
+repat_cfgzones_add(xfrd_state_type* xfrd, struct nsd_options* newopt)
+{
+	struct zone_options* zopt;
+	RBTREE_FOR(zopt, struct zone_options*, newopt->zone_options) {
+		if(cfgzone_uses_pattern(zopt) &&
+			!zone_options_find(xfrd->nsd->options,
+			(const dname_type*)zopt->node.key)) {
+			VERBOSITY(1, (LOG_INFO, "zone added to config: %s",
+				zopt->name));
+			add_cfgzone_name(xfrd, zopt->name,
+				zopt->pattern->pname);
+		}
+	}
+}
+
 /** remove pattern and add task so that reload does too */
 static void
 remove_pat(xfrd_state_type* xfrd, const char* name)
@@ -1755,6 +2307,25 @@ add_pat(xfrd_state_type* xfrd, struct pattern_options* p)
 	xfrd_set_reload_now(xfrd);
 }
 
+/** the interrupt flags of the old pattern, it is compared with the new
+ *  pattern once, and not again for every zone that uses it */
+static uint8_t
+repat_interrupt_flags(struct pattern_options* oldp,
+	struct nsd_options* newopt)
+{
+	struct pattern_options* newp;
+	if(!(oldp->xfrd_flags & REPAT_COMPARED)) {
+		newp = pattern_options_find(newopt, oldp->pname);
+		oldp->xfrd_flags |= REPAT_COMPARED;
+		if(!newp || !acl_list_equal(oldp->request_xfr,
+			newp->request_xfr))
+			oldp->xfrd_flags |= REPAT_INTERRUPT_XFR;
+		if(!newp || !acl_list_equal(oldp->notify, newp->notify))
+			oldp->xfrd_flags |= REPAT_INTERRUPT_NOTIFY;
+	}
+	return oldp->xfrd_flags;
+}
+
 /** interrupt zones that are using changed or removed patterns */
 static void
 repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
@@ -1766,16 +2337,13 @@ repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
 	xfrd_zone_type* xz;
 	struct notify_zone* nz;
 	RBTREE_FOR(xz, xfrd_zone_type*, xfrd->zones) {
-		struct pattern_options* oldp = xz->zone_options->pattern;
-		struct pattern_options* newp = pattern_options_find(newopt,
-			oldp->pname);
-		if(!newp || !acl_list_equal(oldp->request_xfr,
-			newp->request_xfr)) {
+		if(repat_interrupt_flags(xz->zone_options->pattern, newopt)
+			& REPAT_INTERRUPT_XFR) {
 			/* interrupt transfer */
 			if(xz->tcp_conn != -1) {
 				xfrd_tcp_release(xfrd->tcp_set, xz);
 				xfrd_set_refresh_now(xz);
-			} else if(xz->zone_handler.ev_fd != -1) {
+			} else if(XFRD_ZONE_IN_UDP(xz)) {
 				xfrd_udp_release(xz);
 				xfrd_set_refresh_now(xz);
 			}
@@ -1790,10 +2358,8 @@ repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
 	 *   reset notify to start of list.  (clear all other reset_notify)
 	 */
 	RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
-		struct pattern_options* oldp = nz->options->pattern;
-		struct pattern_options* newp = pattern_options_find(newopt,
-			oldp->pname);
-		if(!newp || !acl_list_equal(oldp->notify, newp->notify)) {
+		if(repat_interrupt_flags(nz->options->pattern, newopt)
+			& REPAT_INTERRUPT_NOTIFY) {
 			/* interrupt notify */
 			if(nz->notify_send_enable) {
 				notify_disable(nz);
@@ -1807,6 +2373,11 @@ repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
 			nz->notify_restart = 0;
 		}
 	}
+	/* clear the flags for the next time */
+	RBTREE_FOR(xz, xfrd_zone_type*, xfrd->zones)
+		xz->zone_options->pattern->xfrd_flags &= ~REPAT_INTERRUPT_MASK;
+	RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones)
+		nz->options->pattern->xfrd_flags &= ~REPAT_INTERRUPT_MASK;
 }
 
 /** for notify, after the pattern changes, restart the affected notifies */
@@ -1841,6 +2412,9 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 	int search_zones = 0;
 
 	repat_interrupt_zones(xfrd, newopt);
+	/* the zones without implicit pattern, before their pattern can be
+	 * deleted, and before an implicit pattern adds the zone again */
+	repat_cfgzones_remove(xfrd, newopt);
 	/* find deleted patterns */
 	p = (struct pattern_options*)rbtree_first(oldopt->patterns);
 	while((rbnode_type*)p != RBTREE_NULL) {
@@ -1949,6 +2523,9 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 			}
 		}
 	}
+	/* the zones without implicit pattern, now that the patterns are
+	 * there */
+	repat_cfgzones_add(xfrd, newopt);
 	repat_interrupt_notify_start(xfrd);
 }
 
@@ -2609,12 +3186,16 @@ execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd)
 		do_reload(ssl, rc->xfrd, skipwhite(p+6));
 	} else if(cmdcmp(p, "write", 5)) {
 		do_write(ssl, rc->xfrd, skipwhite(p+5));
+	} else if(cmdcmp(p, "snapshot", 8)) {
+		do_snapshot(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "status", 6)) {
 		do_status(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "stats_noreset", 13)) {
 		do_stats(ssl, rc->xfrd, 1);
 	} else if(cmdcmp(p, "stats", 5)) {
 		do_stats(ssl, rc->xfrd, 0);
+	} else if(cmdcmp(p, "top", 3)) {
+		do_top(ssl, rc->xfrd, skipwhite(p+3));
 	} else if(cmdcmp(p, "log_reopen", 10)) {
 		do_log_reopen(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "addzone", 7)) {
@@ -2635,8 +3216,16 @@ execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd)
 		do_force_transfer(ssl, rc->xfrd, skipwhite(p+14));
 	} else if(cmdcmp(p, "zonestatus", 10)) {
 		do_zonestatus(ssl, rc->xfrd, skipwhite(p+10));
+	} else if(cmdcmp(p, "reload_stats", 12)) {
+		do_reload_stats(ssl, rc->xfrd);
+	} else if(cmdcmp(p, "mem_stats", 9)) {
+		do_mem_stats(ssl, rc->xfrd, skipwhite(p+9));
 	} else if(cmdcmp(p, "verbosity", 9)) {
 		do_verbosity(ssl, skipwhite(p+9));
+	} else if(cmdcmp(p, "dnstap_sample", 13)) {
+		do_dnstap_sample(ssl, rc->xfrd, skipwhite(p+13));
+	} else if(cmdcmp(p, "dnstap_filter", 13)) {
+		do_dnstap_filter(ssl, rc->xfrd, skipwhite(p+13));
 	} else if(cmdcmp(p, "repattern", 9)) {
 		do_repattern(ssl, rc->xfrd);
 	} else if(cmdcmp(p, "reconfig", 8)) {
@@ -2666,8 +3255,8 @@ execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd)
 	}
 }
 
-/** handle remote control request */
-static void
+/** handle remote control request, returns true if a session starts */
+static int
 handle_req(struct daemon_remote* rc, struct rc_state* s, RES* res)
 {
 	int r;
@@ -2684,20 +3273,20 @@ handle_req(struct daemon_remote* rc, struct rc_state* s, RES* res)
 		ERR_clear_error();
 		if((r=SSL_read(res->ssl, magic, (int)sizeof(magic)-1)) <= 0) {
 			if(SSL_get_error(res->ssl, r) == SSL_ERROR_ZERO_RETURN)
-				return;
+				return 0;
 			log_crypto_err("could not SSL_read");
-			return;
+			return 0;
 		}
 	} else {
 #endif /* HAVE_SSL */
 		while(1) {
 			ssize_t rr = read(res->fd, magic, sizeof(magic)-1);
 			if(rr <= 0) {
-				if(rr == 0) return;
+				if(rr == 0) return 0;
 				if(errno == EINTR || errno == EAGAIN)
 					continue;
 				log_msg(LOG_ERR, "could not read: %s", strerror(errno));
-				return;
+				return 0;
 			}
 			r = (int)rr;
 			break;
@@ -2709,25 +3298,118 @@ handle_req(struct daemon_remote* rc, struct rc_state* s, RES* res)
 	if( r != 7 || strncmp(magic, "NSDCT", 5) != 0) {
 		VERBOSITY(2, (LOG_INFO, "control connection has bad header"));
 		/* probably wrong tool connected, ignore it completely */
-		return;
+		return 0;
 	}
 
 	/* read the command line */
 	if(!ssl_read_line(res, buf, sizeof(buf))) {
-		return;
+		return 0;
 	}
 	snprintf(pre, sizeof(pre), "NSDCT%d ", NSD_CONTROL_VERSION);
 	if(strcmp(magic, pre) != 0) {
 		VERBOSITY(2, (LOG_INFO, "control connection had bad "
 			"version %s, cmd: %s", magic, buf));
 		(void)ssl_printf(res, "error version mismatch\n");
-		return;
+		return 0;
 	}
 	/* always log control commands */
 	VERBOSITY(0, (LOG_INFO, "control cmd: %s", buf));
 
+	if(cmdcmp(skipwhite(buf), "session", 7)) {
+		/* keep the connection, and the read ahead, for the commands
+		 * that follow */
+		s->session = (RES*)xalloc(sizeof(*res));
+		memcpy(s->session, res, sizeof(*res));
+		(void)ssl_printf(res, "ok\n" SESSION_END);
+		return 1;
+	}
+
 	/* figure out what to do */
 	execute_cmd(rc, res, buf);
+	return 0;
+}
+
+/** if there is more input for the session without waiting for it */
+static int
+session_pending(RES* res)
+{
+	if(res->in_pos < res->in_len)
+		return 1;
+#ifdef HAVE_SSL
+	if(res->ssl && SSL_pending(res->ssl) > 0)
+		return 1;
+#endif
+	return 0;
+}
+
+/**
+ * Perform the commands in a session, every line is a command, and the
+ * output of it is followed by the SESSION_END line. If readable, the
+ * socket has input, else only the read ahead is used. Returns false if
+ * the session is done. Then it waits for the next command, in the event
+ * loop, so that xfrd goes on between the commands.
+ */
+static int
+session_cmds(struct daemon_remote* rc, struct rc_state* s, int readable)
+{
+	RES* res = s->session;
+	char buf[1024];
+	char c;
+	int r;
+	if(fcntl(s->fd, F_SETFL, 0) == -1) { /* set blocking */
+		log_msg(LOG_ERR, "cannot fcntl rc: %s", strerror(errno));
+		return 0;
+	}
+	while(readable || session_pending(res)) {
+		region_type* region;
+		char* p;
+		readable = 0;
+		if(ssl_read_byte(res, &c) <= 0)
+			return 0; /* closed by the client, or failed */
+		res->in_pos--;
+		if(!ssl_read_line(res, buf, sizeof(buf)))
+			return 0;
+		p = skipwhite(buf);
+		if(*p == 0)
+			continue;
+		VERBOSITY(0, (LOG_INFO, "control cmd: %s", buf));
+
+		/* the output is sent in one piece with the end marker */
+		region = region_create(xalloc, free);
+		ssl_out_start(res, region);
+		if(cmdcmp(p, "addzones", 8) || cmdcmp(p, "delzones", 8) ||
+			cmdcmp(p, "session", 7))
+			(void)ssl_printf(res, "error %s cannot be used in a "
+				"session\n", p);
+		else	execute_cmd(rc, res, buf);
+		(void)ssl_print_text(res, SESSION_END);
+		r = ssl_out_flush(res);
+		region_destroy(region);
+		if(!r)
+			return 0;
+	}
+
+	if(fcntl(s->fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "cannot fcntl rc: %s", strerror(errno));
+		return 0;
+	}
+	/* wait for the next command, with a fresh timeout */
+	if(s->event_added)
+		event_del(&s->c);
+	s->event_added = 0;
+	memset(&s->c, 0, sizeof(s->c));
+	event_set(&s->c, s->fd, EV_PERSIST|EV_TIMEOUT|EV_READ,
+		remote_control_callback, s);
+	if(event_base_set(xfrd->event_base, &s->c) != 0) {
+		log_msg(LOG_ERR, "remote session: cannot set event_base");
+		return 0;
+	}
+	if(event_add(&s->c, &s->tval) != 0) {
+		log_msg(LOG_ERR, "remote session: cannot add event");
+		return 0;
+	}
+	s->event_added = 1;
+	return 1;
 }
 
 #ifdef HAVE_SSL
@@ -2790,6 +3472,11 @@ remote_control_callback(int fd, short event, void* arg)
 		clean_point(rc, s);
 		return;
 	}
+	if(s->session) {
+		if(!session_cmds(rc, s, 1))
+			clean_point(rc, s);
+		return;
+	}
 #ifdef HAVE_SSL
 	if(s->ssl) {
 		/* (continue to) setup the SSL connection */
@@ -2806,7 +3493,7 @@ remote_control_callback(int fd, short event, void* arg)
 #endif /* HAVE_SSL */
 
 	/* once handshake has completed, check authentication */
-	if (!rc->use_cert) {
+	if (!rc->use_cert || s->plain) {
 		VERBOSITY(3, (LOG_INFO, "unauthenticated remote control connection"));
 #ifdef HAVE_SSL
 	} else if(SSL_get_verify_result(s->ssl) == X509_V_OK) {
@@ -2836,7 +3523,15 @@ remote_control_callback(int fd, short event, void* arg)
 	res.ssl = s->ssl;
 #endif /* HAVE_SSL */
 	res.fd = fd;
-	handle_req(rc, s, &res);
+	res.in_pos = 0;
+	res.in_len = 0;
+	res.out = NULL;
+	if(handle_req(rc, s, &res)) {
+		/* the commands that were sent along are in the read ahead */
+		if(!session_cmds(rc, s, 0))
+			clean_point(rc, s);
+		return;
+	}
 
 	VERBOSITY(3, (LOG_INFO, "remote control operation completed"));
 	clean_point(rc, s);
@@ -2976,6 +3671,147 @@ print_stat_block(RES* ssl, char* n, char* d, struct nsdst* st)
 	if(!ssl_printf(ssl, "%s%snum.dropped=%lu\n", n, d,
 		(unsigned long)st->dropped))
 		return;
+
+	/* response cache */
+	if(!ssl_printf(ssl, "%s%snum.rcache_hit=%lu\n", n, d,
+		(unsigned long)st->rcache_hit))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.rcache_miss=%lu\n", n, d,
+		(unsigned long)st->rcache_miss))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.udp_gso=%lu\n", n, d,
+		(unsigned long)st->udp_gso))
+		return;
+
+	/* TLS session resumption */
+	if(!ssl_printf(ssl, "%s%snum.tls_resumed=%lu\n", n, d,
+		(unsigned long)st->tls_resumed))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tls_full=%lu\n", n, d,
+		(unsigned long)st->tls_full))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tls_ktls=%lu\n", n, d,
+		(unsigned long)st->tls_ktls))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tls_async=%lu\n", n, d,
+		(unsigned long)st->tls_async))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tls_handshake_usec=%lu\n", n, d,
+		(unsigned long)st->tls_handshake_usec))
+		return;
+
+	/* TCP connection limits */
+	if(!ssl_printf(ssl, "%s%snum.tcp_evicted=%lu\n", n, d,
+		(unsigned long)st->tcp_evicted))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tcp_source_limited=%lu\n", n, d,
+		(unsigned long)st->tcp_source_limited))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.xfr_out_limited=%lu\n", n, d,
+		(unsigned long)st->xfr_out_limited))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.xdp_malformed=%lu\n", n, d,
+		(unsigned long)st->xdp_malformed))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.xdp_ratelimited=%lu\n", n, d,
+		(unsigned long)st->xdp_ratelimited))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tcp_accepted=%lu\n", n, d,
+		(unsigned long)st->tcp_accepted))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.tcp_pool_reused=%lu\n", n, d,
+		(unsigned long)st->tcp_pool_reused))
+		return;
+
+	/* ratelimit table */
+	if(!ssl_printf(ssl, "%s%snum.rrl_evicted=%lu\n", n, d,
+		(unsigned long)st->rrl_evicted))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.rrl_collision=%lu\n", n, d,
+		(unsigned long)st->rrl_collision))
+		return;
+
+	/* overload shedding */
+	if(!ssl_printf(ssl, "%s%snum.udp_shed=%lu\n", n, d,
+		(unsigned long)st->udp_shed))
+		return;
+	if(!ssl_printf(ssl, "%s%snum.udp_overload=%lu\n", n, d,
+		(unsigned long)st->udp_overload))
+		return;
+
+	/* latency histograms, the buckets are the upper bound in usec */
+	for(i=0; i<LATENCY_TRANSPORTS; i++) {
+		const char* trstr[] = {"udp", "tcp", "tls"};
+		size_t b;
+		for(b=0; b<LATENCY_BUCKETS; b++) {
+			if(st->latency[i][b] == 0)
+				continue;
+			if(b == LATENCY_BUCKETS-1) {
+				if(!ssl_printf(ssl, "%s%snum.latency.%s.inf=%lu\n",
+					n, d, trstr[i],
+					(unsigned long)st->latency[i][b]))
+					return;
+			} else if(!ssl_printf(ssl, "%s%snum.latency.%s.%luus=%lu\n",
+				n, d, trstr[i], (unsigned long)1<<b,
+				(unsigned long)st->latency[i][b]))
+				return;
+		}
+	}
+
+	/* kernel drops and queue time of the UDP sockets */
+	if(!ssl_printf(ssl, "%s%snum.rxq_dropped=%lu\n", n, d,
+		(unsigned long)st->rxq_dropped))
+		return;
+	for(i=0; i<LATENCY_BUCKETS; i++) {
+		if(st->rxq_latency[i] == 0)
+			continue;
+		if(i == LATENCY_BUCKETS-1) {
+			if(!ssl_printf(ssl, "%s%snum.rxq_latency.inf=%lu\n",
+				n, d, (unsigned long)st->rxq_latency[i]))
+				return;
+		} else if(!ssl_printf(ssl, "%s%snum.rxq_latency.%luus=%lu\n",
+			n, d, (unsigned long)1<<i,
+			(unsigned long)st->rxq_latency[i]))
+			return;
+	}
+
+	/* the number of queries of the UDP reads */
+	for(i=0; i<UDP_BATCH_BUCKETS; i++) {
+		if(st->udp_batch[i] == 0)
+			continue;
+		if(i == UDP_BATCH_BUCKETS-1) {
+			if(!ssl_printf(ssl, "%s%snum.udp_batch.inf=%lu\n",
+				n, d, (unsigned long)st->udp_batch[i]))
+				return;
+		} else if(!ssl_printf(ssl, "%s%snum.udp_batch.%lu=%lu\n",
+			n, d, (unsigned long)1<<i,
+			(unsigned long)st->udp_batch[i]))
+			return;
+	}
+
+	/* the connections in use at TCP accept, in percent of tcp-count */
+	for(i=0; i<TCP_OCCUPANCY_BUCKETS; i++) {
+		if(st->tcp_occupancy[i] == 0)
+			continue;
+		if(!ssl_printf(ssl, "%s%snum.tcp_occupancy.%lu=%lu\n",
+			n, d, (unsigned long)(i+1)*100/TCP_OCCUPANCY_BUCKETS,
+			(unsigned long)st->tcp_occupancy[i]))
+			return;
+	}
+
+	/* the idle timeouts of the TCP connections */
+	for(i=0; i<TCP_TIMEOUT_BUCKETS; i++) {
+		if(st->tcp_timeout[i] == 0)
+			continue;
+		if(i == TCP_TIMEOUT_BUCKETS-1) {
+			if(!ssl_printf(ssl, "%s%snum.tcp_timeout.inf=%lu\n",
+				n, d, (unsigned long)st->tcp_timeout[i]))
+				return;
+		} else if(!ssl_printf(ssl, "%s%snum.tcp_timeout.%lums=%lu\n",
+			n, d, (unsigned long)100<<i,
+			(unsigned long)st->tcp_timeout[i]))
+			return;
+	}
 }
 
 #ifdef USE_ZONE_STATS
@@ -2997,6 +3833,7 @@ zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear,
 {
 	struct zonestatname* n;
 	struct nsdst stat0, stat1;
+	size_t i, cc = xfrd->nsd->child_count;
 	RBTREE_FOR(n, struct zonestatname*, xfrd->nsd->options->zonestatnames){
 		char* name = (char*)n->node.key;
 		if(n->id >= xfrd->zonestat_safe)
@@ -3007,10 +3844,12 @@ zonestat_print(RES* ssl, xfrd_state_type* xfrd, int clear,
 		/* the statistics are stored in two blocks, during reload
 		 * the newly forked processes get the other block to use,
 		 * these blocks are mmapped and are currently in use to
-		 * add statistics to */
-		memcpy(&stat0, &zonestats[0][n->id], sizeof(stat0));
-		memcpy(&stat1, &zonestats[1][n->id], sizeof(stat1));
-		stats_add(&stat0, &stat1);
+		 * add statistics to. Every server has an entry for the zone */
+		memcpy(&stat0, &zonestats[0][n->id*cc], sizeof(stat0));
+		for(i=1; i<cc; i++)
+			stats_add(&stat0, &zonestats[0][n->id*cc+i]);
+		for(i=0; i<cc; i++)
+			stats_add(&stat0, &zonestats[1][n->id*cc+i]);
 		
 		/* save a copy of current (cumulative) stats in stat1 */
 		memcpy(&stat1, &stat0, sizeof(stat1));
@@ -3061,6 +3900,14 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear,
 	}
 	if(!ssl_printf(ssl, "num.queries=%lu\n", (unsigned long)total))
 		return;
+	for(i=0; i<xfrd->nsd->child_count; i++) {
+		if(!ssl_printf(ssl, "server%d.page_faults_major=%lu\n"
+			"server%d.page_faults_minor=%lu\n", (int)i,
+			(unsigned long)xfrd->nsd->children[i].page_faults_major,
+			(int)i,
+			(unsigned long)xfrd->nsd->children[i].page_faults_minor))
+			return;
+	}
 
 	/* time elapsed and uptime (in seconds) */
 	timeval_subtract(&uptime, now, &xfrd->nsd->rc->boot_time);
@@ -3077,6 +3924,12 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear,
 		return;
 	if(!print_longnum(ssl, "size.db.mem=", st->db_mem))
 		return;
+	if(!print_longnum(ssl, "size.db.reload_faults=",
+		st->db_reload_faults))
+		return;
+	if(!print_longnum(ssl, "size.db.compact_bytes=",
+		st->db_compact_bytes))
+		return;
 	if(!print_longnum(ssl, "size.xfrd.mem=", region_get_mem(xfrd->region)))
 		return;
 	if(!print_longnum(ssl, "size.config.disk=", 
@@ -3086,6 +3939,19 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear,
 		xfrd->nsd->options->region)))
 		return;
 	print_stat_block(ssl, "", "", st);
+#ifdef HAVE_TLS_1_3
+	/* XoT handshakes of xfrd to the primaries */
+	if(!ssl_printf(ssl, "num.xfrd.tls_resumed=%lu\n",
+		(unsigned long)xfrd->tcp_set->tls_resumed))
+		return;
+	if(!ssl_printf(ssl, "num.xfrd.tls_full=%lu\n",
+		(unsigned long)xfrd->tcp_set->tls_full))
+		return;
+	if(clear) {
+		xfrd->tcp_set->tls_resumed = 0;
+		xfrd->tcp_set->tls_full = 0;
+	}
+#endif
 
 	/* zone statistics */
 	if(!ssl_printf(ssl, "zone.primary=%lu\n",
@@ -3113,8 +3979,10 @@ process_stats_alloc(xfrd_state_type* xfrd, struct nsdst** stats,
 {
 	*stats = xmallocarray(xfrd->nsd->child_count*2, sizeof(struct nsdst));
 #ifdef USE_ZONE_STATS
-	zonestats[0] = xmallocarray(xfrd->zonestat_safe, sizeof(struct nsdst));
-	zonestats[1] = xmallocarray(xfrd->zonestat_safe, sizeof(struct nsdst));
+	zonestats[0] = xmallocarray(xfrd->zonestat_safe*xfrd->nsd->child_count,
+		sizeof(struct nsdst));
+	zonestats[1] = xmallocarray(xfrd->zonestat_safe*xfrd->nsd->child_count,
+		sizeof(struct nsdst));
 #else
 	(void)zonestats;
 #endif
@@ -3131,9 +3999,9 @@ process_stats_grab(xfrd_state_type* xfrd, struct timeval* stattime,
 		xfrd->nsd->child_count*2*sizeof(struct nsdst));
 #ifdef USE_ZONE_STATS
 	memcpy(zonestats[0], xfrd->nsd->zonestat[0],
-		xfrd->zonestat_safe*sizeof(struct nsdst));
+		xfrd->zonestat_safe*xfrd->nsd->child_count*sizeof(struct nsdst));
 	memcpy(zonestats[1], xfrd->nsd->zonestat[1],
-		xfrd->zonestat_safe*sizeof(struct nsdst));
+		xfrd->zonestat_safe*xfrd->nsd->child_count*sizeof(struct nsdst));
 #else
 	(void)zonestats;
 #endif
@@ -3147,6 +4015,8 @@ process_stats_add_old_new(xfrd_state_type* xfrd, struct nsdst* stats)
 	size_t i;
 	uint64_t dbd = stats[0].db_disk;
 	uint64_t dbm = stats[0].db_mem;
+	uint64_t dbf = stats[0].db_reload_faults;
+	uint64_t dbc = stats[0].db_compact_bytes;
 	/* The old and new server processes have separate stat blocks,
 	 * and these are added up together. This results in the statistics
 	 * values per server-child. The reload task briefly forks both
@@ -3156,6 +4026,8 @@ process_stats_add_old_new(xfrd_state_type* xfrd, struct nsdst* stats)
 	}
 	stats[0].db_disk = dbd;
 	stats[0].db_mem = dbm;
+	stats[0].db_reload_faults = dbf;
+	stats[0].db_compact_bytes = dbc;
 }
 
 /* manage clearing of stats, a cumulative count of cleared statistics */
@@ -3197,14 +4069,16 @@ process_stats_add_total(xfrd_state_type* xfrd, struct nsdst* total,
 	size_t i;
 	/* copy over the first one, with also the nonadded values. */
 	memcpy(total, &stats[0], sizeof(*total));
-	xfrd->nsd->children[0].query_count = stats[0].qudp + stats[0].qudp6
-		+ stats[0].ctcp + stats[0].ctcp6 + stats[0].ctls
-		+ stats[0].ctls6;
-	for(i=1; i<xfrd->nsd->child_count; i++) {
-		stats_add(total, &stats[i]);
+	for(i=0; i<xfrd->nsd->child_count; i++) {
+		if(i > 0)
+			stats_add(total, &stats[i]);
 		xfrd->nsd->children[i].query_count = stats[i].qudp
 			+ stats[i].qudp6 + stats[i].ctcp + stats[i].ctcp6
 			+ stats[i].ctls + stats[i].ctls6;
+		xfrd->nsd->children[i].page_faults_major =
+			stats[i].page_faults_major;
+		xfrd->nsd->children[i].page_faults_minor =
+			stats[i].page_faults_minor;
 	}
 }
 
@@ -84,6 +84,14 @@ void daemon_remote_close(struct daemon_remote* rc);
 int daemon_remote_open_ports(struct daemon_remote* rc,
 	struct nsd_options* cfg);
 
+/**
+ * Pass the listening control ports over the socket-handoff.
+ * @param rc: rc state that contains list of accept port sockets.
+ * @param s: connection to the new nsd.
+ * @return number of sockets passed.
+ */
+size_t daemon_remote_handoff(struct daemon_remote* rc, int s);
+
 /**
  * Setup comm points for accepting remote control connections.
  * @param rc: state
@@ -0,0 +1,400 @@
+/*
+ * respcache.c -- cache of encoded responses for UDP queries
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Every server process keeps a direct mapped table of responses, keyed by
+ * the query name, type, class, DO flag, the response size limit (from the
+ * EDNS buffer size) and the space reserved for EDNS options, so that
+ * truncation and minimal responses come out the same. The entry holds the
+ * header flags and counts, and the bytes after the question section; the
+ * query ID and question are the ones of the new query. Compression
+ * pointers only point into the question section, or after it, and the
+ * question is the same length for the same query name.
+ *
+ * NXDOMAIN answers, and answers expanded from a wildcard, are stored by
+ * the closest encloser of the query name, its length and the domain of
+ * the denial proof, instead of by the name. That is no domain without
+ * DNSSEC, the closest match for NSEC, or the NSEC3 that covers the next
+ * closer name, so the answer is made from those domains only. The owner
+ * of a wildcard answer is a compression pointer to the query name, and
+ * the other compression pointers into the question point at the closest
+ * encloser, that is at the same offset in names of the same length. So
+ * the random names of a random subdomain flood below one encloser are
+ * answered from one entry, or with NSEC3 from one entry per cover.
+ *
+ * Referrals are stored by the closest encloser of the query name, and its
+ * length, in the same way. The NS set, DS or NSEC(3) proof and glue only
+ * depend on the delegation above the encloser, so on a TLD the queries
+ * for all the names below a delegation are copied from a few entries.
+ *
+ * SOA queries with a verified TSIG, the refresh probes of secondaries, are
+ * answered from the cache as well. The answer does not depend on the key,
+ * zones with an allow-query acl are not cached, and the space reserved
+ * for the TSIG record is part of the key, so the probe gets the answer
+ * that it would have got, and the TSIG is added to it like for a new
+ * answer, with the HMAC state of the key that tsig keeps.
+ *
+ * The cache is private to the server process, and is not kept over a
+ * reload, its domains may be gone. With reload-prewarm, the queries of
+ * the cached responses are also kept in memory that is shared with the
+ * server process that replaces this one, and that answers them again
+ * from the new database before it serves, so that the responses of the
+ * zones that did not change are cached again, and those that changed
+ * are made new.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "respcache.h"
+#include "fasthash.h"
+#include "options.h"
+#include "nsec3.h"
+
+/* a cached response */
+struct respcache_entry {
+	uint32_t hash;
+	uint16_t qtype, qclass;
+	uint16_t maxlen, reserved_space;
+	uint8_t dnssec_ok, family;
+	/* header flags and section counts of the response */
+	uint16_t flags, ancount, nscount, arcount;
+	/* for an NXDOMAIN, wildcard or referral entry, the proof domain
+	 * and closest encloser it is stored for, and the data has no
+	 * query name */
+	domain_type* closest_match;
+	domain_type* closest_encloser;
+	uint8_t referral;
+	/* the zone, and domains used for rate limiting, of the answer */
+	zone_type* zone;
+	domain_type* delegation_domain;
+#ifdef RATELIMIT
+	domain_type* wildcard_domain;
+#endif
+	/* length of the query name, that is at the start of data, but for
+	 * NXDOMAIN entries */
+	uint16_t qname_len;
+	/* length of the response after the question section */
+	uint16_t len;
+	/* the query name, followed by the response after the question */
+	uint8_t* data;
+};
+
+static struct respcache_entry* respcache_table = NULL;
+static size_t respcache_mask = 0;
+/* the queries of the stored responses, for the next server process */
+static struct respcache_handover* respcache_handover = NULL;
+
+void
+respcache_init(size_t entries)
+{
+	size_t size = 1;
+	respcache_deinit();
+	if(entries == 0)
+		return;
+	while(size < entries)
+		size <<= 1;
+	respcache_table = xalloc_array_zero(size, sizeof(*respcache_table));
+	respcache_mask = size - 1;
+}
+
+void
+respcache_handover_set(struct respcache_handover* handover)
+{
+	respcache_handover = handover;
+	if(handover)
+		memset(handover, 0, sizeof(*handover));
+}
+
+void
+respcache_deinit(void)
+{
+	size_t i;
+	if(!respcache_table)
+		return;
+	for(i = 0; i <= respcache_mask; i++)
+		free(respcache_table[i].data);
+	free(respcache_table);
+	respcache_table = NULL;
+	respcache_mask = 0;
+	respcache_handover = NULL;
+}
+
+static uint8_t
+respcache_family(struct query* q)
+{
+	return (uint8_t)((struct sockaddr*)&q->client_addr)->sa_family;
+}
+
+static uint32_t
+respcache_hash_key(struct query* q)
+{
+	uint8_t k[10];
+	write_uint16(k, q->qtype);
+	write_uint16(k+2, q->qclass);
+	write_uint16(k+4, (uint16_t)q->maxlen);
+	write_uint16(k+6, (uint16_t)q->reserved_space);
+	k[8] = (uint8_t)(q->edns.dnssec_ok != 0);
+	k[9] = respcache_family(q);
+	return fasthash32(k, sizeof(k), 0);
+}
+
+static uint32_t
+respcache_hash(struct query* q)
+{
+	return fasthash32(dname_name(q->qname), q->qname->name_size,
+		respcache_hash_key(q));
+}
+
+static uint32_t
+respcache_hash_nxdomain(struct query* q, domain_type* closest_match,
+	domain_type* closest_encloser)
+{
+	uint32_t h = fasthash32(&closest_match, sizeof(closest_match),
+		respcache_hash_key(q) ^ q->qname->name_size);
+	return fasthash32(&closest_encloser, sizeof(closest_encloser), h);
+}
+
+/* the domain that the denial proof in an NXDOMAIN or wildcard answer
+ * depends on, NULL if the answer has no proof */
+static domain_type*
+respcache_proof(struct query* q, zone_type* zone, domain_type* closest_match,
+	domain_type* closest_encloser)
+{
+	if(!q->edns.dnssec_ok || !zone_is_secure(zone))
+		return NULL;
+#ifdef NSEC3
+	if(zone->nsec3_param)
+		return nsec3_next_closer_cover(zone, q->qname,
+			closest_encloser);
+#else
+	(void)closest_encloser;
+#endif
+	return closest_match;
+}
+
+/* if the entry has the key of the query, other than the name */
+static int
+respcache_match_key(struct respcache_entry* e, struct query* q, uint32_t h)
+{
+	return e->data && e->hash == h && e->qtype == q->qtype &&
+		e->qclass == q->qclass && e->maxlen == q->maxlen &&
+		e->reserved_space == q->reserved_space &&
+		e->dnssec_ok == (q->edns.dnssec_ok != 0) &&
+		e->family == respcache_family(q) &&
+		e->qname_len == q->qname->name_size;
+}
+
+/* put the cached answer in the packet, returns 0 if it does not fit */
+static int
+respcache_answer(struct respcache_entry* e, struct query* q,
+	struct nsd* nsd)
+{
+	size_t qlen = QHEADERSZ + q->qname->name_size + 4;
+	uint8_t* data = e->data + (e->closest_encloser ? 0 : e->qname_len);
+
+	if(buffer_position(q->packet) != qlen ||
+		!buffer_available(q->packet, e->len))
+		return 0;
+	buffer_write(q->packet, data, e->len);
+	/* the RD flag is that of the query */
+	FLAGS_SET(q->packet, (e->flags & ~0x0100U) |
+		(FLAGS(q->packet) & 0x0100U));
+	ANCOUNT_SET(q->packet, e->ancount);
+	NSCOUNT_SET(q->packet, e->nscount);
+	ARCOUNT_SET(q->packet, e->arcount);
+	q->zone = e->zone;
+	q->delegation_domain = e->delegation_domain;
+#ifdef RATELIMIT
+	q->wildcard_domain = e->wildcard_domain;
+#endif
+	STATUP(nsd, rcache_hit);
+	ZTATUP2(nsd, q->zone, opcode, q->opcode);
+	ZTATUP2(nsd, q->zone, qtype, q->qtype);
+	ZTATUP2(nsd, q->zone, qclass, q->qclass);
+	return 1;
+}
+
+/* if the query can be answered from, or stored in, the cache */
+static int
+respcache_usable(struct query* q)
+{
+	return respcache_table && !q->tcp &&
+		(q->tsig.status == TSIG_NOT_PRESENT ||
+		 (q->tsig.status == TSIG_OK && q->qtype == TYPE_SOA &&
+		  q->tsig.error_code == TSIG_ERROR_NOERROR)) &&
+		q->maxlen <= 0xffff && q->reserved_space <= 0xffff;
+}
+
+int
+respcache_lookup(struct query* q, struct nsd* nsd)
+{
+	struct respcache_entry* e;
+	uint32_t h;
+
+	if(!respcache_usable(q))
+		return 0;
+	h = respcache_hash(q);
+	e = &respcache_table[h & respcache_mask];
+	if(!respcache_match_key(e, q, h) || e->closest_encloser ||
+		memcmp(e->data, dname_name(q->qname), e->qname_len) != 0)
+		return 0;
+	return respcache_answer(e, q, nsd);
+}
+
+int
+respcache_lookup_nxdomain(struct query* q, struct nsd* nsd, zone_type* zone,
+	domain_type* closest_match, domain_type* closest_encloser)
+{
+	struct respcache_entry* e;
+	domain_type* proof;
+	uint32_t h;
+
+	if(!respcache_usable(q) || !zone)
+		return 0;
+	proof = respcache_proof(q, zone, closest_match, closest_encloser);
+#ifdef NSEC3
+	if(!proof && q->edns.dnssec_ok && zone->nsec3_param &&
+		zone_is_secure(zone))
+		return 0;
+#endif
+	h = respcache_hash_nxdomain(q, proof, closest_encloser);
+	e = &respcache_table[h & respcache_mask];
+	if(!respcache_match_key(e, q, h) || e->referral ||
+		e->zone != zone || e->closest_encloser != closest_encloser ||
+		e->closest_match != proof)
+		return 0;
+	return respcache_answer(e, q, nsd);
+}
+
+int
+respcache_lookup_referral(struct query* q, struct nsd* nsd,
+	domain_type* closest_encloser)
+{
+	struct respcache_entry* e;
+	uint32_t h;
+
+	if(!respcache_usable(q))
+		return 0;
+	h = respcache_hash_nxdomain(q, NULL, closest_encloser);
+	e = &respcache_table[h & respcache_mask];
+	if(!respcache_match_key(e, q, h) || !e->referral ||
+		e->closest_encloser != closest_encloser)
+		return 0;
+	return respcache_answer(e, q, nsd);
+}
+
+/* keep the query of the stored response for the next server process, it
+ * is answered again after a reload. Only queries that can be made again
+ * as they were, without TSIG. */
+static void
+respcache_handover_store(struct query* q, uint32_t h)
+{
+	struct respcache_key* k = &respcache_handover->key[
+		h & (RESPCACHE_HANDOVER_SIZE-1)];
+	if(q->tsig.status != TSIG_NOT_PRESENT)
+		return;
+	k->qname_len = 0;
+	k->qtype = q->qtype;
+	k->qclass = q->qclass;
+	k->edns_size = 0;
+	if(q->edns.status == EDNS_OK)
+		k->edns_size = (uint16_t)(q->edns.maxlen < 512 ? 512 :
+			q->edns.maxlen);
+	k->dnssec_ok = (uint8_t)(q->edns.dnssec_ok != 0);
+	k->family = respcache_family(q);
+	k->cookie = (uint8_t)(q->edns.cookie_status != COOKIE_NOT_PRESENT);
+	k->nsid = (uint8_t)(q->edns.nsid != 0);
+	memcpy(k->qname, dname_name(q->qname), q->qname->name_size);
+	k->qname_len = (uint8_t)q->qname->name_size;
+}
+
+void
+respcache_store(struct query* q, struct nsd* nsd)
+{
+	struct respcache_entry* e;
+	size_t qlen, len, keylen;
+	uint8_t* data;
+	uint32_t h;
+	domain_type* proof = NULL;
+	int nxdomain, referral;
+
+	if(!respcache_usable(q))
+		return;
+	STATUP(nsd, rcache_miss);
+	/* only answers from zone data, that do not depend on the client */
+	if(!q->zone || q->client_specific || q->edns.ede >= 0 ||
+		(RCODE(q->packet) != RCODE_OK &&
+		 RCODE(q->packet) != RCODE_NXDOMAIN))
+		return;
+	qlen = QHEADERSZ + q->qname->name_size + 4;
+	if(buffer_position(q->packet) < qlen)
+		return;
+	len = buffer_position(q->packet) - qlen;
+	if(len > 0xffff)
+		return;
+	/* an NXDOMAIN or wildcard answer that is made from the lookup
+	 * result and its proof only, not after CNAMEs */
+	nxdomain = (RCODE(q->packet) == RCODE_NXDOMAIN ||
+		(q->rcache_wildcard && RCODE(q->packet) == RCODE_OK)) &&
+		q->rcache_closest_match && q->cname_count == 0;
+	if(nxdomain) {
+		proof = respcache_proof(q, q->zone, q->rcache_closest_match,
+			q->rcache_closest_encloser);
+#ifdef NSEC3
+		/* the NSEC3 in the answer has to be the one it is
+		 * looked up by */
+		if(q->edns.dnssec_ok && q->zone->nsec3_param &&
+			zone_is_secure(q->zone) &&
+			(!proof || proof != q->rcache_nsec3_cover))
+			nxdomain = 0;
+#endif
+	}
+	/* a referral, that is made from the delegation above the encloser */
+	referral = !nxdomain && q->rcache_referral &&
+		RCODE(q->packet) == RCODE_OK && q->rcache_closest_encloser;
+	keylen = (nxdomain || referral) ? 0 : q->qname->name_size;
+	data = (uint8_t*)malloc(keylen + len);
+	if(!data)
+		return;
+	memcpy(data, dname_name(q->qname), keylen);
+	memcpy(data + keylen, buffer_at(q->packet, qlen), len);
+
+	if(nxdomain)
+		h = respcache_hash_nxdomain(q, proof,
+			q->rcache_closest_encloser);
+	else if(referral)
+		h = respcache_hash_nxdomain(q, NULL,
+			q->rcache_closest_encloser);
+	else	h = respcache_hash(q);
+	e = &respcache_table[h & respcache_mask];
+	free(e->data);
+	e->hash = h;
+	e->qtype = q->qtype;
+	e->qclass = q->qclass;
+	e->maxlen = (uint16_t)q->maxlen;
+	e->reserved_space = (uint16_t)q->reserved_space;
+	e->dnssec_ok = (uint8_t)(q->edns.dnssec_ok != 0);
+	e->family = respcache_family(q);
+	e->flags = FLAGS(q->packet);
+	e->ancount = ANCOUNT(q->packet);
+	e->nscount = NSCOUNT(q->packet);
+	e->arcount = ARCOUNT(q->packet);
+	e->zone = q->zone;
+	e->delegation_domain = q->delegation_domain;
+#ifdef RATELIMIT
+	e->wildcard_domain = q->wildcard_domain;
+#endif
+	e->closest_match = proof;
+	e->closest_encloser = (nxdomain || referral) ?
+		q->rcache_closest_encloser : NULL;
+	e->referral = (uint8_t)referral;
+	e->qname_len = (uint16_t)q->qname->name_size;
+	e->len = (uint16_t)len;
+	e->data = data;
+	if(respcache_handover && !nxdomain && !referral)
+		respcache_handover_store(q, h);
+}
@@ -0,0 +1,88 @@
+/*
+ * respcache.h -- cache of encoded responses for UDP queries
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+#include "query.h"
+
+/*
+ * Initialize the response cache, for this server process, with space
+ * for (at least) the given number of responses. 0 disables the cache.
+ * The cache starts empty; on a reload the server processes are replaced,
+ * so cached responses never outlive the database they were made from.
+ */
+void respcache_init(size_t entries);
+
+/* the number of queries of cached responses that a server process keeps
+ * for the server process that replaces it after a reload */
+#define RESPCACHE_HANDOVER_SIZE 1024
+
+/* the query of a cached response, that the next server process answers
+ * to fill its cache with reload-prewarm */
+struct respcache_key {
+	uint16_t qtype, qclass;
+	/* the EDNS buffer size, 0 for a query without EDNS */
+	uint16_t edns_size;
+	uint8_t dnssec_ok, family;
+	/* if the query had a cookie, and asked for the NSID */
+	uint8_t cookie, nsid;
+	/* the query name, 0 length for an unused key */
+	uint8_t qname_len;
+	uint8_t qname[MAXDOMAINLEN];
+};
+
+/* the queries of the cached responses of a server process, by hash, in
+ * memory that is shared with the server process that replaces it */
+struct respcache_handover {
+	struct respcache_key key[RESPCACHE_HANDOVER_SIZE];
+};
+
+/* keep the queries of the responses that are stored in the table, that
+ * is cleared, or NULL to not keep them */
+void respcache_handover_set(struct respcache_handover* handover);
+
+/* free the response cache for this server process */
+void respcache_deinit(void);
+
+/*
+ * Look up the answer for the query, that has been prepared with
+ * query_prepare_response. On a hit the answer sections, flags and counts
+ * are copied into the packet after the question, and the zone of the
+ * answer is set in the query. The EDNS and TSIG records still need to be
+ * added with query_add_optional. Returns 1 on a hit.
+ */
+int respcache_lookup(struct query* q, struct nsd* nsd);
+
+/*
+ * Look up an NXDOMAIN or wildcard answer for the query, by the closest
+ * encloser of the query name and the domain of its denial proof in the
+ * zone, so that the random names below one encloser share one entry.
+ * Like respcache_lookup, returns 1 on a hit.
+ */
+int respcache_lookup_nxdomain(struct query* q, struct nsd* nsd,
+	zone_type* zone, domain_type* closest_match,
+	domain_type* closest_encloser);
+
+/*
+ * Look up a referral for the query, by the closest encloser of the query
+ * name, so that all the names below a delegation share an entry per
+ * name length. Like respcache_lookup, returns 1 on a hit.
+ */
+int respcache_lookup_referral(struct query* q, struct nsd* nsd,
+	domain_type* closest_encloser);
+
+/* Store the answer of the query, if it can be reused for other queries
+ * with the same name, type, class, DO flag and EDNS size. An NXDOMAIN or
+ * wildcard answer is stored for the closest encloser of its name and the
+ * domain of its proof, the closest match for NSEC or the cover of the
+ * next closer name for NSEC3. A referral is stored for the closest
+ * encloser of its name. Counts the cache miss. */
+void respcache_store(struct query* q, struct nsd* nsd);
+
+#endif /* RESPCACHE_H */
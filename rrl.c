@@ -8,7 +8,7 @@
 #include <errno.h>
 #include "rrl.h"
 #include "util.h"
-#include "lookup3.h"
+#include "fasthash.h"
 #include "options.h"
 
 #ifdef RATELIMIT
@@ -25,6 +25,10 @@
  * The rate limiting data structure bucket, this represents one rate of
  * packets from a single source.
  * Smoothed average rates.
+ * The buckets are in sets of RRL_WAYS, a source can be in any bucket of
+ * the set for its hash. A new source replaces the bucket with the lowest
+ * rate, so that a flood of spoofed sources does not push out the sources
+ * that are ratelimited. A set of 4 buckets of 32 bytes is two cache lines.
  */
 struct rrl_bucket {
 	/* the source netmask */
@@ -46,25 +50,61 @@ struct rrl_bucket {
 /* the (global) array of RRL buckets */
 static struct rrl_bucket* rrl_array = NULL;
 static size_t rrl_array_size = RRL_BUCKETS;
+/* if the last update replaced the bucket of another source,
+ * RRL_EVICTED, or RRL_COLLISION if that source had queries in the
+ * last second */
+static int rrl_last_evict = 0;
+#define RRL_EVICTED 1
+#define RRL_COLLISION 2
 static uint32_t rrl_ratelimit = RRL_LIMIT; /* 2x qps */
 static uint8_t rrl_slip_ratio = RRL_SLIP;
 static uint8_t rrl_ipv4_prefixlen = RRL_IPV4_PREFIX_LENGTH;
 static uint8_t rrl_ipv6_prefixlen = RRL_IPV6_PREFIX_LENGTH;
 static uint64_t rrl_ipv6_mask; /* max prefixlen 64 */
 static uint32_t rrl_whitelist_ratelimit = RRL_WLIST_LIMIT; /* 2x qps */
+/* if there are ratelimits, from the server or for a zone */
+static int rrl_enabled = 1;
 
 /* the array of mmaps for the children (saved between reloads) */
 static void** rrl_maps = NULL;
 static size_t rrl_maps_num = 0;
+/* if the children share the first mmap */
+static int rrl_shared = 0;
+
+/*
+ * Access to the buckets of the shared table. Other servers update
+ * the same buckets, the updates are atomic per field but not for the
+ * bucket, a race gives a slightly wrong count, but no wrong state.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define RRL_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define RRL_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define RRL_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define RRL_XCHG(x, v) __atomic_exchange_n(&(x), (v), __ATOMIC_RELAXED)
+#define RRL_CAS(x, e, v) __atomic_compare_exchange_n(&(x), (e), (v), 0, \
+	__ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define RRL_LOAD(x) (x)
+#define RRL_STORE(x, v) ((x) = (v))
+#define RRL_INC(x) (++(x))
+static uint32_t rrl_xchg(uint32_t* x, uint32_t v)
+{ uint32_t o = *x; *x = v; return o; }
+#define RRL_XCHG(x, v) rrl_xchg(&(x), (v))
+static int rrl_cas(int32_t* x, int32_t* e, int32_t v)
+{ if(*x != *e) { *e = *x; return 0; } *x = v; return 1; }
+#define RRL_CAS(x, e, v) rrl_cas(&(x), (e), (v))
+#endif
 
 void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls)
+	size_t plf, size_t pls, int shared)
 {
 #ifdef HAVE_MMAP
 	size_t i;
 #endif
 	if(numbuck != 0)
 		rrl_array_size = numbuck;
+	/* whole sets of buckets */
+	rrl_array_size = (rrl_array_size+RRL_WAYS-1)/RRL_WAYS*RRL_WAYS;
 	rrl_ratelimit = lm*2;
 	rrl_slip_ratio = sm;
 	rrl_ipv4_prefixlen = plf;
@@ -76,12 +116,19 @@ void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
 			(((uint64_t)0xffffffff)<<32);
 	}
 	rrl_whitelist_ratelimit = wlm*2;
+	rrl_enabled = (rrl_ratelimit != 0 || rrl_whitelist_ratelimit != 0);
 #ifdef HAVE_MMAP
 	/* allocate the ratelimit hashtable in a memory map so it is
-	 * preserved across reforks (every child its own table) */
+	 * preserved across reforks (every child its own table, or one
+	 * table for all of them if shared) */
 	rrl_maps_num = (size_t)numch;
+	rrl_shared = shared;
 	rrl_maps = (void**)xmallocarray(rrl_maps_num, sizeof(void*));
 	for(i=0; i<rrl_maps_num; i++) {
+		if(shared && i > 0) {
+			rrl_maps[i] = rrl_maps[0];
+			continue;
+		}
 		rrl_maps[i] = mmap(NULL,
 			sizeof(struct rrl_bucket)*rrl_array_size,
 			PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
@@ -95,6 +142,7 @@ void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
 	}
 #else
 	(void)numch;
+	(void)shared;
 	rrl_maps_num = 0;
 	rrl_maps = NULL;
 #endif
@@ -105,7 +153,9 @@ void rrl_mmap_deinit(void)
 #ifdef HAVE_MMAP
 	size_t i;
 	for(i=0; i<rrl_maps_num; i++) {
-		munmap(rrl_maps[i], sizeof(struct rrl_bucket)*rrl_array_size);
+		if(!rrl_shared || i == 0)
+			munmap(rrl_maps[i],
+				sizeof(struct rrl_bucket)*rrl_array_size);
 		rrl_maps[i] = NULL;
 	}
 	free(rrl_maps);
@@ -126,6 +176,34 @@ void rrl_set_limit(size_t lm, size_t wlm, size_t sm)
 	rrl_ratelimit = lm*2;
 	rrl_whitelist_ratelimit = wlm*2;
 	rrl_slip_ratio = sm;
+	rrl_enabled = (rrl_ratelimit != 0 || rrl_whitelist_ratelimit != 0);
+}
+
+void rrl_zone_set_limits(zone_type* zone)
+{
+	struct pattern_options* p = zone->opts?zone->opts->pattern:NULL;
+	int i;
+	for(i=0; i<RRL_TYPES; i++) {
+		uint16_t c = (1<<i);
+		uint32_t lm = rrl_ratelimit;
+		if(p && (p->rrl_type_limits & c))
+			lm = p->rrl_type_ratelimit[i]*2;
+		else if(p && (p->rrl_whitelist & c))
+			lm = rrl_whitelist_ratelimit;
+		else if(p && !p->rrl_ratelimit_is_default)
+			lm = p->rrl_ratelimit*2;
+		zone->rrl_limit[i] = lm;
+		if(lm != 0)
+			rrl_enabled = 1;
+	}
+}
+
+void rrl_zones_set_limits(struct namedb* db)
+{
+	struct radnode* n;
+	rrl_enabled = (rrl_ratelimit != 0 || rrl_whitelist_ratelimit != 0);
+	for(n=radix_first(db->zonetree); n; n=radix_next(n))
+		rrl_zone_set_limits((zone_type*)n->elem);
 }
 
 void rrl_init(size_t ch)
@@ -302,6 +380,17 @@ static uint16_t rrl_classify(query_type* query, const uint8_t** d,
 	return rrl_type_positive;
 }
 
+/** index of the classification type in the ratelimits of the zone */
+static int rrl_type_index(uint16_t c)
+{
+	int i = 0;
+	while(c > 1) {
+		c >>= 1;
+		i++;
+	}
+	return i;
+}
+
 /** Examine the query and return hash and source of netblock. */
 static void examine_query(query_type* query, uint32_t* hash, uint64_t* source,
 	uint16_t* flags, uint32_t* lm)
@@ -315,9 +404,8 @@ static void examine_query(query_type* query, uint32_t* hash, uint64_t* source,
 
 	*source = rrl_get_source(query, &c2);
 	c = rrl_classify(query, &dname, &dname_len);
-	if(query->zone && query->zone->opts &&
-		(query->zone->opts->pattern->rrl_whitelist & c))
-		*lm = rrl_whitelist_ratelimit;
+	if(query->zone)
+		*lm = query->zone->rrl_limit[rrl_type_index(c)];
 	if(*lm == 0) return;
 	c |= c2;
 	*flags = c;
@@ -329,24 +417,30 @@ static void examine_query(query_type* query, uint32_t* hash, uint64_t* source,
 	/* and hash it */
 	if(dname && dname_len <= MAXDOMAINLEN) {
 		memmove(buf+sizeof(*source)+sizeof(c), dname, dname_len);
-		*hash = hashlittle(buf, sizeof(*source)+sizeof(c)+dname_len, r);
+		*hash = fasthash32(buf, sizeof(*source)+sizeof(c)+dname_len, r);
 	} else
-		*hash = hashlittle(buf, sizeof(*source)+sizeof(c), r);
+		*hash = fasthash32(buf, sizeof(*source)+sizeof(c), r);
+}
+
+/* age the rate because elapsed time steps have gone by */
+static uint32_t rrl_attenuate_rate(uint32_t rate, uint32_t counter,
+	int32_t elapsed)
+{
+	if(elapsed > 16)
+		return 0;
+	/* divide rate /2 for every elapsed time step, because
+	 * the counters in the inbetween steps were 0 */
+	/* r(t) = 0 + 0/2 + 0/4 + .. + oldrate/2^dt */
+	rate >>= elapsed;
+	/* we know that elapsed >= 2 */
+	rate += (counter>>(elapsed-1));
+	return rate;
 }
 
 /* age the bucket because elapsed time steps have gone by */
 static void rrl_attenuate_bucket(struct rrl_bucket* b, int32_t elapsed)
 {
-	if(elapsed > 16) {
-		b->rate = 0;
-	} else {
-		/* divide rate /2 for every elapsed time step, because
-		 * the counters in the inbetween steps were 0 */
-		/* r(t) = 0 + 0/2 + 0/4 + .. + oldrate/2^dt */
-		b->rate >>= elapsed;
-		/* we know that elapsed >= 2 */
-		b->rate += (b->counter>>(elapsed-1));
-	}
+	b->rate = rrl_attenuate_rate(b->rate, b->counter, elapsed);
 }
 
 /** log a message about ratelimits */
@@ -378,28 +472,80 @@ used_to_block(uint32_t rate, uint32_t counter, uint32_t lm)
 	return rate >= lm || counter+rate/2 >= lm;
 }
 
+/** estimate of the rate of a bucket at time now, for replacement */
+static uint32_t rrl_bucket_rate(uint32_t rate, uint32_t counter,
+	int32_t stamp, int32_t now)
+{
+	/* circular arith for time */
+	int32_t elapsed = now - stamp;
+	if(elapsed <= 0)
+		return counter + rate/2;
+	if(elapsed == 1)
+		return rate/2 + counter;
+	return rrl_attenuate_rate(rate, counter, elapsed);
+}
+
+/** find the bucket for the source in the set of the hash; or, if it is
+ * not there, the bucket to replace: an empty one, or else the one with
+ * the lowest rate. Sets *found if it is the bucket of the source. */
+static struct rrl_bucket* rrl_find_bucket(uint32_t hash, uint64_t source,
+	uint16_t flags, int32_t now, int* found)
+{
+	struct rrl_bucket* set = &rrl_array[(hash % (rrl_array_size/RRL_WAYS))
+		* RRL_WAYS];
+	struct rrl_bucket* victim = NULL;
+	uint32_t victim_rate = 0;
+	int i;
+	for(i=0; i<RRL_WAYS; i++) {
+		struct rrl_bucket* b = &set[i];
+		uint32_t counter = RRL_LOAD(b->counter);
+		uint32_t r;
+		if(RRL_LOAD(b->hash) == hash && RRL_LOAD(b->source) == source &&
+			RRL_LOAD(b->flags) == flags && counter != 0) {
+			*found = 1;
+			return b;
+		}
+		if(counter == 0)
+			r = 0;
+		else	r = rrl_bucket_rate(RRL_LOAD(b->rate), counter,
+				RRL_LOAD(b->stamp), now);
+		/* on a tie, the older bucket goes */
+		if(!victim || r < victim_rate || (r == victim_rate &&
+			RRL_LOAD(b->stamp) - RRL_LOAD(victim->stamp) < 0)) {
+			victim = b;
+			victim_rate = r;
+		}
+	}
+	*found = 0;
+	if(RRL_LOAD(victim->counter) != 0)
+		rrl_last_evict = (now - RRL_LOAD(victim->stamp) <= 1)?
+			RRL_COLLISION:RRL_EVICTED;
+	return victim;
+}
+
 /** update the rate in a ratelimit bucket, return actual rate */
 uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
 	uint16_t flags, int32_t now, uint32_t lm)
 {
-	struct rrl_bucket* b = &rrl_array[hash % rrl_array_size];
+	int found;
+	struct rrl_bucket* b = rrl_find_bucket(hash, source, flags, now,
+		&found);
 
 	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "source %llx hash %x oldrate %d oldcount %d stamp %d",
 		(long long unsigned)source, hash, b->rate, b->counter, b->stamp));
 
 	/* check if different source */
-	if(b->source != source || b->flags != flags || b->hash != hash) {
+	if(!found) {
 		/* initialise */
 		/* potentially the wrong limit here, used lower nonwhitelim */
-		if(verbosity >= 1 &&
+		if(verbosity >= 1 && b->counter != 0 &&
 			used_to_block(b->rate, b->counter, rrl_ratelimit)) {
 			char address[128];
 			addr2str(&query->client_addr, address, sizeof(address));
-			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (%s collision)",
+			log_msg(LOG_INFO, "ratelimit unblock ~ type %s target %s query %s %s (bucket collision)",
 				rrltype2str(b->flags),
 				rrlsource2str(b->source, b->flags),
-				address, rrtype_to_string(query->qtype),
-				(b->hash!=hash?"bucket":"hash"));
+				address, rrtype_to_string(query->qtype));
 		}
 		b->hash = hash;
 		b->source = source;
@@ -453,15 +599,73 @@ uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
 	return b->rate;
 }
 
-int rrl_process_query(query_type* query)
+/** update the rate in a bucket of the shared table, return actual rate.
+ * The first server that sees a new timestep moves the counter into the
+ * rate, the others only increase the counter. */
+static uint32_t rrl_update_shared(query_type* query, uint32_t hash,
+	uint64_t source, uint16_t flags, int32_t now, uint32_t lm)
+{
+	int found;
+	struct rrl_bucket* b = rrl_find_bucket(hash, source, flags, now,
+		&found);
+	uint32_t rate, counter;
+	int32_t stamp;
+
+	/* check if different source */
+	if(!found) {
+		/* initialise */
+		RRL_STORE(b->hash, hash);
+		RRL_STORE(b->source, source);
+		RRL_STORE(b->flags, flags);
+		RRL_STORE(b->counter, 1);
+		RRL_STORE(b->rate, 0);
+		RRL_STORE(b->stamp, now);
+		return 1;
+	}
+	/* this is the same source */
+
+	stamp = RRL_LOAD(b->stamp);
+	if(now != stamp && RRL_CAS(b->stamp, &stamp, now)) {
+		/* this server steps the bucket to the current timestep */
+		int oldblock;
+		counter = RRL_XCHG(b->counter, 1);
+		rate = RRL_LOAD(b->rate);
+		oldblock = used_to_block(rate, counter, lm);
+		/* circular arith for time */
+		if(now - stamp == 1)
+			rate = rate/2 + counter;
+		else if(now - stamp > 0)
+			rate = rrl_attenuate_rate(rate, counter, now - stamp);
+		else	rate = 0; /* robust, timestamp from the future */
+		RRL_STORE(b->rate, rate);
+		if(oldblock && rate < lm)
+			rrl_msg(query, "unblock");
+		counter = 1;
+	} else {
+		/* bucket is from the current timestep, update counter */
+		counter = RRL_INC(b->counter);
+		rate = RRL_LOAD(b->rate);
+
+		/* log what is blocked for operational debugging */
+		if(counter + rate/2 == lm && rate < lm)
+			rrl_msg(query, "block");
+	}
+
+	/* return max from current rate and projected next-value for rate */
+	if(counter > rate/2)
+		return counter + rate/2;
+	return rate;
+}
+
+int rrl_process_query(query_type* query, struct nsd* nsd)
 {
 	uint64_t source;
-	uint32_t hash;
+	uint32_t hash, rate;
 	/* we can use circular arithmetic here, so int32 works after 2038 */
 	int32_t now = (int32_t)time(NULL);
 	uint32_t lm = rrl_ratelimit;
 	uint16_t flags;
-	if(rrl_ratelimit == 0 && rrl_whitelist_ratelimit == 0)
+	if(!rrl_enabled)
 		return 0;
 
 	/* examine query */
@@ -471,7 +675,19 @@ int rrl_process_query(query_type* query)
 		return 0; /* no limit for this */
 
 	/* update rate */
-	return (rrl_update(query, hash, source, flags, now, lm) >= lm);
+	rrl_last_evict = 0;
+	if(rrl_shared && rrl_maps && rrl_array == rrl_maps[0])
+		rate = rrl_update_shared(query, hash, source, flags, now, lm);
+	else	rate = rrl_update(query, hash, source, flags, now, lm);
+	if(rrl_last_evict) {
+		STATUP(nsd, rrl_evicted);
+		if(rrl_last_evict == RRL_COLLISION)
+			STATUP(nsd, rrl_collision);
+	}
+#ifndef BIND8_STATS
+	(void)nsd;
+#endif
+	return (rate >= lm);
 }
 
 query_state_type rrl_slip(query_type* query)
@@ -20,7 +20,7 @@ enum rrl_type {
 	rrl_type_positive	= 0x80,
 	rrl_type_rrsig		= 0x100,
 
-	/* all classification types */
+	/* all classification types, RRL_TYPES bits */
 	rrl_type_all		= 0x1ff,
 	/* to distinguish between ip4 and ip6 netblocks, used in code */
 	rrl_ip6			= 0x8000
@@ -28,6 +28,8 @@ enum rrl_type {
 
 /** Number of buckets */
 #define RRL_BUCKETS 1000000
+/** Number of buckets in a set, a source can be in any bucket of its set */
+#define RRL_WAYS 4
 /** default rrl limit, in 2x qps , the default is 200 qps */
 #define RRL_LIMIT 400
 /** default slip */
@@ -42,9 +44,10 @@ enum rrl_type {
  * Initialize for n children (optional, otherwise no mmaps used)
  * ratelimits lm and wlm are in qps (this routines x2s them for internal use).
  * plf and pls are in prefix lengths.
+ * If shared, the children use one table, and see the rates over all of them.
  */
 void rrl_mmap_init(int numch, size_t numbuck, size_t lm, size_t wlm, size_t sm,
-	size_t plf, size_t pls);
+	size_t plf, size_t pls, int shared);
 
 /**
  * Initialize rate limiting (for this child server process)
@@ -62,9 +65,10 @@ void rrl_mmap_deinit_keep_mmap(void);
 /**
  * Process query that happens, the query structure contains the
  * information about the query and the answer.
+ * Counts the buckets of other sources that are replaced in the statistics.
  * returns true if the query is ratelimited.
  */
-int rrl_process_query(query_type* query);
+int rrl_process_query(query_type* query, struct nsd* nsd);
 
 /**
  * Deny the query, with slip.
@@ -83,4 +87,15 @@ uint32_t rrl_update(query_type* query, uint32_t hash, uint64_t source,
 /** set the rate limit counters, pass variables in qps */
 void rrl_set_limit(size_t lm, size_t wlm, size_t sm);
 
+/**
+ * Set the ratelimits of the zone for the rrl types, from the
+ * rrl-type-ratelimit, rrl-whitelist and rrl-ratelimit options of the zone
+ * and the server ratelimits. Done when the zone is loaded, so queries
+ * only look up the limit for their type.
+ */
+void rrl_zone_set_limits(zone_type* zone);
+
+/** set the ratelimits of all the zones in the db */
+void rrl_zones_set_limits(struct namedb* db);
+
 #endif /* RRL_H */
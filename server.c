@@ -38,12 +38,41 @@
 #ifdef HAVE_SYS_RANDOM_H
 #include <sys/random.h>
 #endif
+#ifdef HAVE_SYS_UN_H
+#include <sys/un.h>
+#endif
+#include <sys/stat.h>
 #ifndef SHUT_WR
 #define SHUT_WR 1
 #endif
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
+#if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
 #endif /* HAVE_MMAP */
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+#include <sys/resource.h>
+#endif
+#if defined(HAVE_MALLOC_H) && defined(HAVE_MALLOC_TRIM)
+#include <malloc.h>
+#endif
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define USE_TCP_ZEROCOPY 1
+/* the msec to wait before the error queue is looked at for the release
+ * of a MSG_ZEROCOPY send, it doubles to the max while it is not there */
+#define TCP_ZEROCOPY_POLL_MIN 1
+#define TCP_ZEROCOPY_POLL_MAX 64
+#endif
+#ifdef HAVE_NETINET_UDP_H
+#include <netinet/udp.h>
+#endif
 #ifdef HAVE_OPENSSL_RAND_H
 #include <openssl/rand.h>
 #endif
@@ -56,6 +85,11 @@
 #ifdef HAVE_OPENSSL_OCSP_H
 #include <openssl/ocsp.h>
 #endif
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+#include <openssl/core_names.h>
+#elif defined(HAVE_SSL)
+#include <openssl/hmac.h>
+#endif
 #ifndef USE_MINI_EVENT
 #  ifdef HAVE_EVENT_H
 #    include <event.h>
@@ -80,13 +114,22 @@
 #include "udb.h"
 #include "remote.h"
 #include "lookup3.h"
+#include "fasthash.h"
 #include "rrl.h"
+#include "respcache.h"
+#include "topstat.h"
+#include "metrics.h"
 #include "ixfr.h"
 #ifdef USE_DNSTAP
 #include "dnstap/dnstap_collector.h"
 #endif
 #include "verify.h"
 #include "util/proxy_protocol.h"
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+#include "xdp-server.h"
+#include "probes.h"
 
 #define RELOAD_SYNC_TIMEOUT 25 /* seconds */
 
@@ -152,6 +195,10 @@ struct udp_handler_data
 	struct event       event;
 	/* if set, PROXYv2 is expected on this connection */
 	int pp2_enabled;
+	/* the last drop counter of the socket seen, for the
+	 * udp-queue-statistics, and if one was seen */
+	uint32_t rxq_ovfl;
+	int rxq_ovfl_seen;
 };
 
 struct tcp_accept_handler_data {
@@ -203,6 +250,69 @@ static struct mmsghdr msgs[NUM_RECV_PER_SELECT];
 static struct iovec iovecs[NUM_RECV_PER_SELECT];
 static struct query *queries[NUM_RECV_PER_SELECT];
 
+/* The size of the packet buffer of the UDP queries, that holds the largest
+ * UDP answer, from the EDNS sizes, and a query with a PROXYv2 header.
+ * Larger datagrams are truncated by the receive, and dropped. */
+static size_t
+udp_query_buffer_size(struct nsd* nsd)
+{
+	size_t size = 4096;
+	if(nsd->ipv4_edns_size > size)
+		size = nsd->ipv4_edns_size;
+	if(nsd->ipv6_edns_size > size)
+		size = nsd->ipv6_edns_size;
+	if(size > QIOBUFSZ)
+		size = QIOBUFSZ;
+	return size;
+}
+
+#if defined(UDP_SEGMENT) && defined(SOL_UDP) && defined(HAVE_SENDMMSG)
+#define USE_UDP_GSO 1
+/* the kernel limit on the number of segments in one send */
+#define UDP_GSO_MAX_SEGMENTS 64
+/* the answers combined for GSO, gso_first has the first query of each */
+static struct mmsghdr gso_msgs[NUM_RECV_PER_SELECT];
+static int gso_first[NUM_RECV_PER_SELECT];
+static union {
+	char buf[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr align;
+} gso_control[NUM_RECV_PER_SELECT];
+/* cleared when the interface cannot do GSO */
+static int udp_gso_works = 1;
+#define UDP_SEND_FIRST(smsgs, i) ((smsgs) == msgs ? (i) : gso_first[(i)])
+#else
+#define UDP_SEND_FIRST(smsgs, i) (i)
+#endif /* UDP_SEGMENT && SOL_UDP && HAVE_SENDMMSG */
+
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME) && \
+	defined(HAVE_RECVMMSG) && defined(SO_RXQ_OVFL) && \
+	defined(SO_TIMESTAMPNS) && defined(SCM_TIMESTAMPNS)
+#define USE_UDP_QUEUE_STATS 1
+/* the control messages of the received queries, with the drop counter of
+ * the socket and the kernel receive time */
+static union {
+	char buf[CMSG_SPACE(sizeof(uint32_t)) +
+		CMSG_SPACE(sizeof(struct timespec))];
+	struct cmsghdr align;
+} rxq_control[NUM_RECV_PER_SELECT];
+/* set in the server processes if udp-queue-statistics is enabled */
+static int udp_queue_stats = 0;
+#endif
+
+/* the number of UDP queries that are read at once, it adapts to the
+ * udp-batch-latency usec, and the average nsec of a query in a batch */
+static int udp_batch_max = NUM_RECV_PER_SELECT;
+static int udp_batch_latency = 0;
+#ifdef HAVE_CLOCK_GETTIME
+static uint64_t udp_batch_cost = 0;
+#endif
+
+/* for udp-shed, the server is in overload after this many full UDP
+ * batches in a row, and out of it at a batch that is half full or less */
+#define UDP_SHED_FULL_BATCHES 4
+static int udp_shed = 0;
+static int udp_shed_full = 0;
+
 /*
  * Data for the TCP connection handlers.
  *
@@ -221,7 +331,8 @@ struct tcp_handler_data
 	/*
 	 * The region used to allocate all TCP connection related
 	 * data, including this structure.  This region is destroyed
-	 * when the connection is closed.
+	 * when the connection is closed, or kept with the structure in
+	 * the pool of handlers for new connections.
 	 */
 	region_type*		region;
 
@@ -273,6 +384,37 @@ struct tcp_handler_data
 	 */
 	int tcp_no_more_queries;
 
+	/*
+	 * With tcp-pipeline, the bytes that are read ahead, and the answers
+	 * that wait to be written, or NULL until the first read.
+	 */
+	buffer_type* pipeline_in;
+	buffer_type* pipeline_out;
+	/* if pipeline_out is flipped and has answers to write */
+	int pipeline_flush;
+	/* if the answer in the query packet is written after pipeline_out */
+	int pipeline_answer;
+	/* if the event is set to continue with the queries read ahead */
+	int pipeline_resume;
+
+	/* if the connection waits for a query, and can be evicted */
+	int tcp_idle;
+
+#ifdef USE_TCP_ZEROCOPY
+	/* if answers of the tcp-zerocopy size are sent with MSG_ZEROCOPY */
+	int zc_enabled;
+	/* the number of MSG_ZEROCOPY sends, and the number of those that
+	 * the kernel has released, the query packet is not used again
+	 * until they are equal */
+	uint32_t zc_sent, zc_done;
+	/* if the event waits for the kernel to release the packet, and
+	 * the msec until the error queue is looked at again, and that the
+	 * release has been waited for */
+	int zc_wait, zc_poll, zc_waited;
+#endif
+	/* the counter for the source address of tcp-source-limit, or -1 */
+	ssize_t source_slot;
+
 #ifdef USE_DNSTAP
 	/* the socket of the accept socket to find proper service (local) address the socket is bound to. */
 	struct nsd_socket *socket;
@@ -284,6 +426,12 @@ struct tcp_handler_data
 	/* header state for the PROXYv2 header (for TCP) */
 	enum pp2_header_state pp2_header_state;
 
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	/* the time the current query was received, if latency_measure */
+	struct timespec latency_start;
+	int latency_measure;
+#endif
+
 #ifdef HAVE_SSL
 	/*
 	 * TLS objects.
@@ -295,18 +443,68 @@ struct tcp_handler_data
 	 * TLS handshake state.
 	 */
 	enum { tls_hs_none, tls_hs_read, tls_hs_write,
-		tls_hs_read_event, tls_hs_write_event } shake_state;
+		tls_hs_read_event, tls_hs_write_event,
+		tls_hs_async } shake_state;
 #endif
 	/* list of connections, for service of remaining tcp channels */
 	struct tcp_handler_data *prev, *next;
 };
-/* global that is the list of active tcp channels */
+/* global that is the list of active tcp channels, the one that had a query
+ * most recently first, and the last one, that tcp-evict-idle closes */
 static struct tcp_handler_data *tcp_active_list = NULL;
+static struct tcp_handler_data *tcp_active_last = NULL;
+/* closed tcp channels, with their region, query and buffers, that are
+ * used again for new connections, linked with the next pointer */
+static struct tcp_handler_data *tcp_handler_pool = NULL;
+static size_t tcp_handler_pool_count = 0;
+/* connections per source address, in a hashed table of counters for
+ * tcp-source-limit */
+static uint16_t* tcp_source_count = NULL;
+static size_t tcp_source_mask = 0;
 
 /*
  * Handle incoming queries on the UDP server sockets.
  */
 static void handle_udp(int fd, short event, void* arg);
+static void handle_udp_plain(int fd, short event, void* arg);
+static void (*udp_handler_for(struct udp_handler_data* data))(int, short,
+	void*);
+
+/* the UDP handlers of the server that the busy poll spins on, and if the
+ * last receive got queries */
+static struct udp_handler_data** busy_poll_udp = NULL;
+static size_t busy_poll_udp_count = 0;
+static int busy_poll_received = 0;
+/* the average usec between the receives, for udp-batch-latency */
+static uint64_t busy_poll_gap = 0;
+/* the UDP handlers of the server for udp-drain, with the fds to poll
+ * them, and the one to start the next drain with */
+static void handle_udp_drain(int fd, short event, void* arg);
+static struct udp_handler_data** udp_drain_udp = NULL;
+static struct pollfd* udp_drain_fds = NULL;
+static size_t udp_drain_count = 0;
+static size_t udp_drain_next = 0;
+/* rounds of the busy poll between the checks of the other events */
+#define BUSY_POLL_EVENT_ROUNDS 16
+
+#ifdef USE_IO_URING
+/*
+ * Serve the UDP socket from the io_uring of this server process instead
+ * of with handle_udp. Returns 0 if io_uring cannot be used for it.
+ */
+static int uring_add_udp_socket(struct udp_handler_data *data);
+#ifdef MEMCLEAN
+static void uring_udp_deinit(void);
+#endif
+#endif
+
+#ifdef USE_XDP
+/*
+ * Answer a query that was received on the AF_XDP socket of this server.
+ */
+static int xdp_answer_query(struct nsd* nsd, struct nsd_socket* sock,
+	struct query* q, uint32_t* now_p);
+#endif
 
 /*
  * Handle incoming connections on the TCP sockets.  These handlers
@@ -326,12 +524,26 @@ static void handle_tcp_accept(int fd, short event, void* arg);
  */
 static void handle_tcp_reading(int fd, short event, void* arg);
 
+/*
+ * Continue with the queries that are read ahead on a TCP connection, with
+ * tcp-pipeline, when the socket can take the answers.
+ */
+static void handle_tcp_pipeline(int fd, short event, void* arg);
+
 /*
  * Handle outgoing responses on a TCP connection.  The TCP connections
  * are configured to be non-blocking and the handler may be called
  * multiple times before a complete response is sent.
  */
 static void handle_tcp_writing(int fd, short event, void* arg);
+#ifdef USE_TCP_ZEROCOPY
+/*
+ * Look for the notifications of MSG_ZEROCOPY on the error queue, from a
+ * timer, while the packet that is written waits to be released by the
+ * kernel.
+ */
+static void handle_tcp_zerocopy(int fd, short event, void* arg);
+#endif
 
 #ifdef HAVE_SSL
 /* Create SSL object and associate fd */
@@ -354,6 +566,13 @@ static void handle_tls_reading(int fd, short event, void* arg);
  * be called multiple times before a complete response is sent.
  */
 static void handle_tls_writing(int fd, short event, void* arg);
+
+#ifdef SSL_MODE_ASYNC
+/*
+ * Continue the TLS handshake when its async job is done, with tls-async.
+ */
+static void handle_tls_async(int afd, short event, void* arg);
+#endif
 #endif
 
 /*
@@ -373,10 +592,8 @@ static void set_children_stats(struct nsd* nsd);
  */
 static void configure_handler_event_types(short event_types);
 
-static uint16_t *compressed_dname_offsets = 0;
-static uint32_t compression_table_capacity = 0;
+static struct compression_table *compression_table = NULL;
 static uint32_t compression_table_size = 0;
-static domain_type* compressed_dnames[MAXRRSPP];
 
 #ifdef USE_TCP_FASTOPEN
 /* Checks to see if the kernel value must be manually changed in order for
@@ -440,8 +657,8 @@ restart_child_servers(struct nsd *nsd, region_type* region, netio_type* netio,
 	size_t i;
 	int sv[2];
 
-	/* Fork the child processes... */
-	for (i = 0; i < nsd->child_count; ++i) {
+	/* Fork the child processes, the retired ones are not started */
+	for (i = 0; i < nsd->active_children; ++i) {
 		if (nsd->children[i].pid <= 0) {
 			if (nsd->children[i].child_fd != -1)
 				close(nsd->children[i].child_fd);
@@ -542,7 +759,7 @@ server_zonestat_alloc(struct nsd* nsd)
 {
 	size_t num = (nsd->options->zonestatnames->count==0?1:
 			nsd->options->zonestatnames->count);
-	size_t sz = sizeof(struct nsdst)*num;
+	size_t sz = sizeof(struct nsdst)*num*nsd->child_count;
 	char tmpfile[256];
 	uint8_t z = 0;
 
@@ -625,7 +842,7 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 #ifdef HAVE_MMAP
 #ifdef MREMAP_MAYMOVE
 	nsd->zonestat[idx] = (struct nsdst*)mremap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], sz,
+		sizeof(struct nsdst)*nsd->zonestatsize[idx]*nsd->child_count, sz,
 		MREMAP_MAYMOVE);
 	if(nsd->zonestat[idx] == MAP_FAILED) {
 		log_msg(LOG_ERR, "mremap failed: %s", strerror(errno));
@@ -633,10 +850,12 @@ zonestat_remap(struct nsd* nsd, int idx, size_t sz)
 	}
 #else /* !HAVE MREMAP */
 	if(msync(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx], MS_ASYNC) != 0)
+		sizeof(struct nsdst)*nsd->zonestatsize[idx]*nsd->child_count,
+		MS_ASYNC) != 0)
 		log_msg(LOG_ERR, "msync failed: %s", strerror(errno));
 	if(munmap(nsd->zonestat[idx],
-		sizeof(struct nsdst)*nsd->zonestatsize[idx]) != 0)
+		sizeof(struct nsdst)*nsd->zonestatsize[idx]*nsd->child_count)
+		!= 0)
 		log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
 	nsd->zonestat[idx] = (struct nsdst*)mmap(NULL, sz,
 		PROT_READ|PROT_WRITE, MAP_SHARED, nsd->zonestatfd[idx], 0);
@@ -661,7 +880,7 @@ server_zonestat_realloc(struct nsd* nsd)
 		idx = 1;
 	if(nsd->zonestatsize[idx] == nsd->zonestatdesired)
 		return;
-	sz = sizeof(struct nsdst)*nsd->zonestatdesired;
+	sz = sizeof(struct nsdst)*nsd->zonestatdesired*nsd->child_count;
 	if(lseek(nsd->zonestatfd[idx], (off_t)sz-1, SEEK_SET) == -1) {
 		log_msg(LOG_ERR, "lseek %s: %s", nsd->zonestatfname[idx],
 			strerror(errno));
@@ -676,7 +895,8 @@ server_zonestat_realloc(struct nsd* nsd)
 	/* zero the newly allocated region */
 	if(nsd->zonestatdesired > nsd->zonestatsize[idx]) {
 		memset(((char*)nsd->zonestat[idx])+sizeof(struct nsdst) *
-			nsd->zonestatsize[idx], 0, sizeof(struct nsdst) *
+			nsd->zonestatsize[idx]*nsd->child_count, 0,
+			sizeof(struct nsdst) * nsd->child_count *
 			(nsd->zonestatdesired - nsd->zonestatsize[idx]));
 	}
 	nsd->zonestatsize[idx] = nsd->zonestatdesired;
@@ -705,8 +925,24 @@ server_stat_alloc(struct nsd* nsd)
 {
 	char tmpfile[256];
 	size_t sz = sizeof(struct nsdst) * nsd->child_count * 2;
+	size_t active_pos, handover_pos;
 	uint8_t z = 0;
 
+	/* the heavy hitters of the servers are after the statistics */
+	nsd->topstat_map = NULL;
+	nsd->topstat = NULL;
+	if(nsd->options->top_statistics)
+		sz += sizeof(struct topstat) * nsd->child_count * 2;
+	/* then the queries of the cached responses */
+	nsd->respcache_handover_map = NULL;
+	handover_pos = sz;
+	if(nsd->options->reload_prewarm && !nsd->options->round_robin &&
+		nsd->options->response_cache_size > 0)
+		sz += sizeof(struct respcache_handover) * nsd->child_count * 2;
+	/* and then the number of running servers */
+	active_pos = sz;
+	sz += sizeof(uint64_t);
+
 	/* file name */
 	nsd->statfname = 0;
 	snprintf(tmpfile, sizeof(tmpfile), "%snsd-xfr-%d/nsd.%u.stat",
@@ -750,6 +986,15 @@ fail_exit:
 	nsd->stats_per_child[1] = &nsd->stat_map[nsd->child_count];
 	nsd->stat_current = 0;
 	nsd->st = &nsd->stats_per_child[nsd->stat_current][0];
+	if(nsd->options->top_statistics)
+		nsd->topstat_map = (struct topstat*)&nsd->stat_map[
+			nsd->child_count*2];
+	if(active_pos != handover_pos)
+		nsd->respcache_handover_map = (struct respcache_handover*)
+			((uint8_t*)nsd->stat_map + handover_pos);
+	nsd->stat_active_children = (uint32_t*)((uint8_t*)nsd->stat_map +
+		active_pos);
+	*nsd->stat_active_children = (uint32_t)nsd->active_children;
 #endif /* HAVE_MMAP */
 }
 #endif /* BIND8_STATS */
@@ -766,31 +1011,29 @@ static void
 cleanup_dname_compression_tables(void *ptr)
 {
 	free(ptr);
-	compressed_dname_offsets = NULL;
-	compression_table_capacity = 0;
+	compression_table = NULL;
 }
 
 static void
 initialize_dname_compression_tables(struct nsd *nsd)
 {
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
-	needed += EXTRA_DOMAIN_NUMBERS;
-	if(compression_table_capacity < needed) {
-		if(compressed_dname_offsets) {
-			region_remove_cleanup(nsd->db->region,
-				cleanup_dname_compression_tables,
-				compressed_dname_offsets);
-			free(compressed_dname_offsets);
-		}
-		compressed_dname_offsets = (uint16_t *) xmallocarray(
-			needed, sizeof(uint16_t));
+	/* the table does not depend on the size of the database, only
+	 * the numbers for temporary domains do */
+	if(!compression_table) {
+		compression_table = (struct compression_table *) xalloc_zero(
+			sizeof(*compression_table));
 		region_add_cleanup(nsd->db->region, cleanup_dname_compression_tables,
-			compressed_dname_offsets);
-		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
-	}
-	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
-	compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
+			compression_table);
+	} else {
+		memset(compression_table->entries, 0,
+			sizeof(compression_table->entries));
+	}
+	/* the numbers stay dense, a deleted domain gets the number of the
+	 * last one, so that the temporary domains are numbered after the
+	 * count of domains */
+	compression_table_size = nsd->db->domains->numlist_last->number + 1;
+	assert(compression_table_size ==
+		domain_table_count(nsd->db->domains) + 1);
 }
 
 static int
@@ -1247,11 +1490,407 @@ set_setfib(struct nsd_socket *sock)
 #endif
 }
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+/*
+ * Attach a classic BPF program to the reuseport group of the socket, that
+ * returns the index of the socket for the packet. The sockets in the group
+ * are bound in the order of the servers, so the index is the number of the
+ * server. For an index outside of the group the kernel uses the hash.
+ */
+static void
+set_reuseport_steering(struct nsd *nsd, struct nsd_socket *sock,
+	size_t active)
+{
+	struct cpu_map_option *map;
+	struct sock_filter *code;
+	struct sock_fprog prog;
+	size_t n = 0, max = 8;
+
+	for(map = nsd->options->service_cpu_affinity; map; map = map->next)
+		max += 2;
+	code = xmallocarray(max, sizeof(*code));
+	if(strcmp(nsd->options->reuseport_steering, "cpu") == 0) {
+		/* the server bound to the cpu, or the cpu modulo servers */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_AD_OFF + SKF_AD_CPU);
+		for(map = nsd->options->service_cpu_affinity; map;
+			map = map->next) {
+			if(map->service < 1 ||
+				(size_t)map->service > active)
+				continue;
+			code[n++] = (struct sock_filter)BPF_JUMP(
+				BPF_JMP|BPF_JEQ|BPF_K, map->cpu, 0, 1);
+			code[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K,
+				map->service - 1);
+		}
+	} else if(strcmp(nsd->options->reuseport_steering, "no") == 0 &&
+		sock->addr.ai_family == AF_INET) {
+		/* the source address and port, over the running servers,
+		 * for server-count-min. Not the rxhash, that is 0 without
+		 * RSS and RPS, and then all the packets go to one server */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_NET_OFF + 12);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_ST, 0);
+		/* the port is after the IPv4 header and its options */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_B|BPF_MSH,
+			SKF_NET_OFF);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_IND,
+			SKF_NET_OFF);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LDX|BPF_W|BPF_MEM,
+			0);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_ADD|BPF_X,
+			0);
+	} else if(strcmp(nsd->options->reuseport_steering, "no") == 0) {
+		/* the last word of the IPv6 source address and the port,
+		 * that is after the fixed header */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_NET_OFF + 20);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_MISC|BPF_TAX, 0);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS,
+			SKF_NET_OFF + 40);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_ADD|BPF_X,
+			0);
+	} else if(sock->addr.ai_family == AF_INET) {
+		/* the source address /24 */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_NET_OFF + 12);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_RSH|BPF_K,
+			8);
+	} else {
+		/* the source address /48, the first word plus the half */
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS,
+			SKF_NET_OFF + 8);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_MISC|BPF_TAX, 0);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS,
+			SKF_NET_OFF + 12);
+		code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_ADD|BPF_X,
+			0);
+	}
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU|BPF_MOD|BPF_K,
+		active);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_A, 0);
+	assert(n <= max);
+
+	prog.len = (unsigned short)n;
+	prog.filter = code;
+	if(setsockopt(sock->s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+		sizeof(prog)) == -1) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_ATTACH_REUSEPORT_CBPF, "
+			"...) failed: %s", strerror(errno));
+	}
+	free(code);
+}
+#endif /* SO_ATTACH_REUSEPORT_CBPF && HAVE_LINUX_FILTER_H */
+
+static void
+set_busy_poll(struct nsd_socket *sock, int usec)
+{
+#ifdef SO_BUSY_POLL
+	if(setsockopt(sock->s, SOL_SOCKET, SO_BUSY_POLL, &usec,
+		sizeof(usec)) == -1) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_BUSY_POLL, ...) failed: %s",
+			strerror(errno));
+	}
+#else
+	(void)sock;
+	(void)usec;
+#endif /* SO_BUSY_POLL */
+}
+
+/* have the kernel report the drops of the UDP socket and the receive time
+ * of the packets in control messages, for udp-queue-statistics */
+static void
+set_udp_queue_stats(struct nsd_socket *sock)
+{
+#if defined(SO_RXQ_OVFL) && defined(SO_TIMESTAMPNS)
+	int on = 1;
+	if(setsockopt(sock->s, SOL_SOCKET, SO_RXQ_OVFL, &on,
+		sizeof(on)) == -1) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_RXQ_OVFL, ...) failed: %s",
+			strerror(errno));
+	}
+	if(setsockopt(sock->s, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+		sizeof(on)) == -1) {
+		log_msg(LOG_ERR, "setsockopt(..., SO_TIMESTAMPNS, ...) failed: "
+			"%s", strerror(errno));
+	}
+#else
+	(void)sock;
+#endif /* SO_RXQ_OVFL && SO_TIMESTAMPNS */
+}
+
+/* the sockets received from the old nsd on the socket-handoff */
+static int* handoff_fds = NULL;
+static size_t handoff_num = 0;
+
+/* receive the listening sockets of the old nsd, if it has the socket-handoff
+ * open; the sockets are then taken by server_handoff_take */
+static void
+server_handoff_receive(struct nsd *nsd)
+{
+#ifdef HAVE_SYS_UN_H
+	const char* path = nsd->options->socket_handoff;
+	struct sockaddr_un usock;
+	struct timeval tv;
+	int s;
+
+	if(!path || !path[0])
+		return;
+	if((s = socket(AF_LOCAL, SOCK_STREAM, 0)) == -1) {
+		log_msg(LOG_ERR, "socket-handoff: cannot create socket: %s",
+			strerror(errno));
+		return;
+	}
+	memset(&usock, 0, sizeof(usock));
+#ifdef HAVE_STRUCT_SOCKADDR_UN_SUN_LEN
+	usock.sun_len = (unsigned)sizeof(usock);
+#endif
+	usock.sun_family = AF_LOCAL;
+	(void)strlcpy(usock.sun_path, path, sizeof(usock.sun_path));
+	/* do not hang on an old nsd that does not answer */
+	tv.tv_sec = 5;
+	tv.tv_usec = 0;
+	(void)setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if(connect(s, (struct sockaddr*)&usock, (socklen_t)sizeof(usock))
+		== -1) {
+		/* there is no old nsd */
+		VERBOSITY(2, (LOG_INFO, "socket-handoff %s: %s, opening "
+			"new sockets", path, strerror(errno)));
+		close(s);
+		return;
+	}
+	for(;;) {
+		union {
+			struct cmsghdr hdr;
+			char buf[CMSG_SPACE(sizeof(int))];
+		} control;
+		struct msghdr msg;
+		struct cmsghdr* cmsg;
+		struct iovec iov;
+		char c;
+		ssize_t r;
+
+		iov.iov_base = &c;
+		iov.iov_len = 1;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		if((r = recvmsg(s, &msg, 0)) == -1) {
+			if(errno == EINTR)
+				continue;
+			log_msg(LOG_ERR, "socket-handoff %s: recvmsg: %s",
+				path, strerror(errno));
+			break;
+		}
+		if(r == 0)
+			break;
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			handoff_fds = xrealloc(handoff_fds,
+				(handoff_num+1)*sizeof(*handoff_fds));
+			memcpy(&handoff_fds[handoff_num++], CMSG_DATA(cmsg),
+				sizeof(int));
+		}
+	}
+	close(s);
+	VERBOSITY(1, (LOG_INFO, "socket-handoff %s: received %d sockets",
+		path, (int)handoff_num));
+#else
+	(void)nsd;
+#endif /* HAVE_SYS_UN_H */
+}
+
+/* if the socket addresses are the same address and port */
+static int
+handoff_addr_match(struct sockaddr* a, struct sockaddr* b)
+{
+	if(a->sa_family != b->sa_family)
+		return 0;
+	if(a->sa_family == AF_INET) {
+		struct sockaddr_in* a4 = (struct sockaddr_in*)a;
+		struct sockaddr_in* b4 = (struct sockaddr_in*)b;
+		return a4->sin_port == b4->sin_port &&
+			a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	}
+#ifdef INET6
+	if(a->sa_family == AF_INET6) {
+		struct sockaddr_in6* a6 = (struct sockaddr_in6*)a;
+		struct sockaddr_in6* b6 = (struct sockaddr_in6*)b;
+		return a6->sin6_port == b6->sin6_port &&
+			memcmp(&a6->sin6_addr, &b6->sin6_addr,
+			sizeof(a6->sin6_addr)) == 0;
+	}
+#endif
+	return 0;
+}
+
+int
+server_handoff_take(struct sockaddr* addr, int socktype)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int type, fd;
+	size_t i;
+
+	for(i = 0; i < handoff_num; i++) {
+		if(handoff_fds[i] == -1)
+			continue;
+		len = (socklen_t)sizeof(type);
+		if(getsockopt(handoff_fds[i], SOL_SOCKET, SO_TYPE, &type,
+			&len) == -1 || type != socktype)
+			continue;
+		len = (socklen_t)sizeof(ss);
+		memset(&ss, 0, sizeof(ss));
+		if(getsockname(handoff_fds[i], (struct sockaddr*)&ss, &len)
+			== -1 || !handoff_addr_match((struct sockaddr*)&ss, addr))
+			continue;
+		fd = handoff_fds[i];
+		handoff_fds[i] = -1;
+		return fd;
+	}
+	return -1;
+}
+
+int
+server_handoff_listen(struct nsd *nsd)
+{
+	size_t i;
+
+	/* close the sockets of the old nsd that are not used */
+	for(i = 0; i < handoff_num; i++) {
+		if(handoff_fds[i] != -1)
+			close(handoff_fds[i]);
+	}
+	free(handoff_fds);
+	handoff_fds = NULL;
+	handoff_num = 0;
+
+	nsd->handoff_fd = -1;
+	if(!nsd->options->socket_handoff || !nsd->options->socket_handoff[0])
+		return 0;
+#ifdef HAVE_SYS_UN_H
+	{
+		int noproto = 0;
+		const char* path = nsd->options->socket_handoff;
+		if((nsd->handoff_fd = create_local_accept_sock(path,
+			&noproto)) == -1)
+			return -1;
+		if(chmod(path, (mode_t)(S_IRUSR | S_IWUSR)) == -1) {
+			VERBOSITY(3, (LOG_INFO, "cannot chmod socket-handoff "
+				"%s: %s", path, strerror(errno)));
+		}
+		if(fcntl(nsd->handoff_fd, F_SETFD, FD_CLOEXEC) == -1) {
+			log_msg(LOG_ERR, "fcntl(..., O_CLOEXEC) failed for "
+				"socket-handoff: %s", strerror(errno));
+		}
+	}
+	return 0;
+#else
+	log_msg(LOG_ERR, "socket-handoff: no unix sockets on this system");
+	return -1;
+#endif /* HAVE_SYS_UN_H */
+}
+
+int
+server_handoff_send_fd(int s, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	char c = 0;
+
+	if(fd == -1)
+		return 0;
+	iov.iov_base = &c;
+	iov.iov_len = 1;
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	while(sendmsg(s, &msg, 0) == -1) {
+		if(errno == EINTR)
+			continue;
+		log_msg(LOG_ERR, "socket-handoff: sendmsg: %s",
+			strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+static size_t
+handoff_send_sockets(int s, struct nsd_socket* sockets, size_t n)
+{
+	size_t i, num = 0;
+	for(i = 0; i < n; i++)
+		num += server_handoff_send_fd(s, sockets[i].s);
+	return num;
+}
+
+/* a new nsd connected to the socket-handoff, pass it the listening sockets */
+static void
+server_handoff_accept(netio_type *ATTR_UNUSED(netio),
+	netio_handler_type *handler, netio_event_types_type event_types)
+{
+	struct nsd *nsd = (struct nsd*)handler->user_data;
+	size_t num = 0;
+	int s;
+
+	if(!(event_types & NETIO_EVENT_READ))
+		return;
+	if((s = accept(handler->fd, NULL, NULL)) == -1) {
+		if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+			log_msg(LOG_ERR, "socket-handoff: accept: %s",
+				strerror(errno));
+		return;
+	}
+	/* the accepted socket can inherit nonblocking from the listener */
+	if(fcntl(s, F_SETFL, 0) == -1) {
+		log_msg(LOG_ERR, "socket-handoff: fcntl: %s", strerror(errno));
+		close(s);
+		return;
+	}
+	num += handoff_send_sockets(s, nsd->udp, nsd->ifs);
+	num += handoff_send_sockets(s, nsd->tcp, nsd->ifs);
+	num += handoff_send_sockets(s, nsd->verify_udp, nsd->verify_ifs);
+	num += handoff_send_sockets(s, nsd->verify_tcp, nsd->verify_ifs);
+	if(nsd->rc)
+		num += daemon_remote_handoff(nsd->rc, s);
+	close(s);
+	/* the pidfile is that of the new nsd now */
+	nsd->handoff_done = 1;
+	log_msg(LOG_NOTICE, "socket-handoff: passed %d sockets to a new nsd",
+		(int)num);
+}
+
 static int
 open_udp_socket(struct nsd *nsd, struct nsd_socket *sock, int *reuseport_works)
 {
 	int rcv = 1*1024*1024, snd = 1*1024*1024;
 
+	if(-1 != (sock->s = server_handoff_take(
+		(struct sockaddr*)&sock->addr.ai_addr, sock->addr.ai_socktype)))
+	{
+		/* passed by the old nsd, it has the socket options */
+		set_cloexec(sock);
+		return 1;
+	}
+
 	if(-1 == (sock->s = socket(
 		sock->addr.ai_family, sock->addr.ai_socktype, 0)))
 	{
@@ -1283,6 +1922,10 @@ open_udp_socket(struct nsd *nsd, struct nsd_socket *sock, int *reuseport_works)
 		snd = nsd->options->send_buffer_size;
 	if(set_sndbuf(sock, snd) == -1)
 		return -1;
+	if(nsd->options->busy_poll > 0)
+		set_busy_poll(sock, nsd->options->busy_poll);
+	if(nsd->options->udp_queue_statistics)
+		set_udp_queue_stats(sock);
 #ifdef INET6
 	if(sock->addr.ai_family == AF_INET6) {
 		if(set_ipv6_v6only(sock) == -1 ||
@@ -1330,6 +1973,14 @@ open_tcp_socket(struct nsd *nsd, struct nsd_socket *sock, int *reuseport_works)
 
 	(void)reuseport_works;
 
+	if(-1 != (sock->s = server_handoff_take(
+		(struct sockaddr*)&sock->addr.ai_addr, sock->addr.ai_socktype)))
+	{
+		/* passed by the old nsd, it is bound and listening */
+		set_cloexec(sock);
+		return 1;
+	}
+
 	if(-1 == (sock->s = socket(
 		sock->addr.ai_family, sock->addr.ai_socktype, 0)))
 	{
@@ -1405,6 +2056,9 @@ server_init(struct nsd *nsd)
 	size_t i;
 	int reuseport = 1; /* Determine if REUSEPORT works. */
 
+	/* sockets of an old nsd, that are used instead of new ones */
+	server_handoff_receive(nsd);
+
 	/* open server interface ports */
 	for(i = 0; i < nsd->ifs; i++) {
 		if(open_udp_socket(nsd, &nsd->udp[i], &reuseport) == -1 ||
@@ -1447,6 +2101,23 @@ server_init(struct nsd *nsd)
 			}
 		}
 
+		if(strcmp(nsd->options->reuseport_steering, "no") != 0) {
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+			/* the program is for the group, it is attached to
+			 * the first socket of every interface */
+			for(i = 0; i < nsd->ifs; i++) {
+				if(nsd->udp[i].s != -1)
+					set_reuseport_steering(nsd,
+						&nsd->udp[i], nsd->reuseport);
+				if(nsd->tcp[i].s != -1)
+					set_reuseport_steering(nsd,
+						&nsd->tcp[i], nsd->reuseport);
+			}
+#else
+			log_msg(LOG_WARNING, "reuseport-steering is not "
+				"supported on this system");
+#endif
+		}
 		nsd->ifs = ifs;
 	} else {
 		nsd->reuseport = 0;
@@ -1497,9 +2168,22 @@ server_prepare(struct nsd *nsd)
 		nsd->options->rrl_whitelist_ratelimit,
 		nsd->options->rrl_slip,
 		nsd->options->rrl_ipv4_prefix_length,
-		nsd->options->rrl_ipv6_prefix_length);
+		nsd->options->rrl_ipv6_prefix_length,
+		nsd->options->rrl_shared_buckets);
 #endif /* RATELIMIT */
 
+	/* The zone data is read by the servers on all the sockets, spread
+	 * it over the nodes. The reload processes inherit the policy. */
+	if(nsd->options->numa_interleave) {
+		int nodes = set_numa_interleave(1);
+		if(nodes == -1)
+			log_msg(LOG_WARNING, "numa-interleave: could not set "
+				"memory policy: %s", strerror(errno));
+		else if(nodes > 0)
+			VERBOSITY(1, (LOG_INFO, "numa-interleave: zone data "
+				"spread over %d nodes", nodes));
+	}
+
 	/* Open the database... */
 	if ((nsd->db = namedb_open(nsd->options)) == NULL) {
 		log_msg(LOG_ERR, "unable to open the database: %s", strerror(errno));
@@ -1520,8 +2204,14 @@ server_prepare(struct nsd *nsd)
 	 * for all zones */
 	namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
 	zonestatid_tree_set(nsd);
+#ifdef RATELIMIT
+	rrl_zones_set_limits(nsd->db);
+#endif
+#if !defined(USE_MMAP_ALLOC) && !defined(USE_SLAB_ALLOC)
+	if(nsd->options->use_huge_pages)
+		huge_alloc_report();
+#endif
 
-	compression_table_capacity = 0;
 	initialize_dname_compression_tables(nsd);
 
 #ifdef	BIND8_STATS
@@ -1756,6 +2446,8 @@ server_start_xfrd(struct nsd *nsd, int del_db, int reload_active)
 			set_cpu_affinity(nsd->xfrd_cpuset);
 		}
 #endif
+		if(nsd->options->numa_interleave)
+			(void)set_numa_interleave(0);
 
 		xfrd_init(sockets[1], nsd, del_db, reload_active, pid);
 		/* ENOTREACH */
@@ -1801,6 +2493,7 @@ add_all_soa_to_task(struct nsd* nsd, struct udb_base* taskudb)
 	udb_ptr_init(&task_last, taskudb);
 	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n)) {
 		task_new_soainfo(taskudb, &task_last, (zone_type*)n->elem, 0);
+		task_new_zone_mem(taskudb, &task_last, (zone_type*)n->elem);
 	}
 	udb_ptr_unlink(&task_last, taskudb);
 }
@@ -1828,8 +2521,9 @@ server_send_soa_xfrd(struct nsd* nsd, int shortsoa)
 			server_close_all_sockets(nsd->udp, nsd->ifs);
 			server_close_all_sockets(nsd->tcp, nsd->ifs);
 			daemon_remote_close(nsd->rc);
-			/* Unlink it if possible... */
-			unlinkpid(nsd->pidfile, nsd->username);
+			/* Unlink it if possible, unless a new nsd took over */
+			if(!nsd->handoff_done)
+				unlinkpid(nsd->pidfile, nsd->username);
 			unlink(nsd->task[0]->fname);
 			unlink(nsd->task[1]->fname);
 #ifdef USE_ZONE_STATS
@@ -2177,6 +2871,116 @@ server_tls_ctx_setup(char* key, char* pem, char* verifypem)
 	return ctx;
 }
 
+/* the shared session ticket keys, for the ticket key callback */
+static struct tls_ticket_keys* tls_ticket_keys_shared = NULL;
+
+/* make the TLS session tickets with the shared keys */
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+static int
+tls_ticket_key_cb(SSL* ATTR_UNUSED(ssl), unsigned char* key_name,
+	unsigned char* iv, EVP_CIPHER_CTX* evp_ctx, EVP_MAC_CTX* hmac_ctx,
+	int enc)
+#else
+static int
+tls_ticket_key_cb(SSL* ATTR_UNUSED(ssl), unsigned char* key_name,
+	unsigned char* iv, EVP_CIPHER_CTX* evp_ctx, HMAC_CTX* hmac_ctx,
+	int enc)
+#endif
+{
+	struct tls_ticket_keys* keys = tls_ticket_keys_shared;
+	uint32_t current = keys->current % TLS_TICKET_KEYS;
+	uint32_t previous = (current + TLS_TICKET_KEYS - 1) % TLS_TICKET_KEYS;
+	struct tls_ticket_key* key;
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+	OSSL_PARAM params[3];
+#endif
+
+	if(enc) {
+		key = &keys->key[current];
+		if(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+			return -1;
+		memcpy(key_name, key->name, sizeof(key->name));
+		if(EVP_EncryptInit_ex(evp_ctx, EVP_aes_256_cbc(), NULL,
+			key->aes, iv) != 1)
+			return -1;
+	} else {
+		if(memcmp(key_name, keys->key[current].name,
+			sizeof(keys->key[current].name)) == 0)
+			key = &keys->key[current];
+		else if(memcmp(key_name, keys->key[previous].name,
+			sizeof(keys->key[previous].name)) == 0)
+			key = &keys->key[previous];
+		else	return 0; /* unknown key, do a full handshake */
+		if(EVP_DecryptInit_ex(evp_ctx, EVP_aes_256_cbc(), NULL,
+			key->aes, iv) != 1)
+			return -1;
+	}
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+		key->hmac, sizeof(key->hmac));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+		"sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if(EVP_MAC_CTX_set_params(hmac_ctx, params) != 1)
+		return -1;
+#else
+	if(HMAC_Init_ex(hmac_ctx, key->hmac, sizeof(key->hmac), EVP_sha256(),
+		NULL) != 1)
+		return -1;
+#endif
+	/* a ticket made with the previous key is renewed */
+	if(!enc && key != &keys->key[current])
+		return 2;
+	return 1;
+}
+
+/* allocate the shared session ticket keys, with random keys in all slots */
+static struct tls_ticket_keys*
+server_tls_ticket_keys_alloc(void)
+{
+	struct tls_ticket_keys* keys;
+#ifdef HAVE_MMAP
+	keys = (struct tls_ticket_keys*)mmap(NULL, sizeof(*keys),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(keys == MAP_FAILED) {
+		log_msg(LOG_ERR, "could not mmap session ticket keys: %s",
+			strerror(errno));
+		return NULL;
+	}
+#else
+	/* without shared memory the keys do not rotate in the servers */
+	keys = (struct tls_ticket_keys*)xalloc(sizeof(*keys));
+#endif
+	if(RAND_bytes((unsigned char*)keys->key, sizeof(keys->key)) != 1) {
+		log_crypto_err("could not RAND_bytes for session ticket keys");
+#ifdef HAVE_MMAP
+		munmap(keys, sizeof(*keys));
+#else
+		free(keys);
+#endif
+		return NULL;
+	}
+	keys->current = 0;
+	return keys;
+}
+
+void
+server_tls_ticket_keys_rotate(struct nsd* nsd)
+{
+	struct tls_ticket_keys* keys = nsd->tls_ticket_keys;
+	uint32_t next;
+	if(!keys)
+		return;
+	next = (keys->current + 1) % TLS_TICKET_KEYS;
+	if(RAND_bytes((unsigned char*)&keys->key[next],
+		sizeof(keys->key[next])) != 1) {
+		log_crypto_err("could not RAND_bytes for session ticket key");
+		return;
+	}
+	keys->current = next;
+	VERBOSITY(3, (LOG_INFO, "rotated the TLS session ticket key"));
+}
+
 SSL_CTX*
 server_tls_ctx_create(struct nsd* nsd, char* verifypem, char* ocspfile)
 {
@@ -2215,6 +3019,42 @@ server_tls_ctx_create(struct nsd* nsd, char* verifypem, char* ocspfile)
 			}
 		}
 	}
+	if(nsd->options->tls_async) {
+#ifdef SSL_MODE_ASYNC
+		/* with an async engine, the handshake pauses with
+		 * SSL_ERROR_WANT_ASYNC until the crypto result is ready */
+		(void)SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+#else
+		log_msg(LOG_WARNING, "tls-async: not supported by OpenSSL");
+#endif
+	}
+	if(nsd->options->tls_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+		/* OpenSSL passes the keys to the kernel after the handshake,
+		 * if the kernel supports the cipher */
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		log_msg(LOG_WARNING, "tls-ktls: not supported by OpenSSL");
+#endif
+	}
+	if(nsd->options->tls_session_ticket_rotate > 0) {
+		if(!nsd->tls_ticket_keys &&
+			!(nsd->tls_ticket_keys = server_tls_ticket_keys_alloc())) {
+			SSL_CTX_free(ctx);
+			return NULL;
+		}
+		tls_ticket_keys_shared = nsd->tls_ticket_keys;
+#ifdef HAVE_SSL_CTX_SET_TLSEXT_TICKET_KEY_EVP_CB
+		if(!SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx,
+			tls_ticket_key_cb)) {
+#else
+		if(!SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_ticket_key_cb)) {
+#endif
+			log_crypto_err("could not set session ticket key callback");
+			SSL_CTX_free(ctx);
+			return NULL;
+		}
+	}
 	return ctx;
 }
 
@@ -2366,6 +3206,17 @@ reload_process_xfr_tasks(struct nsd* nsd, int cmdsocket, udb_ptr* xfrs2process)
 		}
 	}
 	/* xfrs2process and next are already unlinked (because they are null) */
+
+	/* build the wire format of the changed rrsets, that walks the zone,
+	 * once for a zone that had more than one transfer */
+	if(xfrs_processed) {
+		zone_type* zone;
+		for(zone = nsd->db->updated_first; zone;
+			zone = zone->updated_next) {
+			if(zone->is_updated)
+				zone_wire_build(nsd->db, zone);
+		}
+	}
 	return xfrs_processed;
 }
 
@@ -2444,6 +3295,74 @@ static void server_reload_handle_quit_sync_ack(int cmdsocket, short event,
 	event_base_loopexit(cb_data->base, NULL);
 }
 
+/* log the time of the reload phases, and the zones that took longest */
+static void
+reload_stats_log(struct reload_stats* rs)
+{
+	uint32_t i;
+	VERBOSITY(2, (LOG_INFO, "reload: %llu usec, tasks %llu fork %llu "
+		"xfr %llu verify %llu compact %llu children %llu quit_sync "
+		"%llu, %u zones",
+		(unsigned long long)rs->total, (unsigned long long)rs->tasks,
+		(unsigned long long)rs->fork, (unsigned long long)rs->xfr,
+		(unsigned long long)rs->verify,
+		(unsigned long long)rs->compact,
+		(unsigned long long)rs->children,
+		(unsigned long long)rs->quit_sync, (unsigned)rs->num_zones));
+	for(i=0; i<rs->num_slow; i++) {
+		VERBOSITY(3, (LOG_INFO, "reload: zone %s parse %llu apply %llu "
+			"prehash %llu usec", rs->slow[i].name,
+			(unsigned long long)rs->slow[i].parse,
+			(unsigned long long)rs->slow[i].apply,
+			(unsigned long long)rs->slow[i].prehash));
+	}
+}
+
+/* the least unused memory in the database that reload-compact copies for */
+#define RELOAD_COMPACT_MIN (1024*1024)
+
+/*
+ * Copy the database into new memory when the changes of the transfers
+ * left more of it unused than reload-compact allows. The old memory is
+ * shared with the old server processes, that keep it until they quit; in
+ * this process it is freed, and the new server processes only have the
+ * copy.
+ */
+static void
+reload_compact(struct nsd* nsd)
+{
+	struct namedb* db;
+	size_t mem = region_get_mem(nsd->db->region);
+	size_t unused = region_get_mem_unused(nsd->db->region) +
+		region_get_recycle_size(nsd->db->region);
+	size_t newmem;
+	if(nsd->options->reload_compact == 0 || unused < RELOAD_COMPACT_MIN ||
+		unused*100 < mem*(size_t)nsd->options->reload_compact)
+		return;
+	db = namedb_copy(nsd->db, nsd->options);
+	if(!db) {
+		log_msg(LOG_ERR, "reload: could not copy the database");
+		return;
+	}
+	newmem = region_get_mem(db->region);
+	/* the compression table is freed with the old region */
+	namedb_close(nsd->db);
+	nsd->db = db;
+	nsd->next_zone_to_verify = NULL;
+	initialize_dname_compression_tables(nsd);
+#if defined(HAVE_MALLOC_H) && defined(HAVE_MALLOC_TRIM)
+	(void)malloc_trim(0);
+#endif
+	VERBOSITY(1, (LOG_INFO, "reload: copied the database, %lu bytes "
+		"with %lu unused into %lu bytes", (unsigned long)mem,
+		(unsigned long)unused, (unsigned long)newmem));
+#ifdef BIND8_STATS
+	if(mem > newmem)
+		nsd->st->db_compact_bytes += mem - newmem;
+	nsd->st->db_mem = newmem;
+#endif
+}
+
 /*
  * Reload the database, stop parent, re-fork children and continue.
  * as server_main.
@@ -2455,7 +3374,6 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	pid_t mypid;
 	sig_atomic_t cmd;
 	struct sigaction old_sigchld, ign_sigchld;
-	struct radnode* node;
 	zone_type* zone;
 	enum soainfo_hint hint;
 	struct quit_sync_event_data cb_data;
@@ -2465,6 +3383,14 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	/* For swapping filedescriptors from the serve childs to the xfrd
 	 * and/or the dnstap collector */
 	int *swap_fd_send;
+	struct reload_stats* rs = nsd->reload_stats;
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+	/* page faults of the reload, most are copy-on-write faults of the
+	 * database pages shared with the old server processes */
+	struct rusage ru_start, ru_end;
+	if(getrusage(RUSAGE_SELF, &ru_start) != 0)
+		memset(&ru_start, 0, sizeof(ru_start));
+#endif
 
 	/* ignore SIGCHLD from the previous server_main that used this pid */
 	memset(&ign_sigchld, 0, sizeof(ign_sigchld));
@@ -2478,7 +3404,15 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 #endif
 
 	/* see what tasks we got from xfrd */
+	NSD_PROBE1(reload__phase, "start");
 	xfrs_processed = reload_process_xfr_tasks(nsd, cmdsocket, xfrs2process);
+	NSD_PROBE1(reload__phase, "tasks");
+	if(rs)
+		rs->xfr = reload_stats_elapsed(&rs->stamp);
+#ifdef RATELIMIT
+	/* the zone options and ratelimits can have changed with the tasks */
+	rrl_zones_set_limits(nsd->db);
+#endif
 
 #ifndef NDEBUG
 	if(nsd_debug_level >= 1)
@@ -2501,6 +3435,19 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 #endif
 
 	if(nsd->options->verify_enable) {
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+		struct rusage ru_verify;
+		if(getrusage(RUSAGE_SELF, &ru_verify) != 0)
+			memset(&ru_verify, 0, sizeof(ru_verify));
+#endif
+#if defined(HAVE_MALLOC_H) && defined(HAVE_MALLOC_TRIM)
+		/* The process is kept while the verifiers run, and the old
+		 * server processes still serve. Only the pages that the
+		 * transfers changed are copies, and are the memory of the
+		 * new zones. Give the heap memory that the transfers used
+		 * and freed back, so that it is not held as well. */
+		(void)malloc_trim(0);
+#endif
 #ifdef RATELIMIT
 		/* allocate resources for rate limiting. use a slot that is guaranteed
 		   not mapped to a file so no persistent data is overwritten */
@@ -2508,17 +3455,32 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 #endif
 
 		/* spin-up server and execute verifiers for each zone */
+		if(rs)
+			(void)reload_stats_elapsed(&rs->stamp);
 		server_verify(nsd, cmdsocket, &old_sigchld);
+		if(rs)
+			rs->verify = reload_stats_elapsed(&rs->stamp);
 #ifdef RATELIMIT
 		/* deallocate rate limiting resources */
 		rrl_deinit(nsd->child_count + 1);
 #endif
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+		if(getrusage(RUSAGE_SELF, &ru_end) == 0 &&
+			ru_verify.ru_minflt != 0) {
+			VERBOSITY(2, (LOG_INFO, "reload: verify %ld page faults, "
+				"max resident %ld kb",
+				(long)(ru_end.ru_minflt - ru_verify.ru_minflt),
+				(long)ru_end.ru_maxrss));
+		}
+#endif
+		NSD_PROBE1(reload__phase, "verified");
 	}
 
-	if(xfrs_processed) for( node = radix_first(nsd->db->zonetree)
-	                      ; node != NULL; node = radix_next(node)) {
+	/* only the zones that the transfers updated or skipped have a
+	 * changed SOA for xfrd, the others are not walked */
+	if(xfrs_processed) for( zone = nsd->db->updated_first
+	                      ; zone != NULL; zone = zone->updated_next) {
 
-		zone = (zone_type *)node->elem;
 		if(zone->is_updated) {
 			if(zone->is_bad) {
 				nsd->mode = NSD_RELOAD_FAILED;
@@ -2531,6 +3493,9 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 			   by failed update check in xfrd */
 			task_new_soainfo(nsd->task[nsd->mytask], last_task,
 			                 zone, hint);
+			if(hint == soainfo_ok)
+				task_new_zone_mem(nsd->task[nsd->mytask],
+					last_task, zone);
 		} else if(zone->is_skipped) {
 			/* corrupt or inconsistent update without preceding
 			   update(s), communicate soainfo_gone */
@@ -2540,10 +3505,28 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		zone->is_updated = 0;
 		zone->is_skipped = 0;
 	}
+	nsd->db->updated_first = NULL;
+	nsd->db->updated_last = NULL;
 
 	if(nsd->mode == NSD_RELOAD_FAILED) {
 		exit(NSD_RELOAD_FAILED);
 	}
+	if(rs)
+		(void)reload_stats_elapsed(&rs->stamp);
+	reload_compact(nsd);
+	if(rs)
+		rs->compact = reload_stats_elapsed(&rs->stamp);
+	NSD_PROBE1(reload__phase, "compact");
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+	if(getrusage(RUSAGE_SELF, &ru_end) == 0) {
+		VERBOSITY(2, (LOG_INFO, "reload: %ld page faults",
+			(long)(ru_end.ru_minflt - ru_start.ru_minflt)));
+#ifdef BIND8_STATS
+		nsd->st->db_reload_faults = (uint64_t)(ru_end.ru_minflt -
+			ru_start.ru_minflt);
+#endif
+	}
+#endif
 
 	/* listen for the signals of failed children again */
 	sigaction(SIGCHLD, &old_sigchld, NULL);
@@ -2562,11 +3545,16 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	nsd->serve2xfrd_fd_send = nsd->serve2xfrd_fd_swap;
 	nsd->serve2xfrd_fd_swap = swap_fd_send;
 	/* Start new child processes */
+	if(rs)
+		(void)reload_stats_elapsed(&rs->stamp);
 	if (server_start_children(nsd, server_region, netio, &nsd->
 		xfrd_listener->fd) != 0) {
 		send_children_quit(nsd);
 		exit(1);
 	}
+	NSD_PROBE1(reload__phase, "children");
+	if(rs)
+		rs->children = reload_stats_elapsed(&rs->stamp);
 
 	/* if the old-main has quit, we must quit too, poll the fd for cmds */
 	if(block_read(nsd, cmdsocket, &cmd, sizeof(cmd), 0) == sizeof(cmd)) {
@@ -2629,6 +3617,13 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		exit(1);
 	}
 	assert(cmd == NSD_RELOAD);
+	if(rs) {
+		rs->quit_sync = reload_stats_elapsed(&rs->stamp);
+		rs->total = reload_stats_elapsed(&rs->start);
+		rs->done = (uint64_t)time(NULL);
+		reload_stats_log(rs);
+		task_new_reload_stats(nsd->task[nsd->mytask], last_task, rs);
+	}
 	udb_ptr_unlink(last_task, nsd->task[nsd->mytask]);
 	task_process_sync(nsd->task[nsd->mytask]);
 #ifdef USE_ZONE_STATS
@@ -2651,6 +3646,7 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	/* try to reopen file */
 	if (nsd->file_rotation_ok)
 		log_reopen(nsd->log_filename, 1);
+	NSD_PROBE1(reload__phase, "done");
 	/* exit reload, continue as new server_main */
 }
 
@@ -2695,6 +3691,108 @@ server_signal_mode(struct nsd *nsd)
 	return NSD_RUN;
 }
 
+#ifdef BIND8_STATS
+/* seconds between the looks at the load for server-count-min */
+#define SERVER_SCALE_INTERVAL 10
+
+/* spread the reuseport packets over the running servers */
+static void
+server_steer_children(struct nsd* nsd)
+{
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_LINUX_FILTER_H)
+	size_t i;
+	if(!nsd->reuseport)
+		return;
+	/* the program is for the group, on the first socket of it */
+	for(i = 0; i < nsd->ifs / nsd->reuseport; i++) {
+		if(nsd->udp[i].s != -1)
+			set_reuseport_steering(nsd, &nsd->udp[i],
+				nsd->active_children);
+		if(nsd->tcp[i].s != -1)
+			set_reuseport_steering(nsd, &nsd->tcp[i],
+				nsd->active_children);
+	}
+#else
+	(void)nsd;
+#endif
+}
+
+/*
+ * Start or retire a server for server-count-min, by the queries per second
+ * of the running servers in the shared statistics. One server is added or
+ * retired at a time, the last one in the list.
+ */
+static void
+server_scale_children(struct nsd* nsd, region_type* region,
+	netio_type* netio, int* xfrd_sock_p)
+{
+	static time_t last_time = 0;
+	static stc_type last_count = 0;
+	struct nsdst* st = nsd->stats_per_child[nsd->stat_current];
+	uint64_t load = (uint64_t)nsd->options->server_count_load;
+	size_t i, n = nsd->active_children;
+	struct nsd_child* child;
+	stc_type count = 0;
+	time_t now = time(NULL);
+	uint64_t qps;
+
+	if(last_time != 0 && now >= last_time &&
+		now - last_time < SERVER_SCALE_INTERVAL)
+		return;
+	for(i = 0; i < nsd->child_count; i++)
+		count += st[i].qudp + st[i].qudp6 + st[i].ctcp +
+			st[i].ctcp6 + st[i].ctls + st[i].ctls6;
+	if(last_time == 0 || now <= last_time || count < last_count) {
+		/* the first look, or the counts of new servers after a
+		 * reload */
+		last_time = now;
+		last_count = count;
+		return;
+	}
+	qps = (uint64_t)(count - last_count) / (uint64_t)(now - last_time);
+	last_time = now;
+	last_count = count;
+
+	if(qps > load * n && n < nsd->child_count) {
+		child = &nsd->children[n];
+		if(child->pid > 0)
+			return; /* the retired one has not exited yet */
+		child->need_to_exit = 0;
+		child->has_exited = 0;
+		child->need_to_send_QUIT = 0;
+		child->need_to_send_STATS = 0;
+		if(child->handler)
+			child->handler->event_types = NETIO_EVENT_READ;
+		nsd->active_children = n+1;
+		if(restart_child_servers(nsd, region, netio, xfrd_sock_p) != 0)
+			log_msg(LOG_ERR, "server-count-min: could not start "
+				"server %d", (int)n+1);
+		server_steer_children(nsd);
+		VERBOSITY(1, (LOG_INFO, "server-count-min: %d servers, "
+			"%llu queries per second", (int)nsd->active_children,
+			(unsigned long long)qps));
+	} else if(n > (size_t)nsd->options->server_count_min &&
+		qps*2 < load * (n-1)) {
+		/* steer the packets away before the server quits */
+		nsd->active_children = n-1;
+		server_steer_children(nsd);
+		child = &nsd->children[n-1];
+		child->need_to_exit = 1;
+		if(child->pid > 0 && child->child_fd != -1) {
+			child->need_to_send_QUIT = 1;
+			child->handler->event_types |= NETIO_EVENT_WRITE;
+		} else if(child->child_fd == -1) {
+			child->has_exited = 1;
+		}
+		VERBOSITY(1, (LOG_INFO, "server-count-min: %d servers, "
+			"%llu queries per second", (int)nsd->active_children,
+			(unsigned long long)qps));
+	}
+	if(nsd->stat_active_children)
+		*nsd->stat_active_children = (uint32_t)nsd->active_children;
+}
+#endif /* BIND8_STATS */
+
 /*
  * The main server simply waits for signals and child processes to
  * terminate.  Child processes are restarted as necessary.
@@ -2705,6 +3803,7 @@ server_main(struct nsd *nsd)
 	region_type *server_region = region_create(xalloc, free);
 	netio_type *netio = netio_create(server_region);
 	netio_handler_type reload_listener;
+	netio_handler_type handoff_listener;
 	int reload_sockets[2] = {-1, -1};
 	/* pointer to the xfr tasks that will be processed in a second pass */
 	udb_ptr xfrs2process;
@@ -2715,6 +3814,8 @@ server_main(struct nsd *nsd)
 	pid_t child_pid;
 	pid_t reload_pid = -1;
 	sig_atomic_t mode;
+	/* timing of the reloads, allocated at the first reload */
+	struct reload_stats* reload_stats = NULL;
 
 	/* Ensure we are the main process */
 	assert(nsd->server_kind == NSD_SERVER_MAIN);
@@ -2722,6 +3823,16 @@ server_main(struct nsd *nsd)
 	/* Add listener for the XFRD process */
 	netio_add_handler(netio, nsd->xfrd_listener);
 
+	/* Add listener for a new nsd to take over the sockets */
+	if(nsd->handoff_fd != -1) {
+		handoff_listener.fd = nsd->handoff_fd;
+		handoff_listener.timeout = NULL;
+		handoff_listener.user_data = nsd;
+		handoff_listener.event_types = NETIO_EVENT_READ;
+		handoff_listener.event_handler = server_handoff_accept;
+		netio_add_handler(netio, &handoff_listener);
+	}
+
 #ifdef BIND8_STATS
 	nsd->st = &nsd->stat_map[0];
 	nsd->st->db_disk = 0;
@@ -2829,6 +3940,15 @@ server_main(struct nsd *nsd)
 						dt_collector_start(nsd->dt_collector, nsd);
 						nsd->mode = NSD_RELOAD_REQ;
 					}
+#endif
+#ifdef BIND8_STATS
+				} else if(child_pid == nsd->metrics_pid) {
+					log_msg(LOG_WARNING,
+					       "metrics %d terminated with status %d",
+					       (int) child_pid, status);
+					/* start it again, it only reads the
+					 * shared statistics */
+					nsd->metrics_pid = metrics_start(nsd);
 #endif
 				} else if(status != 0) {
 					/* check for status, because we get
@@ -2866,6 +3986,13 @@ server_main(struct nsd *nsd)
 					&nsd->xfrd_listener->fd);
 				nsd->restart_children = 0;
 			}
+#ifdef BIND8_STATS
+			/* not during a reload, that forks the servers again */
+			if(nsd->options->server_count_min > 0 &&
+				reload_pid == -1)
+				server_scale_children(nsd, server_region, netio,
+					&nsd->xfrd_listener->fd);
+#endif
 			if(nsd->reload_failed) {
 				sig_atomic_t cmd = NSD_RELOAD_FAILED;
 				pid_t mypid;
@@ -2943,21 +4070,33 @@ server_main(struct nsd *nsd)
 			task_remap(nsd->task[nsd->mytask]);
 			udb_ptr_init(&xfrs2process, nsd->task[nsd->mytask]);
 			udb_ptr_init(&last_task   , nsd->task[nsd->mytask]);
+			if(!reload_stats)
+				reload_stats = (struct reload_stats*)
+					region_alloc(nsd->region,
+					sizeof(*reload_stats));
+			reload_stats_start(reload_stats);
+			nsd->reload_stats = reload_stats;
 			reload_process_non_xfr_tasks(nsd, &xfrs2process
 			                                , &last_task);
+			reload_stats->tasks = reload_stats_elapsed(
+				&reload_stats->stamp);
 			/* Do actual reload */
 			reload_pid = fork();
 			switch (reload_pid) {
 			case -1:
 				log_msg(LOG_ERR, "fork failed: %s", strerror(errno));
+				nsd->reload_stats = NULL;
 				break;
 			default:
 				/* PARENT */
 				close(reload_sockets[0]);
+				reload_stats->fork = reload_stats_elapsed(
+					&reload_stats->stamp);
 				server_reload(nsd, server_region, netio
 				                 , reload_sockets[1]
 				                 , &xfrs2process
 						 , &last_task);
+				nsd->reload_stats = NULL;
 				DEBUG(DEBUG_IPC,2, (LOG_INFO, "Reload exited to become new main"));
 				close(reload_sockets[1]);
 				DEBUG(DEBUG_IPC,2, (LOG_INFO, "Reload closed"));
@@ -2975,6 +4114,7 @@ server_main(struct nsd *nsd)
 				/* server_main keep running until NSD_QUIT_SYNC
 				 * received from reload. */
 				close(reload_sockets[1]);
+				nsd->reload_stats = NULL;
 #ifdef HAVE_SETPROCTITLE
 				setproctitle("old-main");
 #endif
@@ -2988,6 +4128,11 @@ server_main(struct nsd *nsd)
 				reload_listener.event_handler = parent_handle_reload_command; /* listens to Quit */
 				netio_add_handler(netio, &reload_listener);
 				reload_pid = getppid();
+#ifdef BIND8_STATS
+				/* the metrics process stays with the main
+				 * process that does the reload */
+				nsd->metrics_pid = -1;
+#endif
 				break;
 			}
 			if(reload_pid == -1) {
@@ -3076,8 +4221,9 @@ server_main(struct nsd *nsd)
 	daemon_remote_close(nsd->rc);
 	send_children_quit_and_wait(nsd);
 
-	/* Unlink it if possible... */
-	unlinkpid(nsd->pidfile, nsd->username);
+	/* Unlink it if possible, unless a new nsd took over */
+	if(!nsd->handoff_done)
+		unlinkpid(nsd->pidfile, nsd->username);
 	unlink(nsd->task[0]->fname);
 	unlink(nsd->task[1]->fname);
 #ifdef USE_ZONE_STATS
@@ -3090,6 +4236,10 @@ server_main(struct nsd *nsd)
 #ifdef USE_DNSTAP
 	dt_collector_close(nsd->dt_collector, nsd);
 #endif
+#ifdef BIND8_STATS
+	if(nsd->metrics_pid != -1)
+		(void)kill(nsd->metrics_pid, SIGTERM);
+#endif
 
 	if(reload_listener.fd != -1) {
 		sig_atomic_t cmd = NSD_QUIT;
@@ -3135,23 +4285,41 @@ server_main(struct nsd *nsd)
 static query_state_type
 server_process_query(struct nsd *nsd, struct query *query, uint32_t *now_p)
 {
-	return query_process(query, nsd, now_p);
+	query_state_type state = query_process(query, nsd, now_p);
+#ifdef BIND8_STATS
+	if(nsd->topstat)
+		topstat_add(nsd->topstat, query);
+#endif
+	return state;
 }
 
 static query_state_type
 server_process_query_udp(struct nsd *nsd, struct query *query, uint32_t *now_p)
 {
+	query_state_type state = query_process(query, nsd, now_p);
+#ifdef BIND8_STATS
+	if(nsd->topstat)
+		topstat_add(nsd->topstat, query);
+#endif
 #ifdef RATELIMIT
-	if(query_process(query, nsd, now_p) != QUERY_DISCARDED) {
+	if(state != QUERY_DISCARDED) {
 		if(query->edns.cookie_status != COOKIE_VALID
 		&& query->edns.cookie_status != COOKIE_VALID_REUSE
-		&& rrl_process_query(query))
-			return rrl_slip(query);
-		else	return QUERY_PROCESSED;
+		&& rrl_process_query(query, nsd)) {
+			NSD_PROBE4(rrl__decision, PROBE_QNAME(query),
+				query->qtype, PROBE_ZONE(query->zone), 1);
+			state = rrl_slip(query);
+			QUERY_TRACE(query, QUERY_TRACE_RRL);
+			return state;
+		}
+		NSD_PROBE4(rrl__decision, PROBE_QNAME(query), query->qtype,
+			PROBE_ZONE(query->zone), 0);
+		QUERY_TRACE(query, QUERY_TRACE_RRL);
+		return QUERY_PROCESSED;
 	}
 	return QUERY_DISCARDED;
 #else
-	return query_process(query, nsd, now_p);
+	return state;
 #endif
 }
 
@@ -3184,7 +4352,7 @@ const char*
 nsd_event_method(void)
 {
 #ifdef USE_MINI_EVENT
-	return "select";
+	return event_get_method();
 #else
 	struct event_base* b = nsd_child_event_base();
 	const char* m;
@@ -3243,12 +4411,29 @@ add_udp_handler(
 		data->pp2_enabled = 1;
 	}
 
+#ifdef USE_IO_URING
+	if((sock->flags & NSD_USE_IO_URING)) {
+		if(uring_add_udp_socket(data))
+			return;
+		log_msg(LOG_WARNING, "nsd udp: io_uring not available, "
+			"using recvmmsg for the socket");
+	}
+#endif
+
 	memset(handler, 0, sizeof(*handler));
-	event_set(handler, sock->s, EV_PERSIST|EV_READ, handle_udp, data);
+	event_set(handler, sock->s, EV_PERSIST|EV_READ,
+		(udp_drain_udp?handle_udp_drain:udp_handler_for(data)), data);
 	if(event_base_set(nsd->event_base, handler) != 0)
 		log_msg(LOG_ERR, "nsd udp: event_base_set failed");
 	if(event_add(handler, NULL) != 0)
 		log_msg(LOG_ERR, "nsd udp: event_add failed");
+	if(busy_poll_udp)
+		busy_poll_udp[busy_poll_udp_count++] = data;
+	if(udp_drain_udp) {
+		udp_drain_fds[udp_drain_count].fd = sock->s;
+		udp_drain_fds[udp_drain_count].events = POLLIN;
+		udp_drain_udp[udp_drain_count++] = data;
+	}
 }
 
 void
@@ -3325,6 +4510,15 @@ static void server_verify(struct nsd *nsd, int cmdsocket,
 
 	nsd->server_region = region_create(xalloc, free);
 	nsd->event_base = nsd_child_event_base();
+	/* the zones have changed since the lookup caches were filled */
+	query_zone_cache_clear();
+	query_additional_cache_clear();
+	query_dname_cache_clear();
+	query_any_cache_clear();
+	query_nsec_cache_clear();
+#ifdef NSEC3
+	nsec3_next_closer_cache_clear();
+#endif
 
 	nsd->next_zone_to_verify = zone;
 	nsd->verifier_count = 0;
@@ -3343,6 +4537,7 @@ static void server_verify(struct nsd *nsd, int cmdsocket,
 		nsd->verifiers[i].nsd = nsd;
 		nsd->verifiers[i].zone = NULL;
 		nsd->verifiers[i].pid = -1;
+		nsd->verifiers[i].zone_feed.fd = -1;
 		nsd->verifiers[i].output_stream.fd = -1;
 		nsd->verifiers[i].output_stream.priority = LOG_INFO;
 		nsd->verifiers[i].error_stream.fd = -1;
@@ -3375,9 +4570,9 @@ static void server_verify(struct nsd *nsd, int cmdsocket,
 
 	memset(msgs, 0, sizeof(msgs));
 	for (int i = 0; i < NUM_RECV_PER_SELECT; i++) {
-		queries[i] = query_create(nsd->server_region,
-			compressed_dname_offsets,
-			compression_table_size, compressed_dnames);
+		queries[i] = query_create_with_buffer(nsd->server_region,
+			compression_table, compression_table_size,
+			udp_query_buffer_size(nsd));
 		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 		iovecs[i].iov_base = buffer_begin(queries[i]->packet);
 		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
@@ -3439,6 +4634,392 @@ fail_pipe:
 	nsd->verifiers = NULL;
 }
 
+#ifdef HAVE_CLOCK_GETTIME
+/*
+ * One round of the busy poll: receive on the UDP sockets without waiting
+ * for an event. Every few rounds the other events are handled, without
+ * waiting, and after busy-poll-idle msec without queries the server
+ * waits for an event, until the next query wakes it up.
+ * Returns 0 if the event loop failed.
+ */
+static int
+server_busy_poll(struct nsd* nsd, struct event_base* event_base)
+{
+	static struct timespec last;
+	static unsigned rounds = 0;
+	struct timespec now;
+	int flags = EVLOOP_NONBLOCK;
+	int idle = nsd->options->busy_poll_idle;
+	size_t i;
+
+	busy_poll_received = 0;
+	for(i = 0; i < busy_poll_udp_count; i++)
+		udp_handler_for(busy_poll_udp[i])(
+			busy_poll_udp[i]->socket->s, EV_READ, busy_poll_udp[i]);
+	if(busy_poll_received) {
+		struct timespec prev = last;
+		(void)clock_gettime(CLOCK_MONOTONIC, &last);
+		if(udp_batch_latency && prev.tv_sec != 0) {
+			uint64_t gap = (uint64_t)(last.tv_sec - prev.tv_sec)
+				*1000000 + (last.tv_nsec - prev.tv_nsec)/1000;
+			busy_poll_gap = (busy_poll_gap ?
+				(busy_poll_gap*7 + gap)/8 : gap);
+		}
+	}
+	if(++rounds % BUSY_POLL_EVENT_ROUNDS != 0)
+		return 1;
+
+	/* spin for a few arrival gaps, the next query is not going to
+	 * arrive soon after that */
+	if(udp_batch_latency && busy_poll_gap &&
+		(busy_poll_gap*4)/1000 < (uint64_t)idle)
+		idle = (int)((busy_poll_gap*4)/1000) + 1;
+	if(!busy_poll_received && clock_gettime(CLOCK_MONOTONIC, &now) == 0 &&
+		(now.tv_sec - last.tv_sec)*1000 +
+		(now.tv_nsec - last.tv_nsec)/1000000 >= idle)
+		flags = EVLOOP_ONCE; /* idle, sleep until there is work */
+	if(event_base_loop(event_base, flags) == -1) {
+		if (errno != EINTR) {
+			log_msg(LOG_ERR, "dispatch failed: %s", strerror(errno));
+			return 0;
+		}
+	}
+	if(flags == EVLOOP_ONCE)
+		(void)clock_gettime(CLOCK_MONOTONIC, &last);
+	return 1;
+}
+#endif /* HAVE_CLOCK_GETTIME */
+
+#ifdef BIND8_STATS
+/* answer the query of the key for the prewarm, from the loopback address
+ * of the family of the key */
+static void
+server_prewarm_query(struct nsd *nsd, query_type* q,
+	struct respcache_key* k, uint32_t* now)
+{
+	query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+	memset(&q->client_addr, 0, sizeof(q->client_addr));
+#ifdef INET6
+	if(k->family == AF_INET6) {
+		struct sockaddr_in6* sa6 = (struct sockaddr_in6*)&q->client_addr;
+		sa6->sin6_family = AF_INET6;
+		sa6->sin6_addr = in6addr_loopback;
+		q->client_addrlen = (socklen_t)sizeof(*sa6);
+	} else
+#endif
+	{
+		struct sockaddr_in* sa = (struct sockaddr_in*)&q->client_addr;
+		sa->sin_family = AF_INET;
+		sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		q->client_addrlen = (socklen_t)sizeof(*sa);
+	}
+	buffer_write_u16(q->packet, 0); /* id */
+	buffer_write_u16(q->packet, 0); /* flags */
+	buffer_write_u16(q->packet, 1); /* qdcount */
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, 0);
+	buffer_write_u16(q->packet, k->edns_size?1:0); /* arcount */
+	buffer_write(q->packet, k->qname, k->qname_len);
+	buffer_write_u16(q->packet, k->qtype);
+	buffer_write_u16(q->packet, k->qclass);
+	if(k->edns_size) {
+		/* OPT record, with the options that change the space that
+		 * the answer reserves for them, a client cookie and NSID */
+		buffer_write_u8(q->packet, 0);
+		buffer_write_u16(q->packet, TYPE_OPT);
+		buffer_write_u16(q->packet, k->edns_size);
+		buffer_write_u32(q->packet, k->dnssec_ok?DNSSEC_OK_MASK:0);
+		buffer_write_u16(q->packet, (k->cookie?OPT_HDR+8:0) +
+			(k->nsid?OPT_HDR:0));
+		if(k->cookie) {
+			buffer_write_u16(q->packet, COOKIE_CODE);
+			buffer_write_u16(q->packet, 8);
+			buffer_write_u32(q->packet, 0);
+			buffer_write_u32(q->packet, 0);
+		}
+		if(k->nsid) {
+			buffer_write_u16(q->packet, NSID_CODE);
+			buffer_write_u16(q->packet, 0);
+		}
+	}
+	buffer_flip(q->packet);
+	(void)query_process(q, nsd, now);
+}
+
+/*
+ * Answer the queries of the server process with the same number before
+ * the reload, so that the response cache and the lookup caches are filled
+ * before the queries of the clients come in. These are the query names
+ * with the most queries, from its heavy hitters, for type A and AAAA with
+ * EDNS, and the queries of its cached responses. The answers are made from
+ * the new database, so the zones that changed get new answers. They are
+ * not sent, and not counted in the statistics.
+ */
+static void
+server_prewarm(struct nsd *nsd, region_type* region)
+{
+	static const uint16_t types[] = { TYPE_A, TYPE_AAAA };
+	struct topstat* old;
+	struct topstat_entry e;
+	struct respcache_handover* handover;
+	struct respcache_key k;
+	struct nsdst scratch;
+	struct nsdst* st = nsd->st;
+	query_type* q;
+	uint32_t now = 0;
+	size_t i, t, count = 0;
+#ifdef USE_ZONE_STATS
+	unsigned zonestatsize = nsd->zonestatsizenow;
+#endif
+
+	if(!nsd->topstat_map && !nsd->respcache_handover_map)
+		return;
+	q = query_create(region, compression_table, compression_table_size);
+	memset(&scratch, 0, sizeof(scratch));
+	nsd->st = &scratch;
+#ifdef USE_ZONE_STATS
+	nsd->zonestatsizenow = 0;
+#endif
+	for(i = 0; nsd->topstat_map && i < TOPSTAT_SIZE; i++) {
+		old = &nsd->topstat_map[(nsd->stat_current?0:1)*
+			nsd->child_count + nsd->this_child->child_num];
+		/* the old server may still be running, copy the entry */
+		memcpy(&e, &old->kind[TOPSTAT_QNAME].top[i], sizeof(e));
+		if(e.count == 0 || e.len == 0 || e.len > MAXDOMAINLEN)
+			continue;
+		memset(&k, 0, sizeof(k));
+		k.qclass = CLASS_IN;
+		k.edns_size = 1232;
+		k.family = AF_INET;
+		memcpy(k.qname, e.key, e.len);
+		k.qname_len = (uint8_t)e.len;
+		for(t = 0; t < sizeof(types)/sizeof(types[0]); t++) {
+			k.qtype = types[t];
+			server_prewarm_query(nsd, q, &k, &now);
+			count++;
+		}
+	}
+	for(i = 0; nsd->respcache_handover_map &&
+		i < RESPCACHE_HANDOVER_SIZE; i++) {
+		handover = &nsd->respcache_handover_map[(nsd->stat_current?0:1)
+			*nsd->child_count + nsd->this_child->child_num];
+		memcpy(&k, &handover->key[i], sizeof(k));
+		if(k.qname_len == 0)
+			continue;
+		server_prewarm_query(nsd, q, &k, &now);
+		count++;
+	}
+	nsd->st = st;
+#ifdef USE_ZONE_STATS
+	nsd->zonestatsizenow = zonestatsize;
+#endif
+	query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+	VERBOSITY(3, (LOG_INFO, "server %d prewarmed with %d queries",
+		nsd->this_child->child_num + 1, (int)count));
+}
+#endif /* BIND8_STATS */
+
+#if defined(HAVE_MLOCK2) && defined(MLOCK_ONFAULT)
+/* seconds between the locks of the query names of top-statistics */
+#define MEMORY_LOCK_INTERVAL 60
+/* memory-lock: hot, the zone apexes and heavy hitters are locked */
+static int memory_lock_hot = 0;
+static time_t memory_lock_next = 0;
+
+/*
+ * Lock the pages of the range in memory. They are locked on fault, that
+ * is not a write, so that the pages stay shared with the other processes,
+ * and then read, to fault in the ones that were evicted.
+ */
+static void
+memory_lock_range(const void* p, size_t len)
+{
+	static uintptr_t pagesize = 0;
+	uintptr_t start, end, a;
+	if(!memory_lock_hot || !p || len == 0)
+		return;
+	if(pagesize == 0)
+		pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+	start = (uintptr_t)p & ~(pagesize-1);
+	end = ((uintptr_t)p + len + pagesize-1) & ~(pagesize-1);
+	if(mlock2((void*)start, end-start, MLOCK_ONFAULT) == -1) {
+		/* over the memlock resource limit, stop locking */
+		log_msg(LOG_WARNING, "memory-lock: %s, no more pages are "
+			"locked", strerror(errno));
+		memory_lock_hot = 0;
+		return;
+	}
+	for(a = start; a < end; a += pagesize)
+		(void)*(volatile const uint8_t*)a;
+}
+
+/* lock the domain, its RRs and the path to it in the name tree */
+static void
+memory_lock_domain(domain_type* domain)
+{
+	rrset_type* rrset;
+#ifdef USE_RADIX_TREE
+	struct radnode* n;
+	for(n = domain->rnode; n; n = n->parent) {
+		memory_lock_range(n, sizeof(*n));
+		if(n->array != &n->single)
+			memory_lock_range(n->array,
+				n->capacity*sizeof(struct radsel));
+	}
+	memory_lock_range(domain->dname, dname_total_size(domain->dname));
+#endif
+	memory_lock_range(domain, sizeof(*domain));
+	for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+		uint16_t i;
+		memory_lock_range(rrset, sizeof(*rrset));
+		memory_lock_range(rrset->rrs, rrset->rr_count*sizeof(rr_type));
+		for(i = 0; i < rrset->rr_count; i++) {
+			rr_type* rr = &rrset->rrs[i];
+			const uint8_t* end = (const uint8_t*)(rr->rdatas +
+				rr->rdata_count);
+			size_t j;
+			/* the atoms and their data are one allocation */
+			for(j = 0; j < rr->rdata_count; j++) {
+				const uint8_t* e;
+				if(rdata_atom_is_domain(rr->type, j))
+					continue;
+				e = rdata_atom_data(rr->rdatas[j]) +
+					rdata_atom_size(rr->rdatas[j]);
+				if(e > end)
+					end = e;
+			}
+			memory_lock_range(rr->rdatas,
+				end - (const uint8_t*)rr->rdatas);
+		}
+		if(rrset->wire)
+			memory_lock_range(rrset->wire, ((const uint32_t*)
+				rrset->wire)[rrset->rr_count]);
+	}
+}
+
+/* lock the query names of the heavy hitters */
+static void
+memory_lock_topstat(struct nsd* nsd, struct topstat* ts)
+{
+	region_type* region = region_create(xalloc, free);
+	struct topstat_entry e;
+	size_t i;
+	for(i = 0; i < TOPSTAT_SIZE && memory_lock_hot; i++) {
+		const dname_type* dname;
+		domain_type* match = NULL, *encloser = NULL;
+		/* the other server may be writing it, copy the entry */
+		memcpy(&e, &ts->kind[TOPSTAT_QNAME].top[i], sizeof(e));
+		if(e.count == 0 || e.len == 0 || e.len > MAXDOMAINLEN)
+			continue;
+		if(!(dname = dname_make(region, e.key, 1)))
+			continue;
+		if(domain_table_search(nsd->db->domains, dname, &match,
+			&encloser))
+			memory_lock_domain(match);
+		else if(encloser)
+			memory_lock_domain(encloser);
+		region_free_all(region);
+	}
+	region_destroy(region);
+}
+
+/*
+ * Lock the zone apexes, and the heavy hitters of the server process that
+ * this one replaces, from the heat map of top-statistics.
+ */
+static void
+memory_lock_start(struct nsd* nsd)
+{
+	struct radnode* n;
+	memory_lock_hot = 1;
+	for(n = radix_first(nsd->db->zonetree); n && memory_lock_hot;
+		n = radix_next(n)) {
+		zone_type* zone = (zone_type*)n->elem;
+		memory_lock_range(n, sizeof(*n));
+		memory_lock_range(zone, sizeof(*zone));
+		if(zone->apex)
+			memory_lock_domain(zone->apex);
+	}
+#ifdef BIND8_STATS
+	if(nsd->topstat_map)
+		memory_lock_topstat(nsd, &nsd->topstat_map[(nsd->stat_current?
+			0:1)*nsd->child_count + nsd->this_child->child_num]);
+#endif
+	memory_lock_next = time(NULL) + MEMORY_LOCK_INTERVAL;
+}
+#endif /* HAVE_MLOCK2 && MLOCK_ONFAULT */
+
+#if defined(BIND8_STATS) && defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+/* count the page faults of this server process in its statistics */
+static void
+server_page_faults(struct nsd* nsd)
+{
+	static long majflt = 0, minflt = 0;
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0)
+		return;
+	nsd->st->page_faults_major += (stc_type)(ru.ru_majflt - majflt);
+	nsd->st->page_faults_minor += (stc_type)(ru.ru_minflt - minflt);
+	majflt = ru.ru_majflt;
+	minflt = ru.ru_minflt;
+}
+#endif
+
+/* once a second, the page faults and the memory-lock of the heavy hitters */
+static void
+server_child_timer(int ATTR_UNUSED(fd), short ATTR_UNUSED(event), void* arg)
+{
+	struct nsd* nsd = (struct nsd*)arg;
+#if defined(BIND8_STATS) && defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+	server_page_faults(nsd);
+#endif
+#if defined(HAVE_MLOCK2) && defined(MLOCK_ONFAULT)
+	if(memory_lock_hot && time(NULL) >= memory_lock_next) {
+#ifdef BIND8_STATS
+		if(nsd->topstat)
+			memory_lock_topstat(nsd, nsd->topstat);
+#endif
+		memory_lock_next = time(NULL) + MEMORY_LOCK_INTERVAL;
+	}
+#endif
+	(void)nsd;
+}
+
+/* set the memory-lock of the server process, and its timer */
+static void
+server_child_memory(struct nsd* nsd, region_type* region,
+	struct event_base* event_base)
+{
+	struct event* timer;
+	struct timeval tv;
+	if(strcmp(nsd->options->memory_lock, "all") == 0) {
+#if defined(HAVE_MLOCKALL) && defined(MCL_ONFAULT)
+		if(mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == -1)
+			log_msg(LOG_WARNING, "memory-lock: mlockall: %s",
+				strerror(errno));
+#else
+		log_msg(LOG_WARNING, "memory-lock: all is not supported "
+			"on this system");
+#endif
+	} else if(strcmp(nsd->options->memory_lock, "hot") == 0) {
+#if defined(HAVE_MLOCK2) && defined(MLOCK_ONFAULT)
+		memory_lock_start(nsd);
+#else
+		log_msg(LOG_WARNING, "memory-lock: hot is not supported "
+			"on this system");
+#endif
+	}
+
+	timer = (struct event*)region_alloc_zero(region, sizeof(*timer));
+	event_set(timer, -1, EV_PERSIST|EV_TIMEOUT, server_child_timer, nsd);
+	if(event_base_set(event_base, timer) != 0)
+		log_msg(LOG_ERR, "nsd child timer: event_base_set failed");
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	if(event_add(timer, &tv) != 0)
+		log_msg(LOG_ERR, "nsd child timer: event_add failed");
+}
+
 /*
  * Serve DNS requests.
  */
@@ -3463,6 +5044,18 @@ server_child(struct nsd *nsd)
 #ifdef RATELIMIT
 	rrl_init(nsd->this_child->child_num);
 #endif
+	/* rotated answers cannot be reused */
+	if(!nsd->options->round_robin && nsd->options->response_cache_size > 0)
+		respcache_init((size_t)nsd->options->response_cache_size);
+	/* the lookup caches may be inherited from an earlier database */
+	query_zone_cache_clear();
+	query_additional_cache_clear();
+	query_dname_cache_clear();
+	query_any_cache_clear();
+	query_nsec_cache_clear();
+#ifdef NSEC3
+	nsec3_next_closer_cache_clear();
+#endif
 
 	assert(nsd->server_kind != NSD_SERVER_MAIN);
 
@@ -3481,11 +5074,27 @@ server_child(struct nsd *nsd)
 		set_cpu_affinity(nsd->this_child->cpuset);
 	}
 #endif
+	/* the buffers of this server are best on its own node */
+	if(nsd->options->numa_interleave)
+		(void)set_numa_interleave(0);
 #ifdef BIND8_STATS
 	nsd->st = &nsd->stats_per_child[nsd->stat_current]
 		[nsd->this_child->child_num];
 	nsd->st->boot = nsd->stat_map[0].boot;
 	memcpy(&nsd->stat_proc, nsd->st, sizeof(nsd->stat_proc));
+	if(nsd->topstat_map) {
+		/* the heavy hitters are counted from the start of the server */
+		nsd->topstat = &nsd->topstat_map[nsd->stat_current*
+			nsd->child_count + nsd->this_child->child_num];
+		memset(nsd->topstat, 0, sizeof(*nsd->topstat));
+	}
+	if(nsd->respcache_handover_map)
+		respcache_handover_set(&nsd->respcache_handover_map[
+			nsd->stat_current*nsd->child_count +
+			nsd->this_child->child_num]);
+#endif
+#ifdef USE_ZONE_STATS
+	nsd->zonestat_child = nsd->this_child->child_num;
 #endif
 
 	if (!(nsd->server_kind & NSD_SERVER_TCP)) {
@@ -3530,9 +5139,9 @@ server_child(struct nsd *nsd)
 		int child = nsd->this_child->child_num;
 		memset(msgs, 0, sizeof(msgs));
 		for (i = 0; i < NUM_RECV_PER_SELECT; i++) {
-			queries[i] = query_create(server_region,
-				compressed_dname_offsets,
-				compression_table_size, compressed_dnames);
+			queries[i] = query_create_with_buffer(server_region,
+				compression_table, compression_table_size,
+				udp_query_buffer_size(nsd));
 			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 			iovecs[i].iov_base          = buffer_begin(queries[i]->packet);
 			iovecs[i].iov_len           = buffer_remaining(queries[i]->packet);
@@ -3541,6 +5150,22 @@ server_child(struct nsd *nsd)
 			msgs[i].msg_hdr.msg_name    = &queries[i]->remote_addr;
 			msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
 		}
+#ifdef USE_UDP_QUEUE_STATS
+		udp_queue_stats = nsd->options->udp_queue_statistics;
+#endif
+		udp_shed = nsd->options->udp_shed;
+#ifdef HAVE_CLOCK_GETTIME
+		udp_batch_latency = nsd->options->udp_batch_latency;
+		if(nsd->options->busy_poll > 0)
+			busy_poll_udp = region_alloc_array(server_region,
+				numifs, sizeof(*busy_poll_udp));
+#endif
+		if(nsd->options->udp_drain && nsd->options->busy_poll <= 0) {
+			udp_drain_udp = region_alloc_array(server_region,
+				numifs, sizeof(*udp_drain_udp));
+			udp_drain_fds = region_alloc_array(server_region,
+				numifs, sizeof(*udp_drain_fds));
+		}
 
 		for (i = 0; i < nsd->ifs; i++) {
 			int listen;
@@ -3557,6 +5182,15 @@ server_child(struct nsd *nsd)
 				server_close_socket(&nsd->udp[i]);
 			}
 		}
+#ifdef USE_XDP
+		if(nsd->options->xdp_interface) {
+			struct query* q = query_create_with_buffer(
+				server_region, compression_table,
+				compression_table_size,
+				udp_query_buffer_size(nsd));
+			xdp_server_child(nsd, q, xdp_answer_query);
+		}
+#endif
 	}
 
 	/*
@@ -3589,8 +5223,19 @@ server_child(struct nsd *nsd)
 		tcp_accept_handler_count = 0;
 	}
 
+#ifdef BIND8_STATS
+	if(nsd->options->reload_prewarm)
+		server_prewarm(nsd, server_region);
+#endif
+	server_child_memory(nsd, server_region, event_base);
+
+	/* log lines are written in batches, after the events that made them,
+	 * and repeated messages are counted, to not block the queries */
+	log_set_buffered(1);
+
 	/* The main loop... */
 	while ((mode = nsd->mode) != NSD_QUIT) {
+		log_flush();
 		if(mode == NSD_RUN) nsd->mode = mode = server_signal_mode(nsd);
 
 		/* Do we need to do the statistics... */
@@ -3623,6 +5268,13 @@ server_child(struct nsd *nsd)
 			nsd->mode = NSD_RUN;
 		}
 		else if(mode == NSD_RUN) {
+#ifdef HAVE_CLOCK_GETTIME
+			if(busy_poll_udp_count > 0) {
+				if(!server_busy_poll(nsd, event_base))
+					break;
+				continue;
+			}
+#endif
 			/* Wait for a query... */
 			if(event_base_loop(event_base, EVLOOP_ONCE) == -1) {
 				if (errno != EINTR) {
@@ -3643,11 +5295,16 @@ server_child(struct nsd *nsd)
 #ifdef	BIND8_STATS
 	bind8_stats(nsd);
 #endif /* BIND8_STATS */
+	log_set_buffered(0);
 
 #ifdef MEMCLEAN /* OS collects memory pages */
 #ifdef RATELIMIT
 	rrl_deinit(nsd->this_child->child_num);
 #endif
+#ifdef USE_IO_URING
+	uring_udp_deinit();
+#endif
+	respcache_deinit();
 	event_base_free(event_base);
 	region_destroy(server_region);
 #endif
@@ -3696,6 +5353,11 @@ service_remaining_tcp(struct nsd* nsd)
 #endif
 		void (*fn)(int, short, void*);
 #ifdef HAVE_SSL
+#ifdef SSL_MODE_ASYNC
+		if(p->shake_state == tls_hs_async) {
+			fn = handle_tls_async;
+		} else
+#endif
 		if(p->tls) {
 			if((event&EV_READ))
 				fn = handle_tls_reading;
@@ -3705,9 +5367,16 @@ service_remaining_tcp(struct nsd* nsd)
 				fn = handle_tls_reading;
 			else	fn = handle_tls_writing;
 		} else {
+#endif
+#ifdef USE_TCP_ZEROCOPY
+			if(p->zc_wait)
+				fn = handle_tcp_zerocopy;
+			else
 #endif
 			if((event&EV_READ))
 				fn = handle_tcp_reading;
+			else if(p->pipeline_resume)
+				fn = handle_tcp_pipeline;
 			else	fn = handle_tcp_writing;
 #ifdef HAVE_SSL
 		}
@@ -3719,6 +5388,13 @@ service_remaining_tcp(struct nsd* nsd)
 			p->tcp_timeout = 3000;
 		timeout.tv_sec = p->tcp_timeout / 1000;
 		timeout.tv_usec = (p->tcp_timeout % 1000)*1000;
+#ifdef USE_TCP_ZEROCOPY
+		if(p->zc_wait) {
+			/* look at the error queue again soon */
+			timeout.tv_sec = p->zc_poll / 1000;
+			timeout.tv_usec = (p->zc_poll % 1000)*1000;
+		}
+#endif
 		event_del(&p->event);
 		memset(&p->event, 0, sizeof(p->event));
 		event_set(&p->event, fd, EV_PERSIST | event | EV_TIMEOUT,
@@ -3954,134 +5630,536 @@ consume_pp2_header(struct buffer* buf, struct query* q, int stream)
 done:
 	if(!stream) {
 		/* We are reading a whole packet;
-		 * Move the rest of the data to overwrite the PROXYv2 header */
-		/* XXX can we do better to avoid memmove? */
-		memmove(header, ((char*)header)+size, buffer_limit(buf)-size);
-		buffer_set_limit(buf, buffer_limit(buf)-size);
+		 * let the buffer start after the PROXYv2 header, the answer
+		 * is written there too. query_reset undoes this. */
+		buffer_skip_begin(buf, size);
+		q->pp2_skip = size;
 	}
 	return 1;
 }
 
-static void
-handle_udp(int fd, short event, void* arg)
+/*
+ * Process a query that was received in the packet buffer of q, with the
+ * remote address already filled in. Returns 1 when the answer is ready in
+ * the packet buffer to be sent back, 0 when the query is to be dropped.
+ * The pp2 and dnstap arguments are constants in the callers, so that the
+ * compiler makes a variant without the code for the features that are
+ * not in use.
+ */
+static inline int
+udp_process_received_variant(struct udp_handler_data *data, struct query *q,
+	uint32_t *now_p, int pp2, int dnstap)
 {
-	struct udp_handler_data *data = (struct udp_handler_data *) arg;
-	int received, sent, recvcount, i;
-	struct query *q;
-	uint32_t now = 0;
-
-	if (!(event & EV_READ)) {
-		return;
-	}
-	recvcount = nsd_recvmmsg(fd, msgs, NUM_RECV_PER_SELECT, 0, NULL);
-	/* this printf strangely gave a performance increase on Linux */
-	/* printf("recvcount %d \n", recvcount); */
-	if (recvcount == -1) {
-		if (errno != EAGAIN && errno != EINTR) {
-			log_msg(LOG_ERR, "recvmmsg failed: %s", strerror(errno));
-			STATUP(data->nsd, rxerr);
-			/* No zone statup */
-		}
-		/* Simply no data available */
-		return;
-	}
-	for (i = 0; i < recvcount; i++) {
-	loopstart:
-		received = msgs[i].msg_len;
-		queries[i]->remote_addrlen = msgs[i].msg_hdr.msg_namelen;
-		queries[i]->client_addrlen = (socklen_t)sizeof(queries[i]->client_addr);
-		queries[i]->is_proxied = 0;
-		q = queries[i];
-		if (received == -1) {
-			log_msg(LOG_ERR, "recvmmsg %d failed %s", i, strerror(
-#if defined(HAVE_RECVMMSG)
-				msgs[i].msg_hdr.msg_flags
-#else
-				errno
-#endif
-				));
-			STATUP(data->nsd, rxerr);
-			/* No zone statup */
-			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
-			iovecs[i].iov_len = buffer_remaining(q->packet);
-			msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
-			goto swap_drop;
-		}
-
-		/* Account... */
+	/* Account... */
 #ifdef BIND8_STATS
-		if (data->socket->addr.ai_family == AF_INET) {
-			STATUP(data->nsd, qudp);
-		} else if (data->socket->addr.ai_family == AF_INET6) {
-			STATUP(data->nsd, qudp6);
-		}
+	if (data->socket->addr.ai_family == AF_INET) {
+		STATUP(data->nsd, qudp);
+	} else if (data->socket->addr.ai_family == AF_INET6) {
+		STATUP(data->nsd, qudp6);
+	}
 #endif
 
-		buffer_skip(q->packet, received);
-		buffer_flip(q->packet);
-		if(data->pp2_enabled && !consume_pp2_header(q->packet, q, 0)) {
-			VERBOSITY(2, (LOG_ERR, "proxy-protocol: could not "
-				"consume PROXYv2 header"));
-			goto swap_drop;
-		}
-		if(!q->is_proxied) {
-			q->client_addrlen = q->remote_addrlen;
-			memmove(&q->client_addr, &q->remote_addr,
-				q->remote_addrlen);
-		}
+	buffer_flip(q->packet);
+	if(pp2 && !consume_pp2_header(q->packet, q, 0)) {
+		VERBOSITY(2, (LOG_ERR, "proxy-protocol: could not "
+			"consume PROXYv2 header"));
+		return 0;
+	}
+	if(!q->is_proxied) {
+		q->client_addrlen = q->remote_addrlen;
+		memmove(&q->client_addr, &q->remote_addr,
+			q->remote_addrlen);
+	}
 #ifdef USE_DNSTAP
-		/*
-		 * sending UDP-query with server address (local) and client address to dnstap process
-		 */
+	/*
+	 * sending UDP-query with server address (local) and client address to dnstap process
+	 */
+	if(dnstap) {
 		log_addr("query from client", &q->client_addr);
 		log_addr("to server (local)", (void*)&data->socket->addr.ai_addr);
 		if(verbosity >= 6 && q->is_proxied)
 			log_addr("query via proxy", &q->remote_addr);
 		dt_collector_submit_auth_query(data->nsd, (void*)&data->socket->addr.ai_addr, &q->client_addr, q->client_addrlen,
 			q->tcp, q->packet);
+	}
 #endif /* USE_DNSTAP */
 
-		/* Process and answer the query... */
-		if (server_process_query_udp(data->nsd, q, &now) != QUERY_DISCARDED) {
-			if (RCODE(q->packet) == RCODE_OK && !AA(q->packet)) {
-				STATUP(data->nsd, nona);
-				ZTATUP(data->nsd, q->zone, nona);
-			}
+	/* Process and answer the query... */
+	if (server_process_query_udp(data->nsd, q, now_p) == QUERY_DISCARDED)
+		return 0;
+
+	if (RCODE(q->packet) == RCODE_OK && !AA(q->packet)) {
+		STATUP(data->nsd, nona);
+		ZTATUP(data->nsd, q->zone, nona);
+	}
 
 #ifdef USE_ZONE_STATS
-			if (data->socket->addr.ai_family == AF_INET) {
-				ZTATUP(data->nsd, q->zone, qudp);
-			} else if (data->socket->addr.ai_family == AF_INET6) {
-				ZTATUP(data->nsd, q->zone, qudp6);
-			}
+	if (data->socket->addr.ai_family == AF_INET) {
+		ZTATUP(data->nsd, q->zone, qudp);
+	} else if (data->socket->addr.ai_family == AF_INET6) {
+		ZTATUP(data->nsd, q->zone, qudp6);
+	}
 #endif
 
-			/* Add EDNS0 and TSIG info if necessary.  */
-			query_add_optional(q, data->nsd, &now);
+	/* Add EDNS0 and TSIG info if necessary.  */
+	query_add_optional(q, data->nsd, now_p);
+	QUERY_TRACE(q, QUERY_TRACE_FINAL);
 
-			buffer_flip(q->packet);
-			iovecs[i].iov_len = buffer_remaining(q->packet);
+	buffer_flip(q->packet);
+	NSD_PROBE5(answer__encoded, PROBE_QNAME(q), q->qtype,
+		PROBE_ZONE(q->zone), RCODE(q->packet),
+		buffer_remaining(q->packet));
 #ifdef BIND8_STATS
-			/* Account the rcode & TC... */
-			STATUP2(data->nsd, rcode, RCODE(q->packet));
-			ZTATUP2(data->nsd, q->zone, rcode, RCODE(q->packet));
-			if (TC(q->packet)) {
-				STATUP(data->nsd, truncated);
-				ZTATUP(data->nsd, q->zone, truncated);
-			}
+	/* Account the rcode & TC... */
+	STATUP2(data->nsd, rcode, RCODE(q->packet));
+	ZTATUP2(data->nsd, q->zone, rcode, RCODE(q->packet));
+	if (TC(q->packet)) {
+		STATUP(data->nsd, truncated);
+		ZTATUP(data->nsd, q->zone, truncated);
+	}
 #endif /* BIND8_STATS */
 #ifdef USE_DNSTAP
-			/*
-			 * sending UDP-response with server address (local) and client address to dnstap process
-			 */
-			log_addr("from server (local)", (void*)&data->socket->addr.ai_addr);
-			log_addr("response to client", &q->client_addr);
-			if(verbosity >= 6 && q->is_proxied)
-				log_addr("response via proxy", &q->remote_addr);
-			dt_collector_submit_auth_response(data->nsd, (void*)&data->socket->addr.ai_addr,
-				&q->client_addr, q->client_addrlen, q->tcp, q->packet,
-				q->zone);
+	/*
+	 * sending UDP-response with server address (local) and client address to dnstap process
+	 */
+	if(dnstap) {
+		log_addr("from server (local)", (void*)&data->socket->addr.ai_addr);
+		log_addr("response to client", &q->client_addr);
+		if(verbosity >= 6 && q->is_proxied)
+			log_addr("response via proxy", &q->remote_addr);
+		dt_collector_submit_auth_response(data->nsd, (void*)&data->socket->addr.ai_addr,
+			&q->client_addr, q->client_addrlen, q->tcp, q->packet,
+			q->zone);
+	}
+#else
+	(void)dnstap;
 #endif /* USE_DNSTAP */
+	return 1;
+}
+
+/* if queries are submitted to dnstap, the option does not change while
+ * the server runs */
+static int
+udp_dnstap_enabled(struct nsd* nsd)
+{
+#ifdef USE_DNSTAP
+	return nsd->options->dnstap_enable;
+#else
+	(void)nsd;
+	return 0;
+#endif
+}
+
+/* process the query with the features that are enabled for the socket */
+static int
+udp_process_received(struct udp_handler_data *data, struct query *q,
+	uint32_t *now_p)
+{
+	return udp_process_received_variant(data, q, now_p,
+		data->pp2_enabled, udp_dnstap_enabled(data->nsd));
+}
+
+/* process the query on a socket without PROXYv2 and dnstap, the common
+ * configuration */
+static int
+udp_process_received_plain(struct udp_handler_data *data, struct query *q,
+	uint32_t *now_p)
+{
+	return udp_process_received_variant(data, q, now_p, 0, 0);
+}
+
+#ifdef USE_XDP
+static int
+xdp_answer_query(struct nsd* nsd, struct nsd_socket* sock, struct query* q,
+	uint32_t* now_p)
+{
+	struct udp_handler_data data;
+	memset(&data, 0, sizeof(data));
+	data.nsd = nsd;
+	data.socket = sock;
+	/* PROXYv2 ports are not redirected to AF_XDP */
+	data.pp2_enabled = 0;
+	return udp_process_received(&data, q, now_p);
+}
+#endif /* USE_XDP */
+
+#ifdef HAVE_CLOCK_GETTIME
+/* the queries since the last one that query-trace sampled */
+static uint32_t query_trace_count = 0;
+
+/* trace one in query-trace queries, received at recv, or now if 0 */
+static void
+query_trace_start(struct nsd* nsd, struct query* q, uint64_t recv)
+{
+	if(!nsd->options->query_trace || ++query_trace_count <
+		(uint32_t)nsd->options->query_trace)
+		return;
+	query_trace_count = 0;
+	memset(q->trace, 0, sizeof(q->trace));
+	q->traced = 1;
+	q->trace[QUERY_TRACE_START] = query_trace_now();
+	q->trace[QUERY_TRACE_RECV] = (recv?recv:q->trace[QUERY_TRACE_START]);
+}
+
+/* the answer of the traced query is sent, log the time of the stages if
+ * the total is more than query-trace-min */
+static void
+query_trace_done(struct nsd* nsd, struct query* q)
+{
+	static const char* names[QUERY_TRACE_STAGES] = { "recv", "start",
+		"parse", "lookup", "answer", "rrl", "final", "send" };
+	char stages[256], a[64];
+	size_t len = 0;
+	uint64_t prev, total;
+	int i;
+	q->traced = 0;
+	q->trace[QUERY_TRACE_SEND] = query_trace_now();
+	prev = q->trace[QUERY_TRACE_RECV];
+	if(q->trace[QUERY_TRACE_SEND] < prev)
+		return;
+	total = q->trace[QUERY_TRACE_SEND] - prev;
+	if(total < (uint64_t)nsd->options->query_trace_min*1000)
+		return;
+	stages[0] = 0;
+	for(i = QUERY_TRACE_START; i < QUERY_TRACE_STAGES; i++) {
+		if(q->trace[i] == 0 || q->trace[i] < prev)
+			continue;
+		snprintf(stages+len, sizeof(stages)-len, " %s %llu", names[i],
+			(unsigned long long)(q->trace[i] - prev));
+		len += strlen(stages+len);
+		prev = q->trace[i];
+	}
+	addrport2str((void*)&q->client_addr, a, sizeof(a));
+	log_msg(LOG_INFO, "query-trace: %s %s from %s %s, %llu nsec:%s",
+		(q->qname?dname_to_string(q->qname, NULL):"-"),
+		rrtype_to_string(q->qtype), a, (q->tcp?"tcp":"udp"),
+		(unsigned long long)total, stages);
+}
+#endif /* HAVE_CLOCK_GETTIME */
+
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+/* if latency statistics are kept, get the time the query was received */
+static int
+latency_start(struct nsd* nsd, struct timespec* start)
+{
+	if(!nsd->options->latency_statistics)
+		return 0;
+	return clock_gettime(CLOCK_MONOTONIC, start) == 0;
+}
+
+/* the latency histogram bucket for the time from start to end */
+static int
+latency_bucket(struct timespec* start, struct timespec* end)
+{
+	uint64_t usec;
+	int b = 0;
+	if(end->tv_sec < start->tv_sec || (end->tv_sec == start->tv_sec &&
+		end->tv_nsec < start->tv_nsec))
+		usec = 0;
+	else	usec = ((uint64_t)(end->tv_sec - start->tv_sec))*1000000 +
+			((int64_t)end->tv_nsec - (int64_t)start->tv_nsec)/1000;
+	while(b < LATENCY_BUCKETS-1 && usec >= ((uint64_t)1)<<b)
+		b++;
+	return b;
+}
+
+/* add the time from start to end to the latency histogram of the transport,
+ * and to that of the zone of the answer */
+static void
+latency_add(struct nsd* nsd, zone_type* ATTR_UNUSED(zone), int transport,
+	struct timespec* start, struct timespec* end)
+{
+	int b = latency_bucket(start, end);
+	nsd->st->latency[transport][b]++;
+#ifdef USE_ZONE_STATS
+	if(zone && zone->zonestatid < nsd->zonestatsizenow)
+		ZONESTATNOW(nsd, zone).latency[transport][b]++;
+#endif
+}
+#endif /* BIND8_STATS && HAVE_CLOCK_GETTIME */
+
+#ifdef USE_UDP_QUEUE_STATS
+/* point the messages to the control buffers for the next receive */
+static void
+udp_queue_stats_setup(void)
+{
+	int i;
+	for(i=0; i<NUM_RECV_PER_SELECT; i++) {
+		msgs[i].msg_hdr.msg_control = rxq_control[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(rxq_control[i].buf);
+	}
+}
+
+/* count the kernel drops and the time in the socket buffer of the
+ * received queries, and remove the control messages before the send */
+static void
+udp_queue_stats_read(struct udp_handler_data* data, int recvcount)
+{
+	struct timespec now;
+	int i, have_now = (clock_gettime(CLOCK_REALTIME, &now) == 0);
+	for(i=0; i<recvcount; i++) {
+		struct msghdr* hdr = &msgs[i].msg_hdr;
+		struct cmsghdr* cmsg;
+		for(cmsg = CMSG_FIRSTHDR(hdr); cmsg;
+			cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET)
+				continue;
+			if(cmsg->cmsg_type == SO_RXQ_OVFL &&
+				cmsg->cmsg_len >= CMSG_LEN(sizeof(uint32_t))) {
+				uint32_t ovfl;
+				memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+				/* the counter is of the socket, the drops
+				 * are the increase since the last one seen */
+				if(data->rxq_ovfl_seen)
+					data->nsd->st->rxq_dropped +=
+						(uint32_t)(ovfl - data->rxq_ovfl);
+				data->rxq_ovfl = ovfl;
+				data->rxq_ovfl_seen = 1;
+			} else if(cmsg->cmsg_type == SCM_TIMESTAMPNS &&
+				cmsg->cmsg_len >= CMSG_LEN(sizeof(now)) &&
+				have_now) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				data->nsd->st->rxq_latency[latency_bucket(&ts,
+					&now)]++;
+			}
+		}
+		hdr->msg_control = NULL;
+		hdr->msg_controllen = 0;
+	}
+}
+#endif /* USE_UDP_QUEUE_STATS */
+
+#ifdef USE_UDP_GSO
+/*
+ * Combine the answers, next to each other in msgs, for the same address
+ * into one message with UDP_SEGMENT, the kernel splits it up into the
+ * datagrams. All but the last datagram must have the segment size, the
+ * last can be shorter. Returns the number of messages in gso_msgs.
+ */
+static int
+udp_gso_coalesce(struct nsd* nsd, int count)
+{
+	int i = 0, j, n = 0;
+	while(i < count) {
+		size_t seg = iovecs[i].iov_len, total = seg;
+		for(j = i+1; j < count && j-i < UDP_GSO_MAX_SEGMENTS; j++) {
+			if(iovecs[j-1].iov_len != seg ||
+				iovecs[j].iov_len > seg ||
+				total + iovecs[j].iov_len > 65000 ||
+				msgs[j].msg_hdr.msg_namelen !=
+				msgs[i].msg_hdr.msg_namelen ||
+				memcmp(msgs[j].msg_hdr.msg_name,
+				msgs[i].msg_hdr.msg_name,
+				msgs[i].msg_hdr.msg_namelen) != 0)
+				break;
+			total += iovecs[j].iov_len;
+		}
+		gso_msgs[n] = msgs[i];
+		gso_msgs[n].msg_hdr.msg_iov = &iovecs[i];
+		gso_msgs[n].msg_hdr.msg_iovlen = j-i;
+		if(j-i > 1) {
+			struct cmsghdr* cmsg;
+			gso_msgs[n].msg_hdr.msg_control = gso_control[n].buf;
+			gso_msgs[n].msg_hdr.msg_controllen =
+				sizeof(gso_control[n].buf);
+			cmsg = CMSG_FIRSTHDR(&gso_msgs[n].msg_hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t*)CMSG_DATA(cmsg) = (uint16_t)seg;
+#ifdef BIND8_STATS
+			nsd->st->udp_gso += j-i;
+#endif
+		} else {
+			gso_msgs[n].msg_hdr.msg_control = NULL;
+			gso_msgs[n].msg_hdr.msg_controllen = 0;
+		}
+		gso_first[n++] = i;
+		i = j;
+	}
+	(void)nsd;
+	return n;
+}
+#endif /* USE_UDP_GSO */
+
+#ifdef BIND8_STATS
+/* count the size of a UDP read in the histogram */
+static inline void
+udp_batch_count(struct nsd* nsd, int count)
+{
+	unsigned b = 0;
+	while(b < UDP_BATCH_BUCKETS-1 && (unsigned)count >= 1U<<b)
+		b++;
+	nsd->st->udp_batch[b]++;
+}
+#endif /* BIND8_STATS */
+
+#ifdef HAVE_CLOCK_GETTIME
+/* adapt the size of the UDP reads to the time the queries of this batch
+ * took, so that the first query of a batch is answered within the
+ * udp-batch-latency target */
+static void
+udp_batch_adapt(struct timespec* start, int count)
+{
+	struct timespec end;
+	uint64_t nsec, max;
+	if(count <= 0 || clock_gettime(CLOCK_MONOTONIC, &end) != 0)
+		return;
+	nsec = (uint64_t)(end.tv_sec - start->tv_sec)*1000000000 +
+		end.tv_nsec - start->tv_nsec;
+	nsec /= (uint64_t)count;
+	if(nsec == 0)
+		nsec = 1;
+	udp_batch_cost = (udp_batch_cost ? (udp_batch_cost*7 + nsec)/8 :
+		nsec);
+	max = (uint64_t)udp_batch_latency*1000 / (udp_batch_cost?
+		udp_batch_cost:1);
+	if(max < 1)
+		max = 1;
+	else if(max > NUM_RECV_PER_SELECT)
+		max = NUM_RECV_PER_SELECT;
+	udp_batch_max = (int)max;
+}
+#endif /* HAVE_CLOCK_GETTIME */
+
+/*
+ * Follow the overload for udp-shed. A read that fills the batch leaves
+ * queries waiting in the socket buffer, and with udp-batch-latency the
+ * batch is as large as the latency allows. When the reads stay full,
+ * the queue grows and the kernel drops queries of every source alike.
+ */
+static void
+udp_shed_update(struct nsd* nsd, int recvcount)
+{
+	if(recvcount >= udp_batch_max) {
+		if(!nsd->udp_overloaded &&
+			++udp_shed_full >= UDP_SHED_FULL_BATCHES) {
+			nsd->udp_overloaded = 1;
+			STATUP(nsd, udp_overload);
+			VERBOSITY(3, (LOG_INFO, "server %d: overloaded, "
+				"shedding UDP queries without cookie",
+				(int)nsd->this_child->child_num));
+		}
+	} else if(recvcount <= udp_batch_max/2) {
+		udp_shed_full = 0;
+		nsd->udp_overloaded = 0;
+	}
+}
+
+/* receive and answer a batch of queries, process is a constant in the
+ * callers so that the variant of query processing is inlined */
+static inline void
+handle_udp_variant(int fd, short event, void* arg,
+	int (*process)(struct udp_handler_data*, struct query*, uint32_t*))
+{
+	struct udp_handler_data *data = (struct udp_handler_data *) arg;
+	int received, sent, recvcount, readcount, i;
+	struct mmsghdr* smsgs = msgs;
+	int sendcount;
+	struct query *q;
+	uint32_t now = 0;
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	struct timespec lat_start, lat_end;
+	int lat = 0;
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec batch_start;
+	uint64_t trace_recv = 0;
+#endif
+
+	if (!(event & EV_READ)) {
+		return;
+	}
+#ifdef USE_UDP_QUEUE_STATS
+	if(udp_queue_stats)
+		udp_queue_stats_setup();
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+	if(udp_batch_latency)
+		(void)clock_gettime(CLOCK_MONOTONIC, &batch_start);
+#endif
+	recvcount = nsd_recvmmsg(fd, msgs, udp_batch_max, 0, NULL);
+	/* this printf strangely gave a performance increase on Linux */
+	/* printf("recvcount %d \n", recvcount); */
+	if (recvcount == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			log_msg(LOG_ERR, "recvmmsg failed: %s", strerror(errno));
+			STATUP(data->nsd, rxerr);
+			/* No zone statup */
+		}
+		/* Simply no data available */
+		return;
+	}
+	if(recvcount > 0)
+		busy_poll_received = 1;
+	readcount = recvcount;
+	if(udp_shed)
+		udp_shed_update(data->nsd, recvcount);
+#ifdef BIND8_STATS
+	if(recvcount > 0)
+		udp_batch_count(data->nsd, recvcount);
+#endif
+#ifdef USE_UDP_QUEUE_STATS
+	if(udp_queue_stats)
+		udp_queue_stats_read(data, recvcount);
+#endif
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	lat = latency_start(data->nsd, &lat_start);
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+	if(data->nsd->options->query_trace && recvcount > 0)
+		trace_recv = query_trace_now();
+#endif
+	/* start the loads of the query structures of the batch, that the
+	 * loop below waits for one after the other otherwise */
+	for (i = 0; i < recvcount; i++)
+		PREFETCH(queries[i]);
+	for (i = 0; i < recvcount; i++) {
+	loopstart:
+		/* and the packet of the next query, while this one is
+		 * answered */
+		if (i+1 < recvcount)
+			PREFETCH(buffer_begin(queries[i+1]->packet));
+		received = msgs[i].msg_len;
+		queries[i]->remote_addrlen = msgs[i].msg_hdr.msg_namelen;
+		queries[i]->client_addrlen = (socklen_t)sizeof(queries[i]->client_addr);
+		queries[i]->is_proxied = 0;
+		q = queries[i];
+		if (received == -1) {
+			log_msg(LOG_ERR, "recvmmsg %d failed %s", i, strerror(
+#if defined(HAVE_RECVMMSG)
+				msgs[i].msg_hdr.msg_flags
+#else
+				errno
+#endif
+				));
+			STATUP(data->nsd, rxerr);
+			/* No zone statup */
+			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
+			iovecs[i].iov_len = buffer_remaining(q->packet);
+			msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
+			goto swap_drop;
+		}
+#if defined(HAVE_RECVMMSG) && defined(MSG_TRUNC)
+		if((msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+			/* larger than the buffer, not a query we answer */
+			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
+			iovecs[i].iov_len = buffer_remaining(q->packet);
+			msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
+			goto swap_drop;
+		}
+#endif
+
+		buffer_skip(q->packet, received);
+#ifdef HAVE_CLOCK_GETTIME
+		if(trace_recv)
+			query_trace_start(data->nsd, q, trace_recv);
+#endif
+		if(process(data, q, &now)) {
+			/* after a PROXYv2 header the packet starts later */
+			iovecs[i].iov_base = buffer_begin(q->packet);
+			iovecs[i].iov_len = buffer_remaining(q->packet);
 		} else {
 			query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 			iovecs[i].iov_len = buffer_remaining(q->packet);
@@ -4108,10 +6186,31 @@ handle_udp(int fd, short event, void* arg)
 	}
 
 	/* send until all are sent */
+	sendcount = recvcount;
+#ifdef USE_UDP_GSO
+	if(data->nsd->options->udp_gso && udp_gso_works && recvcount > 1) {
+		sendcount = udp_gso_coalesce(data->nsd, recvcount);
+		smsgs = gso_msgs;
+	}
+#endif
 	i = 0;
-	while(i<recvcount) {
-		sent = nsd_sendmmsg(fd, &msgs[i], recvcount-i, 0);
+	while(i<sendcount) {
+		sent = nsd_sendmmsg(fd, &smsgs[i], sendcount-i, 0);
 		if(sent == -1) {
+#ifdef USE_UDP_GSO
+			if(errno == EIO && smsgs == gso_msgs) {
+				/* the interface cannot do GSO, send the rest
+				 * one by one, and stop using it */
+				log_msg(LOG_WARNING, "udp-gso: sendmmsg failed: "
+					"%s, turning off udp-gso",
+					strerror(errno));
+				udp_gso_works = 0;
+				i = gso_first[i];
+				smsgs = msgs;
+				sendcount = recvcount;
+				continue;
+			}
+#endif
 			if(errno == ENOBUFS ||
 #ifdef EWOULDBLOCK
 				errno == EWOULDBLOCK ||
@@ -4126,7 +6225,7 @@ handle_udp(int fd, short event, void* arg)
 				flag &= ~O_NONBLOCK;
 				if(fcntl(fd, F_SETFL, flag) == -1)
 					log_msg(LOG_ERR, "cannot fcntl F_SETFL 0: %s", strerror(errno));
-				sent = nsd_sendmmsg(fd, &msgs[i], recvcount-i, 0);
+				sent = nsd_sendmmsg(fd, &smsgs[i], sendcount-i, 0);
 				errstore = errno;
 				flag |= O_NONBLOCK;
 				if(fcntl(fd, F_SETFL, flag) == -1)
@@ -4140,12 +6239,12 @@ handle_udp(int fd, short event, void* arg)
 			if(errno == EINVAL) {
 				/* skip the invalid argument entry,
 				 * send the remaining packets in the list */
-				if(!(port_is_zero((void*)&queries[i]->remote_addr) &&
+				if(!(port_is_zero((void*)&queries[UDP_SEND_FIRST(smsgs, i)]->remote_addr) &&
 					verbosity < 3)) {
 					const char* es = strerror(errno);
 					char a[64];
-					addrport2str((void*)&queries[i]->remote_addr, a, sizeof(a));
-					log_msg(LOG_ERR, "sendmmsg skip invalid argument [0]=%s count=%d failed: %s", a, (int)(recvcount-i), es);
+					addrport2str((void*)&queries[UDP_SEND_FIRST(smsgs, i)]->remote_addr, a, sizeof(a));
+					log_msg(LOG_ERR, "sendmmsg skip invalid argument [0]=%s count=%d failed: %s", a, (int)(sendcount-i), es);
 				}
 				i += 1;
 				continue;
@@ -4159,53 +6258,625 @@ handle_udp(int fd, short event, void* arg)
 			   errno != EAGAIN) {
 				const char* es = strerror(errno);
 				char a[64];
-				addrport2str((void*)&queries[i]->remote_addr, a, sizeof(a));
-				log_msg(LOG_ERR, "sendmmsg [0]=%s count=%d failed: %s", a, (int)(recvcount-i), es);
+				addrport2str((void*)&queries[UDP_SEND_FIRST(smsgs, i)]->remote_addr, a, sizeof(a));
+				log_msg(LOG_ERR, "sendmmsg [0]=%s count=%d failed: %s", a, (int)(sendcount-i), es);
 			}
 #ifdef BIND8_STATS
-			data->nsd->st->txerr += recvcount-i;
+			data->nsd->st->txerr += recvcount-UDP_SEND_FIRST(smsgs, i);
 #endif /* BIND8_STATS */
 			break;
 		}
-		i += sent;
-	}
-	for(i=0; i<recvcount; i++) {
-		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
-		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
-		msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
+		i += sent;
+	}
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	/* the queries in the batch are received and sent at the same time */
+	if(lat && clock_gettime(CLOCK_MONOTONIC, &lat_end) == 0) {
+		for(i=0; i<recvcount; i++)
+			latency_add(data->nsd, queries[i]->zone, LATENCY_UDP,
+				&lat_start, &lat_end);
+	}
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+	if(udp_batch_latency)
+		udp_batch_adapt(&batch_start, readcount);
+	if(trace_recv) {
+		for(i=0; i<recvcount; i++)
+			if(queries[i]->traced)
+				query_trace_done(data->nsd, queries[i]);
+	}
+#endif
+	for(i=0; i<recvcount; i++) {
+		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
+		iovecs[i].iov_base = buffer_begin(queries[i]->packet);
+		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
+		msgs[i].msg_hdr.msg_namelen = queries[i]->remote_addrlen;
+	}
+}
+
+static void
+handle_udp(int fd, short event, void* arg)
+{
+	handle_udp_variant(fd, event, arg, udp_process_received);
+}
+
+static void
+handle_udp_plain(int fd, short event, void* arg)
+{
+	handle_udp_variant(fd, event, arg, udp_process_received_plain);
+}
+
+/* the handler for the socket, without the code for PROXYv2 and dnstap if
+ * they are not used for it */
+static void
+(*udp_handler_for(struct udp_handler_data* data))(int, short, void*)
+{
+	if(data->pp2_enabled || udp_dnstap_enabled(data->nsd))
+		return handle_udp;
+	return handle_udp_plain;
+}
+
+/*
+ * Handle the UDP socket that woke the server up, and then the other UDP
+ * sockets of the server that have queries, found with one poll, for
+ * udp-drain. With the queries spread over many listening addresses, more
+ * of them are answered per wakeup of the event loop. The sockets are
+ * visited from the next one each time, so that none is always last.
+ */
+static void
+handle_udp_drain(int fd, short event, void* arg)
+{
+	struct udp_handler_data* data = (struct udp_handler_data*)arg;
+	size_t i, n;
+	int ready;
+
+	udp_handler_for(data)(fd, event, arg);
+	if(udp_drain_count < 2)
+		return;
+	ready = poll(udp_drain_fds, udp_drain_count, 0);
+	if(ready <= 0)
+		return;
+	n = udp_drain_next;
+	udp_drain_next = (udp_drain_next+1) % udp_drain_count;
+	for(i = 0; i < udp_drain_count && ready > 0; i++) {
+		if((udp_drain_fds[n].revents & (POLLIN|POLLERR|POLLHUP|
+			POLLNVAL))) {
+			ready--;
+			if((udp_drain_fds[n].revents & POLLIN))
+				udp_handler_for(udp_drain_udp[n])(
+					udp_drain_fds[n].fd, EV_READ,
+					udp_drain_udp[n]);
+		}
+		n = (n+1) % udp_drain_count;
+	}
+}
+
+#ifdef USE_IO_URING
+/*
+ * io_uring UDP service. Every server process that has io-uring=yes sockets
+ * keeps one ring. The sockets are read with a multishot recvmsg that
+ * picks buffers from a ring of provided buffers, and the responses are
+ * submitted in the same ring, so that one io_uring_enter call both sends
+ * the answers and picks up new queries. The ring fd is polled by the event
+ * loop, it becomes readable when completions are available.
+ */
+#define URING_ENTRIES 1024
+/* number of receive buffers, must be a power of two */
+#define URING_RECV_BUFS 512
+/* the start of a receive buffer, for io_uring_recvmsg_out and address,
+ * the query that follows is as large as for recvmmsg */
+#define URING_RECV_HDRSZ (sizeof(struct io_uring_recvmsg_out) + \
+	sizeof(struct sockaddr_storage))
+/* number of queries that can be in flight, waiting for send completion */
+#define URING_SEND_SLOTS 512
+#define URING_BGID 1
+#define URING_OP_RECV 1
+#define URING_OP_SEND 2
+#define URING_USERDATA(op, idx) ((((uint64_t)(op))<<32) | (uint64_t)(idx))
+#define URING_USERDATA_OP(u) ((int)((u)>>32))
+#define URING_USERDATA_IDX(u) ((size_t)((u)&0xffffffffU))
+
+struct uring_udp_socket {
+	struct udp_handler_data *data;
+	/* template for the multishot recvmsg, sets the address length */
+	struct msghdr msg;
+};
+
+struct uring_send_slot {
+	struct query *query;
+	struct iovec iov;
+	struct msghdr msg;
+	/* next on the free list, or -1 */
+	int next_free;
+};
+
+static struct uring_udp {
+	int active;
+	struct nsd *nsd;
+	struct io_uring ring;
+	struct io_uring_buf_ring *bufring;
+	uint8_t *bufs;
+	/* size of a receive buffer, URING_RECV_HDRSZ and the query */
+	size_t bufsz;
+	struct uring_udp_socket *socks;
+	size_t sock_count, sock_max;
+	struct uring_send_slot *slots;
+	int free_slot;
+	struct event event;
+} uring_udp;
+
+static void handle_udp_uring(int fd, short event, void* arg);
+
+static struct io_uring_sqe*
+uring_get_sqe(void)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&uring_udp.ring);
+	if(!sqe) {
+		/* submission queue is full, flush it to the kernel */
+		(void)io_uring_submit(&uring_udp.ring);
+		sqe = io_uring_get_sqe(&uring_udp.ring);
+	}
+	return sqe;
+}
+
+static int
+uring_udp_setup(struct nsd *nsd)
+{
+	int r, i;
+
+	if((r = io_uring_queue_init(URING_ENTRIES, &uring_udp.ring, 0)) < 0) {
+		log_msg(LOG_ERR, "io_uring_queue_init failed: %s",
+			strerror(-r));
+		return 0;
+	}
+	uring_udp.bufring = io_uring_setup_buf_ring(&uring_udp.ring,
+		URING_RECV_BUFS, URING_BGID, 0, &r);
+	if(!uring_udp.bufring) {
+		log_msg(LOG_ERR, "io_uring_setup_buf_ring failed: %s",
+			strerror(-r));
+		io_uring_queue_exit(&uring_udp.ring);
+		return 0;
+	}
+	uring_udp.bufsz = URING_RECV_HDRSZ + udp_query_buffer_size(nsd);
+	uring_udp.bufs = region_alloc_array(nsd->server_region,
+		URING_RECV_BUFS, uring_udp.bufsz);
+	for(i = 0; i < URING_RECV_BUFS; i++) {
+		io_uring_buf_ring_add(uring_udp.bufring,
+			uring_udp.bufs + (size_t)i*uring_udp.bufsz,
+			uring_udp.bufsz, i,
+			io_uring_buf_ring_mask(URING_RECV_BUFS), i);
+	}
+	io_uring_buf_ring_advance(uring_udp.bufring, URING_RECV_BUFS);
+
+	uring_udp.slots = region_alloc_array_zero(nsd->server_region,
+		URING_SEND_SLOTS, sizeof(struct uring_send_slot));
+	for(i = 0; i < URING_SEND_SLOTS; i++) {
+		struct uring_send_slot *slot = &uring_udp.slots[i];
+		slot->query = query_create_with_buffer(nsd->server_region,
+			compression_table, compression_table_size,
+			udp_query_buffer_size(nsd));
+		query_reset(slot->query, UDP_MAX_MESSAGE_LEN, 0);
+		slot->msg.msg_iov = &slot->iov;
+		slot->msg.msg_iovlen = 1;
+		slot->next_free = (i+1 < URING_SEND_SLOTS)?i+1:-1;
+	}
+	uring_udp.free_slot = 0;
+
+	uring_udp.sock_max = nsd->ifs;
+	uring_udp.socks = region_alloc_array_zero(nsd->server_region,
+		uring_udp.sock_max, sizeof(struct uring_udp_socket));
+	uring_udp.sock_count = 0;
+	uring_udp.nsd = nsd;
+
+	memset(&uring_udp.event, 0, sizeof(uring_udp.event));
+	event_set(&uring_udp.event, uring_udp.ring.ring_fd,
+		EV_PERSIST|EV_READ, handle_udp_uring, &uring_udp);
+	if(event_base_set(nsd->event_base, &uring_udp.event) != 0 ||
+		event_add(&uring_udp.event, NULL) != 0) {
+		log_msg(LOG_ERR, "nsd udp: io_uring event_add failed");
+		io_uring_free_buf_ring(&uring_udp.ring, uring_udp.bufring,
+			URING_RECV_BUFS, URING_BGID);
+		io_uring_queue_exit(&uring_udp.ring);
+		return 0;
+	}
+	uring_udp.active = 1;
+	return 1;
+}
+
+/* submit the multishot receive for the socket (again) */
+static int
+uring_udp_arm(size_t idx)
+{
+	struct uring_udp_socket *us = &uring_udp.socks[idx];
+	struct io_uring_sqe *sqe = uring_get_sqe();
+	if(!sqe) {
+		log_msg(LOG_ERR, "nsd udp: io_uring submission queue full");
+		return 0;
+	}
+	io_uring_prep_recvmsg_multishot(sqe, us->data->socket->s, &us->msg, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	io_uring_sqe_set_data64(sqe, URING_USERDATA(URING_OP_RECV, idx));
+	return 1;
+}
+
+static int
+uring_add_udp_socket(struct udp_handler_data *data)
+{
+	struct uring_udp_socket *us;
+	int r;
+	if(!uring_udp.active && !uring_udp_setup(data->nsd))
+		return 0;
+	if(uring_udp.sock_count >= uring_udp.sock_max)
+		return 0;
+	us = &uring_udp.socks[uring_udp.sock_count];
+	us->data = data;
+	memset(&us->msg, 0, sizeof(us->msg));
+	us->msg.msg_namelen = (socklen_t)sizeof(struct sockaddr_storage);
+	if(!uring_udp_arm(uring_udp.sock_count))
+		return 0;
+	uring_udp.sock_count++;
+	if((r = io_uring_submit(&uring_udp.ring)) < 0) {
+		log_msg(LOG_ERR, "nsd udp: io_uring_submit failed: %s",
+			strerror(-r));
+	}
+	return 1;
+}
+
+static void
+uring_release_slot(int s)
+{
+	query_reset(uring_udp.slots[s].query, UDP_MAX_MESSAGE_LEN, 0);
+	uring_udp.slots[s].next_free = uring_udp.free_slot;
+	uring_udp.free_slot = s;
+}
+
+static void
+uring_send_answer(struct uring_udp_socket *us, int s)
+{
+	struct uring_send_slot *slot = &uring_udp.slots[s];
+	struct query *q = slot->query;
+	struct io_uring_sqe *sqe;
+
+	slot->iov.iov_base = buffer_begin(q->packet);
+	slot->iov.iov_len = buffer_remaining(q->packet);
+	slot->msg.msg_name = &q->remote_addr;
+	slot->msg.msg_namelen = q->remote_addrlen;
+	if(!(sqe = uring_get_sqe())) {
+		/* send it directly, the ring is not available */
+		if(sendmsg(us->data->socket->s, &slot->msg, 0) == -1) {
+			STATUP(uring_udp.nsd, txerr);
+		}
+		uring_release_slot(s);
+		return;
+	}
+	io_uring_prep_sendmsg(sqe, us->data->socket->s, &slot->msg, 0);
+	io_uring_sqe_set_data64(sqe, URING_USERDATA(URING_OP_SEND, s));
+}
+
+static void
+uring_handle_recv(struct io_uring_cqe *cqe, size_t idx, uint32_t *now_p)
+{
+	struct uring_udp_socket *us = &uring_udp.socks[idx];
+	struct io_uring_recvmsg_out *out;
+	struct query *q;
+	unsigned bid;
+	uint8_t *buf;
+	uint32_t len;
+	int s;
+
+	if(cqe->res < 0) {
+		/* ENOBUFS is when all receive buffers are in use */
+		if(cqe->res != -ENOBUFS) {
+			log_msg(LOG_ERR, "io_uring recvmsg failed: %s",
+				strerror(-cqe->res));
+			STATUP(uring_udp.nsd, rxerr);
+		} else {
+			STATUP(uring_udp.nsd, dropped);
+		}
+		goto rearm;
+	}
+	if(!(cqe->flags & IORING_CQE_F_BUFFER))
+		goto rearm;
+	bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	buf = uring_udp.bufs + (size_t)bid*uring_udp.bufsz;
+
+	out = io_uring_recvmsg_validate(buf, cqe->res, &us->msg);
+	s = uring_udp.free_slot;
+	if(!out || (out->flags & MSG_TRUNC) || s == -1) {
+		STATUP(uring_udp.nsd, dropped);
+		goto release;
+	}
+	q = uring_udp.slots[s].query;
+	uring_udp.free_slot = uring_udp.slots[s].next_free;
+
+	q->remote_addrlen = (out->namelen < sizeof(q->remote_addr))?
+		out->namelen:(socklen_t)sizeof(q->remote_addr);
+	memcpy(&q->remote_addr, io_uring_recvmsg_name(out), q->remote_addrlen);
+	q->client_addrlen = (socklen_t)sizeof(q->client_addr);
+	q->is_proxied = 0;
+	len = io_uring_recvmsg_payload_length(out, cqe->res, &us->msg);
+	if(len > buffer_remaining(q->packet)) {
+		STATUP(uring_udp.nsd, dropped);
+		uring_release_slot(s);
+		goto release;
+	}
+	buffer_write(q->packet, io_uring_recvmsg_payload(out, &us->msg), len);
+
+	if(udp_process_received(us->data, q, now_p)) {
+		uring_send_answer(us, s);
+	} else {
+		STATUP(uring_udp.nsd, dropped);
+		ZTATUP(uring_udp.nsd, q->zone, dropped);
+		uring_release_slot(s);
+	}
+
+release:
+	/* give the buffer back to the kernel */
+	io_uring_buf_ring_add(uring_udp.bufring, buf, uring_udp.bufsz, bid,
+		io_uring_buf_ring_mask(URING_RECV_BUFS), 0);
+	io_uring_buf_ring_advance(uring_udp.bufring, 1);
+rearm:
+	/* the multishot receive stops, on error or buffer shortage */
+	if(!(cqe->flags & IORING_CQE_F_MORE))
+		(void)uring_udp_arm(idx);
+}
+
+static void
+uring_handle_send(struct io_uring_cqe *cqe, int s)
+{
+	if(cqe->res < 0) {
+		int err = -cqe->res;
+		/* don't log transient network full errors, unless
+		 * on higher verbosity */
+		if(!(err == ENOBUFS && verbosity < 1) &&
+#ifdef EWOULDBLOCK
+		   err != EWOULDBLOCK &&
+#endif
+		   err != EAGAIN) {
+			char a[64];
+			addrport2str((void*)&uring_udp.slots[s].query->remote_addr,
+				a, sizeof(a));
+			log_msg(LOG_ERR, "io_uring sendmsg %s failed: %s", a,
+				strerror(err));
+		}
+		STATUP(uring_udp.nsd, txerr);
+	}
+	uring_release_slot(s);
+}
+
+static void
+handle_udp_uring(int ATTR_UNUSED(fd), short event, void* ATTR_UNUSED(arg))
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, count = 0;
+	uint32_t now = 0;
+	int r;
+
+	if (!(event & EV_READ)) {
+		return;
+	}
+	io_uring_for_each_cqe(&uring_udp.ring, head, cqe) {
+		uint64_t u = io_uring_cqe_get_data64(cqe);
+		count++;
+		if(URING_USERDATA_OP(u) == URING_OP_RECV)
+			uring_handle_recv(cqe, URING_USERDATA_IDX(u), &now);
+		else if(URING_USERDATA_OP(u) == URING_OP_SEND)
+			uring_handle_send(cqe, (int)URING_USERDATA_IDX(u));
+	}
+	io_uring_cq_advance(&uring_udp.ring, count);
+	/* send the answers and rearm receives in one system call */
+	if((r = io_uring_submit(&uring_udp.ring)) < 0) {
+		log_msg(LOG_ERR, "nsd udp: io_uring_submit failed: %s",
+			strerror(-r));
+	}
+}
+
+#ifdef MEMCLEAN
+static void
+uring_udp_deinit(void)
+{
+	if(!uring_udp.active)
+		return;
+	event_del(&uring_udp.event);
+	io_uring_free_buf_ring(&uring_udp.ring, uring_udp.bufring,
+		URING_RECV_BUFS, URING_BGID);
+	io_uring_queue_exit(&uring_udp.ring);
+	uring_udp.active = 0;
+}
+#endif /* MEMCLEAN */
+#endif /* USE_IO_URING */
+
+#ifdef HAVE_SSL
+/*
+ * Setup an event for the tcp handler.
+ */
+static void
+tcp_handler_setup_event(struct tcp_handler_data* data, void (*fn)(int, short, void *),
+       int fd, short event)
+{
+	struct timeval timeout;
+	struct event_base* ev_base;
+
+	timeout.tv_sec = data->nsd->tcp_timeout;
+	timeout.tv_usec = 0L;
+
+	ev_base = data->event.ev_base;
+	event_del(&data->event);
+	memset(&data->event, 0, sizeof(data->event));
+	event_set(&data->event, fd, event, fn, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add failed");
+}
+#endif /* HAVE_SSL */
+
+/*
+ * Get a tcp handler for a new connection, from the pool of closed ones,
+ * or allocate a new one. Its fields are set up by the caller.
+ */
+static struct tcp_handler_data*
+tcp_handler_get(struct nsd* nsd)
+{
+	struct tcp_handler_data* data;
+	region_type* region;
+	(void)nsd;
+
+	if(tcp_handler_pool) {
+		data = tcp_handler_pool;
+		tcp_handler_pool = data->next;
+		tcp_handler_pool_count--;
+		if(data->pipeline_in) {
+			buffer_clear(data->pipeline_in);
+			buffer_flip(data->pipeline_in);
+			buffer_clear(data->pipeline_out);
+		}
+		STATUP(nsd, tcp_pool_reused);
+		return data;
+	}
+	/*
+	 * This region is deallocated when the TCP connection is
+	 * closed by the TCP handler, and not kept in the pool.
+	 */
+	region = region_create(xalloc, free);
+	data = (struct tcp_handler_data *) region_alloc(
+		region, sizeof(struct tcp_handler_data));
+	data->region = region;
+	data->query = query_create(region, compression_table,
+		compression_table_size);
+	data->pipeline_in = NULL;
+	data->pipeline_out = NULL;
+	return data;
+}
+
+/*
+ * Put the tcp handler of a closed connection in the pool, or free it
+ * when the pool is full.
+ */
+static void
+tcp_handler_release(struct tcp_handler_data* data)
+{
+	if(tcp_handler_pool_count >= TCP_HANDLER_POOL_SIZE) {
+		region_destroy(data->region);
+		return;
+	}
+	/* end a transfer, and free the query data */
+	query_reset(data->query, TCP_MAX_MESSAGE_LEN, 1);
+	/* query_reset keeps the fields of the connection, the next
+	 * connection with this handler may be plain TCP */
+#ifdef HAVE_SSL
+	data->query->tls = NULL;
+	data->query->tls_auth = NULL;
+	data->query->cert_cn = NULL;
+#endif
+	data->query->is_proxied = 0;
+	data->next = tcp_handler_pool;
+	tcp_handler_pool = data;
+	tcp_handler_pool_count++;
+}
+
+#ifdef USE_TCP_ZEROCOPY
+/* set when SO_ZEROCOPY is not supported, to not try it again */
+static int tcp_zerocopy_unsupported = 0;
+
+/* enable MSG_ZEROCOPY on an accepted tcp connection, for tcp-zerocopy */
+static void
+tcp_zerocopy_setup(struct tcp_handler_data* data, int fd)
+{
+	int on = 1;
+	if(data->nsd->options->tcp_zerocopy <= 0 || tcp_zerocopy_unsupported)
+		return;
+	if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+		log_msg(LOG_WARNING, "setsockopt(..., SO_ZEROCOPY, ...) "
+			"failed: %s, tcp-zerocopy is not used",
+			strerror(errno));
+		tcp_zerocopy_unsupported = 1;
+		return;
+	}
+	data->zc_enabled = 1;
+}
+
+/*
+ * Read the MSG_ZEROCOPY notifications from the error queue of the socket.
+ * Returns true if sends still wait to be released by the kernel.
+ */
+static int
+tcp_zerocopy_pending(struct tcp_handler_data* data, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+	} control;
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct sock_extended_err* serr;
+
+	while(data->zc_done != data->zc_sent) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		if(recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+			if(errno == EINTR)
+				continue;
+			/* EAGAIN, no more notifications for now */
+			break;
+		}
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(!(cmsg->cmsg_level == IPPROTO_IP &&
+				cmsg->cmsg_type == IP_RECVERR) &&
+				!(cmsg->cmsg_level == IPPROTO_IPV6 &&
+				cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+			serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+			if(serr->ee_errno != 0 ||
+				serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			/* the sends from ee_info to ee_data are released */
+			data->zc_done += serr->ee_data - serr->ee_info + 1;
+			/* the kernel made a copy anyway, like on loopback,
+			 * then the notifications are only overhead */
+			if((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED))
+				data->zc_enabled = 0;
+		}
 	}
+	return data->zc_done != data->zc_sent;
 }
 
-#ifdef HAVE_SSL
 /*
- * Setup an event for the tcp handler.
+ * Wait for the kernel to release the packet, the error queue is looked
+ * at after zc_poll msec. The fd is not watched for reading, the next
+ * query of a pipelining client would keep it readable until the release.
  */
 static void
-tcp_handler_setup_event(struct tcp_handler_data* data, void (*fn)(int, short, void *),
-       int fd, short event)
+tcp_zerocopy_wait(struct tcp_handler_data* data, int fd)
 {
 	struct timeval timeout;
 	struct event_base* ev_base;
 
-	timeout.tv_sec = data->nsd->tcp_timeout;
-	timeout.tv_usec = 0L;
-
+	timeout.tv_sec = data->zc_poll / 1000;
+	timeout.tv_usec = (data->zc_poll % 1000)*1000;
 	ev_base = data->event.ev_base;
 	event_del(&data->event);
 	memset(&data->event, 0, sizeof(data->event));
-	event_set(&data->event, fd, event, fn, data);
+	event_set(&data->event, fd, EV_TIMEOUT, handle_tcp_zerocopy, data);
 	if(event_base_set(ev_base, &data->event) != 0)
-		log_msg(LOG_ERR, "event base set failed");
+		log_msg(LOG_ERR, "event base set tcpz failed");
 	if(event_add(&data->event, &timeout) != 0)
-		log_msg(LOG_ERR, "event add failed");
+		log_msg(LOG_ERR, "event add tcpz failed");
 }
-#endif /* HAVE_SSL */
+#endif /* USE_TCP_ZEROCOPY */
 
 static void
 cleanup_tcp_handler(struct tcp_handler_data* data)
 {
+	int fd = data->event.ev_fd;
 	event_del(&data->event);
 #ifdef HAVE_SSL
+	/* while the handshake waits for an async job, the event is on the
+	 * fd of the job, that belongs to OpenSSL */
+	if(data->shake_state == tls_hs_async)
+		fd = SSL_get_fd(data->tls_auth?data->tls_auth:data->tls);
 	if(data->tls) {
 		SSL_shutdown(data->tls);
 		SSL_free(data->tls);
@@ -4218,12 +6889,28 @@ cleanup_tcp_handler(struct tcp_handler_data* data)
 	}
 #endif
 	data->pp2_header_state = pp2_header_none;
-	close(data->event.ev_fd);
+#ifdef USE_TCP_ZEROCOPY
+	data->zc_wait = 0;
+	if(tcp_zerocopy_pending(data, fd)) {
+		/* the kernel still sends from the packet, that is used again
+		 * by the next connection, reset the connection so that the
+		 * close drops the unsent data */
+		struct linger linger;
+		linger.l_onoff = 1;
+		linger.l_linger = 0;
+		(void)setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger,
+			sizeof(linger));
+	}
+#endif
+	close(fd);
 	if(data->prev)
 		data->prev->next = data->next;
 	else	tcp_active_list = data->next;
 	if(data->next)
 		data->next->prev = data->prev;
+	else	tcp_active_last = data->prev;
+	if(data->source_slot != -1)
+		tcp_source_count[data->source_slot]--;
 
 	/*
 	 * Enable the TCP accept handlers when the current number of
@@ -4240,7 +6927,124 @@ cleanup_tcp_handler(struct tcp_handler_data* data)
 	--data->nsd->current_tcp_count;
 	assert(data->nsd->current_tcp_count >= 0);
 
-	region_destroy(data->region);
+	tcp_handler_release(data);
+}
+
+/* the connection has a query, move it to the front of the active list */
+static void
+tcp_active_touch(struct tcp_handler_data* data)
+{
+	data->tcp_idle = 0;
+	if(!data->prev)
+		return;
+	data->prev->next = data->next;
+	if(data->next)
+		data->next->prev = data->prev;
+	else	tcp_active_last = data->prev;
+	data->prev = NULL;
+	data->next = tcp_active_list;
+	tcp_active_list->prev = data;
+	tcp_active_list = data;
+}
+
+/*
+ * Close the connection that had a query least recently, if it waits for
+ * a query, to make room for a new connection with tcp-evict-idle.
+ * Returns 1 if a connection was closed.
+ */
+static int
+tcp_evict_idle(struct nsd* nsd)
+{
+	if(!tcp_active_last || !tcp_active_last->tcp_idle)
+		return 0;
+	STATUP(nsd, tcp_evicted);
+	cleanup_tcp_handler(tcp_active_last);
+	return 1;
+}
+
+/*
+ * The counter for the source address of a new connection, for
+ * tcp-source-limit, for IPv6 the /64 prefix. A counter can be shared by
+ * sources, that then have the limit together.
+ */
+static size_t
+tcp_source_slot(struct nsd* nsd, struct sockaddr* addr)
+{
+	uint32_t h = 0;
+	if(!tcp_source_count) {
+		size_t size = 64;
+		while(size < 4*(size_t)nsd->maximum_tcp_count)
+			size <<= 1;
+		tcp_source_count = xalloc_array_zero(size,
+			sizeof(*tcp_source_count));
+		tcp_source_mask = size - 1;
+	}
+	if(addr->sa_family == AF_INET)
+		h = fasthash32(&((struct sockaddr_in*)addr)->sin_addr,
+			sizeof(struct in_addr), 0);
+#ifdef INET6
+	else if(addr->sa_family == AF_INET6)
+		h = fasthash32(&((struct sockaddr_in6*)addr)->sin6_addr, 8, 0);
+#endif
+	return h & tcp_source_mask;
+}
+
+/* the idle timeout in msec of connections when half of tcp-count is used */
+#define TCP_IDLE_TIMEOUT_MIN 200
+
+/*
+ * The idle timeout in msec of a connection that waits for a query. It is
+ * the tcp-timeout while up to a quarter of tcp-count is in use, and
+ * shrinks linearly to TCP_IDLE_TIMEOUT_MIN when half is in use, so that
+ * the idle connections make room for new ones when it gets busy.
+ */
+static int
+tcp_idle_timeout(struct nsd* nsd)
+{
+	int full = nsd->tcp_timeout * 1000;
+	int quarter = nsd->maximum_tcp_count/4;
+	int half = nsd->maximum_tcp_count/2;
+	int count = nsd->current_tcp_count;
+	if(count > half)
+		return TCP_IDLE_TIMEOUT_MIN;
+	if(count <= quarter || full <= TCP_IDLE_TIMEOUT_MIN)
+		return full;
+	return full - (int)((int64_t)(full - TCP_IDLE_TIMEOUT_MIN) *
+		(count - quarter) / (half - quarter + 1));
+}
+
+/* set the idle timeout of the connection, that waits for a query */
+static void
+tcp_idle_set(struct tcp_handler_data* data)
+{
+#ifdef BIND8_STATS
+	unsigned b = 0;
+#endif
+	/* after a reload, the connection keeps the short timeout to end */
+	if(data->tcp_no_more_queries)
+		return;
+	data->tcp_timeout = tcp_idle_timeout(data->nsd);
+#ifdef BIND8_STATS
+	while(b < TCP_TIMEOUT_BUCKETS-1 && data->tcp_timeout > 100<<b)
+		b++;
+	data->nsd->st->tcp_timeout[b]++;
+#endif
+}
+
+/*
+ * The timeout for the edns-tcp-keepalive option of the answer, in units
+ * of 100 msec, the idle timeout after the answer, or zero if the
+ * connection is closed after it.
+ */
+static uint16_t
+tcp_keepalive(struct tcp_handler_data* data)
+{
+	int t;
+	if(data->tcp_no_more_queries || (data->nsd->tcp_query_count > 0 &&
+		data->query_count >= data->nsd->tcp_query_count))
+		return 0;
+	t = tcp_idle_timeout(data->nsd) / 100;
+	return (uint16_t)(t > 0xffff ? 0xffff : t);
 }
 
 /* Read more data into the buffer for tcp read. Pass the amount of additional
@@ -4276,6 +7080,335 @@ more_read_buf_tcp(int fd, struct tcp_handler_data* data, void* bufpos,
 	return 1;
 }
 
+/*
+ * Answer the complete query in the packet buffer of the connection, the
+ * answer is left in the packet buffer, flipped, with tcplen set. Returns 0
+ * if the query is discarded, and the connection is closed.
+ */
+static int
+tcp_answer_query(struct tcp_handler_data* data, uint32_t* now_p)
+{
+	/* Account... */
+#ifdef BIND8_STATS
+#ifndef INET6
+	STATUP(data->nsd, ctcp);
+#else
+	if (data->query->remote_addr.ss_family == AF_INET) {
+		STATUP(data->nsd, ctcp);
+	} else if (data->query->remote_addr.ss_family == AF_INET6) {
+		STATUP(data->nsd, ctcp6);
+	}
+#endif
+#endif /* BIND8_STATS */
+
+	/* We have a complete query, process it.  */
+
+	/* tcp-query-count: handle query counter ++ */
+	data->query_count++;
+	tcp_active_touch(data);
+
+	buffer_flip(data->query->packet);
+#ifdef USE_DNSTAP
+	/*
+	 * and send TCP-query with found address (local) and client address to dnstap process
+	 */
+	log_addr("query from client", &data->query->client_addr);
+	log_addr("to server (local)", (void*)&data->socket->addr.ai_addr);
+	if(verbosity >= 6 && data->query->is_proxied)
+		log_addr("query via proxy", &data->query->remote_addr);
+	dt_collector_submit_auth_query(data->nsd, (void*)&data->socket->addr.ai_addr, &data->query->client_addr,
+		data->query->client_addrlen, data->query->tcp, data->query->packet);
+#endif /* USE_DNSTAP */
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	data->latency_measure = latency_start(data->nsd, &data->latency_start);
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+	query_trace_start(data->nsd, data->query, 0);
+#endif
+	data->query->tcp_keepalive = tcp_keepalive(data);
+	data->query_state = server_process_query(data->nsd, data->query, now_p);
+	if (data->query_state == QUERY_DISCARDED) {
+		/* Drop the packet and the entire connection... */
+		STATUP(data->nsd, dropped);
+		ZTATUP(data->nsd, data->query->zone, dropped);
+		cleanup_tcp_handler(data);
+		return 0;
+	}
+
+#ifdef BIND8_STATS
+	if (RCODE(data->query->packet) == RCODE_OK
+	    && !AA(data->query->packet))
+	{
+		STATUP(data->nsd, nona);
+		ZTATUP(data->nsd, data->query->zone, nona);
+	}
+#endif /* BIND8_STATS */
+
+#ifdef USE_ZONE_STATS
+#ifndef INET6
+	ZTATUP(data->nsd, data->query->zone, ctcp);
+#else
+	if (data->query->remote_addr.ss_family == AF_INET) {
+		ZTATUP(data->nsd, data->query->zone, ctcp);
+	} else if (data->query->remote_addr.ss_family == AF_INET6) {
+		ZTATUP(data->nsd, data->query->zone, ctcp6);
+	}
+#endif
+#endif /* USE_ZONE_STATS */
+
+	query_add_optional(data->query, data->nsd, now_p);
+	QUERY_TRACE(data->query, QUERY_TRACE_FINAL);
+
+	/* Switch to the tcp write handler.  */
+	buffer_flip(data->query->packet);
+	data->query->tcplen = buffer_remaining(data->query->packet);
+	NSD_PROBE5(answer__encoded, PROBE_QNAME(data->query),
+		data->query->qtype, PROBE_ZONE(data->query->zone),
+		RCODE(data->query->packet), data->query->tcplen);
+#ifdef BIND8_STATS
+	/* Account the rcode & TC... */
+	STATUP2(data->nsd, rcode, RCODE(data->query->packet));
+	ZTATUP2(data->nsd, data->query->zone, rcode, RCODE(data->query->packet));
+	if (TC(data->query->packet)) {
+		STATUP(data->nsd, truncated);
+		ZTATUP(data->nsd, data->query->zone, truncated);
+	}
+#endif /* BIND8_STATS */
+#ifdef USE_DNSTAP
+	/*
+	 * sending TCP-response with found (earlier) address (local) and client address to dnstap process
+	 */
+	log_addr("from server (local)", (void*)&data->socket->addr.ai_addr);
+	log_addr("response to client", &data->query->client_addr);
+	if(verbosity >= 6 && data->query->is_proxied)
+		log_addr("response via proxy", &data->query->remote_addr);
+	dt_collector_submit_auth_response(data->nsd, (void*)&data->socket->addr.ai_addr, &data->query->client_addr,
+		data->query->client_addrlen, data->query->tcp, data->query->packet,
+		data->query->zone);
+#endif /* USE_DNSTAP */
+	return 1;
+}
+
+/* the time from the query to the (first packet of the) answer */
+static void
+tcp_latency_done(struct tcp_handler_data* data)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	if(data->query->traced)
+		query_trace_done(data->nsd, data->query);
+#endif
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	if(data->latency_measure) {
+		/* for a zone transfer, the time to the first packet */
+		struct timespec end;
+		if(clock_gettime(CLOCK_MONOTONIC, &end) == 0)
+			latency_add(data->nsd, data->query->zone, LATENCY_TCP,
+				&data->latency_start, &end);
+		data->latency_measure = 0;
+	}
+#else
+	(void)data;
+#endif
+}
+
+/* the size of the read ahead and of the answers buffer for tcp-pipeline */
+#define TCP_PIPELINE_BUFFER_SIZE 16384
+
+/* set the event of the tcp connection, with the tcp timeout */
+static void
+tcp_pipeline_set_event(struct tcp_handler_data* data, int fd, short event,
+	void (*fn)(int, short, void*))
+{
+	struct timeval timeout;
+	struct event_base* ev_base;
+
+	timeout.tv_sec = data->tcp_timeout / 1000;
+	timeout.tv_usec = (data->tcp_timeout % 1000)*1000;
+	ev_base = data->event.ev_base;
+	event_del(&data->event);
+	memset(&data->event, 0, sizeof(data->event));
+	event_set(&data->event, fd, event, fn, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set tcpp failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add tcpp failed");
+}
+
+/* if a complete message is read ahead */
+static int
+tcp_pipeline_pending(struct tcp_handler_data* data)
+{
+	buffer_type* in = data->pipeline_in;
+	return in && buffer_remaining(in) >= sizeof(uint16_t) &&
+		buffer_remaining(in) >= sizeof(uint16_t) +
+		buffer_read_u16_at(in, buffer_position(in));
+}
+
+/*
+ * Write the answers in pipeline_out. Returns 1 when they are written, 0
+ * if the socket cannot take more now, and -1 if the connection is closed.
+ */
+static int
+tcp_pipeline_write(int fd, struct tcp_handler_data* data)
+{
+	buffer_type* out = data->pipeline_out;
+	ssize_t sent;
+
+	while(buffer_remaining(out) > 0) {
+		sent = write(fd, buffer_current(out), buffer_remaining(out));
+		if(sent == -1) {
+			if(errno == EAGAIN || errno == EINTR)
+				return 0;
+#ifdef ECONNRESET
+			if(verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+#ifdef EPIPE
+				  if(verbosity >= 2 || errno != EPIPE)
+#endif /* EPIPE 'broken pipe' */
+			log_msg(LOG_ERR, "failed writing to tcp: %s", strerror(errno));
+			cleanup_tcp_handler(data);
+			return -1;
+		}
+		buffer_skip(out, sent);
+	}
+	buffer_clear(out);
+	data->pipeline_flush = 0;
+	return 1;
+}
+
+/*
+ * Read what is available on the tcp connection, after the bytes that are
+ * read ahead, and answer the complete queries in it. The answers are put
+ * in pipeline_out, that is written in one go. An answer that does not fit,
+ * or that starts a zone transfer, is left in the query packet and written
+ * after them. A query that is larger than the read ahead buffer is handed
+ * to the normal read of handle_tcp_reading.
+ */
+static void
+tcp_pipeline_handle(int fd, struct tcp_handler_data* data)
+{
+	buffer_type* in = data->pipeline_in, *out = data->pipeline_out;
+	struct query* q = data->query;
+	uint32_t now = 0;
+	ssize_t received;
+	size_t left, len;
+
+	/* move the bytes that are left to the start, and read more */
+	left = buffer_remaining(in);
+	memmove(buffer_begin(in), buffer_current(in), left);
+	buffer_clear(in);
+	buffer_skip(in, left);
+	if(buffer_remaining(in) > 0) {
+		received = read(fd, buffer_current(in), buffer_remaining(in));
+		if(received == -1 && errno != EAGAIN && errno != EINTR) {
+			char buf[48];
+			addr2str(&q->remote_addr, buf, sizeof(buf));
+#ifdef ECONNRESET
+			if (verbosity >= 2 || errno != ECONNRESET)
+#endif /* ECONNRESET */
+			log_msg(LOG_ERR, "failed reading from %s tcp: %s", buf, strerror(errno));
+			cleanup_tcp_handler(data);
+			return;
+		}
+		if(received > 0)
+			buffer_skip(in, received);
+		buffer_flip(in);
+		if(received == 0 && !tcp_pipeline_pending(data)) {
+			/* EOF, and no more queries to answer */
+			cleanup_tcp_handler(data);
+			return;
+		}
+	} else	buffer_flip(in);
+
+	while(buffer_remaining(in) >= sizeof(uint16_t)) {
+		if((data->nsd->tcp_query_count > 0 &&
+			data->query_count >= data->nsd->tcp_query_count) ||
+			(data->query_count > 0 && data->tcp_no_more_queries))
+			break;
+		len = buffer_read_u16_at(in, buffer_position(in));
+		/* the same minimum as for the normal read */
+		if(len < QHEADERSZ + 1 + sizeof(uint16_t) + sizeof(uint16_t)) {
+			VERBOSITY(2, (LOG_WARNING, "packet too small, dropping tcp connection"));
+			cleanup_tcp_handler(data);
+			return;
+		}
+		if(data->query_needs_reset) {
+			query_reset(q, TCP_MAX_MESSAGE_LEN, 1);
+			data->query_needs_reset = 0;
+		}
+		if(len > q->maxlen) {
+			VERBOSITY(2, (LOG_WARNING, "insufficient tcp buffer, dropping connection"));
+			cleanup_tcp_handler(data);
+			return;
+		}
+		if(sizeof(uint16_t) + len > buffer_capacity(in)) {
+			if(buffer_position(out) > 0)
+				break;
+			/* continue with the normal read for this query */
+			buffer_skip(in, sizeof(uint16_t));
+			q->tcplen = len;
+			buffer_set_limit(q->packet, len);
+			left = buffer_remaining(in);
+			buffer_write(q->packet, buffer_current(in), left);
+			data->bytes_transmitted = sizeof(uint16_t) + left;
+			buffer_clear(in);
+			buffer_flip(in);
+			break;
+		}
+		if(buffer_remaining(in) < sizeof(uint16_t) + len)
+			break;
+		buffer_skip(in, sizeof(uint16_t));
+		buffer_write(q->packet, buffer_current(in), len);
+		buffer_skip(in, len);
+		q->tcplen = len;
+		if(!tcp_answer_query(data, &now))
+			return;
+		data->query_needs_reset = 1;
+		if(data->query_state == QUERY_PROCESSED &&
+			buffer_remaining(out) >= sizeof(uint16_t) + q->tcplen) {
+			buffer_write_u16(out, q->tcplen);
+			buffer_write(out, buffer_begin(q->packet), q->tcplen);
+			tcp_latency_done(data);
+			continue;
+		}
+		data->pipeline_answer = 1;
+		break;
+	}
+
+	if(buffer_position(out) > 0) {
+		buffer_flip(out);
+		data->pipeline_flush = 1;
+	}
+	if(data->pipeline_flush || data->pipeline_answer) {
+		data->bytes_transmitted = 0;
+		data->pipeline_resume = 0;
+		tcp_pipeline_set_event(data, fd, EV_PERSIST|EV_WRITE|EV_TIMEOUT,
+			handle_tcp_writing);
+		handle_tcp_writing(fd, EV_WRITE, data);
+		return;
+	}
+	if(data->pipeline_resume) {
+		/* wait for more queries */
+		data->pipeline_resume = 0;
+		tcp_pipeline_set_event(data, fd, EV_PERSIST|EV_READ|EV_TIMEOUT,
+			handle_tcp_reading);
+	}
+}
+
+/* continue with the queries that are read ahead, the socket can take the
+ * answers, this is not done from handle_tcp_writing to not recurse */
+static void
+handle_tcp_pipeline(int fd, short event, void* arg)
+{
+	struct tcp_handler_data* data = (struct tcp_handler_data*)arg;
+	if((event & EV_TIMEOUT)) {
+		/* Connection timed out.  */
+		cleanup_tcp_handler(data);
+		return;
+	}
+	handle_tcp_reading(fd, EV_READ, data);
+}
+
 static void
 handle_tcp_reading(int fd, short event, void* arg)
 {
@@ -4390,6 +7523,18 @@ handle_tcp_reading(int fd, short event, void* arg)
 		data->bytes_transmitted = 0;
 	}
 
+	if(data->nsd->options->tcp_pipeline && data->bytes_transmitted == 0) {
+		if(!data->pipeline_in) {
+			data->pipeline_in = buffer_create(data->region,
+				TCP_PIPELINE_BUFFER_SIZE);
+			buffer_flip(data->pipeline_in);
+			data->pipeline_out = buffer_create(data->region,
+				TCP_PIPELINE_BUFFER_SIZE);
+		}
+		tcp_pipeline_handle(fd, data);
+		return;
+	}
+
 	/*
 	 * Check if we received the leading packet length bytes yet.
 	 */
@@ -4451,92 +7596,8 @@ handle_tcp_reading(int fd, short event, void* arg)
 
 	assert(buffer_position(data->query->packet) == data->query->tcplen);
 
-	/* Account... */
-#ifdef BIND8_STATS
-#ifndef INET6
-	STATUP(data->nsd, ctcp);
-#else
-	if (data->query->remote_addr.ss_family == AF_INET) {
-		STATUP(data->nsd, ctcp);
-	} else if (data->query->remote_addr.ss_family == AF_INET6) {
-		STATUP(data->nsd, ctcp6);
-	}
-#endif
-#endif /* BIND8_STATS */
-
-	/* We have a complete query, process it.  */
-
-	/* tcp-query-count: handle query counter ++ */
-	data->query_count++;
-
-	buffer_flip(data->query->packet);
-#ifdef USE_DNSTAP
-	/*
-	 * and send TCP-query with found address (local) and client address to dnstap process
-	 */
-	log_addr("query from client", &data->query->client_addr);
-	log_addr("to server (local)", (void*)&data->socket->addr.ai_addr);
-	if(verbosity >= 6 && data->query->is_proxied)
-		log_addr("query via proxy", &data->query->remote_addr);
-	dt_collector_submit_auth_query(data->nsd, (void*)&data->socket->addr.ai_addr, &data->query->client_addr,
-		data->query->client_addrlen, data->query->tcp, data->query->packet);
-#endif /* USE_DNSTAP */
-	data->query_state = server_process_query(data->nsd, data->query, &now);
-	if (data->query_state == QUERY_DISCARDED) {
-		/* Drop the packet and the entire connection... */
-		STATUP(data->nsd, dropped);
-		ZTATUP(data->nsd, data->query->zone, dropped);
-		cleanup_tcp_handler(data);
+	if(!tcp_answer_query(data, &now))
 		return;
-	}
-
-#ifdef BIND8_STATS
-	if (RCODE(data->query->packet) == RCODE_OK
-	    && !AA(data->query->packet))
-	{
-		STATUP(data->nsd, nona);
-		ZTATUP(data->nsd, data->query->zone, nona);
-	}
-#endif /* BIND8_STATS */
-
-#ifdef USE_ZONE_STATS
-#ifndef INET6
-	ZTATUP(data->nsd, data->query->zone, ctcp);
-#else
-	if (data->query->remote_addr.ss_family == AF_INET) {
-		ZTATUP(data->nsd, data->query->zone, ctcp);
-	} else if (data->query->remote_addr.ss_family == AF_INET6) {
-		ZTATUP(data->nsd, data->query->zone, ctcp6);
-	}
-#endif
-#endif /* USE_ZONE_STATS */
-
-	query_add_optional(data->query, data->nsd, &now);
-
-	/* Switch to the tcp write handler.  */
-	buffer_flip(data->query->packet);
-	data->query->tcplen = buffer_remaining(data->query->packet);
-#ifdef BIND8_STATS
-	/* Account the rcode & TC... */
-	STATUP2(data->nsd, rcode, RCODE(data->query->packet));
-	ZTATUP2(data->nsd, data->query->zone, rcode, RCODE(data->query->packet));
-	if (TC(data->query->packet)) {
-		STATUP(data->nsd, truncated);
-		ZTATUP(data->nsd, data->query->zone, truncated);
-	}
-#endif /* BIND8_STATS */
-#ifdef USE_DNSTAP
-	/*
-	 * sending TCP-response with found (earlier) address (local) and client address to dnstap process
-	 */
-	log_addr("from server (local)", (void*)&data->socket->addr.ai_addr);
-	log_addr("response to client", &data->query->client_addr);
-	if(verbosity >= 6 && data->query->is_proxied)
-		log_addr("response via proxy", &data->query->remote_addr);
-	dt_collector_submit_auth_response(data->nsd, (void*)&data->socket->addr.ai_addr, &data->query->client_addr,
-		data->query->client_addrlen, data->query->tcp, data->query->packet,
-		data->query->zone);
-#endif /* USE_DNSTAP */
 	data->bytes_transmitted = 0;
 
 	timeout.tv_sec = data->tcp_timeout / 1000;
@@ -4555,6 +7616,65 @@ handle_tcp_reading(int fd, short event, void* arg)
 	handle_tcp_writing(fd, EV_WRITE, data);
 }
 
+/* the second and the bytes of transfers sent in it, for xfr-out-rate */
+static time_t xfr_out_rate_sec = 0;
+static uint64_t xfr_out_rate_bytes = 0;
+
+static void handle_xfr_out_pace(int fd, short event, void* arg);
+
+/*
+ * Account the next packet of the transfer for xfr-out-rate. If the rate
+ * is reached, a timer is set to wait for the next second, the other
+ * connections are served in the meantime, and it returns true.
+ */
+static int
+xfr_out_wait(struct tcp_handler_data* data, int fd)
+{
+	struct timeval now, timeout;
+	struct event_base* ev_base;
+	if(data->nsd->options->xfr_out_rate == 0)
+		return 0;
+	if(gettimeofday(&now, NULL) == -1)
+		return 0;
+	if(now.tv_sec != xfr_out_rate_sec) {
+		xfr_out_rate_sec = now.tv_sec;
+		xfr_out_rate_bytes = 0;
+	}
+	if(xfr_out_rate_bytes < data->nsd->options->xfr_out_rate) {
+		xfr_out_rate_bytes += data->query->tcplen;
+		return 0;
+	}
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 1000000 - now.tv_usec;
+	ev_base = data->event.ev_base;
+	event_del(&data->event);
+	memset(&data->event, 0, sizeof(data->event));
+	event_set(&data->event, fd, EV_TIMEOUT, handle_xfr_out_pace, data);
+	if(event_base_set(ev_base, &data->event) != 0)
+		log_msg(LOG_ERR, "event base set xfr pace failed");
+	if(event_add(&data->event, &timeout) != 0)
+		log_msg(LOG_ERR, "event add xfr pace failed");
+	return 1;
+}
+
+/* the transfer waited for xfr-out-rate, write its next packet */
+static void
+handle_xfr_out_pace(int fd, short ATTR_UNUSED(event), void* arg)
+{
+	struct tcp_handler_data* data = (struct tcp_handler_data*)arg;
+	if(xfr_out_wait(data, fd))
+		return;
+#ifdef HAVE_SSL
+	if(data->tls) {
+		tcp_handler_setup_event(data, handle_tls_writing, fd,
+			EV_PERSIST | EV_WRITE | EV_TIMEOUT);
+		return;
+	}
+#endif
+	tcp_pipeline_set_event(data, fd, EV_PERSIST|EV_WRITE|EV_TIMEOUT,
+		handle_tcp_writing);
+}
+
 static void
 handle_tcp_writing(int fd, short event, void* arg)
 {
@@ -4564,6 +7684,9 @@ handle_tcp_writing(int fd, short event, void* arg)
 	struct timeval timeout;
 	struct event_base* ev_base;
 	uint32_t now = 0;
+#ifdef USE_TCP_ZEROCOPY
+	int zerocopy;
+#endif
 
 	if ((event & EV_TIMEOUT)) {
 		/* Connection timed out.  */
@@ -4573,11 +7696,44 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert((event & EV_WRITE));
 
+#ifdef USE_TCP_ZEROCOPY
+	if(data->zc_wait) {
+		/* the kernel has released the packet */
+		data->zc_wait = 0;
+		goto tcp_packet_released;
+	}
+#endif
+
+	if(data->pipeline_flush) {
+		/* first the answers of tcp-pipeline */
+		if(tcp_pipeline_write(fd, data) != 1)
+			return;
+		if(!data->pipeline_answer)
+			goto tcp_write_done;
+	}
+	data->pipeline_answer = 0;
+#ifdef USE_TCP_ZEROCOPY
+	zerocopy = data->zc_enabled &&
+		q->tcplen >= data->nsd->options->tcp_zerocopy;
+#endif
+
 	if (data->bytes_transmitted < sizeof(q->tcplen)) {
 		/* Writing the response packet length.  */
 		uint16_t n_tcplen = htons(q->tcplen);
 #ifdef HAVE_WRITEV
 		struct iovec iov[2];
+#endif
+#ifdef USE_TCP_ZEROCOPY
+		if(zerocopy) {
+			/* the length is on the stack, it is copied, and the
+			 * packet is sent after it with MSG_ZEROCOPY */
+			sent = send(fd,
+				(const char *) &n_tcplen + data->bytes_transmitted,
+				sizeof(n_tcplen) - data->bytes_transmitted,
+				MSG_MORE);
+		} else {
+#endif
+#ifdef HAVE_WRITEV
 		iov[0].iov_base = (uint8_t*)&n_tcplen + data->bytes_transmitted;
 		iov[0].iov_len = sizeof(n_tcplen) - data->bytes_transmitted; 
 		iov[1].iov_base = buffer_begin(q->packet);
@@ -4588,6 +7744,9 @@ handle_tcp_writing(int fd, short event, void* arg)
 			     (const char *) &n_tcplen + data->bytes_transmitted,
 			     sizeof(n_tcplen) - data->bytes_transmitted);
 #endif /* HAVE_WRITEV */
+#ifdef USE_TCP_ZEROCOPY
+		}
+#endif
 		if (sent == -1) {
 			if (errno == EAGAIN || errno == EINTR) {
 				/*
@@ -4618,12 +7777,30 @@ handle_tcp_writing(int fd, short event, void* arg)
 		}
 
 #ifdef HAVE_WRITEV
-		sent -= sizeof(n_tcplen);
-		/* handle potential 'packet done' code */
-		goto packet_could_be_done;
+#ifdef USE_TCP_ZEROCOPY
+		if(!zerocopy)
+#endif
+		{
+			sent -= sizeof(n_tcplen);
+			/* handle potential 'packet done' code */
+			goto packet_could_be_done;
+		}
 #endif
  	}
  
+#ifdef USE_TCP_ZEROCOPY
+	if(zerocopy) {
+		sent = send(fd, buffer_current(q->packet),
+			buffer_remaining(q->packet), MSG_ZEROCOPY);
+		if(sent > 0)
+			data->zc_sent++;
+		else if(sent == -1 && errno == ENOBUFS) {
+			/* no memory for the notification, send a copy */
+			sent = write(fd, buffer_current(q->packet),
+				buffer_remaining(q->packet));
+		}
+	} else
+#endif
 	sent = write(fd,
 		     buffer_current(q->packet),
 		     buffer_remaining(q->packet));
@@ -4662,6 +7839,19 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	assert(data->bytes_transmitted == q->tcplen + sizeof(q->tcplen));
 
+	tcp_latency_done(data);
+#ifdef USE_TCP_ZEROCOPY
+	if(tcp_zerocopy_pending(data, fd)) {
+		/* the packet is used for the next answer or transfer packet
+		 * after the kernel releases it */
+		data->zc_wait = 1;
+		data->zc_poll = TCP_ZEROCOPY_POLL_MIN;
+		data->zc_waited = 0;
+		tcp_zerocopy_wait(data, fd);
+		return;
+	}
+  tcp_packet_released:
+#endif
 	if (data->query_state == QUERY_IN_AXFR ||
 		data->query_state == QUERY_IN_IXFR) {
 		/* Continue processing AXFR and writing back results.  */
@@ -4676,6 +7866,8 @@ handle_tcp_writing(int fd, short event, void* arg)
 			buffer_flip(q->packet);
 			q->tcplen = buffer_remaining(q->packet);
 			data->bytes_transmitted = 0;
+			if(xfr_out_wait(data, fd))
+				return;
 			/* Reset timeout.  */
 			timeout.tv_sec = data->tcp_timeout / 1000;
 			timeout.tv_usec = (data->tcp_timeout % 1000)*1000;
@@ -4697,6 +7889,9 @@ handle_tcp_writing(int fd, short event, void* arg)
 		}
 	}
 
+  tcp_write_done:
+	/* a transfer is done, it no longer counts for the xfr-out limits */
+	xfr_out_done(q);
 	/*
 	 * Done sending, wait for the next request to arrive on the
 	 * TCP socket by installing the TCP read handler.
@@ -4710,7 +7905,17 @@ handle_tcp_writing(int fd, short event, void* arg)
 
 	data->bytes_transmitted = 0;
 	data->query_needs_reset = 1;
+	data->tcp_idle = 1;
+
+	if(tcp_pipeline_pending(data)) {
+		/* answer the queries that are read ahead */
+		data->pipeline_resume = 1;
+		tcp_pipeline_set_event(data, fd, EV_PERSIST|EV_WRITE|EV_TIMEOUT,
+			handle_tcp_pipeline);
+		return;
+	}
 
+	tcp_idle_set(data);
 	timeout.tv_sec = data->tcp_timeout / 1000;
 	timeout.tv_usec = (data->tcp_timeout % 1000)*1000;
 	ev_base = data->event.ev_base;
@@ -4724,6 +7929,29 @@ handle_tcp_writing(int fd, short event, void* arg)
 		log_msg(LOG_ERR, "event add tcpw failed");
 }
 
+#ifdef USE_TCP_ZEROCOPY
+static void
+handle_tcp_zerocopy(int fd, short event, void* arg)
+{
+	struct tcp_handler_data* data = (struct tcp_handler_data*)arg;
+	(void)event;
+	if(tcp_zerocopy_pending(data, fd)) {
+		data->zc_waited += data->zc_poll;
+		if(data->zc_waited >= data->tcp_timeout) {
+			/* Connection timed out.  */
+			cleanup_tcp_handler(data);
+			return;
+		}
+		/* look again later, the peer has not acknowledged the data */
+		if(data->zc_poll < TCP_ZEROCOPY_POLL_MAX)
+			data->zc_poll *= 2;
+		tcp_zerocopy_wait(data, fd);
+		return;
+	}
+	handle_tcp_writing(fd, EV_WRITE, data);
+}
+#endif /* USE_TCP_ZEROCOPY */
+
 #ifdef HAVE_SSL
 /** create SSL object and associate fd */
 static SSL*
@@ -4744,11 +7972,48 @@ incoming_ssl_fd(SSL_CTX* ctx, int fd)
 	return ssl;
 }
 
+#ifdef SSL_MODE_ASYNC
+/* the async job of the TLS handshake is done, continue the handshake */
+static void
+handle_tls_async(int ATTR_UNUSED(afd), short event, void* arg)
+{
+	struct tcp_handler_data* data = (struct tcp_handler_data*)arg;
+	SSL* ssl = data->tls_auth?data->tls_auth:data->tls;
+	if((event & EV_TIMEOUT)) {
+		cleanup_tcp_handler(data);
+		return;
+	}
+	(void)tls_handshake(data, SSL_get_fd(ssl), 0);
+}
+
+/* wait for the async job of the handshake on its fd, returns 0 if there
+ * is no fd to wait on */
+static int
+tls_handshake_wait_async(struct tcp_handler_data* data, SSL* ssl)
+{
+	OSSL_ASYNC_FD afd;
+	size_t numfds = 0;
+	if(!SSL_get_all_async_fds(ssl, NULL, &numfds) || numfds != 1 ||
+		!SSL_get_all_async_fds(ssl, &afd, &numfds))
+		return 0;
+	if(data->shake_state != tls_hs_async) {
+		data->shake_state = tls_hs_async;
+		STATUP(data->nsd, tls_async);
+	}
+	tcp_handler_setup_event(data, handle_tls_async, afd,
+		EV_PERSIST|EV_TIMEOUT|EV_READ);
+	return 1;
+}
+#endif /* SSL_MODE_ASYNC */
+
 /** TLS handshake to upgrade TCP connection */
 static int
 tls_handshake(struct tcp_handler_data* data, int fd, int writing)
 {
 	int r;
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	struct timespec hs_start, hs_end;
+#endif
 	if(data->shake_state == tls_hs_read_event) {
 		/* read condition satisfied back to writing */
 		tcp_handler_setup_event(data, handle_tls_writing, fd, EV_PERSIST|EV_TIMEOUT|EV_WRITE);
@@ -4764,10 +8029,21 @@ tls_handshake(struct tcp_handler_data* data, int fd, int writing)
 
 	/* (continue to) setup the TLS connection */
 	ERR_clear_error();
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	if(clock_gettime(CLOCK_MONOTONIC, &hs_start) != 0)
+		memset(&hs_start, 0, sizeof(hs_start));
+#endif
 	if(data->tls_auth)
 		r = SSL_do_handshake(data->tls_auth);
 	else
 		r = SSL_do_handshake(data->tls);
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	if(hs_start.tv_sec != 0 &&
+		clock_gettime(CLOCK_MONOTONIC, &hs_end) == 0)
+		data->nsd->st->tls_handshake_usec +=
+			(stc_type)(hs_end.tv_sec - hs_start.tv_sec)*1000000 +
+			(hs_end.tv_nsec - hs_start.tv_nsec)/1000;
+#endif
 
 	if(r != 1) {
 		int want;
@@ -4775,6 +8051,12 @@ tls_handshake(struct tcp_handler_data* data, int fd, int writing)
 			want = SSL_get_error(data->tls_auth, r);
 		else
 			want = SSL_get_error(data->tls, r);
+#ifdef SSL_MODE_ASYNC
+		if(want == SSL_ERROR_WANT_ASYNC &&
+			tls_handshake_wait_async(data,
+			data->tls_auth?data->tls_auth:data->tls))
+			return 1;
+#endif
 		if(want == SSL_ERROR_WANT_READ) {
 			if(data->shake_state == tls_hs_read) {
 				/* try again later */
@@ -4810,13 +8092,25 @@ tls_handshake(struct tcp_handler_data* data, int fd, int writing)
 		}
 	}
 
+	if(SSL_session_reused(data->tls_auth?data->tls_auth:data->tls))
+		STATUP(data->nsd, tls_resumed);
+	else	STATUP(data->nsd, tls_full);
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+	/* with kernel TLS, SSL_read and SSL_write do plain system calls */
+	if(BIO_get_ktls_send(SSL_get_wbio(data->tls_auth?data->tls_auth:
+		data->tls)))
+		STATUP(data->nsd, tls_ktls);
+#endif
 	/* Use to log successful upgrade for testing - could be removed*/
 	if(data->tls_auth)
 		VERBOSITY(5, (LOG_INFO, "TLS-AUTH handshake succeeded."));
 	else
 		VERBOSITY(5, (LOG_INFO, "TLS handshake succeeded."));
 	/* set back to the event we need to have when reading (or writing) */
-	if(data->shake_state == tls_hs_read && writing) {
+	if(data->shake_state == tls_hs_async) {
+		/* the event is on the async fd, read the query */
+		tcp_handler_setup_event(data, handle_tls_reading, fd, EV_PERSIST|EV_TIMEOUT|EV_READ);
+	} else if(data->shake_state == tls_hs_read && writing) {
 		tcp_handler_setup_event(data, handle_tls_writing, fd, EV_PERSIST|EV_TIMEOUT|EV_WRITE);
 	} else if(data->shake_state == tls_hs_write && !writing) {
 		tcp_handler_setup_event(data, handle_tls_reading, fd, EV_PERSIST|EV_TIMEOUT|EV_READ);
@@ -5058,6 +8352,7 @@ handle_tls_reading(int fd, short event, void* arg)
 
 	/* tcp-query-count: handle query counter ++ */
 	data->query_count++;
+	tcp_active_touch(data);
 
 	buffer_flip(data->query->packet);
 #ifdef USE_DNSTAP
@@ -5071,6 +8366,10 @@ handle_tls_reading(int fd, short event, void* arg)
 	dt_collector_submit_auth_query(data->nsd, (void*)&data->socket->addr.ai_addr, &data->query->client_addr,
 		data->query->client_addrlen, data->query->tcp, data->query->packet);
 #endif /* USE_DNSTAP */
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	data->latency_measure = latency_start(data->nsd, &data->latency_start);
+#endif
+	data->query->tcp_keepalive = tcp_keepalive(data);
 	data->query_state = server_process_query(data->nsd, data->query, &now);
 	if (data->query_state == QUERY_DISCARDED) {
 		/* Drop the packet and the entire connection... */
@@ -5106,6 +8405,9 @@ handle_tls_reading(int fd, short event, void* arg)
 	/* Switch to the tcp write handler.  */
 	buffer_flip(data->query->packet);
 	data->query->tcplen = buffer_remaining(data->query->packet);
+	NSD_PROBE5(answer__encoded, PROBE_QNAME(data->query),
+		data->query->qtype, PROBE_ZONE(data->query->zone),
+		RCODE(data->query->packet), data->query->tcplen);
 #ifdef BIND8_STATS
 	/* Account the rcode & TC... */
 	STATUP2(data->nsd, rcode, RCODE(data->query->packet));
@@ -5236,6 +8538,16 @@ handle_tls_writing(int fd, short event, void* arg)
 
 	assert(data->bytes_transmitted == q->tcplen + sizeof(q->tcplen));
 
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	if(data->latency_measure) {
+		/* for a zone transfer, the time to the first packet */
+		struct timespec end;
+		if(clock_gettime(CLOCK_MONOTONIC, &end) == 0)
+			latency_add(data->nsd, q->zone, LATENCY_TLS,
+				&data->latency_start, &end);
+		data->latency_measure = 0;
+	}
+#endif
 	if (data->query_state == QUERY_IN_AXFR ||
 		data->query_state == QUERY_IN_IXFR) {
 		/* Continue processing AXFR and writing back results.  */
@@ -5250,6 +8562,8 @@ handle_tls_writing(int fd, short event, void* arg)
 			buffer_flip(q->packet);
 			q->tcplen = buffer_remaining(q->packet);
 			data->bytes_transmitted = 0;
+			if(xfr_out_wait(data, fd))
+				return;
 			/* Reset to writing mode.  */
 			tcp_handler_setup_event(data, handle_tls_writing, fd, EV_PERSIST | EV_WRITE | EV_TIMEOUT);
 
@@ -5261,6 +8575,8 @@ handle_tls_writing(int fd, short event, void* arg)
 		}
 	}
 
+	/* a transfer is done, it no longer counts for the xfr-out limits */
+	xfr_out_done(q);
 	/*
 	 * Done sending, wait for the next request to arrive on the
 	 * TCP socket by installing the TCP read handler.
@@ -5274,6 +8590,8 @@ handle_tls_writing(int fd, short event, void* arg)
 
 	data->bytes_transmitted = 0;
 	data->query_needs_reset = 1;
+	data->tcp_idle = 1;
+	tcp_idle_set(data);
 
 	tcp_handler_setup_event(data, handle_tls_reading, fd, EV_PERSIST | EV_READ | EV_TIMEOUT);
 }
@@ -5310,19 +8628,17 @@ static int perform_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
 }
 
 /*
- * Handle an incoming TCP connection.  The connection is accepted and
- * a new TCP reader event handler is added.  The TCP handler
- * is responsible for cleanup when the connection is closed.
+ * Accept one incoming TCP connection, and add a new TCP reader event
+ * handler for it.  The TCP handler is responsible for cleanup when the
+ * connection is closed.  Returns 0 when no more connections are to be
+ * accepted now, because there are none or the tcp-count is reached.
  */
-static void
-handle_tcp_accept(int fd, short event, void* arg)
+static int
+tcp_accept_one(struct tcp_accept_handler_data *data, int fd)
 {
-	struct tcp_accept_handler_data *data
-		= (struct tcp_accept_handler_data *) arg;
 	int s;
 	int reject = 0;
 	struct tcp_handler_data *tcp_data;
-	region_type *tcp_region;
 #ifdef INET6
 	struct sockaddr_storage addr;
 #else
@@ -5330,15 +8646,15 @@ handle_tcp_accept(int fd, short event, void* arg)
 #endif
 	socklen_t addrlen;
 	struct timeval timeout;
-
-	if (!(event & EV_READ)) {
-		return;
-	}
+	ssize_t slot = -1;
+#ifdef BIND8_STATS
+	unsigned b;
+#endif
 
 	if (data->nsd->current_tcp_count >= data->nsd->maximum_tcp_count) {
 		reject = data->nsd->options->tcp_reject_overflow;
-		if (!reject) {
-			return;
+		if (!reject && !data->nsd->options->tcp_evict_idle) {
+			return 0;
 		}
 	}
 
@@ -5380,25 +8696,32 @@ handle_tcp_accept(int fd, short event, void* arg)
 			) {
 			log_msg(LOG_ERR, "accept failed: %s", strerror(errno));
 		}
-		return;
+		return 0;
+	}
+	STATUP(data->nsd, tcp_accepted);
+
+	if (data->nsd->current_tcp_count >= data->nsd->maximum_tcp_count &&
+		data->nsd->options->tcp_evict_idle) {
+		/* make room, if no connection waits for a query, it is the
+		 * new connection that is closed */
+		reject = !tcp_evict_idle(data->nsd);
+	}
+	if (!reject && data->nsd->options->tcp_source_limit > 0) {
+		slot = (ssize_t)tcp_source_slot(data->nsd, (struct sockaddr*)&addr);
+		if (tcp_source_count[slot] >=
+			data->nsd->options->tcp_source_limit) {
+			STATUP(data->nsd, tcp_source_limited);
+			reject = 1;
+		}
 	}
 
 	if (reject) {
 		shutdown(s, SHUT_RDWR);
 		close(s);
-		return;
+		return 1;
 	}
 
-	/*
-	 * This region is deallocated when the TCP connection is
-	 * closed by the TCP handler.
-	 */
-	tcp_region = region_create(xalloc, free);
-	tcp_data = (struct tcp_handler_data *) region_alloc(
-		tcp_region, sizeof(struct tcp_handler_data));
-	tcp_data->region = tcp_region;
-	tcp_data->query = query_create(tcp_region, compressed_dname_offsets,
-		compression_table_size, compressed_dnames);
+	tcp_data = tcp_handler_get(data->nsd);
 	tcp_data->nsd = data->nsd;
 	tcp_data->query_count = 0;
 #ifdef HAVE_SSL
@@ -5410,6 +8733,9 @@ handle_tcp_accept(int fd, short event, void* arg)
 	tcp_data->query_needs_reset = 1;
 	tcp_data->pp2_enabled = data->pp2_enabled;
 	tcp_data->pp2_header_state = pp2_header_none;
+#if defined(BIND8_STATS) && defined(HAVE_CLOCK_GETTIME)
+	tcp_data->latency_measure = 0;
+#endif
 	tcp_data->prev = NULL;
 	tcp_data->next = NULL;
 
@@ -5424,11 +8750,28 @@ handle_tcp_accept(int fd, short event, void* arg)
 	tcp_data->query->is_proxied = 0;
 
 	tcp_data->tcp_no_more_queries = 0;
-	tcp_data->tcp_timeout = data->nsd->tcp_timeout * 1000;
-	if (data->nsd->current_tcp_count > data->nsd->maximum_tcp_count/2) {
-		/* very busy, give smaller timeout */
-		tcp_data->tcp_timeout = 200;
-	}
+	tcp_data->pipeline_flush = 0;
+	tcp_data->pipeline_answer = 0;
+	tcp_data->pipeline_resume = 0;
+	tcp_data->tcp_idle = 1;
+	tcp_data->source_slot = -1;
+#ifdef USE_TCP_ZEROCOPY
+	tcp_data->zc_enabled = 0;
+	tcp_data->zc_sent = 0;
+	tcp_data->zc_done = 0;
+	tcp_data->zc_wait = 0;
+	tcp_data->zc_poll = 0;
+	tcp_data->zc_waited = 0;
+#endif
+	/* when busy, give smaller timeout */
+	tcp_idle_set(tcp_data);
+#ifdef BIND8_STATS
+	b = (unsigned)(data->nsd->current_tcp_count * TCP_OCCUPANCY_BUCKETS /
+		(data->nsd->maximum_tcp_count ? data->nsd->maximum_tcp_count : 1));
+	if(b > TCP_OCCUPANCY_BUCKETS-1)
+		b = TCP_OCCUPANCY_BUCKETS-1;
+	data->nsd->st->tcp_occupancy[b]++;
+#endif
 	memset(&tcp_data->event, 0, sizeof(tcp_data->event));
 	timeout.tv_sec = tcp_data->tcp_timeout / 1000;
 	timeout.tv_usec = (tcp_data->tcp_timeout % 1000)*1000;
@@ -5443,7 +8786,8 @@ handle_tcp_accept(int fd, short event, void* arg)
 		tcp_data->tls = incoming_ssl_fd(tcp_data->nsd->tls_ctx, s);
 		if(!tcp_data->tls) {
 			close(s);
-			return;
+			tcp_handler_release(tcp_data);
+			return 1;
 		}
 		tcp_data->query->tls = tcp_data->tls;
 		tcp_data->shake_state = tls_hs_read;
@@ -5454,7 +8798,8 @@ handle_tcp_accept(int fd, short event, void* arg)
 		tcp_data->tls_auth = incoming_ssl_fd(tcp_data->nsd->tls_auth_ctx, s);
 		if(!tcp_data->tls_auth) {
 			close(s);
-			return;
+			tcp_handler_release(tcp_data);
+			return 1;
 		}
 		tcp_data->query->tls_auth = tcp_data->tls_auth;
 		tcp_data->shake_state = tls_hs_read;
@@ -5466,26 +8811,33 @@ handle_tcp_accept(int fd, short event, void* arg)
 		memset(&tcp_data->event, 0, sizeof(tcp_data->event));
 		event_set(&tcp_data->event, s, EV_PERSIST | EV_READ | EV_TIMEOUT,
 			  handle_tcp_reading, tcp_data);
+#ifdef USE_TCP_ZEROCOPY
+		tcp_zerocopy_setup(tcp_data, s);
+#endif
 #ifdef HAVE_SSL
 	}
 #endif
 	if(event_base_set(data->event.ev_base, &tcp_data->event) != 0) {
 		log_msg(LOG_ERR, "cannot set tcp event base");
 		close(s);
-		region_destroy(tcp_region);
-		return;
+		tcp_handler_release(tcp_data);
+		return 0;
 	}
 	if(event_add(&tcp_data->event, &timeout) != 0) {
 		log_msg(LOG_ERR, "cannot add tcp to event base");
 		close(s);
-		region_destroy(tcp_region);
-		return;
+		tcp_handler_release(tcp_data);
+		return 0;
 	}
 	if(tcp_active_list) {
 		tcp_active_list->prev = tcp_data;
 		tcp_data->next = tcp_active_list;
-	}
+	} else	tcp_active_last = tcp_data;
 	tcp_active_list = tcp_data;
+	if(slot != -1) {
+		tcp_data->source_slot = slot;
+		tcp_source_count[slot]++;
+	}
 
 	/*
 	 * Keep track of the total number of TCP handlers installed so
@@ -5495,21 +8847,95 @@ handle_tcp_accept(int fd, short event, void* arg)
 	 * If tcp-reject-overflow is enabled, however, then we do not
 	 * change the handler event type; we keep it as-is and accept
 	 * overflow TCP connections only so that we can forcibly kill
-	 * them off.
+	 * them off. With tcp-evict-idle the accept continues as well, an
+	 * idle connection is closed to make room.
 	 */
 	++data->nsd->current_tcp_count;
 	if (!data->nsd->options->tcp_reject_overflow &&
+	    !data->nsd->options->tcp_evict_idle &&
 	     data->nsd->current_tcp_count == data->nsd->maximum_tcp_count)
 	{
 		configure_handler_event_types(0);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Handle incoming TCP connections.  Up to TCP_ACCEPT_BATCH connections
+ * are accepted per event, so that a busy socket does not need a pass of
+ * the event loop for every connection, and the other sockets are served
+ * after the batch.
+ */
+static void
+handle_tcp_accept(int fd, short event, void* arg)
+{
+	struct tcp_accept_handler_data *data
+		= (struct tcp_accept_handler_data *) arg;
+	int i;
+
+	if (!(event & EV_READ)) {
+		return;
+	}
+	for (i = 0; i < TCP_ACCEPT_BATCH; i++) {
+		if (!tcp_accept_one(data, fd))
+			break;
+	}
+}
+
+/*
+ * Wait until the children in FDS have acked the command, by writing it
+ * back or by closing the channel, or until TIMEOUT seconds have passed.
+ * The children are waited for together, so they work on the command at
+ * the same time, and the wait is not the sum of their times.
+ */
+static void
+wait_children_ack(struct nsd* nsd, struct pollfd* fds, size_t num,
+	int timeout)
+{
+	struct timeval start, now;
+	size_t i, waiting = num;
+	int elapsed = 0, ret;
+
+	if(gettimeofday(&start, NULL) == -1)
+		memset(&start, 0, sizeof(start));
+	while(waiting > 0 && elapsed < timeout*1000) {
+		ret = poll(fds, (nfds_t)num, timeout*1000 - elapsed);
+		if(ret == -1) {
+			if(errno != EAGAIN && errno != EINTR)
+				return;
+			if(errno == EINTR && (nsd->signal_hint_quit ||
+				nsd->signal_hint_shutdown))
+				return;
+		}
+		for(i = 0; ret > 0 && i < num; i++) {
+			sig_atomic_t ack;
+			if(fds[i].fd == -1 || !fds[i].revents)
+				continue;
+			if(read(fds[i].fd, &ack, sizeof(ack)) == -1 &&
+				(errno == EAGAIN || errno == EINTR))
+				continue;
+			/* the ack, or the closed channel, or an error */
+			fds[i].fd = -1;
+			waiting--;
+		}
+		if(gettimeofday(&now, NULL) == -1)
+			return;
+		elapsed = (int)((now.tv_sec - start.tv_sec)*1000 +
+			(now.tv_usec - start.tv_usec)/1000);
 	}
 }
 
 static void
 send_children_command(struct nsd* nsd, sig_atomic_t command, int timeout)
 {
-	size_t i;
+	size_t i, num = 0;
+	struct pollfd* fds = NULL;
 	assert(nsd->server_kind == NSD_SERVER_MAIN && nsd->this_child == 0);
+	if (timeout > 0)
+		fds = (struct pollfd*)xalloc_array_zero(nsd->child_count,
+			sizeof(*fds));
+	/* send the command to all the children first */
 	for (i = 0; i < nsd->child_count; ++i) {
 		if (nsd->children[i].pid > 0 && nsd->children[i].child_fd != -1) {
 			if (write(nsd->children[i].child_fd,
@@ -5522,10 +8948,17 @@ send_children_command(struct nsd* nsd, sig_atomic_t command, int timeout)
 					(int) nsd->children[i].pid,
 					strerror(errno));
 			} else if (timeout > 0) {
-				(void)block_read(NULL,
-					nsd->children[i].child_fd,
-					&command, sizeof(command), timeout);
+				fds[num].fd = nsd->children[i].child_fd;
+				fds[num].events = POLLIN;
+				num++;
 			}
+		}
+	}
+	if (num > 0)
+		wait_children_ack(nsd, fds, num, timeout);
+	free(fds);
+	for (i = 0; i < nsd->child_count; ++i) {
+		if (nsd->children[i].pid > 0 && nsd->children[i].child_fd != -1) {
 			fsync(nsd->children[i].child_fd);
 			close(nsd->children[i].child_fd);
 			nsd->children[i].child_fd = -1;
@@ -5555,6 +8988,9 @@ set_children_stats(struct nsd* nsd)
 	assert(nsd->server_kind == NSD_SERVER_MAIN && nsd->this_child == 0);
 	DEBUG(DEBUG_IPC, 1, (LOG_INFO, "parent set stats to send to children"));
 	for (i = 0; i < nsd->child_count; ++i) {
+		/* a retired server may not have been started */
+		if(!nsd->children[i].handler)
+			continue;
 		nsd->children[i].need_to_send_STATS = 1;
 		nsd->children[i].handler->event_types |= NETIO_EVENT_WRITE;
 	}
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "siphash.h"
 
 /* default: SipHash-2-4 */
 #define cROUNDS 2
@@ -168,3 +169,75 @@ int siphash(const uint8_t *in, const size_t inlen, const uint8_t *k,
 
     return 0;
 }
+
+void siphash_key_setup(struct siphash_key* sk, const uint8_t *k)
+{
+    uint64_t k0 = U8TO64_LE(k);
+    uint64_t k1 = U8TO64_LE(k + 8);
+    sk->v0 = 0x736f6d6570736575ULL ^ k0;
+    sk->v1 = 0x646f72616e646f6dULL ^ k1;
+    sk->v2 = 0x6c7967656e657261ULL ^ k0;
+    sk->v3 = 0x7465646279746573ULL ^ k1;
+}
+
+void siphash_key_hash(const struct siphash_key* sk, const uint8_t *in,
+                      size_t inlen, uint8_t *out)
+{
+    uint64_t v0 = sk->v0;
+    uint64_t v1 = sk->v1;
+    uint64_t v2 = sk->v2;
+    uint64_t v3 = sk->v3;
+    uint64_t m;
+    const uint8_t *end = in + inlen - (inlen % sizeof(uint64_t));
+    const int left = inlen & 7;
+    uint64_t b = ((uint64_t)inlen) << 56;
+
+    /* the rounds are written out, cROUNDS is 2 and dROUNDS is 4 */
+    for (; in != end; in += 8) {
+        m = U8TO64_LE(in);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    switch (left) {
+    case 7:
+        b |= ((uint64_t)in[6]) << 48;
+	/* fallthrough */
+    case 6:
+        b |= ((uint64_t)in[5]) << 40;
+	/* fallthrough */
+    case 5:
+        b |= ((uint64_t)in[4]) << 32;
+	/* fallthrough */
+    case 4:
+        b |= ((uint64_t)in[3]) << 24;
+	/* fallthrough */
+    case 3:
+        b |= ((uint64_t)in[2]) << 16;
+	/* fallthrough */
+    case 2:
+        b |= ((uint64_t)in[1]) << 8;
+	/* fallthrough */
+    case 1:
+        b |= ((uint64_t)in[0]);
+        break;
+    case 0:
+        break;
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    b = v0 ^ v1 ^ v2 ^ v3;
+    U64TO8_LE(out, b);
+}
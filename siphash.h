@@ -0,0 +1,31 @@
+/*
+ * siphash.h -- SipHash-2-4 for DNS cookies.
+ *
+ * Copyright (c) 2024, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+/* the SipHash state after the key is set in it, so that hashes with the
+ * same key do not have to read the key again */
+struct siphash_key {
+	uint64_t v0, v1, v2, v3;
+};
+
+/* SipHash-2-4 of in, with key k of 16 bytes, to out of outlen 8 or 16 */
+int siphash(const uint8_t *in, const size_t inlen, const uint8_t *k,
+	uint8_t *out, const size_t outlen);
+
+/* set up the SipHash state for the key k of 16 bytes */
+void siphash_key_setup(struct siphash_key* sk, const uint8_t *k);
+
+/* SipHash-2-4 of in with the key state, to out of 8 bytes. The same as
+ * siphash() with outlen 8 */
+void siphash_key_hash(const struct siphash_key* sk, const uint8_t *in,
+	size_t inlen, uint8_t *out);
+
+#endif /* SIPHASH_H */
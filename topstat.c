@@ -0,0 +1,181 @@
+/*
+ * topstat.c -- heavy hitter statistics of query names, sources and zones
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Every server process counts the queries in a count-min sketch, per query
+ * name, source prefix and zone. The estimate from the sketch is compared
+ * with that of the candidates in two slots of a small table, picked by the
+ * hash values, and a key with a larger estimate replaces the smallest
+ * candidate. This costs two hash values and a few counter increments per
+ * query, with a fixed amount of memory. The remote control merges the
+ * tables of the server processes.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "topstat.h"
+#include "fasthash.h"
+#include "query.h"
+#include "namedb.h"
+
+/* add the key to the sketch */
+static void
+topstat_sketch_add(struct topstat_sketch* s, const uint8_t* key, size_t len)
+{
+	uint32_t h1 = fasthash32(key, len, 0);
+	uint32_t h2 = fasthash32(key, len, 0x9e3779b9) | 1;
+	uint32_t est = 0xffffffff;
+	struct topstat_entry* e, *e2;
+	int d;
+
+	for(d = 0; d < TOPSTAT_DEPTH; d++) {
+		uint32_t* c = &s->cm[d][(h1 + (uint32_t)d*h2) % TOPSTAT_WIDTH];
+		if(*c != 0xffffffff)
+			(*c)++;
+		if(*c < est)
+			est = *c;
+	}
+
+	e = &s->top[h1 % TOPSTAT_SIZE];
+	e2 = &s->top[h2 % TOPSTAT_SIZE];
+	if(e->len == len && memcmp(e->key, key, len) == 0) {
+		e->count = est;
+		return;
+	}
+	if(e2->len == len && memcmp(e2->key, key, len) == 0) {
+		e2->count = est;
+		return;
+	}
+	if(e2->count < e->count)
+		e = e2;
+	if(est > e->count) {
+		e->count = est;
+		e->len = (uint16_t)len;
+		memcpy(e->key, key, len);
+	}
+}
+
+void
+topstat_add(struct topstat* ts, struct query* q)
+{
+	uint8_t src[1+16];
+	struct sockaddr* sa = (struct sockaddr*)&q->client_addr;
+
+	if(ts->reset != ts->reset_done) {
+		memset(ts->kind, 0, sizeof(ts->kind));
+		ts->reset_done = ts->reset;
+	}
+	if(q->qname)
+		topstat_sketch_add(&ts->kind[TOPSTAT_QNAME],
+			dname_name(q->qname), q->qname->name_size);
+	if(q->zone && q->zone->apex)
+		topstat_sketch_add(&ts->kind[TOPSTAT_ZONE],
+			dname_name(domain_dname(q->zone->apex)),
+			domain_dname(q->zone->apex)->name_size);
+	if(sa->sa_family == AF_INET) {
+		src[0] = 4;
+		memcpy(src+1, &((struct sockaddr_in*)sa)->sin_addr, 3);
+		topstat_sketch_add(&ts->kind[TOPSTAT_SOURCE], src, 1+3);
+#ifdef INET6
+	} else if(sa->sa_family == AF_INET6) {
+		src[0] = 6;
+		memcpy(src+1, &((struct sockaddr_in6*)sa)->sin6_addr, 6);
+		topstat_sketch_add(&ts->kind[TOPSTAT_SOURCE], src, 1+6);
+#endif
+	}
+}
+
+/* sort on the key */
+static int
+topstat_cmp_key(const void* a, const void* b)
+{
+	const struct topstat_entry* x = (const struct topstat_entry*)a;
+	const struct topstat_entry* y = (const struct topstat_entry*)b;
+	if(x->len != y->len)
+		return (x->len < y->len) ? -1 : 1;
+	return memcmp(x->key, y->key, x->len);
+}
+
+/* sort on the count, largest first */
+static int
+topstat_cmp_count(const void* a, const void* b)
+{
+	const struct topstat_entry* x = (const struct topstat_entry*)a;
+	const struct topstat_entry* y = (const struct topstat_entry*)b;
+	if(x->count != y->count)
+		return (x->count > y->count) ? -1 : 1;
+	return 0;
+}
+
+size_t
+topstat_merge(struct topstat* ts, size_t num, int kind,
+	struct topstat_entry* result, size_t max)
+{
+	struct topstat_entry* all = xmallocarray(num*TOPSTAT_SIZE,
+		sizeof(*all));
+	size_t i, j, n = 0, m = 0;
+
+	for(i = 0; i < num; i++) {
+		if(ts[i].reset != ts[i].reset_done)
+			continue;
+		for(j = 0; j < TOPSTAT_SIZE; j++) {
+			if(ts[i].kind[kind].top[j].count != 0)
+				all[n++] = ts[i].kind[kind].top[j];
+		}
+	}
+	/* add up the counts of the same key from different servers */
+	qsort(all, n, sizeof(*all), topstat_cmp_key);
+	for(i = 0; i < n; i++) {
+		if(m > 0 && topstat_cmp_key(&all[m-1], &all[i]) == 0)
+			all[m-1].count += all[i].count;
+		else	all[m++] = all[i];
+	}
+	qsort(all, m, sizeof(*all), topstat_cmp_count);
+	if(m > max)
+		m = max;
+	memcpy(result, all, m*sizeof(*all));
+	free(all);
+	return m;
+}
+
+void
+topstat_reset(struct topstat* ts, struct topstat* snapshot, size_t num)
+{
+	size_t i;
+	for(i = 0; i < num; i++)
+		ts[i].reset = snapshot[i].reset + 1;
+}
+
+void
+topstat_key2str(int kind, struct topstat_entry* e, char* buf, size_t len)
+{
+	if(kind == TOPSTAT_SOURCE) {
+		uint8_t a[16];
+		char s[64];
+		memset(a, 0, sizeof(a));
+		buf[0] = 0;
+		if(e->key[0] == 4) {
+			memcpy(a, e->key+1, 3);
+			if(!inet_ntop(AF_INET, a, s, (socklen_t)sizeof(s)))
+				s[0] = 0;
+			snprintf(buf, len, "%s/24", s);
+#ifdef INET6
+		} else {
+			memcpy(a, e->key+1, 6);
+			if(!inet_ntop(AF_INET6, a, s, (socklen_t)sizeof(s)))
+				s[0] = 0;
+			snprintf(buf, len, "%s/48", s);
+#endif
+		}
+		return;
+	}
+	strlcpy(buf, wiredname2str(e->key), len);
+}
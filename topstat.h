@@ -0,0 +1,75 @@
+/*
+ * topstat.h -- heavy hitter statistics of query names, sources and zones
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef TOPSTAT_H
+#define TOPSTAT_H
+#include "dns.h"
+struct query;
+
+/* number of candidates for the top kept per kind */
+#define TOPSTAT_SIZE 64
+/* the count-min sketch, counters per row and number of rows */
+#define TOPSTAT_WIDTH 512
+#define TOPSTAT_DEPTH 4
+
+/* kinds of heavy hitters that are tracked */
+#define TOPSTAT_QNAME 0
+#define TOPSTAT_SOURCE 1
+#define TOPSTAT_ZONE 2
+#define TOPSTAT_KINDS 3
+
+/* a heavy hitter candidate, with the estimated number of queries */
+struct topstat_entry {
+	uint64_t count;
+	uint16_t len;
+	/* query name or zone apex in wire format, or for the source the
+	 * address family followed by the /24 or /48 prefix */
+	uint8_t key[MAXDOMAINLEN+1];
+};
+
+/* the sketch for one kind of heavy hitter */
+struct topstat_sketch {
+	uint32_t cm[TOPSTAT_DEPTH][TOPSTAT_WIDTH];
+	struct topstat_entry top[TOPSTAT_SIZE];
+};
+
+/*
+ * The heavy hitters of one server process. It has a fixed size, without
+ * pointers, so that it can be in the shared statistics memory, and it is
+ * written only by that server process.
+ */
+struct topstat {
+	/* the remote control increments reset to have the server process
+	 * start over, it sets reset_done when it has done so. */
+	uint32_t reset, reset_done;
+	struct topstat_sketch kind[TOPSTAT_KINDS];
+};
+
+/* Add the query name, source prefix and zone of the query to the sketch. */
+void topstat_add(struct topstat* ts, struct query* q);
+
+/*
+ * Merge the heavy hitters of kind from num sketches, the estimates for
+ * the same key are added up. Sketches that have not started over since
+ * the last reset request are skipped, their server process has had no
+ * queries since, or has exited. The max largest are stored in result,
+ * sorted by count. Returns the number of entries in result.
+ */
+size_t topstat_merge(struct topstat* ts, size_t num, int kind,
+	struct topstat_entry* result, size_t max);
+
+/* ask the server processes of the num sketches to start over, the current
+ * values of the reset counters are taken from snapshot */
+void topstat_reset(struct topstat* ts, struct topstat* snapshot, size_t num);
+
+/* print the key of the heavy hitter of kind to a string */
+void topstat_key2str(int kind, struct topstat_entry* e, char* buf,
+	size_t len);
+
+#endif /* TOPSTAT_H */
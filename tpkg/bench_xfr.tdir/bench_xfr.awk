@@ -0,0 +1,38 @@
+# bench_xfr.awk -- generate a zone for the bench_xfr test.
+# variables: origin, size (names), serial, change (changed names get it in
+# their AAAA record), signed (yes adds RRSIG and NSEC records).
+function sig(owner, type) {
+	printf "%s\tRRSIG\t%s 8 2 3600 20361231000000 20260101000000 4711 %s. %s\n", owner, type, origin, b64
+}
+BEGIN {
+	b64 = ""
+	for(i=0; i<43; i++)
+		b64 = b64 "AwEA"
+	print "$TTL\t3600"
+	print "$ORIGIN " origin "."
+	print "@\tIN\tSOA\tns hostmaster " serial " 14400 3600 604800 3600"
+	print "@\tNS\tns"
+	print "ns\tA\t192.0.2.1"
+	if(signed == "yes") {
+		sig("@", "SOA")
+		sig("@", "NS")
+		sig("ns", "A")
+		print "@\tNSEC\th0 NS SOA RRSIG NSEC"
+		sig("@", "NSEC")
+		print "ns\tNSEC\t@ A RRSIG NSEC"
+		sig("ns", "NSEC")
+	}
+	for(i=0; i<size; i++) {
+		n = "h" i
+		printf "%s\tA\t10.%d.%d.%d\n", n, int(i/65536)%256, int(i/256)%256, i%256
+		printf "%s\tAAAA\t2001:db8::%x:%x\n", n, (i%100 == 0 ? change : 0), i%65536
+		printf "%s\tMX\t10 mail.%s.\n", n, origin
+		if(signed == "yes") {
+			sig(n, "A")
+			sig(n, "AAAA")
+			sig(n, "MX")
+			printf "%s\tNSEC\t%s A AAAA MX RRSIG NSEC\n", n, (i+1 < size ? "h" (i+1) : "ns")
+			sig(n, "NSEC")
+		}
+	}
+}
@@ -1,7 +1,9 @@
 # common.sh - an include file for commonly used functions for test code.
 # BSD licensed (see LICENSE file).
 #
-# Version 6
+# Version 7
+# 2026-10-15: start_fresh, stop_fresh, compare_fresh, expect_answer,
+# rcache_hits and rcache_used to compare answers with a fresh server.
 # 2023-12-06: list wait_for_soa_serial in overview
 # 2023-12-06: get_ldns_notify, skip_test and teststep, and previous changes
 # also included are wait_logfile, cpu_count, process_cpu_list, and
@@ -40,6 +42,12 @@
 # process_cpu_list	: get cpu affinity list for process
 # kill_from_pidfile     : kill the pid in the given pid file
 # teststep		: print the current test step in the output
+# start_fresh x		: start a server without caches with config x.
+# stop_fresh		: stop the server that start_fresh started.
+# compare_fresh x	: compare answers to dig x with the fresh server.
+# expect_answer x	: see if the last answer of compare_fresh has x.
+# rcache_hits		: print the number of answers from the response cache.
+# rcache_used x		: see if there were response cache answers since x.
 
 
 # print error and exit
@@ -388,3 +396,80 @@ teststep () {
 	echo
 	echo "STEP [ $1 ]"
 }
+
+# The fresh server functions compare the answers of the server of the
+# test, on port TPKG_PORT with config edit.conf and log nsd.log, with
+# those of a server that is started on port TPKG_PORT2 and has not
+# answered queries before, so its answers do not come from a cache.
+# PRE is the path to the nsd binaries.
+
+# print the dig output without the lines that differ between queries and
+# servers, and the TSIG record, whose MAC is made for every query.
+norm_answer () {
+	grep -v -e '^; <<>> DiG' -e '^;; global options' -e '^;; Query time' \
+		-e '^;; SERVER' -e '^;; WHEN' -e '	TSIG	' \
+		| sed -e 's/id: [0-9]*/id: 0/'
+}
+
+# start the fresh server on the zone files as they are now
+# $1: the config file, with logfile fresh.log and pidfile fresh.pid
+start_fresh () {
+	rm -f fresh.log fresh.zone.list fresh.xfrd
+	$PRE/nsd -c $1 -u "" -p $TPKG_PORT2
+	wait_nsd_up fresh.log
+}
+
+# stop the fresh server
+stop_fresh () {
+	kill_from_pidfile fresh.pid
+}
+
+# ask the server of the test twice, the second time the answer is from
+# the cache, and the fresh server once, the answers must be the same.
+# The raw answers are in cached.1.raw, cached.2.raw and fresh.raw.
+# $@: the arguments for dig
+compare_fresh () {
+	local DIG="dig +norec +nocookie"
+	$DIG @127.0.0.1 -p $TPKG_PORT "$@" > cached.1.raw
+	$DIG @127.0.0.1 -p $TPKG_PORT "$@" > cached.2.raw
+	$DIG @127.0.0.1 -p $TPKG_PORT2 "$@" > fresh.raw
+	norm_answer < cached.1.raw > cached.1
+	norm_answer < cached.2.raw > cached.2
+	norm_answer < fresh.raw > fresh
+	cat cached.2
+	if diff cached.1 fresh && diff cached.2 fresh; then
+		:
+	else
+		echo "the cached answer to $* is not the same as the fresh answer"
+		cat nsd.log
+		exit 1
+	fi
+}
+
+# exit if the last answer of compare_fresh does not have the text
+# $1: extended regular expression
+expect_answer () {
+	if grep -E "$1" cached.2 >/dev/null; then
+		:
+	else
+		echo "the answer does not have $1"
+		exit 1
+	fi
+}
+
+# print the number of answers that came from the response cache
+rcache_hits () {
+	$PRE/nsd-control -c edit.conf stats_noreset | grep '^num.rcache_hit=' \
+		| sed -e 's/^.*=//'
+}
+
+# exit if no answers came from the response cache since the count
+# $1: the earlier count from rcache_hits
+rcache_used () {
+	local hits=`rcache_hits`
+	echo "num.rcache_hit=$hits"
+	if test -z "$hits" || test "$hits" -le "$1"; then
+		echo "no answers came from the response cache"
+		exit 1
+	fi
+}
@@ -8,6 +8,7 @@
 #include <string.h>
 #endif
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "tpkg/cutest/cutest.h"
@@ -15,11 +16,13 @@
 #include "dname.h"
 
 static void dname_1(CuTest *tc);
+static void dname_case(CuTest *tc);
 
 CuSuite* reg_cutest_dname(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, dname_1);
+	SUITE_ADD_TEST(suite, dname_case);
 	return suite;
 }
 
@@ -139,6 +142,73 @@ check_dname_subdomain(CuTest *tc)
 	CuAssert(tc, "test dname_subdomain_of_case function", r == 0);
 }
 
+/* check that dname_partial_copy_into copies like dname_partial_copy */
+static void
+check_dname_partial(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* name = dname_parse(region, "www.example.com.");
+	const dname_type* copy, *into;
+	uint8_t buf[sizeof(dname_type) + MAXDOMAINLEN*2];
+	uint8_t i;
+
+	for(i=0; i<=name->label_count; i++) {
+		copy = dname_partial_copy(region, name, i);
+		into = dname_partial_copy_into(buf, name, i);
+		CuAssert(tc, "test dname_partial_size",
+			dname_partial_size(name, i) == dname_total_size(copy));
+		CuAssert(tc, "test dname_partial_copy_into",
+			memcmp(copy, into, dname_total_size(copy)) == 0);
+	}
+	region_destroy(region);
+}
+
+/* check dname_make_from_query against dname_make on the name in the
+ * packet, and that bad names are refused */
+static void
+check_dname_from_query(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	const char* ok[] = { "\003WwW\007ExAmple\003com\000",
+		"\000", "\001a\012ABCDEFGHIJ\000" };
+	const char* bad[] = { "\003www\300\014", "\003ww", "\003www\100a\000" };
+	uint8_t pkt[300];
+	buffer_type buf;
+	const dname_type* made, *exp;
+	size_t i, len;
+
+	for(i=0; i<sizeof(ok)/sizeof(ok[0]); i++) {
+		len = strlen(ok[i])+1;
+		memcpy(pkt, ok[i], len);
+		buffer_create_from(&buf, pkt, len);
+		made = dname_make_from_query(region, &buf);
+		exp = dname_make(region, pkt, 1);
+		CuAssert(tc, "test dname_make_from_query", made && exp &&
+			memcmp(made, exp, dname_total_size(exp)) == 0);
+		CuAssert(tc, "test dname_make_from_query position",
+			buffer_position(&buf) == len);
+	}
+	for(i=0; i<sizeof(bad)/sizeof(bad[0]); i++) {
+		len = strlen(bad[i]);
+		memcpy(pkt, bad[i], len);
+		buffer_create_from(&buf, pkt, len);
+		CuAssert(tc, "test dname_make_from_query bad name",
+			dname_make_from_query(region, &buf) == NULL);
+	}
+	/* a name of 256 octets is too long, one of 255 is not */
+	memset(pkt, 1, sizeof(pkt));
+	pkt[254] = 0;
+	buffer_create_from(&buf, pkt, 255);
+	CuAssert(tc, "test dname_make_from_query 255",
+		dname_make_from_query(region, &buf) != NULL);
+	pkt[254] = 1;
+	pkt[256] = 0;
+	buffer_create_from(&buf, pkt, 257);
+	CuAssert(tc, "test dname_make_from_query 256",
+		dname_make_from_query(region, &buf) == NULL);
+	region_destroy(region);
+}
+
 static void 
 dname_1(CuTest *tc)
 {
@@ -202,6 +272,53 @@ dname_1(CuTest *tc)
 	CuAssert(tc, "test dname replace overflow", res == NULL);
 
 	check_dname_subdomain(tc);
+	check_dname_partial(tc);
+	check_dname_from_query(tc);
+
+	region_destroy(region);
+}
+
+/* check the case normalization of dname_make and dname_equal_nocase
+ * against DNAME_NORMALIZE, for every byte value at every position of
+ * the word sized blocks of a label */
+static void
+dname_case(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	uint8_t wire[24], other[24];
+	const dname_type* made;
+	int c, pos, ok;
+
+	for(pos = 0; pos < 21; pos++) {
+		for(c = 0; c < 256; c++) {
+			/* a 21 byte label, with mixed case filler */
+			wire[0] = 21;
+			memcpy(wire+1, "aBcDeFgHiJkLmNoPqRsTu", 21);
+			wire[1+pos] = (uint8_t)c;
+			wire[22] = 0;
+			made = dname_make(region, wire, 1);
+			CuAssert(tc, "dname_case made", made != NULL);
+			CuAssert(tc, "dname_case normalized",
+			    dname_name(made)[1+pos] == (uint8_t)DNAME_NORMALIZE(c));
+			CuAssert(tc, "dname_case filler",
+			    dname_name(made)[1+(pos+1)%21] == (uint8_t)
+			    DNAME_NORMALIZE(wire[1+(pos+1)%21]));
 
+			/* the same name, with the case of every byte swapped */
+			memcpy(other, wire, 23);
+			for(ok = 1; ok < 22; ok++) {
+				if(isalpha((unsigned char)other[ok]))
+					other[ok] ^= 0x20;
+			}
+			CuAssert(tc, "dname_case equal_nocase",
+			    dname_equal_nocase(wire, other, 23));
+			other[1+pos] ^= 0x01;
+			ok = (DNAME_NORMALIZE(other[1+pos]) ==
+				DNAME_NORMALIZE(wire[1+pos]));
+			CuAssert(tc, "dname_case not equal_nocase",
+			    dname_equal_nocase(wire, other, 23) == ok);
+		}
+		region_free_all(region);
+	}
 	region_destroy(region);
 }
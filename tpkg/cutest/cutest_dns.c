@@ -13,14 +13,19 @@
 #include "tpkg/cutest/cutest.h"
 #include "region-allocator.h"
 #include "dns.h"
+#include "buffer.h"
+#include "namedb.h"
+#include "rdata.h"
 
 static void dns_1(CuTest *tc);
+static void dns_2(CuTest *tc);
 
 CuSuite* reg_cutest_dns(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, dns_1);
+	SUITE_ADD_TEST(suite, dns_2);
 	return suite;
 }
 
@@ -39,3 +44,59 @@ static void dns_1(CuTest *tc)
 	d = rrtype_descriptor_by_type(TYPE_NSEC3);
 	CuAssert(tc, "dns rrtype descriptor: type nsec3", d->type == TYPE_NSEC3);
 }
+
+static void dns_2(CuTest *tc)
+{
+	/* RRSIG rdata is stored packed in one atom, with the signer name
+	 * in lowercase, and unpacked into its fields */
+	static const uint8_t wire[] = {
+		0x00, 0x01, /* type covered A */
+		0x08, /* algorithm */
+		0x02, /* labels */
+		0x00, 0x00, 0x0e, 0x10, /* original ttl */
+		0x65, 0x00, 0x00, 0x00, /* expiration */
+		0x64, 0x00, 0x00, 0x00, /* inception */
+		0x30, 0x39, /* key tag */
+		0x07, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'O', 'R', 'G',
+		0x00, /* signer */
+		0xde, 0xad, 0xbe, 0xef /* signature */
+	};
+	static const uint8_t signer[] = { 0x07, 'e', 'x', 'a', 'm', 'p',
+		'l', 'e', 0x03, 'o', 'r', 'g', 0x00 };
+	region_type* region = region_create(xalloc, free);
+	buffer_type packet;
+	rdata_atom_type* rdatas = NULL, *fields = NULL;
+	rr_type rr;
+	ssize_t n;
+
+	buffer_create_from(&packet, wire, sizeof(wire));
+	n = rdata_wireformat_to_rdata_atoms(region, NULL, TYPE_RRSIG,
+		sizeof(wire), &packet, &rdatas);
+	CuAssert(tc, "rrsig packed in one atom", n == 1);
+	CuAssert(tc, "rrsig packed size",
+		rdata_atom_size(rdatas[0]) == sizeof(wire));
+	CuAssert(tc, "rrsig packed block size", rdata_atoms_size(TYPE_RRSIG,
+		1, rdatas) == sizeof(rdata_atom_type) + 2 + sizeof(wire));
+	CuAssert(tc, "rrsig header", memcmp(rdata_atom_data(rdatas[0]), wire,
+		18) == 0);
+	CuAssert(tc, "rrsig signer lowercase", memcmp(rdata_atom_data(
+		rdatas[0]) + 18, signer, sizeof(signer)) == 0);
+
+	memset(&rr, 0, sizeof(rr));
+	rr.type = TYPE_RRSIG;
+	rr.klass = CLASS_IN;
+	rr.rdatas = rdatas;
+	rr.rdata_count = 1;
+	CuAssert(tc, "rrsig type covered", rr_rrsig_type_covered(&rr) ==
+		TYPE_A);
+	n = rdata_rrsig_unpack(region, &rr, &fields);
+	CuAssert(tc, "rrsig unpacked fields", n == 9);
+	CuAssert(tc, "rrsig key tag", rdata_atom_size(fields[6]) == 2 &&
+		memcmp(rdata_atom_data(fields[6]), wire+16, 2) == 0);
+	CuAssert(tc, "rrsig signer", rdata_atom_size(fields[7]) ==
+		sizeof(signer) && memcmp(rdata_atom_data(fields[7]), signer,
+		sizeof(signer)) == 0);
+	CuAssert(tc, "rrsig signature", rdata_atom_size(fields[8]) == 4 &&
+		memcmp(rdata_atom_data(fields[8]), wire+31, 4) == 0);
+	region_destroy(region);
+}
@@ -25,11 +25,15 @@
 
 static void namedb_1(CuTest *tc);
 static void namedb_2(CuTest *tc);
+static void namedb_5(CuTest *tc);
+static void namedb_6(CuTest *tc);
 #ifdef NSEC3
 static void namedb_3(CuTest *tc);
 static void namedb_4(CuTest *tc);
 #endif /* NSEC3 */
 static int v = 0; /* verbosity */
+/* if create_and_read_db makes the namedb with rdata-dedup */
+static int create_rdata_dedup = 0;
 
 /** get a temporary file name */
 char* udbtest_get_temp_file(char* suffix);
@@ -40,6 +44,8 @@ CuSuite* reg_cutest_namedb(void)
 
 	SUITE_ADD_TEST(suite, namedb_1);
 	SUITE_ADD_TEST(suite, namedb_2);
+	SUITE_ADD_TEST(suite, namedb_5);
+	SUITE_ADD_TEST(suite, namedb_6);
 #ifdef NSEC3
 	SUITE_ADD_TEST(suite, namedb_3);
 	SUITE_ADD_TEST(suite, namedb_4);
@@ -72,6 +78,7 @@ create_and_read_db(CuTest* tc, region_type* region, const char* zonename,
 
 	/* add our zone option */
 	opt = nsd_options_create(region);
+	opt->rdata_dedup = create_rdata_dedup;
 	zone = zone_options_create(region);
 	memset(zone, 0, sizeof(*zone));
 	zone->name = region_strdup(region, zonename);
@@ -884,15 +891,26 @@ static void
 test_add_del_2(CuTest *tc, namedb_type* db)
 {
 	zone_type* zone = find_zone(db, "example.org");
+	struct zone_mem_usage mem;
 	check_namedb(tc, db);
 	zone->is_ok = 0;
 
+	/* the apex, ns and hostmaster, SOA and NS */
+	zone_mem_usage(zone, &mem);
+	CuAssertTrue(tc, mem.num_domains == 3);
+	CuAssertTrue(tc, mem.num_rrsets == 2);
+	CuAssertTrue(tc, mem.domains >= 3*sizeof(domain_type));
+	CuAssertTrue(tc, mem.rrsets >= 2*sizeof(rrset_type)+3*sizeof(rr_type));
+	CuAssertTrue(tc, mem.ixfr == 0);
+
 	del_str(db, zone, "example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n");
 	check_namedb(tc, db);
 	del_str(db, zone, "example.org. IN NS ns.example.com.\n");
 	check_namedb(tc, db);
 	del_str(db, zone, "example.org. IN NS ns2.example.com.\n");
 	check_namedb(tc, db);
+	zone_mem_usage(zone, &mem);
+	CuAssertTrue(tc, mem.num_rrsets == 0 && mem.rrsets == 0);
 	/* the root has not been deleted */
 	CuAssertTrue(tc, domain_table_count(db->domains) != 0);
 	CuAssertTrue(tc, db->domains->root && db->domains->root->number);
@@ -916,6 +934,136 @@ static void namedb_2(CuTest *tc)
 	region_destroy(region);
 }
 
+/* test _5 : the rdata of RRs with the same content is shared */
+static void namedb_5(CuTest *tc)
+{
+	region_type* region;
+	namedb_type* db;
+	zone_type* zone;
+	domain_type* a, *b;
+	rrset_type* ra, *rb;
+	if(v) printf("test 5 namedb start\n");
+	region = region_create(xalloc, free);
+	create_rdata_dedup = 1;
+	db = create_and_read_db(tc, region, "example.org.",
+		"example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n"
+		"example.org. IN NS ns.example.com.\n"
+		"a.example.org. IN A 1.2.3.4\n"
+		"a.example.org. IN NS ns.example.com.\n"
+		"b.example.org. IN A 1.2.3.4\n"
+		"b.example.org. IN NS ns.example.com.\n"
+		"c.example.org. IN A 1.2.3.5\n"
+	);
+	create_rdata_dedup = 0;
+	zone = find_zone(db, "example.org");
+	check_namedb(tc, db);
+	a = domain_table_find(db->domains, dname_parse(region,
+		"a.example.org."));
+	b = domain_table_find(db->domains, dname_parse(region,
+		"b.example.org."));
+	CuAssertTrue(tc, a && b);
+	ra = domain_find_rrset(a, zone, TYPE_A);
+	rb = domain_find_rrset(b, zone, TYPE_A);
+	CuAssertTrue(tc, ra && rb && ra->rrs[0].rdatas == rb->rrs[0].rdatas);
+	CuAssertTrue(tc, domain_find_rrset(a, zone, TYPE_NS)->rrs[0].rdatas ==
+		zone->ns_rrset->rrs[0].rdatas);
+
+	/* deleting one of the RRs leaves the rdata of the other */
+	del_str(db, zone, "a.example.org. IN A 1.2.3.4\n");
+	check_namedb(tc, db);
+	rb = domain_find_rrset(b, zone, TYPE_A);
+	CuAssertTrue(tc, rb && rdata_atom_size(rb->rrs[0].rdatas[0]) == 4 &&
+		memcmp(rdata_atom_data(rb->rrs[0].rdatas[0]), "\001\002\003\004",
+		4) == 0);
+	/* and it is shared again when added */
+	add_str(db, zone, "a.example.org. IN A 1.2.3.4\n");
+	check_namedb(tc, db);
+	ra = domain_find_rrset(a, zone, TYPE_A);
+	CuAssertTrue(tc, ra && ra->rrs[0].rdatas == rb->rrs[0].rdatas);
+	del_str(db, zone, "b.example.org. IN A 1.2.3.4\n");
+	del_str(db, zone, "a.example.org. IN A 1.2.3.4\n");
+	check_namedb(tc, db);
+
+	zone->is_ok = 0;
+	delete_zone_rrs(db, zone);
+	check_namedb(tc, db);
+	if(v) printf("test 5 namedb end\n");
+	namedb_close(db);
+	region_destroy(region);
+}
+
+/* test _6 : add and delete in a large RRset, that has an RR index */
+static void namedb_6(CuTest *tc)
+{
+	region_type* region;
+	namedb_type* db;
+	zone_type* zone;
+	domain_type* big;
+	rrset_type* mx;
+	char str[128];
+	int i, softfail = 0;
+	if(v) printf("test 6 namedb start\n");
+	region = region_create(xalloc, free);
+	db = create_and_read_db(tc, region, "example.org.",
+		"example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n"
+		"example.org. IN NS ns.example.com.\n"
+	);
+	zone = find_zone(db, "example.org");
+	for(i=0; i<300; i++) {
+		snprintf(str, sizeof(str), "big.example.org. IN MX %d "
+			"mx%d.example.org.\n", i%7, i);
+		add_str(db, zone, str);
+	}
+	check_namedb(tc, db);
+	mx = domain_find_rrset(domain_table_find(db->domains,
+		dname_parse(region, "big.example.org.")), zone, TYPE_MX);
+	CuAssertTrue(tc, mx && mx->rr_count == 300);
+
+	/* the duplicates are found, also with the name in other case */
+	for(i=0; i<300; i+=3) {
+		struct buffer buffer;
+		struct parse_rr_state state;
+		memset(&state, 0, sizeof(state));
+		state.region = region_create(xalloc, free);
+		snprintf(str, sizeof(str), "big.example.org. IN MX %d "
+			"MX%d.Example.ORG.\n", i%7, i);
+		CuAssertTrue(tc, parse_rr_str(zone, str, &state));
+		buffer_create_from(&buffer, state.rdata, state.rdlength);
+		softfail = 0;
+		CuAssertTrue(tc, add_RR(db, state.owner, state.type,
+			state.class, state.ttl, &buffer, state.rdlength, zone,
+			&softfail));
+		CuAssertTrue(tc, softfail == 1);
+		region_destroy(state.region);
+	}
+	CuAssertTrue(tc, mx->rr_count == 300);
+
+	/* delete every other one, the last RR moves into their place */
+	for(i=0; i<300; i+=2) {
+		snprintf(str, sizeof(str), "big.example.org. IN MX %d "
+			"mx%d.example.org.\n", i%7, i);
+		del_str(db, zone, str);
+	}
+	check_namedb(tc, db);
+	CuAssertTrue(tc, mx->rr_count == 150);
+	for(i=1; i<300; i+=2) {
+		snprintf(str, sizeof(str), "big.example.org. IN MX %d "
+			"mx%d.example.org.\n", i%7, i);
+		del_str(db, zone, str);
+	}
+	check_namedb(tc, db);
+	big = domain_table_find(db->domains, dname_parse(region,
+		"big.example.org."));
+	CuAssertTrue(tc, !big || !domain_find_rrset(big, zone, TYPE_MX));
+
+	zone->is_ok = 0;
+	delete_zone_rrs(db, zone);
+	check_namedb(tc, db);
+	if(v) printf("test 6 namedb end\n");
+	namedb_close(db);
+	region_destroy(region);
+}
+
 #ifdef NSEC3
 /* test the namedb, and add, remove items from it */
 static void
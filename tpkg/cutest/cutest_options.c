@@ -17,6 +17,7 @@
 #include "util.h"
 #include "dname.h"
 #include "nsd.h"
+#include "query.h"
 
 static void acl_1(CuTest *tc);
 static void acl_2(CuTest *tc);
@@ -24,9 +25,11 @@ static void acl_3(CuTest *tc);
 static void acl_4(CuTest *tc);
 static void acl_5(CuTest *tc);
 static void acl_6(CuTest *tc);
+static void acl_7(CuTest *tc);
 static void replace_1(CuTest *tc);
 static void replace_2(CuTest *tc);
 static void zonelist_1(CuTest *tc);
+static void config_1(CuTest *tc);
 
 CuSuite* reg_cutest_options(void)
 {
@@ -38,9 +41,11 @@ CuSuite* reg_cutest_options(void)
 	SUITE_ADD_TEST(suite, acl_4); /* parse_acl_range_type */
 	SUITE_ADD_TEST(suite, acl_5); /* parse_acl_range_subnet */
 	SUITE_ADD_TEST(suite, acl_6); /* acl_same_host */
+	SUITE_ADD_TEST(suite, acl_7); /* acl trie */
 	SUITE_ADD_TEST(suite, replace_1); /* replace_str */
 	SUITE_ADD_TEST(suite, replace_2); /* make_zonefile */
 	SUITE_ADD_TEST(suite, zonelist_1); /* zonelist */
+	SUITE_ADD_TEST(suite, config_1); /* zones with an include-pattern */
 	return suite;
 }
 
@@ -267,6 +272,83 @@ static void acl_6(CuTest *tc)
 	region_destroy(region);
 }
 
+/* check acl_check_incoming for addr, with the list and with its trie */
+static void acl_7_chk(CuTest *tc, struct acl_options* list,
+	struct acl_options* copy, uint32_t addr)
+{
+	struct query q;
+	struct acl_options* r1, *r2;
+	int n1, n2;
+	memset(&q, 0, sizeof(q));
+	((struct sockaddr_in*)&q.client_addr)->sin_family = AF_INET;
+	((struct sockaddr_in*)&q.client_addr)->sin_addr.s_addr = htonl(addr);
+	q.tsig.status = TSIG_NOT_PRESENT;
+	n1 = acl_check_incoming(copy, &q, &r1);
+	n2 = acl_check_incoming(list, &q, &r2);
+	CuAssertIntEquals(tc, n1, n2);
+	CuAssert(tc, "check acl trie reason", (r1 == NULL && r2 == NULL) ||
+		(r1 && r2 && strcmp(r1->ip_address_spec,
+		r2->ip_address_spec) == 0 && r1->blocked == r2->blocked));
+}
+
+static void acl_7(CuTest *tc)
+{
+	/* compiled acl lists give the same answers as the list walk */
+	region_type* region = region_create(xalloc, free);
+	struct pattern_options* p = pattern_options_create(region);
+	struct pattern_options* c = pattern_options_create(region);
+	struct acl_options* a, *last = NULL, *clast = NULL;
+	char buf[64];
+	uint32_t x;
+	int i;
+	const char* extra[] = { "10.0.0.0/8", "10.1.2.3", "10.1.2.0/24",
+		"10.1.0.0&255.255.0.255", "10.2.0.0-10.2.0.100",
+		"10.3.0.0/16", "0.0.0.0/0", NULL };
+	const char* extrakey[] = { "NOKEY", "BLOCKED", "NOKEY", "NOKEY",
+		"NOKEY", "BLOCKED", "NOKEY", NULL };
+
+	for(i=0; i<300+7; i++) {
+		const char* key = "NOKEY";
+		if(i < 300) {
+			snprintf(buf, sizeof(buf), "10.%d.%d.0/%d", i%5, i%250,
+				(i%3==0)?24:((i%3==1)?28:32));
+			if(i%7 == 0) key = "BLOCKED";
+		} else {
+			strlcpy(buf, extra[i-300], sizeof(buf));
+			key = extrakey[i-300];
+		}
+		a = parse_acl_info(region, region_strdup(region, buf), key);
+		if(!last) p->allow_query = a;
+		else last->next = a;
+		last = a;
+		a = parse_acl_info(region, region_strdup(region, buf), key);
+		if(!clast) c->allow_query = a;
+		else clast->next = a;
+		clast = a;
+	}
+	pattern_options_compile_acls(region, p);
+	CuAssert(tc, "check acl trie built", p->allow_query->trie != NULL);
+
+	for(i=0; i<300; i++) {
+		x = (10<<24) | ((i%5)<<16) | ((i%250)<<8);
+		acl_7_chk(tc, p->allow_query, c->allow_query, x);
+		acl_7_chk(tc, p->allow_query, c->allow_query, x|5);
+		acl_7_chk(tc, p->allow_query, c->allow_query, x|20);
+	}
+	for(x=0; x<256; x++) {
+		acl_7_chk(tc, p->allow_query, c->allow_query,
+			(10<<24) | (1<<16) | (x<<8) | x);
+		acl_7_chk(tc, p->allow_query, c->allow_query,
+			(10<<24) | (2<<16) | x);
+		acl_7_chk(tc, p->allow_query, c->allow_query,
+			(10<<24) | (3<<16) | (x<<8));
+		acl_7_chk(tc, p->allow_query, c->allow_query,
+			(x<<24) | 0x010203);
+	}
+
+	region_destroy(region);
+}
+
 static void replace_1(CuTest *tc)
 {
 	char buf[32];
@@ -507,3 +589,68 @@ static void zonelist_1(CuTest *tc)
 	region_destroy(region);
 	unlink(zname);
 }
+
+/** find the zone in the options */
+static struct zone_options*
+config_zone(struct nsd_options* opt, const char* name)
+{
+	const dname_type* dname = dname_parse(opt->region, name);
+	return dname ? zone_options_find(opt, dname) : NULL;
+}
+
+static void config_1(CuTest *tc)
+{
+	struct zone_options* z;
+	struct pattern_options* p;
+	char fname[1024];
+	FILE* out;
+	region_type* region = region_create(xalloc, free);
+	struct nsd_options* opt = nsd_options_create(region);
+	snprintf(fname, sizeof(fname), "/tmp/unitconfig%u.conf",
+		(unsigned)getpid());
+	out = fopen(fname, "w");
+	CuAssertTrue(tc, out != NULL);
+	fprintf(out, "pattern:\n\tname: secondary\n"
+		"\tzonefile: \"%%s.zone\"\n"
+		"\trequest-xfr: 192.0.2.1 NOKEY\n"
+		"pattern:\n\tname: notify\n"
+		"\tnotify: 192.0.2.2 NOKEY\n"
+		/* only the pattern, the zone uses it */
+		"zone:\n\tname: a.example\n\tinclude-pattern: secondary\n"
+		/* an option after it */
+		"zone:\n\tname: b.example\n\tinclude-pattern: secondary\n"
+		"\tzonefile: b.zone\n"
+		/* an option before it */
+		"zone:\n\tzonefile: c.zone\n\tname: c.example\n"
+		"\tinclude-pattern: secondary\n"
+		/* two patterns */
+		"zone:\n\tname: d.example\n\tinclude-pattern: secondary\n"
+		"\tinclude-pattern: notify\n");
+	fclose(out);
+	CuAssertTrue(tc, parse_options_file(opt, fname, NULL, NULL, NULL));
+	unlink(fname);
+	CuAssertTrue(tc, opt->zone_options->count == 4);
+	/* the two patterns and the implicit ones of b, c and d */
+	CuAssertTrue(tc, opt->patterns->count == 5);
+
+	p = pattern_options_find(opt, "secondary");
+	CuAssertTrue(tc, p != NULL);
+	z = config_zone(opt, "a.example");
+	CuAssertTrue(tc, z && z->part_of_config && z->pattern == p);
+	CuAssertStrEquals(tc, "%s.zone", z->pattern->zonefile);
+
+	z = config_zone(opt, "b.example");
+	CuAssertTrue(tc, z && z->part_of_config && z->pattern->implicit);
+	CuAssertStrEquals(tc, "b.zone", z->pattern->zonefile);
+	CuAssertTrue(tc, z->pattern->request_xfr != NULL);
+
+	z = config_zone(opt, "c.example");
+	CuAssertTrue(tc, z && z->pattern->implicit);
+	CuAssertStrEquals(tc, "%s.zone", z->pattern->zonefile);
+
+	z = config_zone(opt, "d.example");
+	CuAssertTrue(tc, z && z->pattern->implicit);
+	CuAssertTrue(tc, z->pattern->request_xfr != NULL);
+	CuAssertTrue(tc, z->pattern->notify != NULL);
+	region_destroy(region);
+}
@@ -355,10 +355,29 @@ static void test_checks(struct radtree* rt)
 	test_check_closest_match_inexact(rt);
 }
 
+/** label offsets of a domain name, in the order of a dname_type */
+static unsigned int test_dname_offsets(uint8_t* d, uint8_t* offs)
+{
+	uint8_t tmp[128];
+	unsigned int labs = 0, i;
+	size_t dpos = 0;
+	while(1) {
+		tmp[labs++] = (uint8_t)dpos;
+		if(d[dpos] == 0)
+			break;
+		dpos += d[dpos]+1;
+	}
+	for(i=0; i<labs; i++)
+		offs[i] = tmp[labs-1-i];
+	return labs;
+}
+
 /** check radname_search */
 static void test_check_dname_search(struct radtree* rt)
 {
 	struct radnode* n;
+	uint8_t offs[128];
+	unsigned int labs;
 	for(n = radix_first(rt); n ; n = radix_next(n)) {
 		struct teststr* s = (struct teststr*)n->elem;
 		struct radnode* found;
@@ -366,6 +385,9 @@ static void test_check_dname_search(struct radtree* rt)
 		found = radname_search(rt, s->dname, s->dname_len);
 		CuAssert(tc, "radname_search", found != NULL);
 		CuAssert(tc, "radname_search", found == n);
+		labs = test_dname_offsets(s->dname, offs);
+		found = radname_search_labels(rt, s->dname, offs, labs);
+		CuAssert(tc, "radname_search_labels", found == n);
 	}
 }
 
@@ -394,9 +416,11 @@ static void test_check_dname_closest_inexact(struct radtree* rt)
 	radstrlen_type dlen;
 	uint8_t radname[1024];
 	radstrlen_type rlen;
-	struct radnode* n;
+	struct radnode* n, *n2;
 	struct teststr* t;
-	int i = 0, num=1000;
+	uint8_t offs[128];
+	unsigned int labs;
+	int i = 0, num=1000, r;
 	/* what strings to try out? random */
 	/* how to check result? use prev and next (they work checked before)*/
 	for(i=0; i<num; i++) {
@@ -407,7 +431,13 @@ static void test_check_dname_closest_inexact(struct radtree* rt)
 		 * the dname to radname against the d2r function */
 		radname_d2r(radname, &rlen, dname, (size_t)dlen);
 		n = NULL;
-		if(radname_find_less_equal(rt, dname, (size_t)dlen, &n)) {
+		r = radname_find_less_equal(rt, dname, (size_t)dlen, &n);
+		labs = test_dname_offsets(dname, offs);
+		n2 = NULL;
+		CuAssert(tc, "radname_find_labels",
+			radname_find_less_equal_labels(rt, dname, offs, labs,
+			&n2) == r && n2 == n);
+		if(r) {
 			CuAssert(tc, "radname_find", n != NULL);
 			CuAssert(tc, "radname_find", n->elem != NULL);
 			/* check exact match */
@@ -25,11 +25,15 @@
 #endif /* PACKED_STRUCTS */
 
 static void region_1(CuTest *tc);
+static void region_2(CuTest *tc);
+static void region_3(CuTest *tc);
 
 CuSuite* reg_cutest_region(void)
 {
 	CuSuite* suite = CuSuiteNew();
 	SUITE_ADD_TEST(suite, region_1); /* test recycle */
+	SUITE_ADD_TEST(suite, region_2); /* test slab */
+	SUITE_ADD_TEST(suite, region_3); /* test arena */
 	return suite;
 }
 
@@ -283,19 +287,17 @@ test_dealloc(CuTest *ATTR_UNUSED(tc), rbtree_type* tree, region_type* region)
 	}
 }
 
-static void 
-region_1(CuTest *tc)
+/* add and delete random elements in the region */
+static void
+test_random(CuTest *tc, region_type* region)
 {
 	region_type* tree_region = region_create(xalloc, free);
 	rbtree_type* tree = rbtree_create(tree_region, comparef);
-	region_type* region = 0;
 	int i;
 	int max = 10000;
 	int emptyup = 40;
 
 	srand48(4096);
-	region = region_create_custom(xalloc, free, DEFAULT_CHUNK_SIZE,
-		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE, 1);
 
 	/* start adding and deleting random elements */
 	for(i=0; i<max; i++) {
@@ -313,7 +315,77 @@ region_1(CuTest *tc)
 			printf("\n");
 		}
 	}
+	region_destroy(tree_region);
+}
 
+static void 
+region_1(CuTest *tc)
+{
+	region_type* region = region_create_custom(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE, 1);
+	test_random(tc, region);
+	region_destroy(region);
+}
+
+static void
+region_2(CuTest *tc)
+{
+	region_type* region = region_create_slab(xalloc, free,
+		DEFAULT_LARGE_OBJECT_SIZE, DEFAULT_INITIAL_CLEANUP_SIZE);
+	void* blocks[10000];
+	size_t i, num = sizeof(blocks)/sizeof(blocks[0]);
+
+	test_random(tc, region);
+	region_free_all(region);
+
+	/* fill pages with blocks of one size, and recycle them again */
+	for(i=0; i<num; i++) {
+		blocks[i] = region_alloc(region, 40);
+		CuAssert(tc, "region_alloc nonnull", blocks[i] != NULL);
+		memset(blocks[i], 0x5a, 40);
+	}
+	CuAssert(tc, "region_alloc nonnull", region_alloc_zero(region, 40)
+		!= NULL);
+	for(i=0; i<num; i++)
+		region_recycle(region, blocks[i], 40);
+	blocks[0] = region_alloc(region, 40);
+	CuAssert(tc, "region_alloc nonnull", blocks[0] != NULL);
+#ifdef USE_SLAB_ALLOC
+	/* the empty pages are given back, but for the one last page */
+	CuAssert(tc, "empty pages given back",
+		region_get_recycle_size(region) < 65536);
+	CuAssert(tc, "slab memory in use", region_get_mem(region) == 80);
+#endif
+	region_destroy(region);
+}
+
+static void
+region_3(CuTest *tc)
+{
+	region_type* region = region_create_arena(xalloc, free,
+		DEFAULT_CHUNK_SIZE, DEFAULT_LARGE_OBJECT_SIZE,
+		DEFAULT_INITIAL_CLEANUP_SIZE);
+	char* first[100], *again;
+	int i, j;
+
+	test_random(tc, region);
+	for(j=0; j<3; j++) {
+		region_free_all(region);
+		/* the blocks are on the same spots in the chunks, that are
+		 * kept from the previous use */
+		for(i=0; i<100; i++) {
+			if(j == 0) {
+				first[i] = region_alloc(region, 200);
+				CuAssert(tc, "region_alloc nonnull",
+					first[i] != NULL);
+				continue;
+			}
+			again = region_alloc(region, 200);
+			CuAssert(tc, "arena chunk reused", again == first[i]);
+		}
+		CuAssert(tc, "large object", region_alloc(region,
+			DEFAULT_LARGE_OBJECT_SIZE*2) != NULL);
+	}
 	region_destroy(region);
-	region_destroy(tree_region);
 }
@@ -12,15 +12,20 @@
 #include <stdlib.h>
 #include "tpkg/cutest/cutest.h"
 #include "rrl.h"
+#include "options.h"
 
 #ifdef RATELIMIT
 static void rrl_1(CuTest *tc);
+static void rrl_2(CuTest *tc);
+static void rrl_3(CuTest *tc);
 
 CuSuite* reg_cutest_rrl(void)
 {
         CuSuite* suite = CuSuiteNew();
 
 	SUITE_ADD_TEST(suite, rrl_1);
+	SUITE_ADD_TEST(suite, rrl_2);
+	SUITE_ADD_TEST(suite, rrl_3);
 	return suite;
 }
 
@@ -72,4 +77,87 @@ static void rrl_1(CuTest *tc)
 
 	rrl_deinit(0);
 }
+
+/* the sources in a set of buckets, and replacement of the lowest rate */
+static void rrl_2(CuTest *tc)
+{
+	query_type q;
+	uint64_t source = 0x200;
+	uint32_t now = 123;
+	uint32_t hash = 0x1234;
+	uint16_t c = rrl_type_nxdomain;
+	uint32_t i, j;
+	uint32_t m = 400; /* ratelimit */
+	memset(&q, 0, sizeof(q));
+
+	rrl_init(0);
+
+	/* the sources with the same hash each get a bucket of the set,
+	 * source+j has rate j+1 */
+	for(j=0; j<RRL_WAYS; j++) {
+		for(i=0; i<=j; i++) {
+			CuAssert(tc, "rrl way count", i+1 == rrl_update(&q,
+				hash, source+j, c, now, m));
+		}
+	}
+	/* the rates are still there */
+	for(j=0; j<RRL_WAYS; j++) {
+		CuAssert(tc, "rrl way kept", j+2 == rrl_update(&q, hash,
+			source+j, c, now, m));
+	}
+
+	/* a new source replaces the lowest rate, that of source+0 */
+	CuAssert(tc, "rrl replace", 1 == rrl_update(&q, hash, source+100,
+		c, now, m));
+	CuAssert(tc, "rrl replaced", 1 == rrl_update(&q, hash, source,
+		c, now, m));
+	/* source+0 replaced source+100, the others have their rate */
+	for(j=1; j<RRL_WAYS; j++) {
+		CuAssert(tc, "rrl not replaced", j+3 == rrl_update(&q, hash,
+			source+j, c, now, m));
+	}
+
+	rrl_deinit(0);
+}
+
+/* the ratelimits of a zone, from the zone options and the server */
+static void rrl_3(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct pattern_options* p = pattern_options_create(region);
+	struct zone_options zo;
+	zone_type zone;
+	memset(&zo, 0, sizeof(zo));
+	memset(&zone, 0, sizeof(zone));
+	zo.pattern = p;
+	zone.opts = &zo;
+	rrl_set_limit(200, 2000, 2);
+
+	/* the server ratelimits */
+	p->rrl_whitelist = rrl_type_dnskey;
+	rrl_zone_set_limits(&zone);
+	CuAssert(tc, "rrl zone server limit", zone.rrl_limit[0] == 400);
+	CuAssert(tc, "rrl zone server limit", zone.rrl_limit[7] == 400);
+	CuAssert(tc, "rrl zone whitelist limit", zone.rrl_limit[6] == 4000);
+
+	/* rrl-ratelimit for the zone, and rrl-type-ratelimit for nxdomain */
+	p->rrl_ratelimit = 1000;
+	p->rrl_ratelimit_is_default = 0;
+	p->rrl_type_limits = rrl_type_nxdomain;
+	p->rrl_type_ratelimit[0] = 50;
+	rrl_zone_set_limits(&zone);
+	CuAssert(tc, "rrl zone type limit", zone.rrl_limit[0] == 100);
+	CuAssert(tc, "rrl zone limit", zone.rrl_limit[1] == 2000);
+	CuAssert(tc, "rrl zone limit", zone.rrl_limit[8] == 2000);
+	CuAssert(tc, "rrl zone whitelist limit", zone.rrl_limit[6] == 4000);
+
+	/* no limit for the zone */
+	p->rrl_ratelimit = 0;
+	rrl_zone_set_limits(&zone);
+	CuAssert(tc, "rrl zone no limit", zone.rrl_limit[7] == 0);
+	CuAssert(tc, "rrl zone type limit", zone.rrl_limit[0] == 100);
+
+	rrl_set_limit(RRL_LIMIT/2, RRL_WLIST_LIMIT/2, RRL_SLIP);
+	region_destroy(region);
+}
 #endif /* RATELIMIT */
@@ -15,6 +15,7 @@ static void udb_1(CuTest* tc);
 static void udb_2(CuTest* tc);
 static void udb_3(CuTest* tc);
 static void udb_4(CuTest* tc);
+static void udb_5(CuTest* tc);
 
 CuSuite* reg_cutest_udb(void)
 {
@@ -23,6 +24,7 @@ CuSuite* reg_cutest_udb(void)
 	SUITE_ADD_TEST(suite, udb_2);
 	SUITE_ADD_TEST(suite, udb_3);
 	SUITE_ADD_TEST(suite, udb_4);
+	SUITE_ADD_TEST(suite, udb_5);
 	return suite;
 }
 
@@ -434,6 +436,53 @@ test_ucb_exp_offset(void)
 	CuAssertTrue(tc, udb_exp_offset(288) == 5);
 }
 
+/** test that clear drops the chunks and keeps the file size */
+static void
+test_clear(void)
+{
+	char* fname = udbtest_get_temp_file(".udb");
+	udb_base* udb;
+	udb_ptr p;
+	udb_void first = 0;
+	uint64_t fsize;
+	int i;
+	udb = udb_base_create_new(fname, testAwalk, NULL);
+	CuAssertTrue(tc, udb != NULL);
+	for(i=0; i<100; i++) {
+		CuAssertTrue(tc, udb_ptr_alloc_space(&p, udb,
+			udb_chunk_type_data, 100));
+		if(i == 0) {
+			first = p.data;
+			udb_base_set_userdata(udb, p.data);
+		}
+		udb_ptr_unlink(&p, udb);
+	}
+	fsize = udb->glob_data->fsize;
+	CuAssertTrue(tc, udb->alloc->disk->nextgrow > UDB_HEADER_SIZE);
+
+	udb_base_clear(udb);
+	CuAssertTrue(tc, udb_base_get_userdata(udb)->data == 0);
+	CuAssertTrue(tc, udb->alloc->disk->nextgrow == UDB_HEADER_SIZE);
+	CuAssertTrue(tc, udb->alloc->disk->stat_data == 0);
+	CuAssertTrue(tc, udb->glob_data->fsize == fsize);
+
+	/* new chunks start from the beginning again, without growth */
+	for(i=0; i<100; i++) {
+		CuAssertTrue(tc, udb_ptr_alloc_space(&p, udb,
+			udb_chunk_type_data, 100));
+		if(i == 0)
+			CuAssertTrue(tc, p.data == first);
+		udb_ptr_unlink(&p, udb);
+	}
+	CuAssertTrue(tc, udb->glob_data->fsize == fsize);
+
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror("unlink");
+	free(fname);
+}
+
 static void udb_1(CuTest* t)
 {
 	tc = t;
@@ -457,3 +506,9 @@ static void udb_4(CuTest* t)
 	tc = t;
 	test_A();
 }
+
+static void udb_5(CuTest* t)
+{
+	tc = t;
+	test_clear();
+}
@@ -14,12 +14,16 @@
 #include "region-allocator.h"
 #include "util.h"
 #include "xfrd-tcp.h"
+#include "siphash.h"
+#include "fasthash.h"
 
 static void util_1(CuTest *tc);
 static void util_2(CuTest *tc);
 static void util_3(CuTest *tc);
 static void util_4(CuTest *tc);
 static void util_5(CuTest *tc);
+static void util_6(CuTest *tc);
+static void util_7(CuTest *tc);
 
 CuSuite* reg_cutest_util(void)
 {
@@ -30,6 +34,8 @@ CuSuite* reg_cutest_util(void)
 	SUITE_ADD_TEST(suite, util_3);
 	SUITE_ADD_TEST(suite, util_4);
 	SUITE_ADD_TEST(suite, util_5);
+	SUITE_ADD_TEST(suite, util_6);
+	SUITE_ADD_TEST(suite, util_7);
 	return suite;
 }
 
@@ -209,3 +215,54 @@ static void util_5(CuTest *tc)
 	testarray(tc, 5, 10);
 	testarray(tc, 5, 65536);
 }
+
+static void util_6(CuTest *tc)
+{
+	/* the siphash with a key state is the same as siphash */
+	uint8_t k[16], in[40], h1[8], h2[8];
+	struct siphash_key sk;
+	size_t i;
+	for(i=0; i<sizeof(k); i++)
+		k[i] = (uint8_t)i;
+	for(i=0; i<sizeof(in); i++)
+		in[i] = (uint8_t)(i*7+3);
+	siphash_key_setup(&sk, k);
+	for(i=0; i<=sizeof(in); i++) {
+		siphash(in, i, k, h1, 8);
+		siphash_key_hash(&sk, in, i, h2);
+		CuAssert(tc, "siphash key", memcmp(h1, h2, 8) == 0);
+	}
+	/* the test vector of the reference implementation, for the 15
+	 * bytes 00..0e */
+	for(i=0; i<15; i++)
+		in[i] = (uint8_t)i;
+	siphash_key_hash(&sk, in, 15, h2);
+	CuAssert(tc, "siphash vector", memcmp(h2,
+		"\xe5\x45\xbe\x49\x61\xca\x29\xa1", 8) == 0);
+}
+
+static void util_7(CuTest *tc)
+{
+	/* the fasthash of a key only depends on the bytes of the key, and
+	 * changes with every byte of it, for the lengths of all the paths */
+	uint8_t a[128], b[128];
+	size_t len, i;
+	for(i=0; i<sizeof(a); i++) {
+		a[i] = (uint8_t)(i*7+3);
+		b[i] = (uint8_t)~a[i];
+	}
+	for(len=0; len<=100; len++) {
+		uint32_t h = fasthash32(a+8, len, 0);
+		memcpy(b+8, a+8, len);
+		CuAssert(tc, "fasthash in key", h == fasthash32(b+8, len, 0));
+		CuAssert(tc, "fasthash seed", h != fasthash32(a+8, len, 1));
+		for(i=0; i<len; i++) {
+			b[8+i] ^= 0x20;
+			CuAssert(tc, "fasthash byte", h != fasthash32(b+8,
+				len, 0));
+			b[8+i] ^= 0x20;
+		}
+		for(i=0; i<sizeof(b); i++)
+			b[i] = (uint8_t)~a[i];
+	}
+}
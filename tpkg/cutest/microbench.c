@@ -0,0 +1,1301 @@
+/*
+	microbenchmarks of the core data structures
+	log
+	14 oct 26: created file.
+
+	Times the radix tree, red-black tree, dname compare, region allocator
+	and the packet encoding of answers, on a generated set of names and
+	a generated zone. The results are printed as name=value lines, in
+	nanoseconds per operation, so that runs can be compared.
+
+	The query benchmarks feed wire format queries to query_process and
+	query_add_optional, without sockets, with EDNS, DNSSEC, NSEC3,
+	cookies, TSIG, rate limiting and the response cache in turn, and
+	TSIG signed SOA queries, like the refresh probes of secondaries,
+	with and without the response cache, and ANY queries. They print the mallocs of the
+	query region per query as well.
+
+	The tsig benchmarks sign the packets of an AXFR stream, every one
+	with the same TSIG record, and sign queries that each start a new
+	TSIG record, with the same key.
+
+	The hash benchmarks compare hashlittle and fasthash32 on the keys of
+	rate limiting, source prefix, type and name, and on names.
+
+	The zone benchmarks write an NSEC3 signed zone to a zonefile, and
+	create an IXFR for a new serial, that compares every RR of the zone
+	with the spooled old version, in nanoseconds per RR.
+
+	The config benchmarks parse a config with more and more zones, that
+	include a pattern, or that have a zonefile of their own as well,
+	and print the time and the memory per zone.
+*/
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "nsd.h"
+#include "options.h"
+#include "namedb.h"
+#include "radtree.h"
+#include "rbtree.h"
+#include "dname.h"
+#include "region-allocator.h"
+#include "packet.h"
+#include "answer.h"
+#include "query.h"
+#include "edns.h"
+#include "tsig.h"
+#include "rrl.h"
+#include "respcache.h"
+#include "lookup3.h"
+#include "fasthash.h"
+#include "iterated_hash.h"
+#include "util.h"
+#include "ixfrcreate.h"
+
+/* dummy functions to link */
+struct nsd nsd;
+int writepid(struct nsd * ATTR_UNUSED(nsd))
+{
+	return 0;
+}
+void unlinkpid(const char * ATTR_UNUSED(file), const char* ATTR_UNUSED(username))
+{
+}
+void bind8_stats(struct nsd * ATTR_UNUSED(nsd))
+{
+}
+
+void sig_handler(int ATTR_UNUSED(sig))
+{
+}
+
+/** number of names in the name set */
+static size_t num_names = 100000;
+/** number of repeats of the operations */
+static size_t repeat = 10;
+/** only run benchmarks with this in their name */
+static const char* filter = NULL;
+
+/** the name set, and names that are not in the set */
+static const dname_type** names;
+static const dname_type** absent;
+
+/** the value that the benchmarks compute, so it is not optimized away */
+static volatile size_t sink;
+
+static double
+now_usec(void)
+{
+	struct timeval tv;
+	if(gettimeofday(&tv, NULL) == -1)
+		return 0;
+	return (double)tv.tv_sec*1000000.0 + (double)tv.tv_usec;
+}
+
+static int
+want(const char* name)
+{
+	return !filter || strstr(name, filter) != NULL;
+}
+
+static void
+report(const char* name, double start, size_t ops)
+{
+	double usec = now_usec() - start;
+	printf("%s.ns=%.1f\n", name, ops ? usec*1000.0/(double)ops : 0);
+	printf("%s.ops=%lu\n", name, (unsigned long)ops);
+	fflush(stdout);
+}
+
+/** make a name set like that of a large zone or many zones: hosts of
+ * varying depth below zones under a few top level domains */
+static void
+make_names(region_type* region)
+{
+	static const char* tlds[] = { "com", "net", "org", "nl", "de" };
+	static const char* hosts[] = { "www", "mail", "ns1", "ns2", "ftp",
+		"smtp", "_tcp", "_443._tcp" };
+	char buf[256];
+	size_t i;
+
+	names = region_alloc_array(region, num_names, sizeof(*names));
+	absent = region_alloc_array(region, num_names, sizeof(*absent));
+	srandom(1);
+	for(i = 0; i < num_names; i++) {
+		long z = random() % (long)(num_names/10 + 1);
+		const char* tld = tlds[z % 5];
+		switch(random() % 3) {
+		case 0:
+			snprintf(buf, sizeof(buf), "%s.zone%ld.%s.",
+				hosts[random() % 8], z, tld);
+			break;
+		case 1:
+			snprintf(buf, sizeof(buf), "h%ld.%s.zone%ld.%s.",
+				(long)i, hosts[random() % 8], z, tld);
+			break;
+		default:
+			snprintf(buf, sizeof(buf), "host-%ld.zone%ld.%s.",
+				(long)i, z, tld);
+			break;
+		}
+		names[i] = dname_parse(region, buf);
+		snprintf(buf, sizeof(buf), "nx%ld.zone%ld.%s.", (long)i, z,
+			tld);
+		absent[i] = dname_parse(region, buf);
+		if(!names[i] || !absent[i]) {
+			fprintf(stderr, "cannot parse %s\n", buf);
+			exit(1);
+		}
+	}
+}
+
+static void
+bench_radtree(void)
+{
+	region_type* region = region_create(xalloc, free);
+	struct radtree* rt = radix_tree_create(region);
+	struct radnode* n;
+	double start;
+	size_t i, r, ops;
+
+	start = now_usec();
+	for(i = 0; i < num_names; i++)
+		(void)radname_insert(rt, dname_name(names[i]),
+			names[i]->name_size, (void*)names[i]);
+	report("radtree.insert", start, num_names);
+
+	if(want("radtree.search")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(radname_search(rt, dname_name(names[i]),
+					names[i]->name_size))
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("radtree.search", start, ops);
+	}
+
+	if(want("radtree.search_labels")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(radname_search_labels(rt,
+					dname_name(names[i]),
+					dname_label_offsets(names[i]),
+					names[i]->label_count))
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("radtree.search_labels", start, ops);
+	}
+
+	if(want("radtree.find_less_equal")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(!radname_find_less_equal(rt,
+					dname_name(absent[i]),
+					absent[i]->name_size, &n) && n)
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("radtree.find_less_equal", start, ops);
+	}
+
+	if(want("radtree.next")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(n = radix_first(rt); n; n = radix_next(n))
+				ops++;
+		}
+		report("radtree.next", start, ops);
+	}
+	radix_tree_delete(rt);
+	region_destroy(region);
+}
+
+static int
+bench_dname_cmp(const void* a, const void* b)
+{
+	return dname_compare((const dname_type*)a, (const dname_type*)b);
+}
+
+static void
+bench_rbtree(void)
+{
+	region_type* region = region_create(xalloc, free);
+	rbtree_type* tree = rbtree_create(region, bench_dname_cmp);
+	rbnode_type* nodes = region_alloc_array(region, num_names,
+		sizeof(*nodes));
+	double start;
+	size_t i, r, ops;
+
+	start = now_usec();
+	for(i = 0; i < num_names; i++) {
+		nodes[i].key = names[i];
+		(void)rbtree_insert(tree, &nodes[i]);
+	}
+	report("rbtree.insert", start, num_names);
+
+	if(want("rbtree.search")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(rbtree_search(tree, names[i]))
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("rbtree.search", start, ops);
+	}
+
+	if(want("rbtree.find_less_equal")) {
+		rbnode_type* n;
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(!rbtree_find_less_equal(tree, absent[i],
+					&n) && n)
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("rbtree.find_less_equal", start, ops);
+	}
+	region_destroy(region);
+}
+
+static void
+bench_dname(region_type* region)
+{
+	double start;
+	size_t i, r, ops;
+
+	if(want("dname.compare")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 1; i < num_names; i++) {
+				if(dname_compare(names[i-1], names[i]) < 0)
+					sink++;
+			}
+			ops += num_names-1;
+		}
+		report("dname.compare", start, ops);
+	}
+
+	if(want("dname.compare_equal")) {
+		const dname_type** copies = region_alloc_array(region,
+			num_names, sizeof(*copies));
+		for(i = 0; i < num_names; i++)
+			copies[i] = dname_copy(region, names[i]);
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				if(dname_compare(names[i], copies[i]) == 0)
+					sink++;
+			}
+			ops += num_names;
+		}
+		report("dname.compare_equal", start, ops);
+	}
+
+	if(want("dname.parse")) {
+		region_type* tmp = region_create(xalloc, free);
+		char buf[MAXDOMAINLEN*5];
+		start = now_usec();
+		ops = 0;
+		for(i = 0; i < num_names; i++) {
+			dname_to_string_buf(names[i], NULL, buf);
+			if(dname_parse(tmp, buf))
+				sink++;
+			ops++;
+			if(ops % 1024 == 0)
+				region_free_all(tmp);
+		}
+		report("dname.parse", start, ops);
+		region_destroy(tmp);
+	}
+}
+
+static void
+bench_region(void)
+{
+	double start;
+	size_t i, r, ops;
+
+	if(want("region.alloc")) {
+		region_type* region = region_create(xalloc, free);
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++)
+				sink += (size_t)region_alloc(region,
+					16 + (i%16)*8);
+			region_free_all(region);
+			ops += num_names;
+		}
+		report("region.alloc", start, ops);
+		region_destroy(region);
+	}
+
+	if(want("region.recycle")) {
+		region_type* region = region_create(xalloc, free);
+		void* blocks[64];
+		memset(blocks, 0, sizeof(blocks));
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				size_t b = i%64, size = 16 + (b%16)*8;
+				if(blocks[b])
+					region_recycle(region, blocks[b],
+						size);
+				blocks[b] = region_alloc(region, size);
+			}
+			ops += num_names;
+		}
+		report("region.recycle", start, ops);
+		region_destroy(region);
+	}
+
+	if(want("region.arena")) {
+		/* the per query region of the server */
+		region_type* region = region_create_arena(xalloc, free,
+			16384, 16384/8, 32);
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				sink += (size_t)region_alloc(region, 64);
+				sink += (size_t)region_alloc(region, 256);
+				region_free_all(region);
+			}
+			ops += num_names;
+		}
+		report("region.arena", start, ops);
+		region_destroy(region);
+	}
+}
+
+/** the key of rrl_examine, the source prefix, the type and the name */
+static size_t
+bench_rrl_key(uint8_t* buf, size_t i)
+{
+	uint64_t source = (uint64_t)(0xc0a80000 + (i & 0xffff)) << 8;
+	uint16_t c = 0x0001;
+	const dname_type* d = names[i];
+	memcpy(buf, &source, sizeof(source));
+	memcpy(buf+sizeof(source), &c, sizeof(c));
+	memcpy(buf+sizeof(source)+sizeof(c), dname_name(d), d->name_size);
+	return sizeof(source) + sizeof(c) + d->name_size;
+}
+
+static void
+bench_hash(void)
+{
+	uint8_t buf[MAXDOMAINLEN + 16];
+	double start;
+	size_t i, r, ops, len;
+
+	if(want("hash.rrl.lookup3")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				len = bench_rrl_key(buf, i);
+				sink += hashlittle(buf, len, 0x267fcd16);
+			}
+			ops += num_names;
+		}
+		report("hash.rrl.lookup3", start, ops);
+	}
+	if(want("hash.rrl.fasthash")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++) {
+				len = bench_rrl_key(buf, i);
+				sink += fasthash32(buf, len, 0x267fcd16);
+			}
+			ops += num_names;
+		}
+		report("hash.rrl.fasthash", start, ops);
+	}
+	if(want("hash.name.lookup3")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++)
+				sink += hashlittle(dname_name(names[i]),
+					names[i]->name_size, 0);
+			ops += num_names;
+		}
+		report("hash.name.lookup3", start, ops);
+	}
+	if(want("hash.name.fasthash")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < num_names; i++)
+				sink += fasthash32(dname_name(names[i]),
+					names[i]->name_size, 0);
+			ops += num_names;
+		}
+		report("hash.name.fasthash", start, ops);
+	}
+}
+
+#ifdef NSEC3
+/* an NSEC3 owner hash, for the chain of the generated zone */
+struct bench_hash {
+	uint8_t hash[SHA_DIGEST_LENGTH];
+	char b32[SHA_DIGEST_LENGTH*2];
+	int apex;
+};
+
+static int
+bench_hash_cmp(const void* a, const void* b)
+{
+	return memcmp(((const struct bench_hash*)a)->hash,
+		((const struct bench_hash*)b)->hash, SHA_DIGEST_LENGTH);
+}
+
+static void
+bench_hash_name(region_type* region, struct bench_hash* h, const char* str,
+	int apex)
+{
+	const dname_type* d = dname_parse(region, str);
+	if(!d) {
+		fprintf(stderr, "cannot parse %s\n", str);
+		exit(1);
+	}
+	(void)iterated_hash(h->hash, NULL, 0, dname_name(d), d->name_size, 0);
+	if(b32_ntop(h->hash, sizeof(h->hash), h->b32, sizeof(h->b32)) == -1) {
+		fprintf(stderr, "cannot b32 %s\n", str);
+		exit(1);
+	}
+	h->apex = apex;
+}
+
+/** write the NSEC3 chain, with no salt and no extra iterations, and the
+ * DNSKEY and its signature that make the zone secure. The signatures do
+ * not validate, they are only there for the size of the answers. */
+static void
+write_nsec3(FILE* out, const char* origin, size_t hosts)
+{
+	region_type* region = region_create(xalloc, free);
+	size_t num = hosts + 3, i;
+	struct bench_hash* h = region_alloc_array(region, num, sizeof(*h));
+	char buf[256], sig[89];
+	memset(sig, 'A', sizeof(sig));
+	sig[86] = '=';
+	sig[87] = '=';
+	sig[88] = 0;
+	bench_hash_name(region, &h[0], origin, 1);
+	snprintf(buf, sizeof(buf), "ns1.%s", origin);
+	bench_hash_name(region, &h[1], buf, 0);
+	snprintf(buf, sizeof(buf), "ns2.%s", origin);
+	bench_hash_name(region, &h[2], buf, 0);
+	for(i = 0; i < hosts; i++) {
+		snprintf(buf, sizeof(buf), "host%u.%s", (unsigned)i, origin);
+		bench_hash_name(region, &h[i+3], buf, 0);
+	}
+	qsort(h, num, sizeof(*h), bench_hash_cmp);
+	fprintf(out, "@ DNSKEY 257 3 13 %s\n", sig);
+	fprintf(out, "@ NSEC3PARAM 1 0 0 -\n");
+	fprintf(out, "@ RRSIG DNSKEY 13 2 3600 20500101000000 "
+		"20200101000000 1 %s %s\n", origin, sig);
+	fprintf(out, "@ RRSIG SOA 13 2 3600 20500101000000 "
+		"20200101000000 1 %s %s\n", origin, sig);
+	for(i = 0; i < num; i++) {
+		fprintf(out, "%s NSEC3 1 0 0 - %s %s\n", h[i].b32,
+			h[(i+1)%num].b32, h[i].apex?
+			"SOA NS DNSKEY NSEC3PARAM RRSIG":"A AAAA MX TXT RRSIG");
+		fprintf(out, "%s RRSIG NSEC3 13 3 3600 20500101000000 "
+			"20200101000000 1 %s %s\n", h[i].b32, origin, sig);
+	}
+	region_destroy(region);
+}
+#endif /* NSEC3 */
+
+/** write a zone with hosts that have an address, and mail and text data,
+ * with an NSEC3 chain if asked for */
+static char*
+make_zone(const char* origin, size_t hosts, int nsec3)
+{
+	char fname[256];
+	FILE* out;
+	size_t i;
+	snprintf(fname, sizeof(fname), "/tmp/nsd-microbench.%u.%szone",
+		(unsigned)getpid(), origin);
+	if(!(out = fopen(fname, "w"))) {
+		fprintf(stderr, "cannot write %s: %s\n", fname,
+			strerror(errno));
+		exit(1);
+	}
+	fprintf(out, "$ORIGIN %s\n$TTL 3600\n"
+		"@ SOA ns1 hostmaster 1 3600 900 604800 3600\n"
+		"@ NS ns1\n@ NS ns2\n"
+		"ns1 A 192.0.2.1\nns1 AAAA 2001:db8::1\n"
+		"ns2 A 192.0.2.2\nns2 AAAA 2001:db8::2\n", origin);
+	for(i = 0; i < hosts; i++) {
+		fprintf(out, "host%u A 192.0.2.%u\n", (unsigned)i,
+			(unsigned)(i%250+3));
+		fprintf(out, "host%u A 198.51.100.%u\n", (unsigned)i,
+			(unsigned)(i%250+3));
+		fprintf(out, "host%u AAAA 2001:db8::%x\n", (unsigned)i,
+			(unsigned)i);
+		fprintf(out, "host%u MX 10 mail%u\n", (unsigned)i,
+			(unsigned)(i%10));
+		fprintf(out, "host%u TXT \"v=spf1 mx -all\"\n", (unsigned)i);
+	}
+#ifdef NSEC3
+	if(nsec3)
+		write_nsec3(out, origin, hosts);
+#else
+	(void)nsec3;
+#endif
+	fclose(out);
+	return strdup(fname);
+}
+
+/** load the zones in a new namedb, for the nsd struct */
+static struct namedb*
+load_zones(region_type* region, const char** origins, char** fnames,
+	size_t num)
+{
+	struct nsd_options* opt = nsd_options_create(region);
+	size_t i;
+	for(i = 0; i < num; i++) {
+		struct zone_options* zone = zone_options_create(region);
+		memset(zone, 0, sizeof(*zone));
+		zone->name = region_strdup(region, origins[i]);
+		zone->pattern = pattern_options_create(region);
+		zone->pattern->pname = zone->name;
+		zone->pattern->zonefile = region_strdup(region, fnames[i]);
+		if(!nsd_options_insert_zone(opt, zone)) {
+			fprintf(stderr, "cannot add the zone %s\n",
+				origins[i]);
+			exit(1);
+		}
+	}
+	memset(&nsd, 0, sizeof(nsd));
+	nsd.region = region;
+	nsd.options = opt;
+	if(!(nsd.db = namedb_open(opt))) {
+		fprintf(stderr, "cannot open the namedb\n");
+		exit(1);
+	}
+	namedb_check_zonefiles(&nsd, opt, NULL, NULL);
+	for(i = 0; i < num; i++) {
+		unlink(fnames[i]);
+		free(fnames[i]);
+	}
+	return nsd.db;
+}
+
+static void
+bench_packet(void)
+{
+	static struct compression_table compression;
+	region_type* region = region_create(xalloc, free);
+	size_t hosts = num_names/10 + 1, i, r, ops;
+	const char* origin = "bench.example.";
+	char* fname = make_zone(origin, hosts, 0);
+	struct namedb* db = load_zones(region, &origin, &fname, 1);
+	const dname_type* apexname = dname_parse(region, origin);
+	zone_type* zone = namedb_find_zone(db, apexname);
+	domain_type** domains;
+	query_type* q;
+	double start;
+	int done;
+
+	if(!zone || !zone->apex || !zone->ns_rrset) {
+		fprintf(stderr, "the zone did not load\n");
+		exit(1);
+	}
+	domains = region_alloc_array(region, hosts, sizeof(*domains));
+	for(i = 0; i < hosts; i++) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "host%u.bench.example.",
+			(unsigned)i);
+		domains[i] = domain_table_find(db->domains,
+			dname_parse(region, buf));
+		if(!domains[i]) {
+			fprintf(stderr, "%s is not in the zone\n", buf);
+			exit(1);
+		}
+	}
+	q = query_create(region, &compression,
+		domain_table_count(db->domains) + 1);
+
+	if(want("packet.encode_rrset")) {
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < hosts; i++) {
+				rrset_type* rrset = domain_find_rrset(
+					domains[i], zone, TYPE_A);
+				query_clear_compression_tables(q);
+				query_reset(q, 65535, 0);
+				buffer_skip(q->packet, QHEADERSZ);
+				done = 0;
+				sink += packet_encode_rrset(q, domains[i],
+					rrset, ANSWER_SECTION, 0, &done);
+			}
+			ops += hosts;
+		}
+		report("packet.encode_rrset", start, ops);
+	}
+
+	if(want("packet.encode_answer")) {
+		answer_type answer;
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < hosts; i++) {
+				query_clear_compression_tables(q);
+				query_reset(q, 65535, 0);
+				buffer_skip(q->packet, QHEADERSZ);
+				answer_init(&answer);
+				(void)answer_add_rrset(&answer, ANSWER_SECTION,
+					domains[i], domain_find_rrset(
+					domains[i], zone, TYPE_MX));
+				(void)answer_add_rrset(&answer,
+					AUTHORITY_SECTION, zone->apex,
+					zone->ns_rrset);
+				encode_answer(q, &answer);
+				sink += buffer_position(q->packet);
+			}
+			ops += hosts;
+		}
+		report("packet.encode_answer", start, ops);
+	}
+	query_clear_compression_tables(q);
+	namedb_close(db);
+	region_destroy(region);
+}
+
+/** write the zone to a zonefile, and create an IXFR by comparing a
+ * spooled copy of the zone with it, per RR of the zone */
+static void
+bench_zone(void)
+{
+	region_type* region = region_create(xalloc, free);
+	size_t hosts = num_names/10 + 1, r, ops, rrs = 0;
+	const char* origin = "nsec3.example.";
+	char* fname = make_zone(origin, hosts, 1);
+	struct namedb* db = load_zones(region, &origin, &fname, 1);
+	zone_type* zone = namedb_find_zone(db, dname_parse(region, origin));
+	domain_type* domain;
+	rrset_type* rrset;
+	char zfile[256], ixfrfile[300];
+	double start;
+
+	if(!zone || !zone->soa_rrset) {
+		fprintf(stderr, "the zone did not load\n");
+		exit(1);
+	}
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next)
+			rrs += rrset->rr_count;
+	}
+
+	if(want("zone.write")) {
+		FILE* out = fopen("/dev/null", "w");
+		if(!out) {
+			fprintf(stderr, "cannot open /dev/null: %s\n",
+				strerror(errno));
+			exit(1);
+		}
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			if(!print_rrs(out, zone)) {
+				fprintf(stderr, "cannot write the zone\n");
+				exit(1);
+			}
+			ops += rrs;
+		}
+		report("zone.write", start, ops);
+		fclose(out);
+	}
+
+	if(want("zone.ixfr_create")) {
+		snprintf(zfile, sizeof(zfile), "/tmp/nsd-microbench.%u.ixfr.zone",
+			(unsigned)getpid());
+		snprintf(ixfrfile, sizeof(ixfrfile), "%s.ixfr", zfile);
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			struct ixfr_create* ixfrcr = ixfr_create_start(zone,
+				zfile, zone->opts->pattern->ixfr_size, 0);
+			uint8_t* serial;
+			if(!ixfrcr) {
+				fprintf(stderr, "cannot spool the zone\n");
+				exit(1);
+			}
+			/* the new version has the next serial, and the
+			 * same RRs, all of them are compared */
+			serial = rdata_atom_data(zone->soa_rrset->rrs[0].
+				rdatas[2]);
+			write_uint32(serial, read_uint32(serial)+1);
+			if(!ixfr_create_perform(ixfrcr, zone, 0, &nsd, zfile,
+				1)) {
+				fprintf(stderr, "cannot create the ixfr\n");
+				exit(1);
+			}
+			ixfr_create_free(ixfrcr);
+			unlink(ixfrfile);
+			ops += rrs;
+		}
+		report("zone.ixfr_create", start, ops);
+	}
+	namedb_close(db);
+	region_destroy(region);
+}
+
+/** the mallocs done by the query region */
+static size_t query_allocs;
+
+static void*
+count_alloc(size_t size)
+{
+	query_allocs++;
+	return xalloc(size);
+}
+
+/** a case of the query benchmark, that is compared with the others */
+struct bench_case {
+	const char* name;
+	/* the zone that is queried, 1 is signed with NSEC3 */
+	int zone;
+	int edns, dnssec_ok, cookie, tsig, rrl, rcache;
+	/* the type of all the queries, with TYPE_SOA for the SOA of the
+	 * zone, like refresh probes, or 0 for a mix of types */
+	uint16_t qtype;
+};
+
+static const struct bench_case bench_cases[] = {
+	{ "query.plain", 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ "query.edns", 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ "query.dnssec_ok", 0, 1, 1, 0, 0, 0, 0, 0 },
+#ifdef NSEC3
+	{ "query.nsec3", 1, 1, 1, 0, 0, 0, 0, 0 },
+#endif
+	{ "query.cookie", 0, 1, 0, 1, 0, 0, 0, 0 },
+#ifdef HAVE_SSL
+	{ "query.tsig", 0, 1, 0, 0, 1, 0, 0, 0 },
+	{ "query.soa_tsig", 0, 1, 0, 0, 1, 0, 0, TYPE_SOA },
+	{ "query.soa_tsig_rcache", 0, 1, 0, 0, 1, 0, 1, TYPE_SOA },
+#endif
+#ifdef RATELIMIT
+	{ "query.rrl", 0, 1, 0, 0, 0, 1, 0, 0 },
+#endif
+	{ "query.rcache", 0, 1, 0, 0, 0, 0, 1, 0 },
+	{ "query.any", 0, 1, 0, 0, 0, 0, 0, TYPE_ANY },
+#ifdef NSEC3
+	{ "query.any_nsec3", 1, 1, 1, 0, 0, 0, 0, TYPE_ANY },
+#endif
+	{ NULL, 0, 0, 0, 0, 0, 0, 0, 0 }
+};
+
+/** the client address of the j-th query, spread over many /24 prefixes so
+ * that rate limiting keeps track of them all, and does not drop them */
+static void
+bench_client(query_type* q, size_t j)
+{
+	struct sockaddr_in* sin = (struct sockaddr_in*)&q->client_addr;
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(53000);
+	sin->sin_addr.s_addr = htonl(0x0a000001 | (uint32_t)((j&0xffff)<<8));
+	q->client_addrlen = (socklen_t)sizeof(*sin);
+	memcpy(&q->remote_addr, sin, sizeof(*sin));
+	q->remote_addrlen = q->client_addrlen;
+}
+
+/** create the wire format query, with EDNS, the DO flag and a cookie from
+ * the case, and sign it if the case has TSIG */
+static buffer_type*
+make_query(region_type* region, const struct bench_case* c,
+	const dname_type* qname, uint16_t qtype, const uint8_t* cookie,
+	size_t cookie_len, tsig_record_type* tsig, tsig_key_type* key)
+{
+	buffer_type* b = buffer_create(region, QIOBUFSZ);
+	buffer_write_u16(b, (uint16_t)random());
+	buffer_write_u16(b, 0);
+	buffer_write_u16(b, 1);
+	buffer_write_u16(b, 0);
+	buffer_write_u16(b, 0);
+	buffer_write_u16(b, c->edns ? 1 : 0);
+	buffer_write(b, dname_name(qname), qname->name_size);
+	buffer_write_u16(b, qtype);
+	buffer_write_u16(b, CLASS_IN);
+	if(c->edns) {
+		buffer_write_u8(b, 0);
+		buffer_write_u16(b, TYPE_OPT);
+		buffer_write_u16(b, 1232);
+		buffer_write_u32(b, c->dnssec_ok ? 0x00008000 : 0);
+		if(c->cookie) {
+			buffer_write_u16(b, (uint16_t)(4 + cookie_len));
+			buffer_write_u16(b, COOKIE_CODE);
+			buffer_write_u16(b, (uint16_t)cookie_len);
+			buffer_write(b, cookie, cookie_len);
+		} else	buffer_write_u16(b, 0);
+	}
+#ifdef HAVE_SSL
+	if(c->tsig) {
+		tsig_init_record(tsig, tsig_get_algorithm_by_name(
+			"hmac-sha256"), key);
+		tsig_init_query(tsig, ID(b));
+		tsig_prepare(tsig);
+		tsig_update(tsig, b, buffer_position(b));
+		tsig_sign(tsig);
+		tsig_append_rr(tsig, b);
+		ARCOUNT_SET(b, ARCOUNT(b) + 1);
+	}
+#else
+	(void)tsig; (void)key;
+#endif
+	buffer_flip(b);
+	return b;
+}
+
+/** answer the query like the server does for UDP, returns the state */
+static query_state_type
+run_query(query_type* q, buffer_type* wire, size_t j, int rrl,
+	uint32_t* now)
+{
+	query_state_type state;
+	query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+	bench_client(q, j);
+	buffer_write(q->packet, buffer_begin(wire), buffer_limit(wire));
+	buffer_flip(q->packet);
+	state = query_process(q, &nsd, now);
+#ifdef RATELIMIT
+	if(rrl && state != QUERY_DISCARDED &&
+		q->edns.cookie_status != COOKIE_VALID &&
+		q->edns.cookie_status != COOKIE_VALID_REUSE &&
+		rrl_process_query(q, &nsd))
+		state = rrl_slip(q);
+#else
+	(void)rrl;
+#endif
+	if(state != QUERY_DISCARDED)
+		query_add_optional(q, &nsd, now);
+	buffer_flip(q->packet);
+	return state;
+}
+
+/** get the server cookie from the answer, it is in the last option of
+ * the OPT record at the end of the answer. Returns 0 if not there. */
+static int
+answer_cookie(query_type* q, uint8_t* cookie)
+{
+	size_t len = buffer_limit(q->packet);
+	uint8_t* p = buffer_begin(q->packet);
+	if(len < QHEADERSZ + 28 || read_uint16(p+len-28) != COOKIE_CODE ||
+		read_uint16(p+len-26) != 24)
+		return 0;
+	memcpy(cookie, p+len-24, 24);
+	return 1;
+}
+
+/** the queries of a case: an existing name, a name that does not exist
+ * and a type that does not exist, for every host, or the SOA of the zone
+ * three times, for the SOA cases, or with the type of the case */
+static buffer_type**
+make_queries(region_type* region, query_type* q, const struct bench_case* c,
+	const char* origin, size_t hosts, size_t* num, tsig_key_type* key)
+{
+	buffer_type** wires = region_alloc_array(region, hosts*3,
+		sizeof(*wires));
+	tsig_record_type tsig;
+	uint8_t cookie[24];
+	uint32_t now = 0;
+	size_t i, j = 0;
+
+	tsig_create_record(&tsig, region);
+	for(i = 0; i < hosts*3; i++) {
+		char buf[256];
+		uint16_t qtype = TYPE_A;
+		const dname_type* qname;
+		if(i%3 == 0) {
+			snprintf(buf, sizeof(buf), "host%u.%s",
+				(unsigned)(i/3), origin);
+		} else if(i%3 == 1) {
+			snprintf(buf, sizeof(buf), "nx%u.%s",
+				(unsigned)(i/3), origin);
+		} else {
+			snprintf(buf, sizeof(buf), "host%u.%s",
+				(unsigned)(i/3), origin);
+			qtype = TYPE_SRV;
+		}
+		if(c->qtype == TYPE_SOA)
+			snprintf(buf, sizeof(buf), "%s", origin);
+		if(c->qtype != 0)
+			qtype = c->qtype;
+		qname = dname_parse(region, buf);
+		/* a client cookie, and the server cookie from the answer to
+		 * that, so that the server verifies the full cookie */
+		memset(cookie, 0, sizeof(cookie));
+		write_uint32(cookie, (uint32_t)i);
+		wires[j] = make_query(region, c, qname, qtype, cookie, 8,
+			&tsig, key);
+		if(c->cookie) {
+			(void)run_query(q, wires[j], j, 0, &now);
+			if(!answer_cookie(q, cookie)) {
+				fprintf(stderr, "no server cookie for %s\n",
+					buf);
+				exit(1);
+			}
+			wires[j] = make_query(region, c, qname, qtype, cookie,
+				24, &tsig, key);
+		}
+		j++;
+	}
+	tsig_delete_record(&tsig, region);
+	*num = j;
+	return wires;
+}
+
+static void
+bench_query(void)
+{
+	static struct compression_table compression;
+	region_type* region = region_create(xalloc, free);
+	size_t hosts = num_names/10 + 1;
+	const char* origins[2] = { "bench.example.", "nsec3.example." };
+	char* fnames[2];
+	tsig_key_type* key = NULL;
+	query_type* q;
+	const struct bench_case* c;
+	size_t i;
+
+	fnames[0] = make_zone(origins[0], hosts, 0);
+	fnames[1] = make_zone(origins[1], hosts, 1);
+	(void)load_zones(region, origins, fnames, 2);
+#ifdef BIND8_STATS
+	nsd.st = (struct nsdst*)region_alloc_zero(region, sizeof(struct nsdst));
+#endif
+	edns_init_data(&nsd.edns_ipv4, 1232);
+	edns_init_data(&nsd.edns_ipv6, 1232);
+	nsd.cookie_count = 1;
+	for(i = 0; i < NSD_COOKIE_SECRET_SIZE; i++)
+		nsd.cookie_secrets[0].cookie_secret[i] = (uint8_t)random();
+	cookie_keys_setup(&nsd);
+	if(!tsig_init(region)) {
+		fprintf(stderr, "cannot init tsig\n");
+		exit(1);
+	}
+#ifdef HAVE_SSL
+	{
+		struct key_options* k = key_options_create(region);
+		k->name = region_strdup(region, "bench-key.");
+		k->algorithm = region_strdup(region, "hmac-sha256");
+		k->secret = region_strdup(region,
+			"K2tf3TRjvQkVCmJF3/Z9vA5MTBlmr3V7yQKs6s9Cq2c=");
+		key_options_insert(nsd.options, k);
+		key_options_setup(region, k);
+		tsig_add_key(k->tsig_key);
+		key = k->tsig_key;
+	}
+#endif
+#ifdef RATELIMIT
+	hash_set_raninit(1);
+	rrl_mmap_init(1, nsd.options->rrl_size, nsd.options->rrl_ratelimit,
+		nsd.options->rrl_whitelist_ratelimit, nsd.options->rrl_slip,
+		nsd.options->rrl_ipv4_prefix_length,
+		nsd.options->rrl_ipv6_prefix_length, 0);
+	rrl_zones_set_limits(nsd.db);
+	rrl_init(0);
+#endif
+	q = query_create(region, &compression,
+		domain_table_count(nsd.db->domains) + 1);
+	/* count the mallocs of the query region, that should be none once
+	 * its chunks are there */
+	region_destroy(q->region);
+	q->region = region_create_arena(count_alloc, free, 16384, 16384/8, 32);
+
+	for(c = bench_cases; c->name; c++) {
+		region_type* tmp;
+		buffer_type** wires;
+		size_t num, r, j, ops = 0, answered = 0;
+		uint32_t now;
+		double start;
+		if(!want(c->name))
+			continue;
+		tmp = region_create(xalloc, free);
+		nsd.do_answer_cookie = c->cookie;
+		if(c->rcache)
+			respcache_init(hosts*4);
+		wires = make_queries(tmp, q, c, origins[c->zone], hosts, &num,
+			key);
+		query_allocs = 0;
+		start = now_usec();
+		for(r = 0; r < repeat; r++) {
+			now = 0;
+			for(j = 0; j < num; j++) {
+				if(run_query(q, wires[j], j, c->rrl, &now) !=
+					QUERY_DISCARDED)
+					answered++;
+				sink += buffer_remaining(q->packet);
+			}
+			ops += num;
+		}
+		report(c->name, start, ops);
+		printf("%s.allocs=%.3f\n", c->name, ops?
+			(double)query_allocs/(double)ops:0);
+		printf("%s.answered=%lu\n", c->name, (unsigned long)answered);
+		if(c->rcache)
+			respcache_deinit();
+		nsd.do_answer_cookie = 0;
+		region_destroy(tmp);
+	}
+#ifdef RATELIMIT
+	rrl_deinit(0);
+	rrl_mmap_deinit();
+#endif
+	query_clear_compression_tables(q);
+	namedb_close(nsd.db);
+	region_destroy(region);
+}
+
+#ifdef HAVE_SSL
+/** sign the packets of AXFR transfers, and signed queries */
+static void
+bench_tsig(void)
+{
+	region_type* region = region_create(xalloc, free);
+	struct key_options* k;
+	tsig_record_type tsig;
+	buffer_type* packet = buffer_create(region, MAX_PACKET_SIZE);
+	size_t packets = num_names/100 + 1;
+	size_t r, i, ops, len = 16384;
+	double start;
+	if(!tsig_init(region)) {
+		fprintf(stderr, "cannot init tsig\n");
+		exit(1);
+	}
+	k = key_options_create(region);
+	k->name = region_strdup(region, "bench-key.");
+	k->algorithm = region_strdup(region, "hmac-sha256");
+	k->secret = region_strdup(region,
+		"K2tf3TRjvQkVCmJF3/Z9vA5MTBlmr3V7yQKs6s9Cq2c=");
+	key_options_setup(region, k);
+	tsig_create_record(&tsig, region);
+
+	if(want("tsig.axfr")) {
+		/* every packet of the transfer is signed, the packets are
+		 * the size that AXFR makes them */
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			tsig_init_record(&tsig, tsig_get_algorithm_by_name(
+				"hmac-sha256"), k->tsig_key);
+			tsig_init_query(&tsig, 0x1234);
+			for(i = 0; i < packets; i++) {
+				buffer_clear(packet);
+				ID_SET(packet, 0x1234);
+				QR_SET(packet);
+				memset(buffer_at(packet, QHEADERSZ), (int)i,
+					len - QHEADERSZ);
+				buffer_set_position(packet, len);
+				tsig_prepare(&tsig);
+				tsig_update(&tsig, packet, buffer_position(packet));
+				tsig_sign(&tsig);
+				tsig_append_rr(&tsig, packet);
+				sink += buffer_position(packet);
+			}
+			ops += packets;
+		}
+		report("tsig.axfr", start, ops);
+		printf("tsig.axfr.mbps=%.1f\n", (double)ops*(double)len*8.0/
+			(now_usec()-start));
+	}
+
+	if(want("tsig.query")) {
+		/* every query starts a new TSIG record with the key */
+		start = now_usec();
+		ops = 0;
+		for(r = 0; r < repeat; r++) {
+			for(i = 0; i < packets*10; i++) {
+				tsig_init_record(&tsig, tsig_get_algorithm_by_name(
+					"hmac-sha256"), k->tsig_key);
+				tsig_init_query(&tsig, (uint16_t)i);
+				buffer_clear(packet);
+				ID_SET(packet, (uint16_t)i);
+				buffer_set_position(packet, QHEADERSZ + 32);
+				tsig_prepare(&tsig);
+				tsig_update(&tsig, packet, buffer_position(packet));
+				tsig_sign(&tsig);
+				tsig_append_rr(&tsig, packet);
+				sink += buffer_position(packet);
+			}
+			ops += packets*10;
+		}
+		report("tsig.query", start, ops);
+	}
+	tsig_delete_record(&tsig, region);
+	region_destroy(region);
+}
+#endif /* HAVE_SSL */
+
+/** parse a config with the number of zones, that use one pattern, or
+ * that have an option of their own as well, per zone, and print the
+ * memory used per zone */
+static void
+bench_config_zones(size_t zones, int override)
+{
+	char fname[256], name[64];
+	region_type* region;
+	struct nsd_options* opt;
+	FILE* out;
+	size_t i;
+	double start;
+	snprintf(name, sizeof(name), "config.%s.%lu",
+		override?"override":"pattern", (unsigned long)zones);
+	if(!want(name))
+		return;
+	snprintf(fname, sizeof(fname), "/tmp/nsd-microbench.%u.conf",
+		(unsigned)getpid());
+	if(!(out = fopen(fname, "w"))) {
+		fprintf(stderr, "cannot write %s: %s\n", fname,
+			strerror(errno));
+		exit(1);
+	}
+	fprintf(out, "pattern:\n\tname: \"secondary\"\n"
+		"\tzonefile: \"%%s.zone\"\n"
+		"\tallow-notify: 192.0.2.1 NOKEY\n"
+		"\trequest-xfr: 192.0.2.1 NOKEY\n"
+		"\tnotify: 192.0.2.2 NOKEY\n"
+		"\tprovide-xfr: 192.0.2.2 NOKEY\n");
+	for(i = 0; i < zones; i++) {
+		fprintf(out, "zone:\n\tname: \"zone%u.example\"\n"
+			"\tinclude-pattern: \"secondary\"\n", (unsigned)i);
+		if(override)
+			fprintf(out, "\tzonefile: \"zone%u.zone\"\n",
+				(unsigned)i);
+	}
+	fclose(out);
+
+	region = region_create(xalloc, free);
+	opt = nsd_options_create(region);
+	start = now_usec();
+	if(!parse_options_file(opt, fname, NULL, NULL, NULL)) {
+		fprintf(stderr, "cannot parse %s\n", fname);
+		exit(1);
+	}
+	report(name, start, zones);
+	printf("%s.bytes=%.1f\n", name, zones ?
+		(double)region_get_mem(region)/(double)zones : 0);
+	region_destroy(region);
+	/* the parser state was in the region */
+	cfg_parser = NULL;
+	unlink(fname);
+}
+
+/** the config load time and memory versus the number of zones */
+static void
+bench_config(void)
+{
+	size_t zones;
+	for(zones = num_names/100 + 1; zones <= num_names; zones *= 10) {
+		bench_config_zones(zones, 0);
+		bench_config_zones(zones, 1);
+	}
+}
+
+static void
+usage(void)
+{
+	printf("usage:	nsd-microbench [options]\n");
+	printf(" -n num		number of names, default 100000\n");
+	printf(" -r num		repeats of the operations, default 10\n");
+	printf(" -t text		only the benchmarks with text in their name,\n");
+	printf("		radtree, rbtree, dname, region, hash, packet, zone,\n");
+	printf("		query, tsig, config\n");
+	printf(" -h		this help\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+	region_type* region;
+	int c;
+
+	log_init("nsd-microbench");
+	while((c = getopt(argc, argv, "hn:r:t:")) != -1) {
+		switch(c) {
+		case 'n':
+			num_names = (size_t)atoi(optarg);
+			break;
+		case 'r':
+			repeat = (size_t)atoi(optarg);
+			break;
+		case 't':
+			filter = optarg;
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		default:
+			usage();
+			exit(1);
+		}
+	}
+	if(num_names < 2 || repeat < 1) {
+		usage();
+		exit(1);
+	}
+	region = region_create(xalloc, free);
+	make_names(region);
+	printf("names=%lu\n", (unsigned long)num_names);
+	printf("repeat=%lu\n", (unsigned long)repeat);
+	if(want("radtree"))
+		bench_radtree();
+	if(want("rbtree"))
+		bench_rbtree();
+	if(want("dname"))
+		bench_dname(region);
+	if(want("region"))
+		bench_region();
+	if(want("hash"))
+		bench_hash();
+	if(want("packet"))
+		bench_packet();
+	if(want("zone"))
+		bench_zone();
+	if(want("query"))
+		bench_query();
+	if(want("config"))
+		bench_config();
+#ifdef HAVE_SSL
+	if(want("tsig"))
+		bench_tsig();
+#endif
+	region_destroy(region);
+	return 0;
+}
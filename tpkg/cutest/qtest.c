@@ -17,24 +17,18 @@
 #include "dname.h"
 #include "rdata.h"
 
-static uint16_t *compressed_dname_offsets = 0;
-static uint32_t compression_table_capacity = 0;
+static struct compression_table *compression_table = NULL;
 static uint32_t compression_table_size = 0;
-static domain_type* compressed_dnames[MAXRRSPP];
 
 /* fake compression table implementation, copy from server.c */
 static void init_dname_compr(nsd_type* nsd)
 {
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
-	needed += EXTRA_DOMAIN_NUMBERS;
-	if(compression_table_capacity < needed) {
-		compressed_dname_offsets = (uint16_t *) xalloc(
-					needed * sizeof(uint16_t));
-		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
-	}
-	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
-        compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
+	if(!compression_table)
+		compression_table = (struct compression_table *) xalloc_zero(
+			sizeof(*compression_table));
+	else	memset(compression_table->entries, 0,
+			sizeof(compression_table->entries));
+	compression_table_size = domain_table_count(nsd->db->domains) + 1;
 }
 
 /* create the answer to one query */
@@ -103,10 +97,9 @@ qsetup(nsd_type* nsd, region_type* region, query_type** query, char* config)
 	namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
 
 	/* setup query */
-	compression_table_capacity = 0;
 	init_dname_compr(nsd);
-	*query = query_create(region, compressed_dname_offsets,
-		compression_table_size, compressed_dnames);
+	*query = query_create(region, compression_table,
+		compression_table_size);
 }
 
 void
@@ -581,7 +574,7 @@ int runqtest(char* config, char* qfile, int verbose)
 		do_write(qs, query, &nsd, "qfile.out");
 
 	qfree(qs);
-	free(compressed_dname_offsets);
+	free(compression_table);
 	region_destroy(region);
 	return 0;
 }
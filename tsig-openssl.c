@@ -38,8 +38,45 @@ struct tsig_openssl_context {
 	EVP_MAC_CTX* hmac_ctx;
 	/* the size of destination buffers */
 	size_t outsize;
+	/* the algorithm and key that are set in the hmac_ctx, the next
+	 * message with them starts again with the same context */
+	tsig_algorithm_type* algorithm;
+	tsig_key_type* key;
 };
 
+/* number of keys with a context in the cache */
+#define TSIG_KEY_CACHE_SIZE 16
+/* keys that are larger than this are not cached */
+#define TSIG_KEY_CACHE_MAX_KEY 128
+
+/*
+ * The HMAC context with the key set in it, that has the inner and outer
+ * pads of the key computed. It is copied for the messages with the key,
+ * the pads are not computed again. The key data is kept to check that
+ * the key is the same, keys can change with a reconfig.
+ */
+struct tsig_key_cache {
+	tsig_algorithm_type* algorithm;
+	size_t size;
+	uint8_t data[TSIG_KEY_CACHE_MAX_KEY];
+	EVP_MAC_CTX* hmac_ctx;
+};
+static struct tsig_key_cache tsig_key_cache[TSIG_KEY_CACHE_SIZE];
+
+/* free the contexts in the key cache, and wipe the keys */
+static void
+key_cache_clear(void)
+{
+	size_t i;
+	for(i=0; i<TSIG_KEY_CACHE_SIZE; i++) {
+		EVP_MAC_CTX_free(tsig_key_cache[i].hmac_ctx);
+		tsig_key_cache[i].hmac_ctx = NULL;
+		tsig_key_cache[i].algorithm = NULL;
+		explicit_bzero(tsig_key_cache[i].data,
+			sizeof(tsig_key_cache[i].data));
+	}
+}
+
 static void
 cleanup_tsig_openssl_data(void *data)
 {
@@ -145,6 +182,10 @@ int
 tsig_openssl_init(region_type *region)
 {
 	int count = 0;
+#ifdef HAVE_EVP_MAC_CTX_NEW
+	/* the algorithms are created again, the cache has the old ones */
+	key_cache_clear();
+#endif
 #if OPENSSL_VERSION_NUMBER < 0x10100000 || !defined(HAVE_OPENSSL_INIT_CRYPTO)
 	OpenSSL_add_all_digests();
 #else
@@ -185,6 +226,66 @@ cleanup_context(void *data)
 #endif
 }
 
+#ifdef HAVE_EVP_MAC_CTX_NEW
+/* create a new HMAC context, with the algorithm and the key set in it */
+static EVP_MAC_CTX*
+new_key_context(tsig_algorithm_type *algorithm, tsig_key_type *key)
+{
+	OSSL_PARAM params[3];
+	struct tsig_openssl_data* algo_data = (struct tsig_openssl_data*)
+		algorithm->data;
+	EVP_MAC_CTX* hmac_ctx = EVP_MAC_CTX_new(algo_data->mac);
+	if(!hmac_ctx) {
+		log_msg(LOG_ERR, "could not EVP_MAC_CTX_new");
+		return NULL;
+	}
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+		(char*)algo_data->digest, 0);
+	params[1] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+		key->data, key->size);
+	params[2] = OSSL_PARAM_construct_end();
+#ifdef HAVE_EVP_MAC_CTX_SET_PARAMS
+	if(EVP_MAC_CTX_set_params(hmac_ctx, params) <= 0) {
+		log_msg(LOG_ERR, "could not EVP_MAC_CTX_set_params");
+		EVP_MAC_CTX_free(hmac_ctx);
+		return NULL;
+	}
+#else
+	if(EVP_MAC_set_ctx_params(hmac_ctx, params) <= 0) {
+		log_msg(LOG_ERR, "could not EVP_MAC_set_ctx_params");
+		EVP_MAC_CTX_free(hmac_ctx);
+		return NULL;
+	}
+#endif
+	return hmac_ctx;
+}
+
+/* the HMAC context for the key from the cache, it is created if not
+ * there. NULL if the key is not cached. */
+static EVP_MAC_CTX*
+key_cache_lookup(tsig_algorithm_type *algorithm, tsig_key_type *key)
+{
+	struct tsig_key_cache* e;
+	if(!key->data || key->size > TSIG_KEY_CACHE_MAX_KEY)
+		return NULL;
+	e = &tsig_key_cache[(((size_t)key)>>4) % TSIG_KEY_CACHE_SIZE];
+	if(e->hmac_ctx && e->algorithm == algorithm && e->size == key->size
+		&& CRYPTO_memcmp(e->data, key->data, key->size) == 0)
+		return e->hmac_ctx;
+	/* replace the entry with this key */
+	if(e->hmac_ctx)
+		EVP_MAC_CTX_free(e->hmac_ctx);
+	explicit_bzero(e->data, sizeof(e->data));
+	e->hmac_ctx = new_key_context(algorithm, key);
+	if(!e->hmac_ctx)
+		return NULL;
+	e->algorithm = algorithm;
+	e->size = key->size;
+	memcpy(e->data, key->data, key->size);
+	return e->hmac_ctx;
+}
+#endif /* HAVE_EVP_MAC_CTX_NEW */
+
 static void *
 create_context(region_type *region)
 {
@@ -219,38 +320,35 @@ init_context(void *context,
 	const EVP_MD *md = (const EVP_MD *) algorithm->data;
 	HMAC_Init_ex(ctx, key->data, key->size, md, NULL);
 #else
-	OSSL_PARAM params[3];
-	struct tsig_openssl_data* algo_data = (struct tsig_openssl_data*)
-		algorithm->data;
 	struct tsig_openssl_context* c = (struct tsig_openssl_context*)context;
-	if(c->hmac_ctx) {
-		EVP_MAC_CTX_free(c->hmac_ctx);
+	EVP_MAC_CTX* cached;
+	if(c->hmac_ctx && c->algorithm == algorithm && c->key == key) {
+		/* the next message of the stream, start again with the
+		 * key that is set in the context */
+		if(EVP_MAC_init(c->hmac_ctx, NULL, 0, NULL) > 0)
+			return;
 	}
-	c->hmac_ctx = EVP_MAC_CTX_new(algo_data->mac);
-	if(!c->hmac_ctx) {
-		log_msg(LOG_ERR, "could not EVP_MAC_CTX_new");
-		return;
-	}
-	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
-		(char*)algo_data->digest, 0);
-	params[1] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
-		key->data, key->size);
-	params[2] = OSSL_PARAM_construct_end();
-#ifdef HAVE_EVP_MAC_CTX_SET_PARAMS
-	if(EVP_MAC_CTX_set_params(c->hmac_ctx, params) <= 0) {
-		log_msg(LOG_ERR, "could not EVP_MAC_CTX_set_params");
+	if(c->hmac_ctx) {
 		EVP_MAC_CTX_free(c->hmac_ctx);
 		c->hmac_ctx = NULL;
-		return;
 	}
-#else
-	if(EVP_MAC_set_ctx_params(hmac_ctx, params) <= 0) {
-		log_msg(LOG_ERR, "could not EVP_MAC_set_ctx_params");
-		EVP_MAC_CTX_free(c->hmac_ctx);
-		c->hmac_ctx = NULL;
-		return;
+	c->algorithm = NULL;
+	c->key = NULL;
+	cached = key_cache_lookup(algorithm, key);
+	if(cached) {
+		c->hmac_ctx = EVP_MAC_CTX_dup(cached);
+		if(c->hmac_ctx && EVP_MAC_init(c->hmac_ctx, NULL, 0, NULL) <= 0) {
+			EVP_MAC_CTX_free(c->hmac_ctx);
+			c->hmac_ctx = NULL;
+		}
 	}
-#endif
+	if(!c->hmac_ctx) {
+		c->hmac_ctx = new_key_context(algorithm, key);
+		if(!c->hmac_ctx)
+			return;
+	}
+	c->algorithm = algorithm;
+	c->key = key;
 	c->outsize = algorithm->maximum_digest_size;
 #endif
 }
@@ -288,6 +386,9 @@ final(void *context, uint8_t *digest, size_t *size)
 void
 tsig_openssl_finalize()
 {
+#ifdef HAVE_EVP_MAC_CTX_NEW
+	key_cache_clear();
+#endif
 #ifdef HAVE_EVP_CLEANUP
 	EVP_cleanup();
 #endif
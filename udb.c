@@ -502,6 +502,13 @@ void udb_base_set_userdata(udb_base* udb, udb_void user)
 	udb_rel_ptr_set(udb->base, &udb->glob_data->user_global, user);
 }
 
+void udb_base_clear(udb_base* udb)
+{
+	assert(udb->ram_num == 0);
+	udb_base_set_userdata(udb, 0);
+	udb_alloc_init_new(udb->alloc->disk);
+}
+
 void udb_base_set_userflags(udb_base* udb, uint8_t v)
 {
 	udb->glob_data->userflags = v;
@@ -573,6 +580,8 @@ void
 udb_base_remap_process(udb_base* udb)
 {
 	/* assume that fsize is still accessible */
+	if(udb->base_size == udb->glob_data->fsize)
+		return; /* the other process did not grow it */
 	udb_base_remap(udb, udb->alloc, udb->glob_data->fsize);
 }
 
@@ -416,6 +416,14 @@ udb_rel_ptr* udb_base_get_userdata(udb_base* udb);
  */
 void udb_base_set_userdata(udb_base* udb, udb_void user);
 
+/**
+ * Drop all the chunks and the user data pointer. The file keeps its size,
+ * and new chunks are allocated in sequence from the start of the file.
+ * There must be no udb_ptr for the udb.
+ * @param udb: the udb.
+ */
+void udb_base_clear(udb_base* udb);
+
 /** 
  * Set the user flags (to any value, uint8). 
  * @param udb: the udb.
@@ -29,9 +29,16 @@
 #include <syslog.h>
 #endif /* HAVE_SYSLOG_H */
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <dirent.h>
+#endif
 #ifdef HAVE_SYS_RANDOM_H
 #include <sys/random.h>
 #endif
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
 
 #include "util.h"
 #include "region-allocator.h"
@@ -42,7 +49,7 @@
 #include "nsd.h"
 #include "options.h"
 
-#ifdef USE_MMAP_ALLOC
+#if defined(USE_MMAP_ALLOC) || defined(HAVE_MMAP)
 #include <sys/mman.h>
 
 #if defined(MAP_ANON) && !defined(MAP_ANONYMOUS)
@@ -51,7 +58,12 @@
 #define	MAP_ANON	MAP_ANONYMOUS
 #endif
 
-#endif /* USE_MMAP_ALLOC */
+#endif /* USE_MMAP_ALLOC || HAVE_MMAP */
+
+#if defined(HAVE_MMAP) && defined(HAVE_MUNMAP) && defined(MAP_ANONYMOUS)
+/* size of the areas with the huge page chunks, one 2 MB huge page */
+#define HUGE_AREA_SIZE (2 * 1024 * 1024)
+#endif
 
 #ifndef NDEBUG
 unsigned nsd_debug_facilities = 0xffff;
@@ -68,6 +80,22 @@ static FILE *current_log_file = NULL;
 int log_time_asc = 1;
 int log_time_iso = 0;
 
+/*
+ * In buffered mode, the lines for the log file are collected in log_buf
+ * and written with log_flush, whole lines only, so that the lines of the
+ * processes that append to the file do not get mixed up. A message that
+ * is the same as the one before it is counted, and the count is logged
+ * once a second, and when another message is logged.
+ */
+#define LOG_BUF_SIZE 16384
+static int log_buffered = 0;
+static char log_buf[LOG_BUF_SIZE];
+static size_t log_buf_len = 0;
+static char log_last[MAXSYSLOGMSGLEN];
+static int log_last_priority = 0;
+static unsigned log_repeated = 0;
+static time_t log_repeated_time = 0;
+
 #ifdef USE_LOG_PROCESS_ROLE
 void
 log_set_process_role(const char *process_role)
@@ -116,6 +144,7 @@ log_reopen(const char *filename, uint8_t verbose)
 					"keeping old logfile",
 					filename, strerror(errno)));
 		} else {
+			log_flush();
 			if (current_log_file && current_log_file != stderr)
 				fclose(current_log_file);
 			current_log_file = file;
@@ -126,6 +155,7 @@ log_reopen(const char *filename, uint8_t verbose)
 void
 log_finalize(void)
 {
+	log_flush();
 #ifdef HAVE_SYSLOG_H
 	closelog();
 #endif /* HAVE_SYSLOG_H */
@@ -143,12 +173,33 @@ static lookup_table_type log_priority_table[] = {
 	{ 0, NULL }
 };
 
+/* write the line to the log file, or put it in the buffer */
+static void
+log_file_write(int priority, const char *line, size_t len)
+{
+	if (log_buffered && priority > LOG_ERR) {
+		if (log_buf_len + len > sizeof(log_buf))
+			log_flush();
+		if (len <= sizeof(log_buf)) {
+			memcpy(log_buf + log_buf_len, line, len);
+			log_buf_len += len;
+			return;
+		}
+	}
+	/* errors are written right away, after the lines before them */
+	log_flush();
+	fwrite(line, 1, len, current_log_file);
+	fflush(current_log_file);
+}
+
 void
 log_file(int priority, const char *message)
 {
 	size_t length;
 	lookup_table_type *priority_info;
 	const char *priority_text = "unknown";
+	char line[MAXSYSLOGMSGLEN+128];
+	int len;
 
 	assert(global_ident);
 	assert(current_log_file);
@@ -183,7 +234,7 @@ log_file(int priority, const char *message)
 					tzbuf[6] = 0;
 				}
 			}
-			fprintf(current_log_file, "%s.%3.3d%s %s[%d]: %s: %s",
+			len = snprintf(line, sizeof(line), "%s.%3.3d%s %s[%d]: %s: %s",
 				tmbuf, (int)tv.tv_usec/1000, tzbuf,
 				global_ident, (int) getpid(), priority_text, message);
 		} else {
@@ -194,19 +245,66 @@ log_file(int priority, const char *message)
 				strftime(tmbuf, sizeof(tmbuf), "%Y-%m-%d %H:%M:%S",
 					localtime_r(&now, &tm));
 			}
-			fprintf(current_log_file, "[%s.%3.3d] %s[%d]: %s: %s",
+			len = snprintf(line, sizeof(line), "[%s.%3.3d] %s[%d]: %s: %s",
 				tmbuf, (int)tv.tv_usec/1000,
 				global_ident, (int) getpid(), priority_text, message);
 		}
  	} else
 #endif /* have time functions */
-		fprintf(current_log_file, "[%d] %s[%d]: %s: %s",
+		len = snprintf(line, sizeof(line), "[%d] %s[%d]: %s: %s",
 		(int)time(NULL), global_ident, (int) getpid(), priority_text, message);
-	length = strlen(message);
-	if (length == 0 || message[length - 1] != '\n') {
-		fprintf(current_log_file, "\n");
+	if (len < 0)
+		return;
+	length = (size_t)len;
+	if (length >= sizeof(line) - 1)
+		length = sizeof(line) - 2;
+	if (length == 0 || line[length - 1] != '\n') {
+		line[length++] = '\n';
+		line[length] = 0;
 	}
-	fflush(current_log_file);
+	log_file_write(priority, line, length);
+}
+
+void
+log_flush(void)
+{
+	if (log_buf_len == 0)
+		return;
+	if (current_log_file) {
+		fwrite(log_buf, 1, log_buf_len, current_log_file);
+		fflush(current_log_file);
+	}
+	log_buf_len = 0;
+}
+
+/* log the number of times the last message was repeated */
+static void
+log_repeated_flush(void)
+{
+	char message[64];
+	if (log_repeated == 0)
+		return;
+	snprintf(message, sizeof(message), "last message repeated %u times",
+		log_repeated);
+	log_repeated = 0;
+	current_log_function(log_last_priority, message);
+}
+
+void
+log_set_buffered(int buffered)
+{
+	static int registered = 0;
+	if (buffered && !registered) {
+		/* the lines in the buffer are written when the process exits */
+		if (atexit(log_flush) == 0)
+			registered = 1;
+	}
+	if (!buffered) {
+		log_repeated_flush();
+		log_flush();
+	}
+	log_buffered = buffered;
+	log_last[0] = 0;
 }
 
 void
@@ -249,6 +347,22 @@ log_vmsg(int priority, const char *format, va_list args)
 {
 	char message[MAXSYSLOGMSGLEN];
 	vsnprintf(message, sizeof(message), format, args);
+	if (log_buffered) {
+		if (priority == log_last_priority &&
+			strcmp(message, log_last) == 0) {
+			time_t now = time(NULL);
+			log_repeated++;
+			if (now != log_repeated_time) {
+				log_repeated_flush();
+				log_repeated_time = now;
+			}
+			return;
+		}
+		log_repeated_flush();
+		strlcpy(log_last, message, sizeof(log_last));
+		log_last_priority = priority;
+		log_repeated_time = time(NULL);
+	}
 	current_log_function(priority, message);
 }
 
@@ -422,6 +536,210 @@ mmap_free(void *ptr)
 
 #endif /* USE_MMAP_ALLOC */
 
+#ifdef HUGE_AREA_SIZE
+/* an area of huge pages that the chunks are cut from */
+struct huge_area {
+	struct huge_area* next;
+	struct huge_area* prev;
+	char* base;
+	/* bytes handed out from the start of the area */
+	size_t used;
+	/* number of chunks in use */
+	size_t count;
+	/* if on reserved huge pages, otherwise transparent huge pages are
+	 * asked for */
+	int hugetlb;
+};
+
+/* the huge page areas, the first is the one chunks are taken from */
+static struct huge_area* huge_areas = NULL;
+/* set when no reserved huge pages were available */
+static int huge_no_hugetlb = 0;
+
+static struct huge_area*
+huge_area_create(void)
+{
+	struct huge_area* area;
+	char* base = MAP_FAILED, *m;
+	int hugetlb = 0;
+
+#ifdef MAP_HUGETLB
+	if(!huge_no_hugetlb) {
+		base = mmap(NULL, HUGE_AREA_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(base == MAP_FAILED) {
+			VERBOSITY(2, (LOG_INFO, "no reserved huge pages, "
+				"using transparent huge pages: %s",
+				strerror(errno)));
+			huge_no_hugetlb = 1;
+		} else	hugetlb = 1;
+	}
+#endif /* MAP_HUGETLB */
+	if(base == MAP_FAILED) {
+		/* map twice the size for an aligned area, so that it can
+		 * be on a transparent huge page */
+		m = mmap(NULL, 2*HUGE_AREA_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(m == MAP_FAILED) {
+			log_msg(LOG_ERR, "mmap failed: %s", strerror(errno));
+			exit(1);
+		}
+		base = (char*)(((uintptr_t)m + HUGE_AREA_SIZE - 1) &
+			~((uintptr_t)HUGE_AREA_SIZE - 1));
+		if(base > m)
+			(void)munmap(m, base - m);
+		if(base + HUGE_AREA_SIZE < m + 2*HUGE_AREA_SIZE)
+			(void)munmap(base + HUGE_AREA_SIZE, (m + 2*HUGE_AREA_SIZE)
+				- (base + HUGE_AREA_SIZE));
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+		if(madvise(base, HUGE_AREA_SIZE, MADV_HUGEPAGE) == -1)
+			VERBOSITY(2, (LOG_INFO, "madvise hugepage failed: %s",
+				strerror(errno)));
+#endif
+	}
+
+	area = (struct huge_area*)xalloc(sizeof(*area));
+	area->base = base;
+	area->used = 0;
+	area->count = 0;
+	area->hugetlb = hugetlb;
+	area->prev = NULL;
+	area->next = huge_areas;
+	if(area->next)
+		area->next->prev = area;
+	huge_areas = area;
+	return area;
+}
+#endif /* HUGE_AREA_SIZE */
+
+void *
+huge_alloc(size_t size)
+{
+	char* p;
+#ifdef HUGE_AREA_SIZE
+	if(size == HUGE_ALLOC_CHUNK_SIZE) {
+		struct huge_area* area = huge_areas;
+		if(!area || area->used + HUGE_ALLOC_HEADER_SIZE + size >
+			HUGE_AREA_SIZE)
+			area = huge_area_create();
+		p = area->base + area->used;
+		area->used += HUGE_ALLOC_HEADER_SIZE + size;
+		area->count++;
+		*((struct huge_area**)p) = area;
+		return p + HUGE_ALLOC_HEADER_SIZE;
+	}
+	p = (char*)xalloc(size + HUGE_ALLOC_HEADER_SIZE);
+	*((struct huge_area**)p) = NULL;
+#else
+	p = (char*)xalloc(size + HUGE_ALLOC_HEADER_SIZE);
+#endif /* HUGE_AREA_SIZE */
+	return p + HUGE_ALLOC_HEADER_SIZE;
+}
+
+void
+huge_free(void *ptr)
+{
+	char* p;
+#ifdef HUGE_AREA_SIZE
+	struct huge_area* area;
+#endif
+	if(!ptr)
+		return;
+	p = (char*)ptr - HUGE_ALLOC_HEADER_SIZE;
+#ifdef HUGE_AREA_SIZE
+	area = *((struct huge_area**)p);
+	if(area) {
+		area->count--;
+		if(area->count != 0)
+			return;
+		if(area == huge_areas) {
+			/* cut the next chunks from the start again */
+			area->used = 0;
+			return;
+		}
+		area->prev->next = area->next;
+		if(area->next)
+			area->next->prev = area->prev;
+		if(munmap(area->base, HUGE_AREA_SIZE) == -1)
+			log_msg(LOG_ERR, "munmap failed: %s", strerror(errno));
+		free(area);
+		return;
+	}
+#endif /* HUGE_AREA_SIZE */
+	free(p);
+}
+
+#if defined(HUGE_AREA_SIZE) && defined(__linux__)
+/* bytes of the range that are in areas on transparent huge pages */
+static size_t
+huge_thp_overlap(uintptr_t start, uintptr_t end)
+{
+	struct huge_area* area;
+	size_t overlap = 0;
+	for(area = huge_areas; area; area = area->next) {
+		uintptr_t s = (uintptr_t)area->base, e = s + HUGE_AREA_SIZE;
+		if(area->hugetlb)
+			continue;
+		if(s < start)
+			s = start;
+		if(e > end)
+			e = end;
+		if(s < e)
+			overlap += e - s;
+	}
+	return overlap;
+}
+
+/* the bytes of the areas that the kernel has put on transparent huge
+ * pages, from the AnonHugePages of the mappings in smaps */
+static size_t
+huge_thp_size(void)
+{
+	FILE* in = fopen("/proc/self/smaps", "r");
+	char line[256];
+	unsigned long start, end, kb;
+	size_t overlap = 0, total = 0;
+	if(!in)
+		return 0;
+	while(fgets(line, (int)sizeof(line), in)) {
+		if(sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			overlap = huge_thp_overlap(start, end);
+		} else if(overlap && sscanf(line, "AnonHugePages: %lu kB",
+			&kb) == 1) {
+			/* the mapping can be larger than the areas in it */
+			total += ((size_t)kb*1024 < overlap)?(size_t)kb*1024:
+				overlap;
+		}
+	}
+	fclose(in);
+	return total;
+}
+#endif /* HUGE_AREA_SIZE && __linux__ */
+
+void
+huge_alloc_report(void)
+{
+#ifdef HUGE_AREA_SIZE
+	struct huge_area* area;
+	size_t total = 0, hugetlb = 0, thp = 0;
+	for(area = huge_areas; area; area = area->next) {
+		total += HUGE_AREA_SIZE;
+		if(area->hugetlb)
+			hugetlb += HUGE_AREA_SIZE;
+	}
+#ifdef __linux__
+	thp = huge_thp_size();
+#endif
+	log_msg(LOG_INFO, "zone data has %lu MB in huge page areas, %lu MB "
+		"on reserved huge pages, %lu MB on transparent huge pages",
+		(unsigned long)(total/(1024*1024)),
+		(unsigned long)(hugetlb/(1024*1024)),
+		(unsigned long)(thp/(1024*1024)));
+#else
+	log_msg(LOG_INFO, "zone data is not on huge pages, no mmap");
+#endif /* HUGE_AREA_SIZE */
+}
+
 int
 write_data(FILE *file, const void *data, size_t size)
 {
@@ -558,19 +876,32 @@ hex_ntop(uint8_t const *src, size_t srclength, char *target, size_t targsize)
 	return 2 * srclength;
 }
 
+/* value of a hex digit, or -1 */
+static inline int
+hex_value(unsigned char ch)
+{
+	if(ch >= '0' && ch <= '9')
+		return ch - '0';
+	ch |= 0x20; /* lowercase */
+	if(ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	return -1;
+}
+
 ssize_t
 hex_pton(const char* src, uint8_t* target, size_t targsize)
 {
 	uint8_t *t = target;
-	if(strlen(src) % 2 != 0 || strlen(src)/2 > targsize) {
+	size_t len = strlen(src);
+	if(len % 2 != 0 || len/2 > targsize) {
 		return -1;
 	}
 	while(*src) {
-		if(!isxdigit((unsigned char)src[0]) ||
-			!isxdigit((unsigned char)src[1]))
+		int hi = hex_value((unsigned char)src[0]);
+		int lo = hex_value((unsigned char)src[1]);
+		if(hi < 0 || lo < 0)
 			return -1;
-		*t++ = hexdigit_to_int(src[0]) * 16 +
-			hexdigit_to_int(src[1]) ;
+		*t++ = (uint8_t)(hi * 16 + lo);
 		src += 2;
 	}
 	return t-target;
@@ -583,6 +914,27 @@ b32_ntop(uint8_t const *src, size_t srclength, char *target, size_t targsize)
 	char buf[9];
 	ssize_t len=0;
 
+	/* the whole groups of five octets, as a 40 bit number */
+	while(srclength >= 5 && targsize > 8)
+	{
+		uint64_t v = ((uint64_t)src[0] << 32) |
+			((uint64_t)src[1] << 24) | ((uint64_t)src[2] << 16) |
+			((uint64_t)src[3] << 8) | (uint64_t)src[4];
+		target[0]=b32[(v >> 35) & 0x1f];
+		target[1]=b32[(v >> 30) & 0x1f];
+		target[2]=b32[(v >> 25) & 0x1f];
+		target[3]=b32[(v >> 20) & 0x1f];
+		target[4]=b32[(v >> 15) & 0x1f];
+		target[5]=b32[(v >> 10) & 0x1f];
+		target[6]=b32[(v >> 5) & 0x1f];
+		target[7]=b32[v & 0x1f];
+		src += 5;
+		srclength -= 5;
+		target += 8;
+		targsize -= 8;
+		len += 8;
+	}
+
 	while(srclength > 0)
 	{
 		int t;
@@ -657,6 +1009,18 @@ b32_ntop(uint8_t const *src, size_t srclength, char *target, size_t targsize)
 	return len;
 }
 
+/* value of a base32hex digit, or -1 */
+static inline int
+b32_value(unsigned char ch)
+{
+	if(ch >= '0' && ch <= '9')
+		return ch - '0';
+	ch |= 0x20; /* lowercase */
+	if(ch >= 'a' && ch <= 'v')
+		return ch - 'a' + 10;
+	return -1;
+}
+
 int
 b32_pton(const char *src, uint8_t *target, size_t tsize)
 {
@@ -664,10 +1028,34 @@ b32_pton(const char *src, uint8_t *target, size_t tsize)
 	size_t p=0;
 
 	memset(target,'\0',tsize);
-	while((ch = *src++)) {
+	while(1) {
 		uint8_t d;
 		size_t b;
 		size_t n;
+		int v;
+
+		/* eight digits at an octet boundary are five octets */
+		while(p%8 == 0 && p+40 < tsize*8) {
+			uint64_t w = 0;
+			int i;
+			for(i=0; i<8; i++) {
+				if((v = b32_value((unsigned char)src[i])) < 0)
+					break;
+				w = (w << 5) | (uint64_t)v;
+			}
+			if(i < 8)
+				break;
+			n=p/8;
+			target[n]=(uint8_t)(w >> 32);
+			target[n+1]=(uint8_t)(w >> 24);
+			target[n+2]=(uint8_t)(w >> 16);
+			target[n+3]=(uint8_t)(w >> 8);
+			target[n+4]=(uint8_t)w;
+			src += 8;
+			p += 40;
+		}
+		if(!(ch = *src++))
+			break;
 
 		if(p+5 >= tsize*8)
 		       return -1;
@@ -675,14 +1063,9 @@ b32_pton(const char *src, uint8_t *target, size_t tsize)
 		if(isspace((unsigned char)ch))
 			continue;
 
-		if(ch >= '0' && ch <= '9')
-			d=ch-'0';
-		else if(ch >= 'A' && ch <= 'V')
-			d=ch-'A'+10;
-		else if(ch >= 'a' && ch <= 'v')
-			d=ch-'a'+10;
-		else
+		if((v = b32_value((unsigned char)ch)) < 0)
 			return -1;
+		d=(uint8_t)v;
 
 		b=7-p%8;
 		n=p/8;
@@ -904,8 +1287,7 @@ set_previous_owner(struct state_pretty_rr *state, const dname_type *dname)
 }
 
 int
-print_rr(FILE *out,
-         struct state_pretty_rr *state,
+print_rr_buffer(struct state_pretty_rr *state,
          rr_type *record,
 	 region_type* rr_region,
 	 buffer_type* output)
@@ -956,12 +1338,23 @@ print_rr(FILE *out,
 	if (result) {
 		buffer_printf(output, "\n");
 		buffer_flip(output);
-		result = write_data(out, buffer_current(output),
-		buffer_remaining(output));
 	}
 	return result;
 }
 
+int
+print_rr(FILE *out,
+         struct state_pretty_rr *state,
+         rr_type *record,
+	 region_type* rr_region,
+	 buffer_type* output)
+{
+	if(!print_rr_buffer(state, record, rr_region, output))
+		return 0;
+	return write_data(out, buffer_current(output),
+		buffer_remaining(output));
+}
+
 const char*
 rcode2str(int rc)
 {
@@ -1119,6 +1512,212 @@ int set_cpu_affinity(cpuset_t *set)
 #endif
 #endif /* HAVE_CPUSET_T */
 
+#ifdef __linux__
+#define NSD_NUMA_MAXNODE 1024
+
+/* read a list of numbers like 0-3,8 from sysfs or proc, and mark them,
+ * returns the number of marked entries, or -1 if it cannot be read.
+ * Numbers from max and up are not marked. */
+static int
+read_id_list(const char* fname, uint8_t* mark, int max)
+{
+	char buf[4096];
+	char* p = buf;
+	int count = 0;
+	FILE* in = fopen(fname, "r");
+	if(!in)
+		return -1;
+	if(!fgets(buf, (int)sizeof(buf), in)) {
+		fclose(in);
+		return -1;
+	}
+	fclose(in);
+	while(isdigit((unsigned char)*p)) {
+		long first = strtol(p, &p, 10), last = first, n;
+		if(*p == '-')
+			last = strtol(p+1, &p, 10);
+		if(last < first)
+			return -1;
+		for(n = first; n <= last && n < max; n++) {
+			if(!mark[n])
+				count++;
+			mark[n] = 1;
+		}
+		if(*p == ',')
+			p++;
+	}
+	return count;
+}
+#endif /* __linux__ */
+
+#if defined(HAVE_CPUSET_T) && defined(__linux__) && defined(HAVE_SCHED_SETAFFINITY)
+/* the cpus that take the interrupts of the network cards */
+static void
+cpu_placement_irqs(uint8_t* irq)
+{
+	char fname[512];
+	DIR* netdir, *irqdir;
+	struct dirent* ifd, *irqd;
+	if(!(netdir = opendir("/sys/class/net")))
+		return;
+	while((ifd = readdir(netdir)) != NULL) {
+		if(ifd->d_name[0] == '.')
+			continue;
+		/* virtual interfaces have no device */
+		snprintf(fname, sizeof(fname),
+			"/sys/class/net/%s/device/msi_irqs", ifd->d_name);
+		if(!(irqdir = opendir(fname)))
+			continue;
+		while((irqd = readdir(irqdir)) != NULL) {
+			if(!isdigit((unsigned char)irqd->d_name[0]))
+				continue;
+			snprintf(fname, sizeof(fname),
+				"/proc/irq/%s/smp_affinity_list",
+				irqd->d_name);
+			(void)read_id_list(fname, irq, CPU_SETSIZE);
+		}
+		closedir(irqdir);
+	}
+	closedir(netdir);
+}
+
+static int
+cpu_place_cmp(const void* x, const void* y)
+{
+	const struct cpu_place* a = (const struct cpu_place*)x;
+	const struct cpu_place* b = (const struct cpu_place*)y;
+	if(a->smt != b->smt)
+		return a->smt - b->smt;
+	if(a->rank != b->rank)
+		return a->rank - b->rank;
+	if(a->node != b->node)
+		return a->node - b->node;
+	return a->cpu - b->cpu;
+}
+
+int
+cpu_placement(struct cpu_place* list, int max)
+{
+	cpu_set_t allowed;
+	uint8_t mark[CPU_SETSIZE], irq[CPU_SETSIZE], nodes[NSD_NUMA_MAXNODE];
+	char fname[256];
+	int cpu, node, i, j, n = 0;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+		return -1;
+	memset(irq, 0, sizeof(irq));
+	cpu_placement_irqs(irq);
+	for(cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+		if(!CPU_ISSET(cpu, &allowed))
+			continue;
+		list[n].cpu = cpu;
+		list[n].node = 0;
+		list[n].smt = 0;
+		list[n].rank = 0;
+		list[n].irq = irq[cpu];
+		/* a thread sibling with a lower number is on the same core */
+		memset(mark, 0, sizeof(mark));
+		snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/"
+			"cpu%d/topology/thread_siblings_list", cpu);
+		if(read_id_list(fname, mark, CPU_SETSIZE) > 0) {
+			for(i = 0; i < cpu; i++) {
+				if(mark[i] && CPU_ISSET(i, &allowed)) {
+					list[n].smt = 1;
+					break;
+				}
+			}
+		}
+		n++;
+	}
+	memset(nodes, 0, sizeof(nodes));
+	if(read_id_list("/sys/devices/system/node/online", nodes,
+		NSD_NUMA_MAXNODE) > 0) {
+		for(node = 0; node < NSD_NUMA_MAXNODE; node++) {
+			if(!nodes[node])
+				continue;
+			memset(mark, 0, sizeof(mark));
+			snprintf(fname, sizeof(fname),
+				"/sys/devices/system/node/node%d/cpulist", node);
+			if(read_id_list(fname, mark, CPU_SETSIZE) <= 0)
+				continue;
+			for(i = 0; i < n; i++) {
+				if(mark[list[i].cpu])
+					list[i].node = node;
+			}
+		}
+	}
+	/* the position on its node, so that sorting on it takes the
+	 * nodes in turn */
+	for(i = 0; i < n; i++) {
+		for(j = 0; j < i; j++) {
+			if(list[j].node == list[i].node &&
+				list[j].smt == list[i].smt)
+				list[i].rank++;
+		}
+	}
+	qsort(list, (size_t)n, sizeof(*list), cpu_place_cmp);
+	return n;
+}
+#elif defined(HAVE_CPUSET_T)
+int
+cpu_placement(struct cpu_place* ATTR_UNUSED(list), int ATTR_UNUSED(max))
+{
+	return -1;
+}
+#endif /* HAVE_CPUSET_T */
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+/* from linux/mempolicy.h, that is not always installed */
+#define NSD_MPOL_DEFAULT 0
+#define NSD_MPOL_INTERLEAVE 3
+#define NSD_NUMA_ULONG_BITS (sizeof(unsigned long)*8)
+
+/* read the online nodes into the node mask */
+static int
+numa_online_nodes(unsigned long* mask, int* count)
+{
+	uint8_t online[NSD_NUMA_MAXNODE];
+	int n;
+	memset(online, 0, sizeof(online));
+	if((*count = read_id_list("/sys/devices/system/node/online",
+		online, NSD_NUMA_MAXNODE)) <= 0)
+		return 0;
+	for(n = 0; n < NSD_NUMA_MAXNODE; n++) {
+		if(online[n])
+			mask[n/NSD_NUMA_ULONG_BITS] |=
+				1UL << (n%NSD_NUMA_ULONG_BITS);
+	}
+	return 1;
+}
+
+int
+set_numa_interleave(int on)
+{
+	unsigned long mask[NSD_NUMA_MAXNODE/NSD_NUMA_ULONG_BITS];
+	int count = 0;
+	if(!on)
+		return (int)syscall(SYS_set_mempolicy, NSD_MPOL_DEFAULT,
+			NULL, 0);
+	memset(mask, 0, sizeof(mask));
+	if(!numa_online_nodes(mask, &count)) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(count < 2)
+		return 0; /* one node, nothing to spread */
+	if(syscall(SYS_set_mempolicy, NSD_MPOL_INTERLEAVE, mask,
+		(unsigned long)NSD_NUMA_MAXNODE+1) == -1)
+		return -1;
+	return count;
+}
+#else
+int
+set_numa_interleave(int ATTR_UNUSED(on))
+{
+	return 0;
+}
+#endif /* __linux__ && SYS_set_mempolicy */
+
 void add_cookie_secret(struct nsd* nsd, uint8_t* secret)
 {
 	/* New cookie secret becomes the staging secret (position 1)
@@ -1175,6 +1774,18 @@ void drop_cookie_secret(struct nsd* nsd)
 	nsd->cookie_count -= 1;
 }
 
+void cookie_keys_setup(struct nsd* nsd)
+{
+	size_t i;
+	for(i = 0; i < NSD_COOKIE_HISTORY_SIZE; i++) {
+		if(i < nsd->cookie_count)
+			siphash_key_setup(&nsd->cookie_keys[i],
+				nsd->cookie_secrets[i].cookie_secret);
+		else	explicit_bzero(&nsd->cookie_keys[i],
+				sizeof(nsd->cookie_keys[i]));
+	}
+}
+
 void reconfig_cookies(struct nsd* nsd, struct nsd_options* options)
 {
 	cookie_secret_type cookie_secrets[NSD_COOKIE_HISTORY_SIZE];
@@ -1304,3 +1915,49 @@ generate_cookie_secrets:
 	/*********************************************************************/
 }
 
+
+#ifdef USE_LZ4
+uint8_t*
+lz4_compress(const uint8_t* data, size_t len, size_t* clen)
+{
+	int bound, r;
+	uint8_t* buf;
+	if(len == 0 || len > LZ4_MAX_INPUT_SIZE)
+		return NULL;
+	bound = LZ4_compressBound((int)len);
+	buf = xalloc((size_t)bound);
+	r = LZ4_compress_default((const char*)data, (char*)buf, (int)len,
+		bound);
+	if(r <= 0 || (size_t)r >= len) {
+		free(buf);
+		return NULL;
+	}
+	*clen = (size_t)r;
+	return buf;
+}
+#endif /* USE_LZ4 */
+
+int
+lz4_read_block(FILE* in, size_t clen, uint8_t* buf, size_t len)
+{
+#ifdef USE_LZ4
+	char* cbuf;
+	int r;
+	if(clen == 0 || len > LZ4_MAX_INPUT_SIZE ||
+		clen > (size_t)LZ4_compressBound((int)len))
+		return 0;
+	cbuf = xalloc(clen);
+	if(fread(cbuf, clen, 1, in) != 1) {
+		free(cbuf);
+		return 0;
+	}
+	r = LZ4_decompress_safe(cbuf, (char*)buf, (int)clen, (int)len);
+	free(cbuf);
+	return r >= 0 && (size_t)r == len;
+#else
+	(void)in; (void)clen; (void)buf; (void)len;
+	log_msg(LOG_ERR, "data is compressed with LZ4, but NSD is compiled "
+		"without --enable-lz4");
+	return 0;
+#endif
+}
@@ -38,6 +38,13 @@ struct nsd_options;
 #define PADDING(n, alignment)   \
 	(ALIGN_UP((n), (alignment)) - (n))
 
+/* hint that the memory at p is read soon, if the compiler can */
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) /* empty */
+#endif
+
 /*
  * Initialize the logging system.  All messages are logged to stderr
  * until log_open and log_set_log_function are called.
@@ -95,6 +102,19 @@ log_function_type log_only_syslog;
  */
 void log_set_log_function(log_function_type *log_function);
 
+/*
+ * Set buffered logging, for the server processes. The lines for the log
+ * file are collected and written with log_flush, apart from errors, and
+ * a message that is repeated is logged with a count, at most once a
+ * second. Turning it off writes the pending lines.
+ */
+void log_set_buffered(int buffered);
+
+/*
+ * Write the lines that are collected in buffered mode to the log file.
+ */
+void log_flush(void);
+
 /*
  * Log a message using the current log function.
  */
@@ -170,6 +190,20 @@ void *mmap_alloc(size_t size);
 void mmap_free(void *ptr);
 #endif /* USE_MMAP_ALLOC */
 
+/*
+ * Huge page allocator routines.  Blocks of HUGE_ALLOC_CHUNK_SIZE, the
+ * chunks of a region, are cut from 2 MB areas on reserved huge pages, or
+ * if none are reserved, areas that are advised for transparent huge
+ * pages.  An area is unmapped when all its chunks are freed.  Blocks of
+ * other sizes are malloced.
+ */
+#define HUGE_ALLOC_HEADER_SIZE 16
+#define HUGE_ALLOC_CHUNK_SIZE ((16 * 4096) - HUGE_ALLOC_HEADER_SIZE)
+void *huge_alloc(size_t size);
+void huge_free(void *ptr);
+/* log how much of the chunks are on huge pages */
+void huge_alloc_report(void);
+
 /*
  * Write SIZE bytes of DATA to FILE.  Report an error on failure.
  *
@@ -391,6 +425,10 @@ struct state_pretty_rr* create_pretty_rr(struct region* region);
 /* print rr to file, returns 0 on failure(nothing is written) */
 int print_rr(FILE *out, struct state_pretty_rr* state, struct rr *record,
 	struct region* tmp_region, struct buffer* tmp_buffer);
+/* print rr into the buffer, that is cleared first and flipped after, like
+ * print_rr, returns 0 on failure */
+int print_rr_buffer(struct state_pretty_rr* state, struct rr *record,
+	struct region* tmp_region, struct buffer* output);
 
 /*
  * Convert a numeric rcode value to a human readable string
@@ -427,8 +465,37 @@ void error(const char *format, ...) ATTR_FORMAT(printf, 1, 2) ATTR_NORETURN;
 #if HAVE_CPUSET_T
 int number_of_cpus(void);
 int set_cpu_affinity(cpuset_t *set);
+
+/* A cpu, in the order in which cpu-affinity-auto hands them out. */
+struct cpu_place {
+	int cpu;
+	/* the NUMA node of the cpu */
+	int node;
+	/* a thread sibling of a cpu with a lower number, on the same core */
+	int smt;
+	/* the cpu takes network card interrupts */
+	int irq;
+	/* the position among the cpus of its node */
+	int rank;
+};
+
+/*
+ * List the cpus that this process may run on, one per core first, with
+ * the NUMA nodes in turn, and then the SMT siblings in the same way.
+ * Returns the number of cpus put in the list of max entries, or -1 if
+ * the topology is not available on this system.
+ */
+int cpu_placement(struct cpu_place* list, int max);
 #endif
 
+/*
+ * Spread the memory that this process allocates from now on over the
+ * online NUMA nodes, or go back to node local allocation with on=0.
+ * Returns the number of nodes used, 0 if there is nothing to do and -1
+ * on failure, with errno set.
+ */
+int set_numa_interleave(int on);
+
 /* Add a cookie secret. If there are no secrets yet, the secret will become
  * the active secret. Otherwise it will become the staging secret.
  * Active secrets are used to both verify and create new DNS Cookies.
@@ -441,5 +508,24 @@ void activate_cookie_secret(struct nsd* nsd);
 void drop_cookie_secret(struct nsd* nsd);
 /* Configure nsd struct with how to respond to DNS Cookies based on options */
 void reconfig_cookies(struct nsd* nsd, struct nsd_options* options);
+/* Set up the SipHash keys for the cookie secrets, when the secrets are
+ * used to answer queries. */
+void cookie_keys_setup(struct nsd* nsd);
+
+#ifdef USE_LZ4
+/*
+ * Compress len bytes of data with LZ4, into an allocated buffer that is
+ * returned, with the compressed size in clen. Returns NULL if that fails,
+ * or if the data does not get smaller.
+ */
+uint8_t* lz4_compress(const uint8_t* data, size_t len, size_t* clen);
+#endif
+
+/*
+ * Read a block of clen bytes compressed with LZ4 from the file, and
+ * decompress it into buf, it has to be len bytes, the original size.
+ * Returns 0 on failure, also when NSD is compiled without LZ4.
+ */
+int lz4_read_block(FILE* in, size_t clen, uint8_t* buf, size_t len);
 
 #endif /* UTIL_H */
@@ -34,16 +34,15 @@
 struct zone *verify_next_zone(struct nsd *nsd, struct zone *zone)
 {
 	int verify;
-	struct radnode *node;
 
+	/* the updated zones are in the list of the reload */
 	if(zone != NULL) {
-		node = radix_next(zone->node);
+		zone = zone->updated_next;
 	} else {
-		node = radix_first(nsd->db->zonetree);
+		zone = nsd->db->updated_first;
 	}
 
-	while(node != NULL) {
-		zone = (struct zone *)node->elem;
+	while(zone != NULL) {
 		verify = zone->opts->pattern->verify_zone;
 		if(verify == VERIFY_ZONE_INHERIT) {
 			verify = nsd->options->verify_zones;
@@ -51,7 +50,7 @@ struct zone *verify_next_zone(struct nsd *nsd, struct zone *zone)
 		if(verify && zone->is_updated && !zone->is_checked) {
 			return zone;
 		}
-		node = radix_next(node);
+		zone = zone->updated_next;
 	}
 
 	return NULL;
@@ -190,6 +189,14 @@ static void close_stream(struct verifier *verifier, struct verifier_stream *stre
 	stream->fd = -1;
 }
 
+static void close_feed(struct verifier_zone_feed *feed)
+{
+	event_del(&feed->event);
+	close(feed->fd);
+	feed->fd = -1;
+	region_destroy(feed->region);
+}
+
 static void close_verifier(struct verifier *verifier)
 {
 	/* unregister events and close streams (in that order) */
@@ -199,11 +206,8 @@ static void close_verifier(struct verifier *verifier)
 		verifier->timeout.tv_usec = 0;
 	}
 
-	if(verifier->zone_feed.fh != NULL) {
-		event_del(&verifier->zone_feed.event);
-		fclose(verifier->zone_feed.fh);
-		verifier->zone_feed.fh = NULL;
-		region_destroy(verifier->zone_feed.region);
+	if(verifier->zone_feed.fd != -1) {
+		close_feed(&verifier->zone_feed);
 	}
 
 	close_stream(verifier, &verifier->error_stream);
@@ -215,30 +219,52 @@ static void close_verifier(struct verifier *verifier)
 }
 
 /*
- * Feed zone to verifier over STDIN as it becomes available.
+ * Feed zone to verifier over STDIN as it becomes available. The text of
+ * the RRs is collected in a buffer, that is written with as few writes as
+ * the verifier reads it.
  */
 static void verify_handle_feed(int fd, short event, void *arg)
 {
 	struct verifier *verifier;
+	struct verifier_zone_feed *feed;
 	struct rr *rr;
+	ssize_t written;
 
-	(void)fd;
 	assert(event == EV_WRITE);
 	assert(arg != NULL);
 
 	verifier = (struct verifier *)arg;
-	if((rr = zone_rr_iter_next(&verifier->zone_feed.rriter)) != NULL) {
-		print_rr(verifier->zone_feed.fh,
-		         verifier->zone_feed.rrprinter,
-		         rr,
-		         verifier->zone_feed.region,
-		         verifier->zone_feed.buffer);
-	} else {
-		event_del(&verifier->zone_feed.event);
-		fclose(verifier->zone_feed.fh);
-		verifier->zone_feed.fh = NULL;
-		region_destroy(verifier->zone_feed.region);
+	feed = &verifier->zone_feed;
+	if(buffer_remaining(feed->out) == 0) {
+		buffer_clear(feed->out);
+		while(buffer_position(feed->out) < VERIFY_FEED_SIZE &&
+			(rr = zone_rr_iter_next(&feed->rriter)) != NULL) {
+			if(!print_rr_buffer(feed->rrprinter, rr, feed->region,
+				feed->buffer))
+				continue;
+			buffer_reserve(feed->out, buffer_remaining(feed->buffer));
+			buffer_write(feed->out, buffer_current(feed->buffer),
+				buffer_remaining(feed->buffer));
+		}
+		buffer_flip(feed->out);
+		if(buffer_remaining(feed->out) == 0) {
+			/* the whole zone is written */
+			close_feed(feed);
+			return;
+		}
+	}
+
+	written = write(fd, buffer_current(feed->out),
+		buffer_remaining(feed->out));
+	if(written == -1) {
+		if(errno == EAGAIN || errno == EINTR)
+			return;
+		log_msg(LOG_ERR, "verify: cannot write zone %s to verifier: %s",
+		                 verifier->zone->opts->name, strerror(errno));
+		close_feed(feed);
+		return;
 	}
+	buffer_skip(feed->out, written);
 }
 
 /*
@@ -415,14 +441,12 @@ void verify_zone(struct nsd *nsd, struct zone *zone)
 	struct verifier *verifier = NULL;
 	int32_t timeout;
 	char **command;
-	FILE *fin;
 	int fdin, fderr, fdout, flags;
 
 	assert(nsd != NULL);
 	assert(nsd->verifier_count < nsd->verifier_limit);
 	assert(zone != NULL);
 
-	fin = NULL;
 	fdin = fdout = fderr = -1;
 
 	/* search for available verifier slot */
@@ -487,14 +511,14 @@ void verify_zone(struct nsd *nsd, struct zone *zone)
 		goto fail_fcntl;
 	}
 	if (fdin >= 0) {
-		if ((fin = fdopen(fdin, "w")) == NULL) {
-			log_msg(LOG_ERR, "verify: fdopen(stdin, ...) for "
-			                 "zone %s: %s",
+		/* the zone is written as the verifier reads it */
+		flags = fcntl(fdin, F_GETFL, 0);
+		if (fcntl(fdin, F_SETFL, flags | O_NONBLOCK) == -1) {
+			log_msg(LOG_ERR, "verify: fcntl(stdin, ..., O_NONBLOCK) "
+			                 "for zone %s: %s",
 		                         zone->opts->name, strerror(errno));
 			goto fail_fcntl;
 		}
-		/* write unbuffered */
-		setbuf(fin, NULL);
 	}
 
 	verifier->zone = zone;
@@ -535,8 +559,8 @@ void verify_zone(struct nsd *nsd, struct zone *zone)
 		goto fail_stdout;
 	}
 
-	if(fin != NULL) {
-		verifier->zone_feed.fh = fin;
+	if(fdin >= 0) {
+		verifier->zone_feed.fd = fdin;
 
 		zone_rr_iter_init(&verifier->zone_feed.rriter, zone);
 
@@ -546,9 +570,12 @@ void verify_zone(struct nsd *nsd, struct zone *zone)
 			= region_create(xalloc, free);
 		verifier->zone_feed.buffer
 			= buffer_create(nsd->server_region, MAX_RDLENGTH);
+		verifier->zone_feed.out
+			= buffer_create(nsd->server_region, VERIFY_FEED_SIZE);
+		buffer_flip(verifier->zone_feed.out);
 
 		event_set(&verifier->zone_feed.event,
-		          fileno(verifier->zone_feed.fh),
+		          verifier->zone_feed.fd,
 			  EV_WRITE|EV_PERSIST,
 			  &verify_handle_feed,
 			  verifier);
@@ -590,11 +617,14 @@ void verify_zone(struct nsd *nsd, struct zone *zone)
 fail_timeout:
 	verifier->timeout.tv_sec = 0;
 	verifier->timeout.tv_usec = 0;
-	if(fin != NULL) {
+	if(fdin >= 0) {
 		event_del(&verifier->zone_feed.event);
 	}
 fail_stdin:
-	verifier->zone_feed.fh = NULL;
+	if(verifier->zone_feed.fd != -1) {
+		region_destroy(verifier->zone_feed.region);
+		verifier->zone_feed.fd = -1;
+	}
 	event_del(&verifier->output_stream.event);
 fail_stdout:
 	verifier->output_stream.fd = -1;
@@ -603,9 +633,7 @@ fail_stderr:
 	verifier->error_stream.fd = -1;
 fail_fcntl:
 	kill_verifier(verifier);
-	if(fin != NULL) {
-		fclose(fin);
-	} else if (fdin >= 0) {
+	if (fdin >= 0) {
 		close(fdin);
 	}
 	close(fdout);
@@ -20,17 +20,26 @@
 #  include "mini_event.h"
 #endif
 
+/*
+ * The zone text is written to the verifier in writes of about this many
+ * bytes, with many RRs in one write.
+ */
+#define VERIFY_FEED_SIZE 65536
+
 /*
  * Track position in zone to feed verifier more data as the input descriptor
  * becomes available.
  */
 struct verifier_zone_feed {
-	FILE *fh;
+	int fd;
 	struct event event;
 	zone_rr_iter_type rriter;
 	struct state_pretty_rr *rrprinter;
 	struct region *region;
+	/* the text of one RR */
 	struct buffer *buffer;
+	/* the text of the RRs that is not yet written to the verifier */
+	struct buffer *out;
 };
 
 /* 40 is (estimated) space already used on each logline.
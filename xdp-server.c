@@ -0,0 +1,740 @@
+/*
+ * xdp-server.c -- AF_XDP receive and transmit path for UDP queries
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * The XDP program (bpf-xdp/xdp-dns-redirect_kern.c) redirects plain UDP
+ * packets for the DNS port to an AF_XDP socket per receive queue. Every
+ * server process owns one socket and its UMEM. The query is copied out of
+ * the UMEM frame and processed as any UDP query, and the answer is written
+ * back in place into the same frame, with the addresses swapped, and sent
+ * from there. The frames cycle from the fill ring, to the rx ring, to the
+ * tx ring and via the completion ring back to the fill ring.
+ *
+ * The XDP program drops malformed packets, and with xdp-ratelimit the
+ * packets from source prefixes over the limit, and counts them per receive
+ * queue. Every server adds the drops on its queue to its statistics.
+ */
+
+#include "config.h"
+
+#ifdef USE_XDP
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp/xsk.h>
+#ifndef USE_MINI_EVENT
+#  ifdef HAVE_EVENT_H
+#    include <event.h>
+#  else
+#    include <event2/event.h>
+#    include "event2/event_struct.h"
+#    include "event2/event_compat.h"
+#  endif
+#else
+#  include "mini_event.h"
+#endif
+
+#include "xdp-server.h"
+#include "nsd.h"
+#include "query.h"
+#include "packet.h"
+#include "options.h"
+
+/* number of UMEM frames for every socket, they all fit in the fill ring */
+#define XDP_NUM_FRAMES 4096
+#define XDP_FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+/* packets that are handled per event */
+#define XDP_RX_BATCH 64
+
+#define XDP_ETH_HLEN 14
+#define XDP_ETHERTYPE_IP 0x0800
+#define XDP_ETHERTYPE_IPV6 0x86dd
+#define XDP_IP4_HLEN 20
+#define XDP_IP6_HLEN 40
+#define XDP_UDP_HLEN 8
+#define XDP_TTL 64
+/* the number of receive queues in the maps of the XDP program */
+#define XDP_NUM_QUEUES 256
+/* source prefixes for xdp-ratelimit, if there are no rrl settings */
+#define XDP_IPV4_PREFIX 24
+#define XDP_IPV6_PREFIX 56
+
+/* the ratelimit config of the XDP program, in its limit_map */
+struct xdp_limit_config {
+	uint32_t ratelimit;
+	uint32_t ip4_mask;
+	uint32_t ip6_mask[4];
+};
+
+/* the drops of a receive queue, in the stats_map of the XDP program */
+struct xdp_counters {
+	uint64_t malformed;
+	uint64_t ratelimited;
+};
+
+struct xdp_sock {
+	struct nsd* nsd;
+	/* NIC receive queue the socket is bound to */
+	int queue;
+	void* umem_area;
+	struct xsk_umem* umem;
+	struct xsk_ring_prod fill;
+	struct xsk_ring_cons comp;
+	struct xsk_ring_cons rx;
+	struct xsk_ring_prod tx;
+	struct xsk_socket* xsk;
+	struct event event;
+	/* the query that received packets are copied into */
+	struct query* query;
+	xdp_answer_func_type answer;
+	/* the local address of the current query, for the answer function */
+	struct nsd_socket local;
+	/* the drops on the queue that are in the statistics */
+	uint64_t malformed, ratelimited;
+};
+
+static struct xdp_server {
+	int ifindex;
+	struct bpf_object* obj;
+	/* the stats_map of the program, mapped in memory, or NULL */
+	volatile struct xdp_counters* counters;
+	/* a socket for every server, indexed by child_num */
+	size_t num;
+	struct xdp_sock* socks;
+	/* the addresses of the ip-address lines, that the queries must be
+	 * sent to, or any address of the family for a wildcard socket */
+	uint8_t* addr4;
+	size_t num4;
+	int any4;
+	uint8_t* addr6;
+	size_t num6;
+	int any6;
+} xdp;
+
+/* note the addresses that the UDP sockets of the server are bound to */
+static void
+xdp_server_addrs(struct nsd* nsd)
+{
+	size_t i;
+	xdp.addr4 = region_alloc_array(nsd->region, nsd->ifs?nsd->ifs:1, 4);
+	xdp.addr6 = region_alloc_array(nsd->region, nsd->ifs?nsd->ifs:1, 16);
+	for(i = 0; i < nsd->ifs; i++) {
+		struct sockaddr_storage* a = &nsd->udp[i].addr.ai_addr;
+		if(a->ss_family == AF_INET) {
+			struct sockaddr_in* a4 = (struct sockaddr_in*)a;
+			if(a4->sin_addr.s_addr == INADDR_ANY)
+				xdp.any4 = 1;
+			memcpy(xdp.addr4 + 4*xdp.num4++, &a4->sin_addr, 4);
+#ifdef INET6
+		} else if(a->ss_family == AF_INET6) {
+			struct sockaddr_in6* a6 = (struct sockaddr_in6*)a;
+			if(IN6_IS_ADDR_UNSPECIFIED(&a6->sin6_addr))
+				xdp.any6 = 1;
+			memcpy(xdp.addr6 + 16*xdp.num6++, &a6->sin6_addr, 16);
+#endif
+		}
+	}
+}
+
+/* see if the destination of the packet is an address of the server, the
+ * XDP program redirects the port for all addresses on the interface */
+static int
+xdp_server_dest(const uint8_t* ip, int is_ip6)
+{
+	size_t i;
+	if(is_ip6) {
+		if(xdp.any6)
+			return 1;
+		for(i = 0; i < xdp.num6; i++)
+			if(memcmp(xdp.addr6 + 16*i, ip+24, 16) == 0)
+				return 1;
+		return 0;
+	}
+	if(xdp.any4)
+		return 1;
+	for(i = 0; i < xdp.num4; i++)
+		if(memcmp(xdp.addr4 + 4*i, ip+16, 4) == 0)
+			return 1;
+	return 0;
+}
+
+/* the receive queue for a server: its cpu if it has a server-N-cpu-affinity,
+ * and otherwise the server number (minus one). */
+static int
+xdp_server_queue(struct nsd* nsd, size_t child)
+{
+	struct cpu_map_option* opt;
+	for(opt = nsd->options->service_cpu_affinity; opt; opt = opt->next) {
+		if(opt->service == (int)child+1)
+			return opt->cpu;
+	}
+	return (int)child;
+}
+
+/* the network order mask for a prefix of len bits of a 32 bit word that
+ * starts at bit start */
+static uint32_t
+xdp_prefix_mask(size_t len, size_t start)
+{
+	if(len <= start)
+		return 0;
+	if(len - start >= 32)
+		return 0xffffffff;
+	return htonl(0xffffffffU << (32 - (len - start)));
+}
+
+/* set the ratelimit of the program, and map its counters */
+static int
+xdp_set_limit(struct nsd* nsd, const char* path)
+{
+	struct xdp_limit_config cfg;
+	size_t ip4 = XDP_IPV4_PREFIX, ip6 = XDP_IPV6_PREFIX;
+	uint32_t key = 0;
+	int limit_fd, stats_fd, i;
+	void* p;
+
+	limit_fd = bpf_object__find_map_fd_by_name(xdp.obj, "limit_map");
+	stats_fd = bpf_object__find_map_fd_by_name(xdp.obj, "stats_map");
+	if(limit_fd < 0 || stats_fd < 0) {
+		log_msg(LOG_ERR, "xdp: %s has no ratelimit maps, it is from "
+			"an older nsd", path);
+		return 0;
+	}
+#ifdef RATELIMIT
+	ip4 = nsd->options->rrl_ipv4_prefix_length;
+	ip6 = nsd->options->rrl_ipv6_prefix_length;
+#endif
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.ratelimit = (uint32_t)nsd->options->xdp_ratelimit;
+	cfg.ip4_mask = xdp_prefix_mask(ip4, 0);
+	for(i = 0; i < 4; i++)
+		cfg.ip6_mask[i] = xdp_prefix_mask(ip6, (size_t)i*32);
+	if(bpf_map_update_elem(limit_fd, &key, &cfg, BPF_ANY) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot set the ratelimit: %s",
+			strerror(errno));
+		return 0;
+	}
+	p = mmap(NULL, XDP_NUM_QUEUES*sizeof(struct xdp_counters),
+		PROT_READ, MAP_SHARED, stats_fd, 0);
+	if(p == MAP_FAILED) {
+		log_msg(LOG_WARNING, "xdp: cannot mmap the counters, the "
+			"drops are not in the statistics: %s", strerror(errno));
+		return 1;
+	}
+	xdp.counters = (volatile struct xdp_counters*)p;
+	return 1;
+}
+
+static int
+xdp_load_program(struct nsd* nsd, int port, int* map_fd)
+{
+	const char* path = nsd->options->xdp_program_path;
+	struct bpf_program* prog;
+	uint32_t key = 0, value = (uint32_t)port;
+	int prog_fd, port_fd, r;
+	long err;
+
+	if(!path || !path[0]) {
+		log_msg(LOG_ERR, "xdp: no xdp-program-path configured");
+		return 0;
+	}
+	xdp.obj = bpf_object__open_file(path, NULL);
+	err = libbpf_get_error(xdp.obj);
+	if(err) {
+		log_msg(LOG_ERR, "xdp: cannot open %s: %s", path,
+			strerror((int)-err));
+		xdp.obj = NULL;
+		return 0;
+	}
+	if((r = bpf_object__load(xdp.obj)) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot load %s: %s", path, strerror(-r));
+		return 0;
+	}
+	prog = bpf_object__find_program_by_name(xdp.obj, "xdp_dns_redirect");
+	*map_fd = bpf_object__find_map_fd_by_name(xdp.obj, "xsks_map");
+	port_fd = bpf_object__find_map_fd_by_name(xdp.obj, "dns_port_map");
+	if(!prog || *map_fd < 0 || port_fd < 0) {
+		log_msg(LOG_ERR, "xdp: %s is not the nsd XDP program", path);
+		return 0;
+	}
+	if(bpf_map_update_elem(port_fd, &key, &value, BPF_ANY) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot set the port: %s",
+			strerror(errno));
+		return 0;
+	}
+	if(!xdp_set_limit(nsd, path))
+		return 0;
+	prog_fd = bpf_program__fd(prog);
+	/* replaces a program that is still attached from an earlier run,
+	 * try driver mode first and fall back to generic mode */
+	if((r = bpf_xdp_attach(xdp.ifindex, prog_fd, XDP_FLAGS_DRV_MODE,
+		NULL)) != 0) {
+		VERBOSITY(2, (LOG_INFO, "xdp: driver mode attach failed: %s, "
+			"using generic mode", strerror(-r)));
+		if((r = bpf_xdp_attach(xdp.ifindex, prog_fd,
+			XDP_FLAGS_SKB_MODE, NULL)) != 0) {
+			log_msg(LOG_ERR, "xdp: cannot attach %s to %s: %s",
+				path, nsd->options->xdp_interface,
+				strerror(-r));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+xdp_sock_create(struct xdp_sock* s, const char* ifname, int map_fd)
+{
+	struct xsk_umem_config ucfg;
+	struct xsk_socket_config scfg;
+	size_t size = (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	uint32_t i, idx = 0;
+	int r;
+
+	/* shared, so that the server process writes to the pages that are
+	 * registered with the kernel, and not to a copy on write */
+	s->umem_area = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(s->umem_area == MAP_FAILED) {
+		log_msg(LOG_ERR, "xdp: mmap of umem failed: %s",
+			strerror(errno));
+		s->umem_area = NULL;
+		return 0;
+	}
+	memset(&ucfg, 0, sizeof(ucfg));
+	ucfg.fill_size = XDP_NUM_FRAMES;
+	ucfg.comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+	ucfg.frame_size = XDP_FRAME_SIZE;
+	ucfg.frame_headroom = 0;
+	if((r = xsk_umem__create(&s->umem, s->umem_area, size, &s->fill,
+		&s->comp, &ucfg)) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot create umem: %s", strerror(-r));
+		return 0;
+	}
+
+	memset(&scfg, 0, sizeof(scfg));
+	scfg.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+	scfg.tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS;
+	scfg.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD;
+	scfg.bind_flags = XDP_USE_NEED_WAKEUP;
+	if((r = xsk_socket__create(&s->xsk, ifname, (uint32_t)s->queue,
+		s->umem, &s->rx, &s->tx, &scfg)) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot create socket on %s queue %d: %s",
+			ifname, s->queue, strerror(-r));
+		return 0;
+	}
+	if((r = xsk_socket__update_xskmap(s->xsk, map_fd)) != 0) {
+		log_msg(LOG_ERR, "xdp: cannot add socket for queue %d to the "
+			"map: %s", s->queue, strerror(-r));
+		return 0;
+	}
+
+	/* give all frames to the kernel, for reception */
+	if(xsk_ring_prod__reserve(&s->fill, XDP_NUM_FRAMES, &idx)
+		!= XDP_NUM_FRAMES) {
+		log_msg(LOG_ERR, "xdp: cannot fill the fill ring");
+		return 0;
+	}
+	for(i = 0; i < XDP_NUM_FRAMES; i++)
+		*xsk_ring_prod__fill_addr(&s->fill, idx++) =
+			(uint64_t)i * XDP_FRAME_SIZE;
+	xsk_ring_prod__submit(&s->fill, XDP_NUM_FRAMES);
+
+	memset(&s->local, 0, sizeof(s->local));
+	s->local.s = -1;
+	s->local.addr.ai_socktype = SOCK_DGRAM;
+	return 1;
+}
+
+int
+xdp_server_init(struct nsd* nsd)
+{
+	const char* ifname = nsd->options->xdp_interface;
+	struct proxy_protocol_port_list* p;
+	int port, map_fd = -1;
+	size_t i, j;
+
+	port = atoi(nsd->options->port);
+	for(p = nsd->options->proxy_protocol_port; p; p = p->next) {
+		if(p->port == port) {
+			log_msg(LOG_ERR, "xdp: port %d is a proxy-protocol-port,"
+				" that is not supported with AF_XDP", port);
+			return -1;
+		}
+	}
+	xdp.ifindex = (int)if_nametoindex(ifname);
+	if(xdp.ifindex == 0) {
+		log_msg(LOG_ERR, "xdp: unknown interface %s: %s", ifname,
+			strerror(errno));
+		return -1;
+	}
+	if(!xdp_load_program(nsd, port, &map_fd))
+		return -1;
+	xdp_server_addrs(nsd);
+
+	xdp.num = nsd->child_count;
+	xdp.socks = region_alloc_array_zero(nsd->region, xdp.num,
+		sizeof(*xdp.socks));
+	for(i = 0; i < xdp.num; i++) {
+		xdp.socks[i].queue = xdp_server_queue(nsd, i);
+		for(j = 0; j < i; j++) {
+			if(xdp.socks[j].queue == xdp.socks[i].queue) {
+				log_msg(LOG_ERR, "xdp: server %d and server %d "
+					"both use queue %d", (int)j+1, (int)i+1,
+					xdp.socks[i].queue);
+				return -1;
+			}
+		}
+		if(!xdp_sock_create(&xdp.socks[i], ifname, map_fd))
+			return -1;
+	}
+	VERBOSITY(1, (LOG_INFO, "xdp: serving UDP port %d on %s with %d "
+		"AF_XDP sockets", port, ifname, (int)xdp.num));
+	return 0;
+}
+
+static uint32_t
+xdp_csum_add(uint32_t sum, const uint8_t* p, size_t len)
+{
+	while(len > 1) {
+		sum += ((uint32_t)p[0]<<8) | p[1];
+		p += 2;
+		len -= 2;
+	}
+	if(len)
+		sum += (uint32_t)p[0]<<8;
+	return sum;
+}
+
+static uint16_t
+xdp_csum_fold(uint32_t sum)
+{
+	while(sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+/* checksum of the UDP datagram with the IPv4 or IPv6 pseudo header */
+static uint16_t
+xdp_udp_csum(const uint8_t* ip, const uint8_t* udp, size_t udplen,
+	int is_ip6)
+{
+	uint32_t sum;
+	uint16_t csum;
+	if(is_ip6)
+		sum = xdp_csum_add(0, ip+8, 32);
+	else	sum = xdp_csum_add(0, ip+12, 8);
+	sum += IPPROTO_UDP;
+	sum += (uint32_t)udplen;
+	sum = xdp_csum_add(sum, udp, udplen);
+	csum = xdp_csum_fold(sum);
+	return csum == 0 ? 0xffff : csum;
+}
+
+static void
+xdp_swap(uint8_t* a, uint8_t* b, size_t len)
+{
+	uint8_t tmp[16];
+	memcpy(tmp, a, len);
+	memcpy(a, b, len);
+	memcpy(b, tmp, len);
+}
+
+/* set the remote and local address of the query from the packet */
+static void
+xdp_set_addr(struct xdp_sock* s, struct query* q, const uint8_t* ip,
+	const uint8_t* udp, int is_ip6)
+{
+#ifdef INET6
+	if(is_ip6) {
+		struct sockaddr_in6* r = (struct sockaddr_in6*)&q->remote_addr;
+		struct sockaddr_in6* l =
+			(struct sockaddr_in6*)&s->local.addr.ai_addr;
+		memset(r, 0, sizeof(*r));
+		r->sin6_family = AF_INET6;
+		memcpy(&r->sin6_addr, ip+8, 16);
+		memcpy(&r->sin6_port, udp, 2);
+		q->remote_addrlen = (socklen_t)sizeof(*r);
+		memset(l, 0, sizeof(*l));
+		l->sin6_family = AF_INET6;
+		memcpy(&l->sin6_addr, ip+24, 16);
+		memcpy(&l->sin6_port, udp+2, 2);
+		s->local.addr.ai_family = AF_INET6;
+		s->local.addr.ai_addrlen = (socklen_t)sizeof(*l);
+		return;
+	}
+#endif
+	{
+		struct sockaddr_in* r = (struct sockaddr_in*)&q->remote_addr;
+		struct sockaddr_in* l =
+			(struct sockaddr_in*)&s->local.addr.ai_addr;
+		(void)is_ip6;
+		memset(r, 0, sizeof(*r));
+		r->sin_family = AF_INET;
+		memcpy(&r->sin_addr, ip+12, 4);
+		memcpy(&r->sin_port, udp, 2);
+		q->remote_addrlen = (socklen_t)sizeof(*r);
+		memset(l, 0, sizeof(*l));
+		l->sin_family = AF_INET;
+		memcpy(&l->sin_addr, ip+16, 4);
+		memcpy(&l->sin_port, udp+2, 2);
+		s->local.addr.ai_family = AF_INET;
+		s->local.addr.ai_addrlen = (socklen_t)sizeof(*l);
+	}
+}
+
+/* make the answer a truncated answer with only the question section */
+static int
+xdp_truncate(struct query* q)
+{
+	buffer_type* packet = q->packet;
+	if(buffer_limit(packet) < QHEADERSZ || QDCOUNT(packet) != 1)
+		return 0;
+	buffer_set_position(packet, QHEADERSZ);
+	if(!packet_skip_dname(packet) || !buffer_available(packet, 4))
+		return 0;
+	buffer_skip(packet, 4);
+	buffer_set_limit(packet, buffer_position(packet));
+	buffer_set_position(packet, 0);
+	TC_SET(packet);
+	ANCOUNT_SET(packet, 0);
+	NSCOUNT_SET(packet, 0);
+	ARCOUNT_SET(packet, 0);
+	return 1;
+}
+
+/*
+ * Answer the packet in the frame, the answer replaces the query in the
+ * frame. room is the space in the frame from the start of the packet.
+ * Returns the length of the answer packet, or 0 to drop the frame.
+ */
+static uint32_t
+xdp_process(struct xdp_sock* s, uint8_t* pkt, uint32_t len, size_t room,
+	uint32_t* now_p)
+{
+	struct query* q = s->query;
+	uint8_t* ip = pkt + XDP_ETH_HLEN;
+	uint8_t* udp;
+	size_t hdrlen, udplen, anslen;
+	int is_ip6;
+
+	if(len < XDP_ETH_HLEN)
+		return 0;
+	if(read_uint16(pkt+12) == XDP_ETHERTYPE_IP) {
+		if(len < XDP_ETH_HLEN + XDP_IP4_HLEN + XDP_UDP_HLEN)
+			return 0;
+		/* no IP options, and no fragments; the XDP program only
+		 * redirects these, this keeps out anything unexpected */
+		if(ip[0] != 0x45 || ip[9] != IPPROTO_UDP ||
+			(read_uint16(ip+6) & 0x3fff) != 0)
+			return 0;
+		hdrlen = XDP_ETH_HLEN + XDP_IP4_HLEN;
+		is_ip6 = 0;
+#ifdef INET6
+	} else if(read_uint16(pkt+12) == XDP_ETHERTYPE_IPV6) {
+		if(len < XDP_ETH_HLEN + XDP_IP6_HLEN + XDP_UDP_HLEN)
+			return 0;
+		if(ip[6] != IPPROTO_UDP)
+			return 0;
+		hdrlen = XDP_ETH_HLEN + XDP_IP6_HLEN;
+		is_ip6 = 1;
+#endif
+	} else {
+		return 0;
+	}
+	udp = pkt + hdrlen;
+	udplen = read_uint16(udp+4);
+	if(udplen < XDP_UDP_HLEN || hdrlen + udplen > len)
+		return 0;
+	/* not an address that the server listens on, as without XDP,
+	 * there is no answer */
+	if(!xdp_server_dest(ip, is_ip6))
+		return 0;
+
+	/* put the query in the packet buffer like recvmmsg does */
+	query_reset(q, UDP_MAX_MESSAGE_LEN, 0);
+	if(udplen - XDP_UDP_HLEN > buffer_remaining(q->packet))
+		return 0;
+	buffer_write(q->packet, udp + XDP_UDP_HLEN, udplen - XDP_UDP_HLEN);
+	xdp_set_addr(s, q, ip, udp, is_ip6);
+	if(!s->answer(s->nsd, &s->local, q, now_p))
+		return 0;
+
+	anslen = buffer_remaining(q->packet);
+	if(hdrlen + XDP_UDP_HLEN + anslen > room) {
+		if(!xdp_truncate(q))
+			return 0;
+		anslen = buffer_remaining(q->packet);
+		if(hdrlen + XDP_UDP_HLEN + anslen > room)
+			return 0;
+	}
+
+	/* turn the frame around, and put the answer in it */
+	xdp_swap(pkt, pkt+6, 6);
+	if(is_ip6) {
+		xdp_swap(ip+8, ip+24, 16);
+		write_uint16(ip+4, (uint16_t)(XDP_UDP_HLEN + anslen));
+		ip[7] = XDP_TTL;
+	} else {
+		xdp_swap(ip+12, ip+16, 4);
+		write_uint16(ip+2, (uint16_t)(XDP_IP4_HLEN + XDP_UDP_HLEN +
+			anslen));
+		ip[8] = XDP_TTL;
+		write_uint16(ip+10, 0);
+		write_uint16(ip+10, xdp_csum_fold(xdp_csum_add(0, ip,
+			XDP_IP4_HLEN)));
+	}
+	xdp_swap(udp, udp+2, 2);
+	write_uint16(udp+4, (uint16_t)(XDP_UDP_HLEN + anslen));
+	memcpy(udp + XDP_UDP_HLEN, buffer_begin(q->packet), anslen);
+	write_uint16(udp+6, 0);
+	write_uint16(udp+6, xdp_udp_csum(ip, udp, XDP_UDP_HLEN + anslen,
+		is_ip6));
+	return (uint32_t)(hdrlen + XDP_UDP_HLEN + anslen);
+}
+
+/* give frames back to the kernel for reception */
+static void
+xdp_fill(struct xdp_sock* s, const uint64_t* addrs, uint32_t n)
+{
+	uint32_t i, idx = 0;
+	if(n == 0)
+		return;
+	/* the fill ring holds all frames, so there is always space */
+	if(xsk_ring_prod__reserve(&s->fill, n, &idx) != n) {
+		log_msg(LOG_ERR, "xdp: fill ring full, lost %u frames",
+			(unsigned)n);
+		return;
+	}
+	for(i = 0; i < n; i++)
+		*xsk_ring_prod__fill_addr(&s->fill, idx++) = addrs[i];
+	xsk_ring_prod__submit(&s->fill, n);
+}
+
+/* move the frames of transmitted answers to the fill ring */
+static void
+xdp_reclaim(struct xdp_sock* s)
+{
+	uint64_t addrs[XDP_RX_BATCH];
+	uint32_t n, i, idx = 0;
+	while((n = xsk_ring_cons__peek(&s->comp, XDP_RX_BATCH, &idx)) > 0) {
+		for(i = 0; i < n; i++)
+			addrs[i] = *xsk_ring_cons__comp_addr(&s->comp, idx++);
+		xsk_ring_cons__release(&s->comp, n);
+		xdp_fill(s, addrs, n);
+	}
+}
+
+/* add the drops of the XDP program on the queue to the statistics */
+static void
+xdp_count_drops(struct xdp_sock* s)
+{
+	uint64_t malformed, ratelimited;
+	if(!xdp.counters || s->queue < 0 || s->queue >= XDP_NUM_QUEUES)
+		return;
+	malformed = xdp.counters[s->queue].malformed;
+	ratelimited = xdp.counters[s->queue].ratelimited;
+#ifdef BIND8_STATS
+	s->nsd->st->xdp_malformed += malformed - s->malformed;
+	s->nsd->st->xdp_ratelimited += ratelimited - s->ratelimited;
+#endif
+	s->malformed = malformed;
+	s->ratelimited = ratelimited;
+}
+
+static void
+xdp_handle_sock(int fd, short event, void* arg)
+{
+	struct xdp_sock* s = (struct xdp_sock*)arg;
+	uint64_t tx_addr[XDP_RX_BATCH], drop[XDP_RX_BATCH];
+	uint32_t tx_len[XDP_RX_BATCH];
+	uint32_t rcvd, i, ntx, nanswer = 0, ndrop = 0, idx = 0;
+	uint32_t now = 0;
+
+	if(!(event & EV_READ))
+		return;
+	xdp_count_drops(s);
+	xdp_reclaim(s);
+	rcvd = xsk_ring_cons__peek(&s->rx, XDP_RX_BATCH, &idx);
+	for(i = 0; i < rcvd; i++) {
+		const struct xdp_desc* desc = xsk_ring_cons__rx_desc(&s->rx,
+			idx++);
+		uint8_t* pkt = xsk_umem__get_data(s->umem_area, desc->addr);
+		size_t room = XDP_FRAME_SIZE - (desc->addr % XDP_FRAME_SIZE);
+		uint32_t len = xdp_process(s, pkt, desc->len, room, &now);
+		if(len) {
+			tx_addr[nanswer] = desc->addr;
+			tx_len[nanswer] = len;
+			nanswer++;
+		} else {
+			drop[ndrop++] = desc->addr;
+		}
+	}
+	if(rcvd)
+		xsk_ring_cons__release(&s->rx, rcvd);
+
+	if(nanswer) {
+		ntx = xsk_ring_prod__reserve(&s->tx, nanswer, &idx);
+		for(i = 0; i < ntx; i++) {
+			struct xdp_desc* desc = xsk_ring_prod__tx_desc(&s->tx,
+				idx++);
+			desc->addr = tx_addr[i];
+			desc->len = tx_len[i];
+		}
+		if(ntx) {
+			xsk_ring_prod__submit(&s->tx, ntx);
+			if(xsk_ring_prod__needs_wakeup(&s->tx) &&
+				sendto(fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1
+				&& errno != EAGAIN && errno != EBUSY &&
+				errno != ENOBUFS && errno != EINTR) {
+				log_msg(LOG_ERR, "xdp: sendto failed: %s",
+					strerror(errno));
+			}
+		}
+		/* answers that did not fit in the tx ring are dropped */
+		for(i = ntx; i < nanswer; i++)
+			drop[ndrop++] = tx_addr[i];
+	}
+	xdp_fill(s, drop, ndrop);
+	xdp_reclaim(s);
+}
+
+void
+xdp_server_child(struct nsd* nsd, struct query* q,
+	xdp_answer_func_type answer)
+{
+	struct xdp_sock* s;
+	size_t child = (size_t)nsd->this_child->child_num;
+
+	if(!xdp.socks || child >= xdp.num)
+		return;
+	s = &xdp.socks[child];
+	s->nsd = nsd;
+	s->query = q;
+	s->answer = answer;
+	/* the drops before this server started are not its drops */
+	if(xdp.counters && s->queue >= 0 && s->queue < XDP_NUM_QUEUES) {
+		s->malformed = xdp.counters[s->queue].malformed;
+		s->ratelimited = xdp.counters[s->queue].ratelimited;
+	}
+	memset(&s->event, 0, sizeof(s->event));
+	event_set(&s->event, xsk_socket__fd(s->xsk), EV_PERSIST|EV_READ,
+		xdp_handle_sock, s);
+	if(event_base_set(nsd->event_base, &s->event) != 0)
+		log_msg(LOG_ERR, "xdp: event_base_set failed");
+	if(event_add(&s->event, NULL) != 0)
+		log_msg(LOG_ERR, "xdp: event_add failed");
+}
+#endif /* USE_XDP */
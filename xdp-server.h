@@ -0,0 +1,44 @@
+/*
+ * xdp-server.h -- AF_XDP receive and transmit path for UDP queries
+ *
+ * Copyright (c) 2025, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ */
+
+#ifndef XDP_SERVER_H
+#define XDP_SERVER_H
+
+#ifdef USE_XDP
+struct nsd;
+struct nsd_socket;
+struct query;
+
+/*
+ * Answer a query that was received with AF_XDP. The packet buffer of the
+ * query holds the received data, positioned after it, the same as after
+ * recvmmsg. The socket holds the local address the query was sent to.
+ * Returns 0 if the query must be dropped, otherwise the answer is in the
+ * (flipped) packet buffer.
+ */
+typedef int (*xdp_answer_func_type)(struct nsd* nsd, struct nsd_socket* sock,
+	struct query* q, uint32_t* now_p);
+
+/*
+ * Attach the XDP program to the xdp-interface and create an AF_XDP socket
+ * for every server, on the receive queue for that server. Called in the
+ * main process, before privileges are dropped. Returns 0 on success.
+ */
+int xdp_server_init(struct nsd* nsd);
+
+/*
+ * In a server process, add the AF_XDP socket for this server to the
+ * event base. Received queries are copied into the query q, and answered
+ * with the answer function.
+ */
+void xdp_server_child(struct nsd* nsd, struct query* q,
+	xdp_answer_func_type answer);
+
+#endif /* USE_XDP */
+#endif /* XDP_SERVER_H */
@@ -224,6 +224,17 @@ inspect_packet(region_type* region, buffer_type* pkt)
 	}
 }
 
+/** read the packet of a part, that is compressed for type XZFR */
+static int
+xi_read_packet(FILE* in, uint32_t pkttype, uint8_t* buf, uint32_t msglen)
+{
+	uint32_t clen;
+	if(pkttype != DIFF_PART_XZFR)
+		return fread(buf, msglen, 1, in) == 1;
+	return xi_diff_read_32(in, &clen) &&
+		lz4_read_block(in, clen, buf, msglen);
+}
+
 /** inspect part of xfr file */
 static void
 inspect_part(FILE* in, int partnum)
@@ -243,7 +254,7 @@ inspect_part(FILE* in, int partnum)
 		fclose(in);
 		exit(1);
 	}
-	if(pkttype != DIFF_PART_XXFR) {
+	if(pkttype != DIFF_PART_XXFR && pkttype != DIFF_PART_XZFR) {
 		printf("bad part %d: not type XXFR\n", partnum);
 		fclose(in);
 		exit(1);
@@ -259,7 +270,7 @@ inspect_part(FILE* in, int partnum)
 		fclose(in);
 		exit(1);
 	}
-	if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
+	if(!xi_read_packet(in, pkttype, buffer_begin(packet), msglen)) {
 		printf("bad part %d: short packet, file too short, %s\n",
 			partnum, strerror(errno));
 		fclose(in);
@@ -428,7 +439,7 @@ list_part(FILE* in, int partnum)
 		fclose(in);
 		exit(1);
 	}
-	if(pkttype != DIFF_PART_XXFR) {
+	if(pkttype != DIFF_PART_XXFR && pkttype != DIFF_PART_XZFR) {
 		printf("bad part %d: not type XXFR\n", partnum);
 		fclose(in);
 		exit(1);
@@ -444,7 +455,7 @@ list_part(FILE* in, int partnum)
 		fclose(in);
 		exit(1);
 	}
-	if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
+	if(!xi_read_packet(in, pkttype, buffer_begin(packet), msglen)) {
 		printf("bad part %d: short packet, file too short, %s\n",
 			partnum, strerror(errno));
 		fclose(in);
@@ -6,9 +6,11 @@
  * See LICENSE for the license.
  */
 #include "config.h"
+#include <ctype.h>
 #include "difffile.h"
 #include "nsd.h"
 #include "packet.h"
+#include "siphash.h"
 #include "xfrd-catalog-zones.h"
 #include "xfrd-notify.h"
 
@@ -58,6 +60,35 @@ catalog_member_pattern(struct xfrd_catalog_consumer_zone* consumer_zone)
 		consumer_zone->options->pattern->catalog_member_pattern);
 }
 
+/** Is the member zone in the catalog-member-shard of the consumer zone.
+ *  The hash is SipHash-2-4 with a key of zeroes of the lowercase name in
+ *  wire format, as a little endian number, so that every server and the
+ *  load balancer can compute it the same way. */
+static int
+catalog_member_in_shard(struct xfrd_catalog_consumer_zone* consumer_zone,
+		domain_type* member_domain)
+{
+	static const uint8_t key[16] = { 0 };
+	const dname_type* dname = domain_dname(member_domain);
+	uint8_t wire[MAXDOMAINLEN], out[8];
+	uint64_t h = 0;
+	struct pattern_options* pat = consumer_zone->options->pattern;
+	size_t i;
+
+	if (!pat || !pat->catalog_member_shards)
+		return 1;
+	memcpy(wire, dname_name(dname), dname->name_size);
+	for (i = 0; i < dname->name_size && wire[i]; i += wire[i] + 1) {
+		size_t j;
+		for (j = i+1; j <= i+wire[i] && j < dname->name_size; j++)
+			wire[j] = (uint8_t)tolower((unsigned char)wire[j]);
+	}
+	(void)siphash(wire, dname->name_size, key, out, sizeof(out));
+	for (i = 8; i > 0; i--)
+		h = (h << 8) | out[i-1];
+	return (h % pat->catalog_member_shards) == pat->catalog_member_shard;
+}
+
 /** see if we have more zonestatistics entries and it has to be incremented */
 static inline void
 zonestat_inc_ifneeded()
@@ -203,6 +234,7 @@ xfrd_init_catalog_consumer_zone(xfrd_state_type* xfrd,
 	consumer_zone->member_ids.cmp = member_id_compare;
 	consumer_zone->mtime.tv_sec = 0;
 	consumer_zone->mtime.tv_nsec = 0;
+	consumer_zone->changes = diff_changes_create(xfrd->region);
 
 	consumer_zone->invalid = NULL;
 	rbtree_insert(xfrd->catalog_consumer_zones,
@@ -251,6 +283,7 @@ xfrd_deinit_catalog_consumer_zone(xfrd_state_type* xfrd,
 	if ((zone = namedb_find_zone(xfrd->nsd->db, dname))) {
 		namedb_zone_delete(xfrd->nsd->db, zone);
 	}
+	diff_changes_delete(xfrd->region, consumer_zone->changes);
 	region_recycle(xfrd->region, consumer_zone, sizeof(*consumer_zone));
 #ifndef MULTIPLE_CATALOG_CONSUMER_ZONES
 	if((consumer_zone = xfrd_one_catalog_consumer_zone())
@@ -483,16 +516,340 @@ static void debug_log_consumer_members(
 # define debug_log_consumer_members(x) /* nothing */
 #endif
 
+/** The pattern for the member zone with member_id, from its group property
+ *  or the pattern from "catalog-member-pattern". Returns NULL, and makes the
+ *  catalog consumer zone invalid, if there is none. */
+static struct pattern_options*
+catalog_member_zone_pattern(struct xfrd_catalog_consumer_zone* consumer_zone,
+		zone_type* zone, domain_type* member_id,
+		struct pattern_options** default_pattern)
+{
+	domain_type *group, *closest_encloser;
+	rrset_type *rrset;
+	struct pattern_options *pattern = NULL;
+	int valid_group_values = 0;
+	size_t i;
+
+	/* Lookup group.<member_id> TXT for matching patterns  */
+	if(!namedb_lookup(xfrd->nsd->db, label_plus_dname("group",
+					domain_dname(member_id)),
+				&group, &closest_encloser)
+	|| !(rrset = domain_find_rrset(group, zone, TYPE_TXT))) {
+		; /* pass */
+
+	} else for (i = 0; i < rrset->rr_count; i++) {
+		/* Max single TXT rdata field length + '\x00' == 256 */
+		char group_value[256];
+
+		/* Looking for a single TXT rdata field */
+		if (rrset->rrs[i].rdata_count != 1
+
+		    /* rdata field should be at least 1 char */
+		||  rrset->rrs[i].rdatas[0].data[0] < 2
+
+		    /* single rdata atom with single TXT rdata field */
+		||  (uint16_t)(((uint8_t*)(rrset->rrs[i].rdatas[0].data + 1))[0])
+		  != (uint16_t) (rrset->rrs[i].rdatas[0].data[0]-1))
+			continue;
+
+		memcpy( group_value
+		      , (uint8_t*)(rrset->rrs[i].rdatas[0].data+1) + 1
+		      ,((uint8_t*)(rrset->rrs[i].rdatas[0].data+1))[0]
+		      );
+		group_value[
+		       ((uint8_t*)(rrset->rrs[i].rdatas[0].data+1))[0]
+		] = 0;
+		if ((pattern = pattern_options_find(
+				xfrd->nsd->options, group_value)))
+			valid_group_values += 1;
+	}
+	if (valid_group_values > 1) {
+                log_msg(LOG_ERR, "member zone '%s': only a single "
+			"group property that matches a pattern is "
+			"allowed."
+			"The pattern from \"catalog-member-pattern\" "
+			"will be used instead.",
+			domain_to_string(member_id));
+		valid_group_values = 0;
+
+	} else if (valid_group_values == 1 && pattern
+			&& pattern->catalog_producer_zone) {
+                log_msg(LOG_ERR, "member zone '%s': group property "
+			"'%s' matches a catalog producer member zone "
+			"pattern. In NSD, catalog member zones can be "
+			"either a member of a catalog consumer zone or"
+			" a catalog producer zone, but not both.",
+			domain_to_string(member_id), pattern->pname);
+		valid_group_values = 0;
+	}
+	if (valid_group_values == 1) {
+		/* pass: pattern is already set */
+		assert(pattern);
+		return pattern;
+
+	} else if (*default_pattern)
+		return *default_pattern;
+
+	else if (!(*default_pattern = catalog_member_pattern(consumer_zone)))
+		make_catalog_consumer_invalid(consumer_zone, 
+			"missing 'group.%s' TXT RR and no default "
+			"pattern from \"catalog-member-pattern\"",
+			domain_to_string(member_id));
+	return *default_pattern;
+}
+
+/** change the pattern of a catalog consumer member zone */
+static void
+catalog_change_member_zone_pattern(struct catalog_member_zone* cmz,
+		struct pattern_options* pattern)
+{
+	struct zone_options* zopt = &cmz->options;
+	const dname_type* dname = (const dname_type*)zopt->node.key;
+
+	/* Changing patterns is basically deleting and adding the zone again
+	 */
+	task_new_del_zone(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, dname);
+	xfrd_set_reload_now(xfrd);
+	if(zone_is_slave(zopt)) {
+		xfrd_del_slave_zone(xfrd, dname);
+	}
+	xfrd_del_notify(xfrd, dname);
+#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
+	if(zone_is_catalog_consumer(zopt)) {
+		xfrd_deinit_catalog_consumer_zone(xfrd, dname);
+	}
+#endif
+	/* It is a catalog consumer member, so no need to check if it was a
+	 * catalog producer member zone to delete and add
+	 */
+	zopt->pattern = pattern;
+	task_new_add_zone(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, zopt->name, pattern->pname,
+		getzonestatid(xfrd->nsd->options, zopt));
+	zonestat_inc_ifneeded();
+	xfrd_set_reload_now(xfrd);
+#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
+	if(zone_is_catalog_consumer(zopt)) {
+		xfrd_init_catalog_consumer_zone(xfrd, zopt);
+	}
+#endif
+	init_notify_send(xfrd->notify_zones, xfrd->region, zopt);
+	if(zone_is_slave(zopt)) {
+		xfrd_init_slave_zone(xfrd, zopt);
+	}
+}
+
+/** Add the catalog consumer member zone member_domain_str with member_id.
+ *  Returns 1 when added, in *added, 0 if it has a bad domain name, and -1
+ *  if it could not be inserted in the consumer_zone->member_ids. */
+static int
+catalog_add_consumer_member_zone(
+		struct xfrd_catalog_consumer_zone* consumer_zone,
+		const dname_type* member_id, const char* member_domain_str,
+		struct pattern_options* pattern,
+		struct catalog_member_zone** added)
+{
+	struct catalog_member_zone* to_add;
+
+	/* Add member zone if not already there */
+        log_msg(LOG_INFO, "Adding '%s' PTR '%s'",
+			dname_to_string(member_id, NULL),
+			member_domain_str);
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "Adding %s PTR %s",
+		dname_to_string(member_id, NULL), member_domain_str));
+	to_add= catalog_member_zone_create(xfrd->nsd->options->region);
+	to_add->options.name = region_strdup(
+			xfrd->nsd->options->region, member_domain_str);
+	to_add->options.pattern = pattern;
+	if (!nsd_options_insert_zone(xfrd->nsd->options,
+				&to_add->options)) {
+                log_msg(LOG_ERR, "bad domain name  '%s' pattern %s",
+			member_domain_str,
+			( pattern->pname ? pattern->pname: "<NULL>"));
+		zone_options_delete(xfrd->nsd->options,
+				&to_add->options);
+		return 0;
+	}
+	to_add->member_id = dname_copy( xfrd->nsd->options->region
+	                              , member_id);
+	/* Insert into the members_id list */
+	to_add->node.key = to_add;
+	if(!rbtree_insert( &consumer_zone->member_ids, &to_add->node)){
+                log_msg(LOG_ERR, "Error adding '%s' PTR '%s' to "
+			"consumer_zone->member_ids",
+			dname_to_string(member_id, NULL),
+			member_domain_str);
+		return -1;
+	}
+	/* make addzone task and schedule reload */
+	task_new_add_zone(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, member_domain_str,
+		pattern->pname,
+		getzonestatid(xfrd->nsd->options, &to_add->options));
+	zonestat_inc_ifneeded();
+	xfrd_set_reload_now(xfrd);
+#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
+	/* add to xfrd - catalog consumer zones */
+	if(zone_is_catalog_consumer(&to_add->options)) {
+		xfrd_init_catalog_consumer_zone(xfrd,&to_add->options);
+	}
+#endif
+	/* add to xfrd - notify (for master and slaves) */
+	init_notify_send(xfrd->notify_zones, xfrd->region,
+			&to_add->options);
+	/* add to xfrd - slave */
+	if(zone_is_slave(&to_add->options)) {
+		xfrd_init_slave_zone(xfrd, &to_add->options);
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "Added catalog "
+		"member zone %s (from %s)",
+		member_domain_str, dname_to_string(member_id, NULL)));
+	*added = to_add;
+	return 1;
+}
+
+/** A member_id of the names changed in a catalog consumer zone */
+struct catalog_changed_member {
+	/* key is the member_id dname */
+	rbnode_type node;
+	/* the zone from the PTR, or NULL if there is none to add */
+	domain_type* member_domain;
+	struct pattern_options* pattern;
+};
+
+/** Process only the member_ids with names changed by the transfers applied
+ *  since the catalog consumer zone was last processed. Returns 1 when done,
+ *  0 if the catalog consumer zone is invalid, and -1 if the whole zone must
+ *  be walked, because a member zone that could not be added before, may
+ *  be added now. */
+static int
+xfrd_process_catalog_consumer_changes(
+		struct xfrd_catalog_consumer_zone* consumer_zone,
+		zone_type* zone, domain_type* zones)
+{
+	const dname_type* zones_dname = domain_dname(zones);
+	struct pattern_options *default_pattern = NULL;
+	region_type* region = region_create(xalloc, free);
+	rbtree_type* member_ids = rbtree_create(region, dname_compare);
+	struct catalog_changed_member* changed;
+	rbnode_type* node;
+	int deleted = 0, result = 1;
+
+	/* The member_ids of the changed <member_id>.zones.<consumer_zone> and
+	 * <property>.<member_id>.zones.<consumer_zone> names */
+	RBTREE_FOR(node, rbnode_type*, &consumer_zone->changes->names) {
+		const dname_type* name = (const dname_type*)node->key;
+
+		if (name->label_count <= zones_dname->label_count
+		||  name->label_count > zones_dname->label_count + 2
+		||  !dname_is_subdomain(name, zones_dname))
+			continue;
+		name = dname_partial_copy(region, name,
+				zones_dname->label_count + 1);
+		if (rbtree_search(member_ids, name))
+			continue;
+		changed = (struct catalog_changed_member*)region_alloc_zero(
+				region, sizeof(*changed));
+		changed->node.key = name;
+		rbtree_insert(member_ids, &changed->node);
+	}
+	/* First delete the member zones that are gone or that point to
+	 * another zone now, so that a zone that moved to another member_id
+	 * can be added again after
+	 */
+	RBTREE_FOR(changed, struct catalog_changed_member*, member_ids) {
+		struct catalog_member_zone key;
+		struct catalog_member_zone* cmz = NULL;
+		domain_type *member_id = NULL, *closest_encloser;
+		rrset_type *rrset = NULL;
+
+		key.member_id = (const dname_type*)changed->node.key;
+		if ((node = rbtree_search(&consumer_zone->member_ids, &key)))
+			cmz = (struct catalog_member_zone*)node->key;
+		if (namedb_lookup(xfrd->nsd->db, key.member_id,
+					&member_id, &closest_encloser))
+			rrset = domain_find_rrset(member_id, zone, TYPE_PTR);
+		if (rrset && rrset->rr_count != 1) {
+			make_catalog_consumer_invalid(consumer_zone, 
+				"only a single PTR RR expected on '%s'",
+				domain_to_string(member_id));
+			result = 0;
+			break;
+		}
+		/* A PTR rr always has 1 rdata element which is a dname */
+		if (rrset && rrset->rrs[0].rdata_count == 1
+		&&  catalog_member_in_shard(consumer_zone,
+				rrset->rrs[0].rdatas[0].domain)) {
+			changed->member_domain = rrset->rrs[0].rdatas[0].domain;
+			if (!(changed->pattern = catalog_member_zone_pattern(
+					consumer_zone, zone, member_id,
+					&default_pattern))) {
+				result = 0;
+				break;
+			}
+		}
+		if (!cmz)
+			continue;
+		if (changed->member_domain && dname_compare(
+				domain_dname(changed->member_domain),
+				cmz->options.node.key) == 0) {
+			if (cmz->options.pattern != changed->pattern)
+				catalog_change_member_zone_pattern(
+						cmz, changed->pattern);
+			changed->member_domain = NULL;
+			continue;
+		}
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "%s changed: delete %s",
+			dname_to_string(key.member_id, NULL),
+			cmz->options.name));
+		catalog_del_consumer_member_zone(consumer_zone, cmz);
+		deleted = 1;
+	}
+	if (result == 1) RBTREE_FOR(changed, struct catalog_changed_member*,
+			member_ids) {
+		char member_domain_str[5 * MAXDOMAINLEN];
+		struct catalog_member_zone* added;
+
+		if (!changed->member_domain)
+			continue;
+		domain_to_string_buf(changed->member_domain, member_domain_str);
+		/* remove trailing dot */
+		member_domain_str[strlen(member_domain_str) - 1] = 0;
+		if (zone_options_find(xfrd->nsd->options,
+				domain_dname(changed->member_domain))) {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "Cannot add "
+				"catalog member zone %s (from %s): "
+				"zone already exists", member_domain_str,
+				dname_to_string((const dname_type*)
+					changed->node.key, NULL)));
+			consumer_zone->skipped += 1;
+			continue;
+		}
+		if (catalog_add_consumer_member_zone(consumer_zone,
+				(const dname_type*)changed->node.key,
+				member_domain_str, changed->pattern,
+				&added) < 0)
+			break;
+	}
+	region_destroy(region);
+	if (result == 1 && deleted && consumer_zone->skipped)
+		return -1;
+	return result;
+}
+
 static void
 xfrd_process_catalog_consumer_zone(
 		struct xfrd_catalog_consumer_zone* consumer_zone)
 {
 	zone_type* zone;
 	const dname_type* dname;
-	domain_type *match, *closest_encloser, *member_id, *group;
+	domain_type *match, *closest_encloser, *member_id;
 	rrset_type *rrset;
 	size_t i;
 	uint8_t version_2_found;
+	int incremental, shard_changed;
+	struct pattern_options* pat;
 	/* Currect catalog member zone */
 	rbnode_type* cursor;
 	struct pattern_options *default_pattern = NULL;
@@ -528,11 +885,28 @@ xfrd_process_catalog_consumer_zone(
 				consumer_zone->options);
 		namedb_read_zonefile(xfrd->nsd, zone, NULL, NULL);
 	}
-	if (timespec_compare(&consumer_zone->mtime, &zone->mtime) == 0) {
+	pat = consumer_zone->options->pattern;
+	shard_changed = pat && (consumer_zone->shard != pat->catalog_member_shard
+		|| consumer_zone->shards != pat->catalog_member_shards);
+	if (timespec_compare(&consumer_zone->mtime, &zone->mtime) == 0
+	&&  !shard_changed) {
 		/* Not processing unchanged catalog consumer zone */
 		return;
 	}
 	consumer_zone->mtime = zone->mtime;
+	if (shard_changed) {
+		consumer_zone->shard = pat->catalog_member_shard;
+		consumer_zone->shards = pat->catalog_member_shards;
+	}
+	/* When the zone changed only by transfers since it was last processed,
+	 * only the member_ids with changed names need to be looked at. Until
+	 * processed successfully, the next time the whole zone is walked.
+	 * A changed catalog-member-shard also needs the whole zone.
+	 */
+	incremental = !shard_changed && !consumer_zone->changes->all
+		&& timespec_compare(&consumer_zone->changes_mtime,
+			&zone->mtime) == 0;
+	consumer_zone->changes->all = 1;
 	/* start processing */
 	/* Lookup version.<consumer_zone> TXT and check that it is version 2 */
 	if(!namedb_lookup(xfrd->nsd->db, label_plus_dname("version", dname),
@@ -569,20 +943,34 @@ xfrd_process_catalog_consumer_zone(
 		 */
 		cursor = rbtree_first(&consumer_zone->member_ids);
 		mode = just_add;
+		consumer_zone->skipped = 0;
 		goto delete_members;
 	}
+	if (incremental) {
+		switch (xfrd_process_catalog_consumer_changes(
+				consumer_zone, zone, match)) {
+		case 0:
+			return;
+		case 1:
+			goto processed;
+		default:
+			/* walk all names under zones.<consumer_zone> */
+			break;
+		}
+	}
 	mode = consumer_zone->member_ids.count ? try_to_add : just_add;
 retry_adding:
+	if (mode == just_add)
+		consumer_zone->skipped = 0;
 	cursor = rbtree_first(&consumer_zone->member_ids);
 	for ( member_id = domain_next(match)
 	    ; member_id && domain_is_subdomain(member_id, match)
 	    ; member_id = domain_next(member_id)) {
 		domain_type *member_domain;
 		char member_domain_str[5 * MAXDOMAINLEN];
-		struct zone_options* zopt;
-		int valid_group_values;
-		struct pattern_options *pattern = NULL;
+		struct pattern_options *pattern;
 		struct catalog_member_zone* to_add;
+		int added;
 
 		if (domain_dname(member_id)->label_count > dname->label_count+2
 		||  !(rrset = domain_find_rrset(member_id, zone, TYPE_PTR)))
@@ -609,74 +997,15 @@ retry_adding:
 		/* remove trailing dot */
 		member_domain_str[strlen(member_domain_str) - 1] = 0;
 
-		valid_group_values = 0;
-		/* Lookup group.<member_id> TXT for matching patterns  */
-		if(!namedb_lookup(xfrd->nsd->db, label_plus_dname("group",
-						domain_dname(member_id)),
-					&group, &closest_encloser)
-		|| !(rrset = domain_find_rrset(group, zone, TYPE_TXT))) {
-			; /* pass */
-
-		} else for (i = 0; i < rrset->rr_count; i++) {
-			/* Max single TXT rdata field length + '\x00' == 256 */
-			char group_value[256];
-
-			/* Looking for a single TXT rdata field */
-			if (rrset->rrs[i].rdata_count != 1
-
-			    /* rdata field should be at least 1 char */
-			||  rrset->rrs[i].rdatas[0].data[0] < 2
-
-			    /* single rdata atom with single TXT rdata field */
-			||  (uint16_t)(((uint8_t*)(rrset->rrs[i].rdatas[0].data + 1))[0])
-			  != (uint16_t) (rrset->rrs[i].rdatas[0].data[0]-1))
-				continue;
-
-			memcpy( group_value
-			      , (uint8_t*)(rrset->rrs[i].rdatas[0].data+1) + 1
-			      ,((uint8_t*)(rrset->rrs[i].rdatas[0].data+1))[0]
-			      );
-			group_value[
-			       ((uint8_t*)(rrset->rrs[i].rdatas[0].data+1))[0]
-			] = 0;
-			if ((pattern = pattern_options_find(
-					xfrd->nsd->options, group_value)))
-				valid_group_values += 1;
-		}
-		if (valid_group_values > 1) {
-	                log_msg(LOG_ERR, "member zone '%s': only a single "
-				"group property that matches a pattern is "
-				"allowed."
-				"The pattern from \"catalog-member-pattern\" "
-				"will be used instead.",
-				domain_to_string(member_id));
-			valid_group_values = 0;
-
-		} else if (valid_group_values == 1 && pattern
-				&& pattern->catalog_producer_zone) {
-	                log_msg(LOG_ERR, "member zone '%s': group property "
-				"'%s' matches a catalog producer member zone "
-				"pattern. In NSD, catalog member zones can be "
-				"either a member of a catalog consumer zone or"
-				" a catalog producer zone, but not both.",
-				domain_to_string(member_id), pattern->pname);
-			valid_group_values = 0;
-		}
-		if (valid_group_values == 1) {
-			/* pass: pattern is already set */
-			assert(pattern);
-
-		} else if (default_pattern)
-			pattern = default_pattern; /* pass */
+		/* Not in the catalog-member-shard, an existing member zone
+		 * for it is deleted, like a member_id that is gone. */
+		if (!catalog_member_in_shard(consumer_zone, member_domain))
+			continue;
 
-		else if (!(pattern = default_pattern =
-				catalog_member_pattern(consumer_zone))) {
-			make_catalog_consumer_invalid(consumer_zone, 
-				"missing 'group.%s' TXT RR and no default "
-				"pattern from \"catalog-member-pattern\"",
-				domain_to_string(member_id));
+		if (!(pattern = catalog_member_zone_pattern(consumer_zone,
+				zone, member_id, &default_pattern)))
 			return;
-		}
+
 		if (cursor == RBTREE_NULL)
 			; /* End of the current member zones list.
 			   * From here onwards, zones will only be added.
@@ -737,58 +1066,10 @@ retry_adding:
 				    cursor_cmz(cursor)->options.pattern->pname,
 				    pattern->pname));
 
-				if (cursor_cmz(cursor)->options.pattern ==
+				if (cursor_cmz(cursor)->options.pattern !=
 						pattern)
-					; /* pass: Pattern remains the same */
-				else {
-					/* Changing patterns is basically
-					 * deleting and adding the zone again
-					 */
-					zopt  = &cursor_cmz(cursor)->options;
-					dname = (dname_type *)zopt->node.key;
-					task_new_del_zone(
-					    xfrd->nsd->task[xfrd->nsd->mytask],
-					    xfrd->last_task,
-					    dname);
-					xfrd_set_reload_now(xfrd);
-					if(zone_is_slave(zopt)) {
-						xfrd_del_slave_zone( xfrd
-						                   , dname);
-					}
-					xfrd_del_notify(xfrd, dname);
-#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
-					if(zone_is_catalog_consumer(zopt)) {
-						xfrd_deinit_catalog_consumer_zone(
-								xfrd, dname);
-					}
-#endif
-					/* It is a catalog consumer member,
-					 * so no need to check if it was a
-					 * catalog producer member zone to 
-					 * delete and add
-					 */
-					zopt->pattern = pattern;
-					task_new_add_zone(
-					    xfrd->nsd->task[xfrd->nsd->mytask],
-					    xfrd->last_task, zopt->name,
-					    pattern->pname,
-					    getzonestatid( xfrd->nsd->options
-					                 , zopt));
-					zonestat_inc_ifneeded();
-					xfrd_set_reload_now(xfrd);
-#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
-					if(zone_is_catalog_consumer(zopt)) {
-						xfrd_init_catalog_consumer_zone(
-								xfrd, zopt);
-					}
-#endif
-					init_notify_send(xfrd->notify_zones,
-							xfrd->region, zopt);
-					if(zone_is_slave(zopt)) {
-						xfrd_init_slave_zone(
-								xfrd, zopt);
-					}
-				}
+					catalog_change_member_zone_pattern(
+						cursor_cmz(cursor), pattern);
 				cursor = rbtree_next(cursor);
 				continue;
 			}
@@ -798,9 +1079,8 @@ retry_adding:
 			assert(cursor == RBTREE_NULL || cmp < 0);
 		}
 		/* See if the zone already exists */
-		zopt = zone_options_find(xfrd->nsd->options,
-				domain_dname(member_domain));
-		if (zopt) {
+		if (zone_options_find(xfrd->nsd->options,
+				domain_dname(member_domain))) {
 			/* Produce warning if zopt is from other catalog.
 			 * Give debug message if zopt is not from this catalog.
 			 */
@@ -814,66 +1094,20 @@ retry_adding:
 					"zone already exists",
 					member_domain_str,
 					domain_to_string(member_id)));
+				consumer_zone->skipped += 1;
 				break;
 			default:
 				break;
 			}
 			continue;
 		}
-		/* Add member zone if not already there */
-                log_msg(LOG_INFO, "Adding '%s' PTR '%s'",
-				domain_to_string(member_id),
-				member_domain_str);
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "Adding %s PTR %s",
-			domain_to_string(member_id), member_domain_str));
-		to_add= catalog_member_zone_create(xfrd->nsd->options->region);
-		to_add->options.name = region_strdup(
-				xfrd->nsd->options->region, member_domain_str);
-		to_add->options.pattern = pattern;
-		if (!nsd_options_insert_zone(xfrd->nsd->options,
-					&to_add->options)) {
-	                log_msg(LOG_ERR, "bad domain name  '%s' pattern %s",
-				member_domain_str,
-				( pattern->pname ? pattern->pname: "<NULL>"));
-			zone_options_delete(xfrd->nsd->options,
-					&to_add->options);
-			continue;
-		}
-		to_add->member_id = dname_copy( xfrd->nsd->options->region
-		                           , domain_dname(member_id));
-		/* Insert into the members_id list */
-		to_add->node.key = to_add;
-		if(!rbtree_insert( &consumer_zone->member_ids, &to_add->node)){
-	                log_msg(LOG_ERR, "Error adding '%s' PTR '%s' to "
-				"consumer_zone->member_ids",
-				domain_to_string(member_id),
-				member_domain_str);
+		added = catalog_add_consumer_member_zone(consumer_zone,
+				domain_dname(member_id), member_domain_str,
+				pattern, &to_add);
+		if (added < 0)
 			break;
-		} else
+		else if (added)
 			cursor = rbtree_next(&to_add->node);
-		/* make addzone task and schedule reload */
-		task_new_add_zone(xfrd->nsd->task[xfrd->nsd->mytask],
-			xfrd->last_task, member_domain_str,
-			pattern->pname,
-			getzonestatid(xfrd->nsd->options, &to_add->options));
-		zonestat_inc_ifneeded();
-		xfrd_set_reload_now(xfrd);
-#ifdef MULTIPLE_CATALOG_CONSUMER_ZONES
-		/* add to xfrd - catalog consumer zones */
-		if(zone_is_catalog_consumer(&to_add->options)) {
-			xfrd_init_catalog_consumer_zone(xfrd,&to_add->options);
-		}
-#endif
-		/* add to xfrd - notify (for master and slaves) */
-		init_notify_send(xfrd->notify_zones, xfrd->region,
-				&to_add->options);
-		/* add to xfrd - slave */
-		if(zone_is_slave(&to_add->options)) {
-			xfrd_init_slave_zone(xfrd, &to_add->options);
-		}
-		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "Added catalog "
-			"member zone %s (from %s)",
-			member_domain_str, domain_to_string(member_id)));
 	}
 delete_members:
 	while (cursor != RBTREE_NULL) {
@@ -889,8 +1123,11 @@ delete_members:
 		mode = just_add;
 		goto retry_adding;
 	}
+processed:
 	debug_log_consumer_members(consumer_zone);
 	make_catalog_consumer_valid(consumer_zone);
+	diff_changes_clear(consumer_zone->changes);
+	consumer_zone->changes_mtime = zone->mtime;
 }
 
 
@@ -1273,12 +1510,56 @@ add_member_zones:
 	producer_zone->latest_pxfr = pxfr;
 }
 
+static void
+xfrd_handle_catalog_producer_timer(int ATTR_UNUSED(fd), short event,
+	void* ATTR_UNUSED(arg))
+{
+	/* the batch is done, the changes are written from xfrd_main */
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	xfrd->catalog_producer_timer_added = 0;
+	xfrd->catalog_producer_batch_done = 1;
+}
+
+/** start the batch of catalog producer member changes, if not started */
+static void
+xfrd_catalog_producer_timer_set(void)
+{
+	struct timeval tv;
+
+	if(xfrd->catalog_producer_timer_added)
+		return;
+	tv.tv_sec = xfrd->nsd->options->catalog_producer_batch;
+	tv.tv_usec = 0;
+	memset(&xfrd->catalog_producer_timer, 0,
+		sizeof(xfrd->catalog_producer_timer));
+	event_set(&xfrd->catalog_producer_timer, -1, EV_TIMEOUT,
+		xfrd_handle_catalog_producer_timer, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->catalog_producer_timer)!=0)
+		log_msg(LOG_ERR, "xfrd catalog producer timer: event_base_set "
+			"failed");
+	if(event_add(&xfrd->catalog_producer_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd catalog producer timer: event_add "
+			"failed");
+	xfrd->catalog_producer_timer_added = 1;
+}
+
 void xfrd_process_catalog_producer_zones()
 {
 	struct xfrd_catalog_producer_zone* producer_zone;
+	int batch = xfrd->nsd->options->catalog_producer_batch > 0
+		&& !xfrd->catalog_producer_batch_done;
 
+	xfrd->catalog_producer_batch_done = 0;
 	RBTREE_FOR(producer_zone, struct xfrd_catalog_producer_zone*,
 			xfrd->catalog_producer_zones) {
+		if(batch && !producer_zone->axfr
+		&& (producer_zone->to_add || producer_zone->to_delete)) {
+			/* Collect the changes until the batch is done, the
+			 * initial deployment is written right away */
+			xfrd_catalog_producer_timer_set();
+			continue;
+		}
 		xfrd_process_catalog_producer_zone(producer_zone);
 	}
 }
@@ -10,6 +10,7 @@
 #include "xfrd.h"
 struct xfrd_producer_member;
 struct xfrd_producer_xfr;
+struct diff_changes;
 
 /**
  * Catalog zones withing the xfrd context
@@ -27,6 +28,19 @@ struct xfrd_catalog_consumer_zone {
 	/* Last time processed, compare with zone->mtime to see if we need to process */
 	struct timespec mtime;
 
+	/* The names changed by the transfers applied since the last time
+	 * processed, and the zone->mtime after them. If the zone->mtime is
+	 * different, the zone changed otherwise and all names are processed */
+	struct diff_changes* changes;
+	struct timespec changes_mtime;
+
+	/* Number of member_ids not added, because their zone already exists */
+	size_t skipped;
+
+	/* The catalog-member-shard of the last time processed, when it
+	 * changes all the member zones are looked at again */
+	uint32_t shard, shards;
+
 	/* The reason for this zone to be invalid, or NULL if it is valid */
 	char *invalid;
 } ATTR_PACKED;
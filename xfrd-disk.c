@@ -14,12 +14,15 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include "xfrd-disk.h"
 #include "xfrd.h"
 #include "buffer.h"
 #include "nsd.h"
 #include "options.h"
+#include "lookup3.h"
 
 /* quick tokenizer, reads words separated by whitespace.
    No quoted strings. Comments are skipped (#... eol). */
@@ -139,15 +142,133 @@ xfrd_read_state_soa(FILE* in, const char* id_acquired,
 	return 1;
 }
 
-void
-xfrd_read_state(struct xfrd_state* xfrd)
+/* the state of a zone, read from the state file or the journal */
+struct xfrd_state_read {
+	uint32_t state, masnum, nextmas, round_num, timeout, backoff;
+	xfrd_soa_type soa_nsd, soa_disk, soa_notified;
+	time_t soa_nsd_acquired, soa_disk_acquired, soa_notified_acquired;
+};
+
+/* set the state of the zone, that was written at filetime */
+static void
+xfrd_read_state_zone(xfrd_zone_type* zone, struct xfrd_state_read* r,
+	uint32_t filetime, const char* statefile)
+{
+	uint32_t timeout = r->timeout;
+	time_t soa_refresh;
+	xfrd_soa_type incoming_soa;
+	time_t incoming_acquired;
+
+	if(r->soa_nsd_acquired>xfrd_time()+15 ||
+		r->soa_disk_acquired>xfrd_time()+15 ||
+		r->soa_notified_acquired>xfrd_time()+15)
+	{
+		log_msg(LOG_ERR, "xfrd: statefile %s contains"
+			" times in the future for zone %s. Ignoring.",
+			statefile, zone->apex_str);
+		return;
+	}
+	zone->state = r->state;
+	zone->master_num = r->masnum;
+	zone->next_master = r->nextmas;
+	zone->round_num = r->round_num;
+	zone->timeout.tv_sec = timeout;
+	zone->timeout.tv_usec = 0;
+	zone->fresh_xfr_timeout = r->backoff*XFRD_TRANSFER_TIMEOUT_START;
+
+	/* read the zone OK, now set the master properly */
+	zone->master = acl_find_num(zone->zone_options->pattern->
+		request_xfr, zone->master_num);
+	if(!zone->master) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: primaries changed for zone %s",
+			zone->apex_str));
+		zone->master = zone->zone_options->pattern->request_xfr;
+		zone->master_num = 0;
+		zone->round_num = 0;
+	}
+
+	/*
+	 * There is no timeout,
+	 * or there is a notification,
+	 * or there is a soa && current time is past refresh point
+	 */
+	soa_refresh = ntohl(r->soa_disk.refresh);
+	if (soa_refresh > (time_t)zone->zone_options->pattern->max_refresh_time)
+		soa_refresh = zone->zone_options->pattern->max_refresh_time;
+	else if (soa_refresh < (time_t)zone->zone_options->pattern->min_refresh_time)
+		soa_refresh = zone->zone_options->pattern->min_refresh_time;
+	if(timeout == 0 || r->soa_notified_acquired != 0 ||
+		(r->soa_disk_acquired != 0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> (uint32_t)soa_refresh))
+	{
+		zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
+	}
+	if(timeout != 0 && filetime + timeout < (uint32_t)xfrd_time()) {
+		/* timeout is in the past, refresh the zone */
+		timeout = 0;
+		if(zone->state == xfrd_zone_ok)
+			zone->state = xfrd_zone_refreshing;
+		xfrd_set_refresh_now(zone);
+	}
+
+	/* There is a soa && current time is past expiry point */
+	if(r->soa_disk_acquired!=0 &&
+		(uint32_t)xfrd_time() - r->soa_disk_acquired
+			> ntohl(r->soa_disk.expire))
+	{
+		zone->state = xfrd_zone_expired;
+		xfrd_set_refresh_now(zone);
+	} 
+
+	/* there is a zone read and it matches what we had before */
+	if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
+		&& zone->soa_nsd.serial == r->soa_nsd.serial) {
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone,
+			within_refresh_bounds(zone, timeout));
+	}	
+	if((zone->soa_nsd_acquired == 0 && r->soa_nsd_acquired == 0 &&
+		r->soa_disk_acquired == 0) ||
+		(zone->state != xfrd_zone_ok && timeout != 0)) {
+		/* but don't check now, because that would mean a
+		 * storm of attempts on some master servers */
+		xfrd_deactivate_zone(zone);
+		zone->state = r->state;
+		xfrd_set_timer(zone,
+			within_retry_bounds(zone, timeout));
+	}
+
+	/* handle as an incoming SOA. */
+	incoming_soa = zone->soa_nsd;
+	incoming_acquired = zone->soa_nsd_acquired;
+	zone->soa_nsd = r->soa_nsd;
+	zone->soa_nsd_acquired = r->soa_nsd_acquired;
+	/* use soa and soa_acquired from starting NSD, not what is stored in
+	 * the state file, because the actual zone contents trumps the contents
+	 * of this cache */
+	zone->soa_disk = incoming_soa;
+	zone->soa_disk_acquired = incoming_acquired;
+	zone->soa_notified = r->soa_notified;
+	zone->soa_notified_acquired = r->soa_notified_acquired;
+	if (zone->state == xfrd_zone_expired)
+	{
+		xfrd_send_expire_notification(zone);
+	}
+	if(incoming_acquired != 0)
+		xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+}
+
+static void
+xfrd_read_state_file(struct xfrd_state* xfrd, rbtree_type* journal)
 {
 	const char* statefile = xfrd->nsd->options->xfrdfile;
 	FILE *in;
 	uint32_t filetime = 0;
 	uint32_t numzones, i;
 	region_type *tempregion;
-	time_t soa_refresh;
 
 	tempregion = region_create(xalloc, free);
 	if(!tempregion)
@@ -190,12 +311,7 @@ xfrd_read_state(struct xfrd_state* xfrd)
 		char *p;
 		xfrd_zone_type* zone;
 		const dname_type* dname;
-		uint32_t state, masnum, nextmas, round_num, timeout, backoff;
-		xfrd_soa_type soa_nsd_read, soa_disk_read, soa_notified_read;
-		time_t soa_nsd_acquired_read,
-			soa_disk_acquired_read, soa_notified_acquired_read;
-		xfrd_soa_type incoming_soa;
-		time_t incoming_acquired;
+		struct xfrd_state_read r;
 
 		if(nsd.signal_hint_shutdown) {
 			fclose(in);
@@ -203,32 +319,30 @@ xfrd_read_state(struct xfrd_state* xfrd)
 			return;
 		}
 
-		memset(&soa_nsd_read, 0, sizeof(soa_nsd_read));
-		memset(&soa_disk_read, 0, sizeof(soa_disk_read));
-		memset(&soa_notified_read, 0, sizeof(soa_notified_read));
+		memset(&r, 0, sizeof(r));
 
 		if(!xfrd_read_check_str(in, "zone:") ||
 		   !xfrd_read_check_str(in, "name:")  ||
 		   !(p=xfrd_read_token(in)) ||
 		   !(dname = dname_parse(tempregion, p)) ||
 		   !xfrd_read_check_str(in, "state:") ||
-		   !xfrd_read_i32(in, &state) || (state>2) ||
+		   !xfrd_read_i32(in, &r.state) || (r.state>2) ||
 		   !xfrd_read_check_str(in, "master:") ||
-		   !xfrd_read_i32(in, &masnum) ||
+		   !xfrd_read_i32(in, &r.masnum) ||
 		   !xfrd_read_check_str(in, "next_master:") ||
-		   !xfrd_read_i32(in, &nextmas) ||
+		   !xfrd_read_i32(in, &r.nextmas) ||
 		   !xfrd_read_check_str(in, "round_num:") ||
-		   !xfrd_read_i32(in, &round_num) ||
+		   !xfrd_read_i32(in, &r.round_num) ||
 		   !xfrd_read_check_str(in, "next_timeout:") ||
-		   !xfrd_read_i32(in, &timeout) ||
+		   !xfrd_read_i32(in, &r.timeout) ||
 		   !xfrd_read_check_str(in, "backoff:") ||
-		   !xfrd_read_i32(in, &backoff) ||
+		   !xfrd_read_i32(in, &r.backoff) ||
 		   !xfrd_read_state_soa(in, "soa_nsd_acquired:", "soa_nsd:",
-			&soa_nsd_read, &soa_nsd_acquired_read) ||
+			&r.soa_nsd, &r.soa_nsd_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_disk_acquired:", "soa_disk:",
-			&soa_disk_read, &soa_disk_acquired_read) ||
+			&r.soa_disk, &r.soa_disk_acquired) ||
 		   !xfrd_read_state_soa(in, "soa_notify_acquired:", "soa_notify:",
-			&soa_notified_read, &soa_notified_acquired_read))
+			&r.soa_notified, &r.soa_notified_acquired))
 		{
 			log_msg(LOG_ERR, "xfrd: corrupt state file %s dated %d (now=%lld)",
 				statefile, (int)filetime, (long long)xfrd_time());
@@ -242,107 +356,11 @@ xfrd_read_state(struct xfrd_state* xfrd)
 			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: state file has info for not configured zone %s", p));
 			continue;
 		}
-
-		if(soa_nsd_acquired_read>xfrd_time()+15 ||
-			soa_disk_acquired_read>xfrd_time()+15 ||
-			soa_notified_acquired_read>xfrd_time()+15)
-		{
-			log_msg(LOG_ERR, "xfrd: statefile %s contains"
-				" times in the future for zone %s. Ignoring.",
-				statefile, zone->apex_str);
+		if(journal && rbtree_search(journal, dname)) {
+			/* the journal has newer state for the zone */
 			continue;
 		}
-		zone->state = state;
-		zone->master_num = masnum;
-		zone->next_master = nextmas;
-		zone->round_num = round_num;
-		zone->timeout.tv_sec = timeout;
-		zone->timeout.tv_usec = 0;
-		zone->fresh_xfr_timeout = backoff*XFRD_TRANSFER_TIMEOUT_START;
-
-		/* read the zone OK, now set the master properly */
-		zone->master = acl_find_num(zone->zone_options->pattern->
-			request_xfr, zone->master_num);
-		if(!zone->master) {
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: primaries changed for zone %s",
-				zone->apex_str));
-			zone->master = zone->zone_options->pattern->request_xfr;
-			zone->master_num = 0;
-			zone->round_num = 0;
-		}
-
-		/*
-		 * There is no timeout,
-		 * or there is a notification,
-		 * or there is a soa && current time is past refresh point
-		 */
-		soa_refresh = ntohl(soa_disk_read.refresh);
-		if (soa_refresh > (time_t)zone->zone_options->pattern->max_refresh_time)
-			soa_refresh = zone->zone_options->pattern->max_refresh_time;
-		else if (soa_refresh < (time_t)zone->zone_options->pattern->min_refresh_time)
-			soa_refresh = zone->zone_options->pattern->min_refresh_time;
-		if(timeout == 0 || soa_notified_acquired_read != 0 ||
-			(soa_disk_acquired_read != 0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> (uint32_t)soa_refresh))
-		{
-			zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
-		if(timeout != 0 && filetime + timeout < (uint32_t)xfrd_time()) {
-			/* timeout is in the past, refresh the zone */
-			timeout = 0;
-			if(zone->state == xfrd_zone_ok)
-				zone->state = xfrd_zone_refreshing;
-			xfrd_set_refresh_now(zone);
-		}
-
-		/* There is a soa && current time is past expiry point */
-		if(soa_disk_acquired_read!=0 &&
-			(uint32_t)xfrd_time() - soa_disk_acquired_read
-				> ntohl(soa_disk_read.expire))
-		{
-			zone->state = xfrd_zone_expired;
-			xfrd_set_refresh_now(zone);
-		} 
-
-		/* there is a zone read and it matches what we had before */
-		if(zone->soa_nsd_acquired && zone->state != xfrd_zone_expired
-			&& zone->soa_nsd.serial == soa_nsd_read.serial) {
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone,
-				within_refresh_bounds(zone, timeout));
-		}	
-		if((zone->soa_nsd_acquired == 0 && soa_nsd_acquired_read == 0 &&
-			soa_disk_acquired_read == 0) ||
-			(zone->state != xfrd_zone_ok && timeout != 0)) {
-			/* but don't check now, because that would mean a
-			 * storm of attempts on some master servers */
-			xfrd_deactivate_zone(zone);
-			zone->state = state;
-			xfrd_set_timer(zone,
-				within_retry_bounds(zone, timeout));
-		}
-
-		/* handle as an incoming SOA. */
-		incoming_soa = zone->soa_nsd;
-		incoming_acquired = zone->soa_nsd_acquired;
-		zone->soa_nsd = soa_nsd_read;
-		zone->soa_nsd_acquired = soa_nsd_acquired_read;
-		/* use soa and soa_acquired from starting NSD, not what is stored in
-		 * the state file, because the actual zone contents trumps the contents
-		 * of this cache */
-		zone->soa_disk = incoming_soa;
-		zone->soa_disk_acquired = incoming_acquired;
-		zone->soa_notified = soa_notified_read;
-		zone->soa_notified_acquired = soa_notified_acquired_read;
-		if (zone->state == xfrd_zone_expired)
-		{
-			xfrd_send_expire_notification(zone);
-		}
-		if(incoming_acquired != 0)
-			xfrd_handle_incoming_soa(zone, &incoming_soa, incoming_acquired);
+		xfrd_read_state_zone(zone, &r, filetime, statefile);
 	}
 
 	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC)) {
@@ -446,20 +464,20 @@ xfrd_write_state_soa(FILE* out, const char* id,
 	fprintf(out, "\n");
 }
 
-void
-xfrd_write_state(struct xfrd_state* xfrd)
+/* write the state file, with the filetime now, returns 0 on failure */
+static int
+xfrd_write_state_file(struct xfrd_state* xfrd, time_t now)
 {
 	rbnode_type* p;
 	const char* statefile = xfrd->nsd->options->xfrdfile;
 	FILE *out;
-	time_t now = xfrd_time();
 
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: write file %s", statefile));
 	out = fopen(statefile, "w");
 	if(!out) {
 		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
 				statefile, strerror(errno));
-		return;
+		return 0;
 	}
 
 	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
@@ -512,9 +530,393 @@ xfrd_write_state(struct xfrd_state* xfrd)
 	}
 
 	fprintf(out, "%s\n", XFRD_FILE_MAGIC);
+	if(ferror(out)) {
+		log_msg(LOG_ERR, "xfrd: could not write file %s: %s",
+			statefile, strerror(errno));
+		fclose(out);
+		return 0;
+	}
+	if(fclose(out) != 0) {
+		log_msg(LOG_ERR, "xfrd: could not write file %s: %s",
+			statefile, strerror(errno));
+		return 0;
+	}
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: written %d zones to state file",
 		(int)xfrd->zones->count));
-	fclose(out);
+	return 1;
+}
+
+/* the filename of the journal for the state file */
+static void
+xfrd_journal_name(char* buf, size_t len, const char* statefile)
+{
+	snprintf(buf, len, "%s.jnl", statefile);
+}
+
+void
+xfrd_write_state(struct xfrd_state* xfrd)
+{
+	char jname[1024];
+	time_t now = xfrd_time();
+	rbnode_type* p;
+
+	if(!xfrd_write_state_file(xfrd, now))
+		return;
+	/* the state file has all the zones, the journal starts over */
+	xfrd_journal_name(jname, sizeof(jname), xfrd->nsd->options->xfrdfile);
+	if(unlink(jname) == -1 && errno != ENOENT)
+		log_msg(LOG_ERR, "xfrd: could not unlink %s: %s", jname,
+			strerror(errno));
+	xfrd->state_filetime = (uint32_t)now;
+	xfrd->state_journal_count = 0;
+	xfrd->state_dirty = 0;
+	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
+		((xfrd_zone_type*)p)->state_dirty = 0;
+}
+
+/*
+ * The journal has a header of the magic string and the filetime of the
+ * state file that it follows. The records are a 16 bit length and a 32 bit
+ * checksum of the data that follows. The data is the time of the record,
+ * the zone name and the zone state, with numbers in network order. A
+ * record for a zone replaces the one in the state file, and earlier
+ * records for that zone. A partially written record at the end, like
+ * after a crash, fails the checksum, and the journal is read up to there.
+ */
+
+/* the size of the journal header */
+#define XFRD_JOURNAL_HEADER_SIZE (sizeof(XFRD_JOURNAL_MAGIC)-1+4)
+/* the size of a record header */
+#define XFRD_JOURNAL_RECORD_HEADER 6
+/* the maximum size of a journal record */
+#define XFRD_JOURNAL_RECORD_MAX (XFRD_JOURNAL_RECORD_HEADER + 4 + 1 + \
+	MAXDOMAINLEN + 1 + 5*4 + 3*(8 + 10 + 2*(MAXDOMAINLEN+1) + 20))
+/* records over twice the number of zones, start a new journal */
+#define XFRD_JOURNAL_SLACK 1024
+
+static void
+xfrd_journal_write_soa(buffer_type* b, xfrd_soa_type* soa, time_t acquired)
+{
+	buffer_write_u64(b, (uint64_t)acquired);
+	if(!acquired)
+		return;
+	/* the soa fields are kept in network order */
+	buffer_write(b, &soa->type, sizeof(soa->type));
+	buffer_write(b, &soa->klass, sizeof(soa->klass));
+	buffer_write(b, &soa->ttl, sizeof(soa->ttl));
+	buffer_write(b, &soa->rdata_count, sizeof(soa->rdata_count));
+	buffer_write(b, soa->prim_ns, soa->prim_ns[0]+1);
+	buffer_write(b, soa->email, soa->email[0]+1);
+	buffer_write(b, &soa->serial, sizeof(soa->serial));
+	buffer_write(b, &soa->refresh, sizeof(soa->refresh));
+	buffer_write(b, &soa->retry, sizeof(soa->retry));
+	buffer_write(b, &soa->expire, sizeof(soa->expire));
+	buffer_write(b, &soa->minimum, sizeof(soa->minimum));
+}
+
+static void
+xfrd_journal_write_zone(buffer_type* b, xfrd_zone_type* zone, uint32_t now)
+{
+	size_t start = buffer_position(b), len;
+	buffer_skip(b, XFRD_JOURNAL_RECORD_HEADER);
+	buffer_write_u32(b, now);
+	buffer_write_u8(b, zone->apex->name_size);
+	buffer_write(b, dname_name(zone->apex), zone->apex->name_size);
+	buffer_write_u8(b, (uint8_t)zone->state);
+	buffer_write_u32(b, (uint32_t)zone->master_num);
+	buffer_write_u32(b, (uint32_t)zone->next_master);
+	buffer_write_u32(b, (uint32_t)zone->round_num);
+	buffer_write_u32(b, (zone->zone_handler_flags&EV_TIMEOUT)?
+		(uint32_t)zone->timeout.tv_sec:0);
+	buffer_write_u32(b, (uint32_t)(zone->fresh_xfr_timeout/
+		XFRD_TRANSFER_TIMEOUT_START));
+	xfrd_journal_write_soa(b, &zone->soa_nsd, zone->soa_nsd_acquired);
+	xfrd_journal_write_soa(b, &zone->soa_disk, zone->soa_disk_acquired);
+	xfrd_journal_write_soa(b, &zone->soa_notified,
+		zone->soa_notified_acquired);
+	len = buffer_position(b) - start - XFRD_JOURNAL_RECORD_HEADER;
+	buffer_write_u16_at(b, start, (uint16_t)len);
+	buffer_write_u32_at(b, start+2, hashlittle(buffer_at(b,
+		start+XFRD_JOURNAL_RECORD_HEADER), len, 0));
+}
+
+/* write the buffer to the journal, returns 0 on failure */
+static int
+xfrd_journal_flush(buffer_type* b, FILE* out, const char* jname)
+{
+	if(buffer_position(b) == 0)
+		return 1;
+	if(fwrite(buffer_begin(b), 1, buffer_position(b), out)
+		!= buffer_position(b)) {
+		log_msg(LOG_ERR, "xfrd: could not write file %s: %s",
+			jname, strerror(errno));
+		return 0;
+	}
+	buffer_clear(b);
+	return 1;
+}
+
+void
+xfrd_write_state_journal(struct xfrd_state* xfrd)
+{
+	char jname[1024];
+	buffer_type* b = xfrd_get_temp_buffer();
+	uint32_t now = (uint32_t)xfrd_time();
+	size_t num = 0;
+	rbnode_type* p;
+	struct stat st;
+	FILE* out;
+
+	if(!xfrd->state_dirty)
+		return;
+	xfrd->state_dirty = 0;
+	xfrd_journal_name(jname, sizeof(jname), xfrd->nsd->options->xfrdfile);
+	out = fopen(jname, "a");
+	if(!out) {
+		log_msg(LOG_ERR, "xfrd: Could not open file %s for writing: %s",
+			jname, strerror(errno));
+		return;
+	}
+	buffer_clear(b);
+	if(fstat(fileno(out), &st) == 0 && st.st_size == 0) {
+		/* a new journal, that follows the state file */
+		buffer_write(b, XFRD_JOURNAL_MAGIC,
+			sizeof(XFRD_JOURNAL_MAGIC)-1);
+		buffer_write_u32(b, xfrd->state_filetime);
+	}
+	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
+	{
+		xfrd_zone_type* zone = (xfrd_zone_type*)p;
+		if(!zone->state_dirty)
+			continue;
+		zone->state_dirty = 0;
+		if(buffer_remaining(b) < XFRD_JOURNAL_RECORD_MAX &&
+			!xfrd_journal_flush(b, out, jname))
+			break;
+		xfrd_journal_write_zone(b, zone, now);
+		num++;
+	}
+	(void)xfrd_journal_flush(b, out, jname);
+	buffer_clear(b);
+	if(fclose(out) != 0)
+		log_msg(LOG_ERR, "xfrd: could not write file %s: %s",
+			jname, strerror(errno));
+	xfrd->state_journal_count += num;
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: appended %d zones to %s",
+		(int)num, jname));
+
+	/* the journal has grown, write the state file and start over */
+	if(xfrd->state_journal_count > 2*xfrd->zones->count +
+		XFRD_JOURNAL_SLACK)
+		xfrd_write_state(xfrd);
+}
+
+static int
+xfrd_journal_read_soa(buffer_type* b, xfrd_soa_type* soa, time_t* acquired)
+{
+	if(!buffer_available(b, 8))
+		return 0;
+	*acquired = (time_t)buffer_read_u64(b);
+	if(!*acquired)
+		return 1;
+	if(!buffer_available(b, 10+1))
+		return 0;
+	buffer_read(b, &soa->type, sizeof(soa->type));
+	buffer_read(b, &soa->klass, sizeof(soa->klass));
+	buffer_read(b, &soa->ttl, sizeof(soa->ttl));
+	buffer_read(b, &soa->rdata_count, sizeof(soa->rdata_count));
+	soa->prim_ns[0] = buffer_read_u8(b);
+	if(!buffer_available(b, soa->prim_ns[0]+1))
+		return 0;
+	buffer_read(b, soa->prim_ns+1, soa->prim_ns[0]);
+	soa->email[0] = buffer_read_u8(b);
+	if(!buffer_available(b, soa->email[0]+20))
+		return 0;
+	buffer_read(b, soa->email+1, soa->email[0]);
+	buffer_read(b, &soa->serial, sizeof(soa->serial));
+	buffer_read(b, &soa->refresh, sizeof(soa->refresh));
+	buffer_read(b, &soa->retry, sizeof(soa->retry));
+	buffer_read(b, &soa->expire, sizeof(soa->expire));
+	buffer_read(b, &soa->minimum, sizeof(soa->minimum));
+	return 1;
+}
+
+/* read the zone state in the journal record */
+static int
+xfrd_journal_read_zone(uint8_t* data, size_t len, uint32_t* rectime,
+	struct xfrd_state_read* r)
+{
+	buffer_type b;
+	buffer_create_from(&b, data, len);
+	memset(r, 0, sizeof(*r));
+	if(!buffer_available(&b, 5))
+		return 0;
+	*rectime = buffer_read_u32(&b);
+	buffer_skip(&b, buffer_read_u8(&b));
+	if(!buffer_available(&b, 1+5*4))
+		return 0;
+	r->state = buffer_read_u8(&b);
+	r->masnum = buffer_read_u32(&b);
+	r->nextmas = buffer_read_u32(&b);
+	r->round_num = buffer_read_u32(&b);
+	r->timeout = buffer_read_u32(&b);
+	r->backoff = buffer_read_u32(&b);
+	return r->state <= 2 &&
+		xfrd_journal_read_soa(&b, &r->soa_nsd, &r->soa_nsd_acquired) &&
+		xfrd_journal_read_soa(&b, &r->soa_disk, &r->soa_disk_acquired) &&
+		xfrd_journal_read_soa(&b, &r->soa_notified,
+			&r->soa_notified_acquired);
+}
+
+/* the last record in the journal for a zone */
+struct xfrd_journal_zone {
+	rbnode_type node;
+	uint8_t* data;
+	size_t len;
+};
+
+/*
+ * Index the records in the journal data, that follows the state file
+ * with filetime. The last record of every zone is put in the tree.
+ * Returns the number of records.
+ */
+static size_t
+xfrd_journal_index(uint8_t* data, size_t size, uint32_t filetime,
+	const char* jname, region_type* region, rbtree_type* tree)
+{
+	size_t pos = XFRD_JOURNAL_HEADER_SIZE, num = 0;
+	if(size < XFRD_JOURNAL_HEADER_SIZE ||
+		memcmp(data, XFRD_JOURNAL_MAGIC, sizeof(XFRD_JOURNAL_MAGIC)-1)
+		!= 0) {
+		log_msg(LOG_ERR, "xfrd: journal %s is corrupt, ignoring it",
+			jname);
+		return 0;
+	}
+	if(read_uint32(data+sizeof(XFRD_JOURNAL_MAGIC)-1) != filetime) {
+		VERBOSITY(2, (LOG_INFO, "xfrd: journal %s is for another "
+			"state file, ignoring it", jname));
+		return 0;
+	}
+	while(pos + XFRD_JOURNAL_RECORD_HEADER <= size) {
+		size_t len = read_uint16(data+pos);
+		uint8_t* rec = data+pos+XFRD_JOURNAL_RECORD_HEADER;
+		const dname_type* dname;
+		struct xfrd_journal_zone* jz;
+		if(pos + XFRD_JOURNAL_RECORD_HEADER + len > size ||
+			len < 5 || 5+(size_t)rec[4] > len ||
+			hashlittle(rec, len, 0) != read_uint32(data+pos+2)) {
+			/* the end of the journal was not written completely */
+			VERBOSITY(2, (LOG_INFO, "xfrd: journal %s has an "
+				"incomplete record at the end", jname));
+			break;
+		}
+		pos += XFRD_JOURNAL_RECORD_HEADER + len;
+		num++;
+		if(!(dname = dname_make(region, rec+5, 1)))
+			continue;
+		jz = (struct xfrd_journal_zone*)rbtree_search(tree, dname);
+		if(!jz) {
+			jz = (struct xfrd_journal_zone*)region_alloc_zero(
+				region, sizeof(*jz));
+			jz->node.key = dname;
+			rbtree_insert(tree, &jz->node);
+		}
+		jz->data = rec;
+		jz->len = len;
+	}
+	return num;
+}
+
+/* read the filetime from the state file, or 0 if there is none */
+static uint32_t
+xfrd_read_state_filetime(const char* statefile)
+{
+	uint32_t filetime = 0;
+	FILE* in = fopen(statefile, "r");
+	if(!in)
+		return 0;
+	if(!xfrd_read_check_str(in, XFRD_FILE_MAGIC) ||
+		!xfrd_read_check_str(in, "filetime:") ||
+		!xfrd_read_i32(in, &filetime))
+		filetime = 0;
+	fclose(in);
+	return filetime;
+}
+
+void
+xfrd_read_state(struct xfrd_state* xfrd)
+{
+	const char* statefile = xfrd->nsd->options->xfrdfile;
+	char jname[1024];
+	region_type* region;
+	rbtree_type* tree;
+	uint8_t* data = NULL;
+	size_t size = 0;
+	struct stat st;
+	rbnode_type* p;
+	int fd;
+
+	xfrd->state_filetime = xfrd_read_state_filetime(statefile);
+	xfrd->state_journal_count = 0;
+	region = region_create(xalloc, free);
+	tree = rbtree_create(region,
+		(int (*)(const void *, const void *)) dname_compare);
+
+	/* map the journal, with the state changes since the state file */
+	xfrd_journal_name(jname, sizeof(jname), statefile);
+	fd = open(jname, O_RDONLY);
+	if(fd != -1) {
+		if(fstat(fd, &st) == 0 && st.st_size > 0) {
+			size = (size_t)st.st_size;
+			data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data == MAP_FAILED) {
+				log_msg(LOG_ERR, "xfrd: could not mmap %s: %s",
+					jname, strerror(errno));
+				data = NULL;
+			}
+		}
+		close(fd);
+	}
+	if(data)
+		xfrd->state_journal_count = xfrd_journal_index(data, size,
+			xfrd->state_filetime, jname, region, tree);
+	if(xfrd->state_journal_count == 0 &&
+		unlink(jname) == -1 && errno != ENOENT)
+		log_msg(LOG_ERR, "xfrd: could not unlink %s: %s", jname,
+			strerror(errno));
+
+	xfrd_read_state_file(xfrd, tree);
+
+	/* the journal records replace the entries in the state file */
+	RBTREE_FOR(p, rbnode_type*, tree) {
+		struct xfrd_journal_zone* jz = (struct xfrd_journal_zone*)p;
+		struct xfrd_state_read r;
+		xfrd_zone_type* zone;
+		uint32_t rectime;
+		if(nsd.signal_hint_shutdown)
+			break;
+		zone = (xfrd_zone_type*)rbtree_search(xfrd->zones,
+			jz->node.key);
+		if(!zone)
+			continue;
+		if(!xfrd_journal_read_zone(jz->data, jz->len, &rectime, &r) ||
+			(time_t)rectime > xfrd_time()+15) {
+			log_msg(LOG_ERR, "xfrd: journal %s has a corrupt "
+				"record for zone %s", jname, zone->apex_str);
+			continue;
+		}
+		xfrd_read_state_zone(zone, &r, rectime, jname);
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: read %d zones from journal %s",
+		(int)tree->count, jname));
+	if(data)
+		munmap(data, size);
+	region_destroy(region);
+
+	/* the state on disk is what was just read */
+	xfrd->state_dirty = 0;
+	for(p = rbtree_first(xfrd->zones); p && p!=RBTREE_NULL; p=rbtree_next(p))
+		((xfrd_zone_type*)p)->state_dirty = 0;
 }
 
 /* return tempdirname */
@@ -565,11 +967,61 @@ tempxfrname(char* buf, size_t sz, struct nsd* nsd, uint64_t number)
 	snprintf(buf, sz, "%s/xfr.%lld", tnm, (long long)number);
 }
 
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SHM_UNLINK)
+/* return name of the shared memory object for the xfrfile */
+static void
+shmxfrname(char* buf, size_t sz, struct nsd* nsd, uint64_t number)
+{
+	snprintf(buf, sz, "/nsd-xfr-%d.%lld", (int)nsd->pid,
+		(long long)number);
+}
+
+/* open the xfrfile in shared memory, with the mode as for fopen */
+static FILE*
+xfrd_open_xfrshm(struct nsd* nsd, uint64_t number, char* mode)
+{
+	char fname[128];
+	int flags, fd;
+	FILE* xfr;
+	shmxfrname(fname, sizeof(fname), nsd, number);
+	if(mode[0] == 'w')
+		flags = O_RDWR | O_CREAT | O_TRUNC;
+	else if(mode[0] == 'a')
+		flags = O_RDWR | O_CREAT;
+	else if(mode[1] == '+')
+		flags = O_RDWR;
+	else	flags = O_RDONLY;
+	fd = shm_open(fname, flags, 0600);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "shm_open %s for %s failed: %s", fname, mode,
+			strerror(errno));
+		return NULL;
+	}
+	xfr = fdopen(fd, mode);
+	if(!xfr) {
+		log_msg(LOG_ERR, "fdopen %s for %s failed: %s", fname, mode,
+			strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if(mode[0] == 'a' && fseeko(xfr, 0, SEEK_END) == -1) {
+		log_msg(LOG_ERR, "fseek %s failed: %s", fname, strerror(errno));
+		fclose(xfr);
+		return NULL;
+	}
+	return xfr;
+}
+#endif /* HAVE_SHM_OPEN && HAVE_SHM_UNLINK */
+
 FILE*
 xfrd_open_xfrfile(struct nsd* nsd, uint64_t number, char* mode)
 {
 	char fname[1200];
 	FILE* xfr;
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SHM_UNLINK)
+	if(nsd->options->xfrd_xfr_shm)
+		return xfrd_open_xfrshm(nsd, number, mode);
+#endif
 	tempxfrname(fname, sizeof(fname), nsd, number);
 	xfr = fopen(fname, mode);
 	if(!xfr && errno == ENOENT) {
@@ -589,6 +1041,16 @@ void
 xfrd_unlink_xfrfile(struct nsd* nsd, uint64_t number)
 {
 	char fname[1200];
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SHM_UNLINK)
+	if(nsd->options->xfrd_xfr_shm) {
+		shmxfrname(fname, sizeof(fname), nsd, number);
+		if(shm_unlink(fname) == -1) {
+			log_msg(LOG_WARNING, "could not shm_unlink %s: %s",
+				fname, strerror(errno));
+		}
+		return;
+	}
+#endif
 	tempxfrname(fname, sizeof(fname), nsd, number);
 	if(unlink(fname) == -1) {
 		log_msg(LOG_WARNING, "could not unlink %s: %s", fname,
@@ -601,6 +1063,22 @@ xfrd_get_xfrfile_size(struct nsd* nsd, uint64_t number )
 {
 	char fname[1200];
 	struct stat tempxfr_stat;
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SHM_UNLINK)
+	if(nsd->options->xfrd_xfr_shm) {
+		int fd;
+		shmxfrname(fname, sizeof(fname), nsd, number);
+		if((fd = shm_open(fname, O_RDONLY, 0600)) == -1 ||
+			fstat(fd, &tempxfr_stat) < 0) {
+			log_msg(LOG_WARNING, "could not get size %s: %s",
+				fname, strerror(errno));
+			if(fd != -1)
+				close(fd);
+			return 0;
+		}
+		close(fd);
+		return (uint64_t)tempxfr_stat.st_size;
+	}
+#endif
 	tempxfrname(fname, sizeof(fname), nsd, number);
 	if( stat( fname, &tempxfr_stat ) < 0 ) {
 	    log_msg(LOG_WARNING, "could not get file size %s: %s", fname,
@@ -15,11 +15,17 @@ struct nsd;
 
 /* magic string to identify xfrd state file */
 #define XFRD_FILE_MAGIC "NSDXFRD2"
+/* magic string to identify the journal of the xfrd state file */
+#define XFRD_JOURNAL_MAGIC "NSDXJNL1"
 
-/* read from state file as many zones as possible (until error/eof).*/
+/* read from state file as many zones as possible (until error/eof),
+ * and the newer zone state from the journal of the state file. */
 void xfrd_read_state(struct xfrd_state* xfrd);
-/* write xfrd zone state if possible */
+/* write xfrd zone state if possible, and remove the journal */
 void xfrd_write_state(struct xfrd_state* xfrd);
+/* append the state of the changed zones to the journal, if it has grown
+ * too large the state file is written and the journal starts over */
+void xfrd_write_state_journal(struct xfrd_state* xfrd);
 
 /* create temp directory */
 void xfrd_make_tempdir(struct nsd* nsd);
@@ -16,6 +16,8 @@
 #include "xfrd.h"
 #include "xfrd-tcp.h"
 #include "packet.h"
+#include "nsd.h"
+#include "options.h"
 
 #define XFRD_NOTIFY_RETRY_TIMOUT 3 /* seconds between retries sending NOTIFY */
 
@@ -29,6 +31,8 @@ static void setup_notify_active(struct notify_zone* zone);
 static void xfrd_handle_notify_send(int fd, short event, void* arg);
 
 static int xfrd_notify_send_udp(struct notify_zone* zone, int index);
+/* the notify packets no longer wait on the shared udp sockets */
+static void notify_pkts_unshare(struct notify_zone* zone);
 
 static void
 notify_send_disable(struct notify_zone* zone)
@@ -56,6 +60,7 @@ void
 notify_disable(struct notify_zone* zone)
 {
 	zone->notify_current = 0;
+	notify_pkts_unshare(zone);
 	/* if added, then remove */
 	if(zone->notify_send_enable) {
 		notify_send_disable(zone);
@@ -147,6 +152,8 @@ xfrd_del_notify(xfrd_state_type* xfrd, const dname_type* dname)
 
 	/* free it */
 	region_recycle(xfrd->region, not->current_soa, sizeof(xfrd_soa_type));
+	if(not->mem)
+		region_recycle(xfrd->region, not->mem, sizeof(*not->mem));
 	/* the apex is recycled when the zone_options.node.key is removed */
 	region_recycle(xfrd->region, not, sizeof(*not));
 }
@@ -221,9 +228,21 @@ cmp_addr_equal(struct sockaddr* a, socklen_t a_len, struct acl_options* dest)
 	return 0;
 }
 
+static void
+notify_pkts_unshare(struct notify_zone* zone)
+{
+	int i;
+	for(i=0; i<NOTIFY_CONCURRENT_MAX; i++) {
+		if(zone->pkts[i].shared)
+			xfrd_udp_shared_remove_notify(&zone->pkts[i]);
+	}
+}
+
 static void
 notify_pkt_done(struct notify_zone* zone, int index)
 {
+	if(zone->pkts[index].shared)
+		xfrd_udp_shared_remove_notify(&zone->pkts[index]);
 	zone->pkts[index].dest = NULL;
 	zone->pkts[index].notify_retry = 0;
 	zone->pkts[index].send_time = 0;
@@ -276,10 +295,16 @@ xfrd_notify_send_udp(struct notify_zone* zone, int index)
 {
 	int apex_compress = 0;
 	buffer_type* packet = xfrd_get_temp_buffer();
+	struct xfrd_udp_shared* s = NULL;
 	if(!zone->pkts[index].dest) return 0;
+	if(zone->pkts[index].shared)
+		xfrd_udp_shared_remove_notify(&zone->pkts[index]);
+	if(xfrd->nsd->options->xfrd_udp_sockets > 0)
+		s = xfrd_udp_shared_get(zone->pkts[index].dest,
+			zone->options->pattern->outgoing_interface);
 	/* send NOTIFY to secondary. */
 	xfrd_setup_packet(packet, TYPE_SOA, CLASS_IN, zone->apex,
-		qid_generate(), &apex_compress);
+		(s?xfrd_udp_shared_qid(s):qid_generate()), &apex_compress);
 	zone->pkts[index].notify_query_id = ID(packet);
 	OPCODE_SET(packet, OPCODE_NOTIFY);
 	AA_SET(packet);
@@ -294,7 +319,12 @@ xfrd_notify_send_udp(struct notify_zone* zone, int index)
 	}
 	buffer_flip(packet);
 
-	if((zone->pkts[index].dest->is_ipv6
+	if(s) {
+		/* queued on the shared socket, sent with the other queries */
+		zone->pkts[index].zone = zone;
+		xfrd_udp_shared_add_notify(s, &zone->pkts[index]);
+		xfrd_udp_shared_send(s, zone->pkts[index].dest, packet);
+	} else if((zone->pkts[index].dest->is_ipv6
 		&& zone->notify_send6_handler.ev_fd == -1) ||
 		(!zone->pkts[index].dest->is_ipv6
 		&& zone->notify_send_handler.ev_fd == -1)) {
@@ -410,6 +440,23 @@ notify_setup_event(struct notify_zone* zone)
 			log_msg(LOG_ERR, "notify_send: event_add failed");
 		zone->notify_send6_enable = 1;
 	}
+	if(zone->notify_send_handler.ev_fd == -1 &&
+		zone->notify_send6_handler.ev_fd == -1) {
+		/* the packets are on shared sockets, wait for the timeout */
+		if(zone->notify_send_enable) {
+			event_del(&zone->notify_send_handler);
+		}
+		zone->notify_timeout.tv_sec = XFRD_NOTIFY_RETRY_TIMOUT;
+		memset(&zone->notify_send_handler, 0,
+			sizeof(zone->notify_send_handler));
+		event_set(&zone->notify_send_handler, -1, EV_TIMEOUT,
+			xfrd_handle_notify_send, zone);
+		if(event_base_set(xfrd->event_base, &zone->notify_send_handler) != 0)
+			log_msg(LOG_ERR, "notify_send: event_base_set failed");
+		if(evtimer_add(&zone->notify_send_handler, &zone->notify_timeout) != 0)
+			log_msg(LOG_ERR, "notify_send: evtimer_add failed");
+		zone->notify_send_enable = 1;
+	}
 }
 
 static void
@@ -460,9 +507,30 @@ xfrd_handle_notify_send(int fd, short event, void* arg)
 	notify_setup_event(zone);
 }
 
+void
+xfrd_notify_shared_reply(struct notify_zone* zone, int index,
+	buffer_type* packet)
+{
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+		"xfrd: zone %s: read notify ACK", zone->apex_str));
+	if(reply_pkt_is_ack(zone, packet, index))
+		notify_pkt_done(zone, index);
+	else	notify_pkt_retry(zone, index);
+
+	/* start new packets in the empty space, the timeout stays */
+	notify_start_pkts(zone);
+	if(!zone->notify_current && !zone->notify_pkt_count) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+			"xfrd: zone %s: no more notify-send acls. stop notify.",
+			zone->apex_str));
+		notify_disable(zone);
+	}
+}
+
 static void
 setup_notify_active(struct notify_zone* zone)
 {
+	notify_pkts_unshare(zone);
 	zone->notify_pkt_count = 0;
 	memset(zone->pkts, 0, sizeof(zone->pkts));
 	zone->notify_current = zone->options->pattern->notify;
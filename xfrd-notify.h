@@ -32,6 +32,7 @@ struct zone;
 struct xfrd_soa;
 struct acl_options;
 struct xfrd_state;
+struct xfrd_udp_shared;
 
 /** number of concurrent notify packets in flight */
 #define NOTIFY_CONCURRENT_MAX 16 
@@ -42,6 +43,12 @@ struct notify_pkt {
 	uint8_t notify_retry; /* how manieth retry in sending to current */
 	uint16_t notify_query_id;
 	time_t send_time;
+	/* the zone of the packet */
+	struct notify_zone* zone;
+	/* shared udp socket that the answer is waited for on, or NULL,
+	 * next packet in the query ID hash list of that socket */
+	struct xfrd_udp_shared* shared;
+	struct notify_pkt* shared_next;
 };
 
 /**
@@ -56,6 +63,7 @@ struct notify_zone {
 	tsig_record_type notify_tsig; /* tsig state for notify */
 	struct zone_options* options;
 	struct xfrd_soa *current_soa; /* current SOA in NSD */
+	struct zone_mem_usage *mem; /* memory use in NSD, or NULL */
 
 	/* notify sending handler */
 	/* Not saved on disk (i.e. kill of daemon stops notifies) */
@@ -93,6 +101,10 @@ void xfrd_notify_start(struct notify_zone* zone, struct xfrd_state* xfrd);
 void notify_handle_master_zone_soainfo(rbtree_type* tree,
 	const dname_type* apex, struct xfrd_soa* new_soa);
 
+/* handle the answer to notify packet index, from its shared udp socket */
+void xfrd_notify_shared_reply(struct notify_zone* zone, int index,
+	buffer_type* packet);
+
 /* close fds in use for notification sending */
 void close_notify_fds(rbtree_type* tree);
 /* stop send of notify */
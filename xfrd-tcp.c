@@ -31,6 +31,7 @@
 
 #ifdef HAVE_TLS_1_3
 void log_crypto_err(const char* str); /* in server.c */
+static int xfrd_tls_new_session(SSL* ssl, SSL_SESSION* session);
 
 static SSL_CTX*
 create_ssl_context()
@@ -58,6 +59,11 @@ create_ssl_context()
 		log_msg(LOG_ERR, "xfrd tls: Unable to set ALPN protocols");
 		return NULL;
 	}
+	/* the sessions (TLS 1.3 tickets) are kept per primary by xfrd,
+	 * and given to the next connection to that primary to resume */
+	(void)SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+		| SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, xfrd_tls_new_session);
 	return ctx;
 }
 
@@ -77,9 +83,82 @@ tls_verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 	return preverify_ok;
 }
 
+/* sort the TLS sessions on address, auth domain name and client cert */
+static int
+xfrd_tls_session_cmp(const void* a, const void* b)
+{
+	const struct xfrd_tls_session* x = (const struct xfrd_tls_session*)a;
+	const struct xfrd_tls_session* y = (const struct xfrd_tls_session*)b;
+	int r;
+	if(x->ip_len != y->ip_len)
+		return (x->ip_len < y->ip_len) ? -1 : 1;
+	if((r = memcmp(&x->ip, &y->ip, x->ip_len)) != 0)
+		return r;
+	if((r = strcmp(x->auth_domain_name, y->auth_domain_name)) != 0)
+		return r;
+	return strcmp(x->client_cert, y->client_cert);
+}
+
+/* find the session entry for the primary, or create an empty one */
+static struct xfrd_tls_session*
+xfrd_tls_session_get(struct xfrd_tcp_set* tcp_set,
+	struct xfrd_tcp_pipeline* tp, const char* auth_domain_name,
+	const char* client_cert)
+{
+	struct xfrd_tls_session key, *s;
+	memset(&key, 0, sizeof(key));
+	memcpy(&key.ip, &tp->key.ip, tp->key.ip_len);
+	key.ip_len = tp->key.ip_len;
+	key.auth_domain_name = (char*)auth_domain_name;
+	key.client_cert = (char*)(client_cert?client_cert:"");
+	key.node.key = &key;
+	s = (struct xfrd_tls_session*)rbtree_search(tcp_set->tls_sessions,
+		&key);
+	if(s)
+		return s;
+	s = (struct xfrd_tls_session*)region_alloc_zero(xfrd->region,
+		sizeof(*s));
+	memcpy(&s->ip, &key.ip, key.ip_len);
+	s->ip_len = key.ip_len;
+	s->auth_domain_name = region_strdup(xfrd->region, auth_domain_name);
+	s->client_cert = region_strdup(xfrd->region, key.client_cert);
+	s->node.key = s;
+	(void)rbtree_insert(tcp_set->tls_sessions, &s->node);
+	return s;
+}
+
+/* the primary has sent a new session, keep it for the next connection,
+ * in TLS 1.3 that is after the handshake, as a ticket */
+static int
+xfrd_tls_new_session(SSL* ssl, SSL_SESSION* session)
+{
+	struct xfrd_tcp_pipeline* tp = (struct xfrd_tcp_pipeline*)
+		SSL_get_app_data(ssl);
+	if(!tp || !tp->tls_session)
+		return 0;
+	if(tp->tls_session->session)
+		SSL_SESSION_free(tp->tls_session->session);
+	tp->tls_session->session = session;
+	/* the reference is kept */
+	return 1;
+}
+
+void
+xfrd_tcp_tls_sessions_free(struct xfrd_tcp_set* set)
+{
+	struct xfrd_tls_session* s;
+	if(!set->tls_sessions)
+		return;
+	RBTREE_FOR(s, struct xfrd_tls_session*, set->tls_sessions) {
+		if(s->session)
+			SSL_SESSION_free(s->session);
+		s->session = NULL;
+	}
+}
+
 static int
 setup_ssl(struct xfrd_tcp_pipeline* tp, struct xfrd_tcp_set* tcp_set, 
-		  const char* auth_domain_name)
+		  const char* auth_domain_name, const char* client_cert)
 {
 	if (!tcp_set->ssl_ctx) {
 		log_msg(LOG_ERR, "xfrd tls: No TLS CTX, cannot set up XFR-over-TLS");
@@ -109,6 +188,15 @@ setup_ssl(struct xfrd_tcp_pipeline* tp, struct xfrd_tcp_set* tcp_set,
 		tp->ssl = NULL;
 		return 0;
 	}
+	SSL_set_app_data(tp->ssl, tp);
+	tp->tls_session = xfrd_tls_session_get(tcp_set, tp, auth_domain_name,
+		client_cert);
+	if(tp->tls_session->session && !SSL_set_session(tp->ssl,
+		tp->tls_session->session)) {
+		/* do a full handshake */
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd tls: could not set "
+			"session to resume for %s", auth_domain_name));
+	}
 	return 1;
 }
 
@@ -120,8 +208,13 @@ ssl_handshake(struct xfrd_tcp_pipeline* tp)
 	ERR_clear_error();
 	ret = SSL_do_handshake(tp->ssl);
 	if(ret == 1) {
-		DEBUG(DEBUG_XFRD, 1, (LOG_INFO, "xfrd: TLS handshake successful"));
+		DEBUG(DEBUG_XFRD, 1, (LOG_INFO, "xfrd: TLS handshake successful%s",
+			SSL_session_reused(tp->ssl)?", session resumed":""));
 		tp->handshake_done = 1;
+		if(SSL_session_reused(tp->ssl))
+			xfrd->tcp_set->tls_resumed++;
+		else
+			xfrd->tcp_set->tls_full++;
 		return 1;
 	}
 	tp->handshake_want = SSL_get_error(tp->ssl, ret);
@@ -129,6 +222,11 @@ ssl_handshake(struct xfrd_tcp_pipeline* tp)
 	|| tp->handshake_want == SSL_ERROR_WANT_WRITE)
 		return 1;
 
+	/* do not offer the session again, that may be why it failed */
+	if(tp->tls_session && tp->tls_session->session) {
+		SSL_SESSION_free(tp->tls_session->session);
+		tp->tls_session->session = NULL;
+	}
 	return 0;
 }
 
@@ -186,6 +284,7 @@ struct xfrd_tcp_set* xfrd_tcp_set_create(struct region* region, const char *tls_
 		log_msg(LOG_ERR, "xfrd tls: Unable to set the certificate bundle file %s",
 				tls_cert_bundle);
 	}
+	tcp_set->tls_sessions = rbtree_create(region, &xfrd_tls_session_cmp);
 #else
 	(void)tls_cert_bundle;
 	log_msg(LOG_INFO, "xfrd: No TLS 1.3 support - XFR-over-TLS not available");
@@ -545,10 +644,11 @@ pipeline_find(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	struct xfrd_tcp_pipeline_key k, *key=&k;
 	key->node.key = key;
 	key->ip_len = xfrd_acl_sockaddr_to(zone->master, &key->ip);
-	key->num_unused = set->tcp_pipeline;
+	/* larger than any, an idle connection is fully unused */
+	key->num_unused = set->tcp_pipeline + 1;
 	/* lookup existing tcp transfer to the master with highest unused */
 	if(rbtree_find_less_equal(set->pipetree, key, &sme)) {
-		/* exact match, strange, fully unused tcp cannot be open */
+		/* exact match, strange, the key is larger than any */
 		assert(0);
 	} 
 	if(!sme)
@@ -565,19 +665,140 @@ pipeline_find(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	return r;
 }
 
+/* the number of tcp connections to the master of the zone */
+static int
+pipeline_count(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
+{
+	rbnode_type* sme = NULL;
+	struct xfrd_tcp_pipeline_key k, *key=&k;
+	int num = 0;
+	key->node.key = key;
+	key->ip_len = xfrd_acl_sockaddr_to(zone->master, &key->ip);
+	key->num_unused = set->tcp_pipeline + 1;
+	(void)rbtree_find_less_equal(set->pipetree, key, &sme);
+	while(sme && sme != RBTREE_NULL) {
+		struct xfrd_tcp_pipeline* r = (struct xfrd_tcp_pipeline*)sme->key;
+		if(r->key.ip_len != key->ip_len ||
+			memcmp(&r->key.ip, &key->ip, key->ip_len) != 0)
+			break;
+		num++;
+		sme = rbtree_previous(sme);
+	}
+	return num;
+}
+
+/* if the master of the zone has xfrd-tcp-per-primary connections */
+static int
+pipeline_at_max(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
+{
+	return set->tcp_per_primary > 0 &&
+		pipeline_count(set, zone) >= set->tcp_per_primary;
+}
+
 /* remove zone from tcp waiting list */
 static void
-tcp_zone_waiting_list_popfirst(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
+tcp_zone_waiting_list_remove(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 {
 	assert(zone->tcp_waiting);
-	set->tcp_waiting_first = zone->tcp_waiting_next;
+	if(zone->tcp_waiting_prev)
+		zone->tcp_waiting_prev->tcp_waiting_next =
+			zone->tcp_waiting_next;
+	else	set->tcp_waiting_first = zone->tcp_waiting_next;
 	if(zone->tcp_waiting_next)
-		zone->tcp_waiting_next->tcp_waiting_prev = NULL;
-	else	set->tcp_waiting_last = 0;
+		zone->tcp_waiting_next->tcp_waiting_prev =
+			zone->tcp_waiting_prev;
+	else	set->tcp_waiting_last = zone->tcp_waiting_prev;
 	zone->tcp_waiting_next = 0;
+	zone->tcp_waiting_prev = 0;
 	zone->tcp_waiting = 0;
 }
 
+/* put zone in the tcp waiting list, behind the zones with the same or a
+ * higher transfer-priority, and before the lower ones that have not been
+ * passed XFRD_TCP_WAITING_PASSED_MAX times already */
+static void
+tcp_zone_waiting_list_insert(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
+{
+	uint32_t prio = zone->zone_options->pattern->transfer_priority;
+	xfrd_zone_type* prev = set->tcp_waiting_last, *next = NULL, *z;
+	assert(!zone->tcp_waiting);
+	while(prev && prev->zone_options->pattern->transfer_priority < prio &&
+		prev->tcp_waiting_passed < XFRD_TCP_WAITING_PASSED_MAX) {
+		next = prev;
+		prev = prev->tcp_waiting_prev;
+	}
+	for(z = next; z; z = z->tcp_waiting_next)
+		z->tcp_waiting_passed++;
+	zone->tcp_waiting_prev = prev;
+	zone->tcp_waiting_next = next;
+	zone->tcp_waiting_passed = 0;
+	zone->tcp_waiting = 1;
+	if(prev)
+		prev->tcp_waiting_next = zone;
+	else	set->tcp_waiting_first = zone;
+	if(next)
+		next->tcp_waiting_prev = zone;
+	else	set->tcp_waiting_last = zone;
+}
+
+/* the first waiting zone that can open a tcp connection, the zones to a
+ * master with xfrd-tcp-per-primary connections wait for those */
+static xfrd_zone_type*
+tcp_zone_waiting_startable(struct xfrd_tcp_set* set)
+{
+	xfrd_zone_type* zone;
+	if(set->tcp_per_primary <= 0)
+		return set->tcp_waiting_first;
+	for(zone = set->tcp_waiting_first; zone; zone = zone->tcp_waiting_next)
+		if(!pipeline_at_max(set, zone))
+			return zone;
+	return NULL;
+}
+
+/* the first waiting zone to the master of the tcp pipe, that can use a
+ * free ID on it */
+static xfrd_zone_type*
+tcp_zone_waiting_for_pipe(struct xfrd_tcp_set* set,
+	struct xfrd_tcp_pipeline* tp)
+{
+	xfrd_zone_type* zone;
+	for(zone = set->tcp_waiting_first; zone; zone = zone->tcp_waiting_next) {
+#ifdef INET6
+		struct sockaddr_storage to;
+#else
+		struct sockaddr_in to;
+#endif
+		socklen_t to_len = xfrd_acl_sockaddr_to(zone->master, &to);
+		if(to_len == tp->key.ip_len &&
+			memcmp(&to, &tp->key.ip, to_len) == 0)
+			return zone;
+		/* without xfrd-tcp-per-primary, the other zones wait
+		 * for a free connection, in order */
+		if(set->tcp_per_primary <= 0)
+			break;
+	}
+	return NULL;
+}
+
+/* if the tcp pipe has no zones, only skipped IDs can be in use */
+static int
+tcp_pipe_no_zones(struct xfrd_tcp_pipeline* tp)
+{
+	return tp->key.num_skip >= tp->pipe_num - tp->key.num_unused;
+}
+
+/* the index of the tcp pipe in the tcp state array */
+static int
+tcp_pipe_conn(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp)
+{
+	int i;
+	for(i=0; i<set->tcp_max; i++) {
+		if(set->tcp_state[i] == tp)
+			return i;
+	}
+	return -1;
+}
+
 /* remove zone from tcp pipe write-wait list */
 static void
 tcp_pipe_sendlist_remove(struct xfrd_tcp_pipeline* tp, xfrd_zone_type* zone)
@@ -674,11 +895,53 @@ tcp_pipe_reset_timeout(struct xfrd_tcp_pipeline* tp)
 	tp->handler_added = 1;
 }
 
+/* keep the tcp pipe without zones open, for xfrd-tcp-idle seconds */
+static void
+tcp_pipe_set_idle(struct xfrd_tcp_pipeline* tp)
+{
+	int fd = tp->handler.ev_fd;
+	struct timeval tv;
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: tcp pipe idle"));
+	tv.tv_sec = xfrd->tcp_set->tcp_idle;
+	tv.tv_usec = 0;
+	if(tp->handler_added)
+		event_del(&tp->handler);
+	memset(&tp->handler, 0, sizeof(tp->handler));
+	event_set(&tp->handler, fd, EV_PERSIST|EV_TIMEOUT|EV_READ,
+		xfrd_handle_tcp_pipe, tp);
+	if(event_base_set(xfrd->event_base, &tp->handler) != 0)
+		log_msg(LOG_ERR, "xfrd tcp: event_base_set failed");
+	if(event_add(&tp->handler, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd tcp: event_add failed");
+	tp->handler_added = 1;
+}
+
+/* close an idle tcp pipe, so that its slot can be used by a waiting zone */
+static void
+tcp_pipe_close_idle(struct xfrd_tcp_set* set)
+{
+	int i;
+	for(i=0; i<set->tcp_max; i++) {
+		struct xfrd_tcp_pipeline* tp = set->tcp_state[i];
+		if(tp->tcp_r->fd != -1 && tcp_pipe_no_zones(tp)) {
+			xfrd_tcp_pipe_release(set, tp, i);
+			return;
+		}
+	}
+}
+
 /* handle event from fd of tcp pipe */
 void
 xfrd_handle_tcp_pipe(int ATTR_UNUSED(fd), short event, void* arg)
 {
 	struct xfrd_tcp_pipeline* tp = (struct xfrd_tcp_pipeline*)arg;
+	if(tcp_pipe_no_zones(tp)) {
+		/* idle, it timed out or the master closed it */
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: idle tcp pipe closed"));
+		xfrd_tcp_pipe_release(xfrd->tcp_set, tp,
+			tcp_pipe_conn(xfrd->tcp_set, tp));
+		return;
+	}
 	if((event & EV_WRITE)) {
 		tcp_pipe_reset_timeout(tp);
 		if(tp->tcp_send_first) {
@@ -692,7 +955,8 @@ xfrd_handle_tcp_pipe(int ATTR_UNUSED(fd), short event, void* arg)
 		tcp_pipe_reset_timeout(tp);
 		xfrd_tcp_read(tp);
 	}
-	if((event & EV_TIMEOUT) && tp->handler_added) {
+	if((event & EV_TIMEOUT) && tp->handler_added &&
+		!tcp_pipe_no_zones(tp)) {
 		/* tcp connection timed out */
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: event tcp timeout"));
 		xfrd_tcp_pipe_stop(tp);
@@ -738,12 +1002,27 @@ void
 xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 {
 	struct xfrd_tcp_pipeline* tp;
+	int at_max;
 	assert(zone->tcp_conn == -1);
 	assert(zone->tcp_waiting == 0);
 
-	if(set->tcp_count < set->tcp_max) {
+	/* use an idle connection to the master again, and share the
+	 * connections to the master when no more can be opened */
+	tp = pipeline_find(set, zone);
+	at_max = pipeline_at_max(set, zone);
+	if(tp && (tcp_pipe_no_zones(tp) ||
+		set->tcp_count >= set->tcp_max || at_max)) {
+		if(XFRD_ZONE_IN_UDP(zone))
+			xfrd_udp_release(zone);
+		zone->tcp_conn = tcp_pipe_conn(set, tp);
+		xfrd_deactivate_zone(zone);
+		xfrd_unset_timer(zone);
+		pipeline_setup_new_zone(set, tp, zone);
+		return;
+	}
+
+	if(set->tcp_count < set->tcp_max && !at_max) {
 		int i;
-		assert(!set->tcp_waiting_first);
 		set->tcp_count ++;
 		/* find a free tcp_buffer */
 		for(i=0; i<set->tcp_max; i++) {
@@ -761,7 +1040,7 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		zone->tcp_waiting = 0;
 
 		/* stop udp use (if any) */
-		if(zone->zone_handler.ev_fd != -1)
+		if(XFRD_ZONE_IN_UDP(zone))
 			xfrd_udp_release(zone);
 
 		if(!xfrd_tcp_open(set, tp, zone)) {
@@ -780,36 +1059,16 @@ xfrd_tcp_obtain(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		pipeline_setup_new_zone(set, tp, zone);
 		return;
 	}
-	/* check for a pipeline to the same master with unused ID */
-	if((tp = pipeline_find(set, zone))!= NULL) {
-		int i;
-		if(zone->zone_handler.ev_fd != -1)
-			xfrd_udp_release(zone);
-		for(i=0; i<set->tcp_max; i++) {
-			if(set->tcp_state[i] == tp)
-				zone->tcp_conn = i;
-		}
-		xfrd_deactivate_zone(zone);
-		xfrd_unset_timer(zone);
-		pipeline_setup_new_zone(set, tp, zone);
-		return;
-	}
 
-	/* wait, at end of line */
+	/* wait, in line by transfer-priority */
 	DEBUG(DEBUG_XFRD,2, (LOG_INFO, "xfrd: max number of tcp "
 		"connections (%d) reached.", set->tcp_max));
-	zone->tcp_waiting_next = 0;
-	zone->tcp_waiting_prev = set->tcp_waiting_last;
-	zone->tcp_waiting = 1;
-	if(!set->tcp_waiting_last) {
-		set->tcp_waiting_first = zone;
-		set->tcp_waiting_last = zone;
-	} else {
-		set->tcp_waiting_last->tcp_waiting_next = zone;
-		set->tcp_waiting_last = zone;
-	}
+	tcp_zone_waiting_list_insert(set, zone);
 	xfrd_deactivate_zone(zone);
 	xfrd_unset_timer(zone);
+	/* the slot of an idle connection to another master can be used */
+	if(!at_max && set->tcp_count >= set->tcp_max)
+		tcp_pipe_close_idle(set);
 }
 
 int
@@ -937,7 +1196,8 @@ xfrd_tcp_open(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 		*/
 		}
 
-		if (!setup_ssl(tp, set, zone->master->tls_auth_options->auth_domain_name)) {
+		if (!setup_ssl(tp, set, zone->master->tls_auth_options->auth_domain_name,
+			zone->master->tls_auth_options->client_cert)) {
 			log_msg(LOG_ERR, "xfrd: Cannot setup TLS on pipeline for %s to %s",
 					zone->apex_str, zone->master->ip_address_spec);
 			close(fd);
@@ -1604,20 +1864,12 @@ xfrd_tcp_release(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 	/* if pipe was full, but no more, then see if waiting element is
 	 * for the same master, and can fill the unused ID */
 	if(tp->key.num_unused == 1 && set->tcp_waiting_first) {
-#ifdef INET6
-		struct sockaddr_storage to;
-#else
-		struct sockaddr_in to;
-#endif
-		socklen_t to_len = xfrd_acl_sockaddr_to(
-			set->tcp_waiting_first->master, &to);
-		if(to_len == tp->key.ip_len && memcmp(&to, &tp->key.ip, to_len) == 0) {
+		if((zone = tcp_zone_waiting_for_pipe(set, tp)) != NULL) {
 			/* use this connection for the waiting zone */
-			zone = set->tcp_waiting_first;
 			assert(zone->tcp_conn == -1);
 			zone->tcp_conn = conn;
-			tcp_zone_waiting_list_popfirst(set, zone);
-			if(zone->zone_handler.ev_fd != -1)
+			tcp_zone_waiting_list_remove(set, zone);
+			if(XFRD_ZONE_IN_UDP(zone))
 				xfrd_udp_release(zone);
 			xfrd_unset_timer(zone);
 			pipeline_setup_new_zone(set, tp, zone);
@@ -1626,9 +1878,15 @@ xfrd_tcp_release(struct xfrd_tcp_set* set, xfrd_zone_type* zone)
 		/* waiting zone did not go to same server */
 	}
 
-	/* if all unused, or only skipped leftover, close the pipeline */
-	if(tp->key.num_unused >= tp->pipe_num || tp->key.num_skip >= tp->pipe_num - tp->key.num_unused)
-		xfrd_tcp_pipe_release(set, tp, conn);
+	/* if all unused, or only skipped leftover, close the pipeline,
+	 * unless it is kept open for the next zones to the master. The
+	 * skipped IDs are not used again on it. */
+	if(tp->key.num_unused >= tp->pipe_num || tp->key.num_skip >= tp->pipe_num - tp->key.num_unused) {
+		if(set->tcp_idle > 0 && tp->key.num_unused > 0 &&
+			!tcp_zone_waiting_startable(set))
+			tcp_pipe_set_idle(tp);
+		else	xfrd_tcp_pipe_release(set, tp, conn);
+	}
 }
 
 void
@@ -1649,6 +1907,7 @@ xfrd_tcp_pipe_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 		SSL_free(tp->ssl);
 		tp->ssl = NULL;
 	}
+	tp->tls_session = NULL;
 #endif
 
 	/* fd in tcp_r and tcp_w is the same, close once */
@@ -1663,16 +1922,18 @@ xfrd_tcp_pipe_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 	/* a waiting zone can use the free tcp slot (to another server) */
 	/* if that zone fails to set-up or connect, we try to start the next
 	 * waiting zone in the list */
-	while(set->tcp_count == set->tcp_max && set->tcp_waiting_first) {
-		/* pop first waiting process */
-		xfrd_zone_type* zone = set->tcp_waiting_first;
+	while(set->tcp_waiting_first) {
+		/* pop first waiting process that can start */
+		xfrd_zone_type* zone = tcp_zone_waiting_startable(set);
+		if(!zone)
+			break;
 		/* start it */
 		assert(zone->tcp_conn == -1);
 		zone->tcp_conn = conn;
-		tcp_zone_waiting_list_popfirst(set, zone);
+		tcp_zone_waiting_list_remove(set, zone);
 
 		/* stop udp (if any) */
-		if(zone->zone_handler.ev_fd != -1)
+		if(XFRD_ZONE_IN_UDP(zone))
 			xfrd_udp_release(zone);
 		if(!xfrd_tcp_open(set, tp, zone)) {
 			zone->tcp_conn = -1;
@@ -1693,7 +1954,6 @@ xfrd_tcp_pipe_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 		return;
 	}
 	/* no task to start, cleanup */
-	assert(!set->tcp_waiting_first);
 	set->tcp_count --;
 	assert(set->tcp_count >= 0);
 }
@@ -41,16 +41,54 @@ struct xfrd_tcp_set {
 	int tcp_count;
 	/* TCP timeout. */
 	int tcp_timeout;
+	/* max number of tcp connections to one master, or 0 for no limit */
+	int tcp_per_primary;
+	/* seconds that a connection without zones is kept open, for the
+	 * next zones to that master, or 0 to close it */
+	int tcp_idle;
 	/* rbtree with pipelines sorted by master */
 	rbtree_type* pipetree;
 #ifdef HAVE_TLS_1_3
 	/* XoT: SSL context */
 	SSL_CTX* ssl_ctx;
+	/* XoT: rbtree of struct xfrd_tls_session, the last session with
+	 * every primary, to resume it on the next connection */
+	rbtree_type* tls_sessions;
+	/* XoT: number of TLS handshakes that resumed a session, and that
+	 * were full handshakes */
+	uint64_t tls_resumed, tls_full;
 #endif
-	/* double linked list of zones waiting for a TCP connection */
+	/* double linked list of zones waiting for a TCP connection, in order
+	 * of transfer-priority */
 	struct xfrd_zone *tcp_waiting_first, *tcp_waiting_last;
 };
 
+#ifdef HAVE_TLS_1_3
+/*
+ * XoT: the TLS session with a primary. The key is the address, the name
+ * that the certificate is verified for and the client certificate, so
+ * that a session is not resumed with another identity on either side.
+ */
+struct xfrd_tls_session {
+	rbnode_type node;
+#ifdef INET6
+	struct sockaddr_storage ip;
+#else
+	struct sockaddr_in ip;
+#endif /* INET6 */
+	socklen_t ip_len;
+	char* auth_domain_name;
+	/* the client certificate file, or "" for none */
+	char* client_cert;
+	/* the session to resume, or NULL if there is none yet */
+	SSL_SESSION* session;
+};
+#endif
+
+/* a waiting zone is passed by at most this many zones with a higher
+ * transfer-priority, after that the others wait behind it */
+#define XFRD_TCP_WAITING_PASSED_MAX 16
+
 /*
  * Structure to keep track of an open tcp connection
  * The xfrd tcp connection is used to first make a request
@@ -150,6 +188,9 @@ struct xfrd_tcp_pipeline {
 	int  handshake_want;
 	/* XoT: 1 if the SSL handshake has succeeded, 0 otherwise */
 	int  handshake_done;
+	/* XoT: the session entry for the primary, that the new sessions
+	 * from the primary are stored in */
+	struct xfrd_tls_session* tls_session;
 #endif
 
 	/* list of queries that want to send, first to get write event,
@@ -180,6 +221,10 @@ struct xfrd_tcp_pipeline {
 
 /* create set of tcp connections */
 struct xfrd_tcp_set* xfrd_tcp_set_create(struct region* region, const char *tls_cert_bundle, int tcp_max, int tcp_pipeline);
+#ifdef HAVE_TLS_1_3
+/* free the TLS sessions that are kept for resumption, at exit */
+void xfrd_tcp_tls_sessions_free(struct xfrd_tcp_set* set);
+#endif
 
 /* init tcp state */
 struct xfrd_tcp* xfrd_tcp_create(struct region* region, size_t bufsize);
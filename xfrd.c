@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <inttypes.h>
@@ -62,6 +63,9 @@ static void xfrd_clean_pending_tasks(struct nsd* nsd, udb_base* u);
 static void xfrd_init_zones(void);
 /* initial handshake with SOAINFO from main and send expire to main */
 static void xfrd_receive_soa(int socket, int shortsoa);
+/* store the memory use of a zone, sent by reload */
+static void xfrd_process_zone_mem_task(xfrd_state_type* xfrd,
+	struct task_list_d* task);
 
 /* handle incoming notification message. soa can be NULL. true if transfer needed. */
 static int xfrd_handle_incoming_notify(xfrd_zone_type* zone,
@@ -76,6 +80,10 @@ static void xfrd_set_zone_state(xfrd_zone_type* zone,
 static void xfrd_set_timer_retry(xfrd_zone_type* zone);
 /* set timer for refresh timeout (depends on zone_state) */
 static void xfrd_set_timer_refresh(xfrd_zone_type* zone);
+/* remove the timeout of the zone, from the timer wheel or the event */
+static void xfrd_zone_event_del(xfrd_zone_type* zone);
+/* the clock of the timer wheel */
+static time_t xfrd_wheel_now(void);
 
 /* set reload timeout */
 static void xfrd_set_reload_timeout(void);
@@ -83,20 +91,36 @@ static void xfrd_set_reload_timeout(void);
 static void xfrd_handle_reload(int fd, short event, void* arg);
 /* handle child timeout */
 static void xfrd_handle_child_timer(int fd, short event, void* arg);
+/* the expire state of the zone goes to the server with the next reload */
+static void xfrd_expire_pending(xfrd_zone_type* zone);
+/* put the pending expire states in one task */
+static void xfrd_expire_task(struct udb_base* udb, udb_ptr* last);
 
-/* send ixfr request, returns fd of connection to read on */
+/* send ixfr request, returns fd of connection to read on, that is a shared
+ * socket if the zone has udp_shared set */
 static int xfrd_send_ixfr_request_udp(xfrd_zone_type* zone);
 /* obtain udp socket slot */
 static void xfrd_udp_obtain(xfrd_zone_type* zone);
 
 /* read data via udp */
 static void xfrd_udp_read(xfrd_zone_type* zone);
+/* handle the answer, in the packet buffer, to the udp query of the zone */
+static void xfrd_udp_handle_packet(xfrd_zone_type* zone);
+/* send the queries that are queued on the shared udp sockets */
+static void xfrd_udp_shared_flush(void);
+/* close the shared udp sockets */
+static void xfrd_udp_shared_close_all(void);
 
 /* find master by notify number */
 static int find_same_master_notify(xfrd_zone_type* zone, int acl_num_nfy);
 
 /* set the write timer to activate */
 static void xfrd_write_timer_set(void);
+/* set the timer for the state journal */
+static void xfrd_journal_timer_set(void);
+#ifdef HAVE_SSL
+static void xfrd_tls_ticket_timer_set(void);
+#endif
 
 static void xfrd_free_zone_xfr(xfrd_zone_type* zone, xfrd_xfr_type* xfr);
 
@@ -153,12 +177,20 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->udp_waiting_first = NULL;
 	xfrd->udp_waiting_last = NULL;
 	xfrd->udp_use_num = 0;
+	xfrd->udp_shared = NULL;
+	xfrd->udp_shared_buf = NULL;
 	xfrd->got_time = 0;
+	memset(xfrd->wheel, 0, sizeof(xfrd->wheel));
+	xfrd->wheel_pending = NULL;
+	xfrd->wheel_time = xfrd_wheel_now();
+	xfrd->wheel_count = 0;
+	xfrd->wheel_timer_added = 0;
 	xfrd->xfrfilenumber = 0;
 #ifdef USE_ZONE_STATS
 	xfrd->zonestat_safe = nsd->zonestatdesired;
 #endif
 	xfrd->activated_first = NULL;
+	xfrd->expire_pending_first = NULL;
 	xfrd->last_task = region_alloc(xfrd->region, sizeof(*xfrd->last_task));
 	udb_ptr_init(xfrd->last_task, xfrd->nsd->task[xfrd->nsd->mytask]);
 	assert(shortsoa || udb_base_get_userdata(xfrd->nsd->task[xfrd->nsd->mytask])->data == 0);
@@ -172,6 +204,8 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->can_send_reload = !reload_active;
 	xfrd->reload_pid = nsd_pid;
 	xfrd->child_timer_added = 0;
+	xfrd->catalog_producer_timer_added = 0;
+	xfrd->catalog_producer_batch_done = 0;
 
 	xfrd->ipc_send_blocked = 0;
 	memset(&xfrd->ipc_handler, 0, sizeof(xfrd->ipc_handler));
@@ -205,6 +239,10 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	xfrd->write_zonefile_needed = 0;
 	if(nsd->options->zonefiles_write)
 		xfrd_write_timer_set();
+#ifdef HAVE_SSL
+	if(nsd->tls_ticket_keys)
+		xfrd_tls_ticket_timer_set();
+#endif
 
 	xfrd->notify_waiting_first = NULL;
 	xfrd->notify_waiting_last = NULL;
@@ -214,6 +252,8 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 
 	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region, nsd->options->tls_cert_bundle, nsd->options->xfrd_tcp_max, nsd->options->xfrd_tcp_pipeline);
 	xfrd->tcp_set->tcp_timeout = nsd->tcp_timeout;
+	xfrd->tcp_set->tcp_per_primary = nsd->options->xfrd_tcp_per_primary;
+	xfrd->tcp_set->tcp_idle = nsd->options->xfrd_tcp_idle;
 #if !defined(HAVE_ARC4RANDOM) && !defined(HAVE_GETRANDOM)
 	srandom((unsigned long) getpid() * (unsigned long) time(NULL));
 #endif
@@ -221,8 +261,11 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd pre-startup"));
 	xfrd_init_zones();
 	xfrd_receive_soa(socket, shortsoa);
-	if(nsd->options->xfrdfile != NULL && nsd->options->xfrdfile[0]!=0)
+	if(nsd->options->xfrdfile != NULL && nsd->options->xfrdfile[0]!=0) {
 		xfrd_read_state(xfrd);
+		if(nsd->options->xfrd_state_journal)
+			xfrd_journal_timer_set();
+	}
 	
 	/* did we get killed before startup was successful? */
 	if(nsd->signal_hint_shutdown) {
@@ -336,6 +379,8 @@ xfrd_main(void)
 		xfrd_process_catalog_consumer_zones();
 		/* process activated zones before blocking in select again */
 		xfrd_process_activated();
+		/* send the udp queries of the activated zones */
+		xfrd_udp_shared_flush();
 		/* dispatch may block for a longer period, so current is gone */
 		xfrd->got_time = 0;
 		if(event_base_loop(xfrd->event_base, EVLOOP_ONCE) == -1) {
@@ -372,15 +417,33 @@ xfrd_shutdown()
 		event_del(&xfrd->child_timer);
 		xfrd->child_timer_added = 0;
 	}
+	if(xfrd->catalog_producer_timer_added) {
+		event_del(&xfrd->catalog_producer_timer);
+		xfrd->catalog_producer_timer_added = 0;
+	}
 	if(xfrd->nsd->options->zonefiles_write) {
 		event_del(&xfrd->write_timer);
 	}
+	if(xfrd->nsd->options->xfrdfile != NULL &&
+		xfrd->nsd->options->xfrdfile[0]!=0 &&
+		xfrd->nsd->options->xfrd_state_journal) {
+		event_del(&xfrd->journal_timer);
+	}
+#ifdef HAVE_SSL
+	if(xfrd->nsd->tls_ticket_keys) {
+		event_del(&xfrd->tls_ticket_timer);
+	}
+#endif
 	daemon_remote_close(xfrd->nsd->rc); /* close sockets of rc */
 	/* close sockets */
+	if(xfrd->wheel_timer_added) {
+		event_del(&xfrd->wheel_timer);
+		xfrd->wheel_timer_added = 0;
+	}
 	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones)
 	{
 		if(zone->event_added) {
-			event_del(&zone->zone_handler);
+			xfrd_zone_event_del(zone);
 			if(zone->zone_handler.ev_fd != -1) {
 				close(zone->zone_handler.ev_fd);
 				zone->zone_handler.ev_fd = -1;
@@ -388,6 +451,7 @@ xfrd_shutdown()
 			zone->event_added = 0;
 		}
 	}
+	xfrd_udp_shared_close_all();
 	close_notify_fds(xfrd->notify_zones);
 
 	/* wait for server parent (if necessary) */
@@ -427,6 +491,7 @@ xfrd_shutdown()
 	if (xfrd->nsd->tls_ctx)
 		SSL_CTX_free(xfrd->nsd->tls_ctx);
 #  ifdef HAVE_TLS_1_3
+	xfrd_tcp_tls_sessions_free(xfrd->tcp_set);
 	if (xfrd->tcp_set->ssl_ctx)
 		SSL_CTX_free(xfrd->tcp_set->ssl_ctx);
 #  endif
@@ -517,6 +582,8 @@ xfrd_init_slave_zone(xfrd_state_type* xfrd, struct zone_options* zone_opt)
 	xzone->soa_nsd_acquired = 0;
 	xzone->soa_disk_acquired = 0;
 	xzone->latest_xfr = NULL;
+	xzone->xfr_zones_next = NULL;
+	xzone->xfr_zones_prev = NULL;
 	xzone->soa_notified_acquired = 0;
 	/* [0]=1, [1]=0; "." domain name */
 	xzone->soa_nsd.prim_ns[0] = 1;
@@ -529,10 +596,17 @@ xfrd_init_slave_zone(xfrd_state_type* xfrd, struct zone_options* zone_opt)
 	xzone->zone_handler.ev_fd = -1;
 	xzone->zone_handler_flags = 0;
 	xzone->event_added = 0;
+	xzone->state_dirty = 0;
+	xzone->in_wheel = 0;
 
 	xzone->tcp_conn = -1;
 	xzone->tcp_waiting = 0;
+	xzone->tcp_waiting_passed = 0;
+	xzone->expire_pending = 0;
+	xzone->expire_pending_next = NULL;
 	xzone->udp_waiting = 0;
+	xzone->udp_shared = NULL;
+	xzone->udp_shared_next = NULL;
 	xzone->is_activated = 0;
 
 	xzone->multi_master_first_master = -1;
@@ -565,6 +639,7 @@ xfrd_init_zones()
 		(int (*)(const void *, const void *)) dname_compare);
 	xfrd->notify_zones = rbtree_create(xfrd->region,
 		(int (*)(const void *, const void *)) dname_compare);
+	xfrd->xfr_zones = NULL;
 	xfrd->catalog_consumer_zones = rbtree_create(xfrd->region,
 		(int (*)(const void *, const void *)) dname_compare);
 	xfrd->catalog_producer_zones = rbtree_create(xfrd->region,
@@ -646,13 +721,18 @@ apply_xfr:
 		"\'%s\'", (xfr->msg_is_ixfr ? "I" : "A"), xfr->msg_old_serial,
 		xfr->msg_new_serial, consumer_zone->options->name));
 
+	/* the changed names only tell what changed since the zone was last
+	 * processed, if nothing but transfers changed it since */
+	if(timespec_compare(&consumer_zone->changes_mtime, &dbzone->mtime) != 0)
+		consumer_zone->changes->all = 1;
 	if(!(df = xfrd_open_xfrfile(xfrd->nsd, xfr->xfrfilenumber, "r"))) {
 		make_catalog_consumer_invalid(consumer_zone,
 		       "could not open transfer file %lld: %s",
 		       (long long)xfr->xfrfilenumber, strerror(errno));
 
 	} else if(0 >= apply_ixfr_for_zone(xfrd->nsd, dbzone, df,
-			xfrd->nsd->options, NULL, xfr->xfrfilenumber)) {
+			xfrd->nsd->options, NULL, xfr->xfrfilenumber,
+			consumer_zone->changes)) {
 		make_catalog_consumer_invalid(consumer_zone,
 			"error processing transfer file %lld",
 			(long long)xfr->xfrfilenumber);
@@ -660,6 +740,7 @@ apply_xfr:
 	} else {
 		/* Make valid for reprocessing */
 		make_catalog_consumer_valid(consumer_zone);
+		consumer_zone->changes_mtime = dbzone->mtime;
 		fclose(df);
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "%sXFR %u -> %u to consumer zone \'%s\' "
 			"applied", (xfr->msg_is_ixfr ? "I" : "A"), xfr->msg_old_serial,
@@ -902,10 +983,10 @@ xfrd_receive_soa(int socket, int shortsoa)
 		/* put all expired zones into mytask */
 		udb_ptr_init(&last_task, xtask);
 		RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones) {
-			if(zone->state == xfrd_zone_expired) {
-				task_new_expire(xtask, &last_task, zone->apex, 1);
-			}
+			if(zone->state == xfrd_zone_expired)
+				xfrd_expire_pending(zone);
 		}
+		xfrd_expire_task(xtask, &last_task);
 		udb_ptr_unlink(&last_task, xtask);
 	
 		/* send RELOAD to main to give it this tasklist */
@@ -939,7 +1020,9 @@ xfrd_receive_soa(int socket, int shortsoa)
 	task_remap(xtask);
 	udb_ptr_new(&t, xtask, udb_base_get_userdata(xtask));
 	while(!udb_ptr_is_null(&t)) {
-		xfrd_process_soa_info_task(TASKLIST(&t));
+		if(TASKLIST(&t)->task_type == task_zone_mem)
+			xfrd_process_zone_mem_task(xfrd, TASKLIST(&t));
+		else	xfrd_process_soa_info_task(TASKLIST(&t));
 	 	udb_ptr_set_rptr(&t, xtask, &TASKLIST(&t)->next);
 	}
 	udb_ptr_unlink(&t, xtask);
@@ -1009,6 +1092,14 @@ xfrd_del_slave_zone(xfrd_state_type* xfrd, const dname_type* dname)
 		else xfrd->tcp_set->tcp_waiting_last = z->tcp_waiting_prev;
 		z->tcp_waiting = 0;
 	}
+	if(z->expire_pending) {
+		/* delete from expire pending list */
+		xfrd_zone_type** p = &xfrd->expire_pending_first;
+		while(*p != z)
+			p = &(*p)->expire_pending_next;
+		*p = z->expire_pending_next;
+		z->expire_pending = 0;
+	}
 	if(z->udp_waiting) {
 		/* delete from udp waiting list */
 		if(z->udp_waiting_prev)
@@ -1024,11 +1115,11 @@ xfrd_del_slave_zone(xfrd_state_type* xfrd, const dname_type* dname)
 	xfrd_deactivate_zone(z);
 	if(z->tcp_conn != -1) {
 		xfrd_tcp_release(xfrd->tcp_set, z);
-	} else if(z->zone_handler.ev_fd != -1 && z->event_added) {
+	} else if(XFRD_ZONE_IN_UDP(z) && z->event_added) {
 		xfrd_udp_release(z);
 	}
 	if(z->event_added)
-		event_del(&z->zone_handler);
+		xfrd_zone_event_del(z);
 
 	while(z->latest_xfr) xfrd_delete_zone_xfr(z, z->latest_xfr);
 
@@ -1143,7 +1234,7 @@ xfrd_handle_zone(int ATTR_UNUSED(fd), short event, void* arg)
 
 	/* timeout */
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s timeout", zone->apex_str));
-	if(zone->zone_handler.ev_fd != -1 && zone->event_added &&
+	if(XFRD_ZONE_IN_UDP(zone) && zone->event_added &&
 		(event & EV_TIMEOUT)) {
 		assert(zone->tcp_conn == -1);
 		xfrd_udp_release(zone);
@@ -1181,7 +1272,7 @@ xfrd_handle_zone(int ATTR_UNUSED(fd), short event, void* arg)
 	}
 
 	/* only make a new request if no request is running (UDPorTCP) */
-	if(zone->zone_handler.ev_fd == -1 && zone->tcp_conn == -1) {
+	if(!XFRD_ZONE_IN_UDP(zone) && zone->tcp_conn == -1) {
 		/* make a new request */
 		xfrd_make_request(zone);
 	}
@@ -1295,6 +1386,16 @@ xfrd_make_request(xfrd_zone_type* zone)
 	}
 }
 
+/* the max number of zones that wait for an answer to a udp query */
+static size_t
+xfrd_udp_max(void)
+{
+	if(xfrd->nsd->options->xfrd_udp_sockets > 0)
+		return (size_t)xfrd->nsd->options->xfrd_udp_sockets *
+			XFRD_UDP_SHARED_WAIT;
+	return XFRD_MAX_UDP;
+}
+
 static void
 xfrd_udp_obtain(xfrd_zone_type* zone)
 {
@@ -1303,15 +1404,15 @@ xfrd_udp_obtain(xfrd_zone_type* zone)
 		/* no tcp and udp at the same time */
 		xfrd_tcp_release(xfrd->tcp_set, zone);
 	}
-	if(xfrd->udp_use_num < XFRD_MAX_UDP) {
+	if(xfrd->udp_use_num < xfrd_udp_max()) {
 		int fd;
 		xfrd->udp_use_num++;
 		fd = xfrd_send_ixfr_request_udp(zone);
 		if(fd == -1)
 			xfrd->udp_use_num--;
-		else {
+		else if(!zone->udp_shared) {
 			if(zone->event_added)
-				event_del(&zone->zone_handler);
+				xfrd_zone_event_del(zone);
 			memset(&zone->zone_handler, 0,
 				sizeof(zone->zone_handler));
 			event_set(&zone->zone_handler, fd,
@@ -1396,6 +1497,7 @@ xfrd_set_zone_state(xfrd_zone_type* zone, enum xfrd_zone_state s)
 			&& s!=old) {
 			xfrd_send_expire_notification(zone);
 		}
+		XFRD_STATE_CHANGED(zone);
 	}
 }
 
@@ -1415,14 +1517,177 @@ xfrd_set_refresh_now(xfrd_zone_type* zone)
 	}
 }
 
+/* the clock of the timer wheel, in seconds, it does not jump back when
+ * the system time is set back */
+static time_t
+xfrd_wheel_now(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ts.tv_sec;
+#endif
+	return time(NULL);
+}
+
+/* link the zone in the list of the timer wheel for its due time */
+static void
+xfrd_wheel_link(xfrd_zone_type* zone)
+{
+	time_t delta = zone->wheel_due - xfrd->wheel_time;
+	xfrd_zone_type** head;
+	if(delta < XFRD_WHEEL_SIZE)
+		head = &xfrd->wheel[0][zone->wheel_due & XFRD_WHEEL_MASK];
+	else if(delta < ((time_t)1 << (2*XFRD_WHEEL_BITS)))
+		head = &xfrd->wheel[1][(zone->wheel_due >> XFRD_WHEEL_BITS)
+			& XFRD_WHEEL_MASK];
+	else	head = &xfrd->wheel[2][(zone->wheel_due >>
+			(2*XFRD_WHEEL_BITS)) & XFRD_WHEEL_MASK];
+	zone->wheel_head = head;
+	zone->wheel_prev = NULL;
+	zone->wheel_next = *head;
+	if(*head)
+		(*head)->wheel_prev = zone;
+	*head = zone;
+}
+
+/* remove the zone from the list of the timer wheel it is in */
+static void
+xfrd_wheel_unlink(xfrd_zone_type* zone)
+{
+	if(zone->wheel_prev)
+		zone->wheel_prev->wheel_next = zone->wheel_next;
+	else	*zone->wheel_head = zone->wheel_next;
+	if(zone->wheel_next)
+		zone->wheel_next->wheel_prev = zone->wheel_prev;
+	zone->wheel_next = NULL;
+	zone->wheel_prev = NULL;
+}
+
+/* ticks of the timer wheel */
+static void xfrd_handle_wheel_timer(int fd, short event, void* arg);
+
+static void
+xfrd_wheel_timer_set(void)
+{
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	memset(&xfrd->wheel_timer, 0, sizeof(xfrd->wheel_timer));
+	event_set(&xfrd->wheel_timer, -1, EV_TIMEOUT,
+		xfrd_handle_wheel_timer, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->wheel_timer) != 0)
+		log_msg(LOG_ERR, "xfrd wheel timer: event_base_set failed");
+	if(event_add(&xfrd->wheel_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd wheel timer: event_add failed");
+	xfrd->wheel_timer_added = 1;
+}
+
+/* put the zone in the timer wheel, to time out at the time due */
+static void
+xfrd_wheel_insert(xfrd_zone_type* zone, time_t due)
+{
+	/* the current second is processed, or being processed */
+	if(due <= xfrd->wheel_time)
+		due = xfrd->wheel_time + 1;
+	if(due - xfrd->wheel_time >= ((time_t)1 << (3*XFRD_WHEEL_BITS)))
+		due = xfrd->wheel_time + ((time_t)1 << (3*XFRD_WHEEL_BITS)) - 1;
+	zone->wheel_due = due;
+	xfrd_wheel_link(zone);
+	zone->in_wheel = 1;
+	xfrd->wheel_count++;
+	if(!xfrd->wheel_timer_added)
+		xfrd_wheel_timer_set();
+}
+
+static void
+xfrd_zone_event_del(xfrd_zone_type* zone)
+{
+	if(zone->in_wheel) {
+		xfrd_wheel_unlink(zone);
+		zone->in_wheel = 0;
+		xfrd->wheel_count--;
+	} else if(zone->zone_handler.ev_fd != -1)
+		event_del(&zone->zone_handler);
+}
+
+/* move the zones in the slot of the level to the lower levels */
+static void
+xfrd_wheel_cascade(int level, time_t t)
+{
+	xfrd_zone_type** head = &xfrd->wheel[level][(t >>
+		(level*XFRD_WHEEL_BITS)) & XFRD_WHEEL_MASK];
+	xfrd_zone_type* zone = *head, *next;
+	*head = NULL;
+	while(zone) {
+		next = zone->wheel_next;
+		xfrd_wheel_link(zone);
+		zone = next;
+	}
+}
+
+/*
+ * Time out the zones in the list, at most budget of them. If that is not
+ * all of them, the rest is moved to the pending list and returns 0.
+ */
+static int
+xfrd_wheel_process(xfrd_zone_type** head, int* budget)
+{
+	xfrd_zone_type* zone;
+	while((zone = *head) != NULL) {
+		if(*budget == 0) {
+			if(head != &xfrd->wheel_pending) {
+				xfrd->wheel_pending = zone;
+				*head = NULL;
+				for(; zone; zone = zone->wheel_next)
+					zone->wheel_head = &xfrd->wheel_pending;
+			}
+			return 0;
+		}
+		(*budget)--;
+		xfrd_zone_event_del(zone);
+		xfrd_handle_zone(-1, EV_TIMEOUT, zone);
+	}
+	return 1;
+}
+
+static void
+xfrd_handle_wheel_timer(int ATTR_UNUSED(fd), short event,
+	void* ATTR_UNUSED(arg))
+{
+	int budget = XFRD_WHEEL_TICK_MAX;
+	time_t now = xfrd_wheel_now();
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	xfrd->wheel_timer_added = 0;
+
+	if(xfrd_wheel_process(&xfrd->wheel_pending, &budget)) {
+		while(xfrd->wheel_time < now) {
+			time_t t = ++xfrd->wheel_time;
+			if((t & XFRD_WHEEL_MASK) == 0) {
+				if(((t >> XFRD_WHEEL_BITS) & XFRD_WHEEL_MASK)
+					== 0)
+					xfrd_wheel_cascade(2, t);
+				xfrd_wheel_cascade(1, t);
+			}
+			if(!xfrd_wheel_process(&xfrd->wheel[0][t &
+				XFRD_WHEEL_MASK], &budget))
+				break;
+		}
+	}
+	if(xfrd->wheel_count > 0 && !xfrd->wheel_timer_added)
+		xfrd_wheel_timer_set();
+}
+
 void
 xfrd_unset_timer(xfrd_zone_type* zone)
 {
 	assert(zone->zone_handler.ev_fd == -1);
 	if(zone->event_added)
-		event_del(&zone->zone_handler);
+		xfrd_zone_event_del(zone);
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
+	XFRD_STATE_CHANGED(zone);
 }
 
 void
@@ -1442,7 +1707,7 @@ xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 
 	/* keep existing flags and fd, but re-add with timeout */
 	if(zone->event_added)
-		event_del(&zone->zone_handler);
+		xfrd_zone_event_del(zone);
 	else	fd = -1;
 	zone->timeout.tv_sec = t;
 	zone->timeout.tv_usec = 0;
@@ -1450,10 +1715,14 @@ xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 	event_set(&zone->zone_handler, fd, fl, xfrd_handle_zone, zone);
 	if(event_base_set(xfrd->event_base, &zone->zone_handler) != 0)
 		log_msg(LOG_ERR, "xfrd timer: event_base_set failed");
-	if(event_add(&zone->zone_handler, &zone->timeout) != 0)
+	if(fd == -1) {
+		/* only a timeout, that is kept in the timer wheel */
+		xfrd_wheel_insert(zone, xfrd_wheel_now() + t);
+	} else if(event_add(&zone->zone_handler, &zone->timeout) != 0)
 		log_msg(LOG_ERR, "xfrd timer: event_add failed");
 	zone->zone_handler_flags = fl;
 	zone->event_added = 1;
+	XFRD_STATE_CHANGED(zone);
 }
 
 void
@@ -1461,6 +1730,7 @@ xfrd_handle_incoming_soa(xfrd_zone_type* zone,
 	xfrd_soa_type* soa, time_t acquired)
 {
 	time_t seconds_since_acquired;
+	XFRD_STATE_CHANGED(zone);
 	if(soa == NULL) {
 		/* nsd no longer has a zone in memory */
 		zone->soa_nsd_acquired = 0;
@@ -1576,14 +1846,524 @@ zonefile:
 	xfrd_send_notify(xfrd->notify_zones, zone->apex, &zone->soa_nsd);
 }
 
+static void
+xfrd_expire_pending(xfrd_zone_type* zone)
+{
+	if(zone->expire_pending)
+		return;
+	zone->expire_pending = 1;
+	zone->expire_pending_next = xfrd->expire_pending_first;
+	xfrd->expire_pending_first = zone;
+}
+
+static void
+xfrd_expire_task(struct udb_base* udb, udb_ptr* last)
+{
+	xfrd_zone_type* zone;
+	uint32_t num = 0;
+	size_t len = 0;
+	uint8_t* list, *p;
+	for(zone = xfrd->expire_pending_first; zone;
+		zone = zone->expire_pending_next) {
+		num++;
+		len += 1 + dname_total_size(zone->apex);
+	}
+	if(num == 0)
+		return;
+	/* the state when the task is made, a zone that expired and came
+	 * back since the last reload is sent once, with its current state */
+	p = list = xalloc(len);
+	while((zone = xfrd->expire_pending_first) != NULL) {
+		xfrd->expire_pending_first = zone->expire_pending_next;
+		zone->expire_pending_next = NULL;
+		zone->expire_pending = 0;
+		*p++ = (zone->state == xfrd_zone_expired);
+		memmove(p, zone->apex, dname_total_size(zone->apex));
+		p += dname_total_size(zone->apex);
+	}
+	task_new_expire(udb, last, num, list, len);
+	free(list);
+}
+
 void
 xfrd_send_expire_notification(xfrd_zone_type* zone)
 {
-	task_new_expire(xfrd->nsd->task[xfrd->nsd->mytask], xfrd->last_task,
-		zone->apex, zone->state == xfrd_zone_expired);
+	xfrd_expire_pending(zone);
 	xfrd_set_reload_timeout();
 }
 
+void
+xfrd_flush_expire_notifications(void)
+{
+	xfrd_expire_task(xfrd->nsd->task[xfrd->nsd->mytask], xfrd->last_task);
+}
+
+#define XFRD_UDP_SHARED_HASH 256 /* query ID hash size of a shared socket */
+#define XFRD_UDP_SHARED_BATCH 16 /* queries queued to send at once */
+#define XFRD_UDP_SHARED_RECV 8 /* answers read at once */
+#define XFRD_UDP_SHARED_PKT 1024 /* max size of a queued query */
+#define XFRD_UDP_SHARED_IFC 4096 /* max length of the outgoing interfaces */
+
+/*
+ * A udp socket for the SOA and IXFR queries, and NOTIFY packets, of many
+ * zones, with xfrd-udp-sockets. The answers are matched to the zones by
+ * query ID and source address. The queries are queued and sent at once
+ * before xfrd waits for events again.
+ */
+struct xfrd_udp_shared {
+	struct xfrd_udp_shared* next;
+	int fd;
+	struct event event;
+	/* address family, and the outgoing interfaces it is bound to, as
+	 * the list of addresses */
+	int is_ipv6;
+	char* ifc;
+	/* number of zones and notifies that wait for an answer on it */
+	int waiting;
+	/* number of queries sent, at XFRD_UDP_SHARED_USES no more queries
+	 * are sent and it is closed when the last answer is in */
+	uint32_t sent;
+	/* answers are being handled, it is closed after that */
+	int busy;
+	/* the zones that wait for an answer, by query ID */
+	xfrd_zone_type* ids[XFRD_UDP_SHARED_HASH];
+	/* the notifies that wait for an answer, by query ID */
+	struct notify_pkt* notify_ids[XFRD_UDP_SHARED_HASH];
+	/* the queued queries */
+	int send_num;
+	struct xfrd_udp_shared_query {
+#ifdef INET6
+		struct sockaddr_storage to;
+#else
+		struct sockaddr_in to;
+#endif /* INET6 */
+		socklen_t to_len;
+		size_t len;
+		uint8_t data[XFRD_UDP_SHARED_PKT];
+	} send[XFRD_UDP_SHARED_BATCH];
+};
+
+/* the outgoing interfaces, of the address family, as a string */
+static void
+xfrd_udp_shared_ifc(struct acl_options* ifc, int is_ipv6, char* buf,
+	size_t len)
+{
+	buf[0] = 0;
+	for(; ifc; ifc = ifc->next) {
+		if(ifc->is_ipv6 != is_ipv6)
+			continue;
+		strlcat(buf, ifc->ip_address_spec, len);
+		strlcat(buf, " ", len);
+	}
+}
+
+/* send the queries that are queued on the shared socket */
+static void
+xfrd_udp_shared_send_queued(struct xfrd_udp_shared* s)
+{
+	int i;
+#if defined(HAVE_SENDMMSG) && defined(HAVE_MMSGHDR)
+	struct mmsghdr msg[XFRD_UDP_SHARED_BATCH];
+	struct iovec iov[XFRD_UDP_SHARED_BATCH];
+	int r;
+
+	memset(msg, 0, sizeof(msg));
+	for(i=0; i<s->send_num; i++) {
+		iov[i].iov_base = s->send[i].data;
+		iov[i].iov_len = s->send[i].len;
+		msg[i].msg_hdr.msg_name = &s->send[i].to;
+		msg[i].msg_hdr.msg_namelen = s->send[i].to_len;
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	i = 0;
+	while(i < s->send_num) {
+		r = sendmmsg(s->fd, msg+i, (unsigned)(s->send_num-i), 0);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			log_msg(LOG_ERR, "xfrd: sendmmsg failed: %s",
+				strerror(errno));
+			/* skip the query, the zone times out */
+			r = 1;
+		}
+		i += r;
+	}
+#else
+	for(i=0; i<s->send_num; i++) {
+		if(sendto(s->fd, s->send[i].data, s->send[i].len, 0,
+			(struct sockaddr*)&s->send[i].to,
+			s->send[i].to_len) == -1)
+			log_msg(LOG_ERR, "xfrd: sendto failed: %s",
+				strerror(errno));
+	}
+#endif /* HAVE_SENDMMSG && HAVE_MMSGHDR */
+	s->send_num = 0;
+}
+
+static void
+xfrd_udp_shared_flush(void)
+{
+	struct xfrd_udp_shared* s;
+	for(s = xfrd->udp_shared; s; s = s->next) {
+		if(s->send_num > 0)
+			xfrd_udp_shared_send_queued(s);
+	}
+}
+
+static void
+xfrd_udp_shared_close(struct xfrd_udp_shared* s)
+{
+	struct xfrd_udp_shared** p;
+	if(s->send_num > 0)
+		xfrd_udp_shared_send_queued(s);
+	for(p = &xfrd->udp_shared; *p; p = &(*p)->next) {
+		if(*p == s) {
+			*p = s->next;
+			break;
+		}
+	}
+	event_del(&s->event);
+	close(s->fd);
+	free(s->ifc);
+	free(s);
+}
+
+static void
+xfrd_udp_shared_close_all(void)
+{
+	while(xfrd->udp_shared)
+		xfrd_udp_shared_close(xfrd->udp_shared);
+}
+
+/* if the address is that of the master, with its port */
+static int
+xfrd_udp_shared_from(struct acl_options* acl, struct sockaddr* from,
+	socklen_t fromlen)
+{
+#ifdef INET6
+	struct sockaddr_storage to;
+#else
+	struct sockaddr_in to;
+#endif /* INET6 */
+	(void)xfrd_acl_sockaddr_to(acl, &to);
+	if(from->sa_family != ((struct sockaddr*)&to)->sa_family)
+		return 0;
+	if(from->sa_family == AF_INET) {
+		struct sockaddr_in* a = (struct sockaddr_in*)from;
+		struct sockaddr_in* b = (struct sockaddr_in*)&to;
+		return fromlen >= (socklen_t)sizeof(*a) &&
+			a->sin_port == b->sin_port &&
+			memcmp(&a->sin_addr, &b->sin_addr,
+			sizeof(a->sin_addr)) == 0;
+	}
+#ifdef INET6
+	if(from->sa_family == AF_INET6) {
+		struct sockaddr_in6* a = (struct sockaddr_in6*)from;
+		struct sockaddr_in6* b = (struct sockaddr_in6*)&to;
+		return fromlen >= (socklen_t)sizeof(*a) &&
+			a->sin6_port == b->sin6_port &&
+			memcmp(&a->sin6_addr, &b->sin6_addr,
+			sizeof(a->sin6_addr)) == 0;
+	}
+#endif /* INET6 */
+	return 0;
+}
+
+/* handle the answer in the packet buffer, for the zone that waits for it */
+static void
+xfrd_udp_shared_answer(struct xfrd_udp_shared* s, struct sockaddr* from,
+	socklen_t fromlen)
+{
+	xfrd_zone_type* zone;
+	struct notify_pkt* pkt;
+	uint16_t id;
+	if(buffer_limit(xfrd->packet) < QHEADERSZ)
+		return;
+	id = ID(xfrd->packet);
+	if(OPCODE(xfrd->packet) == OPCODE_NOTIFY) {
+		for(pkt = s->notify_ids[id % XFRD_UDP_SHARED_HASH]; pkt;
+			pkt = pkt->shared_next) {
+			if(pkt->notify_query_id == id &&
+				xfrd_udp_shared_from(pkt->dest, from, fromlen))
+				break;
+		}
+		if(pkt) {
+			xfrd_notify_shared_reply(pkt->zone,
+				(int)(pkt - pkt->zone->pkts), xfrd->packet);
+			return;
+		}
+	}
+	for(zone = s->ids[id % XFRD_UDP_SHARED_HASH]; zone;
+		zone = zone->udp_shared_next) {
+		if(zone->query_id == id &&
+			xfrd_udp_shared_from(zone->master, from, fromlen))
+			break;
+	}
+	if(!zone) {
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: dropped udp answer "
+			"with unknown ID %d", (int)id));
+		return;
+	}
+	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s read udp data",
+		zone->apex_str));
+	xfrd_udp_handle_packet(zone);
+}
+
+static void
+xfrd_handle_udp_shared(int fd, short event, void* arg)
+{
+	struct xfrd_udp_shared* s = (struct xfrd_udp_shared*)arg;
+#ifdef INET6
+	struct sockaddr_storage from[XFRD_UDP_SHARED_RECV];
+#else
+	struct sockaddr_in from[XFRD_UDP_SHARED_RECV];
+#endif /* INET6 */
+	int i;
+#if defined(HAVE_RECVMMSG) && defined(HAVE_MMSGHDR)
+	struct mmsghdr msg[XFRD_UDP_SHARED_RECV];
+	struct iovec iov[XFRD_UDP_SHARED_RECV];
+	int n;
+#endif
+
+	if(!(event & EV_READ))
+		return;
+	s->busy = 1;
+#if defined(HAVE_RECVMMSG) && defined(HAVE_MMSGHDR)
+	memset(msg, 0, sizeof(msg));
+	for(i=0; i<XFRD_UDP_SHARED_RECV; i++) {
+		iov[i].iov_base = xfrd->udp_shared_buf + i*MAX_PACKET_SIZE;
+		iov[i].iov_len = MAX_PACKET_SIZE;
+		msg[i].msg_hdr.msg_name = &from[i];
+		msg[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	n = recvmmsg(fd, msg, XFRD_UDP_SHARED_RECV, 0, NULL);
+	if(n == -1 && errno != EAGAIN && errno != EINTR)
+		log_msg(LOG_ERR, "xfrd: recvmmsg failed: %s", strerror(errno));
+	for(i=0; i<n; i++) {
+		buffer_clear(xfrd->packet);
+		buffer_write(xfrd->packet, iov[i].iov_base, msg[i].msg_len);
+		buffer_flip(xfrd->packet);
+		xfrd_udp_shared_answer(s, (struct sockaddr*)&from[i],
+			msg[i].msg_hdr.msg_namelen);
+	}
+#else
+	for(i=0; i<XFRD_UDP_SHARED_RECV; i++) {
+		socklen_t fromlen = (socklen_t)sizeof(from[0]);
+		ssize_t received;
+		buffer_clear(xfrd->packet);
+		received = recvfrom(fd, buffer_begin(xfrd->packet),
+			buffer_remaining(xfrd->packet), 0,
+			(struct sockaddr*)&from[0], &fromlen);
+		if(received == -1) {
+			if(errno != EAGAIN && errno != EINTR)
+				log_msg(LOG_ERR, "xfrd: recvfrom failed: %s",
+					strerror(errno));
+			break;
+		}
+		buffer_set_limit(xfrd->packet, received);
+		xfrd_udp_shared_answer(s, (struct sockaddr*)&from[0], fromlen);
+	}
+#endif /* HAVE_RECVMMSG && HAVE_MMSGHDR */
+	s->busy = 0;
+	if(s->waiting == 0 && s->sent >= XFRD_UDP_SHARED_USES)
+		xfrd_udp_shared_close(s);
+}
+
+static struct xfrd_udp_shared*
+xfrd_udp_shared_create(struct acl_options* acl, struct acl_options* ifc,
+	const char* ifc_str)
+{
+	struct xfrd_udp_shared* s;
+	int fd, family;
+
+	if(acl->is_ipv6) {
+#ifdef INET6
+		family = PF_INET6;
+#else
+		return NULL;
+#endif /* INET6 */
+	} else {
+		family = PF_INET;
+	}
+	fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd == -1) {
+		log_msg(LOG_ERR, "xfrd: cannot create udp socket to %s: %s",
+			acl->ip_address_spec, strerror(errno));
+		return NULL;
+	}
+	if(!xfrd_bind_local_interface(fd, ifc, acl, 0)) {
+		log_msg(LOG_ERR, "xfrd: cannot bind outgoing interface '%s' to "
+				 "udp socket: No matching ip addresses found",
+			ifc->ip_address_spec);
+		close(fd);
+		return NULL;
+	}
+	if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		log_msg(LOG_ERR, "xfrd: cannot fcntl udp socket: %s",
+			strerror(errno));
+		close(fd);
+		return NULL;
+	}
+#if defined(HAVE_RECVMMSG) && defined(HAVE_MMSGHDR)
+	if(!xfrd->udp_shared_buf)
+		xfrd->udp_shared_buf = (uint8_t*)region_alloc(xfrd->region,
+			XFRD_UDP_SHARED_RECV*MAX_PACKET_SIZE);
+#endif
+
+	s = (struct xfrd_udp_shared*)xalloc_zero(sizeof(*s));
+	s->fd = fd;
+	s->is_ipv6 = acl->is_ipv6;
+	s->ifc = xstrdup(ifc_str);
+	event_set(&s->event, fd, EV_PERSIST|EV_READ, xfrd_handle_udp_shared,
+		s);
+	if(event_base_set(xfrd->event_base, &s->event) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_base_set failed");
+	if(event_add(&s->event, NULL) != 0)
+		log_msg(LOG_ERR, "xfrd udp: event_add failed");
+	s->next = xfrd->udp_shared;
+	xfrd->udp_shared = s;
+	return s;
+}
+
+struct xfrd_udp_shared*
+xfrd_udp_shared_get(struct acl_options* dest, struct acl_options* ifc)
+{
+	struct xfrd_udp_shared* s, *best = NULL;
+	char ifc_str[XFRD_UDP_SHARED_IFC];
+	int num = 0;
+
+	xfrd_udp_shared_ifc(ifc, dest->is_ipv6, ifc_str, sizeof(ifc_str));
+	for(s = xfrd->udp_shared; s; s = s->next) {
+		if(s->is_ipv6 != dest->is_ipv6 ||
+			s->sent >= XFRD_UDP_SHARED_USES ||
+			strcmp(s->ifc, ifc_str) != 0)
+			continue;
+		num++;
+		if(s->waiting < XFRD_UDP_SHARED_WAIT &&
+			(!best || s->waiting < best->waiting))
+			best = s;
+	}
+	if(num < xfrd->nsd->options->xfrd_udp_sockets &&
+		(!best || best->waiting > 0)) {
+		if((s = xfrd_udp_shared_create(dest, ifc, ifc_str)))
+			return s;
+	}
+	return best;
+}
+
+uint16_t
+xfrd_udp_shared_qid(struct xfrd_udp_shared* s)
+{
+	xfrd_zone_type* zone;
+	struct notify_pkt* pkt;
+	uint16_t id;
+again:
+	id = qid_generate();
+	for(zone = s->ids[id % XFRD_UDP_SHARED_HASH]; zone;
+		zone = zone->udp_shared_next) {
+		if(zone->query_id == id)
+			goto again;
+	}
+	for(pkt = s->notify_ids[id % XFRD_UDP_SHARED_HASH]; pkt;
+		pkt = pkt->shared_next) {
+		if(pkt->notify_query_id == id)
+			goto again;
+	}
+	return id;
+}
+
+/* the zone waits for the answer to its query, on the shared socket */
+static void
+xfrd_udp_shared_add(struct xfrd_udp_shared* s, xfrd_zone_type* zone)
+{
+	xfrd_zone_type** head = &s->ids[zone->query_id % XFRD_UDP_SHARED_HASH];
+	zone->udp_shared = s;
+	zone->udp_shared_next = *head;
+	*head = zone;
+	s->waiting++;
+}
+
+static void
+xfrd_udp_shared_remove(xfrd_zone_type* zone)
+{
+	struct xfrd_udp_shared* s = zone->udp_shared;
+	xfrd_zone_type** p;
+	for(p = &s->ids[zone->query_id % XFRD_UDP_SHARED_HASH]; *p;
+		p = &(*p)->udp_shared_next) {
+		if(*p == zone) {
+			*p = zone->udp_shared_next;
+			break;
+		}
+	}
+	zone->udp_shared = NULL;
+	zone->udp_shared_next = NULL;
+	s->waiting--;
+	if(s->waiting == 0 && s->sent >= XFRD_UDP_SHARED_USES && !s->busy)
+		xfrd_udp_shared_close(s);
+}
+
+void
+xfrd_udp_shared_add_notify(struct xfrd_udp_shared* s, struct notify_pkt* pkt)
+{
+	struct notify_pkt** head =
+		&s->notify_ids[pkt->notify_query_id % XFRD_UDP_SHARED_HASH];
+	pkt->shared = s;
+	pkt->shared_next = *head;
+	*head = pkt;
+	s->waiting++;
+}
+
+void
+xfrd_udp_shared_remove_notify(struct notify_pkt* pkt)
+{
+	struct xfrd_udp_shared* s = pkt->shared;
+	struct notify_pkt** p;
+	for(p = &s->notify_ids[pkt->notify_query_id % XFRD_UDP_SHARED_HASH];
+		*p; p = &(*p)->shared_next) {
+		if(*p == pkt) {
+			*p = pkt->shared_next;
+			break;
+		}
+	}
+	pkt->shared = NULL;
+	pkt->shared_next = NULL;
+	s->waiting--;
+	if(s->waiting == 0 && s->sent >= XFRD_UDP_SHARED_USES && !s->busy)
+		xfrd_udp_shared_close(s);
+}
+
+void
+xfrd_udp_shared_send(struct xfrd_udp_shared* s, struct acl_options* acl,
+	buffer_type* packet)
+{
+	struct xfrd_udp_shared_query* q;
+	s->sent++;
+	if(buffer_remaining(packet) > XFRD_UDP_SHARED_PKT) {
+		/* too large to queue, send it now */
+#ifdef INET6
+		struct sockaddr_storage to;
+#else
+		struct sockaddr_in to;
+#endif /* INET6 */
+		socklen_t to_len = xfrd_acl_sockaddr_to(acl, &to);
+		if(sendto(s->fd, buffer_current(packet),
+			buffer_remaining(packet), 0,
+			(struct sockaddr*)&to, to_len) == -1)
+			log_msg(LOG_ERR, "xfrd: sendto %s failed %s",
+				acl->ip_address_spec, strerror(errno));
+		return;
+	}
+	if(s->send_num == XFRD_UDP_SHARED_BATCH)
+		xfrd_udp_shared_send_queued(s);
+	q = &s->send[s->send_num++];
+	q->to_len = xfrd_acl_sockaddr_to(acl, &q->to);
+	q->len = buffer_remaining(packet);
+	memcpy(q->data, buffer_current(packet), q->len);
+}
+
 int
 xfrd_udp_read_packet(buffer_type* packet, int fd, struct sockaddr* src,
 	socklen_t* srclen)
@@ -1608,15 +2388,17 @@ xfrd_udp_release(xfrd_zone_type* zone)
 {
 	assert(zone->udp_waiting == 0);
 	if(zone->event_added)
-		event_del(&zone->zone_handler);
-	if(zone->zone_handler.ev_fd != -1) {
+		xfrd_zone_event_del(zone);
+	if(zone->udp_shared) {
+		xfrd_udp_shared_remove(zone);
+	} else if(zone->zone_handler.ev_fd != -1) {
 		close(zone->zone_handler.ev_fd);
 	}
 	zone->zone_handler.ev_fd = -1;
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
 	/* see if there are waiting zones */
-	if(xfrd->udp_use_num == XFRD_MAX_UDP)
+	if(xfrd->udp_use_num >= xfrd_udp_max())
 	{
 		while(xfrd->udp_waiting_first) {
 			/* snip off waiting list */
@@ -1631,9 +2413,13 @@ xfrd_udp_release(xfrd_zone_type* zone)
 			/* see if this zone needs udp connection */
 			if(wz->tcp_conn == -1) {
 				int fd = xfrd_send_ixfr_request_udp(wz);
-				if(fd != -1) {
+				if(fd != -1 && wz->udp_shared) {
+					/* the answer is read on the shared
+					 * socket */
+					return;
+				} else if(fd != -1) {
 					if(wz->event_added)
-						event_del(&wz->zone_handler);
+						xfrd_zone_event_del(wz);
 					memset(&wz->zone_handler, 0,
 						sizeof(wz->zone_handler));
 					event_set(&wz->zone_handler, fd,
@@ -1690,6 +2476,12 @@ xfrd_udp_read(xfrd_zone_type* zone)
 		xfrd_make_request(zone);
 		return;
 	}
+	xfrd_udp_handle_packet(zone);
+}
+
+static void
+xfrd_udp_handle_packet(xfrd_zone_type* zone)
+{
 	switch(xfrd_handle_received_xfr_packet(zone, xfrd->packet)) {
 		case xfrd_packet_tcp:
 			xfrd_set_timer(zone, xfrd->tcp_set->tcp_timeout);
@@ -1898,6 +2690,7 @@ static int
 xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 {
 	int fd, apex_compress = 0;
+	struct xfrd_udp_shared* s = NULL;
 
 	/* make sure we have a master to query the ixfr request to */
 	assert(zone->master);
@@ -1908,8 +2701,11 @@ xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 			zone->apex_str);
 		return -1;
 	}
+	if(xfrd->nsd->options->xfrd_udp_sockets > 0)
+		s = xfrd_udp_shared_get(zone->master,
+			zone->zone_options->pattern->outgoing_interface);
 	xfrd_setup_packet(xfrd->packet, TYPE_IXFR, CLASS_IN, zone->apex,
-		qid_generate(), &apex_compress);
+		(s?xfrd_udp_shared_qid(s):qid_generate()), &apex_compress);
 	zone->query_id = ID(xfrd->packet);
 	xfrd_prepare_zone_xfr(zone, TYPE_IXFR);
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "sent query with ID %d", zone->query_id));
@@ -1924,7 +2720,11 @@ xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 	buffer_flip(xfrd->packet);
 	xfrd_set_timer(zone, XFRD_UDP_TIMEOUT);
 
-	if((fd = xfrd_send_udp(zone->master, xfrd->packet,
+	if(s) {
+		xfrd_udp_shared_add(s, zone);
+		xfrd_udp_shared_send(s, zone->master, xfrd->packet);
+		fd = s->fd;
+	} else if((fd = xfrd_send_udp(zone->master, xfrd->packet,
 		zone->zone_options->pattern->outgoing_interface)) == -1)
 		return -1;
 
@@ -1973,15 +2773,13 @@ static int xfrd_parse_soa_info(buffer_type* packet, xfrd_soa_type* soa)
  */
 static int
 xfrd_xfr_check_rrs(xfrd_zone_type* zone, buffer_type* packet, size_t count,
-	int *done, xfrd_soa_type* soa, region_type* temp)
+	int *done, xfrd_soa_type* soa)
 {
 	/* first RR has already been checked */
 	uint32_t tmp_serial = 0;
 	uint16_t type, rrlen;
 	size_t i, soapos, mempos;
-	const dname_type* dname;
-	domain_table_type* owners;
-	rdata_atom_type* rdatas;
+	uint8_t dname[MAXDOMAINLEN+1];
 
 	for(i=0; i<count; ++i,++zone->latest_xfr->msg_rr_count)
 	{
@@ -1990,11 +2788,9 @@ xfrd_xfr_check_rrs(xfrd_zone_type* zone, buffer_type* packet, size_t count,
 				"trailing garbage", zone->apex_str));
 			return 0;
 		}
-		region_free_all(temp);
-		owners = domain_table_create(temp);
-		/* check the dname for errors */
-		dname = dname_make_from_packet(temp, packet, 1, 1);
-		if(!dname) {
+		/* check the dname for errors, the RRs are checked without
+		 * allocations, they are parsed when the transfer is applied */
+		if(!dname_make_wire_from_packet(dname, packet, 1)) {
 			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
 				"to parse owner name", zone->apex_str));
 			return 0;
@@ -2015,8 +2811,7 @@ xfrd_xfr_check_rrs(xfrd_zone_type* zone, buffer_type* packet, size_t count,
 			return 0;
 		}
 		mempos = buffer_position(packet);
-		if(rdata_wireformat_to_rdata_atoms(temp, owners, type, rrlen,
-			packet, &rdatas) == -1) {
+		if(!rdata_wireformat_check(type, rrlen, packet)) {
 			DEBUG(DEBUG_XFRD,1, (LOG_ERR, "xfrd: zone %s xfr unable "
 				"to parse rdata", zone->apex_str));
 			return 0;
@@ -2340,8 +3135,7 @@ xfrd_parse_received_xfr_packet(xfrd_zone_type* zone, buffer_type* packet,
 		return xfrd_packet_tcp;
 	}
 
-	if(!xfrd_xfr_check_rrs(zone, packet, ancount_todo, &done, soa,
-		tempregion))
+	if(!xfrd_xfr_check_rrs(zone, packet, ancount_todo, &done, soa))
 	{
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s sent bad xfr "
 					       			   "reply.", zone->apex_str));
@@ -2375,6 +3169,30 @@ xfrd_pretty_time(time_t v)
 	return buf;
 }
 
+/* the zone gets its first transfer, add it to the xfr_zones list */
+static void
+xfrd_xfr_zones_add(xfrd_zone_type *zone)
+{
+	zone->xfr_zones_prev = NULL;
+	zone->xfr_zones_next = xfrd->xfr_zones;
+	if(xfrd->xfr_zones)
+		xfrd->xfr_zones->xfr_zones_prev = zone;
+	xfrd->xfr_zones = zone;
+}
+
+/* the zone has no transfers left, remove it from the xfr_zones list */
+static void
+xfrd_xfr_zones_remove(xfrd_zone_type *zone)
+{
+	if(zone->xfr_zones_prev)
+		zone->xfr_zones_prev->xfr_zones_next = zone->xfr_zones_next;
+	else	xfrd->xfr_zones = zone->xfr_zones_next;
+	if(zone->xfr_zones_next)
+		zone->xfr_zones_next->xfr_zones_prev = zone->xfr_zones_prev;
+	zone->xfr_zones_next = NULL;
+	zone->xfr_zones_prev = NULL;
+}
+
 static void
 xfrd_free_zone_xfr(xfrd_zone_type *zone, xfrd_xfr_type *xfr)
 {
@@ -2382,6 +3200,7 @@ xfrd_free_zone_xfr(xfrd_zone_type *zone, xfrd_xfr_type *xfr)
 		assert(xfr->next == NULL);
 		if((zone->latest_xfr = xfr->prev) != NULL)
 			zone->latest_xfr->next = NULL;
+		else	xfrd_xfr_zones_remove(zone);
 	} else {
 		if(xfr->next != NULL)
 			xfr->next->prev = xfr->prev;
@@ -2414,6 +3233,8 @@ xfrd_prepare_zone_xfr(xfrd_zone_type *zone, uint16_t query_type)
 	xfr = region_alloc_zero(xfrd->region, sizeof(*xfr));
 	if((xfr->prev = zone->latest_xfr) != NULL) {
 		xfr->prev->next = xfr;
+	} else {
+		xfrd_xfr_zones_add(zone);
 	}
 	tsig_create_record_custom(&xfr->tsig, NULL, 0, 0, 4);
 	zone->latest_xfr = xfr;
@@ -2622,7 +3443,7 @@ void
 xfrd_handle_notify_and_start_xfr(xfrd_zone_type* zone, xfrd_soa_type* soa)
 {
 	if(xfrd_handle_incoming_notify(zone, soa)) {
-		if(zone->zone_handler.ev_fd == -1 && zone->tcp_conn == -1 &&
+		if(!XFRD_ZONE_IN_UDP(zone) && zone->tcp_conn == -1 &&
 			!zone->tcp_waiting && !zone->udp_waiting) {
 			xfrd_set_refresh_now(zone);
 		}
@@ -2675,6 +3496,19 @@ xfrd_handle_passed_packet(buffer_type* packet,
 			xfrd_parse_soa_info(packet, &soa)) {
 				have_soa = 1;
 		}
+		/* a transfer is in flight for this serial or a newer one, the
+		 * notify is a duplicate, do not move to another primary */
+		if(have_soa && (zone->tcp_conn != -1 ||
+			XFRD_ZONE_IN_UDP(zone) || zone->tcp_waiting ||
+			zone->udp_waiting) && zone->soa_notified_acquired &&
+			zone->soa_notified.serial != 0 &&
+			compare_serial(ntohl(soa.serial),
+			ntohl(zone->soa_notified.serial)) <= 0) {
+			DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s notify "
+				"serial %u is in transfer already",
+				zone->apex_str, (unsigned)ntohl(soa.serial)));
+			return;
+		}
 		xfrd_handle_notify_and_start_xfr(zone, have_soa?&soa:NULL);
 		/* First, see if our notifier has a match in provide-xfr */
 		if (acl_find_num(zone->zone_options->pattern->request_xfr,
@@ -2707,6 +3541,7 @@ xfrd_handle_incoming_notify(xfrd_zone_type* zone, xfrd_soa_type* soa)
 			(unsigned)ntohl(zone->soa_disk.serial)));
 		return 0; /* ignore notify with old serial, we have a valid zone */
 	}
+	XFRD_STATE_CHANGED(zone);
 	if(soa == 0) {
 		zone->soa_notified.serial = 0;
 	}
@@ -2753,12 +3588,13 @@ xfrd_check_failed_updates(void)
 	xfrd_zone_type* zone;
 	xfrd_xfr_type* xfr;
 	xfrd_xfr_type* prev_xfr;
+	xfrd_zone_type* next;
 	uint8_t sent = (xfrd->nsd->mytask == 0) + 1;
-	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones)
+	/* the zones without updates are not in the list */
+	for(zone = xfrd->xfr_zones; zone; zone = next)
 	{
-		/* skip zones without updates */
-		if(!zone->latest_xfr)
-			continue;
+		/* the deletes below can take the zone out of the list */
+		next = zone->xfr_zones_next;
 		xfr = zone->latest_xfr;
 		while(!xfr->sent && xfr->prev) {
 			xfr = xfr->prev;
@@ -2820,7 +3656,7 @@ xfrd_prepare_zones_for_reload(void)
 
 	send = 1;
 	reload = 0;
-	RBTREE_FOR(zone, xfrd_zone_type*, xfrd->zones)
+	for(zone = xfrd->xfr_zones; zone; zone = zone->xfr_zones_next)
 	{
 		xfr = zone->latest_xfr;
 		while(xfr) {
@@ -2861,15 +3697,47 @@ xfrd_get_temp_buffer()
 	return xfrd->packet;
 }
 
+/** process zone mem task, store the memory use of the zone */
+static void
+xfrd_process_zone_mem_task(xfrd_state_type* xfrd, struct task_list_d* task)
+{
+	struct notify_zone* nz = (struct notify_zone*)rbtree_search(
+		xfrd->notify_zones, task->zname);
+	if(!nz || task->size < sizeof(struct task_list_d) +
+		dname_total_size(task->zname) + sizeof(struct zone_mem_usage))
+		return;
+	if(!nz->mem)
+		nz->mem = (struct zone_mem_usage*)region_alloc(xfrd->region,
+			sizeof(*nz->mem));
+	memmove(nz->mem, (uint8_t*)task->zname + dname_total_size(
+		task->zname), sizeof(*nz->mem));
+}
+
+/** process reload stats task, store the timing of the reload */
+static void
+xfrd_process_reload_stats_task(xfrd_state_type* xfrd,
+	struct task_list_d* task)
+{
+	if(task->size < sizeof(struct task_list_d) +
+		sizeof(struct reload_stats))
+		return;
+	if(!xfrd->reload_stats)
+		xfrd->reload_stats = (struct reload_stats*)region_alloc(
+			xfrd->region, sizeof(*xfrd->reload_stats));
+	memmove(xfrd->reload_stats, task->zname, sizeof(*xfrd->reload_stats));
+}
+
 #ifdef USE_ZONE_STATS
 /** process zonestat inc task */
 static void
 xfrd_process_zonestat_inc_task(xfrd_state_type* xfrd, struct task_list_d* task)
 {
 	xfrd->zonestat_safe = (unsigned)task->oldserial;
-	zonestat_remap(xfrd->nsd, 0, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 0, xfrd->zonestat_safe*
+		xfrd->nsd->child_count*sizeof(struct nsdst));
 	xfrd->nsd->zonestatsize[0] = xfrd->zonestat_safe;
-	zonestat_remap(xfrd->nsd, 1, xfrd->zonestat_safe*sizeof(struct nsdst));
+	zonestat_remap(xfrd->nsd, 1, xfrd->zonestat_safe*
+		xfrd->nsd->child_count*sizeof(struct nsdst));
 	xfrd->nsd->zonestatsize[1] = xfrd->zonestat_safe;
 }
 #endif /* USE_ZONE_STATS */
@@ -2884,6 +3752,12 @@ xfrd_handle_taskresult(xfrd_state_type* xfrd, struct task_list_d* task)
 	case task_soa_info:
 		xfrd_process_soa_info_task(task);
 		break;
+	case task_zone_mem:
+		xfrd_process_zone_mem_task(xfrd, task);
+		break;
+	case task_reload_stats:
+		xfrd_process_reload_stats_task(xfrd, task);
+		break;
 #ifdef USE_ZONE_STATS
 	case task_zonestat_inc:
 		xfrd_process_zonestat_inc_task(xfrd, task);
@@ -2919,7 +3793,9 @@ void xfrd_process_task_result(xfrd_state_type* xfrd, struct udb_base* taskudb)
 void xfrd_set_reload_now(xfrd_state_type* xfrd)
 {
 #ifdef HAVE_SYSTEMD
-	sd_notify(0, "RELOADING=1");
+	/* once, when bulk changes call this for every zone */
+	if(!xfrd->need_to_send_reload)
+		sd_notify(0, "RELOADING=1");
 #endif
 	xfrd->need_to_send_reload = 1;
 	if(!(xfrd->ipc_handler_flags&EV_WRITE)) {
@@ -2965,6 +3841,58 @@ static void xfrd_write_timer_set()
 		log_msg(LOG_ERR, "xfrd write timer: event_add failed");
 }
 
+static void
+xfrd_handle_journal_timer(int ATTR_UNUSED(fd), short event,
+	void* ATTR_UNUSED(arg))
+{
+	/* timeout to append the changed zone state to the journal */
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	xfrd_write_state_journal(xfrd);
+	xfrd_journal_timer_set();
+}
+
+static void xfrd_journal_timer_set()
+{
+	struct timeval tv;
+	tv.tv_sec = xfrd->nsd->options->xfrd_state_journal;
+	tv.tv_usec = 0;
+	memset(&xfrd->journal_timer, 0, sizeof(xfrd->journal_timer));
+	event_set(&xfrd->journal_timer, -1, EV_TIMEOUT,
+		xfrd_handle_journal_timer, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->journal_timer) != 0)
+		log_msg(LOG_ERR, "xfrd journal timer: event_base_set failed");
+	if(event_add(&xfrd->journal_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd journal timer: event_add failed");
+}
+
+#ifdef HAVE_SSL
+static void
+xfrd_handle_tls_ticket_timer(int ATTR_UNUSED(fd), short event,
+	void* ATTR_UNUSED(arg))
+{
+	/* timeout for a new session ticket key */
+	assert(event & EV_TIMEOUT);
+	(void)event;
+	server_tls_ticket_keys_rotate(xfrd->nsd);
+	xfrd_tls_ticket_timer_set();
+}
+
+static void xfrd_tls_ticket_timer_set()
+{
+	struct timeval tv;
+	tv.tv_sec = xfrd->nsd->options->tls_session_ticket_rotate;
+	tv.tv_usec = 0;
+	memset(&xfrd->tls_ticket_timer, 0, sizeof(xfrd->tls_ticket_timer));
+	event_set(&xfrd->tls_ticket_timer, -1, EV_TIMEOUT,
+		xfrd_handle_tls_ticket_timer, xfrd);
+	if(event_base_set(xfrd->event_base, &xfrd->tls_ticket_timer) != 0)
+		log_msg(LOG_ERR, "xfrd tls ticket timer: event_base_set failed");
+	if(event_add(&xfrd->tls_ticket_timer, &tv) != 0)
+		log_msg(LOG_ERR, "xfrd tls ticket timer: event_add failed");
+}
+#endif /* HAVE_SSL */
+
 static void xfrd_handle_child_timer(int ATTR_UNUSED(fd), short event,
 	void* ATTR_UNUSED(arg))
 {
@@ -33,7 +33,9 @@ struct buffer;
 struct xfrd_tcp;
 struct xfrd_tcp_set;
 struct notify_zone;
+struct notify_pkt;
 struct udb_ptr;
+struct xfrd_udp_shared;
 typedef struct xfrd_state xfrd_state_type;
 typedef struct xfrd_xfr xfrd_xfr_type;
 typedef struct xfrd_zone xfrd_zone_type;
@@ -42,6 +44,16 @@ typedef struct xfrd_soa xfrd_soa_type;
  * The global state for the xfrd daemon process.
  * The time_t times are epochs in secs since 1970, absolute times.
  */
+/* the timer wheel has levels of slots, XFRD_WHEEL_BITS is the log2 of
+ * the number of slots for a level */
+#define XFRD_WHEEL_BITS 8
+#define XFRD_WHEEL_SIZE (1<<XFRD_WHEEL_BITS)
+#define XFRD_WHEEL_MASK (XFRD_WHEEL_SIZE-1)
+#define XFRD_WHEEL_LEVELS 3
+/* the maximum number of zone timeouts handled per second, more are
+ * spread out over the next seconds */
+#define XFRD_WHEEL_TICK_MAX 1000
+
 struct xfrd_state {
 	/* time when daemon was last started */
 	time_t xfrd_start_time;
@@ -56,18 +68,39 @@ struct xfrd_state {
 	struct xfrd_zone *udp_waiting_first, *udp_waiting_last;
 	/* number of udp sockets (for sending queries) in use */
 	size_t udp_use_num;
+	/* the udp sockets shared by the zones, with xfrd-udp-sockets */
+	struct xfrd_udp_shared* udp_shared;
+	/* receive buffers for the shared udp sockets, or NULL */
+	uint8_t* udp_shared_buf;
 	/* activated waiting list, double linked list */
 	struct xfrd_zone *activated_first;
+	/* zones with an expire state change for the next reload, linked
+	 * by expire_pending_next */
+	struct xfrd_zone *expire_pending_first;
 
 	/* current time is cached */
 	uint8_t got_time;
 	time_t current_time;
 
+	/* timer wheel for the zone timeouts that do not wait on a socket,
+	 * levels of slots of one second, 256 seconds and 65536 seconds */
+	struct xfrd_zone* wheel[XFRD_WHEEL_LEVELS][XFRD_WHEEL_SIZE];
+	/* zones that were due, but did not fit in the last tick */
+	struct xfrd_zone* wheel_pending;
+	/* the second up to which the wheel is processed */
+	time_t wheel_time;
+	/* the number of zones in the wheel, and the tick event */
+	size_t wheel_count;
+	struct event wheel_timer;
+	int wheel_timer_added;
+
 	/* counter for xfr file numbers */
 	uint64_t xfrfilenumber;
 
 	/* the zonestat array size that we last saw and is safe to use */
 	unsigned zonestat_safe;
+	/* the timing of the last reload, or NULL if none yet */
+	struct reload_stats* reload_stats;
 	/* size currently of the clear array */
 	size_t zonestat_clear_num;
 	/* array of malloced entries with cumulative cleared stat values */
@@ -93,6 +126,23 @@ struct xfrd_state {
 	struct event write_timer;
 	/* set to 1 if zones have received xfrs since the last write_timer */
 	int write_zonefile_needed;
+#ifdef HAVE_SSL
+	/* timeout event for the rotation of the TLS session ticket keys */
+	struct event tls_ticket_timer;
+#endif
+	/* timeout event for the end of a batch of catalog producer member
+	 * changes, and set when it is added or when the batch is done */
+	struct event catalog_producer_timer;
+	int catalog_producer_timer_added;
+	int catalog_producer_batch_done;
+	/* timeout event for appending zone state changes to the journal */
+	struct event journal_timer;
+	/* set to 1 if zones have changed state since the journal write */
+	int state_dirty;
+	/* filetime of the state file that the journal follows */
+	uint32_t state_filetime;
+	/* number of records in the journal */
+	size_t state_journal_count;
 
 	/* communication channel with server_main */
 	struct event ipc_handler;
@@ -116,6 +166,9 @@ struct xfrd_state {
 
 	/* tree of zones, by apex name, contains notify_zone*. All zones. */
 	rbtree_type *notify_zones;
+	/* list of the zones with transfers, that the reload tasks are made
+	 * for, so that the zones without a transfer are not walked */
+	xfrd_zone_type *xfr_zones;
 	/* number of notify_zone active using UDP socket */
 	int notify_udp_num;
 	/* first and last notify_zone* entries waiting for a UDP socket */
@@ -195,6 +248,14 @@ struct xfrd_zone {
 	struct event zone_handler;
 	int zone_handler_flags;
 	int event_added;
+	/* the state changed since it was written to the journal */
+	uint8_t state_dirty;
+	/* if there is no socket, the timeout is in the timer wheel, in the
+	 * list at wheel_head, due at wheel_due */
+	uint8_t in_wheel;
+	time_t wheel_due;
+	struct xfrd_zone** wheel_head;
+	struct xfrd_zone* wheel_next, *wheel_prev;
 
 	/* tcp connection zone is using, or -1 */
 	int tcp_conn;
@@ -203,6 +264,12 @@ struct xfrd_zone {
 	/* next zone in waiting list */
 	xfrd_zone_type* tcp_waiting_next;
 	xfrd_zone_type* tcp_waiting_prev;
+	/* number of zones with a higher transfer-priority that went before
+	 * this zone in the waiting list */
+	uint8_t tcp_waiting_passed;
+	/* zone is in the expire_pending list */
+	uint8_t expire_pending;
+	xfrd_zone_type* expire_pending_next;
 	/* zone is in its tcp send queue */
 	uint8_t in_tcp_send;
 	/* next zone in tcp send queue */
@@ -213,6 +280,10 @@ struct xfrd_zone {
 	/* next zone in waiting list for UDP */
 	xfrd_zone_type* udp_waiting_next;
 	xfrd_zone_type* udp_waiting_prev;
+	/* shared udp socket the zone waits for an answer on, or NULL,
+	 * next zone in the query ID hash list of that socket */
+	struct xfrd_udp_shared* udp_shared;
+	xfrd_zone_type* udp_shared_next;
 	/* zone has been activated to run now (after the other events
 	 * but before blocking in select again) */
 	uint8_t is_activated;
@@ -223,6 +294,9 @@ struct xfrd_zone {
 	/* query id */
 	uint16_t query_id;
 	xfrd_xfr_type *latest_xfr;
+	/* in the xfr_zones list of xfrd, if latest_xfr is set */
+	xfrd_zone_type* xfr_zones_next;
+	xfrd_zone_type* xfr_zones_prev;
 
 	int multi_master_first_master; /* >0: first check master_num */
 	int multi_master_update_check; /* -1: not update >0: last update master_num */
@@ -269,6 +343,9 @@ enum xfrd_packet_result {
 */
 #define XFRD_MAX_UDP 128 /* max number of UDP sockets at a time for IXFR */
 #define XFRD_MAX_UDP_NOTIFY 128 /* max concurrent UDP sockets for NOTIFY */
+#define XFRD_UDP_SHARED_WAIT 256 /* max queries waiting on a shared socket */
+#define XFRD_UDP_SHARED_USES 4096 /* queries before a shared socket is
+				     replaced, for a new random port */
 
 #define XFRD_TRANSFER_TIMEOUT_START 10 /* empty zone timeout is between x and 2*x seconds */
 #define XFRD_TRANSFER_TIMEOUT_MAX 86400 /* empty zone timeout max expbackoff */
@@ -361,6 +438,10 @@ bound_soa_nsd_expire(xfrd_zone_type* zone)
 
 extern xfrd_state_type* xfrd;
 
+/* note that the state of the zone changed, for the state journal */
+#define XFRD_STATE_CHANGED(zone) do { (zone)->state_dirty = 1; \
+	xfrd->state_dirty = 1; } while(0)
+
 /* start xfrd, new start. Pass socket to server_main. */
 void xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 	pid_t nsd_pid);
@@ -420,6 +501,30 @@ int xfrd_udp_read_packet(buffer_type* packet, int fd, struct sockaddr* src,
  */
 void xfrd_udp_release(xfrd_zone_type* zone);
 
+/*
+ * Get the shared udp socket for a query to dest, from the outgoing
+ * interfaces, with xfrd-udp-sockets. It is the one with the fewest waiting
+ * queries, or a new one while there are fewer than xfrd-udp-sockets.
+ * Returns NULL if it cannot be created, the query has a socket of its own.
+ */
+struct xfrd_udp_shared* xfrd_udp_shared_get(struct acl_options* dest,
+	struct acl_options* ifc);
+/* a query ID that no query waits for on the shared socket */
+uint16_t xfrd_udp_shared_qid(struct xfrd_udp_shared* s);
+/* queue the query in the packet to dest on the shared socket */
+void xfrd_udp_shared_send(struct xfrd_udp_shared* s, struct acl_options* dest,
+	buffer_type* packet);
+/* the notify packet waits for its answer on the shared socket, by its ID */
+void xfrd_udp_shared_add_notify(struct xfrd_udp_shared* s,
+	struct notify_pkt* pkt);
+/* the notify packet no longer waits for an answer on the shared socket */
+void xfrd_udp_shared_remove_notify(struct notify_pkt* pkt);
+
+/* if the zone waits for the answer to a udp query, on a socket of its own
+ * or on a shared one */
+#define XFRD_ZONE_IN_UDP(zone) ((zone)->zone_handler.ev_fd != -1 || \
+	(zone)->udp_shared != NULL)
+
 /*
  * Get a static buffer for temporary use (to build a packet).
  */
@@ -476,6 +581,8 @@ void xfrd_set_reload_now(xfrd_state_type* xfrd);
 
 /* send expiry notifications to nsd */
 void xfrd_send_expire_notification(xfrd_zone_type* zone);
+/* put the expire state changes in one task, before the reload */
+void xfrd_flush_expire_notifications(void);
 
 /* handle incoming notify (soa or NULL) and start zone xfr if necessary */
 void xfrd_handle_notify_and_start_xfr(xfrd_zone_type* zone, xfrd_soa_type* soa);
@@ -242,6 +242,8 @@ int32_t zonec_accept(
 		rrset->zone = state->zone;
 		rrset->rr_count = 0;
 		rrset->rrs = region_alloc(state->database->region, sizeof(*rr));
+		rrset->wire = NULL;
+		rrset->type = type;
 
 		switch (type) {
 			case TYPE_CNAME:
@@ -277,14 +279,8 @@ int32_t zonec_accept(
 			if (zrdatacmp(type, rdatas, rdata_count, &rrset->rrs[i]) != 0)
 				continue;
 			/* Discard the duplicates... */
-			for (size_t j = 0; j < (size_t)rdata_count; j++) {
-				size_t size;
-				if (rdata_atom_is_domain(type, j))
-					continue;
-				size = rdata_atom_size(rdatas[j]) + sizeof(uint16_t);
-				region_recycle(state->database->region, rdatas[j].data, size);
-			}
-			region_recycle(state->database->region, rdatas, sizeof(*rdatas) * rdata_count);
+			region_recycle(state->database->region, rdatas,
+				rdata_atoms_size(type, rdata_count, rdatas));
 			region_free_all(state->rr_region);
 			return 0;
 		}
@@ -301,6 +297,7 @@ int32_t zonec_accept(
 		}
 
 		/* Add it... */
+		rrset_wire_free(state->database->region, rrset);
 		rrs = rrset->rrs;
 		rrset->rrs = region_alloc_array(state->database->region, rrset->rr_count + 1, sizeof(*rr));
 		memcpy(rrset->rrs, rrs, rrset->rr_count * sizeof(*rr));
@@ -309,7 +306,8 @@ int32_t zonec_accept(
 
 	rr = &rrset->rrs[rrset->rr_count++];
 	rr->owner = domain;
-	rr->rdatas = rdatas;
+	rr->rdatas = namedb_rdata_share(state->database, type, rdata_count,
+		rdatas);
 	rr->ttl = ttl;
 	rr->type = type;
 	rr->klass = class;
@@ -456,6 +454,9 @@ zonec_read(
 	if(!zone_is_slave(zone->opts) && !check_dname(zone))
 		state.errors++;
 
+	/* precompile the wire format of the rrsets for answers */
+	zone_wire_build(database, zone);
+
 	region_destroy(state.rr_region);
 	return state.errors;
 }
@@ -480,6 +481,8 @@ apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
 			zone->soa_nx_rrset->zone = zone;
 			zone->soa_nx_rrset->rrs = region_alloc(db->region,
 				sizeof(rr_type));
+			zone->soa_nx_rrset->wire = NULL;
+			zone->soa_nx_rrset->type = TYPE_SOA;
 		}
 		memcpy(zone->soa_nx_rrset->rrs, rrset->rrs, sizeof(rr_type));
 